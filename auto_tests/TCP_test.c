@@ -405,6 +405,108 @@ static void test_some(void)
     mono_time_free(mono_time);
 }
 
+#define NUM_THREADED_CONS 16
+#define NUM_TCP_THREADS 4
+
+static void test_some_threaded(void)
+{
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+    const Random *rng = system_random();
+    ck_assert(rng != nullptr);
+    Logger *logger = logger_new();
+    const Network *ns = system_network();
+
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(rng, self_public_key, self_secret_key);
+    TCP_Server *tcp_s = new_TCP_server_ex(logger, rng, ns, USE_IPV6, NUM_PORTS, ports, self_secret_key, nullptr, nullptr,
+                                          NUM_TCP_THREADS);
+    ck_assert_msg(tcp_s != nullptr, "Failed to create threaded TCP relay server");
+    ck_assert_msg(tcp_server_listen_count(tcp_s) == NUM_PORTS, "Failed to bind to all ports.");
+
+    // The kernel spreads the connections over the shards, so most of the
+    // pairs below end up on different worker threads.
+    struct sec_TCP_con *cons[NUM_THREADED_CONS];
+
+    for (uint32_t i = 0; i < NUM_THREADED_CONS; ++i) {
+        cons[i] = new_TCP_con(logger, rng, ns, tcp_s, mono_time);
+    }
+
+    uint8_t requ_p[1 + CRYPTO_PUBLIC_KEY_SIZE];
+    requ_p[0] = TCP_PACKET_ROUTING_REQUEST;
+
+    for (uint32_t i = 0; i < NUM_THREADED_CONS; ++i) {
+        memcpy(requ_p + 1, cons[i ^ 1]->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+        write_packet_TCP_test_connection(logger, cons[i], requ_p, sizeof(requ_p));
+    }
+
+    do_TCP_server_delay(tcp_s, mono_time, 50);
+
+    uint8_t data[2048];
+
+    for (uint32_t i = 0; i < NUM_THREADED_CONS; ++i) {
+        int len = read_packet_sec_TCP(logger, cons[i], data, 2 + 1 + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_MAC_SIZE);
+        ck_assert_msg(len == 1 + 1 + CRYPTO_PUBLIC_KEY_SIZE, "Wrong response packet length of %d.", len);
+        ck_assert_msg(data[0] == TCP_PACKET_ROUTING_RESPONSE, "Wrong response packet id of %d.", data[0]);
+        ck_assert_msg(data[1] == 16, "Server refused routing request of connection %u.", i);
+        ck_assert_msg(pk_equal(data + 2, cons[i ^ 1]->public_key), "Key in response packet wrong.");
+
+        len = read_packet_sec_TCP(logger, cons[i], data, 2 + 2 + CRYPTO_MAC_SIZE);
+        ck_assert_msg(len == 2, "wrong len %d", len);
+        ck_assert_msg(data[0] == TCP_PACKET_CONNECTION_NOTIFICATION, "wrong packet id %u", data[0]);
+        ck_assert_msg(data[1] == 16, "wrong peer id %u", data[1]);
+    }
+
+    uint8_t test_packet[512] = {16, 17, 16, 86, 99, 127, 255, 189, 78};
+
+    for (uint32_t i = 0; i < NUM_THREADED_CONS; ++i) {
+        test_packet[1] = i;
+        write_packet_TCP_test_connection(logger, cons[i], test_packet, sizeof(test_packet));
+    }
+
+    do_TCP_server_delay(tcp_s, mono_time, 50);
+
+    for (uint32_t i = 0; i < NUM_THREADED_CONS; ++i) {
+        const int len = read_packet_sec_TCP(logger, cons[i], data, 2 + sizeof(test_packet) + CRYPTO_MAC_SIZE);
+        ck_assert_msg(len == sizeof(test_packet), "wrong len %d", len);
+        test_packet[1] = i ^ 1;
+        ck_assert_msg(memcmp(data, test_packet, sizeof(test_packet)) == 0, "packet is wrong %u %u %u %u", data[0], data[1],
+                      data[sizeof(test_packet) - 2], data[sizeof(test_packet) - 1]);
+    }
+
+    // Out of band packets are routed by key, across shards as well.
+    uint8_t oob_packet[1 + CRYPTO_PUBLIC_KEY_SIZE + 8] = {TCP_PACKET_OOB_SEND};
+    memcpy(oob_packet + 1, cons[1]->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    write_packet_TCP_test_connection(logger, cons[2], oob_packet, sizeof(oob_packet));
+
+    do_TCP_server_delay(tcp_s, mono_time, 50);
+
+    int len = read_packet_sec_TCP(logger, cons[1], data, 2 + 1 + CRYPTO_PUBLIC_KEY_SIZE + 8 + CRYPTO_MAC_SIZE);
+    ck_assert_msg(len == 1 + CRYPTO_PUBLIC_KEY_SIZE + 8, "wrong len %d", len);
+    ck_assert_msg(data[0] == TCP_PACKET_OOB_RECV, "wrong packet id %u", data[0]);
+    ck_assert_msg(pk_equal(data + 1, cons[2]->public_key), "wrong OOB sender key");
+
+    // Dropping a route tells the other end, wherever it lives.
+    const uint8_t disconnect_packet[2] = {TCP_PACKET_DISCONNECT_NOTIFICATION, 16};
+    write_packet_TCP_test_connection(logger, cons[0], disconnect_packet, sizeof(disconnect_packet));
+
+    do_TCP_server_delay(tcp_s, mono_time, 50);
+
+    len = read_packet_sec_TCP(logger, cons[1], data, 2 + 2 + CRYPTO_MAC_SIZE);
+    ck_assert_msg(len == 2, "wrong len %d", len);
+    ck_assert_msg(data[0] == TCP_PACKET_DISCONNECT_NOTIFICATION, "wrong packet id %u", data[0]);
+    ck_assert_msg(data[1] == 16, "wrong peer id %u", data[1]);
+
+    kill_TCP_server(tcp_s);
+
+    for (uint32_t i = 0; i < NUM_THREADED_CONS; ++i) {
+        kill_TCP_con(cons[i]);
+    }
+
+    logger_kill(logger);
+    mono_time_free(mono_time);
+}
+
 static int response_callback_good;
 static uint8_t response_callback_connection_id;
 static uint8_t response_callback_public_key[CRYPTO_PUBLIC_KEY_SIZE];
@@ -888,6 +990,7 @@ static void TCP_suite(void)
 {
     test_basic();
     test_some();
+    test_some_threaded();
     test_client();
     test_client_invalid();
     test_tcp_connection();
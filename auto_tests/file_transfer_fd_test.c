@@ -0,0 +1,250 @@
+/* Auto Tests: Send files that core reads itself from a file descriptor or memory,
+ * and receive files that core writes itself to a file descriptor.
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../testing/misc_tools.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "auto_test_support.h"
+#include "check_compat.h"
+
+#define NUM_TOXES 2
+#define FILE_SIZE (3 * 1024 * 1024 + 17)
+#define PROGRESS_INTERVAL (1024 * 1024)
+
+typedef struct State {
+    uint8_t *received;
+    uint64_t received_length;
+    uint32_t kind;
+    bool recv_done;
+    uint32_t chunk_requests;
+    uint32_t final_chunk_requests;
+    FILE *recv_file;
+    uint32_t progress_events;
+    uint64_t progress;
+} State;
+
+static void handle_file_recv(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t kind,
+                             uint64_t file_size, const uint8_t *filename, size_t filename_length, void *user_data)
+{
+    State *state = (State *)user_data;
+    ck_assert(kind == state->kind);
+    ck_assert(file_size == FILE_SIZE);
+
+    if (state->recv_file != nullptr) {
+        Tox_Err_File_Recv_To_Fd err_fd;
+        tox_file_recv_to_fd(tox, friend_number, file_number, fileno(state->recv_file), PROGRESS_INTERVAL, true, &err_fd);
+        ck_assert_msg(err_fd == TOX_ERR_FILE_RECV_TO_FD_OK, "failed to set receive fd: %d", err_fd);
+    }
+
+    Tox_Err_File_Control err;
+    tox_file_control(tox, friend_number, file_number, TOX_FILE_CONTROL_RESUME, &err);
+    ck_assert_msg(err == TOX_ERR_FILE_CONTROL_OK, "failed to accept file: %d", err);
+}
+
+static void handle_file_recv_chunk(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                   const uint8_t *data, size_t length, void *user_data)
+{
+    State *state = (State *)user_data;
+
+    if (length == 0) {
+        state->recv_done = true;
+        return;
+    }
+
+    ck_assert_msg(state->recv_file == nullptr, "got a chunk for a file written by core");
+
+    if (state->kind == TOX_FILE_KIND_FTV2) {
+        // FTv2 chunks start with the file id.
+        ck_assert(length > TOX_FILE_ID_LENGTH);
+        data += TOX_FILE_ID_LENGTH;
+        length -= TOX_FILE_ID_LENGTH;
+    }
+
+    ck_assert_msg(position + length <= FILE_SIZE, "chunk at %lu past the end of the file", (unsigned long)position);
+    memcpy(state->received + position, data, length);
+
+    if (position + length > state->received_length) {
+        state->received_length = position + length;
+    }
+}
+
+static void handle_file_chunk_request(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                      size_t length, void *user_data)
+{
+    State *state = (State *)user_data;
+
+    if (length == 0) {
+        ++state->final_chunk_requests;
+    } else {
+        ++state->chunk_requests;
+    }
+}
+
+static void handle_file_recv_progress(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t bytes_written,
+                                      void *user_data)
+{
+    State *state = (State *)user_data;
+    ck_assert(!state->recv_done);
+    ck_assert_msg(bytes_written > state->progress, "progress went from %lu to %lu",
+                  (unsigned long)state->progress, (unsigned long)bytes_written);
+    state->progress = bytes_written;
+    ++state->progress_events;
+}
+
+static void iterate_all(Tox **toxes, State *states)
+{
+    for (uint32_t i = 0; i < NUM_TOXES; ++i) {
+        tox_iterate(toxes[i], &states[i]);
+    }
+
+    c_sleep(1);
+}
+
+static void send_and_check(Tox **toxes, State *states, uint32_t kind, const uint8_t *contents, FILE *file,
+                           FILE *recv_file)
+{
+    memset(&states[0], 0, sizeof(State));
+    memset(&states[1], 0, sizeof(State));
+    states[1].received = (uint8_t *)calloc(1, FILE_SIZE);
+    states[1].kind = kind;
+    states[1].recv_file = recv_file;
+    ck_assert(states[1].received != nullptr);
+
+    const uint8_t filename[] = "file.bin";
+    Tox_Err_File_Send err;
+
+    if (file != nullptr) {
+        tox_file_send_fd(toxes[0], 0, kind, FILE_SIZE, nullptr, filename, sizeof(filename), fileno(file), &err);
+    } else {
+        tox_file_send_mmap(toxes[0], 0, kind, contents, FILE_SIZE, nullptr, filename, sizeof(filename), &err);
+    }
+
+    ck_assert_msg(err == TOX_ERR_FILE_SEND_OK, "failed to send file: %d", err);
+
+    while (!states[1].recv_done || states[0].final_chunk_requests == 0) {
+        iterate_all(toxes, states);
+    }
+
+    ck_assert_msg(states[0].chunk_requests == 0, "client was asked for %u chunks", states[0].chunk_requests);
+    ck_assert(states[0].final_chunk_requests == 1);
+
+    if (recv_file != nullptr) {
+        // Progress is reported every PROGRESS_INTERVAL bytes and at the end, which
+        // may be in the same chunk as the last interval.
+        ck_assert(states[1].progress == FILE_SIZE);
+        ck_assert_msg(states[1].progress_events >= FILE_SIZE / PROGRESS_INTERVAL
+                      && states[1].progress_events <= FILE_SIZE / PROGRESS_INTERVAL + 1, "%u progress events",
+                      states[1].progress_events);
+
+        rewind(recv_file);
+        ck_assert(fread(states[1].received, 1, FILE_SIZE, recv_file) == FILE_SIZE);
+        states[1].received_length = FILE_SIZE;
+    }
+    ck_assert(states[1].received_length == FILE_SIZE);
+    ck_assert_msg(memcmp(states[1].received, contents, FILE_SIZE) == 0, "file corrupted");
+
+    free(states[1].received);
+}
+
+static void test_file_transfer_fd(void)
+{
+    Tox *toxes[NUM_TOXES];
+    State states[NUM_TOXES] = {{nullptr}};
+    uint32_t index[NUM_TOXES];
+
+    for (uint32_t i = 0; i < NUM_TOXES; ++i) {
+        index[i] = i + 1;
+        toxes[i] = tox_new_log(nullptr, nullptr, &index[i]);
+        ck_assert_msg(toxes[i] != nullptr, "failed to create tox instance %u", i);
+        tox_callback_file_recv(toxes[i], handle_file_recv);
+        tox_callback_file_recv_chunk(toxes[i], handle_file_recv_chunk);
+        tox_callback_file_chunk_request(toxes[i], handle_file_chunk_request);
+        tox_callback_file_recv_progress(toxes[i], handle_file_recv_progress);
+    }
+
+    uint8_t pk[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(toxes[0], pk);
+    tox_bootstrap(toxes[1], "localhost", tox_self_get_udp_port(toxes[0], nullptr), pk, nullptr);
+
+    tox_self_get_public_key(toxes[0], pk);
+    tox_friend_add_norequest(toxes[1], pk, nullptr);
+
+    tox_self_get_public_key(toxes[1], pk);
+    tox_friend_add_norequest(toxes[0], pk, nullptr);
+
+    printf("waiting for the friend connection\n");
+
+    while (tox_friend_get_connection_status(toxes[0], 0, nullptr) == TOX_CONNECTION_NONE ||
+            tox_friend_get_connection_status(toxes[1], 0, nullptr) == TOX_CONNECTION_NONE) {
+        iterate_all(toxes, states);
+    }
+
+    Tox_Err_File_Send err;
+    tox_file_send_fd(toxes[0], 0, TOX_FILE_KIND_DATA, FILE_SIZE, nullptr, nullptr, 0, -1, &err);
+    ck_assert(err == TOX_ERR_FILE_SEND_BAD_SOURCE);
+    tox_file_send_fd(toxes[0], 0, TOX_FILE_KIND_DATA, UINT64_MAX, nullptr, nullptr, 0, 0, &err);
+    ck_assert(err == TOX_ERR_FILE_SEND_BAD_SOURCE);
+    tox_file_send_mmap(toxes[0], 0, TOX_FILE_KIND_DATA, nullptr, FILE_SIZE, nullptr, nullptr, 0, &err);
+    ck_assert(err == TOX_ERR_FILE_SEND_NULL);
+
+    Tox_Err_File_Recv_To_Fd err_fd;
+    tox_file_recv_to_fd(toxes[1], 0, 1 << 16, 0, 0, false, &err_fd);
+    ck_assert(err_fd == TOX_ERR_FILE_RECV_TO_FD_NOT_FOUND);
+
+    uint8_t *contents = (uint8_t *)malloc(FILE_SIZE);
+    ck_assert(contents != nullptr);
+
+    for (uint32_t i = 0; i < FILE_SIZE; ++i) {
+        contents[i] = (uint8_t)rand();
+    }
+
+    FILE *file = tmpfile();
+    ck_assert(file != nullptr);
+    ck_assert(fwrite(contents, 1, FILE_SIZE, file) == FILE_SIZE);
+    ck_assert(fflush(file) == 0);
+
+    FILE *recv_file = tmpfile();
+    ck_assert(recv_file != nullptr);
+
+    printf("sending file from a file descriptor\n");
+    send_and_check(toxes, states, TOX_FILE_KIND_DATA, contents, file, nullptr);
+
+    printf("sending FTv2 file from a file descriptor\n");
+    send_and_check(toxes, states, TOX_FILE_KIND_FTV2, contents, file, nullptr);
+
+    printf("sending file from memory\n");
+    send_and_check(toxes, states, TOX_FILE_KIND_DATA, contents, nullptr, nullptr);
+
+    printf("receiving file to a file descriptor\n");
+    send_and_check(toxes, states, TOX_FILE_KIND_DATA, contents, file, recv_file);
+
+    printf("receiving FTv2 file to a file descriptor\n");
+    ck_assert(ftruncate(fileno(recv_file), 0) == 0);
+    send_and_check(toxes, states, TOX_FILE_KIND_FTV2, contents, file, recv_file);
+
+    fclose(recv_file);
+    fclose(file);
+    free(contents);
+
+    for (uint32_t i = 0; i < NUM_TOXES; ++i) {
+        tox_kill(toxes[i]);
+    }
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    test_file_transfer_fd();
+    return 0;
+}
@@ -0,0 +1,229 @@
+/* Auto Tests: FTv2 transfers that core reads from a file descriptor continue
+ * after the friend went offline and came back in the middle of the transfer,
+ * also when core writes the received file to a file descriptor.
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "../testing/misc_tools.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "auto_test_support.h"
+#include "check_compat.h"
+
+#define TOX_COUNT 2
+#define FILE_SIZE (8 * 1024 * 1024 + 17)
+#define DISCONNECT_AFTER (1024 * 1024)
+
+typedef struct State {
+    uint8_t *received;
+    uint64_t received_length;
+    bool recv_done;
+    uint32_t final_chunk_requests;
+    FILE *recv_file;
+    uint32_t progress_events;
+    uint64_t progress;
+} State;
+
+static void handle_file_recv(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t kind,
+                             uint64_t file_size, const uint8_t *filename, size_t filename_length, void *user_data)
+{
+    ck_assert(kind == TOX_FILE_KIND_FTV2);
+    ck_assert(file_size == FILE_SIZE);
+
+    const AutoTox *autotox = (AutoTox *)user_data;
+    const State *state = (const State *)autotox->state;
+
+    if (state->recv_file != nullptr) {
+        // No progress interval: only going offline and the end are reported.
+        Tox_Err_File_Recv_To_Fd err_fd;
+        tox_file_recv_to_fd(tox, friend_number, file_number, fileno(state->recv_file), 0, false, &err_fd);
+        ck_assert_msg(err_fd == TOX_ERR_FILE_RECV_TO_FD_OK, "failed to set receive fd: %d", err_fd);
+    }
+
+    Tox_Err_File_Control err;
+    tox_file_control(tox, friend_number, file_number, TOX_FILE_CONTROL_RESUME, &err);
+    ck_assert_msg(err == TOX_ERR_FILE_CONTROL_OK, "failed to accept file: %d", err);
+}
+
+static void handle_file_recv_chunk(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                   const uint8_t *data, size_t length, void *user_data)
+{
+    const AutoTox *autotox = (AutoTox *)user_data;
+    State *state = (State *)autotox->state;
+
+    if (length == 0) {
+        state->recv_done = true;
+        return;
+    }
+
+    ck_assert_msg(state->recv_file == nullptr, "got a chunk for a file written by core");
+
+    // FTv2 chunks start with the file id.
+    ck_assert(length > TOX_FILE_ID_LENGTH);
+    data += TOX_FILE_ID_LENGTH;
+    length -= TOX_FILE_ID_LENGTH;
+
+    ck_assert_msg(position + length <= FILE_SIZE, "chunk at %lu past the end of the file", (unsigned long)position);
+    memcpy(state->received + position, data, length);
+
+    if (position + length > state->received_length) {
+        state->received_length = position + length;
+    }
+}
+
+static void handle_file_chunk_request(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                      size_t length, void *user_data)
+{
+    const AutoTox *autotox = (AutoTox *)user_data;
+    State *state = (State *)autotox->state;
+
+    ck_assert_msg(length == 0, "client was asked for a chunk of a file core reads itself");
+    ++state->final_chunk_requests;
+}
+
+static void handle_file_recv_progress(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t bytes_written,
+                                      void *user_data)
+{
+    const AutoTox *autotox = (AutoTox *)user_data;
+    State *state = (State *)autotox->state;
+
+    ck_assert_msg(bytes_written > state->progress, "progress went from %lu to %lu",
+                  (unsigned long)state->progress, (unsigned long)bytes_written);
+    state->progress = bytes_written;
+    ++state->progress_events;
+}
+
+/** @brief The number of bytes received so far, or written to the file by core. */
+static uint64_t received_bytes(const State *state)
+{
+    if (state->recv_file == nullptr) {
+        return state->received_length;
+    }
+
+    struct stat st;
+    ck_assert(fstat(fileno(state->recv_file), &st) == 0);
+    return (uint64_t)st.st_size;
+}
+
+static void send_with_reconnect(AutoTox *autotoxes, const uint8_t *contents, FILE *file, FILE *recv_file)
+{
+    State *sender_state = (State *)autotoxes[0].state;
+    State *receiver_state = (State *)autotoxes[1].state;
+    memset(sender_state, 0, sizeof(State));
+    memset(receiver_state, 0, sizeof(State));
+    receiver_state->recv_file = recv_file;
+    receiver_state->received = (uint8_t *)calloc(1, FILE_SIZE);
+    ck_assert(receiver_state->received != nullptr);
+
+    const uint8_t filename[] = "file.bin";
+    Tox_Err_File_Send err;
+    tox_file_send_fd(autotoxes[0].tox, 0, TOX_FILE_KIND_FTV2, FILE_SIZE, nullptr, filename, sizeof(filename),
+                     fileno(file), &err);
+    ck_assert_msg(err == TOX_ERR_FILE_SEND_OK, "failed to send file: %d", err);
+
+    printf("sending until %d bytes arrived\n", DISCONNECT_AFTER);
+
+    while (received_bytes(receiver_state) < DISCONNECT_AFTER) {
+        iterate_all_wait(autotoxes, TOX_COUNT, 5);
+    }
+
+    // Let each side see the other go offline, as if the network was down.
+    for (uint32_t i = 0; i < TOX_COUNT; ++i) {
+        printf("suspending #%u until #%u sees it offline\n", autotoxes[1 - i].index, autotoxes[i].index);
+
+        do {
+            tox_iterate(autotoxes[i].tox, &autotoxes[i]);
+            autotoxes[i].clock += 1000;
+            c_sleep(20);
+        } while (tox_friend_get_connection_status(autotoxes[i].tox, 0, nullptr) != TOX_CONNECTION_NONE);
+    }
+
+    ck_assert_msg(!receiver_state->recv_done, "file arrived before the friends went offline");
+    printf("reconnecting at %lu bytes\n", (unsigned long)received_bytes(receiver_state));
+
+    if (recv_file != nullptr) {
+        // Everything received before going offline was written out and reported.
+        ck_assert_msg(receiver_state->progress_events == 1, "%u progress events", receiver_state->progress_events);
+        ck_assert(receiver_state->progress == received_bytes(receiver_state));
+        rewind(recv_file);
+        ck_assert(fread(receiver_state->received, 1, receiver_state->progress, recv_file) == receiver_state->progress);
+        ck_assert_msg(memcmp(receiver_state->received, contents, receiver_state->progress) == 0,
+                      "file corrupted before the reconnect");
+    }
+
+    // The descriptor stays open: the FTv2 transfer continues where it stopped.
+    while (!receiver_state->recv_done || sender_state->final_chunk_requests == 0) {
+        iterate_all_wait(autotoxes, TOX_COUNT, 5);
+    }
+
+    ck_assert(sender_state->final_chunk_requests == 1);
+
+    if (recv_file != nullptr) {
+        ck_assert(receiver_state->progress == FILE_SIZE);
+        ck_assert_msg(receiver_state->progress_events == 2, "%u progress events", receiver_state->progress_events);
+        rewind(recv_file);
+        ck_assert(fread(receiver_state->received, 1, FILE_SIZE, recv_file) == FILE_SIZE);
+        receiver_state->received_length = FILE_SIZE;
+    }
+
+    ck_assert(receiver_state->received_length == FILE_SIZE);
+    ck_assert_msg(memcmp(receiver_state->received, contents, FILE_SIZE) == 0, "file corrupted");
+
+    printf("file arrived complete after the reconnect\n");
+
+    free(receiver_state->received);
+}
+
+static void test_file_transfer_reconnect(AutoTox *autotoxes)
+{
+    for (uint32_t i = 0; i < TOX_COUNT; ++i) {
+        tox_callback_file_recv(autotoxes[i].tox, handle_file_recv);
+        tox_callback_file_recv_chunk(autotoxes[i].tox, handle_file_recv_chunk);
+        tox_callback_file_chunk_request(autotoxes[i].tox, handle_file_chunk_request);
+        tox_callback_file_recv_progress(autotoxes[i].tox, handle_file_recv_progress);
+    }
+
+    uint8_t *contents = (uint8_t *)malloc(FILE_SIZE);
+    ck_assert(contents != nullptr);
+
+    for (uint32_t i = 0; i < FILE_SIZE; ++i) {
+        contents[i] = (uint8_t)rand();
+    }
+
+    FILE *file = tmpfile();
+    ck_assert(file != nullptr);
+    ck_assert(fwrite(contents, 1, FILE_SIZE, file) == FILE_SIZE);
+    ck_assert(fflush(file) == 0);
+
+    printf("receiving chunks\n");
+    send_with_reconnect(autotoxes, contents, file, nullptr);
+
+    FILE *recv_file = tmpfile();
+    ck_assert(recv_file != nullptr);
+
+    printf("receiving to a file descriptor\n");
+    send_with_reconnect(autotoxes, contents, file, recv_file);
+
+    fclose(recv_file);
+    fclose(file);
+    free(contents);
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    Run_Auto_Options options = default_run_auto_options();
+    options.graph = GRAPH_LINEAR;
+    run_auto_test(nullptr, TOX_COUNT, test_file_transfer_reconnect, sizeof(State), &options);
+
+    return 0;
+}
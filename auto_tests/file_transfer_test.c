@@ -9,6 +9,7 @@
 #include "../testing/misc_tools.h"
 #include "../toxcore/ccompat.h"
 #include "../toxcore/tox.h"
+#include "../toxcore/tox_struct.h"
 #include "../toxcore/util.h"
 #include "auto_test_support.h"
 #include "check_compat.h"
@@ -151,6 +152,17 @@ static void write_file(Tox *tox, uint32_t friendnumber, uint32_t filenumber, uin
     size_recv += length;
 }
 
+static void print_packet_pool_stats(const char *name, const Tox *tox, uint64_t bytes)
+{
+    Net_Crypto_Packet_Pool_Stats stats;
+    nc_get_packet_pool_stats(tox->m->net_crypto, &stats);
+
+    const double mib = (double)bytes / 1024 / 1024;
+    printf("%s packet pool: %u in use, %u cached, %lu heap allocations (%.2f per MiB), %lu reused\n",
+           name, stats.in_use, stats.cached, (unsigned long)stats.heap_allocations,
+           (double)stats.heap_allocations / mib, (unsigned long)stats.reused);
+}
+
 static void file_transfer_test(void)
 {
     printf("Starting test: few_clients\n");
@@ -260,6 +272,8 @@ static void file_transfer_test(void)
                   (unsigned long)sending_pos);
 
     printf("100MiB file sent in %lu seconds\n", (unsigned long)(time(nullptr) - f_time));
+    print_packet_pool_stats("sender", tox2, totalf_size);
+    print_packet_pool_stats("receiver", tox3, totalf_size);
 
     printf("Starting file streaming transfer test.\n");
 
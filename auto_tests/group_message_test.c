@@ -2,12 +2,13 @@
  * Tests message sending capabilities, including:
  * - The ability to send/receive plain, action, and custom messages
  * - The lossless UDP implementation
- * - The packet splitting implementation
+ * - The packet splitting implementation, with custom packets of up to the maximum size
  * - The ignore feature
  */
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "auto_test_support.h"
@@ -25,12 +26,17 @@ typedef struct State {
     size_t custom_private_packets_received;
     bool lossless_check;
     bool wraparound_check;
+    bool large_custom_packet_check;
     int32_t last_msg_recv;
 } State;
 
 #define NUM_GROUP_TOXES 2
 #define MAX_NUM_MESSAGES_LOSSLESS_TEST 300
 #define MAX_NUM_MESSAGES_WRAPAROUND_TEST 9001
+#define MAX_NUM_LARGE_CUSTOM_PACKETS 20
+
+/* MAX_GC_CUSTOM_PACKET_SIZE, about 30 fragments */
+#define MAX_LARGE_CUSTOM_PACKET_SIZE 40000
 
 #define TEST_MESSAGE "Where is it I've read that someone condemned to death says or thinks, an hour before his death, that if he had to live on some high rock, on such a narrow ledge that he'd only room to stand, and the ocean, everlasting darkness, everlasting solitude, everlasting tempest around him, if he had to remain standing on a square yard of space all his life, a thousand years, eternity, it were better to live so than to die at once. Only to live, to live and live! Life, whatever it may be!"
 #define TEST_MESSAGE_LEN (sizeof(TEST_MESSAGE) - 1)
@@ -329,6 +335,31 @@ static void group_message_handler_wraparound_test(Tox *tox, uint32_t groupnumber
     }
 }
 
+static void group_custom_packet_handler_large_test(Tox *tox, uint32_t groupnumber, uint32_t peer_id,
+        const uint8_t *data, size_t length, void *user_data)
+{
+    AutoTox *autotox = (AutoTox *)user_data;
+    ck_assert(autotox != nullptr);
+
+    State *state = (State *)autotox->state;
+
+    ck_assert(length >= 4 && length <= MAX_LARGE_CUSTOM_PACKET_SIZE);
+
+    uint16_t num;
+    uint16_t checksum;
+    memcpy(&num, data, sizeof(uint16_t));
+    memcpy(&checksum, data + sizeof(uint16_t), sizeof(uint16_t));
+
+    ck_assert_msg(num == state->last_msg_recv + 1, "Expected %d, got start %u", state->last_msg_recv + 1, num);
+    ck_assert_msg(checksum == get_message_checksum(data + 4, length - 4), "Wrong checksum");
+
+    state->last_msg_recv = num;
+
+    if (state->last_msg_recv == MAX_NUM_LARGE_CUSTOM_PACKETS) {
+        state->large_custom_packet_check = true;
+    }
+}
+
 static void group_message_test(AutoTox *autotoxes)
 {
 #ifndef VANILLA_NACL
@@ -505,6 +536,41 @@ static void group_message_test(AutoTox *autotoxes)
         iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
     }
 
+    state1->last_msg_recv = -1;
+    tox_callback_group_custom_packet(tox1, group_custom_packet_handler_large_test);
+
+    fprintf(stderr, "Doing large custom packet test...\n");
+
+    uint8_t *large_packet = (uint8_t *)malloc(MAX_LARGE_CUSTOM_PACKET_SIZE);
+    ck_assert(large_packet != nullptr);
+
+    // fragment reassembly test, the last fragment of each packet is a different size
+    for (uint16_t i = 0; i <= MAX_NUM_LARGE_CUSTOM_PACKETS; ++i) {
+        iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
+
+        const uint16_t packet_size = i == 0 ? MAX_LARGE_CUSTOM_PACKET_SIZE
+                                     : MAX_LARGE_CUSTOM_PACKET_SIZE - (random_u16(rng) % (MAX_LARGE_CUSTOM_PACKET_SIZE / 2));
+
+        memcpy(large_packet, &i, sizeof(uint16_t));
+
+        for (size_t j = 4; j < packet_size; ++j) {
+            large_packet[j] = random_u32(rng);
+        }
+
+        const uint16_t checksum = get_message_checksum(large_packet + 4, packet_size - 4);
+
+        memcpy(large_packet + 2, &checksum, sizeof(uint16_t));
+
+        tox_group_send_custom_packet(tox0, group_number, true, large_packet, packet_size, &c_err);
+        ck_assert_msg(c_err == TOX_ERR_GROUP_SEND_CUSTOM_PACKET_OK, "%d", c_err);
+    }
+
+    free(large_packet);
+
+    while (!state1->large_custom_packet_check) {
+        iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
+    }
+
     for (size_t i = 0; i < NUM_GROUP_TOXES; i++) {
         Tox_Err_Group_Leave err_exit;
         tox_group_leave(autotoxes[i].tox, group_number, nullptr, 0, &err_exit);
@@ -0,0 +1,417 @@
+/*
+ * Tests relayed group broadcasts:
+ * - Every peer receives every message exactly once, whether it relays or not
+ * - A relaying sender sends each message to about `fanout` peers instead of to all of them
+ * - Every lossless packet is eventually acked
+ * - When a relaying peer leaves before forwarding a message, the rest of its branch still gets it
+ *
+ * Prints the CPU time and bytes it costs to send a message with and without relaying.
+ */
+
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/group_chats.h"
+#include "../toxcore/tox_struct.h"
+#include "auto_test_support.h"
+#include "check_compat.h"
+
+#ifndef NUM_GROUP_TOXES
+#define NUM_GROUP_TOXES 32
+#endif
+
+#define RELAY_FANOUT 3
+
+/* Every this many toxes, one doesn't relay broadcasts */
+#define NON_RELAY_INTERVAL 6
+
+#define NUM_MESSAGES 10
+
+/* Tox 0 and 1 relay, the last one doesn't */
+#define NUM_SENDERS 3
+
+/* Messages tox 0 sends just before a peer it sends them to for relaying leaves */
+#define REPAIR_SENDER NUM_SENDERS
+
+#define GROUP_NAME "Relay Station"
+#define GROUP_NAME_LEN (sizeof(GROUP_NAME) - 1)
+
+#define PEER_NICK "Relay"
+#define PEER_NICK_LEN (sizeof(PEER_NICK) - 1)
+
+/* Long enough that the bytes a message costs are dominated by the message itself */
+#define MESSAGE_PADDING 400
+
+typedef struct State {
+    uint32_t num_peers;
+    uint32_t received[NUM_SENDERS + 1][NUM_MESSAGES];
+} State;
+
+static uint32_t sender_tox(uint32_t sender)
+{
+    if (sender == REPAIR_SENDER) {
+        return 0;
+    }
+
+    return sender < NUM_SENDERS - 1 ? sender : NUM_GROUP_TOXES - 1;
+}
+
+static bool tox_relays(uint32_t index)
+{
+    return index % NON_RELAY_INTERVAL != NON_RELAY_INTERVAL - 1 && index != NUM_GROUP_TOXES - 1;
+}
+
+static void init_relay_autotox(AutoTox *autotox, uint32_t n)
+{
+    // The option only takes effect for groups created or joined afterwards.
+    autotox->tox->m->options.group_relay_fanout = tox_relays(n) ? RELAY_FANOUT : 0;
+}
+
+static void group_peer_join_handler(Tox *tox, uint32_t group_number, uint32_t peer_id, void *user_data)
+{
+    AutoTox *autotox = (AutoTox *)user_data;
+    ck_assert(autotox != nullptr);
+
+    State *state = (State *)autotox->state;
+    ++state->num_peers;
+}
+
+static void group_message_handler(Tox *tox, uint32_t group_number, uint32_t peer_id, Tox_Message_Type type,
+                                  const uint8_t *message, size_t length, uint32_t pseudo_msg_id, void *user_data)
+{
+    AutoTox *autotox = (AutoTox *)user_data;
+    ck_assert(autotox != nullptr);
+
+    State *state = (State *)autotox->state;
+
+    char text[TOX_GROUP_MAX_MESSAGE_LENGTH + 1];
+    ck_assert(length < sizeof(text));
+    memcpy(text, message, length);
+    text[length] = '\0';
+
+    unsigned int sender;
+    unsigned int number;
+    ck_assert_msg(sscanf(text, "%u %u", &sender, &number) == 2, "unexpected message: %s", text);
+    ck_assert(sender <= REPAIR_SENDER && number < NUM_MESSAGES);
+
+    ++state->received[sender][number];
+    ck_assert_msg(state->received[sender][number] == 1, "tox %u received message %u from sender %u twice",
+                  autotox->index, number, sender);
+}
+
+static bool all_group_peers_connected(const AutoTox *autotoxes, uint32_t groupnumber)
+{
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        if (!tox_group_is_connected(autotoxes[i].tox, groupnumber, nullptr)) {
+            return false;
+        }
+
+        const State *state = (const State *)autotoxes[i].state;
+
+        if (state->num_peers < NUM_GROUP_TOXES - 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool all_messages_received(const AutoTox *autotoxes, uint32_t sender)
+{
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        if (i == sender_tox(sender) || !autotoxes[i].alive) {
+            continue;
+        }
+
+        const State *state = (const State *)autotoxes[i].state;
+
+        for (uint32_t j = 0; j < NUM_MESSAGES; ++j) {
+            if (state->received[sender][j] != 1) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool all_packets_acked(const AutoTox *autotoxes, uint32_t groupnumber)
+{
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        const GC_Chat *chat = gc_get_group(autotoxes[i].tox->m->group_handler, groupnumber);
+        ck_assert(chat != nullptr);
+
+        GC_Lossless_Stats stats;
+        gc_get_lossless_stats(chat, &stats);
+
+        if (stats.in_flight > 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static uint64_t cpu_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void send_messages(AutoTox *autotoxes, uint32_t groupnumber, uint32_t sender)
+{
+    const uint32_t index = sender_tox(sender);
+    Tox *tox = autotoxes[index].tox;
+    const GC_Chat *chat = gc_get_group(tox->m->group_handler, groupnumber);
+    ck_assert(chat != nullptr);
+
+    GC_Broadcast_Stats before;
+    gc_get_broadcast_stats(chat, &before);
+
+    uint64_t cpu_ns = 0;
+
+    for (uint32_t i = 0; i < NUM_MESSAGES; ++i) {
+        char message[TOX_GROUP_MAX_MESSAGE_LENGTH];
+        const int length = snprintf(message, sizeof(message), "%u %u %0*u", sender, i, MESSAGE_PADDING, 0);
+        ck_assert(length > 0);
+
+        const uint64_t start = cpu_time_ns();
+
+        Tox_Err_Group_Send_Message err;
+        tox_group_send_message(tox, groupnumber, TOX_MESSAGE_TYPE_NORMAL, (const uint8_t *)message, (size_t)length,
+                               nullptr, &err);
+
+        cpu_ns += cpu_time_ns() - start;
+
+        ck_assert_msg(err == TOX_ERR_GROUP_SEND_MESSAGE_OK, "failed to send group message: %d", err);
+    }
+
+    GC_Broadcast_Stats after;
+    gc_get_broadcast_stats(chat, &after);
+
+    const uint64_t packets = after.packets - before.packets;
+    const uint64_t bytes = after.bytes - before.bytes;
+
+    printf("tox %u (%s): %.1f packets, %.0f bytes and %.1f us CPU per message to %u peers\n",
+           index, tox_relays(index) ? "relaying" : "not relaying", (double)packets / NUM_MESSAGES,
+           (double)bytes / NUM_MESSAGES, (double)cpu_ns / 1000.0 / NUM_MESSAGES, NUM_GROUP_TOXES - 1);
+
+    ck_assert(after.sent - before.sent == NUM_MESSAGES);
+
+    uint32_t non_relaying = 0;
+
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        if (i != index && !tox_relays(i)) {
+            ++non_relaying;
+        }
+    }
+
+    if (tox_relays(index)) {
+        // One packet per branch, plus one more if our own hash splits the tree, plus the peers that don't relay.
+        ck_assert_msg(packets <= (uint64_t)NUM_MESSAGES * (RELAY_FANOUT + 1 + non_relaying),
+                      "relaying sender sent %u packets", (unsigned int)packets);
+    } else {
+        ck_assert(packets == (uint64_t)NUM_MESSAGES * (NUM_GROUP_TOXES - 1));
+    }
+
+    while (!all_messages_received(autotoxes, sender)) {
+        iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
+    }
+
+    fprintf(stderr, "All peers received the messages of tox %u\n", index);
+}
+
+/** Returns the index of the tox with public encryption key `enc_pk` in the group. */
+static uint32_t find_tox(const AutoTox *autotoxes, uint32_t groupnumber, const uint8_t *enc_pk)
+{
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        const GC_Chat *chat = gc_get_group(autotoxes[i].tox->m->group_handler, groupnumber);
+        ck_assert(chat != nullptr);
+
+        if (memcmp(get_enc_key(chat->self_public_key), enc_pk, ENC_PUBLIC_KEY_SIZE) == 0) {
+            return i;
+        }
+    }
+
+    ck_abort_msg("no tox has the public key of a relay branch");
+    return 0;
+}
+
+/** Sends messages from tox 0, then makes a peer that should forward them to the rest of its
+ * branch leave the group before it does. Tox 0 sends them to that branch directly instead.
+ */
+static void send_messages_relay_leaves(AutoTox *autotoxes, uint32_t groupnumber)
+{
+    Tox *tox = autotoxes[0].tox;
+    const GC_Chat *chat = gc_get_group(tox->m->group_handler, groupnumber);
+    ck_assert(chat != nullptr);
+
+    for (uint32_t i = 0; i < NUM_MESSAGES; ++i) {
+        char message[TOX_GROUP_MAX_MESSAGE_LENGTH];
+        const int length = snprintf(message, sizeof(message), "%u %u", REPAIR_SENDER, i);
+        ck_assert(length > 0);
+
+        Tox_Err_Group_Send_Message err;
+        tox_group_send_message(tox, groupnumber, TOX_MESSAGE_TYPE_NORMAL, (const uint8_t *)message, (size_t)length,
+                               nullptr, &err);
+        ck_assert_msg(err == TOX_ERR_GROUP_SEND_MESSAGE_OK, "failed to send group message: %d", err);
+    }
+
+    ck_assert(chat->relay_pending.num_entries == NUM_MESSAGES);
+
+    const GC_Relay_Pending *pending = &chat->relay_pending.entries[0];
+    const GC_Relay_Pending_Branch *branch = nullptr;
+
+    for (uint32_t i = 0; i < pending->num_branches; ++i) {
+        if (!gc_relay_range_is_empty(pending->branches[i].range_start, pending->branches[i].range_end)) {
+            branch = &pending->branches[i];
+            break;
+        }
+    }
+
+    ck_assert(branch != nullptr);
+
+    // The peer leaves without ever handling the messages it was sent
+    const uint32_t leaving = find_tox(autotoxes, groupnumber, branch->peer_pk);
+    autotoxes[leaving].alive = false;
+
+    Tox_Err_Group_Leave err_exit;
+    tox_group_leave(autotoxes[leaving].tox, groupnumber, nullptr, 0, &err_exit);
+    ck_assert_msg(err_exit == TOX_ERR_GROUP_LEAVE_OK, "%d", err_exit);
+
+    while (!all_messages_received(autotoxes, REPAIR_SENDER)) {
+        iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
+    }
+
+    GC_Broadcast_Stats stats;
+    gc_get_broadcast_stats(chat, &stats);
+    ck_assert(stats.repaired > 0);
+
+    printf("tox %u left before relaying, tox 0 sent %u packets directly to its branch\n", leaving,
+           (unsigned int)stats.repaired);
+}
+
+static void group_relay_test(AutoTox *autotoxes)
+{
+#ifndef VANILLA_NACL
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        tox_callback_group_peer_join(autotoxes[i].tox, group_peer_join_handler);
+        tox_callback_group_message(autotoxes[i].tox, group_message_handler);
+    }
+
+    Tox *tox0 = autotoxes[0].tox;
+
+    Tox_Err_Group_New new_err;
+    const uint32_t groupnumber = tox_group_new(tox0, TOX_GROUP_PRIVACY_STATE_PUBLIC, (const uint8_t *)GROUP_NAME,
+                                 GROUP_NAME_LEN, (const uint8_t *)PEER_NICK, PEER_NICK_LEN, &new_err);
+    ck_assert_msg(new_err == TOX_ERR_GROUP_NEW_OK, "tox_group_new failed: %d", new_err);
+
+    Tox_Err_Group_State_Queries id_err;
+    uint8_t chat_id[TOX_GROUP_CHAT_ID_SIZE];
+    tox_group_get_chat_id(tox0, groupnumber, chat_id, &id_err);
+    ck_assert_msg(id_err == TOX_ERR_GROUP_STATE_QUERIES_OK, "tox_group_get_chat_id failed %d", id_err);
+
+    for (uint32_t i = 1; i < NUM_GROUP_TOXES; ++i) {
+        iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
+
+        Tox_Err_Group_Join join_err;
+        tox_group_join(autotoxes[i].tox, chat_id, (const uint8_t *)PEER_NICK, PEER_NICK_LEN, nullptr, 0, &join_err);
+        ck_assert_msg(join_err == TOX_ERR_GROUP_JOIN_OK, "tox_group_join failed: %d", join_err);
+    }
+
+    fprintf(stderr, "Peers attempting to join group\n");
+
+    while (!all_group_peers_connected(autotoxes, groupnumber)) {
+        iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
+    }
+
+    fprintf(stderr, "All %u peers connected\n", NUM_GROUP_TOXES);
+
+    for (uint32_t sender = 0; sender < NUM_SENDERS; ++sender) {
+        send_messages(autotoxes, groupnumber, sender);
+    }
+
+    uint64_t relayed = 0;
+    uint64_t duplicates = 0;
+
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        const GC_Chat *chat = gc_get_group(autotoxes[i].tox->m->group_handler, groupnumber);
+        ck_assert(chat != nullptr);
+
+        GC_Broadcast_Stats stats;
+        gc_get_broadcast_stats(chat, &stats);
+        relayed += stats.relayed;
+        duplicates += stats.duplicates;
+    }
+
+    printf("peers forwarded %u packets in total, %u of them duplicates\n", (unsigned int)relayed,
+           (unsigned int)duplicates);
+
+    while (!all_packets_acked(autotoxes, groupnumber)) {
+        iterate_all_wait(autotoxes, NUM_GROUP_TOXES, ITERATION_INTERVAL);
+    }
+
+    uint64_t array_bytes = 0;
+    uint64_t resent = 0;
+
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        const GC_Chat *chat = gc_get_group(autotoxes[i].tox->m->group_handler, groupnumber);
+        ck_assert(chat != nullptr);
+
+        GC_Lossless_Stats stats;
+        gc_get_lossless_stats(chat, &stats);
+
+        // We never send anything to ourselves.
+        ck_assert(stats.send_arrays < chat->numpeers && stats.recv_arrays < chat->numpeers);
+
+        array_bytes += stats.array_bytes;
+        resent += stats.resent + stats.resent_on_request;
+    }
+
+    const uint64_t eager_bytes = (uint64_t)NUM_GROUP_TOXES * NUM_GROUP_TOXES * 2 * GCC_BUFFER_SIZE
+                                 * sizeof(GC_Message_Array_Entry);
+
+    printf("send and receive arrays hold %.1f MiB instead of %.1f MiB, %u packets were resent\n",
+           (double)array_bytes / (1024 * 1024), (double)eager_bytes / (1024 * 1024), (unsigned int)resent);
+
+    send_messages_relay_leaves(autotoxes, groupnumber);
+
+    for (uint32_t i = 0; i < NUM_GROUP_TOXES; ++i) {
+        if (!autotoxes[i].alive) {
+            continue;
+        }
+
+        Tox_Err_Group_Leave err_exit;
+        tox_group_leave(autotoxes[i].tox, groupnumber, nullptr, 0, &err_exit);
+        ck_assert_msg(err_exit == TOX_ERR_GROUP_LEAVE_OK, "%d", err_exit);
+    }
+
+    fprintf(stderr, "All tests passed!\n");
+#endif /* VANILLA_NACL */
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    Run_Auto_Options autotest_opts = default_run_auto_options();
+    autotest_opts.graph = GRAPH_LINEAR;
+    autotest_opts.init_autotox = init_relay_autotox;
+
+    run_auto_test(nullptr, NUM_GROUP_TOXES, group_relay_test, sizeof(State), &autotest_opts);
+
+    return 0;
+}
+
+#undef PEER_NICK_LEN
+#undef PEER_NICK
+#undef GROUP_NAME_LEN
+#undef GROUP_NAME
@@ -0,0 +1,158 @@
+/* Auto Tests: Drive tox instances by waiting on their sockets and deadlines.
+ */
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../testing/misc_tools.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "auto_test_support.h"
+#include "check_compat.h"
+
+#define NUM_TOXES 8
+#define MAX_FDS 64
+#define TCP_RELAY_PORT 33190
+
+typedef struct State {
+    bool message_received;
+} State;
+
+static void handle_friend_message(Tox *tox, uint32_t friend_number, Tox_Message_Type type,
+                                  const uint8_t *message, size_t length, void *user_data)
+{
+    State *state = (State *)user_data;
+    ck_assert(length == sizeof("hello") && memcmp(message, "hello", length) == 0);
+    state->message_received = true;
+}
+
+/** Wait for any socket of any instance, or the earliest deadline, then iterate them all. */
+static void wait_and_iterate(Tox **toxes, State *states)
+{
+    struct pollfd pfds[NUM_TOXES * MAX_FDS];
+    nfds_t num_pfds = 0;
+    uint32_t timeout = UINT32_MAX;
+
+    for (uint32_t i = 0; i < NUM_TOXES; ++i) {
+        int32_t fds[MAX_FDS];
+        const uint32_t count = tox_get_fds(toxes[i], fds, MAX_FDS);
+        ck_assert_msg(count >= 1, "tox %u has no sockets", i);
+        ck_assert(count <= MAX_FDS);
+
+        for (uint32_t j = 0; j < count; ++j) {
+            pfds[num_pfds].fd = fds[j];
+            pfds[num_pfds].events = POLLIN;
+            pfds[num_pfds].revents = 0;
+            ++num_pfds;
+        }
+
+        const uint32_t tox_timeout = tox_iteration_timeout(toxes[i]);
+        ck_assert_msg(tox_timeout <= 1000, "timeout of tox %u is %u ms", i, tox_timeout);
+        ck_assert(tox_iteration_interval(toxes[i]) <= tox_timeout);
+
+        if (tox_timeout < timeout) {
+            timeout = tox_timeout;
+        }
+    }
+
+    ck_assert(poll(pfds, num_pfds, (int)timeout) != -1);
+
+    for (uint32_t i = 0; i < NUM_TOXES; ++i) {
+        tox_iterate(toxes[i], &states[i]);
+    }
+}
+
+/** With `tcp` set, the second instance has UDP off and reaches the first through its TCP relay. */
+static void test_iteration_timeout(bool tcp)
+{
+    Tox *toxes[NUM_TOXES];
+    State states[NUM_TOXES] = {{false}};
+    uint32_t index[NUM_TOXES];
+
+    struct Tox_Options *opts = tox_options_new(nullptr);
+    ck_assert(opts != nullptr);
+
+    for (uint32_t i = 0; i < NUM_TOXES; ++i) {
+        tox_options_set_udp_enabled(opts, !(tcp && i == 1));
+        tox_options_set_tcp_port(opts, tcp && i == 0 ? TCP_RELAY_PORT : 0);
+        index[i] = i + 1;
+        toxes[i] = tox_new_log(opts, nullptr, &index[i]);
+        ck_assert_msg(toxes[i] != nullptr, "failed to create tox instance %u", i);
+        tox_callback_friend_message(toxes[i], handle_friend_message);
+    }
+
+    tox_options_free(opts);
+
+    uint8_t pk[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(toxes[0], pk);
+
+    const uint16_t dht_port = tox_self_get_udp_port(toxes[0], nullptr);
+
+    // The others only fill the DHT so that onion paths to the friend can be built.
+    for (uint32_t i = 1; i < NUM_TOXES; ++i) {
+        tox_bootstrap(toxes[i], "localhost", dht_port, pk, nullptr);
+    }
+
+    if (tcp) {
+        Tox_Err_Bootstrap err;
+        tox_add_tcp_relay(toxes[1], "localhost", TCP_RELAY_PORT, pk, &err);
+        ck_assert(err == TOX_ERR_BOOTSTRAP_OK);
+    }
+
+    tox_self_get_public_key(toxes[0], pk);
+    tox_friend_add_norequest(toxes[1], pk, nullptr);
+
+    tox_self_get_public_key(toxes[1], pk);
+    tox_friend_add_norequest(toxes[0], pk, nullptr);
+
+    printf("waiting for the friend connection over %s\n", tcp ? "TCP" : "UDP");
+
+    while (tox_friend_get_connection_status(toxes[0], 0, nullptr) == TOX_CONNECTION_NONE ||
+            tox_friend_get_connection_status(toxes[1], 0, nullptr) == TOX_CONNECTION_NONE) {
+        wait_and_iterate(toxes, states);
+    }
+
+    printf("friends are connected, sending message\n");
+
+    Tox_Err_Friend_Send_Message err;
+    tox_friend_send_message(toxes[0], 0, TOX_MESSAGE_TYPE_NORMAL, (const uint8_t *)"hello", sizeof("hello"), &err);
+    ck_assert(err == TOX_ERR_FRIEND_SEND_MESSAGE_OK);
+
+    while (!states[1].message_received) {
+        wait_and_iterate(toxes, states);
+    }
+
+    printf("message received\n");
+
+    // Once the connection is idle, nothing is due until the next keepalive or
+    // whole-second timer, well beyond the polling interval. A confirmed TCP
+    // relay connection only adds its ping deadlines.
+    uint32_t longest_timeout = 0;
+
+    for (uint32_t i = 0; i < 1000 && longest_timeout <= 500; ++i) {
+        const uint32_t timeout = tox_iteration_timeout(toxes[1]);
+
+        if (timeout > longest_timeout) {
+            longest_timeout = timeout;
+        }
+
+        wait_and_iterate(toxes, states);
+    }
+
+    printf("longest timeout while idle: %u ms\n", longest_timeout);
+    ck_assert(longest_timeout > 500);
+
+    for (uint32_t i = 0; i < NUM_TOXES; ++i) {
+        tox_kill(toxes[i]);
+    }
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+    test_iteration_timeout(false);
+    test_iteration_timeout(true);
+    return 0;
+}
@@ -0,0 +1,180 @@
+/* Tests that many peers can complete crypto handshakes with a single hub and
+ * reports the handshake throughput.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../testing/misc_tools.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/net_crypto.h"
+#include "../toxcore/util.h"
+#include "auto_test_support.h"
+#include "check_compat.h"
+
+#ifndef USE_IPV6
+#define USE_IPV6 1
+#endif
+
+static inline IP get_loopback(void)
+{
+    IP ip;
+#if USE_IPV6
+    ip.family = net_family_ipv6();
+    ip.ip.v6 = get_ip6_loopback();
+#else
+    ip.family = net_family_ipv4();
+    ip.ip.v4 = get_ip4_loopback();
+#endif
+    return ip;
+}
+
+#define NUM_PEERS 128
+#define HANDSHAKE_PORT_RANGE_START 33445
+#define HANDSHAKE_PORT_RANGE_END (HANDSHAKE_PORT_RANGE_START + 2 * NUM_PEERS + 64)
+
+typedef struct Test_Node {
+    uint32_t index;
+    Logger *log;
+    Networking_Core *net;
+    DHT *dht;
+    Net_Crypto *c;
+} Test_Node;
+
+static uint32_t peers_online;
+static uint32_t hub_accepted;
+
+static void test_node_new(Test_Node *node, const Random *rng, const Network *ns, Mono_Time *mono_time, uint32_t index)
+{
+    node->index = index;
+    node->log = logger_new();
+    ck_assert(node->log != nullptr);
+    logger_callback_log(node->log, print_debug_logger, nullptr, &node->index);
+
+    const IP ip = get_loopback();
+    node->net = new_networking_ex(node->log, ns, &ip, HANDSHAKE_PORT_RANGE_START, HANDSHAKE_PORT_RANGE_END, nullptr);
+    ck_assert_msg(node->net != nullptr, "failed to create networking for node %u", index);
+
+    node->dht = new_dht(node->log, rng, ns, mono_time, node->net, true, true);
+    ck_assert(node->dht != nullptr);
+
+    const TCP_Proxy_Info inf = {{{{0}}}};
+    node->c = new_net_crypto(node->log, rng, ns, mono_time, node->dht, &inf);
+    ck_assert(node->c != nullptr);
+}
+
+static void test_node_kill(Test_Node *node)
+{
+    kill_net_crypto(node->c);
+    kill_dht(node->dht);
+    kill_networking(node->net);
+    logger_kill(node->log);
+}
+
+static void test_node_do(Test_Node *node)
+{
+    networking_poll(node->net, nullptr);
+    do_net_crypto(node->c, nullptr);
+}
+
+static int peer_status_cb(void *object, int id, bool status, void *userdata)
+{
+    if (status) {
+        ++peers_online;
+    }
+
+    return 0;
+}
+
+static int hub_status_cb(void *object, int id, bool status, void *userdata)
+{
+    return 0;
+}
+
+static int hub_new_connection_cb(void *object, const New_Connection *n_c)
+{
+    Net_Crypto *c = (Net_Crypto *)object;
+    const int id = accept_crypto_connection(c, n_c);
+
+    if (id == -1) {
+        return -1;
+    }
+
+    connection_status_handler(c, id, hub_status_cb, nullptr, id);
+    ++hub_accepted;
+    return 0;
+}
+
+static void test_many_handshakes(void)
+{
+    const Random *rng = system_random();
+    ck_assert(rng != nullptr);
+    const Network *ns = system_network();
+    ck_assert(ns != nullptr);
+
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+    ck_assert(mono_time != nullptr);
+
+    Test_Node hub;
+    test_node_new(&hub, rng, ns, mono_time, 0);
+    new_connection_handler(hub.c, hub_new_connection_cb, hub.c);
+
+    // The ip_port list compares raw bytes, so the padding must be zeroed.
+    IP_Port hub_ip_port;
+    memset(&hub_ip_port, 0, sizeof(hub_ip_port));
+    hub_ip_port.ip.family = get_loopback().family;
+    hub_ip_port.ip.ip = get_loopback().ip;
+    hub_ip_port.port = net_port(hub.net);
+
+    Test_Node *peers = (Test_Node *)calloc(NUM_PEERS, sizeof(Test_Node));
+    ck_assert(peers != nullptr);
+
+    for (uint32_t i = 0; i < NUM_PEERS; ++i) {
+        test_node_new(&peers[i], rng, ns, mono_time, i + 1);
+    }
+
+    const uint64_t start = current_time_monotonic(mono_time);
+
+    for (uint32_t i = 0; i < NUM_PEERS; ++i) {
+        const int id = new_crypto_connection(peers[i].c, nc_get_self_public_key(hub.c), dht_get_self_public_key(hub.dht));
+        ck_assert_msg(id != -1, "peer %u failed to create a crypto connection", i);
+        connection_status_handler(peers[i].c, id, peer_status_cb, nullptr, id);
+        ck_assert(set_direct_ip_port(peers[i].c, id, &hub_ip_port, false) == 0);
+    }
+
+    while (peers_online < NUM_PEERS) {
+        mono_time_update(mono_time);
+        test_node_do(&hub);
+
+        for (uint32_t i = 0; i < NUM_PEERS; ++i) {
+            test_node_do(&peers[i]);
+        }
+
+        c_sleep(5);
+    }
+
+    mono_time_update(mono_time);
+    const uint64_t elapsed = current_time_monotonic(mono_time) - start;
+
+    ck_assert(hub_accepted == NUM_PEERS);
+    printf("%u handshakes completed in %lu ms (%.1f handshakes/s)\n", NUM_PEERS, (unsigned long)elapsed,
+           elapsed == 0 ? 0.0 : NUM_PEERS * 1000.0 / elapsed);
+
+    for (uint32_t i = 0; i < NUM_PEERS; ++i) {
+        test_node_kill(&peers[i]);
+    }
+
+    free(peers);
+    test_node_kill(&hub);
+    mono_time_free(mono_time);
+}
+
+int main(void)
+{
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    test_many_handshakes();
+
+    return 0;
+}
@@ -309,8 +309,7 @@ static void test_basic(void)
 
     random_bytes(rng, sb_data, sizeof(sb_data));
     memcpy(&s, sb_data, sizeof(uint64_t));
-    memcpy(onion_announce_entry_public_key(onion2_a, 1), dht_get_self_public_key(onion2->dht), CRYPTO_PUBLIC_KEY_SIZE);
-    onion_announce_entry_set_time(onion2_a, 1, mono_time_get(mono_time2));
+    ck_assert(onion_announce_entry_add(onion2_a, dht_get_self_public_key(onion2->dht)));
     networking_registerhandler(onion1->net, NET_PACKET_ONION_DATA_RESPONSE, &handle_test_4, onion1);
     send_announce_request(onion1->net, rng, &path, &nodes[3],
                           dht_get_self_public_key(onion1->dht),
@@ -323,9 +322,13 @@ static void test_basic(void)
         do_onion(mono_time1, onion1);
         do_onion(mono_time2, onion2);
         c_sleep(50);
-    } while (memcmp(onion_announce_entry_public_key(onion2_a, ONION_ANNOUNCE_MAX_ENTRIES - 2),
-                    dht_get_self_public_key(onion1->dht),
-                    CRYPTO_PUBLIC_KEY_SIZE) != 0);
+    } while (onion_announce_entry_rank(onion2_a, dht_get_self_public_key(onion1->dht)) != 1);
+
+    // Growing the store keeps what is stored.
+    ck_assert(onion_announce_set_max_entries(onion2_a, ONION_ANNOUNCE_MAX_ENTRIES * 10));
+    ck_assert(!onion_announce_set_max_entries(onion2_a, 1));
+    ck_assert(onion_announce_max_entries(onion2_a) == ONION_ANNOUNCE_MAX_ENTRIES * 10);
+    ck_assert(onion_announce_entry_rank(onion2_a, dht_get_self_public_key(onion1->dht)) == 1);
 
     c_sleep(1000);
     Logger *log3 = logger_new();
@@ -0,0 +1,377 @@
+
+
+#define _GNU_SOURCE
+
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <errno.h>
+
+#include <tox/tox.h>
+
+/*
+ * Send the same file over loopback three times and print the throughput:
+ *
+ * - "callback": every chunk is requested with file_chunk_request, read with pread() by the
+ *               client and sent with tox_file_send_chunk (like 0095_ftv2_speed_test_udp.c)
+ * - "fd":       toxcore reads the chunks itself from a file descriptor (tox_file_send_fd)
+ * - "mmap":     toxcore copies the chunks from a mapped file (tox_file_send_mmap)
+ *
+ * A first "warmup" transfer lets the congestion control ramp up, so that the others are comparable.
+ * Besides the wall clock time, the CPU time spent in tox_iterate() of the sender is printed.
+ * The receiver checks every byte.
+ */
+
+#define CURRENT_LOG_LEVEL 2 // 0 -> error, 1 -> warn, 2 -> info, 9 -> debug
+const char *data_filename = "ftv2_fd_test.bin";
+FILE *logfile = NULL;
+uint8_t key_bin_rec[TOX_FILE_ID_LENGTH];
+
+const uint64_t totalf_size = 200L * 1024L * 1024L;
+uint64_t recv_bytes = 0;
+uint64_t recv_errors = 0;
+
+int f_online[3] = { 0, 0, 0};
+int ft_fin = 0;
+int ft_recv_fin = 0;
+int sender_chunk_requests = 0;
+int data_fd = -1;
+
+void dbg(int level, const char *fmt, ...)
+{
+    if ((fmt == NULL) || (!logfile) || (level > CURRENT_LOG_LEVEL))
+    {
+        return;
+    }
+
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    time_t t3 = time(NULL);
+    struct tm tm3;
+    tm3 = *localtime_r(&t3, &tm3);
+    fprintf(logfile, "%04d-%02d-%02d %02d:%02d:%02d.%06ld:%c:",
+             tm3.tm_year + 1900, tm3.tm_mon + 1, tm3.tm_mday,
+             tm3.tm_hour, tm3.tm_min, tm3.tm_sec, tv.tv_usec,
+             (level == 0) ? 'E' : ((level == 1) ? 'W' : ((level == 2) ? 'I' : 'D')));
+
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(logfile, fmt, ap);
+    va_end(ap);
+}
+
+void tox_log_cb__custom(Tox *tox, TOX_LOG_LEVEL level, const char *file, uint32_t line, const char *func,
+                        const char *message, void *user_data)
+{
+    dbg(9, "C-TOXCORE:%d:%s:%d:%s:%s\n", (int)level, file, (int)line, func, message);
+}
+
+// gives a counter value that increaes every millisecond
+static uint64_t current_time_monotonic_default2()
+{
+    uint64_t time = 0;
+    struct timespec clock_mono;
+    clock_gettime(CLOCK_MONOTONIC, &clock_mono);
+    time = 1000ULL * clock_mono.tv_sec + (clock_mono.tv_nsec / 1000000ULL);
+    return time;
+}
+
+static uint64_t thread_cpu_time_us()
+{
+    struct timespec clock_cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &clock_cpu);
+    return 1000000ULL * clock_cpu.tv_sec + (clock_cpu.tv_nsec / 1000ULL);
+}
+
+// the content of the test file at "position"
+static uint8_t file_byte(uint64_t position)
+{
+    return (uint8_t)((position * 31) ^ (position >> 11));
+}
+
+static Tox* tox_init(int num)
+{
+    struct Tox_Options options;
+    tox_options_default(&options);
+
+    // ----- set options ------
+    options.ipv6_enabled = false;
+    options.local_discovery_enabled = true;
+    options.hole_punching_enabled = true;
+    options.udp_enabled = true;
+    options.tcp_port = 0; // disable tcp relay function!
+    options.log_callback = tox_log_cb__custom;
+    // ----- set options ------
+
+    return tox_new(&options, NULL);
+}
+
+static void friend_connection_status_callback(Tox *tox, uint32_t friend_number, Tox_Connection connection_status,
+        void *userdata)
+{
+    uint8_t* unum = (uint8_t *)userdata;
+    uint8_t num = *unum;
+
+    dbg(9, "[%d]:connection to friend %d: %d\n", num, friend_number, connection_status);
+    f_online[num] = (int)connection_status;
+}
+
+static void file_recv_chunk(Tox *tox, uint32_t friendnumber, uint32_t filenumber, uint64_t position, const uint8_t *data,
+                       size_t length, void *userdata)
+{
+    if (data == NULL)
+    {
+        ft_recv_fin = 1;
+        return;
+    }
+
+    if (length < TOX_FILE_ID_LENGTH || memcmp(data, key_bin_rec, TOX_FILE_ID_LENGTH) != 0)
+    {
+        recv_errors++;
+        return;
+    }
+
+    for (size_t i = TOX_FILE_ID_LENGTH; i < length; i++)
+    {
+        if (data[i] != file_byte(position + i - TOX_FILE_ID_LENGTH))
+        {
+            recv_errors++;
+        }
+    }
+
+    recv_bytes += length - TOX_FILE_ID_LENGTH;
+}
+
+static void file_recv_control(Tox *tox, uint32_t friend_number, uint32_t file_number, Tox_File_Control control,
+                               void *userdata)
+{
+    uint8_t* unum = (uint8_t *)userdata;
+    uint8_t num = *unum;
+    dbg(9, "[%d]:file_recv_control. control=%d\n", num, control); // control "0" == "TOX_FILE_CONTROL_RESUME"
+}
+
+static void file_chunk_request(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
+                                   size_t length, void *userdata)
+{
+    if (length == 0)
+    {
+        ft_fin = 1;
+        return;
+    }
+
+    sender_chunk_requests++;
+
+    uint8_t *f_data = malloc(length + TOX_FILE_ID_LENGTH);
+    memcpy(f_data, key_bin_rec, TOX_FILE_ID_LENGTH);
+
+    if (pread(data_fd, f_data + TOX_FILE_ID_LENGTH, length, position) != (ssize_t)length)
+    {
+        dbg(0, "ERR:file_chunk_request: could not read %s\n", data_filename);
+        exit(2);
+    }
+
+    Tox_Err_File_Send_Chunk error;
+    tox_file_send_chunk(tox, friend_number, file_number, position, f_data, (length + TOX_FILE_ID_LENGTH), &error);
+
+    free(f_data);
+}
+
+static void file_receive(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t kind, uint64_t filesize,
+                             const uint8_t *filename, size_t filename_length, void *userdata)
+{
+    if (filesize != totalf_size)
+    {
+        dbg(0, "ERR:file_receive: size=%lu does not match send size=%lu\n", filesize, (uint64_t)totalf_size);
+        exit(2);
+    }
+
+    Tox_Err_File_Control error;
+    tox_file_control(tox, friend_number, file_number, TOX_FILE_CONTROL_RESUME, &error);
+}
+
+static bool write_data_file(void)
+{
+    FILE *f = fopen(data_filename, "wb");
+
+    if (!f)
+    {
+        return false;
+    }
+
+    uint8_t buf[65536];
+
+    for (uint64_t pos = 0; pos < totalf_size; pos += sizeof(buf))
+    {
+        for (size_t i = 0; i < sizeof(buf); i++)
+        {
+            buf[i] = file_byte(pos + i);
+        }
+
+        fwrite(buf, sizeof(buf), 1, f);
+    }
+
+    fclose(f);
+    return true;
+}
+
+static void send_file(Tox *tox1, Tox *tox2, uint8_t *num1, uint8_t *num2, const char *mode, int fd,
+                      const uint8_t *mapped)
+{
+    ft_fin = 0;
+    ft_recv_fin = 0;
+    recv_bytes = 0;
+    recv_errors = 0;
+    sender_chunk_requests = 0;
+
+    for (int i = 0; i < TOX_FILE_ID_LENGTH; i++)
+    {
+        key_bin_rec[i] = (uint8_t)rand();
+    }
+
+    Tox_Err_File_Send error;
+    uint64_t start_ts = current_time_monotonic_default2();
+    uint64_t sender_cpu_us = 0;
+
+    if (fd >= 0)
+    {
+        tox_file_send_fd(tox2, 0, TOX_FILE_KIND_FTV2, totalf_size, key_bin_rec, (const uint8_t *)"Gentoo.exe",
+                         sizeof("Gentoo.exe"), fd, &error);
+    }
+    else if (mapped != NULL)
+    {
+        tox_file_send_mmap(tox2, 0, TOX_FILE_KIND_FTV2, mapped, totalf_size, key_bin_rec,
+                           (const uint8_t *)"Gentoo.exe", sizeof("Gentoo.exe"), &error);
+    }
+    else
+    {
+        tox_file_send(tox2, 0, TOX_FILE_KIND_FTV2, totalf_size, key_bin_rec, (const uint8_t *)"Gentoo.exe",
+                      sizeof("Gentoo.exe"), &error);
+    }
+
+    if (error != TOX_ERR_FILE_SEND_OK)
+    {
+        dbg(0, "ERR:%s: could not send file: %d\n", mode, error);
+        exit(2);
+    }
+
+    while ((ft_fin == 0) || (ft_recv_fin == 0))
+    {
+        uint64_t cpu_start_us = thread_cpu_time_us();
+        tox_iterate(tox2, (void *)num2);
+        sender_cpu_us += thread_cpu_time_us() - cpu_start_us;
+        usleep(1);
+        tox_iterate(tox1, (void *)num1);
+        usleep(1);
+    }
+
+    uint64_t time_delta_ms = current_time_monotonic_default2() - start_ts;
+
+    if (time_delta_ms == 0)
+    {
+        time_delta_ms = 1;
+    }
+
+    dbg(2, "%-8s: %lu bytes in %lu ms, %.2f MB/s, sender cpu %lu ms, %d chunk requests\n", mode, recv_bytes,
+        time_delta_ms, ((float)recv_bytes / (1024 * 1024)) / ((float)time_delta_ms / 1000.0f),
+        sender_cpu_us / 1000, sender_chunk_requests);
+
+    if ((recv_errors != 0) || (recv_bytes < totalf_size))
+    {
+        dbg(0, "ERR:%s: %lu corrupted bytes, %lu of %lu bytes received\n", mode, recv_errors, recv_bytes,
+            (uint64_t)totalf_size);
+        exit(2);
+    }
+}
+
+int main(void)
+{
+    logfile = stdout;
+    setvbuf(logfile, NULL, _IOLBF, 0);
+
+    dbg(9, "--start--\n");
+
+    uint8_t num1 = 1;
+    uint8_t num2 = 2;
+
+    // HINT: force UDP mode
+    tox_set_force_udp_only_mode(true);
+
+    Tox *tox1 = tox_init(1);
+    Tox *tox2 = tox_init(2);
+
+    if ((!tox1) || (!tox2) || (!write_data_file()))
+    {
+        dbg(0, "ERR:setup failed\n");
+        exit(2);
+    }
+
+    uint8_t dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_dht_id(tox1, dht_key);
+    tox_bootstrap(tox2, "127.0.0.1", tox_self_get_udp_port(tox1, NULL), dht_key, NULL);
+
+    uint8_t public_key_bin[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_public_key(tox2, public_key_bin);
+    tox_friend_add_norequest(tox1, public_key_bin, NULL);
+    tox_self_get_public_key(tox1, public_key_bin);
+    tox_friend_add_norequest(tox2, public_key_bin, NULL);
+
+    tox_callback_friend_connection_status(tox1, friend_connection_status_callback);
+    tox_callback_friend_connection_status(tox2, friend_connection_status_callback);
+    tox_callback_file_recv_chunk(tox1, file_recv_chunk);
+    tox_callback_file_recv_control(tox1, file_recv_control);
+    tox_callback_file_recv(tox1, file_receive);
+    tox_callback_file_recv_control(tox2, file_recv_control);
+    tox_callback_file_chunk_request(tox2, file_chunk_request);
+
+    while (1 == 1) {
+        tox_iterate(tox1, (void *)&num1);
+        usleep(tox_iteration_interval(tox1)*1000);
+        tox_iterate(tox2, (void *)&num2);
+        usleep(tox_iteration_interval(tox2)*1000);
+        if ((f_online[1] > 0) && (f_online[2] > 0))
+        {
+            break;
+        }
+    }
+
+    dbg(2, "[%d]:friends online\n", 0);
+
+    int fd = open(data_filename, O_RDONLY);
+    const uint8_t *mapped = (fd < 0) ? MAP_FAILED : mmap(NULL, totalf_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    data_fd = fd;
+
+    if (mapped == MAP_FAILED)
+    {
+        dbg(0, "ERR:could not map %s\n", data_filename);
+        exit(2);
+    }
+
+    send_file(tox1, tox2, &num1, &num2, "warmup", fd, NULL);
+    send_file(tox1, tox2, &num1, &num2, "callback", -1, NULL);
+    send_file(tox1, tox2, &num1, &num2, "fd", fd, NULL);
+    send_file(tox1, tox2, &num1, &num2, "mmap", -1, mapped);
+
+    munmap((void *)mapped, totalf_size);
+    close(fd);
+    unlink(data_filename);
+
+    tox_kill(tox1);
+    tox_kill(tox2);
+
+    fclose(logfile);
+    return 0;
+}
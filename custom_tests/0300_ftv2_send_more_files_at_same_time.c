@@ -40,17 +40,38 @@ const char *savedata_filename1 = "savedata1.tox";
 const char *savedata_filename2 = "savedata2.tox";
 FILE *logfile = NULL;
 #define PARALLEL_FILES 5
-uint8_t *key_bin_rec[PARALLEL_FILES];
+/*
+ * When the bulk files are running, a small file with TOX_FILE_PRIORITY_HIGH is sent.
+ * It has to arrive within SMALL_FILE_MAX_LATENCY_MS, long before the bulk files are done.
+ */
+#define SMALL_FILE PARALLEL_FILES
+#define ALL_FILES (PARALLEL_FILES + 1)
+#define SMALL_FILE_START_AFTER_BYTES (5L * 1024L * 1024L)
+#define SMALL_FILE_MAX_LATENCY_MS 1000
+/*
+ * The first bulk file is sent with TOX_FILE_PRIORITY_HIGH, the others keep TOX_FILE_PRIORITY_NORMAL.
+ * When the high priority bulk file is received, every normal one must have received its share
+ * (4 chunks per 16 of the high one, so about a quarter), at least NORMAL_BULK_MIN_BYTES.
+ */
+#define HIGH_BULK_FILE 0
+#define NORMAL_BULK_MIN_BYTES (totalf_size / 16)
+uint8_t *key_bin_rec[ALL_FILES];
 
 const uint64_t totalf_size = 30L * 1024L * 1024L;
+const uint64_t small_f_size = 64L * 1024L;
 uint64_t cur_recv_pos = 0;
 uint64_t cur_send_pos = 0;
+uint64_t recv_bytes = 0;
+uint64_t recv_file_bytes[ALL_FILES];
 uint32_t print_counter = 0;
-uint8_t *send_file[PARALLEL_FILES];
-uint8_t *recv_file[PARALLEL_FILES];
+uint8_t *send_file[ALL_FILES];
+uint8_t *recv_file[ALL_FILES];
 
 int f_online[3] = { 0, 0, 0};
-int ft_fin[PARALLEL_FILES];
+int ft_fin[ALL_FILES];
+int ft_recv_fin[ALL_FILES];
+uint64_t small_file_start_ms = 0;
+uint64_t small_file_recv_ms = 0;
 
 struct Node1 {
     char *ip;
@@ -249,6 +270,18 @@ static uint32_t receive_filenum_to_filenum(uint32_t file_number)
     return (uint32_t)((file_number >> 16) - 1);
 }
 
+static uint64_t file_size_of(uint32_t file_index)
+{
+    return (file_index == SMALL_FILE) ? small_f_size : totalf_size;
+}
+
+static uint64_t current_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000) + ((uint64_t)ts.tv_nsec / 1000000);
+}
+
 static void hex_string_to_bin2(const char *hex_string, uint8_t *output) {
     size_t len = strlen(hex_string) / 2;
     size_t i = len;
@@ -472,10 +505,11 @@ static void file_recv_chunk(Tox *tox, uint32_t friendnumber, uint32_t filenumber
         dbg(9, "[%d]: -> file_recv_chunk FINISHED:RECEIVER filenum=%d pos=%lu length=%d\n", num, receive_filenum_to_filenum(filenumber), position, (int)length);
         
         dbg(9, "[%d]: -> file_recv_chunk FINISHED:RECEIVER:comparing files ...\n", num);
-        uint8_t *send_file_tmp = send_file[receive_filenum_to_filenum(filenumber)];
-        uint8_t *recv_file_tmp = recv_file[receive_filenum_to_filenum(filenumber)];
+        uint32_t file_index = receive_filenum_to_filenum(filenumber);
+        uint8_t *send_file_tmp = send_file[file_index];
+        uint8_t *recv_file_tmp = recv_file[file_index];
         uint64_t i = 0;
-        while(i++ < totalf_size)
+        while(i++ < file_size_of(file_index))
         {
             if ((uint8_t)*send_file_tmp != (uint8_t)*recv_file_tmp)
             {
@@ -486,6 +520,12 @@ static void file_recv_chunk(Tox *tox, uint32_t friendnumber, uint32_t filenumber
             recv_file_tmp++;
         }
         dbg(9, "[%d]: -> file_recv_chunk FINISHED:RECEIVER:comparing files ... DONE\n", num);
+        ft_recv_fin[file_index] = 1;
+
+        if (file_index == SMALL_FILE)
+        {
+            small_file_recv_ms = current_time_ms();
+        }
     }
     else
     {
@@ -502,6 +542,8 @@ static void file_recv_chunk(Tox *tox, uint32_t friendnumber, uint32_t filenumber
         // dbg(9, "[%d]:ID:C: %.*s\n", 1, TOX_FILE_ID_LENGTH * 2, key_str_chunk);
 
         cur_recv_pos = position;
+        recv_bytes += (length - TOX_FILE_ID_LENGTH);
+        recv_file_bytes[receive_filenum_to_filenum(filenumber)] += (length - TOX_FILE_ID_LENGTH);
 
         memcpy((recv_file[receive_filenum_to_filenum(filenumber)] + position), (data + TOX_FILE_ID_LENGTH), (length - TOX_FILE_ID_LENGTH));
     }
@@ -568,14 +610,15 @@ static void file_receive(Tox *tox, uint32_t friend_number, uint32_t file_number,
 
     dbg(9, "[%d]:file_receive:%s size=%lu kind=%d\n", num, filename, filesize, kind);
 
-    if (filesize != totalf_size)
+    uint64_t expected_size = file_size_of(receive_filenum_to_filenum(file_number));
+    if (filesize != expected_size)
     {
-        dbg(9, "[%d]:ERR:file_receive:%s size=%lu kind=%d does not match send size=%lu\n", num, filename, filesize, kind, (uint64_t)totalf_size);
+        dbg(9, "[%d]:ERR:file_receive:%s size=%lu kind=%d does not match send size=%lu\n", num, filename, filesize, kind, expected_size);
         exit(2);
     }
     else
     {
-        dbg(9, "[%d]:file_receive:%s size=%lu kind=%d DOES match send size=%lu\n", num, filename, filesize, kind, (uint64_t)totalf_size);
+        dbg(9, "[%d]:file_receive:%s size=%lu kind=%d DOES match send size=%lu\n", num, filename, filesize, kind, expected_size);
     }
 
     if (!recv_file[receive_filenum_to_filenum(file_number)])
@@ -641,10 +684,12 @@ int main(void)
     del_savefile(1);
     del_savefile(2);
 
-    for (int k=0;k<PARALLEL_FILES;k++)
+    for (int k=0;k<ALL_FILES;k++)
     {
         key_bin_rec[k] = calloc(1, TOX_FILE_ID_LENGTH);
         ft_fin[k] = 0;
+        ft_recv_fin[k] = 0;
+        recv_file_bytes[k] = 0;
     }
 
     uint8_t num1 = 1;
@@ -697,17 +742,17 @@ int main(void)
 
     dbg(9, "[%d]:friends online\n", 0);
 
-    for (int k=0;k<PARALLEL_FILES;k++)
+    for (int k=0;k<ALL_FILES;k++)
     {
-        send_file[k] = calloc(1, (size_t)totalf_size);
+        send_file[k] = calloc(1, (size_t)file_size_of(k));
     }
 
     dbg(9, "[%d]:generating random mem ...\n", 0);
-    for (int k=0;k<PARALLEL_FILES;k++)
+    for (int k=0;k<ALL_FILES;k++)
     {
         uint8_t *send_file_tmp = send_file[k];
         uint64_t i = 0;
-        while(i++ < totalf_size)
+        while(i++ < file_size_of(k))
         {
             uint8_t random_byte = (uint8_t)(rand() % 255);
             *send_file_tmp = random_byte;
@@ -725,6 +770,17 @@ int main(void)
                                       strlen(this_filename), NULL);
         dbg(9, "[%d]:tox_file_send:file_number=%d\n", 0, fnum);
 
+        if (k == HIGH_BULK_FILE)
+        {
+            Tox_Err_File_Set_Priority perr;
+            tox_file_set_priority(tox2, 0, fnum, TOX_FILE_PRIORITY_HIGH, &perr);
+            if ((fnum != HIGH_BULK_FILE) || (perr != TOX_ERR_FILE_SET_PRIORITY_OK))
+            {
+                dbg(0, "[%d]:ERR:could not raise the priority of bulk file %d\n", 0, k);
+                exit(4);
+            }
+        }
+
         uint8_t key_bin1[TOX_FILE_ID_LENGTH];
         char    key_str1[TOX_FILE_ID_LENGTH * 2];
         Tox_Err_File_Get gfierr1;
@@ -740,6 +796,9 @@ int main(void)
         usleep(tox_iteration_interval(tox2)*1000);
     }
 
+    uint64_t last_stats_ms = current_time_ms();
+    uint64_t normal_bulk_bytes_min = UINT64_MAX;
+
     while (1 == 1) {
         tox_iterate(tox1, (void *)&num1);
         // usleep(tox_iteration_interval(tox1) * 1000);
@@ -747,15 +806,60 @@ int main(void)
         tox_iterate(tox2, (void *)&num2);
         // usleep(tox_iteration_interval(tox2) * 1000);
         usleep(1*1000);
+
+        if ((small_file_start_ms == 0) && (recv_bytes >= SMALL_FILE_START_AFTER_BYTES))
+        {
+            const char *small_filename = "avatar.png";
+            uint32_t fnum = tox_file_send(tox2, 0, TOX_FILE_KIND_FTV2, small_f_size, NULL, (const uint8_t *)small_filename,
+                                          strlen(small_filename), NULL);
+            Tox_Err_File_Set_Priority perr;
+            tox_file_set_priority(tox2, 0, fnum, TOX_FILE_PRIORITY_HIGH, &perr);
+            Tox_Err_File_Get gfierr2;
+            tox_file_get_file_id(tox2, 0, fnum, key_bin_rec[SMALL_FILE], &gfierr2);
+            small_file_start_ms = current_time_ms();
+            dbg(9, "[%d]:small file sent under load:file_number=%d priority res=%d\n", 0, fnum, perr);
+
+            if ((fnum != SMALL_FILE) || (perr != TOX_ERR_FILE_SET_PRIORITY_OK))
+            {
+                dbg(0, "[%d]:ERR:could not send the small file\n", 0);
+                exit(4);
+            }
+        }
+
+        if ((current_time_ms() - last_stats_ms) >= 1000)
+        {
+            last_stats_ms = current_time_ms();
+            for (int k=0;k<ALL_FILES;k++)
+            {
+                if ((ft_fin[k] == 0) && ((k != SMALL_FILE) || (small_file_start_ms != 0)))
+                {
+                    dbg(9, "[%d]:file %d sending at %lu bytes/s\n", 0, k,
+                        tox_file_get_bytes_per_second(tox2, 0, k, NULL));
+                }
+            }
+        }
+
+        if ((normal_bulk_bytes_min == UINT64_MAX) && (ft_recv_fin[HIGH_BULK_FILE] == 1))
+        {
+            for (int k=0;k<PARALLEL_FILES;k++)
+            {
+                if ((k != HIGH_BULK_FILE) && (recv_file_bytes[k] < normal_bulk_bytes_min))
+                {
+                    normal_bulk_bytes_min = recv_file_bytes[k];
+                }
+            }
+            dbg(9, "[%d]:high priority bulk file done, normal ones got at least %lu bytes\n", 0, normal_bulk_bytes_min);
+        }
+
         int finished_fts = 0;
-        for (int k=0;k<PARALLEL_FILES;k++)
+        for (int k=0;k<ALL_FILES;k++)
         {
-            if (ft_fin[k] == 1)
+            if ((ft_fin[k] == 1) && (ft_recv_fin[k] == 1))
             {
                 finished_fts++;
             }
         }
-        if (finished_fts >= PARALLEL_FILES)
+        if (finished_fts >= ALL_FILES)
         {
             break;
         }
@@ -763,11 +867,27 @@ int main(void)
 
     dbg(9, "[%d]:FTv2 ... DONE\n", 0);
 
+    uint64_t small_file_latency_ms = small_file_recv_ms - small_file_start_ms;
+    dbg(9, "[%d]:small file latency under load: %lu ms\n", 0, small_file_latency_ms);
+
+    if (small_file_latency_ms > SMALL_FILE_MAX_LATENCY_MS)
+    {
+        dbg(0, "[%d]:ERR:small file took %lu ms, more than %d ms\n", 0, small_file_latency_ms, SMALL_FILE_MAX_LATENCY_MS);
+        exit(5);
+    }
+
+    if (normal_bulk_bytes_min < NORMAL_BULK_MIN_BYTES)
+    {
+        dbg(0, "[%d]:ERR:normal priority bulk files got only %lu bytes while the high one ran, expected %lu\n", 0,
+            normal_bulk_bytes_min, (uint64_t)NORMAL_BULK_MIN_BYTES);
+        exit(6);
+    }
+
     tox_kill(tox1);
     tox_kill(tox2);
     dbg(9, "[%d]:killed tox\n", 0);
 
-    for (int k=0;k<PARALLEL_FILES;k++)
+    for (int k=0;k<ALL_FILES;k++)
     {
         dbg(9, "[%d]:freeing buffers #%d\n", 0, k);
         free(send_file[k]);
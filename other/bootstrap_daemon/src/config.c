@@ -18,6 +18,8 @@
 
 #include <libconfig.h>
 
+#include "../../../toxcore/TCP_server.h"
+#include "../../../toxcore/onion_announce.h"
 #include "../../bootstrap_node_packets.h"
 
 /**
@@ -129,7 +131,8 @@ static void parse_tcp_relay_ports_config(config_t *cfg, uint16_t **tcp_relay_por
 
 int get_general_config(const char *cfg_file_path, char **pid_file_path, char **keys_file_path, int *port,
                        int *enable_ipv6, int *enable_ipv4_fallback, int *enable_lan_discovery, int *enable_tcp_relay,
-                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *enable_motd, char **motd)
+                       uint16_t **tcp_relay_ports, int *tcp_relay_port_count, int *tcp_relay_threads,
+                       int *onion_announce_entries, int *enable_motd, char **motd)
 {
     config_t cfg;
 
@@ -140,6 +143,8 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
     const char *NAME_ENABLE_IPV4_FALLBACK = "enable_ipv4_fallback";
     const char *NAME_ENABLE_LAN_DISCOVERY = "enable_lan_discovery";
     const char *NAME_ENABLE_TCP_RELAY     = "enable_tcp_relay";
+    const char *NAME_TCP_RELAY_THREADS    = "tcp_relay_threads";
+    const char *NAME_ONION_ANNOUNCE_ENTRIES = "onion_announce_entries";
     const char *NAME_ENABLE_MOTD          = "enable_motd";
     const char *NAME_MOTD                 = "motd";
 
@@ -232,6 +237,36 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
         *tcp_relay_port_count = 0;
     }
 
+    // Get TCP relay threads option
+    if (config_lookup_int(&cfg, NAME_TCP_RELAY_THREADS, tcp_relay_threads) == CONFIG_FALSE) {
+        log_write(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_TCP_RELAY_THREADS);
+        log_write(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_TCP_RELAY_THREADS, DEFAULT_TCP_RELAY_THREADS);
+        *tcp_relay_threads = DEFAULT_TCP_RELAY_THREADS;
+    }
+
+    if (*tcp_relay_threads < 0 || *tcp_relay_threads > TCP_SERVER_MAX_THREADS) {
+        log_write(LOG_LEVEL_WARNING, "Invalid '%s': %d, should be in [0, %d]\n", NAME_TCP_RELAY_THREADS,
+                  *tcp_relay_threads, TCP_SERVER_MAX_THREADS);
+        log_write(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_TCP_RELAY_THREADS, DEFAULT_TCP_RELAY_THREADS);
+        *tcp_relay_threads = DEFAULT_TCP_RELAY_THREADS;
+    }
+
+    // Get onion announce store size
+    if (config_lookup_int(&cfg, NAME_ONION_ANNOUNCE_ENTRIES, onion_announce_entries) == CONFIG_FALSE) {
+        log_write(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_ONION_ANNOUNCE_ENTRIES);
+        log_write(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_ONION_ANNOUNCE_ENTRIES,
+                  DEFAULT_ONION_ANNOUNCE_ENTRIES);
+        *onion_announce_entries = DEFAULT_ONION_ANNOUNCE_ENTRIES;
+    }
+
+    if (*onion_announce_entries < 1 || *onion_announce_entries > ONION_ANNOUNCE_ENTRIES_LIMIT) {
+        log_write(LOG_LEVEL_WARNING, "Invalid '%s': %d, should be in [1, %d]\n", NAME_ONION_ANNOUNCE_ENTRIES,
+                  *onion_announce_entries, ONION_ANNOUNCE_ENTRIES_LIMIT);
+        log_write(LOG_LEVEL_WARNING, "Using default '%s': %d\n", NAME_ONION_ANNOUNCE_ENTRIES,
+                  DEFAULT_ONION_ANNOUNCE_ENTRIES);
+        *onion_announce_entries = DEFAULT_ONION_ANNOUNCE_ENTRIES;
+    }
+
     // Get MOTD option
     if (config_lookup_bool(&cfg, NAME_ENABLE_MOTD, enable_motd) == CONFIG_FALSE) {
         log_write(LOG_LEVEL_WARNING, "No '%s' setting in configuration file.\n", NAME_ENABLE_MOTD);
@@ -279,8 +314,12 @@ int get_general_config(const char *cfg_file_path, char **pid_file_path, char **k
                 log_write(LOG_LEVEL_INFO, "Port #%d: %u\n", i, (*tcp_relay_ports)[i]);
             }
         }
+
+        log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_TCP_RELAY_THREADS, *tcp_relay_threads);
     }
 
+    log_write(LOG_LEVEL_INFO, "'%s': %d\n", NAME_ONION_ANNOUNCE_ENTRIES, *onion_announce_entries);
+
     log_write(LOG_LEVEL_INFO, "'%s': %s\n", NAME_ENABLE_MOTD,          *enable_motd          ? "true" : "false");
 
     if (*enable_motd) {
@@ -243,11 +243,14 @@ int main(int argc, char *argv[])
     int enable_tcp_relay;
     uint16_t *tcp_relay_ports = nullptr;
     int tcp_relay_port_count;
+    int tcp_relay_threads;
+    int onion_announce_entries;
     int enable_motd;
     char *motd = nullptr;
 
     if (get_general_config(cfg_file_path, &pid_file_path, &keys_file_path, &start_port, &enable_ipv6, &enable_ipv4_fallback,
-                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &enable_motd, &motd)) {
+                           &enable_lan_discovery, &enable_tcp_relay, &tcp_relay_ports, &tcp_relay_port_count, &tcp_relay_threads,
+                           &onion_announce_entries, &enable_motd, &motd)) {
         log_write(LOG_LEVEL_INFO, "General config read successfully\n");
     } else {
         log_write(LOG_LEVEL_ERROR, "Couldn't read config file: %s. Exiting.\n", cfg_file_path);
@@ -415,6 +418,11 @@ int main(int argc, char *argv[])
         return 1;
     }
 
+    if (!onion_announce_set_max_entries(onion_a, onion_announce_entries)) {
+        log_write(LOG_LEVEL_WARNING, "Couldn't store %d onion announcements, keeping room for %u.\n",
+                  onion_announce_entries, onion_announce_max_entries(onion_a));
+    }
+
     gca_onion_init(group_announce, onion_a);
 
     if (enable_motd) {
@@ -476,8 +484,8 @@ int main(int argc, char *argv[])
             return 1;
         }
 
-        tcp_server = new_TCP_server(logger, rng, ns, enable_ipv6, tcp_relay_port_count, tcp_relay_ports,
-                                    dht_get_self_secret_key(dht), onion, forwarding);
+        tcp_server = new_TCP_server_ex(logger, rng, ns, enable_ipv6, tcp_relay_port_count, tcp_relay_ports,
+                                       dht_get_self_secret_key(dht), onion, forwarding, tcp_relay_threads);
 
         free(tcp_relay_ports);
 
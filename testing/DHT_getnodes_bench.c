@@ -0,0 +1,137 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* DHT get nodes benchmark
+ *
+ * Fills a DHT with nodes in every close list bucket and in the client lists
+ * of many friends, then replays a flood of get nodes requests for random keys
+ * and reports how long it took to find the closest nodes for each.
+ *
+ * Usage: ./DHT_getnodes_bench [friends] [nodes] [requests]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/logger.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/network.h"
+
+static IP_Port next_ip_port(uint32_t *counter)
+{
+    IP_Port ip_port = {{{0}}};
+    ip_port.ip.family = net_family_ipv4();
+    ip_port.ip.ip.v4.uint32 = net_htonl(0x01000000 + *counter);
+    ip_port.port = net_htons(33445);
+    ++*counter;
+    return ip_port;
+}
+
+/** Add nodes at every distance from our own key, filling the close list. */
+static void fill_close_list(DHT *dht, const Random *rng, uint32_t *counter)
+{
+    const uint8_t *self_pk = dht_get_self_public_key(dht);
+
+    for (uint32_t bucket = 0; bucket < LCLIENT_LENGTH; ++bucket) {
+        for (uint32_t i = 0; i < LCLIENT_NODES; ++i) {
+            uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE];
+            random_bytes(rng, pk, sizeof(pk));
+
+            // Share the first `bucket` bits with our key and differ in the next one.
+            for (uint32_t bit = 0; bit <= bucket; ++bit) {
+                const uint8_t mask = 0x80 >> (bit % 8);
+                const uint8_t self_bit = self_pk[bit / 8] & mask;
+                const uint8_t want = bit == bucket ? (self_bit ^ mask) : self_bit;
+                pk[bit / 8] = (pk[bit / 8] & ~mask) | want;
+            }
+
+            const IP_Port ip_port = next_ip_port(counter);
+            addto_lists(dht, &ip_port, pk);
+        }
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_friends = argc > 1 ? (uint32_t)atoi(argv[1]) : 200;
+    const uint32_t num_nodes = argc > 2 ? (uint32_t)atoi(argv[2]) : 20000;
+    const uint32_t num_requests = argc > 3 ? (uint32_t)atoi(argv[3]) : 1000000;
+
+    Logger *log = logger_new();
+    const Random *rng = system_random();
+    const Network *ns = system_network();
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+    Networking_Core *net = new_networking_no_udp(log, ns);
+    DHT *dht = new_dht(log, rng, ns, mono_time, net, true, true);
+
+    if (log == nullptr || rng == nullptr || mono_time == nullptr || net == nullptr || dht == nullptr) {
+        fprintf(stderr, "failed to create DHT\n");
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num_friends; ++i) {
+        uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(rng, pk, sizeof(pk));
+        uint32_t lock_token;
+
+        if (dht_addfriend(dht, pk, nullptr, nullptr, 0, &lock_token) != 0) {
+            fprintf(stderr, "failed to add friend %u\n", i);
+            return 1;
+        }
+    }
+
+    uint32_t counter = 0;
+    fill_close_list(dht, rng, &counter);
+
+    for (uint32_t i = 0; i < num_nodes; ++i) {
+        uint8_t pk[CRYPTO_PUBLIC_KEY_SIZE];
+        random_bytes(rng, pk, sizeof(pk));
+        const IP_Port ip_port = next_ip_port(&counter);
+        addto_lists(dht, &ip_port, pk);
+    }
+
+    uint32_t num_close = 0;
+
+    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
+        num_close += dht_get_close_client(dht, i)->assoc4.timestamp != 0;
+    }
+
+    printf("%u friends, %u close nodes, %u nodes offered, %u requests\n",
+           dht_get_num_friends(dht), num_close, num_nodes, num_requests);
+
+    // Pre-generate the requested keys so the loop only measures the lookup.
+    const uint32_t num_keys = 4096;
+    uint8_t *keys = (uint8_t *)malloc(num_keys * CRYPTO_PUBLIC_KEY_SIZE);
+
+    if (keys == nullptr) {
+        return 1;
+    }
+
+    random_bytes(rng, keys, num_keys * CRYPTO_PUBLIC_KEY_SIZE);
+
+    uint64_t found = 0;
+    const clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_requests; ++i) {
+        Node_format nodes[MAX_SENT_NODES];
+        found += get_close_nodes(dht, keys + (i % num_keys) * CRYPTO_PUBLIC_KEY_SIZE, nodes, net_family_unspec(),
+                                 false, false);
+    }
+
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%.3f s, %.0f requests/s, %.2f nodes per response\n",
+           seconds, seconds > 0 ? num_requests / seconds : 0.0, (double)found / (num_requests > 0 ? num_requests : 1));
+
+    free(keys);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
@@ -0,0 +1,69 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Symmetric packet crypto benchmark
+ *
+ * Encrypts and decrypts packets of the size of a full net_crypto data packet
+ * with encrypt_data_symmetric and decrypt_data_symmetric and reports how many
+ * round trips it did per second.
+ *
+ * Usage: ./crypto_symmetric_bench [packets] [packet size]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_packets = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+    // Roughly the size of a full net_crypto data packet.
+    const uint32_t packet_size = argc > 2 ? (uint32_t)atoi(argv[2]) : 1373;
+
+    const Random *rng = system_random();
+
+    if (rng == nullptr || packet_size == 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    uint8_t key[CRYPTO_SHARED_KEY_SIZE];
+    uint8_t nonce[CRYPTO_NONCE_SIZE] = {0};
+    new_symmetric_key(rng, key);
+
+    uint8_t *plain = (uint8_t *)calloc(packet_size, 1);
+    uint8_t *encrypted = (uint8_t *)malloc(packet_size + CRYPTO_MAC_SIZE);
+
+    if (plain == nullptr || encrypted == nullptr) {
+        fprintf(stderr, "out of memory\n");
+        free(encrypted);
+        free(plain);
+        return 1;
+    }
+
+    const clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_packets; ++i) {
+        if (encrypt_data_symmetric(key, nonce, plain, packet_size, encrypted) != (int32_t)(packet_size + CRYPTO_MAC_SIZE)
+                || decrypt_data_symmetric(key, nonce, encrypted, packet_size + CRYPTO_MAC_SIZE, plain) != (int32_t)packet_size) {
+            fprintf(stderr, "round trip of packet %u failed\n", i);
+            free(encrypted);
+            free(plain);
+            return 1;
+        }
+
+        increment_nonce(nonce);
+    }
+
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("encrypt+decrypt of %u packets (%u bytes): %.0f packets/sec\n", num_packets, packet_size,
+           seconds > 0 ? num_packets / seconds : 0.0);
+
+    free(encrypted);
+    free(plain);
+    return 0;
+}
@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Group peer lookup benchmark
+ *
+ * Fills a group with synthetic peers and measures the operations that look
+ * peers up by public key or peer id: adding the peers (which checks for
+ * duplicates and picks a free peer id), finding peers by encryption key, the
+ * public API calls that take a peer id, and deleting half of the peers again.
+ * Every lookup is checked against the peer it should find, so the benchmark
+ * also fails loudly if the peer list and the lookups disagree.
+ *
+ * The synthetic peers never connect to anyone; only the local bookkeeping is
+ * measured.
+ *
+ * Usage: ./group_peer_lookup_bench [peers] [lookups]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/group_chats.h"
+#include "../toxcore/group_connection.h"
+#include "../toxcore/tox.h"
+#include "../toxcore/tox_struct.h"
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void print_rate(const char *what, uint32_t count, double seconds)
+{
+    printf("%-24s %8u in %8.3f s, %12.0f/s\n", what, count, seconds, seconds > 0 ? count / seconds : 0.0);
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_peers = argc > 1 ? (uint32_t)atoi(argv[1]) : 5000;
+    const uint32_t num_lookups = argc > 2 ? (uint32_t)atoi(argv[2]) : 1000000;
+
+    if (num_peers == 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    struct Tox_Options *options = tox_options_new(nullptr);
+
+    if (options == nullptr) {
+        fprintf(stderr, "failed to allocate\n");
+        return 1;
+    }
+
+    tox_options_set_ipv6_enabled(options, false);
+    tox_options_set_local_discovery_enabled(options, false);
+
+    Tox *tox = tox_new(options, nullptr);
+    tox_options_free(options);
+
+    if (tox == nullptr) {
+        fprintf(stderr, "failed to create tox instance\n");
+        return 1;
+    }
+
+    const uint8_t name[] = "bench";
+    const uint32_t group_number = tox_group_new(tox, TOX_GROUP_PRIVACY_STATE_PRIVATE, name, sizeof(name) - 1,
+                                  name, sizeof(name) - 1, nullptr);
+    GC_Session *c = tox->m->group_handler;
+    GC_Chat *chat = gc_get_group(c, group_number);
+
+    const Random *rng = system_random();
+    uint8_t *keys = (uint8_t *)malloc((size_t)num_peers * ENC_PUBLIC_KEY_SIZE);
+    uint32_t *peer_ids = (uint32_t *)malloc(num_peers * sizeof(uint32_t));
+    uint32_t *order = (uint32_t *)malloc((num_lookups + 1) * sizeof(uint32_t));
+
+    if (chat == nullptr || rng == nullptr || keys == nullptr || peer_ids == nullptr || order == nullptr) {
+        fprintf(stderr, "failed to set up group\n");
+        return 1;
+    }
+
+    random_bytes(rng, keys, (size_t)num_peers * ENC_PUBLIC_KEY_SIZE);
+
+    for (uint32_t i = 0; i < num_lookups; ++i) {
+        order[i] = random_range_u32(rng, num_peers);
+    }
+
+    uint32_t failed = 0;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        const int peer_number = peer_add(chat, nullptr, keys + (size_t)i * ENC_PUBLIC_KEY_SIZE);
+
+        if (peer_number < 0) {
+            fprintf(stderr, "failed to add peer %u\n", i);
+            return 1;
+        }
+
+        peer_ids[i] = chat->group[peer_number].peer_id;
+    }
+
+    print_rate("peers added", num_peers, seconds_since(&start));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < num_lookups; ++i) {
+        const int peer_number = get_peer_number_of_enc_pk(chat, keys + (size_t)order[i] * ENC_PUBLIC_KEY_SIZE, false);
+        failed += peer_number < 0 || chat->group[peer_number].peer_id != peer_ids[order[i]];
+    }
+
+    print_rate("lookups by public key", num_lookups, seconds_since(&start));
+
+    uint8_t public_key[TOX_GROUP_PEER_PUBLIC_KEY_SIZE];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < num_lookups; ++i) {
+        failed += !tox_group_peer_get_public_key(tox, group_number, peer_ids[order[i]], public_key, nullptr)
+                  || memcmp(public_key, keys + (size_t)order[i] * ENC_PUBLIC_KEY_SIZE, ENC_PUBLIC_KEY_SIZE) != 0;
+    }
+
+    print_rate("lookups by peer id", num_lookups, seconds_since(&start));
+
+    // Delete every other peer; the last peer moves into each freed slot.
+    for (uint32_t i = 0; i < num_peers; i += 2) {
+        const int peer_number = get_peer_number_of_enc_pk(chat, keys + (size_t)i * ENC_PUBLIC_KEY_SIZE, false);
+
+        if (peer_number > 0) {
+            gcc_mark_for_deletion(&chat->group[peer_number].gconn, chat->tcp_conn, GC_EXIT_TYPE_NO_CALLBACK,
+                                  nullptr, 0);
+        }
+    }
+
+    const uint32_t num_deleted = (num_peers + 1) / 2;
+    const uint32_t expected_numpeers = 1 + num_peers - num_deleted;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // A peer moved into a slot that was just freed is deleted by the next iteration.
+    for (uint32_t i = 0; i < num_peers && chat->numpeers > expected_numpeers; ++i) {
+        do_gc(c, nullptr);
+    }
+
+    print_rate("peers deleted", num_deleted, seconds_since(&start));
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        const bool deleted = i % 2 == 0;
+        const int peer_number = get_peer_number_of_enc_pk(chat, keys + (size_t)i * ENC_PUBLIC_KEY_SIZE, false);
+        const bool found = tox_group_peer_get_public_key(tox, group_number, peer_ids[i], public_key, nullptr);
+
+        if (deleted) {
+            failed += peer_number >= 0 || found;
+        } else {
+            failed += peer_number < 0 || !found || chat->group[peer_number].peer_id != peer_ids[i];
+        }
+    }
+
+    printf("%u peers left, %u failed\n", chat->numpeers - 1, failed);
+
+    free(order);
+    free(peer_ids);
+    free(keys);
+    tox_kill(tox);
+    return failed == 0 ? 0 : 1;
+}
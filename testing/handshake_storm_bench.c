@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Handshake storm benchmark
+ *
+ * Simulates many peers connecting to one node at the same moment, as happens
+ * when a bootstrap node restarts or our NAT mapping changes. The node runs
+ * DHT and Net_Crypto on a loopback Network that queues datagrams in memory:
+ * its socket buffer holds a bounded number of packets and drops the rest. Each
+ * peer sends a cookie request, answers the cookie response with a handshake
+ * and is done once the node accepts the connection and sends its own
+ * handshake back. Peers resend whatever went unanswered after a while, like
+ * real clients do. Optionally each peer first sends a DHT crypto request, the
+ * packet that carries DHT public key announcements and NAT pings, and only
+ * starts the handshake once the node handled it.
+ *
+ * The keys of the peers are computed before the clock starts, so the time
+ * measured is what the node spends. Reports how long it took for all peers to
+ * connect, how long individual peers waited and the longest single iteration
+ * of the node's main loop, which is how long all other traffic stalled.
+ *
+ * Usage: ./handshake_storm_bench [peers] [threads] [socket buffer packets] [retry ms] [crypto requests 0/1]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/logger.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/net_crypto.h"
+#include "../toxcore/network.h"
+#include "misc_tools.h"
+
+// Same layout as in network.c, so the loopback functions can fill it in.
+struct Network_Addr {
+    struct sockaddr_storage addr;
+    size_t size;
+};
+
+#define COOKIE_LENGTH (CRYPTO_NONCE_SIZE + sizeof(uint64_t) + 2 * CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_MAC_SIZE)
+#define COOKIE_REQUEST_PLAIN_LENGTH (2 * CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint64_t))
+#define COOKIE_REQUEST_LENGTH (1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + COOKIE_REQUEST_PLAIN_LENGTH + CRYPTO_MAC_SIZE)
+#define COOKIE_RESPONSE_LENGTH (1 + CRYPTO_NONCE_SIZE + COOKIE_LENGTH + sizeof(uint64_t) + CRYPTO_MAC_SIZE)
+#define HANDSHAKE_PLAIN_LENGTH (CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_SHA512_SIZE + COOKIE_LENGTH)
+#define HANDSHAKE_PACKET_LENGTH (1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE + HANDSHAKE_PLAIN_LENGTH + CRYPTO_MAC_SIZE)
+
+#define NODE_SOCKET 3
+#define PEER_PORT 33445
+#define MAX_DATAGRAM_SIZE HANDSHAKE_PACKET_LENGTH
+#define CRYPTO_REQUEST_DATA_LENGTH 64
+#define CRYPTO_REQUEST_LENGTH (1 + 2 * CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE + 1 + CRYPTO_REQUEST_DATA_LENGTH + CRYPTO_MAC_SIZE)
+
+typedef struct Datagram {
+    uint32_t peer;
+    uint16_t length;
+    uint8_t data[MAX_DATAGRAM_SIZE];
+} Datagram;
+
+/** A bounded FIFO of datagrams, standing in for a socket buffer. */
+typedef struct Queue {
+    Datagram *packets;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t count;
+    uint64_t dropped;
+} Queue;
+
+typedef enum Peer_State {
+    PEER_WANTS_REQUEST,
+    PEER_WANTS_COOKIE,
+    PEER_WANTS_ACCEPT,
+    PEER_CONNECTED,
+} Peer_State;
+
+typedef struct Peer {
+    uint8_t real_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t dht_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    /* Keys shared with the node's DHT and real key, computed up front. */
+    uint8_t dht_shared_key[CRYPTO_SHARED_KEY_SIZE];
+    uint8_t real_shared_key[CRYPTO_SHARED_KEY_SIZE];
+
+    Peer_State state;
+    uint8_t cookie[COOKIE_LENGTH];
+    uint64_t last_sent;
+    uint64_t connected_after;
+    uint32_t sent;
+} Peer;
+
+typedef struct Loopback {
+    Queue to_node;
+    Queue to_peers;
+} Loopback;
+
+static bool queue_init(Queue *queue, uint32_t capacity)
+{
+    queue->packets = (Datagram *)calloc(capacity, sizeof(Datagram));
+    queue->capacity = capacity;
+    return queue->packets != nullptr;
+}
+
+static void queue_push(Queue *queue, uint32_t peer, const uint8_t *data, size_t length)
+{
+    if (queue->count == queue->capacity || length > MAX_DATAGRAM_SIZE) {
+        ++queue->dropped;
+        return;
+    }
+
+    Datagram *packet = &queue->packets[(queue->head + queue->count) % queue->capacity];
+    packet->peer = peer;
+    packet->length = (uint16_t)length;
+    memcpy(packet->data, data, length);
+    ++queue->count;
+}
+
+static const Datagram *queue_pop(Queue *queue)
+{
+    if (queue->count == 0) {
+        return nullptr;
+    }
+
+    const Datagram *packet = &queue->packets[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    --queue->count;
+    return packet;
+}
+
+static uint32_t peer_address(uint32_t peer)
+{
+    return 0x0a000001 + peer;  // 10.0.0.1 and up
+}
+
+static int loopback_ok(void *obj, int sock)
+{
+    return 0;
+}
+
+static int loopback_accept(void *obj, int sock)
+{
+    return -1;
+}
+
+static int loopback_bind(void *obj, int sock, const Network_Addr *addr)
+{
+    return 0;
+}
+
+static int loopback_listen(void *obj, int sock, int backlog)
+{
+    return -1;
+}
+
+static int loopback_recv(void *obj, int sock, uint8_t *buf, size_t len)
+{
+    errno = EWOULDBLOCK;
+    return -1;
+}
+
+static int loopback_send(void *obj, int sock, const uint8_t *buf, size_t len)
+{
+    return -1;
+}
+
+static int loopback_recvfrom(void *obj, int sock, uint8_t *buf, size_t len, Network_Addr *addr)
+{
+    Loopback *loopback = (Loopback *)obj;
+    const Datagram *packet = queue_pop(&loopback->to_node);
+
+    if (packet == nullptr) {
+        errno = EWOULDBLOCK;
+        return -1;
+    }
+
+    struct sockaddr_in *addr_in = (struct sockaddr_in *)&addr->addr;
+    memset(addr, 0, sizeof(Network_Addr));
+    addr_in->sin_family = AF_INET;
+    addr_in->sin_addr.s_addr = htonl(peer_address(packet->peer));
+    addr_in->sin_port = htons(PEER_PORT);
+    addr->size = sizeof(struct sockaddr_in);
+
+    const size_t length = packet->length < len ? packet->length : len;
+    memcpy(buf, packet->data, length);
+    return (int)length;
+}
+
+static int loopback_sendto(void *obj, int sock, const uint8_t *buf, size_t len, const Network_Addr *addr)
+{
+    Loopback *loopback = (Loopback *)obj;
+    const struct sockaddr_in *addr_in = (const struct sockaddr_in *)&addr->addr;
+
+    if (addr_in->sin_family == AF_INET) {
+        queue_push(&loopback->to_peers, ntohl(addr_in->sin_addr.s_addr) - peer_address(0), buf, len);
+    }
+
+    return (int)len;
+}
+
+static int loopback_socket(void *obj, int domain, int type, int proto)
+{
+    return NODE_SOCKET;
+}
+
+static int loopback_socket_nonblock(void *obj, int sock, bool nonblock)
+{
+    return 0;
+}
+
+static int loopback_getsockopt(void *obj, int sock, int level, int optname, void *optval, size_t *optlen)
+{
+    memset(optval, 0, *optlen);
+    return 0;
+}
+
+static int loopback_setsockopt(void *obj, int sock, int level, int optname, const void *optval, size_t optlen)
+{
+    return 0;
+}
+
+static int loopback_getaddrinfo(void *obj, int family, Network_Addr **addrs)
+{
+    return 0;
+}
+
+static int loopback_freeaddrinfo(void *obj, Network_Addr *addrs)
+{
+    return 0;
+}
+
+static const Network_Funcs loopback_funcs = {
+    loopback_ok,
+    loopback_accept,
+    loopback_bind,
+    loopback_listen,
+    loopback_ok,
+    loopback_recv,
+    loopback_recvfrom,
+    loopback_send,
+    loopback_sendto,
+    loopback_socket,
+    loopback_socket_nonblock,
+    loopback_getsockopt,
+    loopback_setsockopt,
+    loopback_getaddrinfo,
+    loopback_freeaddrinfo,
+    nullptr,
+    nullptr,
+    nullptr,
+};
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static void send_cookie_request(Loopback *loopback, const Random *rng, uint32_t peer_num, const Peer *peer)
+{
+    uint8_t plain[COOKIE_REQUEST_PLAIN_LENGTH] = {0};
+    memcpy(plain, peer->real_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    uint8_t packet[COOKIE_REQUEST_LENGTH];
+    packet[0] = NET_PACKET_COOKIE_REQUEST;
+    memcpy(packet + 1, peer->dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    random_nonce(rng, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE);
+    encrypt_data_symmetric(peer->dht_shared_key, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, plain, sizeof(plain),
+                           packet + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE);
+    queue_push(&loopback->to_node, peer_num, packet, sizeof(packet));
+}
+
+static void send_crypto_request(Loopback *loopback, const Random *rng, uint32_t peer_num, const Peer *peer,
+                                const uint8_t *node_public_key)
+{
+    uint8_t plain[1 + CRYPTO_REQUEST_DATA_LENGTH] = {CRYPTO_PACKET_DHTPK};
+
+    uint8_t packet[CRYPTO_REQUEST_LENGTH];
+    packet[0] = NET_PACKET_CRYPTO;
+    memcpy(packet + 1, node_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, peer->dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    random_nonce(rng, packet + 1 + 2 * CRYPTO_PUBLIC_KEY_SIZE);
+    encrypt_data_symmetric(peer->dht_shared_key, packet + 1 + 2 * CRYPTO_PUBLIC_KEY_SIZE, plain, sizeof(plain),
+                           packet + 1 + 2 * CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE);
+    queue_push(&loopback->to_node, peer_num, packet, sizeof(packet));
+}
+
+static void send_handshake(Loopback *loopback, const Random *rng, uint32_t peer_num, const Peer *peer)
+{
+    // The session key and the cookie for the node don't matter here.
+    uint8_t plain[HANDSHAKE_PLAIN_LENGTH];
+    random_nonce(rng, plain);
+    memcpy(plain + CRYPTO_NONCE_SIZE, peer->dht_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    crypto_sha512(plain + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE, peer->cookie, COOKIE_LENGTH);
+    random_bytes(rng, plain + CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_SHA512_SIZE, COOKIE_LENGTH);
+
+    uint8_t packet[HANDSHAKE_PACKET_LENGTH];
+    packet[0] = NET_PACKET_CRYPTO_HS;
+    memcpy(packet + 1, peer->cookie, COOKIE_LENGTH);
+    random_nonce(rng, packet + 1 + COOKIE_LENGTH);
+    encrypt_data_symmetric(peer->real_shared_key, packet + 1 + COOKIE_LENGTH, plain, sizeof(plain),
+                           packet + 1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE);
+    queue_push(&loopback->to_node, peer_num, packet, sizeof(packet));
+}
+
+/** Let the peers read what the node sent them and answer it. */
+static uint32_t deliver_to_peers(Loopback *loopback, const Random *rng, Peer *peers, uint32_t num_peers,
+                                 uint64_t start, uint64_t now)
+{
+    uint32_t connected = 0;
+    const Datagram *packet;
+
+    while ((packet = queue_pop(&loopback->to_peers)) != nullptr) {
+        if (packet->peer >= num_peers) {
+            continue;
+        }
+
+        Peer *peer = &peers[packet->peer];
+
+        if (peer->state == PEER_WANTS_COOKIE && packet->data[0] == NET_PACKET_COOKIE_RESPONSE
+                && packet->length == COOKIE_RESPONSE_LENGTH) {
+            uint8_t plain[COOKIE_LENGTH + sizeof(uint64_t)];
+
+            if (decrypt_data_symmetric(peer->dht_shared_key, packet->data + 1, packet->data + 1 + CRYPTO_NONCE_SIZE,
+                                       packet->length - (1 + CRYPTO_NONCE_SIZE), plain) != sizeof(plain)) {
+                continue;
+            }
+
+            memcpy(peer->cookie, plain, COOKIE_LENGTH);
+            peer->state = PEER_WANTS_ACCEPT;
+            peer->last_sent = now;
+            ++peer->sent;
+            send_handshake(loopback, rng, packet->peer, peer);
+        } else if (peer->state == PEER_WANTS_ACCEPT && packet->data[0] == NET_PACKET_CRYPTO_HS) {
+            peer->state = PEER_CONNECTED;
+            peer->connected_after = now - start;
+            ++connected;
+        }
+    }
+
+    return connected;
+}
+
+typedef struct Peers {
+    Peer *peers;
+    uint32_t num_peers;
+} Peers;
+
+/** The node handled the crypto request of a peer, which moves on to the handshake right away. */
+static int handle_crypto_request(void *object, const IP_Port *source, const uint8_t *source_pubkey,
+                                 const uint8_t *data, uint16_t len, void *userdata)
+{
+    const Peers *peers = (const Peers *)object;
+    const uint32_t peer_num = net_ntohl(source->ip.ip.v4.uint32) - peer_address(0);
+
+    if (peer_num >= peers->num_peers || peers->peers[peer_num].state != PEER_WANTS_REQUEST) {
+        return 1;
+    }
+
+    peers->peers[peer_num].state = PEER_WANTS_COOKIE;
+    peers->peers[peer_num].last_sent = 0;
+    return 0;
+}
+
+static int accept_connection(void *object, const New_Connection *n_c)
+{
+    return accept_crypto_connection((Net_Crypto *)object, n_c) == -1 ? -1 : 0;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    const uint64_t x = *(const uint64_t *)a;
+    const uint64_t y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_peers = argc > 1 ? (uint32_t)atoi(argv[1]) : 10000;
+    const uint16_t num_threads = argc > 2 ? (uint16_t)atoi(argv[2]) : 0;
+    const uint32_t buffer_packets = argc > 3 ? (uint32_t)atoi(argv[3]) : 4096;
+    const uint64_t retry_us = (argc > 4 ? (uint64_t)atoi(argv[4]) : 250) * 1000;
+    const bool crypto_requests = argc > 5 && atoi(argv[5]) != 0;
+
+    Loopback loopback = {{nullptr}};
+    const Network ns = {&loopback_funcs, &loopback};
+    const Random *rng = system_random();
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+    Peer *peers = (Peer *)calloc(num_peers, sizeof(Peer));
+    uint64_t *connect_times = (uint64_t *)calloc(num_peers, sizeof(uint64_t));
+
+    if (rng == nullptr || log == nullptr || mono_time == nullptr || peers == nullptr || connect_times == nullptr
+            || num_peers == 0 || !queue_init(&loopback.to_node, buffer_packets)
+            || !queue_init(&loopback.to_peers, 2 * num_peers + NC_HANDSHAKE_QUEUE_SIZE)) {
+        fprintf(stderr, "invalid arguments or failed to allocate\n");
+        return 1;
+    }
+
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4.uint32 = net_htonl(0x7f000001);
+    Networking_Core *net = new_networking_ex(log, &ns, &ip, PEER_PORT, PEER_PORT, nullptr);
+    DHT *dht = net == nullptr ? nullptr : new_dht(log, rng, &ns, mono_time, net, false, false);
+    const TCP_Proxy_Info inf = {{{{0}}}};
+    Net_Crypto *c = dht == nullptr ? nullptr : new_net_crypto(log, rng, &ns, mono_time, dht, &inf);
+
+    if (c == nullptr || !nc_set_handshake_threads(c, num_threads, NC_HANDSHAKE_QUEUE_SIZE)) {
+        fprintf(stderr, "failed to create the node\n");
+        return 1;
+    }
+
+    new_connection_handler(c, &accept_connection, c);
+    Peers peer_list = {peers, num_peers};
+    cryptopacket_registerhandler(dht, CRYPTO_PACKET_DHTPK, &handle_crypto_request, &peer_list);
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        Peer *peer = &peers[i];
+        uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+
+        crypto_new_keypair(rng, peer->dht_public_key, secret_key);
+        encrypt_precompute(dht_get_self_public_key(dht), secret_key, peer->dht_shared_key);
+        crypto_new_keypair(rng, peer->real_public_key, secret_key);
+        encrypt_precompute(nc_get_self_public_key(c), secret_key, peer->real_shared_key);
+        peer->state = crypto_requests ? PEER_WANTS_REQUEST : PEER_WANTS_COOKIE;
+    }
+
+    printf("%u peers, %u handshake threads, %u packet socket buffer, %u ms retry%s\n",
+           num_peers, num_threads, buffer_packets, (unsigned)(retry_us / 1000),
+           crypto_requests ? ", crypto request first" : "");
+
+    const uint64_t start = now_us();
+    uint64_t worst_iteration = 0;
+    uint64_t node_time = 0;
+    uint32_t iterations = 0;
+    uint32_t connected = 0;
+
+    while (connected < num_peers && now_us() - start < 120 * 1000000ULL) {
+        const uint64_t now = now_us();
+
+        for (uint32_t i = 0; i < num_peers; ++i) {
+            Peer *peer = &peers[i];
+
+            if (peer->state == PEER_CONNECTED || (peer->sent > 0 && now - peer->last_sent < retry_us)) {
+                continue;
+            }
+
+            peer->last_sent = now;
+            ++peer->sent;
+
+            if (peer->state == PEER_WANTS_REQUEST) {
+                send_crypto_request(&loopback, rng, i, peer, dht_get_self_public_key(dht));
+            } else if (peer->state == PEER_WANTS_COOKIE) {
+                send_cookie_request(&loopback, rng, i, peer);
+            } else {
+                send_handshake(&loopback, rng, i, peer);
+            }
+        }
+
+        const uint64_t before = now_us();
+        mono_time_update(mono_time);
+        networking_poll(net, nullptr);
+        do_net_crypto(c, nullptr);
+        const uint64_t after = now_us();
+
+        node_time += after - before;
+        worst_iteration = after - before > worst_iteration ? after - before : worst_iteration;
+        ++iterations;
+
+        connected += deliver_to_peers(&loopback, rng, peers, num_peers, start, after);
+
+        if (loopback.to_node.count == 0 && loopback.to_peers.count == 0) {
+            c_sleep(1);
+        }
+    }
+
+    const uint64_t total = now_us() - start;
+    uint64_t packets_sent = 0;
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        connect_times[i] = peers[i].state == PEER_CONNECTED ? peers[i].connected_after : UINT64_MAX;
+        packets_sent += peers[i].sent;
+    }
+
+    qsort(connect_times, num_peers, sizeof(uint64_t), compare_u64);
+
+    printf("%u/%u peers connected in %.3f s\n", connected, num_peers, total / 1e6);
+    printf("time to connect: median %.1f ms, 99th percentile %.1f ms\n",
+           connect_times[num_peers / 2] / 1e3, connect_times[num_peers * 99 / 100] / 1e3);
+    printf("%u iterations, %.3f s in the node, worst iteration %.1f ms\n",
+           iterations, node_time / 1e6, worst_iteration / 1e3);
+    printf("%llu packets sent by peers, %llu dropped by the socket buffer\n",
+           (unsigned long long)packets_sent, (unsigned long long)loopback.to_node.dropped);
+
+    Precompute_Pool_Stats stats;
+
+    if (nc_get_handshake_pool_stats(c, &stats)) {
+        printf("%llu keys computed by the threads, %llu handshakes dropped by the full queue\n",
+               (unsigned long long)stats.completed, (unsigned long long)stats.rejected);
+    }
+
+    kill_net_crypto(c);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    free(connect_times);
+    free(peers);
+    free(loopback.to_peers.packets);
+    free(loopback.to_node.packets);
+    return 0;
+}
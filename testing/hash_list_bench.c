@@ -0,0 +1,161 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Hash_List churn benchmark
+ *
+ * Models a busy TCP relay: a stable population of connected public keys, with
+ * one client disconnecting and another connecting for every lookup. Runs the
+ * same remove+add+find sequence against a BS_List and a Hash_List and reports
+ * how many of these operations each did per second.
+ *
+ * Usage: ./hash_list_bench [population] [operations]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/list.h"
+
+#define KEY_SIZE 32
+
+typedef struct List_Ops {
+    bool (*add)(void *list, const uint8_t *data, int id);
+    bool (*remove)(void *list, const uint8_t *data, int id);
+    int (*find)(const void *list, const uint8_t *data);
+} List_Ops;
+
+static bool bs_add(void *list, const uint8_t *data, int id)
+{
+    return bs_list_add((BS_List *)list, data, id);
+}
+
+static bool bs_remove(void *list, const uint8_t *data, int id)
+{
+    return bs_list_remove((BS_List *)list, data, id);
+}
+
+static int bs_find(const void *list, const uint8_t *data)
+{
+    return bs_list_find((const BS_List *)list, data);
+}
+
+static bool hash_add(void *list, const uint8_t *data, int id)
+{
+    return hash_list_add((Hash_List *)list, data, id);
+}
+
+static bool hash_remove(void *list, const uint8_t *data, int id)
+{
+    return hash_list_remove((Hash_List *)list, data, id);
+}
+
+static int hash_find(const void *list, const uint8_t *data)
+{
+    return hash_list_find((const Hash_List *)list, data);
+}
+
+static const List_Ops bs_ops = {bs_add, bs_remove, bs_find};
+static const List_Ops hash_ops = {hash_add, hash_remove, hash_find};
+
+/** splitmix64, so both lists see the same key sequence. */
+static uint64_t next_random(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static void random_key(uint64_t *state, uint8_t *key)
+{
+    for (uint32_t i = 0; i < KEY_SIZE; i += sizeof(uint64_t)) {
+        const uint64_t r = next_random(state);
+        memcpy(&key[i], &r, sizeof(r));
+    }
+}
+
+/** Returns the operations per second, or a negative value if the list misbehaved. */
+static double churn_ops_per_second(void *list, const List_Ops *ops, uint8_t *keys, uint32_t population,
+                                   uint32_t num_ops)
+{
+    uint64_t state = 1;
+
+    for (uint32_t i = 0; i < population; ++i) {
+        random_key(&state, &keys[i * KEY_SIZE]);
+
+        if (!ops->add(list, &keys[i * KEY_SIZE], (int)i)) {
+            return -1;
+        }
+    }
+
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t op = 0; op < num_ops; ++op) {
+        const uint32_t i = next_random(&state) % population;
+        uint8_t *key = &keys[i * KEY_SIZE];
+
+        if (!ops->remove(list, key, (int)i)) {
+            return -1;
+        }
+
+        random_key(&state, key);
+
+        if (!ops->add(list, key, (int)i)
+                || ops->find(list, &keys[(next_random(&state) % population) * KEY_SIZE]) < 0) {
+            return -1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return seconds > 0 ? num_ops / seconds : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t population = argc > 1 ? (uint32_t)atoi(argv[1]) : 30000;
+    const uint32_t num_ops = argc > 2 ? (uint32_t)atoi(argv[2]) : 100000;
+
+    uint8_t *keys = population > 0 ? (uint8_t *)malloc((size_t)population * KEY_SIZE) : nullptr;
+
+    if (keys == nullptr) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    BS_List bs;
+    Hash_List hash;
+
+    if (bs_list_init(&bs, KEY_SIZE, 8) != 1 || hash_list_init(&hash, KEY_SIZE, 8, 0x1234) != 1) {
+        fprintf(stderr, "failed to create lists\n");
+        free(keys);
+        return 1;
+    }
+
+    const double bs_rate = churn_ops_per_second(&bs, &bs_ops, keys, population, num_ops);
+    const double hash_rate = churn_ops_per_second(&hash, &hash_ops, keys, population, num_ops);
+
+    hash_list_free(&hash);
+    bs_list_free(&bs);
+    free(keys);
+
+    if (bs_rate < 0 || hash_rate < 0) {
+        fprintf(stderr, "list operation failed\n");
+        return 1;
+    }
+
+    printf("%u keys, remove+add+find: %.0f ops/s BS_List, %.0f ops/s Hash_List\n",
+           population, bs_rate, hash_rate);
+
+    return 0;
+}
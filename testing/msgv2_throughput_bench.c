@@ -0,0 +1,441 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* MessageV2 throughput benchmark
+ *
+ * One sender and a number of receivers, all on loopback and wired up through
+ * toxutil the way a client does it. Once every receiver is connected and has
+ * announced MessageV2 support, the sender keeps as many messages in flight to
+ * every receiver as the file transfer slots allow. Each receiver answers every
+ * message with a read receipt, which is what message heavy bots do, so both
+ * directions carry many concurrent MessageV2 file transfers.
+ *
+ * Reports messages and receipts per second and the longest single iteration
+ * of the sender, which grows if the toxutil bookkeeping does not scale with
+ * the number of transfers in flight. Every receiver must get every message
+ * exactly once, so the benchmark also fails (by timing out) if the
+ * bookkeeping of several Tox instances in one process gets mixed up.
+ *
+ * With a memory budget given, messages that do not fit are streamed to the
+ * spill callback, which picks the message id out of the first chunk and
+ * answers with a receipt once the transfer is finished. The peak number of
+ * bytes toxutil had buffered on any receiver shows the budget at work.
+ *
+ * Usage: ./msgv2_throughput_bench [messages per receiver] [receivers] [message length] [memory budget]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/tox.h"
+#include "../toxutil/toxutil.h"
+
+#define MAX_RECEIVERS 32
+#define MAX_RECEIVING_FILES 256
+#define MSGV2_HEADER_PREFIX (TOX_PUBLIC_KEY_SIZE + 4)  // message id and ts_sec
+
+/** The start of a spilled message, enough to answer it with a receipt. */
+typedef struct Spilled {
+    uint8_t header[MSGV2_HEADER_PREFIX];
+    uint32_t header_length;
+} Spilled;
+
+typedef struct Receiver {
+    Tox *tox;
+    uint32_t messages;
+    uint32_t friend_number;
+    /* Read receipts that could not go out yet because all file transfer
+     * slots were in use, oldest first. */
+    uint8_t *pending_msgids;
+    uint32_t *pending_ts_sec;
+    uint32_t pending_head;
+    uint32_t pending_count;
+    Spilled spilled[MAX_RECEIVING_FILES];
+    uint32_t spilled_messages;
+    uint64_t peak_buffered;
+} Receiver;
+
+static Receiver receivers[MAX_RECEIVERS];
+static uint32_t num_receivers;
+static uint32_t receipts[MAX_RECEIVERS];
+static uint32_t bad_messages;
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void print_rate(const char *what, uint32_t count, double seconds)
+{
+    printf("%-24s %8u in %8.3f s, %12.0f/s\n", what, count, seconds, seconds > 0 ? count / seconds : 0.0);
+}
+
+static void sleep_ms(uint32_t ms)
+{
+    const struct timespec ts = {0, (long)ms * 1000000L};
+    nanosleep(&ts, nullptr);
+}
+
+static Receiver *receiver_of(const Tox *tox)
+{
+    for (uint32_t i = 0; i < num_receivers; ++i) {
+        if (receivers[i].tox == tox) {
+            return &receivers[i];
+        }
+    }
+
+    return nullptr;
+}
+
+static void message_received(Receiver *receiver, uint32_t friend_number, const uint8_t *message)
+{
+    uint8_t msgid[TOX_PUBLIC_KEY_SIZE];
+
+    if (!tox_messagev2_get_message_id(message, msgid)) {
+        ++bad_messages;
+        return;
+    }
+
+    ++receiver->messages;
+    receiver->friend_number = friend_number;
+
+    const uint32_t tail = receiver->pending_head + receiver->pending_count;
+    memcpy(&receiver->pending_msgids[tail * TOX_PUBLIC_KEY_SIZE], msgid, TOX_PUBLIC_KEY_SIZE);
+    receiver->pending_ts_sec[tail] = tox_messagev2_get_ts_sec(message);
+    ++receiver->pending_count;
+}
+
+static void friend_message_v2(Tox *tox, uint32_t friend_number, const uint8_t *message, size_t length)
+{
+    Receiver *receiver = receiver_of(tox);
+
+    if (receiver == nullptr || length < MSGV2_HEADER_PREFIX) {
+        ++bad_messages;
+        return;
+    }
+
+    message_received(receiver, friend_number, message);
+}
+
+static void friend_message_v2_spill(Tox *tox, uint32_t friend_number, uint32_t file_number, uint32_t kind,
+                                    uint64_t file_size, uint64_t position, const uint8_t *data, size_t length,
+                                    bool aborted)
+{
+    if (kind == TOX_FILE_KIND_MESSAGEV2_ANSWER) {
+        // a receipt the sender could not buffer, nothing in it is needed to count it
+        if (length == 0 && !aborted && friend_number < num_receivers) {
+            ++receipts[friend_number];
+        }
+
+        return;
+    }
+
+    Receiver *receiver = receiver_of(tox);
+
+    if (receiver == nullptr) {
+        ++bad_messages;
+        return;
+    }
+
+    // receiving file numbers are (slot + 1) << 16
+    Spilled *spilled = &receiver->spilled[((file_number >> 16) - 1) % MAX_RECEIVING_FILES];
+
+    if (aborted) {
+        spilled->header_length = 0;
+        return;
+    }
+
+    if (length == 0) {
+        if (spilled->header_length < MSGV2_HEADER_PREFIX) {
+            ++bad_messages;
+        } else {
+            message_received(receiver, friend_number, spilled->header);
+            ++receiver->spilled_messages;
+        }
+
+        spilled->header_length = 0;
+        return;
+    }
+
+    if (position < MSGV2_HEADER_PREFIX) {
+        const size_t n = length < MSGV2_HEADER_PREFIX - position ? length : MSGV2_HEADER_PREFIX - position;
+        memcpy(spilled->header + position, data, n);
+
+        if (position + n > spilled->header_length) {
+            spilled->header_length = (uint32_t)(position + n);
+        }
+    }
+}
+
+static void send_receipts(Receiver *receiver)
+{
+    while (receiver->pending_count > 0) {
+        const uint32_t head = receiver->pending_head;
+
+        if (!tox_util_friend_send_msg_receipt_v2(receiver->tox, receiver->friend_number,
+                &receiver->pending_msgids[head * TOX_PUBLIC_KEY_SIZE], receiver->pending_ts_sec[head])) {
+            // all file transfer slots to the sender are in use
+            return;
+        }
+
+        ++receiver->pending_head;
+        --receiver->pending_count;
+    }
+}
+
+static void friend_read_receipt_message_v2(Tox *tox, uint32_t friend_number, uint32_t ts_sec,
+        const uint8_t *msgid)
+{
+    if (friend_number < num_receivers) {
+        ++receipts[friend_number];
+    }
+}
+
+static void friend_request(Tox *tox, const uint8_t *public_key, const uint8_t *message, size_t length,
+                           void *user_data)
+{
+    tox_friend_add_norequest(tox, public_key, nullptr);
+}
+
+static Tox *new_tox(void)
+{
+    struct Tox_Options *options = tox_options_new(nullptr);
+
+    if (options == nullptr) {
+        return nullptr;
+    }
+
+    tox_options_set_local_discovery_enabled(options, false);
+    tox_options_set_start_port(options, 33445);
+    tox_options_set_end_port(options, 34445);
+
+    Tox *tox = tox_utils_new(options, nullptr);
+    tox_options_free(options);
+
+    if (tox == nullptr) {
+        return nullptr;
+    }
+
+    tox_callback_self_connection_status(tox, tox_utils_self_connection_status_cb);
+    tox_callback_friend_connection_status(tox, tox_utils_friend_connection_status_cb);
+    tox_callback_friend_lossless_packet(tox, tox_utils_friend_lossless_packet_cb);
+    tox_callback_file_recv_control(tox, tox_utils_file_recv_control_cb);
+    tox_callback_file_chunk_request(tox, tox_utils_file_chunk_request_cb);
+    tox_callback_file_recv(tox, tox_utils_file_recv_cb);
+    tox_callback_file_recv_chunk(tox, tox_utils_file_recv_chunk_cb);
+    tox_callback_friend_request(tox, friend_request);
+
+    tox_utils_callback_friend_message_v2(tox, friend_message_v2);
+    tox_utils_callback_friend_read_receipt_message_v2(tox, friend_read_receipt_message_v2);
+    tox_utils_callback_friend_message_v2_spill(tox, friend_message_v2_spill);
+
+    return tox;
+}
+
+static void iterate(Tox *sender)
+{
+    tox_iterate(sender, nullptr);
+
+    for (uint32_t i = 0; i < num_receivers; ++i) {
+        tox_iterate(receivers[i].tox, nullptr);
+    }
+}
+
+static bool all_connected(Tox *sender)
+{
+    for (uint32_t i = 0; i < num_receivers; ++i) {
+        if (tox_friend_get_connection_status(sender, i, nullptr) == TOX_CONNECTION_NONE
+                || tox_friend_get_connection_status(receivers[i].tox, 0, nullptr) == TOX_CONNECTION_NONE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_messages = argc > 1 ? (uint32_t)atoi(argv[1]) : 2000;
+    num_receivers = argc > 2 ? (uint32_t)atoi(argv[2]) : 4;
+    const uint32_t message_length = argc > 3 ? (uint32_t)atoi(argv[3]) : 200;
+    const bool set_budget = argc > 4;
+    const uint64_t budget = set_budget ? strtoull(argv[4], nullptr, 10) : 0;
+
+    if (num_messages == 0 || num_receivers == 0 || num_receivers > MAX_RECEIVERS
+            || message_length == 0 || message_length > TOX_MESSAGEV2_MAX_TEXT_LENGTH) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    Tox *sender = new_tox();
+
+    if (sender == nullptr) {
+        fprintf(stderr, "failed to create tox instance\n");
+        return 1;
+    }
+
+    uint8_t sender_address[TOX_ADDRESS_SIZE];
+    uint8_t sender_dht_key[TOX_PUBLIC_KEY_SIZE];
+    tox_self_get_address(sender, sender_address);
+    tox_self_get_dht_id(sender, sender_dht_key);
+    const uint16_t sender_port = tox_self_get_udp_port(sender, nullptr);
+
+    for (uint32_t i = 0; i < num_receivers; ++i) {
+        receivers[i].tox = new_tox();
+        receivers[i].pending_msgids = (uint8_t *)malloc((size_t)num_messages * TOX_PUBLIC_KEY_SIZE);
+        receivers[i].pending_ts_sec = (uint32_t *)malloc((size_t)num_messages * sizeof(uint32_t));
+
+        if (receivers[i].tox == nullptr || receivers[i].pending_msgids == nullptr
+                || receivers[i].pending_ts_sec == nullptr) {
+            fprintf(stderr, "failed to create tox instance\n");
+            return 1;
+        }
+
+        if (set_budget) {
+            tox_utils_set_msgv2_memory_budget(receivers[i].tox, budget);
+        }
+
+        tox_bootstrap(receivers[i].tox, "localhost", sender_port, sender_dht_key, nullptr);
+        tox_friend_add(receivers[i].tox, sender_address, (const uint8_t *)"hi", 2, nullptr);
+    }
+
+    printf("connecting %u receivers\n", num_receivers);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (tox_self_get_friend_list_size(sender) < num_receivers || !all_connected(sender)) {
+        iterate(sender);
+        sleep_ms(tox_iteration_interval(sender) / 4);
+
+        if (seconds_since(&start) > 120) {
+            fprintf(stderr, "receivers did not connect\n");
+            return 1;
+        }
+    }
+
+    // give the capability packets time to arrive, until then messages would
+    // go out as old style messages
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (seconds_since(&start) < 2) {
+        iterate(sender);
+        sleep_ms(5);
+    }
+
+    uint8_t *message = (uint8_t *)malloc(message_length);
+
+    if (message == nullptr) {
+        fprintf(stderr, "failed to allocate\n");
+        return 1;
+    }
+
+    memset(message, 'x', message_length);
+
+    uint32_t sent[MAX_RECEIVERS] = {0};
+    uint32_t sent_total = 0;
+    uint32_t received_total = 0;
+    uint32_t receipts_total = 0;
+    double longest_iteration = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (receipts_total < num_messages * num_receivers) {
+        for (uint32_t i = 0; i < num_receivers; ++i) {
+            while (sent[i] < num_messages) {
+                Tox_Err_Friend_Send_Message error;
+                tox_util_friend_send_message_v2(sender, i, TOX_MESSAGE_TYPE_NORMAL, (uint32_t)time(nullptr),
+                                                message, message_length, nullptr, nullptr, nullptr, &error);
+
+                if (error != TOX_ERR_FRIEND_SEND_MESSAGE_OK) {
+                    // all file transfer slots to this friend are in use
+                    break;
+                }
+
+                ++sent[i];
+                ++sent_total;
+            }
+        }
+
+        struct timespec iteration_start;
+        clock_gettime(CLOCK_MONOTONIC, &iteration_start);
+        tox_iterate(sender, nullptr);
+        const double iteration = seconds_since(&iteration_start);
+
+        if (iteration > longest_iteration) {
+            longest_iteration = iteration;
+        }
+
+        for (uint32_t i = 0; i < num_receivers; ++i) {
+            tox_iterate(receivers[i].tox, nullptr);
+            send_receipts(&receivers[i]);
+        }
+
+        received_total = 0;
+        receipts_total = 0;
+
+        for (uint32_t i = 0; i < num_receivers; ++i) {
+            received_total += receivers[i].messages;
+            receipts_total += receipts[i];
+
+            const uint64_t buffered = tox_utils_get_msgv2_buffered_bytes(receivers[i].tox);
+
+            if (buffered > receivers[i].peak_buffered) {
+                receivers[i].peak_buffered = buffered;
+            }
+        }
+
+        if (seconds_since(&start) > 600) {
+            fprintf(stderr, "timed out: sent %u, received %u, receipts %u\n", sent_total, received_total,
+                    receipts_total);
+            return 1;
+        }
+    }
+
+    const double seconds = seconds_since(&start);
+
+    printf("%u receivers, %u messages of %u bytes each\n", num_receivers, num_messages, message_length);
+    print_rate("messages", received_total, seconds);
+    print_rate("receipts", receipts_total, seconds);
+    printf("longest sender iteration %.3f ms\n", longest_iteration * 1000.0);
+
+    uint32_t spilled_total = 0;
+    uint64_t peak_buffered = 0;
+
+    for (uint32_t i = 0; i < num_receivers; ++i) {
+        spilled_total += receivers[i].spilled_messages;
+
+        if (receivers[i].peak_buffered > peak_buffered) {
+            peak_buffered = receivers[i].peak_buffered;
+        }
+    }
+
+    printf("spilled messages %u, peak buffered on a receiver %llu bytes\n", spilled_total,
+           (unsigned long long)peak_buffered);
+
+    free(message);
+
+    for (uint32_t i = 0; i < num_receivers; ++i) {
+        tox_utils_kill(receivers[i].tox);
+        free(receivers[i].pending_msgids);
+        free(receivers[i].pending_ts_sec);
+    }
+
+    tox_utils_kill(sender);
+
+    if (bad_messages != 0) {
+        fprintf(stderr, "%u messages could not be parsed\n", bad_messages);
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Onion announce benchmark
+ *
+ * Replays a flood of accepted announce requests from a pool of announcers
+ * against an Onion_Announce and reports how many the announce store took per
+ * second. Requests are fed to the store directly, so the time spent on
+ * decrypting and answering them is not part of the measurement.
+ *
+ * Usage: ./onion_announce_bench [announcers] [requests] [entries]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../toxcore/DHT.h"
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/logger.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/network.h"
+#include "../toxcore/onion_announce.h"
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_announcers = argc > 1 ? (uint32_t)atoi(argv[1]) : 2000;
+    const uint32_t num_requests = argc > 2 ? (uint32_t)atoi(argv[2]) : 1000000;
+    const uint32_t max_entries = argc > 3 ? (uint32_t)atoi(argv[3]) : ONION_ANNOUNCE_MAX_ENTRIES;
+
+    Logger *log = logger_new();
+    const Random *rng = system_random();
+    const Network *ns = system_network();
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+    Networking_Core *net = new_networking_no_udp(log, ns);
+    DHT *dht = new_dht(log, rng, ns, mono_time, net, true, true);
+    Onion_Announce *onion_a = new_onion_announce(log, rng, mono_time, dht);
+
+    if (log == nullptr || rng == nullptr || mono_time == nullptr || net == nullptr || dht == nullptr
+            || onion_a == nullptr || num_announcers == 0) {
+        fprintf(stderr, "failed to create Onion_Announce\n");
+        return 1;
+    }
+
+    if (!onion_announce_set_max_entries(onion_a, max_entries)) {
+        fprintf(stderr, "failed to make room for %u entries\n", max_entries);
+        return 1;
+    }
+
+    uint8_t *keys = (uint8_t *)malloc(num_announcers * CRYPTO_PUBLIC_KEY_SIZE);
+
+    if (keys == nullptr) {
+        return 1;
+    }
+
+    random_bytes(rng, keys, num_announcers * CRYPTO_PUBLIC_KEY_SIZE);
+
+    // Pick the announcer of each request up front so the loop only measures the store.
+    uint32_t *order = (uint32_t *)malloc(num_requests * sizeof(uint32_t));
+
+    if (order == nullptr) {
+        return 1;
+    }
+
+    for (uint32_t i = 0; i < num_requests; ++i) {
+        order[i] = random_range_u32(rng, num_announcers);
+    }
+
+    uint64_t stored = 0;
+    const clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_requests; ++i) {
+        stored += onion_announce_entry_add(onion_a, keys + order[i] * CRYPTO_PUBLIC_KEY_SIZE);
+    }
+
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("%u announcers, %u requests, %u entries\n", num_announcers, num_requests, max_entries);
+    printf("%.3f s, %.0f requests/s, %.1f%% stored\n",
+           seconds, seconds > 0 ? num_requests / seconds : 0.0,
+           num_requests > 0 ? 100.0 * stored / num_requests : 0.0);
+
+    free(order);
+    free(keys);
+    kill_onion_announce(onion_a);
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+    return 0;
+}
@@ -0,0 +1,112 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Sanctions list validation benchmark
+ *
+ * Fills a group's sanctions list to MOD_MAX_NUM_SANCTIONS entries and
+ * validates it with sanctions_list_check_integrity, once as a peer that knows
+ * none of the entries and once as a peer that knows all but the newest one,
+ * as when receiving the full list after a new sanction. Reports how many
+ * validations per second each peer did.
+ *
+ * Usage: ./sanctions_list_bench [runs]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/group_moderation.h"
+#include "../toxcore/logger.h"
+
+/** Returns how many times per second `moderation` validates the sanctions list of `full`, or -1 on failure. */
+static double validations_per_second(const Moderation *moderation, const Moderation *full, uint32_t runs)
+{
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t i = 0; i < runs; ++i) {
+        if (!sanctions_list_check_integrity(moderation, &full->sanctions_creds, full->sanctions, full->num_sanctions)) {
+            return -1;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return seconds > 0 ? runs / seconds : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t runs = argc > 1 ? (uint32_t)atoi(argv[1]) : 20;
+
+    const Random *rng = system_random();
+    Logger *log = logger_new();
+
+    uint8_t pk[EXT_PUBLIC_KEY_SIZE];
+    uint8_t sk[EXT_SECRET_KEY_SIZE];
+
+    if (rng == nullptr || log == nullptr || !create_extended_keypair(pk, sk)) {
+        fprintf(stderr, "setup failed\n");
+        logger_kill(log);
+        return 1;
+    }
+
+    Moderation mod = {nullptr};
+    mod.log = log;
+    memcpy(mod.self_public_sig_key, get_sig_pk(pk), SIG_PUBLIC_KEY_SIZE);
+    memcpy(mod.self_secret_sig_key, get_sig_sk(sk), SIG_SECRET_KEY_SIZE);
+
+    bool ok = mod_list_add_entry(&mod, get_sig_pk(pk));
+
+    for (uint16_t i = 0; ok && i < MOD_MAX_NUM_SANCTIONS; ++i) {
+        uint8_t target[ENC_PUBLIC_KEY_SIZE];
+        random_bytes(rng, target, sizeof(target));
+
+        Mod_Sanction sanction;
+        ok = sanctions_list_make_entry(&mod, target, &sanction, SA_OBSERVER);
+    }
+
+    double unknown_rate = -1;
+    double known_rate = -1;
+
+    if (ok) {
+        // Both peers share the moderator list with `mod`.
+        Moderation unknown = mod;
+        unknown.sanctions = nullptr;
+        unknown.num_sanctions = 0;
+        memset(&unknown.sanctions_creds, 0, sizeof(unknown.sanctions_creds));
+
+        Moderation known = mod;
+        known.num_sanctions = mod.num_sanctions - 1;
+        memset(&known.sanctions_creds, 0, sizeof(known.sanctions_creds));
+
+        unknown_rate = validations_per_second(&unknown, &mod, runs);
+        known_rate = validations_per_second(&known, &mod, runs);
+    }
+
+    const uint16_t num_sanctions = mod.num_sanctions;
+
+    sanctions_list_cleanup(&mod);
+    mod_list_cleanup(&mod);
+    logger_kill(log);
+
+    if (unknown_rate < 0 || known_rate < 0) {
+        fprintf(stderr, "sanctions list validation failed\n");
+        return 1;
+    }
+
+    printf("%u sanctions: %.0f validations/s with no entry known, %.0f/s with one new entry\n",
+           num_sanctions, unknown_rate, known_rate);
+
+    return 0;
+}
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Shared key cache benchmark
+ *
+ * Replays the public keys seen by a busy node against a Shared_Key_Cache and
+ * reports its hit rate and how many lookups it answered per second. Most
+ * requests come from a population of peers whose activity follows a Zipf
+ * distribution, the rest from peers that are seen only once. The clock
+ * advances by a fixed step per request, so keys time out as they would on a
+ * node handling that many requests per second.
+ *
+ * Usage: ./shared_key_cache_bench [peers] [requests] [max_keys] [one-off %] [requests/s]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/crypto_core.h"
+#include "../toxcore/mono_time.h"
+#include "../toxcore/shared_key_cache.h"
+
+#define KEYS_TIMEOUT 600
+
+static uint64_t fake_time_ms;
+
+static uint64_t get_fake_time(void *user_data)
+{
+    return fake_time_ms;
+}
+
+/** Pick a peer in [0, num_peers) according to the cumulative distribution. */
+static uint32_t sample(const double *cdf, uint32_t num_peers, double x)
+{
+    uint32_t lo = 0;
+    uint32_t hi = num_peers - 1;
+
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+
+        if (cdf[mid] < x) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t num_peers = argc > 1 ? (uint32_t)atoi(argv[1]) : 20000;
+    const uint32_t num_requests = argc > 2 ? (uint32_t)atoi(argv[2]) : 200000;
+    const uint32_t max_keys = argc > 3 ? (uint32_t)atoi(argv[3]) : 4096;
+    const uint32_t one_off_percent = argc > 4 ? (uint32_t)atoi(argv[4]) : 20;
+    const uint32_t requests_per_second = argc > 5 ? (uint32_t)atoi(argv[5]) : 200;
+
+    const Random *rng = system_random();
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+
+    if (rng == nullptr || mono_time == nullptr || num_peers == 0 || requests_per_second == 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+
+    fake_time_ms = current_time_monotonic(mono_time) + 1000;
+    mono_time_set_current_time_callback(mono_time, get_fake_time, nullptr);
+    mono_time_update(mono_time);
+
+    uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
+    crypto_new_keypair(rng, self_public_key, self_secret_key);
+
+    Shared_Key_Cache *cache = shared_key_cache_new(mono_time, rng, self_secret_key, KEYS_TIMEOUT, max_keys);
+    uint8_t *keys = (uint8_t *)malloc((size_t)num_peers * CRYPTO_PUBLIC_KEY_SIZE);
+    double *cdf = (double *)malloc(num_peers * sizeof(double));
+    uint8_t *request_keys = (uint8_t *)malloc((size_t)num_requests * CRYPTO_PUBLIC_KEY_SIZE);
+
+    if (cache == nullptr || keys == nullptr || cdf == nullptr || request_keys == nullptr) {
+        fprintf(stderr, "failed to allocate\n");
+        return 1;
+    }
+
+    random_bytes(rng, keys, (size_t)num_peers * CRYPTO_PUBLIC_KEY_SIZE);
+
+    double total = 0;
+
+    for (uint32_t i = 0; i < num_peers; ++i) {
+        total += 1.0 / (i + 1);
+        cdf[i] = total;
+    }
+
+    // Pick the key of each request up front so the loop only measures the cache.
+    for (uint32_t i = 0; i < num_requests; ++i) {
+        uint8_t *key = request_keys + (size_t)i * CRYPTO_PUBLIC_KEY_SIZE;
+
+        if (random_range_u32(rng, 100) < one_off_percent) {
+            random_bytes(rng, key, CRYPTO_PUBLIC_KEY_SIZE);
+        } else {
+            const double x = (double)random_u64(rng) / (double)UINT64_MAX * total;
+            memcpy(key, keys + (size_t)sample(cdf, num_peers, x) * CRYPTO_PUBLIC_KEY_SIZE, CRYPTO_PUBLIC_KEY_SIZE);
+        }
+    }
+
+    const uint64_t start_ms = fake_time_ms;
+    uint32_t failed = 0;
+    const clock_t start = clock();
+
+    for (uint32_t i = 0; i < num_requests; ++i) {
+        fake_time_ms = start_ms + (uint64_t)i * 1000 / requests_per_second;
+        mono_time_update(mono_time);
+        failed += shared_key_cache_lookup(cache, request_keys + (size_t)i * CRYPTO_PUBLIC_KEY_SIZE) == nullptr;
+    }
+
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    Shared_Key_Cache_Stats stats;
+    shared_key_cache_get_stats(cache, &stats);
+
+    printf("%u peers, %u requests, %u%% one-off, %u requests/s, %u max keys\n",
+           num_peers, num_requests, one_off_percent, requests_per_second, max_keys);
+    printf("%.3f s, %.0f lookups/s, %.1f%% hits\n",
+           seconds, seconds > 0 ? num_requests / seconds : 0.0,
+           num_requests > 0 ? 100.0 * stats.hits / num_requests : 0.0);
+    printf("%llu misses, %llu evictions, %llu expirations, %u keys cached, %u failed\n",
+           (unsigned long long)stats.misses, (unsigned long long)stats.evictions,
+           (unsigned long long)stats.expirations, stats.keys, failed);
+
+    shared_key_cache_free(cache);
+    free(request_keys);
+    free(cdf);
+    free(keys);
+    mono_time_free(mono_time);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/* Batched UDP send/receive benchmark
+ *
+ * Sends bursts of 1400 byte packets from one loopback socket to another and
+ * drains the receiver after each burst, once with one syscall per datagram
+ * and once with batched sendmmsg/recvmmsg, and reports how many packets per
+ * second arrived in each mode.
+ *
+ * Usage: ./udp_batch_bench [rounds] [burst]
+ */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../toxcore/ccompat.h"
+#include "../toxcore/logger.h"
+#include "../toxcore/network.h"
+
+#define BENCH_PACKET_ID 0xf0
+#define BENCH_PACKET_LENGTH 1400
+
+static int count_packet(void *object, const IP_Port *ip_port, const uint8_t *data, uint16_t len, void *userdata)
+{
+    uint64_t *received = (uint64_t *)object;
+    ++*received;
+    return 0;
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/** Returns the packets per second received, or a negative value on error. */
+static double loopback_packets_per_second(const Logger *log, const Network *ns, bool batched,
+        uint32_t rounds, uint32_t burst)
+{
+    IP ip;
+    ip_init(&ip, false);
+    ip.ip.v4 = get_ip4_loopback();
+
+    Networking_Core *sender = new_networking_ex(log, ns, &ip, 33445, 34445, nullptr);
+    Networking_Core *receiver = new_networking_ex(log, ns, &ip, 33445, 34445, nullptr);
+
+    if (sender == nullptr || receiver == nullptr) {
+        kill_networking(receiver);
+        kill_networking(sender);
+        return -1;
+    }
+
+    uint64_t received = 0;
+    networking_registerhandler(receiver, BENCH_PACKET_ID, count_packet, &received);
+
+    IP_Port dest;
+    dest.ip = ip;
+    dest.port = net_port(receiver);
+
+    uint8_t packet[BENCH_PACKET_LENGTH] = {BENCH_PACKET_ID};
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (uint32_t round = 0; round < rounds; ++round) {
+        if (batched) {
+            networking_send_batch_begin(sender);
+        }
+
+        // Send in bursts small enough for the socket buffer, then drain them.
+        for (uint32_t i = 0; i < burst; ++i) {
+            const uint32_t num = round * burst + i;
+            memcpy(&packet[1], &num, sizeof(num));
+            sendpacket(sender, &dest, packet, sizeof(packet));
+        }
+
+        if (batched) {
+            networking_send_batch_flush(sender);
+        }
+
+        networking_poll(receiver, nullptr);
+    }
+
+    const double seconds = seconds_since(&start);
+
+    kill_networking(receiver);
+    kill_networking(sender);
+
+    return seconds > 0 ? received / seconds : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const uint32_t rounds = argc > 1 ? (uint32_t)atoi(argv[1]) : 2000;
+    const uint32_t burst = argc > 2 ? (uint32_t)atoi(argv[2]) : 64;
+
+    Logger *log = logger_new();
+
+    if (log == nullptr) {
+        fprintf(stderr, "failed to create logger\n");
+        return 1;
+    }
+
+    // The system network with batched syscalls disabled.
+    Network_Funcs per_datagram_funcs = *system_network()->funcs;
+    per_datagram_funcs.recvmmsg = nullptr;
+    per_datagram_funcs.sendmmsg = nullptr;
+    per_datagram_funcs.sendv = nullptr;
+    const Network per_datagram = {&per_datagram_funcs, system_network()->obj};
+
+    const double single = loopback_packets_per_second(log, &per_datagram, false, rounds, burst);
+    const double batched = loopback_packets_per_second(log, system_network(), true, rounds, burst);
+
+    logger_kill(log);
+
+    if (single < 0 || batched < 0) {
+        fprintf(stderr, "failed to open loopback sockets\n");
+        return 1;
+    }
+
+    printf("loopback UDP, %d byte packets: %.0f packets/s per datagram, %.0f packets/s batched\n",
+           BENCH_PACKET_LENGTH, single, batched);
+
+    return 0;
+}
@@ -18,9 +18,11 @@
 #include "mono_time.h"
 #include "network.h"
 #include "ping.h"
+#include "precompute_pool.h"
 #include "shared_key_cache.h"
 #include "state.h"
 #include "util.h"
+#include "xor_index.h"
 
 /** The timeout after which a node is discarded completely. */
 #define KILL_NODE_TIMEOUT (BAD_NODE_TIMEOUT + PING_INTERVAL)
@@ -48,7 +50,7 @@
 #define DHT_FRIEND_MAX_LOCKS 32
 
 /* Settings for the shared key cache */
-#define MAX_KEYS_PER_SLOT 4
+#define MAX_CACHED_KEYS 4096
 #define KEYS_TIMEOUT 600
 
 typedef struct DHT_Friend_Callback {
@@ -60,6 +62,8 @@ typedef struct DHT_Friend_Callback {
 struct DHT_Friend {
     uint8_t     public_key[CRYPTO_PUBLIC_KEY_SIZE];
     Client_data client_list[MAX_FRIEND_CLIENTS];
+    /* Public keys of client_list as currently stored in the node index. */
+    uint8_t     indexed_pk[MAX_FRIEND_CLIENTS][CRYPTO_PUBLIC_KEY_SIZE];
 
     /* Time at which the last get_nodes request was sent. */
     uint64_t    lastgetnode;
@@ -101,6 +105,12 @@ struct DHT {
     uint64_t       close_lastgetnodes;
     uint32_t       close_bootstrap_times;
 
+    /* All client list entries by XOR distance, see node_index_slot. */
+    Xor_Index     *node_index;
+    /* False after an allocation failure left the index incomplete. */
+    bool           node_index_ok;
+    uint8_t        close_indexed_pk[LCLIENT_LIST][CRYPTO_PUBLIC_KEY_SIZE];
+
     /* DHT keypair */
     uint8_t self_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t self_secret_key[CRYPTO_SECRET_KEY_SIZE];
@@ -120,6 +130,8 @@ struct DHT {
     uint64_t       cur_time;
 
     Cryptopacket_Handler cryptopackethandlers[256];
+    /* Computes the keys of crypto requests from unknown senders, or nullptr to compute them inline. */
+    Precompute_Pool *request_pool;
 
     Node_format to_bootstrap[MAX_CLOSE_TO_BOOTSTRAP_NODES];
     unsigned int num_to_bootstrap;
@@ -278,6 +290,27 @@ const uint8_t *dht_get_shared_key_sent(DHT *dht, const uint8_t *public_key)
     return shared_key_cache_lookup(dht->shared_keys_sent, public_key);
 }
 
+const uint8_t *dht_find_shared_key_sent(DHT *dht, const uint8_t *public_key)
+{
+    return shared_key_cache_find(dht->shared_keys_sent, public_key);
+}
+
+const uint8_t *dht_add_shared_key_sent(DHT *dht, const uint8_t *public_key, const uint8_t *shared_key)
+{
+    return shared_key_cache_insert(dht->shared_keys_sent, public_key, shared_key);
+}
+
+void dht_set_request_pool(DHT *dht, Precompute_Pool *pool)
+{
+    dht->request_pool = pool;
+}
+
+void dht_get_shared_key_stats(const DHT *dht, Shared_Key_Cache_Stats *recv, Shared_Key_Cache_Stats *sent)
+{
+    shared_key_cache_get_stats(dht->shared_keys_recv, recv);
+    shared_key_cache_get_stats(dht->shared_keys_sent, sent);
+}
+
 #define CRYPTO_SIZE (1 + CRYPTO_PUBLIC_KEY_SIZE * 2 + CRYPTO_NONCE_SIZE)
 
 /**
@@ -759,14 +792,89 @@ static void update_client(const Logger *log, const Mono_Time *mono_time, int ind
     assoc->timestamp = mono_time_get(mono_time);
 }
 
+/** @brief Slot of a client in the node index.
+ *
+ * The close list comes first, so when the same key is in several lists, the
+ * close list entry is visited first.
+ */
+static uint32_t node_index_slot(bool is_friend, uint32_t friend_num, uint32_t client_num)
+{
+    if (!is_friend) {
+        return client_num;
+    }
+
+    return LCLIENT_LIST + friend_num * MAX_FRIEND_CLIENTS + client_num;
+}
+
+non_null()
+static bool pk_is_empty(const uint8_t *public_key)
+{
+    const uint8_t empty_pk[CRYPTO_PUBLIC_KEY_SIZE] = {0};
+    return pk_equal(public_key, empty_pk);
+}
+
+/** @brief Make the node index entry of a slot match the public key now stored there. */
+non_null()
+static void node_index_update(DHT *dht, uint32_t slot, uint8_t *indexed_pk, const uint8_t *public_key)
+{
+    if (pk_equal(indexed_pk, public_key)) {
+        return;
+    }
+
+    if (!pk_is_empty(indexed_pk)) {
+        xor_index_remove(dht->node_index, indexed_pk, slot);
+    }
+
+    if (!pk_is_empty(public_key) && !xor_index_add(dht->node_index, public_key, slot)) {
+        LOGGER_WARNING(dht->log, "out of memory, falling back to scanning client lists");
+        dht->node_index_ok = false;
+        memset(indexed_pk, 0, CRYPTO_PUBLIC_KEY_SIZE);
+        return;
+    }
+
+    pk_copy(indexed_pk, public_key);
+}
+
+non_null()
+static void node_index_update_close(DHT *dht, uint32_t client_num)
+{
+    node_index_update(dht, node_index_slot(false, 0, client_num), dht->close_indexed_pk[client_num],
+                      dht->close_clientlist[client_num].public_key);
+}
+
+non_null()
+static void node_index_update_friend(DHT *dht, uint32_t friend_num)
+{
+    DHT_Friend *const dht_friend = &dht->friends_list[friend_num];
+
+    for (uint32_t i = 0; i < MAX_FRIEND_CLIENTS; ++i) {
+        node_index_update(dht, node_index_slot(true, friend_num, i), dht_friend->indexed_pk[i],
+                          dht_friend->client_list[i].public_key);
+    }
+}
+
+/** @brief Remove all entries of a friend from the node index. */
+non_null()
+static void node_index_remove_friend(DHT *dht, uint32_t friend_num)
+{
+    DHT_Friend *const dht_friend = &dht->friends_list[friend_num];
+    const uint8_t empty_pk[CRYPTO_PUBLIC_KEY_SIZE] = {0};
+
+    for (uint32_t i = 0; i < MAX_FRIEND_CLIENTS; ++i) {
+        node_index_update(dht, node_index_slot(true, friend_num, i), dht_friend->indexed_pk[i], empty_pk);
+    }
+}
+
 /** @brief Check if client with public_key is already in list of length length.
  *
  * If it is then set its corresponding timestamp to current time.
  * If the id is already in the list with a different ip_port, update it.
  * TODO(irungentoo): Maybe optimize this.
+ *
+ * @return index of the client now holding public_key, UINT32_MAX if none.
  */
 non_null()
-static bool client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_time, Client_data *list, uint16_t length,
+static uint32_t client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_time, Client_data *list, uint16_t length,
                                       const uint8_t *public_key, const IP_Port *ip_port)
 {
     const uint64_t temp_time = mono_time_get(mono_time);
@@ -775,7 +883,7 @@ static bool client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_t
     /* if public_key is in list, find it and maybe overwrite ip_port */
     if (index != UINT32_MAX) {
         update_client(log, mono_time, index, &list[index], ip_port);
-        return true;
+        return index;
     }
 
     /* public_key not in list yet: see if we can find an identical ip_port, in
@@ -786,7 +894,7 @@ static bool client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_t
     index = index_of_client_ip_port(list, length, ip_port);
 
     if (index == UINT32_MAX) {
-        return false;
+        return UINT32_MAX;
     }
 
     IPPTsPng *assoc;
@@ -809,7 +917,7 @@ static bool client_or_ip_port_in_list(const Logger *log, const Mono_Time *mono_t
     /* kill the other address, if it was set */
     const IPPTsPng empty_ipptspng = {{{{0}}}};
     *assoc = empty_ipptspng;
-    return true;
+    return index;
 }
 
 bool add_to_list(Node_format *nodes_list, uint32_t length, const uint8_t *pk, const IP_Port *ip_port,
@@ -834,8 +942,51 @@ bool add_to_list(Node_format *nodes_list, uint32_t length, const uint8_t *pk, co
     return false;
 }
 
+/** @brief Pick the address of a client to send in a send nodes response.
+ *
+ * @return nullptr if the client should not be sent.
+ */
+non_null()
+static const IPPTsPng *get_close_node_assoc(uint64_t cur_time, const Client_data *client, Family sa_family,
+        bool is_LAN, bool want_announce)
+{
+    const IPPTsPng *ipptp;
+
+    if (net_family_is_ipv4(sa_family)) {
+        ipptp = &client->assoc4;
+    } else if (net_family_is_ipv6(sa_family)) {
+        ipptp = &client->assoc6;
+    } else if (client->assoc4.timestamp >= client->assoc6.timestamp) {
+        ipptp = &client->assoc4;
+    } else {
+        ipptp = &client->assoc6;
+    }
+
+    /* node not in a good condition? */
+    if (assoc_timeout(cur_time, ipptp)) {
+        return nullptr;
+    }
+
+    /* don't send LAN ips to non LAN peers */
+    if (ip_is_lan(&ipptp->ip_port.ip) && !is_LAN) {
+        return nullptr;
+    }
+
+#ifdef CHECK_ANNOUNCE_NODE
+
+    if (want_announce && !client->announce_node) {
+        return nullptr;
+    }
+
+#endif
+
+    return ipptp;
+}
+
 /**
  * helper for `get_close_nodes()`. argument list is a monster :D
+ *
+ * Scans a whole client list; only used when the node index is unavailable.
  */
 non_null()
 static void get_close_nodes_inner(uint64_t cur_time, const uint8_t *public_key, Node_format *nodes_list,
@@ -843,10 +994,6 @@ static void get_close_nodes_inner(uint64_t cur_time, const uint8_t *public_key,
                                   uint32_t *num_nodes_ptr, bool is_LAN,
                                   bool want_announce)
 {
-    if (!net_family_is_ipv4(sa_family) && !net_family_is_ipv6(sa_family) && !net_family_is_unspec(sa_family)) {
-        return;
-    }
-
     uint32_t num_nodes = *num_nodes_ptr;
 
     for (uint32_t i = 0; i < client_list_length; ++i) {
@@ -857,36 +1004,12 @@ static void get_close_nodes_inner(uint64_t cur_time, const uint8_t *public_key,
             continue;
         }
 
-        const IPPTsPng *ipptp;
-
-        if (net_family_is_ipv4(sa_family)) {
-            ipptp = &client->assoc4;
-        } else if (net_family_is_ipv6(sa_family)) {
-            ipptp = &client->assoc6;
-        } else if (client->assoc4.timestamp >= client->assoc6.timestamp) {
-            ipptp = &client->assoc4;
-        } else {
-            ipptp = &client->assoc6;
-        }
-
-        /* node not in a good condition? */
-        if (assoc_timeout(cur_time, ipptp)) {
-            continue;
-        }
-
-        /* don't send LAN ips to non LAN peers */
-        if (ip_is_lan(&ipptp->ip_port.ip) && !is_LAN) {
-            continue;
-        }
-
-#ifdef CHECK_ANNOUNCE_NODE
+        const IPPTsPng *const ipptp = get_close_node_assoc(cur_time, client, sa_family, is_LAN, want_announce);
 
-        if (want_announce && !client->announce_node) {
+        if (ipptp == nullptr) {
             continue;
         }
 
-#endif
-
         if (num_nodes < MAX_SENT_NODES) {
             memcpy(nodes_list[num_nodes].public_key, client->public_key, CRYPTO_PUBLIC_KEY_SIZE);
             nodes_list[num_nodes].ip_port = ipptp->ip_port;
@@ -901,16 +1024,76 @@ static void get_close_nodes_inner(uint64_t cur_time, const uint8_t *public_key,
     *num_nodes_ptr = num_nodes;
 }
 
+typedef struct Close_Nodes_Search {
+    const DHT *dht;
+    Node_format *nodes_list;
+    uint32_t num_nodes;
+    Family sa_family;
+    bool is_LAN;
+    bool want_announce;
+} Close_Nodes_Search;
+
+non_null()
+static const Client_data *node_index_client(const DHT *dht, uint32_t slot)
+{
+    if (slot < LCLIENT_LIST) {
+        return &dht->close_clientlist[slot];
+    }
+
+    slot -= LCLIENT_LIST;
+    return &dht->friends_list[slot / MAX_FRIEND_CLIENTS].client_list[slot % MAX_FRIEND_CLIENTS];
+}
+
+non_null()
+static bool add_indexed_close_node(void *object, const uint8_t *public_key, uint32_t slot)
+{
+    Close_Nodes_Search *const search = (Close_Nodes_Search *)object;
+
+    /* node already in list? */
+    if (index_of_node_pk(search->nodes_list, search->num_nodes, public_key) != UINT32_MAX) {
+        return true;
+    }
+
+    const Client_data *const client = node_index_client(search->dht, slot);
+    const IPPTsPng *const ipptp = get_close_node_assoc(search->dht->cur_time, client, search->sa_family,
+                                  search->is_LAN, search->want_announce);
+
+    if (ipptp == nullptr) {
+        return true;
+    }
+
+    Node_format *const node = &search->nodes_list[search->num_nodes];
+    memcpy(node->public_key, client->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    node->ip_port = ipptp->ip_port;
+    ++search->num_nodes;
+
+    return search->num_nodes < MAX_SENT_NODES;
+}
+
 /**
  * Find MAX_SENT_NODES nodes closest to the public_key for the send nodes request:
  * put them in the nodes_list and return how many were found.
  *
+ * The nodes come from the node index, closest first, skipping the ones that
+ * are timed out or otherwise unsuitable, so this costs about as much as
+ * looking at the few nodes around public_key rather than all known nodes.
+ *
  * want_announce: return only nodes which implement the dht announcements protocol.
  */
 non_null()
 static int get_somewhat_close_nodes(const DHT *dht, const uint8_t *public_key, Node_format *nodes_list,
                                     Family sa_family, bool is_LAN, bool want_announce)
 {
+    if (!net_family_is_ipv4(sa_family) && !net_family_is_ipv6(sa_family) && !net_family_is_unspec(sa_family)) {
+        return 0;
+    }
+
+    if (dht->node_index_ok) {
+        Close_Nodes_Search search = {dht, nodes_list, 0, sa_family, is_LAN, want_announce};
+        xor_index_closest(dht->node_index, public_key, add_indexed_close_node, &search);
+        return search.num_nodes;
+    }
+
     uint32_t num_nodes = 0;
     get_close_nodes_inner(dht->cur_time, public_key, nodes_list, sa_family,
                           dht->close_clientlist, LCLIENT_LIST, &num_nodes, is_LAN, want_announce);
@@ -932,23 +1115,13 @@ int get_close_nodes(const DHT *dht, const uint8_t *public_key, Node_format *node
                                     is_LAN, want_announce);
 }
 
-typedef struct DHT_Cmp_Data {
-    uint64_t cur_time;
-    const uint8_t *base_public_key;
-    Client_data entry;
-} DHT_Cmp_Data;
-
+/** @brief Order of client list entries: timed out ones first, then from farthest to closest. */
 non_null()
-static int dht_cmp_entry(const void *a, const void *b)
+static int dht_cmp_entry(uint64_t cur_time, const uint8_t *cmp_public_key, const Client_data *entry1,
+                         const Client_data *entry2)
 {
-    const DHT_Cmp_Data *cmp1 = (const DHT_Cmp_Data *)a;
-    const DHT_Cmp_Data *cmp2 = (const DHT_Cmp_Data *)b;
-    const Client_data entry1 = cmp1->entry;
-    const Client_data entry2 = cmp2->entry;
-    const uint8_t *cmp_public_key = cmp1->base_public_key;
-
-    const bool t1 = assoc_timeout(cmp1->cur_time, &entry1.assoc4) && assoc_timeout(cmp1->cur_time, &entry1.assoc6);
-    const bool t2 = assoc_timeout(cmp2->cur_time, &entry2.assoc4) && assoc_timeout(cmp2->cur_time, &entry2.assoc6);
+    const bool t1 = assoc_timeout(cur_time, &entry1->assoc4) && assoc_timeout(cur_time, &entry1->assoc6);
+    const bool t2 = assoc_timeout(cur_time, &entry2->assoc4) && assoc_timeout(cur_time, &entry2->assoc6);
 
     if (t1 && t2) {
         return 0;
@@ -962,7 +1135,7 @@ static int dht_cmp_entry(const void *a, const void *b)
         return 1;
     }
 
-    const int closest = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
+    const int closest = id_closest(cmp_public_key, entry1->public_key, entry2->public_key);
 
     if (closest == 1) {
         return 1;
@@ -1090,31 +1263,58 @@ static bool store_node_ok(const Client_data *client, uint64_t cur_time, const ui
            || id_closest(comp_public_key, client->public_key, public_key) == 2;
 }
 
+/** @brief Sort a client list in place by dht_cmp_entry.
+ *
+ * Insertion sort: the lists are short and replace_all keeps them in order, so
+ * usually only entries that timed out since the last sort need to move.
+ */
 non_null()
 static void sort_client_list(Client_data *list, uint64_t cur_time, unsigned int length,
                              const uint8_t *comp_public_key)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
-    DHT_Cmp_Data *cmp_list = (DHT_Cmp_Data *)calloc(length, sizeof(DHT_Cmp_Data));
+    for (uint32_t i = 1; i < length; ++i) {
+        if (dht_cmp_entry(cur_time, comp_public_key, &list[i - 1], &list[i]) <= 0) {
+            continue;
+        }
 
-    if (cmp_list == nullptr) {
-        return;
-    }
+        const Client_data entry = list[i];
+        uint32_t j = i;
 
-    for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].cur_time = cur_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
+        while (j > 0 && dht_cmp_entry(cur_time, comp_public_key, &list[j - 1], &entry) > 0) {
+            list[j] = list[j - 1];
+            --j;
+        }
+
+        list[j] = entry;
     }
+}
 
-    qsort(cmp_list, length, sizeof(DHT_Cmp_Data), dht_cmp_entry);
+/** @brief Move the first entry of an otherwise sorted client list to its place. */
+non_null()
+static void sift_first_client(Client_data *list, uint64_t cur_time, unsigned int length,
+                              const uint8_t *comp_public_key)
+{
+    // Binary search for the first of list[1..length) that belongs after it.
+    uint32_t low = 1;
+    uint32_t high = length;
 
-    for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
+    while (low < high) {
+        const uint32_t mid = low + (high - low) / 2;
+
+        if (dht_cmp_entry(cur_time, comp_public_key, &list[mid], &list[0]) > 0) {
+            high = mid;
+        } else {
+            low = mid + 1;
+        }
     }
 
-    free(cmp_list);
+    const uint32_t index = low - 1;
+
+    if (index > 0) {
+        const Client_data entry = list[0];
+        memmove(&list[0], &list[1], index * sizeof(Client_data));
+        list[index] = entry;
+    }
 }
 
 non_null()
@@ -1181,6 +1381,9 @@ static bool replace_all(const DHT *dht,
     pk_copy(client->public_key, public_key);
 
     update_client_with_reset(dht->mono_time, client, ip_port);
+
+    // Keep the list sorted, so that the next call has nothing to sort.
+    sift_first_client(list, dht->cur_time, length, comp_public_key);
     return true;
 }
 
@@ -1203,7 +1406,8 @@ static bool add_to_close(DHT *dht, const uint8_t *public_key, const IP_Port *ip_
     for (uint32_t i = 0; i < LCLIENT_NODES; ++i) {
         /* TODO(iphydf): write bounds checking test to catch the case that
          * index is left as >= LCLIENT_LENGTH */
-        Client_data *const client = &dht->close_clientlist[(index * LCLIENT_NODES) + i];
+        const uint32_t client_num = (index * LCLIENT_NODES) + i;
+        Client_data *const client = &dht->close_clientlist[client_num];
 
         if (!assoc_timeout(dht->cur_time, &client->assoc4) ||
                 !assoc_timeout(dht->cur_time, &client->assoc6)) {
@@ -1216,6 +1420,7 @@ static bool add_to_close(DHT *dht, const uint8_t *public_key, const IP_Port *ip_
 
         pk_copy(client->public_key, public_key);
         update_client_with_reset(dht->mono_time, client, ip_port);
+        node_index_update_close(dht, client_num);
 #ifdef CHECK_ANNOUNCE_NODE
         client->announce_node = false;
         send_announce_ping(dht, public_key, ip_port);
@@ -1344,8 +1549,13 @@ uint32_t addto_lists(DHT *dht, const IP_Port *ip_port, const uint8_t *public_key
     /* NOTE: Current behavior if there are two clients with the same id is
      * to replace the first ip by the second.
      */
-    const bool in_close_list = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->close_clientlist, LCLIENT_LIST,
-                               public_key, &ipp_copy);
+    const uint32_t close_index = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->close_clientlist, LCLIENT_LIST,
+                                 public_key, &ipp_copy);
+    const bool in_close_list = close_index != UINT32_MAX;
+
+    if (in_close_list) {
+        node_index_update_close(dht, close_index);
+    }
 
     /* add_to_close should be called only if !in_list (don't extract to variable) */
     if (in_close_list || !add_to_close(dht, public_key, &ipp_copy, false)) {
@@ -1356,12 +1566,15 @@ uint32_t addto_lists(DHT *dht, const IP_Port *ip_port, const uint8_t *public_key
 
     for (uint32_t i = 0; i < dht->num_friends; ++i) {
         const bool in_list = client_or_ip_port_in_list(dht->log, dht->mono_time, dht->friends_list[i].client_list,
-                             MAX_FRIEND_CLIENTS, public_key, &ipp_copy);
+                             MAX_FRIEND_CLIENTS, public_key, &ipp_copy) != UINT32_MAX;
 
         /* replace_all should be called only if !in_list (don't extract to variable) */
         if (in_list
                 || replace_all(dht, dht->friends_list[i].client_list, MAX_FRIEND_CLIENTS, public_key, &ipp_copy,
                                dht->friends_list[i].public_key)) {
+            // Either call may have replaced or reordered keys in the list.
+            node_index_update_friend(dht, i);
+
             const DHT_Friend *dht_friend = &dht->friends_list[i];
 
             if (pk_equal(public_key, dht_friend->public_key)) {
@@ -1802,10 +2015,14 @@ int dht_delfriend(DHT *dht, const uint8_t *public_key, uint32_t lock_token)
         return 0;
     }
 
+    node_index_remove_friend(dht, friend_num);
+
     --dht->num_friends;
 
     if (dht->num_friends != friend_num) {
+        node_index_remove_friend(dht, dht->num_friends);
         dht->friends_list[friend_num] = dht->friends_list[dht->num_friends];
+        node_index_update_friend(dht, friend_num);
     }
 
     if (dht->num_friends == 0) {
@@ -1956,6 +2173,7 @@ static void do_dht_friends(DHT *dht)
         do_ping_and_sendnode_requests(dht, &dht_friend->lastgetnode, dht_friend->public_key, dht_friend->client_list,
                                       MAX_FRIEND_CLIENTS,
                                       &dht_friend->bootstrap_times, true);
+        node_index_update_friend(dht, i);
     }
 }
 
@@ -2621,6 +2839,63 @@ void cryptopacket_registerhandler(DHT *dht, uint8_t byte, cryptopacket_handler_c
     dht->cryptopackethandlers[byte].object = object;
 }
 
+/** @brief Decrypt a crypto request for us with the key shared with its sender and pass it to its handler.
+ *
+ * The length of the packet must have been checked by cryptopacket_handle.
+ *
+ * @return 0 if the request was handled, 1 otherwise.
+ */
+non_null(1, 2, 3, 4) nullable(6)
+static int cryptopacket_handle_request(const DHT *dht, const IP_Port *source, const uint8_t *shared_key,
+                                       const uint8_t *packet, uint16_t length, void *userdata)
+{
+    const uint8_t *const public_key = packet + 1 + CRYPTO_PUBLIC_KEY_SIZE;
+    const uint8_t *const nonce = packet + 1 + CRYPTO_PUBLIC_KEY_SIZE * 2;
+    uint8_t plain[MAX_CRYPTO_REQUEST_SIZE];
+    const int len = decrypt_data_symmetric(shared_key, nonce, packet + CRYPTO_SIZE, length - CRYPTO_SIZE, plain);
+
+    // The request needs a number and some data.
+    if (len <= 1) {
+        crypto_memzero(plain, sizeof(plain));
+        return 1;
+    }
+
+    const Cryptopacket_Handler *handler = &dht->cryptopackethandlers[plain[0]];
+    int ret = 1;
+
+    if (handler->function != nullptr) {
+        ret = handler->function(handler->object, source, public_key, plain + 1, len - 1, userdata);
+    }
+
+    crypto_memzero(plain, sizeof(plain));
+    return ret;
+}
+
+/** Source address and packet of a crypto request waiting for its key in the request pool. */
+#define CRYPTO_REQUEST_JOB_MAX_LENGTH (sizeof(IP_Port) + MAX_CRYPTO_REQUEST_SIZE)
+
+static_assert(CRYPTO_REQUEST_JOB_MAX_LENGTH <= PRECOMPUTE_JOB_DATA_SIZE,
+              "a deferred crypto request must fit in a precompute job");
+
+/** Finish a crypto request once the request pool computed its key. */
+non_null(1, 3) nullable(2, 5)
+static void cryptopacket_request_computed(void *object, const uint8_t *shared_key, const uint8_t *data,
+        uint16_t length, void *userdata)
+{
+    DHT *dht = (DHT *)object;
+
+    if (shared_key == nullptr || length <= sizeof(IP_Port)) {
+        return;
+    }
+
+    IP_Port source;
+    memcpy(&source, data, sizeof(IP_Port));
+    const uint8_t *packet = data + sizeof(IP_Port);
+
+    shared_key_cache_insert(dht->shared_keys_recv, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, shared_key);
+    cryptopacket_handle_request(dht, &source, shared_key, packet, length - sizeof(IP_Port), userdata);
+}
+
 non_null()
 static int cryptopacket_handle(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length,
                                void *userdata)
@@ -2636,23 +2911,38 @@ static int cryptopacket_handle(void *object, const IP_Port *source, const uint8_
 
     // Check if request is for us.
     if (pk_equal(packet + 1, dht->self_public_key)) {
-        uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
-        uint8_t data[MAX_CRYPTO_REQUEST_SIZE];
-        uint8_t number;
-        const int len = handle_request(dht->self_public_key, dht->self_secret_key, public_key,
-                                       data, &number, packet, length);
-
-        if (len == -1 || len == 0) {
+        if (length > MAX_CRYPTO_REQUEST_SIZE) {
             return 1;
         }
 
-        if (dht->cryptopackethandlers[number].function == nullptr) {
+        const uint8_t *const public_key = packet + 1 + CRYPTO_PUBLIC_KEY_SIZE;
+        const uint8_t *shared_key;
+
+        if (dht->request_pool == nullptr) {
+            shared_key = dht_get_shared_key_recv(dht, public_key);
+        } else {
+            shared_key = shared_key_cache_find(dht->shared_keys_recv, public_key);
+
+            if (shared_key == nullptr) {
+                // Leave the key agreement to the pool and handle the request when it's done.
+                uint8_t job[CRYPTO_REQUEST_JOB_MAX_LENGTH];
+                memcpy(job, source, sizeof(IP_Port));
+                memcpy(job + sizeof(IP_Port), packet, length);
+
+                if (!precompute_pool_add(dht->request_pool, public_key, dht->self_secret_key,
+                                         &cryptopacket_request_computed, dht, job, sizeof(IP_Port) + length)) {
+                    return 1;
+                }
+
+                return 0;
+            }
+        }
+
+        if (shared_key == nullptr) {
             return 1;
         }
 
-        return dht->cryptopackethandlers[number].function(
-                   dht->cryptopackethandlers[number].object, source, public_key,
-                   data, len, userdata);
+        return cryptopacket_handle_request(dht, source, shared_key, packet, length, userdata);
     }
 
     /* If request is not for us, try routing it. */
@@ -2724,6 +3014,15 @@ DHT *new_dht(const Logger *log, const Random *rng, const Network *ns, Mono_Time
         return nullptr;
     }
 
+    dht->node_index = xor_index_new();
+
+    if (dht->node_index == nullptr) {
+        kill_dht(dht);
+        return nullptr;
+    }
+
+    dht->node_index_ok = true;
+
     networking_registerhandler(dht->net, NET_PACKET_GET_NODES, &handle_getnodes, dht);
     networking_registerhandler(dht->net, NET_PACKET_SEND_NODES_IPV6, &handle_sendnodes_ipv6, dht);
     networking_registerhandler(dht->net, NET_PACKET_CRYPTO, &cryptopacket_handle, dht);
@@ -2736,8 +3035,8 @@ DHT *new_dht(const Logger *log, const Random *rng, const Network *ns, Mono_Time
 
     crypto_new_keypair(rng, dht->self_public_key, dht->self_secret_key);
 
-    dht->shared_keys_recv = shared_key_cache_new(mono_time, dht->self_secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
-    dht->shared_keys_sent = shared_key_cache_new(mono_time, dht->self_secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    dht->shared_keys_recv = shared_key_cache_new(mono_time, rng, dht->self_secret_key, KEYS_TIMEOUT, MAX_CACHED_KEYS);
+    dht->shared_keys_sent = shared_key_cache_new(mono_time, rng, dht->self_secret_key, KEYS_TIMEOUT, MAX_CACHED_KEYS);
 
     if (dht->shared_keys_recv == nullptr || dht->shared_keys_sent == nullptr) {
         kill_dht(dht);
@@ -2811,6 +3110,7 @@ void kill_dht(DHT *dht)
     shared_key_cache_free(dht->shared_keys_sent);
     ping_array_kill(dht->dht_ping_array);
     ping_kill(dht->ping);
+    xor_index_free(dht->node_index);
     free(dht->friends_list);
     free(dht->loaded_nodes_list);
     crypto_memzero(dht->self_secret_key, sizeof(dht->self_secret_key));
@@ -17,6 +17,8 @@
 #include "mono_time.h"
 #include "network.h"
 #include "ping_array.h"
+#include "precompute_pool.h"
+#include "shared_key_cache.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -291,6 +293,35 @@ const uint8_t *dht_get_shared_key_recv(DHT *dht, const uint8_t *public_key);
 non_null()
 const uint8_t *dht_get_shared_key_sent(DHT *dht, const uint8_t *public_key);
 
+/**
+ * Like dht_get_shared_key_sent, but returns nullptr instead of computing a key
+ * that is not cached yet.
+ */
+non_null()
+const uint8_t *dht_find_shared_key_sent(DHT *dht, const uint8_t *public_key);
+
+/**
+ * Add a key for packets that we send to public_key that was computed elsewhere.
+ *
+ * @return the cached shared key, or nullptr on allocation failure.
+ */
+non_null()
+const uint8_t *dht_add_shared_key_sent(DHT *dht, const uint8_t *public_key, const uint8_t *shared_key);
+
+/**
+ * Compute the keys of crypto requests from senders whose key is not cached on
+ * the workers of pool, and handle those requests when precompute_pool_do hands
+ * the keys back. Pass nullptr to compute the keys inline again.
+ *
+ * The pool must outlive the DHT or be unset first.
+ */
+non_null(1) nullable(2)
+void dht_set_request_pool(DHT *dht, Precompute_Pool *pool);
+
+/** @brief Copy the counters of the shared key caches for received and sent packets. */
+non_null()
+void dht_get_shared_key_stats(const DHT *dht, Shared_Key_Cache_Stats *recv, Shared_Key_Cache_Stats *sent);
+
 /**
  * Sends a getnodes request to `ip_port` with the public key `public_key` for nodes
  * that are close to `client_id`.
@@ -4,6 +4,7 @@
 
 #include <algorithm>
 #include <array>
+#include <vector>
 
 #include "crypto_core.h"
 
@@ -228,4 +229,83 @@ TEST(AnnounceNodes, SetAndTest)
     logger_kill(log);
 }
 
+/** All keys with an address in the close and friend client lists, sorted by distance to target. */
+std::vector<PublicKey> known_nodes_by_distance(DHT *dht, const PublicKey &target)
+{
+    std::vector<PublicKey> nodes;
+
+    auto add_client = [&nodes](const Client_data *client) {
+        const PublicKey pk = to_array(client->public_key);
+
+        if (client->assoc4.timestamp != 0 && std::find(nodes.begin(), nodes.end(), pk) == nodes.end()) {
+            nodes.push_back(pk);
+        }
+    };
+
+    for (uint32_t i = 0; i < LCLIENT_LIST; ++i) {
+        add_client(dht_get_close_client(dht, i));
+    }
+
+    for (uint32_t i = 0; i < dht_get_num_friends(dht); ++i) {
+        for (uint32_t j = 0; j < MAX_FRIEND_CLIENTS; ++j) {
+            add_client(dht_friend_client(dht_get_friend(dht, i), j));
+        }
+    }
+
+    std::sort(nodes.begin(), nodes.end(), [&target](const PublicKey &a, const PublicKey &b) {
+        return id_closest(target.data(), a.data(), b.data()) == 1;
+    });
+    return nodes;
+}
+
+TEST(GetCloseNodes, ReturnsClosestKnownNodes)
+{
+    Logger *log = logger_new();
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+    const Random *rng = system_random();
+    const Network *ns = system_network();
+    Networking_Core *net = new_networking_no_udp(log, ns);
+    DHT *dht = new_dht(log, rng, ns, mono_time, net, true, true);
+    ASSERT_NE(dht, nullptr);
+
+    const PublicKey friend_pk = random_pk(rng);
+    uint32_t lock_token;
+    ASSERT_EQ(dht_addfriend(dht, friend_pk.data(), nullptr, nullptr, 0, &lock_token), 0);
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        IP_Port ip_port = {0};
+        ip_port.ip.family = net_family_ipv4();
+        ip_port.ip.ip.v4.uint32 = net_htonl(0x01000000 + i);
+        ip_port.port = net_htons(33445);
+        addto_lists(dht, &ip_port, random_pk(rng).data());
+
+        // Reusing an address replaces the key it was stored with.
+        if (i % 50 == 49) {
+            addto_lists(dht, &ip_port, random_pk(rng).data());
+        }
+    }
+
+    // Moves the last fake friend into the deleted one's place.
+    ASSERT_EQ(dht_delfriend(dht, friend_pk.data(), lock_token), 0);
+
+    for (int round = 0; round < 50; ++round) {
+        const PublicKey target = random_pk(rng);
+        std::vector<PublicKey> expected = known_nodes_by_distance(dht, target);
+        ASSERT_GE(expected.size(), MAX_SENT_NODES);
+        expected.resize(MAX_SENT_NODES);
+
+        Node_format nodes[MAX_SENT_NODES];
+        ASSERT_EQ(get_close_nodes(dht, target.data(), nodes, net_family_unspec(), true, false), MAX_SENT_NODES);
+
+        for (uint32_t i = 0; i < MAX_SENT_NODES; ++i) {
+            EXPECT_EQ(to_array(nodes[i].public_key), expected[i]);
+        }
+    }
+
+    kill_dht(dht);
+    kill_networking(net);
+    mono_time_free(mono_time);
+    logger_kill(log);
+}
+
 }  // namespace
@@ -6,14 +6,26 @@
 /**
  * An implementation of a simple text chat only messenger on the tox network core.
  */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
 #include "Messenger.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "DHT.h"
 #include "ccompat.h"
 #include "group_chats.h"
@@ -184,6 +196,8 @@ non_null(1) nullable(4)
 static int m_handle_status(void *object, int i, bool status, void *userdata);
 non_null(1, 3) nullable(5)
 static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t len, void *userdata);
+non_null()
+static void kill_file_sinks(Messenger *m, int32_t friendnumber);
 non_null(1, 3) nullable(5)
 static int m_handle_lossy_packet(void *object, int friend_num, const uint8_t *packet, uint16_t length,
                                  void *userdata);
@@ -504,6 +518,7 @@ int m_delfriend(Messenger *m, int32_t friendnumber)
     }
 
     clear_receipts(m, friendnumber);
+    kill_file_sinks(m, friendnumber);
     remove_request_received(m->fr, m->friendlist[friendnumber].real_pk);
     friend_connection_callbacks(m->fr_c, m->friendlist[friendnumber].friendcon_id, MESSENGER_CALLBACK_INDEX, nullptr,
                                 nullptr, nullptr, nullptr, 0);
@@ -1080,6 +1095,8 @@ static void check_friend_tcp_udp(Messenger *m, int32_t friendnumber, void *userd
 
 non_null()
 static void break_files(const Messenger *m, int32_t friendnumber);
+non_null(1) nullable(3)
+static void flush_file_sinks(Messenger *m, int32_t friendnumber, void *userdata);
 
 non_null(1) nullable(4)
 static void check_friend_connectionstatus(Messenger *m, int32_t friendnumber, uint8_t status, void *userdata)
@@ -1093,6 +1110,7 @@ static void check_friend_connectionstatus(Messenger *m, int32_t friendnumber, ui
 
     if (is_online != was_online) {
         if (was_online) {
+            flush_file_sinks(m, friendnumber, userdata);
             break_files(m, friendnumber);
             clear_receipts(m, friendnumber);
         } else {
@@ -1178,6 +1196,11 @@ void callback_file_reqchunk(Messenger *m, m_file_chunk_request_cb *function)
     m->file_reqchunk = function;
 }
 
+void callback_file_recv_progress(Messenger *m, m_file_recv_progress_cb *function)
+{
+    m->file_recv_progress = function;
+}
+
 #define MAX_FILENAME_LENGTH 255
 
 /** @brief Copy the file transfer file id to file_id
@@ -1226,6 +1249,108 @@ int file_get_id(const Messenger *m, int32_t friendnumber, uint32_t filenumber, u
     return 0;
 }
 
+/** @brief Get the file transfer of a file number as used by the tox API.
+ *
+ * @return nullptr if there is no such transfer.
+ */
+non_null()
+static struct File_Transfers *get_file_transfer_of_number(const Messenger *m, int32_t friendnumber,
+        uint32_t filenumber)
+{
+    const bool inbound = filenumber >= (1 << 16);
+    const uint32_t file_number = inbound ? (filenumber >> 16) - 1 : filenumber;
+
+    if (file_number >= MAX_CONCURRENT_FILE_PIPES) {
+        return nullptr;
+    }
+
+    struct File_Transfers *const ft = inbound
+                                      ? &m->friendlist[friendnumber].file_receiving[file_number]
+                                      : &m->friendlist[friendnumber].file_sending[file_number];
+
+    if (ft->status == FILESTATUS_NONE) {
+        return nullptr;
+    }
+
+    return ft;
+}
+
+/** The throughput of a file transfer is averaged over windows of at least this many ms. */
+#define FILE_RATE_WINDOW 1000
+
+non_null()
+static void file_rate_reset(Mono_Time *mono_time, struct File_Transfers *ft)
+{
+    ft->rate_window_start = current_time_monotonic(mono_time);
+    ft->rate_window_bytes = 0;
+    ft->bytes_per_second = 0;
+}
+
+/** @brief Count bytes sent or received by a file transfer towards its throughput. */
+non_null()
+static void file_rate_add(Mono_Time *mono_time, struct File_Transfers *ft, uint64_t length)
+{
+    const uint64_t now = current_time_monotonic(mono_time);
+    const uint64_t elapsed = now - ft->rate_window_start;
+
+    if (elapsed >= FILE_RATE_WINDOW) {
+        ft->bytes_per_second = ft->rate_window_bytes * 1000 / elapsed;
+        ft->rate_window_start = now;
+        ft->rate_window_bytes = 0;
+    }
+
+    ft->rate_window_bytes += length;
+}
+
+int file_set_priority(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint8_t priority)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        return -1;
+    }
+
+    if (filenumber >= MAX_CONCURRENT_FILE_PIPES) {
+        return -2;
+    }
+
+    struct File_Transfers *const ft = get_file_transfer_of_number(m, friendnumber, filenumber);
+
+    if (ft == nullptr) {
+        return -2;
+    }
+
+    if (priority > FILE_PRIORITY_HIGH) {
+        return -3;
+    }
+
+    ft->priority = priority;
+    return 0;
+}
+
+int file_get_bytes_per_second(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
+                              uint64_t *bytes_per_second)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        return -1;
+    }
+
+    const struct File_Transfers *const ft = get_file_transfer_of_number(m, friendnumber, filenumber);
+
+    if (ft == nullptr) {
+        return -2;
+    }
+
+    const uint64_t elapsed = current_time_monotonic(m->mono_time) - ft->rate_window_start;
+
+    if (elapsed >= FILE_RATE_WINDOW) {
+        // Nothing moved since the window filled up, the open window is the better estimate.
+        *bytes_per_second = ft->rate_window_bytes * 1000 / elapsed;
+    } else {
+        *bytes_per_second = ft->bytes_per_second;
+    }
+
+    return 0;
+}
+
 /** @brief Send a file send request.
  * Maximum filename length is 255 bytes.
  * @retval 1 on success
@@ -1257,6 +1382,31 @@ static bool file_sendrequest(const Messenger *m, int32_t friendnumber, uint8_t f
     return write_cryptpacket_id(m, friendnumber, PACKET_ID_FILE_SENDREQUEST, packet, SIZEOF_VLA(packet), false);
 }
 
+static bool is_messagev2_file(uint32_t file_type)
+{
+    return file_type == HACK_TOX_FILE_KIND_MESSAGEV2_SEND
+           || file_type == HACK_TOX_FILE_KIND_MESSAGEV2_ANSWER
+           || file_type == HACK_TOX_FILE_KIND_MESSAGEV2_SYNC
+           || file_type == HACK_TOX_FILE_KIND_MESSAGEV2_ALTER;
+}
+
+/** @brief Add a sending transfer that became active to the friend's `active_sending` list. */
+non_null()
+static void schedule_file_sending(Friend *f, uint8_t filenumber)
+{
+    struct File_Transfers *const ft = &f->file_sending[filenumber];
+
+    if (ft->scheduled) {
+        // still listed from an earlier transfer in the same slot
+        return;
+    }
+
+    assert(f->num_active_sending < MAX_CONCURRENT_FILE_PIPES);
+    ft->scheduled = true;
+    f->active_sending[f->num_active_sending] = filenumber;
+    ++f->num_active_sending;
+}
+
 /** @brief Send a file send request.
  *
  * Maximum filename length is 255 bytes.
@@ -1332,10 +1482,16 @@ long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_
             (file_type == HACK_TOX_FILE_KIND_MESSAGEV2_ALTER)) {
         ft->status = FILESTATUS_TRANSFERRING;
         ++m->friendlist[friendnumber].num_sending_files;
+        schedule_file_sending(&m->friendlist[friendnumber], i);
     } else {
         ft->status = FILESTATUS_NOT_ACCEPTED;
     }
 
+    ft->priority = (file_type == FILEKIND_AVATAR || is_messagev2_file(file_type))
+                   ? FILE_PRIORITY_HIGH : FILE_PRIORITY_NORMAL;
+    ft->send_credit = 0;
+    file_rate_reset(m->mono_time, ft);
+
     ft->size = filesize;
 
     ft->transferred = 0;
@@ -1344,11 +1500,262 @@ long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_
 
     ft->paused = FILE_PAUSE_NOT;
 
+    ft->source = FILE_SOURCE_CLIENT;
+    ft->source_fd = -1;
+    ft->source_data = nullptr;
+
     memcpy(ft->id, file_id, FILE_ID_LENGTH);
 
     return i;
 }
 
+non_null()
+static struct File_Transfers *get_sending_file_source(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
+        int *error)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        *error = -1;
+        return nullptr;
+    }
+
+    if (filenumber >= MAX_CONCURRENT_FILE_PIPES) {
+        *error = -2;
+        return nullptr;
+    }
+
+    struct File_Transfers *ft = &m->friendlist[friendnumber].file_sending[filenumber];
+
+    if (ft->status == FILESTATUS_NONE) {
+        *error = -2;
+        return nullptr;
+    }
+
+    if (ft->size == UINT64_MAX) {
+        *error = -3;
+        return nullptr;
+    }
+
+    return ft;
+}
+
+int file_send_source_fd(const Messenger *m, int32_t friendnumber, uint32_t filenumber, int fd)
+{
+    int error = 0;
+    struct File_Transfers *ft = get_sending_file_source(m, friendnumber, filenumber, &error);
+
+    if (ft == nullptr) {
+        return error;
+    }
+
+    if (fd < 0) {
+        return -3;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    // Chunks are read in order, let the kernel read ahead aggressively.
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    ft->source = FILE_SOURCE_FD;
+    ft->source_fd = fd;
+    ft->source_data = nullptr;
+    return 0;
+}
+
+int file_send_source_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, const uint8_t *data)
+{
+    int error = 0;
+    struct File_Transfers *ft = get_sending_file_source(m, friendnumber, filenumber, &error);
+
+    if (ft == nullptr) {
+        return error;
+    }
+
+    ft->source = FILE_SOURCE_DATA;
+    ft->source_fd = -1;
+    ft->source_data = data;
+    return 0;
+}
+
+#define FILE_SINK_BUFFER_SIZE (64 * 1024)
+
+struct File_Sink {
+    int fd;
+    uint64_t progress_interval;
+    uint64_t next_progress;
+    /* File position of the first byte in `buffer`; everything before it was written. */
+    uint64_t buffer_position;
+    uint32_t buffer_length;
+    uint8_t buffer[FILE_SINK_BUFFER_SIZE];
+};
+
+non_null()
+static bool file_sink_flush(File_Sink *sink)
+{
+    uint32_t done = 0;
+
+    while (done < sink->buffer_length) {
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+        if (_lseeki64(sink->fd, (__int64)(sink->buffer_position + done), SEEK_SET) == -1) {
+            return false;
+        }
+
+        const int ret = _write(sink->fd, sink->buffer + done, sink->buffer_length - done);
+#else
+        const ssize_t ret = pwrite(sink->fd, sink->buffer + done, sink->buffer_length - done,
+                                   (off_t)(sink->buffer_position + done));
+#endif
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret <= 0) {
+            return false;
+        }
+
+        done += ret;
+    }
+
+    sink->buffer_position += sink->buffer_length;
+    sink->buffer_length = 0;
+    return true;
+}
+
+/** @brief Buffer `length` bytes at `position`, writing out every full block.
+ *
+ * Blocks end at multiples of FILE_SINK_BUFFER_SIZE, so that all writes except
+ * the first and last one of a transfer are aligned to the buffer size.
+ */
+non_null()
+static bool file_sink_add(File_Sink *sink, uint64_t position, const uint8_t *data, uint32_t length)
+{
+    if (position != sink->buffer_position + sink->buffer_length) {
+        // A seek; write out what we have and continue at the new position.
+        if (!file_sink_flush(sink)) {
+            return false;
+        }
+
+        sink->buffer_position = position;
+    }
+
+    while (length > 0) {
+        const uint64_t end = sink->buffer_position + sink->buffer_length;
+        const uint32_t space = FILE_SINK_BUFFER_SIZE - (uint32_t)(end % FILE_SINK_BUFFER_SIZE);
+        const uint32_t count = min_u32(space, length);
+
+        memcpy(sink->buffer + sink->buffer_length, data, count);
+        sink->buffer_length += count;
+        data += count;
+        length -= count;
+
+        if (count == space && !file_sink_flush(sink)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Write out the buffered data of a receiving transfer and free its sink. */
+non_null()
+static bool kill_file_sink(struct File_Transfers *ft)
+{
+    if (ft->sink == nullptr) {
+        return true;
+    }
+
+    const bool flushed = file_sink_flush(ft->sink);
+    free(ft->sink);
+    ft->sink = nullptr;
+    return flushed;
+}
+
+non_null()
+static void kill_file_sinks(Messenger *m, int32_t friendnumber)
+{
+    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
+        kill_file_sink(&m->friendlist[friendnumber].file_receiving[i]);
+    }
+}
+
+/** @brief Write out the buffered data of the friend's receiving transfers.
+ *
+ * Run this when the friend disconnects. The FTv2 transfers keep their sinks
+ * and continue when the friend comes back, but everything received so far is
+ * on disk in the meantime. Progress is reported for each sink that wrote
+ * something.
+ */
+static void flush_file_sinks(Messenger *m, int32_t friendnumber, void *userdata)
+{
+    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
+        File_Sink *sink = m->friendlist[friendnumber].file_receiving[i].sink;
+
+        if (sink == nullptr || sink->buffer_length == 0) {
+            continue;
+        }
+
+        const uint32_t real_filenumber = (i + 1) << 16;
+
+        if (!file_sink_flush(sink)) {
+            // The data stays buffered, the next write of the transfer tries again.
+            LOGGER_WARNING(m->log, "could not write file data: friendnum: %d filenum: %d", friendnumber,
+                           real_filenumber);
+            continue;
+        }
+
+        if (m->file_recv_progress != nullptr) {
+            m->file_recv_progress(m, friendnumber, real_filenumber, sink->buffer_position, userdata);
+        }
+    }
+}
+
+int file_recv_sink_fd(const Messenger *m, int32_t friendnumber, uint32_t filenumber, int fd,
+                      uint64_t progress_interval, bool preallocate)
+{
+    if (!m_friend_exists(m, friendnumber)) {
+        return -1;
+    }
+
+    if (filenumber < (1 << 16) || (filenumber >> 16) - 1 >= MAX_CONCURRENT_FILE_PIPES) {
+        return -2;
+    }
+
+    struct File_Transfers *ft = &m->friendlist[friendnumber].file_receiving[(filenumber >> 16) - 1];
+
+    if (ft->status == FILESTATUS_NONE) {
+        return -2;
+    }
+
+    if (fd < 0) {
+        return -3;
+    }
+
+    File_Sink *sink = (File_Sink *)calloc(1, sizeof(File_Sink));
+
+    if (sink == nullptr) {
+        return -4;
+    }
+
+#ifdef __linux__
+
+    if (preallocate && ft->size != UINT64_MAX && ft->size > 0) {
+        // Only a hint to avoid fragmentation, the transfer works without it.
+        posix_fallocate(fd, 0, (off_t)ft->size);
+    }
+
+#endif
+
+    kill_file_sink(ft);
+
+    sink->fd = fd;
+    sink->progress_interval = progress_interval;
+    sink->next_progress = ft->transferred + progress_interval;
+    sink->buffer_position = ft->transferred;
+    ft->sink = sink;
+    return 0;
+}
+
 non_null(1) nullable(6)
 static bool send_file_control_packet(const Messenger *m, int32_t friendnumber, bool inbound, uint8_t filenumber,
                                      uint8_t control_type, const uint8_t *data, uint16_t data_length)
@@ -1472,6 +1879,7 @@ int file_control(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
                     --m->friendlist[friendnumber].num_receiving_files;
                 }
 
+                kill_file_sink(ft);
                 ft->file_type = 0;
                 ft->received_seek_control = false;
                 ft->received_seek_control_counter = 0;
@@ -1570,6 +1978,25 @@ int file_seek(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uin
     return 0;
 }
 
+#define FILE_DATA_HEADER_LENGTH 2
+
+/** @brief Send a file data packet whose payload of `length` bytes has already
+ * been written to `packet` after FILE_DATA_HEADER_LENGTH bytes of headroom.
+ *
+ * @return packet number on success.
+ * @retval -1 on failure.
+ */
+non_null()
+static int64_t write_file_data_packet(const Messenger *m, int32_t friendnumber, uint8_t filenumber, uint8_t *packet,
+                                      uint16_t length)
+{
+    packet[0] = PACKET_ID_FILE_DATA;
+    packet[1] = filenumber;
+
+    return write_cryptpacket(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
+                             m->friendlist[friendnumber].friendcon_id), packet, FILE_DATA_HEADER_LENGTH + length, true);
+}
+
 /** @return packet number on success.
  * @retval -1 on failure.
  */
@@ -1583,16 +2010,13 @@ static int64_t send_file_data_packet(const Messenger *m, int32_t friendnumber, u
         return -1;
     }
 
-    VLA(uint8_t, packet, 2 + length);
-    packet[0] = PACKET_ID_FILE_DATA;
-    packet[1] = filenumber;
+    VLA(uint8_t, packet, FILE_DATA_HEADER_LENGTH + length);
 
     if (length > 0) {
-        memcpy(packet + 2, data, length);
+        memcpy(packet + FILE_DATA_HEADER_LENGTH, data, length);
     }
 
-    return write_cryptpacket(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
-                             m->friendlist[friendnumber].friendcon_id), packet, SIZEOF_VLA(packet), true);
+    return write_file_data_packet(m, friendnumber, filenumber, packet, length);
 }
 
 #define MAX_FILE_DATA_SIZE (MAX_CRYPTO_DATA_SIZE - 2)
@@ -1611,116 +2035,396 @@ static int64_t send_file_data_packet(const Messenger *m, int32_t friendnumber, u
 int send_file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint64_t position,
                    const uint8_t *data, uint16_t length)
 {
-    assert(length == 0 || data != nullptr);
+    assert(length == 0 || data != nullptr);
+
+    if (!m_friend_exists(m, friendnumber)) {
+        return -1;
+    }
+
+    if (m->friendlist[friendnumber].status != FRIEND_ONLINE) {
+        return -2;
+    }
+
+    if (filenumber >= MAX_CONCURRENT_FILE_PIPES) {
+        return -3;
+    }
+
+    struct File_Transfers *ft = &m->friendlist[friendnumber].file_sending[filenumber];
+
+    if (ft->status != FILESTATUS_TRANSFERRING) {
+        return -4;
+    }
+
+    if (length > MAX_FILE_DATA_SIZE) {
+        return -5;
+    }
+
+    if (ft->file_type == FILEKIND_FTV2) {
+        if (length > (MAX_FILE_DATA_SIZE - FILE_OFFSET_LENGTH)) {
+            LOGGER_WARNING(m->log, "sending FT chunk too large. size=%d max=%d", length, (MAX_FILE_DATA_SIZE - FILE_OFFSET_LENGTH));
+            return -5;
+        }
+
+        uint16_t length_raw = length - FILE_ID_LENGTH;
+
+        if ((ft->size - ft->transferred) < length_raw) {
+            LOGGER_WARNING(m->log, "sending FT chunk length error.");
+            return -5;
+        }
+
+        if (position != ft->transferred || (ft->requested <= position && ft->size != 0)) {
+            LOGGER_WARNING(m->log, "wrong position.");
+            return -7;
+        }
+
+        /* Prevent file sending from filling up the entire buffer preventing messages from being sent.
+         * TODO(irungentoo): remove */
+        if (crypto_num_free_sendqueue_slots(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
+                                            m->friendlist[friendnumber].friendcon_id)) < MIN_SLOTS_FREE) {
+            return -6;
+        }
+
+        VLA(uint8_t, packet, FILE_DATA_HEADER_LENGTH + FILE_OFFSET_LENGTH + length);
+        net_pack_u64(packet + FILE_DATA_HEADER_LENGTH, position);
+
+        if (length > 0) {
+            memcpy(packet + FILE_DATA_HEADER_LENGTH + FILE_OFFSET_LENGTH, data, length);
+        }
+
+        const int64_t ret = write_file_data_packet(m, friendnumber, filenumber, packet, FILE_OFFSET_LENGTH + length);
+
+        if (ret != -1) {
+            ft->transferred += length_raw;
+            file_rate_add(m->mono_time, ft, length_raw);
+            return 0;
+        }
+
+    } else {
+        if (ft->size - ft->transferred < length) {
+            return -5;
+        }
+
+        if (ft->size != UINT64_MAX && length != MAX_FILE_DATA_SIZE && (ft->transferred + length) != ft->size) {
+            return -5;
+        }
+
+        if (position != ft->transferred || (ft->requested <= position && ft->size != 0)) {
+            return -7;
+        }
+
+        /* Prevent file sending from filling up the entire buffer preventing messages from being sent.
+         * TODO(irungentoo): remove */
+        if (crypto_num_free_sendqueue_slots(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
+                                            m->friendlist[friendnumber].friendcon_id)) < MIN_SLOTS_FREE) {
+            return -6;
+        }
+
+        const int64_t ret = send_file_data_packet(m, friendnumber, filenumber, data, length);
+
+        if (ret != -1) {
+            // TODO(irungentoo): record packet ids to check if other received complete file.
+            ft->transferred += length;
+            file_rate_add(m->mono_time, ft, length);
+
+            if (length != MAX_FILE_DATA_SIZE || ft->size == ft->transferred) {
+                ft->status = FILESTATUS_FINISHED;
+                ft->last_packet_number = ret;
+            }
+
+            return 0;
+        }
+    }
+
+    return -6;
+}
+
+/** @brief Read `length` bytes at `position` of a file whose data core reads itself. */
+non_null()
+static bool read_file_source(const struct File_Transfers *ft, uint64_t position, uint8_t *data, uint16_t length)
+{
+    if (ft->source == FILE_SOURCE_DATA) {
+        memcpy(data, ft->source_data + position, length);
+        return true;
+    }
+
+    uint16_t done = 0;
+
+    while (done < length) {
+#if defined(_WIN32) || defined(__WIN32__) || defined(WIN32)
+        if (_lseeki64(ft->source_fd, (__int64)(position + done), SEEK_SET) == -1) {
+            return false;
+        }
+
+        const int ret = _read(ft->source_fd, data + done, length - done);
+#else
+        const ssize_t ret = pread(ft->source_fd, data + done, length - done, (off_t)(position + done));
+#endif
+
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (ret <= 0) {
+            return false;
+        }
+
+        done += ret;
+    }
+
+    return true;
+}
+
+/** @brief Read the chunk at `position` from the file source and send it.
+ *
+ * The packet is assembled in place, so the data is only copied once before
+ * `write_cryptpacket` queues it.
+ *
+ * @retval 0 on success.
+ * @retval -1 if the file could not be read.
+ * @retval -2 if the packet could not be sent.
+ */
+non_null()
+static int send_file_data_from_source(const Messenger *m, int32_t friendnumber, uint8_t filenumber,
+                                      struct File_Transfers *ft, uint64_t position, uint16_t length)
+{
+    uint8_t packet[MAX_CRYPTO_DATA_SIZE];
+    uint16_t header_length = 0;
+
+    if (ft->file_type == FILEKIND_FTV2) {
+        net_pack_u64(packet + FILE_DATA_HEADER_LENGTH, position);
+        memcpy(packet + FILE_DATA_HEADER_LENGTH + FILE_OFFSET_LENGTH, ft->id, FILE_ID_LENGTH);
+        header_length = FILE_OFFSET_LENGTH + FILE_ID_LENGTH;
+    }
+
+    assert((size_t)(FILE_DATA_HEADER_LENGTH + header_length + length) <= sizeof(packet));
+
+    if (!read_file_source(ft, position, packet + FILE_DATA_HEADER_LENGTH + header_length, length)) {
+        return -1;
+    }
+
+    const int64_t ret = write_file_data_packet(m, friendnumber, filenumber, packet, header_length + length);
+
+    if (ret == -1) {
+        return -2;
+    }
+
+    ft->transferred += length;
+    file_rate_add(m->mono_time, ft, length);
+
+    if (ft->file_type != FILEKIND_FTV2 && (length != MAX_FILE_DATA_SIZE || ft->size == ft->transferred)) {
+        ft->status = FILESTATUS_FINISHED;
+        ft->last_packet_number = ret;
+    }
+
+    return 0;
+}
+
+/** @brief Get the next chunk of a sending file transfer.
+ *
+ * If core reads the file itself, the chunk is sent right away. Otherwise it is
+ * requested from the client.
+ *
+ * @retval true if the chunk was sent or requested.
+ */
+non_null(1, 4) nullable(7)
+static bool request_file_chunk(Messenger *m, int32_t friendnumber, uint32_t filenumber, struct File_Transfers *ft,
+                               uint64_t position, uint16_t length, void *userdata)
+{
+    if (ft->source == FILE_SOURCE_CLIENT) {
+        if (m->file_reqchunk != nullptr) {
+            m->file_reqchunk(m, friendnumber, filenumber, position, length, userdata);
+        }
 
-    if (!m_friend_exists(m, friendnumber)) {
-        return -1;
+        return true;
     }
 
-    if (m->friendlist[friendnumber].status != FRIEND_ONLINE) {
-        return -2;
+    const int ret = send_file_data_from_source(m, friendnumber, filenumber, ft, position, length);
+
+    if (ret == -2) {
+        // The connection can't take more data right now, try again with the same chunk later.
+        ft->requested = position;
+        return false;
     }
 
-    if (filenumber >= MAX_CONCURRENT_FILE_PIPES) {
-        return -3;
+    if (ret == -1) {
+        LOGGER_WARNING(m->log, "could not read file data: friendnum: %d filenum: %d position: %lu", friendnumber,
+                       filenumber, (unsigned long)position);
+
+        if (file_control(m, friendnumber, filenumber, FILECONTROL_KILL) == 0 && m->file_filecontrol != nullptr) {
+            m->file_filecontrol(m, friendnumber, filenumber, FILECONTROL_KILL, userdata);
+        }
+
+        return false;
     }
 
-    struct File_Transfers *ft = &m->friendlist[friendnumber].file_sending[filenumber];
+    return true;
+}
 
-    if (ft->status != FILESTATUS_TRANSFERRING) {
-        return -4;
+/** @brief Request the next chunk of an active sending transfer, or finish the transfer.
+ *
+ * @retval 1 if a chunk was requested.
+ * @retval 0 if the transfer has nothing to send right now.
+ * @retval -1 if no more chunks should be requested in this iteration.
+ */
+non_null(1, 4) nullable(5)
+static int do_filetransfer(Messenger *m, int32_t friendnumber, uint8_t filenumber, struct File_Transfers *ft,
+                           void *userdata)
+{
+    Friend *const friendcon = &m->friendlist[friendnumber];
+
+    if (ft->status != FILESTATUS_TRANSFERRING && ft->status != FILESTATUS_FINISHED) {
+        // Filetransfer ended since it was scheduled, nothing to do
+        return 0;
     }
 
-    if (length > MAX_FILE_DATA_SIZE) {
-        return -5;
+    if (max_speed_reached(m->net_crypto, friend_connection_crypt_connection_id(
+                              m->fr_c, friendcon->friendcon_id))) {
+        LOGGER_DEBUG(m->log, "maximum connection speed reached");
+        // connection doesn't support any more data
+        return -1;
     }
 
     if (ft->file_type == FILEKIND_FTV2) {
-        if (length > (MAX_FILE_DATA_SIZE - FILE_OFFSET_LENGTH)) {
-            LOGGER_WARNING(m->log, "sending FT chunk too large. size=%d max=%d", length, (MAX_FILE_DATA_SIZE - FILE_OFFSET_LENGTH));
-            return -5;
-        }
+        // If the file transfer is complete, we request a chunk of size 0.
+        if (ft->status == FILESTATUS_FINISHED) {
+            LOGGER_DEBUG(m->log, "The file transfer is complete, we request a chunk of size 0");
+            if (m->file_reqchunk != nullptr) {
+                m->file_reqchunk(m, friendnumber, filenumber, ft->transferred, 0, userdata);
+            }
+            // Now it's inactive, we're no longer sending this.
+            ft->status = FILESTATUS_NONE;
+            ft->file_type = 0;
+            ft->received_seek_control = false;
+            ft->ft_send_ackd = false;
+            ft->received_seek_control_counter = 0;
+            ft->file_receiver_last_received_chunk_this_many_iterations_ago = 0;
+            ft->file_sender_started_this_many_iterations_ago = 0;
+            memset(ft->filename, 0, MAX_FILENAME_LENGTH);
+            ft->filename_length = 0;
+            --friendcon->num_sending_files;
+        } else if (ft->status == FILESTATUS_TRANSFERRING && ft->paused == FILE_PAUSE_NOT) {
+            if (ft->size == ft->requested) {
+                // HINT: this is overkill in the log // LOGGER_DEBUG(m->log, "we as sender think this FTv2 is already finished");
+                // we as sender think this FTv2 is already finished,
+                // so we wait for either the receiver to send FILECONTROL_FINISHED
+                // or to send a SEEK to a new position
+                return 0;
+            }
 
-        uint16_t length_raw = length - FILE_ID_LENGTH;
+            if (ft->received_seek_control) {
+                LOGGER_TRACE(m->log, "we are processing a SEEK control, so do not send new chunks for %d tox_iterate() cycles", (int)PAUSE_CYCLES_ON_FTV2_SEEK_RECEIVED);
+                return 0;
+            }
 
-        if ((ft->size - ft->transferred) < length_raw) {
-            LOGGER_WARNING(m->log, "sending FT chunk length error.");
-            return -5;
-        }
+            uint16_t length = min_u64(ft->size - ft->requested, (MAX_FILE_DATA_SIZE - FILE_OFFSET_LENGTH - FILE_ID_LENGTH));
+            const uint64_t position = ft->requested;
+            ft->requested += length;
 
-        if (position != ft->transferred || (ft->requested <= position && ft->size != 0)) {
-            LOGGER_WARNING(m->log, "wrong position.");
-            return -7;
-        }
+            if (!request_file_chunk(m, friendnumber, filenumber, ft, position, length, userdata)) {
+                return -1;
+            }
 
-        /* Prevent file sending from filling up the entire buffer preventing messages from being sent.
-         * TODO(irungentoo): remove */
-        if (crypto_num_free_sendqueue_slots(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
-                                            m->friendlist[friendnumber].friendcon_id)) < MIN_SLOTS_FREE) {
-            return -6;
+            return 1;
         }
+    } else {
+        // If the file transfer is complete, we request a chunk of size 0.
+        if (ft->status == FILESTATUS_FINISHED && friend_received_packet(m, friendnumber, ft->last_packet_number) == 0) {
+            if (m->file_reqchunk != nullptr) {
+                m->file_reqchunk(m, friendnumber, filenumber, ft->transferred, 0, userdata);
+            }
 
-        uint16_t length_send = length + FILE_OFFSET_LENGTH;
-        uint8_t *data_send = (uint8_t *)calloc(1, length_send);
-        if (data_send)
-        {
-            net_pack_u64(data_send, position);
-            memcpy((data_send + FILE_OFFSET_LENGTH), data, length);
-            const int64_t ret = send_file_data_packet(m, friendnumber, filenumber, data_send, length_send);
-            free(data_send);
+            // Now it's inactive, we're no longer sending this.
+            ft->status = FILESTATUS_NONE;
+            ft->file_type = 0;
+            ft->received_seek_control = false;
+            ft->ft_send_ackd = false;
+            ft->received_seek_control_counter = 0;
+            ft->file_receiver_last_received_chunk_this_many_iterations_ago = 0;
+            ft->file_sender_started_this_many_iterations_ago = 0;
+            memset(ft->filename, 0, MAX_FILENAME_LENGTH);
+            ft->filename_length = 0;
+            --friendcon->num_sending_files;
+        } else if (ft->status == FILESTATUS_TRANSFERRING && ft->paused == FILE_PAUSE_NOT) {
+            if (ft->size == 0) {
+                /* Send 0 data to friend if file is 0 length. */
+                send_file_data(m, friendnumber, filenumber, 0, nullptr, 0);
+                return 0;
+            }
 
-            if (ret != -1) {
-                ft->transferred += length_raw;
+            if (ft->size == ft->requested) {
+                // This file transfer is done.
                 return 0;
             }
-        }
-        else
-        {
-            LOGGER_WARNING(m->log, "could not allocate buffer.");
-            return -6;
-        }
 
-    } else {
-        if (ft->size - ft->transferred < length) {
-            return -5;
-        }
+            const uint16_t length = min_u64(ft->size - ft->requested, MAX_FILE_DATA_SIZE);
+            const uint64_t position = ft->requested;
+            ft->requested += length;
 
-        if (ft->size != UINT64_MAX && length != MAX_FILE_DATA_SIZE && (ft->transferred + length) != ft->size) {
-            return -5;
-        }
+            if (!request_file_chunk(m, friendnumber, filenumber, ft, position, length, userdata)) {
+                return -1;
+            }
 
-        if (position != ft->transferred || (ft->requested <= position && ft->size != 0)) {
-            return -7;
+            return 1;
         }
+    }
 
-        /* Prevent file sending from filling up the entire buffer preventing messages from being sent.
-         * TODO(irungentoo): remove */
-        if (crypto_num_free_sendqueue_slots(m->net_crypto, friend_connection_crypt_connection_id(m->fr_c,
-                                            m->friendlist[friendnumber].friendcon_id)) < MIN_SLOTS_FREE) {
-            return -6;
-        }
+    return 0;
+}
 
-        const int64_t ret = send_file_data_packet(m, friendnumber, filenumber, data, length);
+/** @brief Remove the sending transfers that ended from the friend's `active_sending` list. */
+non_null()
+static void drop_inactive_file_sending(Friend *f)
+{
+    uint16_t num_active = 0;
+    uint16_t next = 0;
 
-        if (ret != -1) {
-            // TODO(irungentoo): record packet ids to check if other received complete file.
-            ft->transferred += length;
+    for (uint16_t i = 0; i < f->num_active_sending; ++i) {
+        const uint8_t filenumber = f->active_sending[i];
+        struct File_Transfers *const ft = &f->file_sending[filenumber];
 
-            if (length != MAX_FILE_DATA_SIZE || ft->size == ft->transferred) {
-                ft->status = FILESTATUS_FINISHED;
-                ft->last_packet_number = ret;
-            }
+        if (i == f->active_sending_next) {
+            // the turn stays with this transfer, or passes to the next one still listed
+            next = num_active;
+        }
 
-            return 0;
+        if (ft->status == FILESTATUS_TRANSFERRING || ft->status == FILESTATUS_FINISHED) {
+            f->active_sending[num_active] = filenumber;
+            ++num_active;
+        } else {
+            ft->scheduled = false;
+            ft->send_credit = 0;
         }
     }
 
-    return -6;
+    f->num_active_sending = num_active;
+    f->active_sending_next = next < num_active ? next : 0;
+}
+
+/** Number of chunks a sending transfer may request per turn, by File_Priority. */
+non_null()
+static uint32_t file_priority_weight(const struct File_Transfers *ft)
+{
+    switch (ft->priority) {
+        case FILE_PRIORITY_LOW:
+            return 1;
+
+        case FILE_PRIORITY_HIGH:
+            return 16;
+
+        default:
+            return 4;
+    }
 }
 
 /**
- * Iterate over all file sending transfers and request chunks (from the client) for each
- * of them.
+ * Do one scheduling round over the active file sending transfers and request chunks (from the
+ * client) for each of them, or send them right away for transfers whose file core reads itself.
+ *
+ * This is deficit round robin: the transfers take turns, and each turn a transfer gets as many
+ * chunks as the weight of its priority. If the send queue fills up during a turn, the transfer
+ * keeps the rest of its credit and the next round continues its turn, so the free slots are
+ * shared by weight no matter how few of them free up per call. A transfer that has nothing to
+ * send ends its turn and loses its credit.
  *
  * The free_slots parameter is updated by this function.
  *
@@ -1732,125 +2436,55 @@ int send_file_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber
  * @return true if there's still work to do, false otherwise.
  *
  */
-non_null()
+non_null(1, 4) nullable(3)
 static bool do_all_filetransfers(Messenger *m, int32_t friendnumber, void *userdata, uint32_t *free_slots)
 {
     Friend *const friendcon = &m->friendlist[friendnumber];
+    const uint16_t num_active = friendcon->num_active_sending;
 
-    // Iterate over file transfers as long as we're sending files
-    for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-        if (friendcon->num_sending_files == 0) {
-            // no active file transfers anymore
-            return false;
-        }
-
-        if (*free_slots == 0) {
-            // send buffer full enough
-            return false;
-        }
+    if (num_active == 0) {
+        // no active file transfers anymore
+        return false;
+    }
 
-        struct File_Transfers *const ft = &friendcon->file_sending[i];
+    bool requested = false;
 
-        if (ft->status == FILESTATUS_NONE || ft->status == FILESTATUS_NOT_ACCEPTED) {
-            // Filetransfers not actively sending, nothing to do
-            continue;
-        }
+    for (uint16_t i = 0; i < num_active; ++i) {
+        const uint8_t filenumber = friendcon->active_sending[friendcon->active_sending_next];
+        struct File_Transfers *const ft = &friendcon->file_sending[filenumber];
 
-        if (max_speed_reached(m->net_crypto, friend_connection_crypt_connection_id(
-                                  m->fr_c, friendcon->friendcon_id))) {
-            LOGGER_DEBUG(m->log, "maximum connection speed reached");
-            // connection doesn't support any more data
-            return false;
+        if (ft->send_credit == 0) {
+            // a new turn
+            ft->send_credit = file_priority_weight(ft);
         }
 
-        if (ft->file_type == FILEKIND_FTV2) {
-            // If the file transfer is complete, we request a chunk of size 0.
-            if (ft->status == FILESTATUS_FINISHED) {
-                LOGGER_DEBUG(m->log, "The file transfer is complete, we request a chunk of size 0");
-                if (m->file_reqchunk != nullptr) {
-                    m->file_reqchunk(m, friendnumber, i, ft->transferred, 0, userdata);
-                }
-                // Now it's inactive, we're no longer sending this.
-                ft->status = FILESTATUS_NONE;
-                ft->file_type = 0;
-                ft->received_seek_control = false;
-                ft->ft_send_ackd = false;
-                ft->received_seek_control_counter = 0;
-                ft->file_receiver_last_received_chunk_this_many_iterations_ago = 0;
-                ft->file_sender_started_this_many_iterations_ago = 0;
-                memset(ft->filename, 0, MAX_FILENAME_LENGTH);
-                ft->filename_length = 0;
-                --friendcon->num_sending_files;
-            } else if (ft->status == FILESTATUS_TRANSFERRING && ft->paused == FILE_PAUSE_NOT) {
-                if (ft->size == ft->requested) {
-                    // HINT: this is overkill in the log // LOGGER_DEBUG(m->log, "we as sender think this FTv2 is already finished");
-                    // we as sender think this FTv2 is already finished,
-                    // so we wait for either the receiver to send FILECONTROL_FINISHED
-                    // or to send a SEEK to a new position
-                    continue;
-                }
-
-                if (ft->received_seek_control) {
-                    LOGGER_TRACE(m->log, "we are processing a SEEK control, so do not send new chunks for %d tox_iterate() cycles", (int)PAUSE_CYCLES_ON_FTV2_SEEK_RECEIVED);
-                    continue;
-                }
-
-                uint16_t length = min_u64(ft->size - ft->requested, (MAX_FILE_DATA_SIZE - FILE_OFFSET_LENGTH - FILE_ID_LENGTH));
-                const uint64_t position = ft->requested;
-                ft->requested += length;
-
-                if (m->file_reqchunk != nullptr) {
-                    m->file_reqchunk(m, friendnumber, i, position, length, userdata);
-                }
-
-                // The allocated slot is no longer free.
-                --*free_slots;
+        while (ft->send_credit > 0) {
+            if (*free_slots == 0) {
+                // send buffer full enough, the turn goes on next time
+                return false;
             }
-        } else {
-            // If the file transfer is complete, we request a chunk of size 0.
-            if (ft->status == FILESTATUS_FINISHED && friend_received_packet(m, friendnumber, ft->last_packet_number) == 0) {
-                if (m->file_reqchunk != nullptr) {
-                    m->file_reqchunk(m, friendnumber, i, ft->transferred, 0, userdata);
-                }
-
-                // Now it's inactive, we're no longer sending this.
-                ft->status = FILESTATUS_NONE;
-                ft->file_type = 0;
-                ft->received_seek_control = false;
-                ft->ft_send_ackd = false;
-                ft->received_seek_control_counter = 0;
-                ft->file_receiver_last_received_chunk_this_many_iterations_ago = 0;
-                ft->file_sender_started_this_many_iterations_ago = 0;
-                memset(ft->filename, 0, MAX_FILENAME_LENGTH);
-                ft->filename_length = 0;
-                --friendcon->num_sending_files;
-            } else if (ft->status == FILESTATUS_TRANSFERRING && ft->paused == FILE_PAUSE_NOT) {
-                if (ft->size == 0) {
-                    /* Send 0 data to friend if file is 0 length. */
-                    send_file_data(m, friendnumber, i, 0, nullptr, 0);
-                    continue;
-                }
-
-                if (ft->size == ft->requested) {
-                    // This file transfer is done.
-                    continue;
-                }
 
-                const uint16_t length = min_u64(ft->size - ft->requested, MAX_FILE_DATA_SIZE);
-                const uint64_t position = ft->requested;
-                ft->requested += length;
+            const int ret = do_filetransfer(m, friendnumber, filenumber, ft, userdata);
 
-                if (m->file_reqchunk != nullptr) {
-                    m->file_reqchunk(m, friendnumber, i, position, length, userdata);
-                }
+            if (ret < 0) {
+                return false;
+            }
 
-                // The allocated slot is no longer free.
-                --*free_slots;
+            if (ret == 0) {
+                ft->send_credit = 0;
+                break;
             }
+
+            // The allocated slot is no longer free.
+            --*free_slots;
+            --ft->send_credit;
+            requested = true;
         }
+
+        friendcon->active_sending_next = (friendcon->active_sending_next + 1) % num_active;
     }
 
-    return true;
+    return requested;
 }
 
 non_null(1) nullable(3)
@@ -1955,6 +2589,9 @@ static void do_reqchunk_filecb(Messenger *m, int32_t friendnumber, void *userdat
     // TODO(Jfreegman): set this cap dynamically
     const uint32_t max_ft_loops = 128;
 
+    Friend *const friendcon = &m->friendlist[friendnumber];
+    drop_inactive_file_sending(friendcon);
+
     for (uint32_t i = 0; i < max_ft_loops; ++i) {
         if (!do_all_filetransfers(m, friendnumber, userdata, &free_slots)) {
             break;
@@ -1967,10 +2604,9 @@ static void do_reqchunk_filecb(Messenger *m, int32_t friendnumber, void *userdat
     }
 
     // reset `received_seek_control` flag for sending FTs
-    Friend *const friendcon = &m->friendlist[friendnumber];
     if (friendcon->num_sending_files > 0) {
-        for (uint32_t i = 0; i < MAX_CONCURRENT_FILE_PIPES; ++i) {
-            struct File_Transfers *const ft = &friendcon->file_sending[i];
+        for (uint16_t i = 0; i < friendcon->num_active_sending; ++i) {
+            struct File_Transfers *const ft = &friendcon->file_sending[friendcon->active_sending[i]];
             if (ft->received_seek_control) {
                 --ft->received_seek_control_counter;
                 // we also check for the unlikely event that the previous line has rolled over `received_seek_control_counter`
@@ -1984,7 +2620,8 @@ static void do_reqchunk_filecb(Messenger *m, int32_t friendnumber, void *userdat
 
 
 /** @brief Run this when the friend disconnects.
- * Kill all current file transfers.
+ * Kill all current file transfers except FTv2 ones, which continue when the
+ * friend comes back. Their file sources stay in use until then.
  */
 static void break_files(const Messenger *m, int32_t friendnumber)
 {
@@ -2007,6 +2644,7 @@ static void break_files(const Messenger *m, int32_t friendnumber)
 
         if (f->file_receiving[i].file_type != FILEKIND_FTV2)
         {
+            kill_file_sink(&f->file_receiving[i]);
             f->file_receiving[i].status = FILESTATUS_NONE;
             f->file_receiving[i].file_type = 0;
             f->file_receiving[i].received_seek_control = false;
@@ -2041,6 +2679,71 @@ static struct File_Transfers *get_file_transfer(bool outbound, uint8_t filenumbe
     return ft;
 }
 
+/** @brief Pass received file data to the sink of a receiving transfer.
+ *
+ * The sink is written out when the last byte of the file arrives. If writing
+ * fails, the transfer is cancelled and the client gets a FILECONTROL_KILL.
+ *
+ * @retval true on success.
+ */
+non_null(1, 4) nullable(6, 8)
+static bool write_file_sink(Messenger *m, int32_t friendnumber, uint32_t real_filenumber, struct File_Transfers *ft,
+                            uint64_t position, const uint8_t *data, uint32_t length, void *userdata)
+{
+    File_Sink *sink = ft->sink;
+    bool ok = length == 0 || file_sink_add(sink, position, data, length);
+
+    if (ok && position + length >= ft->size) {
+        ok = file_sink_flush(sink);
+    }
+
+    if (!ok) {
+        LOGGER_WARNING(m->log, "could not write file data: friendnum: %d filenum: %d position: %lu", friendnumber,
+                       real_filenumber, (unsigned long)position);
+
+        if (file_control(m, friendnumber, real_filenumber, FILECONTROL_KILL) == 0 && m->file_filecontrol != nullptr) {
+            m->file_filecontrol(m, friendnumber, real_filenumber, FILECONTROL_KILL, userdata);
+        }
+
+        return false;
+    }
+
+    // The end of the transfer is reported by `close_file_sink`.
+    if (sink->progress_interval > 0 && sink->buffer_position >= sink->next_progress
+            && position + length < ft->size) {
+        sink->next_progress = sink->buffer_position - sink->buffer_position % sink->progress_interval
+                              + sink->progress_interval;
+
+        if (m->file_recv_progress != nullptr) {
+            m->file_recv_progress(m, friendnumber, real_filenumber, sink->buffer_position, userdata);
+        }
+    }
+
+    return true;
+}
+
+/** @brief Write out and free the sink of a transfer that was received completely.
+ *
+ * The final progress is reported before the client learns that the transfer
+ * has finished.
+ */
+non_null(1, 4) nullable(5)
+static void close_file_sink(Messenger *m, int32_t friendnumber, uint32_t real_filenumber, struct File_Transfers *ft,
+                            void *userdata)
+{
+    if (ft->sink == nullptr) {
+        return;
+    }
+
+    if (!kill_file_sink(ft)) {
+        LOGGER_WARNING(m->log, "could not write file data: friendnum: %d filenum: %d", friendnumber, real_filenumber);
+    }
+
+    if (m->file_recv_progress != nullptr) {
+        m->file_recv_progress(m, friendnumber, real_filenumber, ft->transferred, userdata);
+    }
+}
+
 /** @retval -1 on failure
  * @retval 0 on success.
  */
@@ -2071,6 +2774,7 @@ static int handle_filecontrol(Messenger *m, int32_t friendnumber, bool outbound,
             if (outbound && ft->status == FILESTATUS_NOT_ACCEPTED) {
                 ft->status = FILESTATUS_TRANSFERRING;
                 ++m->friendlist[friendnumber].num_sending_files;
+                schedule_file_sending(&m->friendlist[friendnumber], filenumber);
             } else {
                 if ((ft->paused & FILE_PAUSE_OTHER) != 0) {
                     ft->paused ^= FILE_PAUSE_OTHER;
@@ -2159,6 +2863,7 @@ static int handle_filecontrol(Messenger *m, int32_t friendnumber, bool outbound,
             }
 
             LOGGER_DEBUG(m->log, "FILECONTROL_KILL:friendcon->num_sending_files=%d", m->friendlist[friendnumber].num_sending_files);
+            kill_file_sink(ft);
             ft->status = FILESTATUS_NONE;
             ft->file_type = 0;
             ft->received_seek_control = false;
@@ -2624,6 +3329,8 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
             ft->size = filesize;
             ft->transferred = 0;
             ft->paused = FILE_PAUSE_NOT;
+            kill_file_sink(ft);
+            file_rate_reset(m->mono_time, ft);
             memcpy(ft->id, data + 1 + sizeof(uint32_t) + sizeof(uint64_t), FILE_ID_LENGTH);
 
             ++m->friendlist[i].num_receiving_files;
@@ -2806,11 +3513,17 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
                 // we have received a data packet, reset the stale counter
                 ft->file_receiver_last_received_chunk_this_many_iterations_ago = 0;
 
-                if (m->file_filedata != nullptr) {
+                if (ft->sink != nullptr) {
+                    if (!write_file_sink(m, i, real_filenumber, ft, ft->transferred, file_data_raw + FILE_ID_LENGTH,
+                                         file_data_length_raw_ft, userdata)) {
+                        break;
+                    }
+                } else if (m->file_filedata != nullptr) {
                     m->file_filedata(m, i, real_filenumber, ft->transferred, file_data_raw, file_data_length_raw, userdata);
                 }
 
                 ft->transferred += file_data_length_raw_ft;
+                file_rate_add(m->mono_time, ft, file_data_length_raw_ft);
 
                 if (ft->transferred == ft->size)
                 {
@@ -2822,6 +3535,7 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
                     } else {
                         /* Full file received. */
                         --m->friendlist[i].num_receiving_files;
+                        close_file_sink(m, i, real_filenumber, ft, userdata);
                         if (m->file_filedata != nullptr) {
                             m->file_filedata(m, i, real_filenumber, ft->transferred, nullptr, 0, userdata);
                         }
@@ -2845,11 +3559,22 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
                     file_data_length = ft->size - ft->transferred;
                 }
 
-                if (m->file_filedata != nullptr) {
-                    m->file_filedata(m, i, real_filenumber, position, file_data, file_data_length, userdata);
+                if (ft->sink != nullptr && file_data_length > 0) {
+                    if (!write_file_sink(m, i, real_filenumber, ft, position, file_data, file_data_length, userdata)) {
+                        break;
+                    }
+                } else {
+                    if (file_data_length == 0) {
+                        close_file_sink(m, i, real_filenumber, ft, userdata);
+                    }
+
+                    if (m->file_filedata != nullptr) {
+                        m->file_filedata(m, i, real_filenumber, position, file_data, file_data_length, userdata);
+                    }
                 }
 
                 ft->transferred += file_data_length;
+                file_rate_add(m->mono_time, ft, file_data_length);
 
                 if (file_data_length > 0 && (ft->transferred >= ft->size || file_data_length != MAX_FILE_DATA_SIZE)) {
                     file_data_length = 0;
@@ -2857,6 +3582,7 @@ static int m_handle_packet(void *object, int i, const uint8_t *temp, uint16_t le
                     position = ft->transferred;
                     --m->friendlist[i].num_receiving_files;
                     /* Full file received. */
+                    close_file_sink(m, i, real_filenumber, ft, userdata);
                     if (m->file_filedata != nullptr) {
                         m->file_filedata(m, i, real_filenumber, position, file_data, file_data_length, userdata);
                     }
@@ -3023,13 +3749,66 @@ static char *id_to_string(const uint8_t *pk, char *id_str, size_t length)
  */
 uint32_t messenger_run_interval(const Messenger *m)
 {
-    const uint32_t crypto_interval = crypto_run_interval(m->net_crypto);
+    return min_u32(messenger_wait_interval(m), MIN_RUN_INTERVAL);
+}
+
+uint32_t messenger_wait_interval(const Messenger *m)
+{
+    /* DHT, onion, friend connection, friend and group timers all count in
+     * whole seconds, so they can only come due when the second changes. */
+    uint32_t interval = mono_time_until_next_second(m->mono_time);
+
+    interval = min_u32(interval, crypto_run_interval(m->net_crypto));
+
+#ifndef VANILLA_NACL
+    interval = min_u32(interval, gc_run_interval(m->group_handler));
+#endif
+
+    if (m->tcp_server != nullptr) {
+        /* Relayed data is flushed to other clients from the main loop. */
+        interval = min_u32(interval, MIN_RUN_INTERVAL);
+    }
+
+    return interval;
+}
+
+/** @brief The free part of a socket array that already holds `count` sockets. */
+nullable(1)
+static Socket *sockets_tail(Socket *socks, uint32_t socks_size, uint32_t count)
+{
+    return count < socks_size ? &socks[count] : nullptr;
+}
+
+static uint32_t sockets_space(uint32_t socks_size, uint32_t count)
+{
+    return count < socks_size ? socks_size - count : 0;
+}
+
+uint32_t messenger_get_sockets(const Messenger *m, Socket *socks, uint32_t socks_size)
+{
+    uint32_t count = 0;
+
+    if (!m->options.udp_disabled) {
+        if (socks_size > 0) {
+            socks[0] = net_socket_of(m->net);
+        }
 
-    if (crypto_interval > MIN_RUN_INTERVAL) {
-        return MIN_RUN_INTERVAL;
+        ++count;
     }
 
-    return crypto_interval;
+    count += tcp_connections_get_sockets(nc_get_tcp_c(m->net_crypto), sockets_tail(socks, socks_size, count),
+                                         sockets_space(socks_size, count));
+
+#ifndef VANILLA_NACL
+    count += gc_get_sockets(m->group_handler, sockets_tail(socks, socks_size, count), sockets_space(socks_size, count));
+#endif
+
+    if (m->tcp_server != nullptr) {
+        count += tcp_server_get_sockets(m->tcp_server, sockets_tail(socks, socks_size, count),
+                                        sockets_space(socks_size, count));
+    }
+
+    return count;
 }
 
 /** @brief Attempts to create a DHT announcement for a group chat with our connection info. An
@@ -4235,6 +5014,18 @@ Messenger *new_messenger(Mono_Time *mono_time, const Random *rng, const Network
         return nullptr;
     }
 
+    if (options->handshake_threads > 0
+            && !nc_set_handshake_threads(m->net_crypto, options->handshake_threads, NC_HANDSHAKE_QUEUE_SIZE)) {
+        LOGGER_WARNING(m->log, "failed to start %u handshake threads", options->handshake_threads);
+        kill_net_crypto(m->net_crypto);
+        kill_dht(m->dht);
+        kill_networking(m->net);
+        friendreq_kill(m->fr);
+        logger_kill(m->log);
+        free(m);
+        return nullptr;
+    }
+
 #ifndef VANILLA_NACL
     m->group_announce = new_gca_list();
 
@@ -4388,6 +5179,7 @@ void kill_messenger(Messenger *m)
 
     for (uint32_t i = 0; i < m->numfriends; ++i) {
         clear_receipts(m, i);
+        kill_file_sinks(m, i);
     }
 
     logger_kill(m->log);
@@ -70,6 +70,12 @@ typedef struct Messenger_Options {
     bool local_discovery_enabled;
     bool dht_announcements_enabled;
 
+    /* Threads computing handshake keys, 0 for none. */
+    uint16_t handshake_threads;
+
+    /* Peers a group broadcast is sent to for relaying, 0 to send it to everyone. */
+    uint8_t group_relay_fanout;
+
     logger_cb *log_callback;
     void *log_context;
     void *log_user_data;
@@ -162,6 +168,9 @@ typedef enum Userstatus {
 #define FILE_ID_LENGTH 32
 #define FILE_OFFSET_LENGTH 8
 
+/** Writes the data of a receiving transfer to a file descriptor, see `file_recv_sink_fd`. */
+typedef struct File_Sink File_Sink;
+
 struct File_Transfers {
     uint64_t size;
     uint64_t transferred;
@@ -178,7 +187,33 @@ struct File_Transfers {
     bool ft_send_ackd;
     uint8_t filename[255]; // "MAX_FILENAME_LENGTH 255" in Messenger.c and "TOX_MAX_FILENAME_LENGTH 255" in tox.h -> how can we keep that in sync?
     uint32_t filename_length;
+    /* Where core reads the data of a sending transfer itself, see `file_send_source_fd`
+     * and `file_send_source_data`. Only used if `source` is not FILE_SOURCE_CLIENT. */
+    uint8_t source;
+    int source_fd;
+    const uint8_t *source_data;
+    /* Set if core writes the data of a receiving transfer itself. */
+    File_Sink *sink;
+    /* One of File_Priority, only used for sending transfers, see `do_all_filetransfers`. */
+    uint8_t priority;
+    bool scheduled; /* true if the file number is in the friend's `active_sending` list. */
+    uint32_t send_credit; /* chunks left in this transfer's turn, see `do_all_filetransfers`. */
+    /* Throughput, see `file_get_bytes_per_second`. */
+    uint64_t rate_window_start; /* in ms */
+    uint64_t rate_window_bytes; /* since `rate_window_start` */
+    uint64_t bytes_per_second; /* over the last full window */
 };
+typedef enum File_Source {
+    FILE_SOURCE_CLIENT, /* chunks are requested from the client with `file_reqchunk` */
+    FILE_SOURCE_FD,
+    FILE_SOURCE_DATA,
+} File_Source;
+typedef enum File_Priority {
+    FILE_PRIORITY_LOW,
+    FILE_PRIORITY_NORMAL, /* default for FILEKIND_DATA and FILEKIND_FTV2 */
+    FILE_PRIORITY_HIGH, /* default for FILEKIND_AVATAR and MessageV2 files */
+} File_Priority;
+
 typedef enum Filestatus {
     FILESTATUS_NONE,
     FILESTATUS_NOT_ACCEPTED,
@@ -232,6 +267,8 @@ typedef void m_file_chunk_request_cb(Messenger *m, uint32_t friend_number, uint3
                                      size_t length, void *user_data);
 typedef void m_file_recv_chunk_cb(Messenger *m, uint32_t friend_number, uint32_t file_number, uint64_t position,
                                   const uint8_t *data, size_t length, void *user_data);
+typedef void m_file_recv_progress_cb(Messenger *m, uint32_t friend_number, uint32_t file_number,
+                                     uint64_t bytes_written, void *user_data);
 typedef void m_friend_lossy_packet_cb(Messenger *m, uint32_t friend_number, uint8_t packet_id, const uint8_t *data,
                                       size_t length, void *user_data);
 typedef void m_friend_lossless_packet_cb(Messenger *m, uint32_t friend_number, uint8_t packet_id, const uint8_t *data,
@@ -273,6 +310,11 @@ typedef struct Friend {
     Connection_Status last_connection_udp_tcp;
     struct File_Transfers file_sending[MAX_CONCURRENT_FILE_PIPES];
     uint32_t num_sending_files;
+    /* Numbers of the sending transfers that are transferring or finished, in the order they
+     * were started. Entries of transfers that ended are removed by `do_all_filetransfers`. */
+    uint8_t active_sending[MAX_CONCURRENT_FILE_PIPES];
+    uint16_t num_active_sending;
+    uint16_t active_sending_next; /* whose turn it is in `active_sending` */
     uint32_t num_receiving_files;
     struct File_Transfers file_receiving[MAX_CONCURRENT_FILE_PIPES];
 
@@ -341,6 +383,7 @@ struct Messenger {
     m_file_recv_control_cb *file_filecontrol;
     m_file_recv_chunk_cb *file_filedata;
     m_file_chunk_request_cb *file_reqchunk;
+    m_file_recv_progress_cb *file_recv_progress;
 
     m_friend_lossy_packet_cb *lossy_packethandler;
     m_friend_lossless_packet_cb *lossless_packethandler;
@@ -697,6 +740,9 @@ non_null() void callback_file_data(Messenger *m, m_file_recv_chunk_cb *function)
 /** @brief Set the callback for file request chunk. */
 non_null() void callback_file_reqchunk(Messenger *m, m_file_chunk_request_cb *function);
 
+/** @brief Set the callback for the progress of receiving transfers written by `file_recv_sink_fd`. */
+non_null() void callback_file_recv_progress(Messenger *m, m_file_recv_progress_cb *function);
+
 
 /** @brief Copy the file transfer file id to file_id
  *
@@ -707,6 +753,35 @@ non_null() void callback_file_reqchunk(Messenger *m, m_file_chunk_request_cb *fu
 non_null()
 int file_get_id(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint8_t *file_id);
 
+/** @brief Set the priority of a sending file transfer.
+ *
+ * Sending transfers share the free slots in the send queue in proportion to
+ * the weights of their priorities.
+ *
+ * @param priority One of File_Priority.
+ *
+ * @retval 0 on success.
+ * @retval -1 if friend not valid.
+ * @retval -2 if filenumber not valid or not a sending transfer.
+ * @retval -3 if priority not valid.
+ */
+non_null()
+int file_set_priority(const Messenger *m, int32_t friendnumber, uint32_t filenumber, uint8_t priority);
+
+/** @brief Get the throughput of a file transfer.
+ *
+ * The throughput is averaged over the last full window of about a second of
+ * sent or received data. If no data was sent or received since, the open
+ * window is used, so a stalled transfer goes down to 0.
+ *
+ * @retval 0 on success.
+ * @retval -1 if friend not valid.
+ * @retval -2 if filenumber not valid.
+ */
+non_null()
+int file_get_bytes_per_second(const Messenger *m, int32_t friendnumber, uint32_t filenumber,
+                              uint64_t *bytes_per_second);
+
 /** @brief Send a file send request.
  *
  * Maximum filename length is 255 bytes.
@@ -721,6 +796,57 @@ non_null()
 long int new_filesender(const Messenger *m, int32_t friendnumber, uint32_t file_type, uint64_t filesize,
                         const uint8_t *file_id, const uint8_t *filename, uint16_t filename_length);
 
+/** @brief Let core read the data of a sending file transfer from a file descriptor.
+ *
+ * Chunks are read with pread() at their position in the file and sent without
+ * calling `file_reqchunk`, which is only called once with length 0 when the
+ * transfer has finished. The descriptor is not closed by core.
+ *
+ * @retval 0 on success.
+ * @retval -1 if friend not valid.
+ * @retval -2 if filenumber not valid.
+ * @retval -3 if the file size is unknown or the descriptor is invalid.
+ */
+non_null()
+int file_send_source_fd(const Messenger *m, int32_t friendnumber, uint32_t filenumber, int fd);
+
+/** @brief Let core read the data of a sending file transfer from memory.
+ *
+ * Like `file_send_source_fd`, but chunks are copied from `data`, which must
+ * hold the whole file and stay valid until the transfer has ended. It may be
+ * NULL for an empty file.
+ *
+ * @retval 0 on success.
+ * @retval -1 if friend not valid.
+ * @retval -2 if filenumber not valid.
+ * @retval -3 if the file size is unknown.
+ */
+non_null(1) nullable(4)
+int file_send_source_data(const Messenger *m, int32_t friendnumber, uint32_t filenumber, const uint8_t *data);
+
+/** @brief Let core write the data of a receiving file transfer to a file descriptor.
+ *
+ * Incoming chunks are collected in a buffer and written with pwrite() at their
+ * position in the file in large writes aligned to the buffer size, instead of
+ * calling `file_filedata` for every chunk. `file_filedata` is only called once
+ * with length 0 when the transfer has finished and all data is written. The
+ * buffer is also written out when the friend goes offline.
+ * The descriptor is not closed by core.
+ *
+ * @param progress_interval Call `file_recv_progress` each time this many more
+ *   bytes were written. 0 to only report the end of the transfer.
+ * @param preallocate Reserve the announced file size on disk first, where supported.
+ *
+ * @retval 0 on success.
+ * @retval -1 if friend not valid.
+ * @retval -2 if filenumber not valid.
+ * @retval -3 if the descriptor is invalid.
+ * @retval -4 if memory allocation failed.
+ */
+non_null()
+int file_recv_sink_fd(const Messenger *m, int32_t friendnumber, uint32_t filenumber, int fd,
+                      uint64_t progress_interval, bool preallocate);
+
 /** @brief Send a file control request.
  *
  * @retval 0 on success
@@ -832,11 +958,31 @@ void do_messenger(Messenger *m, void *userdata);
  * @brief Return the time in milliseconds before `do_messenger()` should be called again
  *   for optimal performance.
  *
+ * This is capped so that callers who don't wait for the sockets from
+ * `messenger_get_sockets()` still pick up incoming packets in time.
+ *
  * @return time (in ms) before the next `do_messenger()` needs to be run on success.
  */
 non_null()
 uint32_t messenger_run_interval(const Messenger *m);
 
+/**
+ * @brief Return the time in milliseconds until the earliest deadline of any
+ *   subsystem, not counting packets that may arrive before then.
+ */
+non_null()
+uint32_t messenger_wait_interval(const Messenger *m);
+
+/** @brief Get the sockets `do_messenger()` reads from.
+ *
+ * Writes up to `socks_size` sockets to `socks`. The set changes as TCP relay
+ * connections come and go.
+ *
+ * @return the number of sockets, which may be more than `socks_size`.
+ */
+non_null(1) nullable(2)
+uint32_t messenger_get_sockets(const Messenger *m, Socket *socks, uint32_t socks_size);
+
 /* SAVING AND LOADING FUNCTIONS: */
 
 /** @brief Registers a state plugin for saving, loading, and getting the size of a section of the save.
@@ -79,6 +79,48 @@ TCP_Client_Status tcp_con_status(const TCP_Client_Connection *con)
 {
     return con->status;
 }
+Socket tcp_con_sock(const TCP_Client_Connection *con)
+{
+    return con->con.sock;
+}
+bool tcp_con_has_pending_data(const TCP_Client_Connection *con)
+{
+    return tcp_has_pending_data(&con->con);
+}
+uint32_t tcp_con_run_interval(const TCP_Client_Connection *con, const Mono_Time *mono_time)
+{
+    if (con->status == TCP_CLIENT_DISCONNECTED) {
+        return UINT32_MAX;
+    }
+
+    // do_TCP_connection gives up once mono_time_get reaches kill_at.
+    uint64_t deadline = con->kill_at;
+
+    if (con->status == TCP_CLIENT_CONFIRMED) {
+        if (con->ping_request_id != 0 || con->ping_response_id != 0) {
+            return 0;
+        }
+
+        // mono_time_is_timeout fires one second after last_pinged + timeout.
+        deadline = min_u64(deadline, con->last_pinged + TCP_PING_FREQUENCY + 1);
+
+        if (con->ping_id != 0) {
+            deadline = min_u64(deadline, con->last_pinged + TCP_PING_TIMEOUT + 1);
+        }
+    }
+
+    if (deadline == UINT64_MAX) {
+        return UINT32_MAX;
+    }
+
+    const uint64_t now = mono_time_get(mono_time);
+
+    if (deadline <= now) {
+        return 0;
+    }
+
+    return (uint32_t)min_u64((deadline - now) * 1000, UINT32_MAX - 1);
+}
 void *tcp_con_custom_object(const TCP_Client_Connection *con)
 {
     return con->custom_object;
@@ -998,7 +1040,7 @@ void kill_TCP_connection(TCP_Client_Connection *tcp_connection)
         return;
     }
 
-    wipe_priority_list(tcp_connection->con.priority_queue_start);
+    wipe_send_queue(&tcp_connection->con);
     kill_sock(tcp_connection->con.ns, tcp_connection->con.sock);
     crypto_memzero(tcp_connection, sizeof(TCP_Client_Connection));
     free(tcp_connection);
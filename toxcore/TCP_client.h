@@ -46,6 +46,21 @@ non_null()
 IP_Port tcp_con_ip_port(const TCP_Client_Connection *con);
 non_null()
 TCP_Client_Status tcp_con_status(const TCP_Client_Connection *con);
+non_null()
+Socket tcp_con_sock(const TCP_Client_Connection *con);
+/** @brief Whether the connection has data waiting for its socket to become writable. */
+non_null()
+bool tcp_con_has_pending_data(const TCP_Client_Connection *con);
+/** @brief Time in ms until do_TCP_connection has to send a ping, give up on an
+ * unanswered one or give up connecting.
+ *
+ * A ping that is due but not yet queued counts as due now. The result is
+ * accurate to one second.
+ *
+ * @return UINT32_MAX if there is no such deadline.
+ */
+non_null()
+uint32_t tcp_con_run_interval(const TCP_Client_Connection *con, const Mono_Time *mono_time);
 
 non_null()
 void *tcp_con_custom_object(const TCP_Client_Connection *con);
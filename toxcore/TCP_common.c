@@ -9,15 +9,181 @@
 #include <string.h>
 
 #include "ccompat.h"
+#include "util.h"
 
-void wipe_priority_list(TCP_Priority_List *p)
+/** Capacity of a newly allocated send queue. Larger queues shrink back to this once drained. */
+#define TCP_SEND_QUEUE_MIN_CAPACITY 4096
+
+void wipe_send_queue(TCP_Connection *con)
+{
+    free(con->send_queue.data);
+    memset(&con->send_queue, 0, sizeof(TCP_Send_Queue));
+}
+
+uint32_t tcp_send_queue_packets(const TCP_Connection *con)
+{
+    return con->send_queue.packets;
+}
+
+uint32_t tcp_send_queue_bytes(const TCP_Connection *con)
+{
+    return con->send_queue.size;
+}
+
+uint32_t tcp_send_queue_max_bytes(const TCP_Connection *con)
+{
+    return con->send_queue.max_size;
+}
+
+bool tcp_has_pending_data(const TCP_Connection *con)
+{
+    return con->last_packet_length != 0 || con->send_queue.size != 0;
+}
+
+/** @brief Make room for `length` more bytes, growing the ring if needed.
+ *
+ * @retval false on allocation failure.
+ */
+non_null()
+static bool send_queue_reserve(TCP_Send_Queue *q, uint32_t length)
+{
+    if (q->capacity - q->size >= length) {
+        return true;
+    }
+
+    uint32_t capacity = q->capacity == 0 ? TCP_SEND_QUEUE_MIN_CAPACITY : q->capacity;
+
+    while (capacity - q->size < length) {
+        if (capacity > UINT32_MAX / 2) {
+            return false;
+        }
+
+        capacity *= 2;
+    }
+
+    uint8_t *data = (uint8_t *)malloc(capacity);
+
+    if (data == nullptr) {
+        return false;
+    }
+
+    if (q->size > 0) {
+        const uint32_t first = min_u32(q->size, q->capacity - q->head);
+        memcpy(data, q->data + q->head, first);
+        memcpy(data + first, q->data, q->size - first);
+    }
+
+    free(q->data);
+    q->data = data;
+    q->capacity = capacity;
+    q->head = 0;
+    return true;
+}
+
+/** @brief Frame and encrypt a packet directly into the tail of the send queue.
+ *
+ * The caller must have reserved room for it. Does not increment the nonce.
+ */
+non_null()
+static bool send_queue_encrypt(TCP_Connection *con, const uint8_t *data, uint16_t length)
 {
-    while (p != nullptr) {
-        TCP_Priority_List *pp = p;
-        p = p->next;
-        free(pp->data);
-        free(pp);
+    TCP_Send_Queue *q = &con->send_queue;
+    const uint16_t packet_size = sizeof(uint16_t) + length + CRYPTO_MAC_SIZE;
+
+    if (q->size == 0) {
+        q->head = 0;
     }
+
+    const uint32_t tail = (q->head + q->size) & (q->capacity - 1);
+    const uint32_t contiguous = q->capacity - tail;
+    const uint16_t c_length = net_htons(length + CRYPTO_MAC_SIZE);
+
+    if (contiguous >= packet_size) {
+        memcpy(q->data + tail, &c_length, sizeof(uint16_t));
+
+        if (encrypt_data_symmetric(con->shared_key, con->sent_nonce, data, length,
+                                   q->data + tail + sizeof(uint16_t)) != length + CRYPTO_MAC_SIZE) {
+            return false;
+        }
+    } else {
+        /* The packet wraps around the end of the ring. */
+        VLA(uint8_t, packet, packet_size);
+        memcpy(packet, &c_length, sizeof(uint16_t));
+
+        if (encrypt_data_symmetric(con->shared_key, con->sent_nonce, data, length,
+                                   packet + sizeof(uint16_t)) != length + CRYPTO_MAC_SIZE) {
+            return false;
+        }
+
+        memcpy(q->data + tail, packet, contiguous);
+        memcpy(q->data, packet + contiguous, packet_size - contiguous);
+    }
+
+    q->size += packet_size;
+    ++q->packets;
+
+    if (q->size > q->max_size) {
+        q->max_size = q->size;
+    }
+
+    return true;
+}
+
+/** @brief Drop `sent` bytes from the head of the send queue, counting completed packets. */
+non_null()
+static void send_queue_consume(TCP_Send_Queue *q, uint32_t sent)
+{
+    const uint32_t mask = q->capacity - 1;
+
+    while (sent > 0) {
+        if (q->head_left == 0) {
+            const uint8_t length_buf[sizeof(uint16_t)] = {q->data[q->head], q->data[(q->head + 1) & mask]};
+            uint16_t length;
+            net_unpack_u16(length_buf, &length);
+            q->head_left = sizeof(uint16_t) + length;
+        }
+
+        const uint32_t n = min_u32(sent, q->head_left);
+        q->head = (q->head + n) & mask;
+        q->size -= n;
+        q->head_left -= n;
+        sent -= n;
+
+        if (q->head_left == 0) {
+            --q->packets;
+        }
+    }
+}
+
+/** @brief Write as much of the send queue as the socket takes, in one vectored send.
+ *
+ * @return number of bytes sent, or a value <= 0 if nothing was sent.
+ */
+non_null()
+static int send_queue_flush(const Logger *logger, TCP_Connection *con)
+{
+    TCP_Send_Queue *q = &con->send_queue;
+    const uint32_t first = min_u32(q->size, q->capacity - q->head);
+    const Net_Span spans[2] = {
+        {q->data + q->head, first},
+        {q->data, q->size - first},
+    };
+
+    const int len = net_sendv(con->ns, logger, con->sock, spans, first == q->size ? 1 : 2, &con->ip_port);
+
+    if (len <= 0) {
+        return len;
+    }
+
+    send_queue_consume(q, len);
+
+    if (q->size == 0 && q->capacity > TCP_SEND_QUEUE_MIN_CAPACITY) {
+        free(q->data);
+        q->data = nullptr;
+        q->capacity = 0;
+    }
+
+    return len;
 }
 
 /**
@@ -53,75 +219,18 @@ int send_pending_data_nonpriority(const Logger *logger, TCP_Connection *con)
  */
 int send_pending_data(const Logger *logger, TCP_Connection *con)
 {
-    /* finish sending current non-priority packet */
+    /* finish sending unencrypted handshake data */
     if (send_pending_data_nonpriority(logger, con) == -1) {
         return -1;
     }
 
-    TCP_Priority_List *p = con->priority_queue_start;
-
-    while (p != nullptr) {
-        const uint16_t left = p->size - p->sent;
-        const int len = net_send(con->ns, logger, con->sock, p->data + p->sent, left, &con->ip_port);
-
-        if (len != left) {
-            if (len > 0) {
-                p->sent += len;
-            }
-
-            break;
-        }
-
-        TCP_Priority_List *pp = p;
-        p = p->next;
-        free(pp->data);
-        free(pp);
-    }
-
-    con->priority_queue_start = p;
-
-    if (p == nullptr) {
-        con->priority_queue_end = nullptr;
+    if (con->send_queue.size == 0) {
         return 0;
     }
 
-    return -1;
-}
-
-/**
- * @retval false on failure (only if calloc fails)
- * @retval true on success
- */
-non_null()
-static bool add_priority(TCP_Connection *con, const uint8_t *packet, uint16_t size, uint16_t sent)
-{
-    TCP_Priority_List *p = con->priority_queue_end;
-    TCP_Priority_List *new_list = (TCP_Priority_List *)calloc(1, sizeof(TCP_Priority_List));
+    send_queue_flush(logger, con);
 
-    if (new_list == nullptr) {
-        return false;
-    }
-
-    new_list->next = nullptr;
-    new_list->size = size;
-    new_list->sent = sent;
-    new_list->data = (uint8_t *)malloc(size);
-
-    if (new_list->data == nullptr) {
-        free(new_list);
-        return false;
-    }
-
-    memcpy(new_list->data, packet, size);
-
-    if (p != nullptr) {
-        p->next = new_list;
-    } else {
-        con->priority_queue_start = new_list;
-    }
-
-    con->priority_queue_end = new_list;
-    return true;
+    return con->send_queue.size == 0 ? 0 : -1;
 }
 
 /**
@@ -136,57 +245,33 @@ int write_packet_TCP_secure_connection(const Logger *logger, TCP_Connection *con
         return -1;
     }
 
-    bool sendpriority = true;
+    const bool pending = send_pending_data(logger, con) == -1;
 
-    if (send_pending_data(logger, con) == -1) {
-        if (priority) {
-            sendpriority = false;
-        } else {
-            return 0;
-        }
+    if (pending && !priority) {
+        return 0;
     }
 
-    VLA(uint8_t, packet, sizeof(uint16_t) + length + CRYPTO_MAC_SIZE);
+    const uint16_t packet_size = sizeof(uint16_t) + length + CRYPTO_MAC_SIZE;
 
-    uint16_t c_length = net_htons(length + CRYPTO_MAC_SIZE);
-    memcpy(packet, &c_length, sizeof(uint16_t));
-    int len = encrypt_data_symmetric(con->shared_key, con->sent_nonce, data, length, packet + sizeof(uint16_t));
-
-    if ((unsigned int)len != (SIZEOF_VLA(packet) - sizeof(uint16_t))) {
-        return -1;
+    if (!send_queue_reserve(&con->send_queue, packet_size)) {
+        return 0;
     }
 
-    if (priority) {
-        len = sendpriority ? net_send(con->ns, logger, con->sock, packet, SIZEOF_VLA(packet), &con->ip_port) : 0;
-
-        if (len <= 0) {
-            len = 0;
-        }
-
-        increment_nonce(con->sent_nonce);
-
-        if ((unsigned int)len == SIZEOF_VLA(packet)) {
-            return 1;
-        }
-
-        return add_priority(con, packet, SIZEOF_VLA(packet), len) ? 1 : 0;
+    if (!send_queue_encrypt(con, data, length)) {
+        return -1;
     }
 
-    len = net_send(con->ns, logger, con->sock, packet, SIZEOF_VLA(packet), &con->ip_port);
-
-    if (len <= 0) {
+    /* Priority packets stay queued behind the pending data. Otherwise the
+     * queue was empty and the new packet is at its head. */
+    if (!pending && send_queue_flush(logger, con) <= 0 && !priority) {
+        /* Nothing of it went out: take it back so the caller can retry later
+         * with the same nonce. */
+        con->send_queue.size -= packet_size;
+        --con->send_queue.packets;
         return 0;
     }
 
     increment_nonce(con->sent_nonce);
-
-    if ((unsigned int)len == SIZEOF_VLA(packet)) {
-        return 1;
-    }
-
-    memcpy(con->last_packet, packet, SIZEOF_VLA(packet));
-    con->last_packet_length = SIZEOF_VLA(packet);
-    con->last_packet_sent = len;
     return 1;
 }
 
@@ -9,16 +9,9 @@
 #include "crypto_core.h"
 #include "network.h"
 
-typedef struct TCP_Priority_List TCP_Priority_List;
-struct TCP_Priority_List {
-    TCP_Priority_List *next;
-    uint16_t size;
-    uint16_t sent;
-    uint8_t *data;
-};
-
-nullable(1)
-void wipe_priority_list(TCP_Priority_List *p);
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define NUM_RESERVED_PORTS 16
 #define NUM_CLIENT_CONNECTIONS (256 - NUM_RESERVED_PORTS)
@@ -62,6 +55,24 @@ void wipe_priority_list(TCP_Priority_List *p);
 
 #define MAX_PACKET_SIZE 2048
 
+/** @brief Outbound queue of encrypted, length-prefixed packets.
+ *
+ * A byte ring whose capacity is a power of two. Packets are encrypted straight
+ * into the tail and written from the head with a vectored send over at most
+ * two contiguous spans.
+ */
+typedef struct TCP_Send_Queue {
+    uint8_t *data;
+    uint32_t capacity;
+    uint32_t head;
+    uint32_t size;
+
+    /** Unsent bytes of the packet at the head, or 0 if none of it was sent yet. */
+    uint16_t head_left;
+    uint32_t packets;
+    uint32_t max_size;
+} TCP_Send_Queue;
+
 typedef struct TCP_Connection {
     const Random *rng;
     const Network *ns;
@@ -73,10 +84,29 @@ typedef struct TCP_Connection {
     uint16_t last_packet_length;
     uint16_t last_packet_sent;
 
-    TCP_Priority_List *priority_queue_start;
-    TCP_Priority_List *priority_queue_end;
+    TCP_Send_Queue send_queue;
 } TCP_Connection;
 
+/** @brief Free the send queue of a connection, dropping any unsent packets. */
+non_null()
+void wipe_send_queue(TCP_Connection *con);
+
+/** @brief Number of packets waiting in the send queue, including a partially sent one. */
+non_null()
+uint32_t tcp_send_queue_packets(const TCP_Connection *con);
+
+/** @brief Number of bytes waiting in the send queue. */
+non_null()
+uint32_t tcp_send_queue_bytes(const TCP_Connection *con);
+
+/** @brief Largest number of bytes the send queue has held at once. */
+non_null()
+uint32_t tcp_send_queue_max_bytes(const TCP_Connection *con);
+
+/** @brief Whether anything is waiting for the socket to become writable. */
+non_null()
+bool tcp_has_pending_data(const TCP_Connection *con);
+
 /**
  * @retval 0 if pending data was sent completely
  * @retval -1 if it wasn't
@@ -121,4 +151,8 @@ int read_packet_TCP_secure_connection(
         const uint8_t *shared_key, uint8_t *recv_nonce, uint8_t *data,
         uint16_t max_len, const IP_Port *ip_port);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif
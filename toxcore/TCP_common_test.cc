@@ -0,0 +1,174 @@
+#include "TCP_common.h"
+
+#include <gtest/gtest.h>
+
+#include <sys/socket.h>
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "crypto_core.h"
+#include "logger.h"
+#include "util.h"
+
+namespace {
+
+constexpr uint16_t kPacketLength = 1000;
+
+/** Both ends of a non-blocking stream socket pair with matching crypto state. */
+class TcpPair : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        log_ = logger_new();
+        ASSERT_NE(log_, nullptr);
+
+        int fds[2];
+        ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+        sender_.sock.sock = fds[0];
+        receiver_.sock.sock = fds[1];
+
+        const Network *ns = system_network();
+        ASSERT_NE(ns, nullptr);
+        ASSERT_TRUE(set_socket_nonblock(ns, sender_.sock));
+        ASSERT_TRUE(set_socket_nonblock(ns, receiver_.sock));
+
+        // Keep the socket buffer small so the send queue fills up quickly.
+        const int sndbuf = 4096;
+        setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+        sender_.rng = system_random();
+        sender_.ns = ns;
+        random_bytes(sender_.rng, sender_.shared_key, sizeof(sender_.shared_key));
+        random_nonce(sender_.rng, sender_.sent_nonce);
+
+        std::memcpy(receiver_.shared_key, sender_.shared_key, sizeof(receiver_.shared_key));
+        std::memcpy(receiver_.recv_nonce, sender_.sent_nonce, sizeof(receiver_.recv_nonce));
+    }
+
+    void TearDown() override
+    {
+        wipe_send_queue(&sender_);
+        kill_sock(system_network(), sender_.sock);
+        kill_sock(system_network(), receiver_.sock);
+        logger_kill(log_);
+    }
+
+    static std::vector<uint8_t> numbered_packet(uint32_t num)
+    {
+        std::vector<uint8_t> packet(kPacketLength, static_cast<uint8_t>(num));
+        std::memcpy(packet.data(), &num, sizeof(num));
+        return packet;
+    }
+
+    /** Read and check every packet the receiving end has, flushing the sender in between. */
+    void receive_all(uint32_t expected_count)
+    {
+        std::array<uint8_t, MAX_PACKET_SIZE> data;
+
+        for (int i = 0; i < 100000 && received_ < expected_count; ++i) {
+            send_pending_data(log_, &sender_);
+
+            const int len = read_packet_TCP_secure_connection(log_, system_network(), receiver_.sock,
+                            &receiver_.next_packet_length, receiver_.shared_key, receiver_.recv_nonce,
+                            data.data(), data.size(), &sender_.ip_port);
+            ASSERT_NE(len, -1);
+
+            if (len == 0) {
+                continue;
+            }
+
+            ASSERT_EQ(len, kPacketLength);
+            EXPECT_EQ(std::vector<uint8_t>(data.begin(), data.begin() + len), numbered_packet(received_));
+            ++received_;
+        }
+
+        EXPECT_EQ(received_, expected_count);
+    }
+
+    struct Receiver {
+        Socket sock;
+        uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+        uint8_t recv_nonce[CRYPTO_NONCE_SIZE];
+        uint16_t next_packet_length = 0;
+    };
+
+    Logger *log_ = nullptr;
+    TCP_Connection sender_{};
+    Receiver receiver_{};
+    uint32_t received_ = 0;
+};
+
+TEST_F(TcpPair, PriorityPacketsAreQueuedAndDeliveredInOrder)
+{
+    constexpr uint32_t kCount = 200;
+
+    for (uint32_t i = 0; i < kCount; ++i) {
+        const std::vector<uint8_t> packet = numbered_packet(i);
+        ASSERT_EQ(write_packet_TCP_secure_connection(log_, &sender_, packet.data(), packet.size(), true), 1);
+    }
+
+    // The socket can't take all of it, so the rest waits in the queue.
+    EXPECT_GT(tcp_send_queue_packets(&sender_), 0);
+    EXPECT_GT(tcp_send_queue_bytes(&sender_), 0);
+    EXPECT_GE(tcp_send_queue_max_bytes(&sender_), tcp_send_queue_bytes(&sender_));
+
+    receive_all(kCount);
+
+    EXPECT_EQ(send_pending_data(log_, &sender_), 0);
+    EXPECT_EQ(tcp_send_queue_packets(&sender_), 0);
+    EXPECT_EQ(tcp_send_queue_bytes(&sender_), 0);
+}
+
+TEST_F(TcpPair, QueueWrapsAroundWhileDraining)
+{
+    constexpr uint32_t kCount = 2000;
+    uint32_t written = 0;
+
+    // Keep the queue non-empty while reading, so new packets land behind a
+    // moving head and wrap around the end of the ring.
+    while (written < kCount) {
+        for (uint32_t i = 0; i < 3 && written < kCount; ++i) {
+            const std::vector<uint8_t> packet = numbered_packet(written);
+            ASSERT_EQ(write_packet_TCP_secure_connection(log_, &sender_, packet.data(), packet.size(), true), 1);
+            ++written;
+        }
+
+        receive_all(min_u32(written, received_ + 2));
+    }
+
+    receive_all(kCount);
+    EXPECT_EQ(tcp_send_queue_bytes(&sender_), 0);
+}
+
+TEST_F(TcpPair, NonPriorityPacketsAreRefusedWhileDataIsPending)
+{
+    uint32_t sent = 0;
+
+    // Fill the socket until a packet can't go out.
+    while (tcp_send_queue_bytes(&sender_) == 0) {
+        const std::vector<uint8_t> packet = numbered_packet(sent);
+        const int ret = write_packet_TCP_secure_connection(log_, &sender_, packet.data(), packet.size(), false);
+        ASSERT_NE(ret, -1);
+
+        if (ret == 0) {
+            break;
+        }
+
+        ++sent;
+        ASSERT_LT(sent, 10000);
+    }
+
+    // With data pending, non-priority packets are refused without using up a
+    // nonce, and priority packets queue behind it.
+    const std::vector<uint8_t> packet = numbered_packet(sent);
+    EXPECT_EQ(write_packet_TCP_secure_connection(log_, &sender_, packet.data(), packet.size(), false), 0);
+    EXPECT_EQ(write_packet_TCP_secure_connection(log_, &sender_, packet.data(), packet.size(), true), 1);
+    ++sent;
+
+    receive_all(sent);
+    EXPECT_EQ(tcp_send_queue_bytes(&sender_), 0);
+}
+
+}  // namespace
@@ -1740,6 +1740,67 @@ void do_tcp_connections(const Logger *logger, TCP_Connections *tcp_c, void *user
     kill_nonused_tcp(tcp_c);
 }
 
+/** How often to retry sending data that a TCP socket didn't take, in ms. */
+#define TCP_PENDING_DATA_RUN_INTERVAL 10
+
+uint32_t tcp_connections_run_interval(const TCP_Connections *tcp_c)
+{
+    uint32_t interval = UINT32_MAX;
+
+    for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        const TCP_con *tcp_con = &tcp_c->tcp_connections[i];
+
+        if (tcp_con->status == TCP_CONN_NONE) {
+            continue;
+        }
+
+        if (tcp_con->status == TCP_CONN_SLEEPING) {
+            if (tcp_con->unsleep) {
+                return 0;
+            }
+
+            continue;
+        }
+
+        if (tcp_con->status == TCP_CONN_VALID && tcp_con_status(tcp_con->connection) == TCP_CLIENT_CONFIRMED) {
+            // The relay just accepted us, the routing requests for it are not sent yet.
+            // The next do_tcp_connections sends them and moves it to TCP_CONN_CONNECTED.
+            return 0;
+        }
+
+        if (tcp_con_has_pending_data(tcp_con->connection)) {
+            // Queued pings wait for the same socket.
+            interval = min_u32(interval, TCP_PENDING_DATA_RUN_INTERVAL);
+            continue;
+        }
+
+        interval = min_u32(interval, tcp_con_run_interval(tcp_con->connection, tcp_c->mono_time));
+    }
+
+    return interval;
+}
+
+uint32_t tcp_connections_get_sockets(const TCP_Connections *tcp_c, Socket *socks, uint32_t socks_size)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < tcp_c->tcp_connections_length; ++i) {
+        const TCP_con *tcp_con = &tcp_c->tcp_connections[i];
+
+        if (tcp_con->status == TCP_CONN_NONE || tcp_con->status == TCP_CONN_SLEEPING) {
+            continue;
+        }
+
+        if (count < socks_size) {
+            socks[count] = tcp_con_sock(tcp_con->connection);
+        }
+
+        ++count;
+    }
+
+    return count;
+}
+
 void kill_tcp_connections(TCP_Connections *tcp_c)
 {
     if (tcp_c == nullptr) {
@@ -308,6 +308,25 @@ int kill_tcp_relay_connection(TCP_Connections *tcp_c, int tcp_connections_number
 non_null(1, 2) nullable(3)
 void do_tcp_connections(const Logger *logger, TCP_Connections *tcp_c, void *userdata);
 
+/** @brief Time in ms until do_tcp_connections has work that incoming data won't trigger.
+ *
+ * That is unsent data, a sleeping connection to wake up, or the ping and
+ * timeout deadlines of the relay connections.
+ *
+ * @return UINT32_MAX if there is no such work.
+ */
+non_null()
+uint32_t tcp_connections_run_interval(const TCP_Connections *tcp_c);
+
+/** @brief Get the sockets of all TCP relay connections.
+ *
+ * Writes up to `socks_size` sockets to `socks`.
+ *
+ * @return the number of sockets, which may be more than `socks_size`.
+ */
+non_null(1) nullable(2)
+uint32_t tcp_connections_get_sockets(const TCP_Connections *tcp_c, Socket *socks, uint32_t socks_size);
+
 nullable(1)
 void kill_tcp_connections(TCP_Connections *tcp_c);
 
@@ -6,6 +6,10 @@
 /**
  * Implementation of the TCP relay server part of Tox.
  */
+#ifndef _XOPEN_SOURCE
+#define _XOPEN_SOURCE 600
+#endif
+
 #include "TCP_server.h"
 
 #include <stdlib.h>
@@ -19,6 +23,15 @@
 #include <unistd.h>
 #endif
 
+/* Sharded mode needs pthreads, SO_REUSEPORT and the GCC atomic builtins. */
+#if defined(__GNUC__) && !defined(_WIN32) && !defined(__WIN32__) && !defined(WIN32)
+#define TCP_SERVER_USE_THREADS
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 #include "TCP_common.h"
 #include "ccompat.h"
 #include "list.h"
@@ -32,6 +45,24 @@
 #define TCP_SOCKET_CONFIRMED 3
 #endif
 
+/**
+ * Connections are identified across shards by a global id: the shard number
+ * in the top bits and the index into that shard's accepted connection array
+ * in the low 24 bits (the same 24 bits the epoll event data has room for).
+ * Without shards the global id is the plain array index.
+ */
+#define TCP_SHARD_INDEX_BITS 24
+#define TCP_SHARD_INDEX_MASK ((1U << TCP_SHARD_INDEX_BITS) - 1)
+
+/**
+ * Messages waiting in the inbox of a shard or the main thread beyond which
+ * packets forwarded to it are dropped, so a busy shard can't make another
+ * one buffer without limit. Messages that keep routes consistent are only
+ * dropped at twice that.
+ */
+#define TCP_SHARD_QUEUE_MAX_PACKETS 8192
+#define TCP_SHARD_QUEUE_MAX_MESSAGES (2 * TCP_SHARD_QUEUE_MAX_PACKETS)
+
 typedef struct TCP_Secure_Conn {
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint32_t index;
@@ -55,6 +86,54 @@ typedef struct TCP_Secure_Connection {
     uint64_t ping_id;
 } TCP_Secure_Connection;
 
+typedef enum TCP_Shard_Msg_Type {
+    /* Routed data packet for a paired connection slot of the target. */
+    TCP_SHARD_MSG_DATA,
+    /* Out of band packet for the target. */
+    TCP_SHARD_MSG_OOB,
+    /* Onion or forwarding response, matched by connection identifier. */
+    TCP_SHARD_MSG_REPLY,
+    /* The sender wants a route to the target. */
+    TCP_SHARD_MSG_PAIR,
+    /* The target of an earlier PAIR message linked its slot to the sender. */
+    TCP_SHARD_MSG_PAIRED,
+    /* The sender dropped its end of a route to the target. */
+    TCP_SHARD_MSG_UNLINK,
+    /* A newer connection with the target's public key was accepted. */
+    TCP_SHARD_MSG_KILL,
+    /* Onion request to be sent by the thread that owns the onion. */
+    TCP_SHARD_MSG_ONION_REQUEST,
+    /* Forward request to be sent by the thread that owns the forwarding. */
+    TCP_SHARD_MSG_FORWARD_REQUEST,
+} TCP_Shard_Msg_Type;
+
+/** A message passed between shards, or from a shard to the main thread. */
+typedef struct TCP_Shard_Msg TCP_Shard_Msg;
+struct TCP_Shard_Msg {
+    TCP_Shard_Msg *next;
+
+    TCP_Shard_Msg_Type type;
+    uint32_t target;
+    uint8_t target_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t target_slot;
+    uint32_t sender;
+    uint8_t sender_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t sender_slot;
+    uint64_t identifier;
+
+    uint8_t *data;
+    uint16_t length;
+};
+
+/** Intrusive multi-producer single-consumer queue of shard messages. */
+typedef struct TCP_Shard_Queue {
+    TCP_Shard_Msg *head;
+    TCP_Shard_Msg *tail;
+    TCP_Shard_Msg stub;
+    /* Messages pushed and not yet handled by the owner. */
+    uint32_t size;
+} TCP_Shard_Queue;
+
 
 struct TCP_Server {
     const Logger *logger;
@@ -83,7 +162,31 @@ struct TCP_Server {
 
     uint64_t counter;
 
-    BS_List accepted_key_list;
+    /* The server holding the accepted key list. Points to itself unless this is a shard. */
+    TCP_Server *root;
+    uint32_t shard_id;
+    /* Messages for this shard, or for the main thread if this is the root. */
+    TCP_Shard_Queue inbox;
+
+    Hash_List accepted_key_list;
+
+#ifdef TCP_SERVER_USE_THREADS
+    /* Sharded mode only. The root owns the shards, their threads and the key list lock. */
+    TCP_Server **shards;
+    pthread_t *threads;
+    uint16_t num_shards;
+    pthread_mutex_t *key_list_lock;
+    int stop;
+    /* Each shard keeps its own clock, updated by its worker thread. */
+    Mono_Time *mono_time;
+    /* Shards only. While `waiting` is set the worker is blocked in poll(), and
+     * posting a message wakes it with a byte on `wake_pipe`. */
+    int wake_pipe[2];
+    int waiting;
+    struct pollfd *wait_fds;
+    Socket *wait_socks;
+    uint32_t wait_fds_size;
+#endif
 };
 
 const uint8_t *tcp_server_public_key(const TCP_Server *tcp_server)
@@ -93,9 +196,239 @@ const uint8_t *tcp_server_public_key(const TCP_Server *tcp_server)
 
 size_t tcp_server_listen_count(const TCP_Server *tcp_server)
 {
+#ifdef TCP_SERVER_USE_THREADS
+
+    if (tcp_server->num_shards != 0) {
+        return tcp_server->shards[0]->num_listening_socks;
+    }
+
+#endif
     return tcp_server->num_listening_socks;
 }
 
+/** @brief Global id of the accepted connection at `index` in this shard. */
+non_null()
+static uint32_t tcp_shard_gid(const TCP_Server *tcp_server, uint32_t index)
+{
+    return (tcp_server->shard_id << TCP_SHARD_INDEX_BITS) | index;
+}
+
+/** @brief Whether the connection with this global id lives in this shard. */
+non_null()
+static bool tcp_shard_is_local(const TCP_Server *tcp_server, uint32_t gid)
+{
+    return (gid >> TCP_SHARD_INDEX_BITS) == tcp_server->shard_id;
+}
+
+non_null()
+static bool tcp_server_is_sharded(const TCP_Server *tcp_server)
+{
+#ifdef TCP_SERVER_USE_THREADS
+    return tcp_server->num_shards != 0;
+#else
+    return false;
+#endif
+}
+
+non_null()
+static void tcp_shard_queue_init(TCP_Shard_Queue *queue)
+{
+    queue->stub.next = nullptr;
+    queue->head = &queue->stub;
+    queue->tail = &queue->stub;
+    queue->size = 0;
+}
+
+#ifdef TCP_SERVER_USE_THREADS
+/** @brief Push a message. Safe to call from any thread. */
+non_null()
+static void tcp_shard_queue_push(TCP_Shard_Queue *queue, TCP_Shard_Msg *msg)
+{
+    __atomic_store_n(&msg->next, nullptr, __ATOMIC_RELAXED);
+    TCP_Shard_Msg *prev = __atomic_exchange_n(&queue->head, msg, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&prev->next, msg, __ATOMIC_RELEASE);
+}
+
+/** @brief Pop a message. Must only be called by the queue's owner.
+ *
+ * @return nullptr if the queue is empty or a push is still in progress.
+ */
+non_null()
+static TCP_Shard_Msg *tcp_shard_queue_pop(TCP_Shard_Queue *queue)
+{
+    TCP_Shard_Msg *tail = queue->tail;
+    TCP_Shard_Msg *next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (tail == &queue->stub) {
+        if (next == nullptr) {
+            return nullptr;
+        }
+
+        queue->tail = next;
+        tail = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if (next != nullptr) {
+        queue->tail = next;
+        return tail;
+    }
+
+    if (tail != __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE)) {
+        return nullptr;
+    }
+
+    // Put the stub back so the last message can be taken off the queue.
+    tcp_shard_queue_push(queue, &queue->stub);
+    next = __atomic_load_n(&tail->next, __ATOMIC_ACQUIRE);
+
+    if (next != nullptr) {
+        queue->tail = next;
+        return tail;
+    }
+
+    return nullptr;
+}
+
+/** @brief Whether the queue has no messages. Must only be called by the queue's owner. */
+non_null()
+static bool tcp_shard_queue_is_empty(const TCP_Shard_Queue *queue)
+{
+    // A push moves the head away from the stub before anything else.
+    return queue->tail == &queue->stub && __atomic_load_n(&queue->head, __ATOMIC_RELAXED) == &queue->stub;
+}
+
+/** @brief Wake the worker of a shard if it is waiting. Safe to call from any thread.
+ *
+ * The main thread has no wake pipe, it handles its messages on its next iteration.
+ */
+non_null()
+static void tcp_shard_wake(TCP_Server *shard)
+{
+    if (shard->wake_pipe[1] == -1) {
+        return;
+    }
+
+    // Pairs with the fence in `tcp_shard_wait`: either we see `waiting` or it sees our message.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (__atomic_exchange_n(&shard->waiting, 0, __ATOMIC_RELAXED) != 0) {
+        const uint8_t byte = 0;
+
+        if (write(shard->wake_pipe[1], &byte, sizeof(byte)) != sizeof(byte)) {
+            // The pipe is full, so the worker wakes up anyway.
+        }
+    }
+}
+
+/** @brief Free all queued messages. Only safe once no thread can push any more. */
+non_null()
+static void tcp_shard_queue_clear(TCP_Shard_Queue *queue)
+{
+    TCP_Shard_Msg *msg;
+
+    while ((msg = tcp_shard_queue_pop(queue)) != nullptr) {
+        free(msg);
+    }
+}
+#endif /* TCP_SERVER_USE_THREADS */
+
+/** @brief Allocate a shard message with a copy of `data`.
+ *
+ * The caller fills in any sender fields before posting it.
+ */
+nullable(2, 3)
+static TCP_Shard_Msg *tcp_shard_msg_new(TCP_Shard_Msg_Type type, const uint8_t *target_key, const uint8_t *data,
+                                        uint16_t length, uint32_t target)
+{
+    TCP_Shard_Msg *msg = (TCP_Shard_Msg *)calloc(1, sizeof(TCP_Shard_Msg) + length);
+
+    if (msg == nullptr) {
+        return nullptr;
+    }
+
+    msg->type = type;
+    msg->target = target;
+
+    if (target_key != nullptr) {
+        memcpy(msg->target_key, target_key, CRYPTO_PUBLIC_KEY_SIZE);
+    }
+
+    msg->data = (uint8_t *)(msg + 1);
+    msg->length = length;
+
+    if (length != 0) {
+        memcpy(msg->data, data, length);
+    }
+
+    return msg;
+}
+
+/** @brief Hand a message to the shard owning its target, or to the main thread
+ * for onion and forward requests. Takes ownership of `msg`.
+ */
+non_null()
+static void tcp_shard_post(const TCP_Server *tcp_server, TCP_Shard_Msg *msg)
+{
+#ifdef TCP_SERVER_USE_THREADS
+    TCP_Server *const root = tcp_server->root;
+    TCP_Server *dest = root;
+
+    if (msg->type != TCP_SHARD_MSG_ONION_REQUEST && msg->type != TCP_SHARD_MSG_FORWARD_REQUEST) {
+        const uint32_t shard = msg->target >> TCP_SHARD_INDEX_BITS;
+
+        if (shard >= root->num_shards) {
+            free(msg);
+            return;
+        }
+
+        dest = root->shards[shard];
+    }
+
+    const bool is_packet = msg->type == TCP_SHARD_MSG_DATA || msg->type == TCP_SHARD_MSG_OOB
+                           || msg->type == TCP_SHARD_MSG_REPLY || msg->type == TCP_SHARD_MSG_ONION_REQUEST
+                           || msg->type == TCP_SHARD_MSG_FORWARD_REQUEST;
+    const uint32_t limit = is_packet ? TCP_SHARD_QUEUE_MAX_PACKETS : TCP_SHARD_QUEUE_MAX_MESSAGES;
+
+    if (__atomic_add_fetch(&dest->inbox.size, 1, __ATOMIC_RELAXED) > limit) {
+        // The receiver is behind; drop it like a full socket buffer would.
+        __atomic_sub_fetch(&dest->inbox.size, 1, __ATOMIC_RELAXED);
+        free(msg);
+        return;
+    }
+
+    tcp_shard_queue_push(&dest->inbox, msg);
+    tcp_shard_wake(dest);
+#else
+    // Without threads every connection is local and nothing is ever posted.
+    free(msg);
+#endif
+}
+
+non_null()
+static void key_list_lock(const TCP_Server *root)
+{
+#ifdef TCP_SERVER_USE_THREADS
+
+    if (root->key_list_lock != nullptr) {
+        pthread_mutex_lock(root->key_list_lock);
+    }
+
+#endif
+}
+
+non_null()
+static void key_list_unlock(const TCP_Server *root)
+{
+#ifdef TCP_SERVER_USE_THREADS
+
+    if (root->key_list_lock != nullptr) {
+        pthread_mutex_unlock(root->key_list_lock);
+    }
+
+#endif
+}
+
 /** This is needed to compile on Android below API 21 */
 #ifdef TCP_SERVER_USE_EPOLL
 #ifndef EPOLLRDHUP
@@ -113,7 +446,7 @@ static int alloc_new_connections(TCP_Server *tcp_server, uint32_t num)
 {
     const uint32_t new_size = tcp_server->size_accepted_connections + num;
 
-    if (new_size < tcp_server->size_accepted_connections) {
+    if (new_size < tcp_server->size_accepted_connections || new_size > TCP_SHARD_INDEX_MASK + 1) {
         return -1;
     }
 
@@ -138,7 +471,7 @@ non_null()
 static void wipe_secure_connection(TCP_Secure_Connection *con)
 {
     if (con->status != 0) {
-        wipe_priority_list(con->con.priority_queue_start);
+        wipe_send_queue(&con->con);
         crypto_memzero(con, sizeof(TCP_Secure_Connection));
     }
 }
@@ -167,13 +500,62 @@ static void free_accepted_connection_array(TCP_Server *tcp_server)
 }
 
 /**
- * @return index corresponding to connection with peer on success
+ * @return global id of the connection with peer on success
  * @retval -1 on failure.
  */
 non_null()
 static int get_TCP_connection_index(const TCP_Server *tcp_server, const uint8_t *public_key)
 {
-    return bs_list_find(&tcp_server->accepted_key_list, public_key);
+    const TCP_Server *const root = tcp_server->root;
+    key_list_lock(root);
+    const int gid = hash_list_find(&root->accepted_key_list, public_key);
+    key_list_unlock(root);
+    return gid;
+}
+
+/** @brief Map a public key to a connection, replacing any existing mapping.
+ *
+ * On failure the existing mapping is kept.
+ *
+ * @param old_gid set to the global id the new mapping replaced, or -1.
+ *
+ * @retval true on success.
+ */
+non_null()
+static bool set_TCP_connection_index(const TCP_Server *tcp_server, const uint8_t *public_key, int gid, int *old_gid)
+{
+    TCP_Server *const root = tcp_server->root;
+    key_list_lock(root);
+    *old_gid = hash_list_find(&root->accepted_key_list, public_key);
+
+    if (*old_gid != -1) {
+        hash_list_remove(&root->accepted_key_list, public_key, *old_gid);
+    }
+
+    const bool ok = hash_list_add(&root->accepted_key_list, public_key, gid);
+
+    if (!ok && *old_gid != -1) {
+        // The table just had room for the old entry, so it fits again.
+        hash_list_add(&root->accepted_key_list, public_key, *old_gid);
+        *old_gid = -1;
+    }
+
+    key_list_unlock(root);
+    return ok;
+}
+
+/** @brief Remove the key mapping, unless it already points at a newer connection. */
+non_null()
+static void rm_TCP_connection_index(const TCP_Server *tcp_server, const uint8_t *public_key, int gid)
+{
+    TCP_Server *const root = tcp_server->root;
+    key_list_lock(root);
+
+    if (hash_list_find(&root->accepted_key_list, public_key) == gid) {
+        hash_list_remove(&root->accepted_key_list, public_key, gid);
+    }
+
+    key_list_unlock(root);
 }
 
 
@@ -188,12 +570,7 @@ static int kill_accepted(TCP_Server *tcp_server, int index);
 non_null()
 static int add_accepted(TCP_Server *tcp_server, const Mono_Time *mono_time, TCP_Secure_Connection *con)
 {
-    int index = get_TCP_connection_index(tcp_server, con->public_key);
-
-    if (index != -1) { /* If an old connection to the same public key exists, kill it. */
-        kill_accepted(tcp_server, index);
-        index = -1;
-    }
+    int index = -1;
 
     if (tcp_server->size_accepted_connections == tcp_server->num_accepted_connections) {
         if (alloc_new_connections(tcp_server, 4) == -1) {
@@ -215,19 +592,36 @@ static int add_accepted(TCP_Server *tcp_server, const Mono_Time *mono_time, TCP_
         return -1;
     }
 
-    if (!bs_list_add(&tcp_server->accepted_key_list, con->public_key, index)) {
-        return -1;
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    memcpy(public_key, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    int old_gid;
+    const bool added = set_TCP_connection_index(tcp_server, public_key, tcp_shard_gid(tcp_server, index), &old_gid);
+
+    if (added) {
+        move_secure_connection(&tcp_server->accepted_connection_array[index], con);
+
+        tcp_server->accepted_connection_array[index].status = TCP_STATUS_CONFIRMED;
+        ++tcp_server->num_accepted_connections;
+        tcp_server->accepted_connection_array[index].identifier = ++tcp_server->counter;
+        tcp_server->accepted_connection_array[index].last_pinged = mono_time_get(mono_time);
+        tcp_server->accepted_connection_array[index].ping_id = 0;
     }
 
-    move_secure_connection(&tcp_server->accepted_connection_array[index], con);
+    /* If an old connection to the same public key exists, kill it once the new one replaced it. */
+    if (added && old_gid != -1) {
+        if (tcp_shard_is_local(tcp_server, old_gid)) {
+            kill_accepted(tcp_server, old_gid & TCP_SHARD_INDEX_MASK);
+        } else {
+            TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_KILL, public_key, nullptr, 0, old_gid);
 
-    tcp_server->accepted_connection_array[index].status = TCP_STATUS_CONFIRMED;
-    ++tcp_server->num_accepted_connections;
-    tcp_server->accepted_connection_array[index].identifier = ++tcp_server->counter;
-    tcp_server->accepted_connection_array[index].last_pinged = mono_time_get(mono_time);
-    tcp_server->accepted_connection_array[index].ping_id = 0;
+            if (msg != nullptr) {
+                tcp_shard_post(tcp_server, msg);
+            }
+        }
+    }
 
-    return index;
+    return added ? index : -1;
 }
 
 /** @brief Delete accepted connection from list.
@@ -246,9 +640,8 @@ static int del_accepted(TCP_Server *tcp_server, int index)
         return -1;
     }
 
-    if (!bs_list_remove(&tcp_server->accepted_key_list, tcp_server->accepted_connection_array[index].public_key, index)) {
-        return -1;
-    }
+    rm_TCP_connection_index(tcp_server, tcp_server->accepted_connection_array[index].public_key,
+                            tcp_shard_gid(tcp_server, index));
 
     wipe_secure_connection(&tcp_server->accepted_connection_array[index]);
     --tcp_server->num_accepted_connections;
@@ -269,7 +662,7 @@ static void kill_TCP_secure_connection(TCP_Secure_Connection *con)
 }
 
 non_null()
-static int rm_connection_index(TCP_Server *tcp_server, TCP_Secure_Connection *con, uint8_t con_number);
+static int rm_connection_index(TCP_Server *tcp_server, uint32_t con_id, uint8_t con_number);
 
 /** @brief Kill an accepted TCP_Secure_Connection
  *
@@ -283,7 +676,7 @@ static int kill_accepted(TCP_Server *tcp_server, int index)
     }
 
     for (uint32_t i = 0; i < NUM_CLIENT_CONNECTIONS; ++i) {
-        rm_connection_index(tcp_server, &tcp_server->accepted_connection_array[index], i);
+        rm_connection_index(tcp_server, index, i);
     }
 
     const Socket sock = tcp_server->accepted_connection_array[index].con.sock;
@@ -473,9 +866,24 @@ static int handle_TCP_routing_req(TCP_Server *tcp_server, uint32_t con_id, const
 
     con->connections[index].status = 1;
     memcpy(con->connections[index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    const int other_index = get_TCP_connection_index(tcp_server, public_key);
+    const int other_gid = get_TCP_connection_index(tcp_server, public_key);
+
+    if (other_gid != -1 && !tcp_shard_is_local(tcp_server, other_gid)) {
+        /* The other end lives on another shard, let its owner do the pairing. */
+        TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_PAIR, public_key, nullptr, 0, other_gid);
+
+        if (msg != nullptr) {
+            msg->sender = tcp_shard_gid(tcp_server, con_id);
+            memcpy(msg->sender_key, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+            msg->sender_slot = index;
+            tcp_shard_post(tcp_server, msg);
+        }
 
-    if (other_index != -1) {
+        return 0;
+    }
+
+    if (other_gid != -1) {
+        const uint32_t other_index = other_gid & TCP_SHARD_INDEX_MASK;
         uint32_t other_id = -1;
         TCP_Secure_Connection *other_conn = &tcp_server->accepted_connection_array[other_index];
 
@@ -489,10 +897,10 @@ static int handle_TCP_routing_req(TCP_Server *tcp_server, uint32_t con_id, const
 
         if (other_id != (uint32_t) -1) {
             con->connections[index].status = 2;
-            con->connections[index].index = other_index;
+            con->connections[index].index = other_gid;
             con->connections[index].other_id = other_id;
             other_conn->connections[other_id].status = 2;
-            other_conn->connections[other_id].index = con_id;
+            other_conn->connections[other_id].index = tcp_shard_gid(tcp_server, con_id);
             other_conn->connections[other_id].other_id = index;
             // TODO(irungentoo): return values?
             send_connect_notification(tcp_server->logger, con, index);
@@ -517,15 +925,28 @@ static int handle_TCP_oob_send(TCP_Server *tcp_server, uint32_t con_id, const ui
 
     const TCP_Secure_Connection *con = &tcp_server->accepted_connection_array[con_id];
 
-    const int other_index = get_TCP_connection_index(tcp_server, public_key);
+    const int other_gid = get_TCP_connection_index(tcp_server, public_key);
+
+    if (other_gid == -1) {
+        return 0;
+    }
 
-    if (other_index != -1) {
-        VLA(uint8_t, resp_packet, 1 + CRYPTO_PUBLIC_KEY_SIZE + length);
-        resp_packet[0] = TCP_PACKET_OOB_RECV;
-        memcpy(resp_packet + 1, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
-        memcpy(resp_packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, data, length);
-        write_packet_TCP_secure_connection(tcp_server->logger, &tcp_server->accepted_connection_array[other_index].con,
+    VLA(uint8_t, resp_packet, 1 + CRYPTO_PUBLIC_KEY_SIZE + length);
+    resp_packet[0] = TCP_PACKET_OOB_RECV;
+    memcpy(resp_packet + 1, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(resp_packet + 1 + CRYPTO_PUBLIC_KEY_SIZE, data, length);
+
+    if (tcp_shard_is_local(tcp_server, other_gid)) {
+        write_packet_TCP_secure_connection(tcp_server->logger,
+                                           &tcp_server->accepted_connection_array[other_gid & TCP_SHARD_INDEX_MASK].con,
                                            resp_packet, SIZEOF_VLA(resp_packet), false);
+    } else {
+        TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_OOB, public_key, resp_packet, SIZEOF_VLA(resp_packet),
+                                               other_gid);
+
+        if (msg != nullptr) {
+            tcp_shard_post(tcp_server, msg);
+        }
     }
 
     return 0;
@@ -536,15 +957,27 @@ static int handle_TCP_oob_send(TCP_Server *tcp_server, uint32_t con_id, const ui
  * return -1 on failure.
  * return 0 on success.
  */
-static int rm_connection_index(TCP_Server *tcp_server, TCP_Secure_Connection *con, uint8_t con_number)
+static int rm_connection_index(TCP_Server *tcp_server, uint32_t con_id, uint8_t con_number)
 {
     if (con_number >= NUM_CLIENT_CONNECTIONS) {
         return -1;
     }
 
+    TCP_Secure_Connection *const con = &tcp_server->accepted_connection_array[con_id];
+
     if (con->connections[con_number].status != 0) {
-        if (con->connections[con_number].status == 2) {
-            const uint32_t index = con->connections[con_number].index;
+        if (con->connections[con_number].status == 2 && !tcp_shard_is_local(tcp_server, con->connections[con_number].index)) {
+            TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_UNLINK, con->connections[con_number].public_key, nullptr, 0,
+                                                   con->connections[con_number].index);
+
+            if (msg != nullptr) {
+                msg->target_slot = con->connections[con_number].other_id;
+                msg->sender = tcp_shard_gid(tcp_server, con_id);
+                memcpy(msg->sender_key, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+                tcp_shard_post(tcp_server, msg);
+            }
+        } else if (con->connections[con_number].status == 2) {
+            const uint32_t index = con->connections[con_number].index & TCP_SHARD_INDEX_MASK;
             const uint8_t other_id = con->connections[con_number].other_id;
 
             if (index >= tcp_server->size_accepted_connections) {
@@ -596,10 +1029,43 @@ static bool ip_port_to_con_id(const TCP_Server *tcp_server, const IP_Port *ip_po
            tcp_server->accepted_connection_array[*con_id].identifier == ip_port->ip.ip.v6.uint64[1];
 }
 
+/** @brief Pass an onion or forwarding response to the shard owning the connection.
+ *
+ * @retval true if the connection is valid and the message was posted.
+ */
+non_null()
+static bool tcp_shard_post_reply(const TCP_Server *tcp_server, uint32_t gid, uint64_t identifier,
+                                 const uint8_t *data, uint16_t length)
+{
+    TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_REPLY, nullptr, data, length, gid);
+
+    if (msg == nullptr) {
+        return false;
+    }
+
+    msg->identifier = identifier;
+    tcp_shard_post(tcp_server, msg);
+    return true;
+}
+
 non_null()
 static int handle_onion_recv_1(void *object, const IP_Port *dest, const uint8_t *data, uint16_t length)
 {
     TCP_Server *tcp_server = (TCP_Server *)object;
+
+    if (tcp_server_is_sharded(tcp_server)) {
+        if (!net_family_is_tcp_client(dest->ip.family)) {
+            return 1;
+        }
+
+        VLA(uint8_t, packet, 1 + length);
+        memcpy(packet + 1, data, length);
+        packet[0] = TCP_PACKET_ONION_RESPONSE;
+
+        return tcp_shard_post_reply(tcp_server, dest->ip.ip.v6.uint32[0], dest->ip.ip.v6.uint64[1],
+                                    packet, SIZEOF_VLA(packet)) ? 0 : 1;
+    }
+
     uint32_t index;
 
     if (!ip_port_to_con_id(tcp_server, dest, &index)) {
@@ -638,6 +1104,14 @@ static bool handle_forward_reply_tcp(void *object, const uint8_t *sendback_data,
     net_unpack_u32(sendback_data + 1, &con_id);
     net_unpack_u64(sendback_data + 1 + sizeof(uint32_t), &identifier);
 
+    VLA(uint8_t, packet, 1 + length);
+    memcpy(packet + 1, data, length);
+    packet[0] = TCP_PACKET_FORWARDING;
+
+    if (tcp_server_is_sharded(tcp_server)) {
+        return tcp_shard_post_reply(tcp_server, con_id, identifier, packet, SIZEOF_VLA(packet));
+    }
+
     if (con_id >= tcp_server->size_accepted_connections) {
         return false;
     }
@@ -648,13 +1122,51 @@ static bool handle_forward_reply_tcp(void *object, const uint8_t *sendback_data,
         return false;
     }
 
-    VLA(uint8_t, packet, 1 + length);
-    memcpy(packet + 1, data, length);
-    packet[0] = TCP_PACKET_FORWARDING;
-
     return write_packet_TCP_secure_connection(tcp_server->logger, &con->con, packet, SIZEOF_VLA(packet), false) == 1;
 }
 
+/** @brief Send a forward request on behalf of a connection.
+ *
+ * @retval 0 on success.
+ * @retval -1 if the request is malformed.
+ */
+non_null()
+static int send_TCP_forward_request(Forwarding *forwarding, uint32_t con_id, uint64_t identifier,
+                                    const uint8_t *data, uint16_t length)
+{
+    const uint16_t sendback_data_len = 1 + sizeof(uint32_t) + sizeof(uint64_t);
+    uint8_t sendback_data[1 + sizeof(uint32_t) + sizeof(uint64_t)];
+    sendback_data[0] = SENDBACK_TCP;
+    net_pack_u32(sendback_data + 1, con_id);
+    net_pack_u64(sendback_data + 1 + sizeof(uint32_t), identifier);
+
+    IP_Port dest;
+    const int ipport_length = unpack_ip_port(&dest, data, length, false);
+
+    if (ipport_length == -1) {
+        return -1;
+    }
+
+    const uint8_t *const forward_data = data + ipport_length;
+    const uint16_t forward_data_len = length - ipport_length;
+
+    if (forward_data_len > MAX_FORWARD_DATA_SIZE) {
+        return -1;
+    }
+
+    send_forwarding(forwarding, &dest, sendback_data, sendback_data_len, forward_data, forward_data_len);
+    return 0;
+}
+
+/** @brief Check a forward request before handing it to the main thread. */
+non_null()
+static bool forward_request_valid(const uint8_t *data, uint16_t length)
+{
+    IP_Port dest;
+    const int ipport_length = unpack_ip_port(&dest, data, length, false);
+    return ipport_length != -1 && length - ipport_length <= MAX_FORWARD_DATA_SIZE;
+}
+
 /**
  * @retval 0 on success
  * @retval -1 on failure
@@ -693,7 +1205,7 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
             }
 
             LOGGER_TRACE(tcp_server->logger, "handling disconnect notification for %d", con_id);
-            return rm_connection_index(tcp_server, con, data[1] - NUM_RESERVED_PORTS);
+            return rm_connection_index(tcp_server, con_id, data[1] - NUM_RESERVED_PORTS);
         }
 
         case TCP_PACKET_PING: {
@@ -750,6 +1262,19 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
                     return -1;
                 }
 
+                if (tcp_server->root != tcp_server) {
+                    /* The onion belongs to the main thread. */
+                    TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_ONION_REQUEST, nullptr, data + 1, length - 1, 0);
+
+                    if (msg != nullptr) {
+                        msg->sender = tcp_shard_gid(tcp_server, con_id);
+                        msg->identifier = con->identifier;
+                        tcp_shard_post(tcp_server, msg);
+                    }
+
+                    return 0;
+                }
+
                 IP_Port source = con_id_to_ip_port(con_id, con->identifier);
                 onion_send_1(tcp_server->onion, data + 1 + CRYPTO_NONCE_SIZE, length - (1 + CRYPTO_NONCE_SIZE), &source,
                              data + 1);
@@ -768,28 +1293,24 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
                 return -1;
             }
 
-            const uint16_t sendback_data_len = 1 + sizeof(uint32_t) + sizeof(uint64_t);
-            uint8_t sendback_data[1 + sizeof(uint32_t) + sizeof(uint64_t)];
-            sendback_data[0] = SENDBACK_TCP;
-            net_pack_u32(sendback_data + 1, con_id);
-            net_pack_u64(sendback_data + 1 + sizeof(uint32_t), con->identifier);
-
-            IP_Port dest;
-            const int ipport_length = unpack_ip_port(&dest, data + 1, length - 1, false);
+            if (tcp_server->root != tcp_server) {
+                /* The forwarding belongs to the main thread. */
+                if (!forward_request_valid(data + 1, length - 1)) {
+                    return -1;
+                }
 
-            if (ipport_length == -1) {
-                return -1;
-            }
+                TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_FORWARD_REQUEST, nullptr, data + 1, length - 1, 0);
 
-            const uint8_t *const forward_data = data + (1 + ipport_length);
-            const uint16_t forward_data_len = length - (1 + ipport_length);
+                if (msg != nullptr) {
+                    msg->sender = tcp_shard_gid(tcp_server, con_id);
+                    msg->identifier = con->identifier;
+                    tcp_shard_post(tcp_server, msg);
+                }
 
-            if (forward_data_len > MAX_FORWARD_DATA_SIZE) {
-                return -1;
+                return 0;
             }
 
-            send_forwarding(tcp_server->forwarding, &dest, sendback_data, sendback_data_len, forward_data, forward_data_len);
-            return 0;
+            return send_TCP_forward_request(tcp_server->forwarding, con_id, con->identifier, data + 1, length - 1);
         }
 
         case TCP_PACKET_FORWARDING: {
@@ -816,13 +1337,27 @@ static int handle_TCP_packet(TCP_Server *tcp_server, uint32_t con_id, const uint
                 return 0;
             }
 
-            const uint32_t index = con->connections[c_id].index;
+            const uint32_t gid = con->connections[c_id].index;
             const uint8_t other_c_id = con->connections[c_id].other_id + NUM_RESERVED_PORTS;
             VLA(uint8_t, new_data, length);
             memcpy(new_data, data, length);
             new_data[0] = other_c_id;
+
+            if (!tcp_shard_is_local(tcp_server, gid)) {
+                TCP_Shard_Msg *msg = tcp_shard_msg_new(TCP_SHARD_MSG_DATA, con->connections[c_id].public_key,
+                                                       new_data, length, gid);
+
+                if (msg != nullptr) {
+                    msg->target_slot = con->connections[c_id].other_id;
+                    msg->sender = tcp_shard_gid(tcp_server, con_id);
+                    tcp_shard_post(tcp_server, msg);
+                }
+
+                return 0;
+            }
+
             const int ret = write_packet_TCP_secure_connection(tcp_server->logger,
-                            &tcp_server->accepted_connection_array[index].con, new_data, length, false);
+                            &tcp_server->accepted_connection_array[gid & TCP_SHARD_INDEX_MASK].con, new_data, length, false);
 
             if (ret == -1) {
                 return -1;
@@ -900,12 +1435,202 @@ static int accept_connection(TCP_Server *tcp_server, Socket sock)
     return index;
 }
 
+#ifdef TCP_SERVER_USE_THREADS
+/** @brief Link slot `con_number` of `con` to a connection on another shard. */
 non_null()
-static Socket new_listening_TCP_socket(const Logger *logger, const Network *ns, Family family, uint16_t port)
+static void tcp_shard_link(const TCP_Server *tcp_server, TCP_Secure_Connection *con, uint8_t con_number,
+                           uint32_t gid, uint8_t other_id)
 {
-    const Socket sock = net_socket(ns, family, TOX_SOCK_STREAM, TOX_PROTO_TCP);
+    TCP_Secure_Conn *const slot = &con->connections[con_number];
 
-    if (!sock_valid(sock)) {
+    if (slot->status == 2) {
+        /* Still linked to an older connection with the same key. */
+        send_disconnect_notification(tcp_server->logger, con, con_number);
+    }
+
+    slot->status = 2;
+    slot->index = gid;
+    slot->other_id = other_id;
+    // TODO(irungentoo): return values?
+    send_connect_notification(tcp_server->logger, con, con_number);
+}
+
+/** @brief Handle a message from another shard addressed to a connection in this shard. */
+non_null()
+static void tcp_shard_handle_msg(TCP_Server *tcp_server, const TCP_Shard_Msg *msg)
+{
+    const uint32_t index = msg->target & TCP_SHARD_INDEX_MASK;
+
+    if (!tcp_shard_is_local(tcp_server, msg->target) || index >= tcp_server->size_accepted_connections) {
+        return;
+    }
+
+    TCP_Secure_Connection *const con = &tcp_server->accepted_connection_array[index];
+
+    if (con->status != TCP_STATUS_CONFIRMED) {
+        return;
+    }
+
+    if (msg->type == TCP_SHARD_MSG_REPLY) {
+        if (con->identifier == msg->identifier) {
+            write_packet_TCP_secure_connection(tcp_server->logger, &con->con, msg->data, msg->length, false);
+        }
+
+        return;
+    }
+
+    /* The slot may have been reused by another peer since the message was sent. */
+    if (!pk_equal(con->public_key, msg->target_key)) {
+        return;
+    }
+
+    TCP_Secure_Conn *const slot = msg->target_slot < NUM_CLIENT_CONNECTIONS ? &con->connections[msg->target_slot] : nullptr;
+
+    switch (msg->type) {
+        case TCP_SHARD_MSG_DATA: {
+            if (slot != nullptr && slot->status == 2 && slot->index == msg->sender) {
+                write_packet_TCP_secure_connection(tcp_server->logger, &con->con, msg->data, msg->length, false);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_OOB: {
+            write_packet_TCP_secure_connection(tcp_server->logger, &con->con, msg->data, msg->length, false);
+            break;
+        }
+
+        case TCP_SHARD_MSG_PAIR: {
+            for (uint32_t i = 0; i < NUM_CLIENT_CONNECTIONS; ++i) {
+                const TCP_Secure_Conn *const other = &con->connections[i];
+
+                if (other->status == 0 || !pk_equal(other->public_key, msg->sender_key)) {
+                    continue;
+                }
+
+                if (other->status == 2 && other->index == msg->sender && other->other_id == msg->sender_slot) {
+                    break;
+                }
+
+                tcp_shard_link(tcp_server, con, i, msg->sender, msg->sender_slot);
+
+                TCP_Shard_Msg *reply = tcp_shard_msg_new(TCP_SHARD_MSG_PAIRED, msg->sender_key, nullptr, 0, msg->sender);
+
+                if (reply != nullptr) {
+                    reply->target_slot = msg->sender_slot;
+                    reply->sender = msg->target;
+                    memcpy(reply->sender_key, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+                    reply->sender_slot = i;
+                    tcp_shard_post(tcp_server, reply);
+                }
+
+                break;
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_PAIRED: {
+            if (slot == nullptr) {
+                break;
+            }
+
+            if (slot->status == 0 || !pk_equal(slot->public_key, msg->sender_key)) {
+                /* The route was dropped in the meantime, undo the other end. */
+                TCP_Shard_Msg *reply = tcp_shard_msg_new(TCP_SHARD_MSG_UNLINK, msg->sender_key, nullptr, 0, msg->sender);
+
+                if (reply != nullptr) {
+                    reply->target_slot = msg->sender_slot;
+                    reply->sender = msg->target;
+                    memcpy(reply->sender_key, con->public_key, CRYPTO_PUBLIC_KEY_SIZE);
+                    tcp_shard_post(tcp_server, reply);
+                }
+
+                break;
+            }
+
+            if (slot->status != 2 || slot->index != msg->sender || slot->other_id != msg->sender_slot) {
+                tcp_shard_link(tcp_server, con, msg->target_slot, msg->sender, msg->sender_slot);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_UNLINK: {
+            if (slot != nullptr && slot->status == 2 && slot->index == msg->sender
+                    && pk_equal(slot->public_key, msg->sender_key)) {
+                slot->status = 1;
+                slot->index = 0;
+                slot->other_id = 0;
+                // TODO(irungentoo): return values?
+                send_disconnect_notification(tcp_server->logger, con, msg->target_slot);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_KILL: {
+            /* Only kill it if it is no longer the connection the key maps to. */
+            if (get_TCP_connection_index(tcp_server, con->public_key) != (int)msg->target) {
+                kill_accepted(tcp_server, index);
+            }
+
+            break;
+        }
+
+        case TCP_SHARD_MSG_REPLY:
+        case TCP_SHARD_MSG_ONION_REQUEST:
+        case TCP_SHARD_MSG_FORWARD_REQUEST:
+            break;
+    }
+}
+
+/** @brief Handle an onion or forward request from a shard on the main thread. */
+non_null()
+static void tcp_root_handle_msg(const TCP_Server *tcp_server, const TCP_Shard_Msg *msg)
+{
+    if (msg->type == TCP_SHARD_MSG_ONION_REQUEST && tcp_server->onion != nullptr) {
+        const IP_Port source = con_id_to_ip_port(msg->sender, msg->identifier);
+        onion_send_1(tcp_server->onion, msg->data + CRYPTO_NONCE_SIZE, msg->length - CRYPTO_NONCE_SIZE, &source,
+                     msg->data);
+    } else if (msg->type == TCP_SHARD_MSG_FORWARD_REQUEST && tcp_server->forwarding != nullptr) {
+        send_TCP_forward_request(tcp_server->forwarding, msg->sender, msg->identifier, msg->data, msg->length);
+    }
+}
+
+/** @brief Handle all queued messages for this shard, or for the main thread if this is the root.
+ *
+ * @retval true if there were any.
+ */
+non_null()
+static bool tcp_shard_drain(TCP_Server *tcp_server)
+{
+    bool any = false;
+    TCP_Shard_Msg *msg;
+
+    while ((msg = tcp_shard_queue_pop(&tcp_server->inbox)) != nullptr) {
+        if (tcp_server->root == tcp_server) {
+            tcp_root_handle_msg(tcp_server, msg);
+        } else {
+            tcp_shard_handle_msg(tcp_server, msg);
+        }
+
+        free(msg);
+        __atomic_sub_fetch(&tcp_server->inbox.size, 1, __ATOMIC_RELAXED);
+        any = true;
+    }
+
+    return any;
+}
+#endif /* TCP_SERVER_USE_THREADS */
+
+non_null()
+static Socket new_listening_TCP_socket(const Logger *logger, const Network *ns, Family family, uint16_t port,
+                                       bool reuseport)
+{
+    const Socket sock = net_socket(ns, family, TOX_SOCK_STREAM, TOX_PROTO_TCP);
+
+    if (!sock_valid(sock)) {
         LOGGER_ERROR(logger, "TCP socket creation failed (family = %d)", family.value);
         return net_invalid_socket;
     }
@@ -920,6 +1645,10 @@ static Socket new_listening_TCP_socket(const Logger *logger, const Network *ns,
         ok = set_socket_reuseaddr(ns, sock);
     }
 
+    if (ok && reuseport) {
+        ok = set_socket_reuseport(ns, sock);
+    }
+
     ok = ok && bind_to_port(ns, sock, family, port) && (net_listen(ns, sock, TCP_MAX_BACKLOG) == 0);
 
     if (!ok) {
@@ -935,20 +1664,10 @@ static Socket new_listening_TCP_socket(const Logger *logger, const Network *ns,
     return sock;
 }
 
-TCP_Server *new_TCP_server(const Logger *logger, const Random *rng, const Network *ns,
-                           bool ipv6_enabled, uint16_t num_sockets,
-                           const uint16_t *ports, const uint8_t *secret_key, Onion *onion, Forwarding *forwarding)
+non_null()
+static TCP_Server *tcp_server_alloc(const Logger *logger, const Random *rng, const Network *ns,
+                                    const uint8_t *secret_key)
 {
-    if (num_sockets == 0 || ports == nullptr) {
-        LOGGER_ERROR(logger, "no sockets");
-        return nullptr;
-    }
-
-    if (ns == nullptr) {
-        LOGGER_ERROR(logger, "NULL network");
-        return nullptr;
-    }
-
     TCP_Server *temp = (TCP_Server *)calloc(1, sizeof(TCP_Server));
 
     if (temp == nullptr) {
@@ -959,13 +1678,37 @@ TCP_Server *new_TCP_server(const Logger *logger, const Random *rng, const Networ
     temp->logger = logger;
     temp->ns = ns;
     temp->rng = rng;
+    temp->root = temp;
+#ifdef TCP_SERVER_USE_EPOLL
+    temp->efd = -1;
+#endif
+#ifdef TCP_SERVER_USE_THREADS
+    temp->wake_pipe[0] = -1;
+    temp->wake_pipe[1] = -1;
+#endif
+    tcp_shard_queue_init(&temp->inbox);
+
+    memcpy(temp->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
+    crypto_derive_public_key(temp->public_key, temp->secret_key);
+
+    return temp;
+}
+
+/** @brief Open the listening sockets of a server or shard.
+ *
+ * @retval true if at least one socket is listening.
+ */
+non_null()
+static bool tcp_server_listen(TCP_Server *temp, bool ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                              bool reuseport)
+{
+    const Logger *logger = temp->logger;
 
     temp->socks_listening = (Socket *)calloc(num_sockets, sizeof(Socket));
 
     if (temp->socks_listening == nullptr) {
         LOGGER_ERROR(logger, "socket allocation failed");
-        free(temp);
-        return nullptr;
+        return false;
     }
 
 #ifdef TCP_SERVER_USE_EPOLL
@@ -973,9 +1716,7 @@ TCP_Server *new_TCP_server(const Logger *logger, const Random *rng, const Networ
 
     if (temp->efd == -1) {
         LOGGER_ERROR(logger, "epoll initialisation failed");
-        free(temp->socks_listening);
-        free(temp);
-        return nullptr;
+        return false;
     }
 
 #endif
@@ -983,7 +1724,7 @@ TCP_Server *new_TCP_server(const Logger *logger, const Random *rng, const Networ
     const Family family = ipv6_enabled ? net_family_ipv6() : net_family_ipv4();
 
     for (uint32_t i = 0; i < num_sockets; ++i) {
-        const Socket sock = new_listening_TCP_socket(logger, ns, family, ports[i]);
+        const Socket sock = new_listening_TCP_socket(logger, temp->ns, family, ports[i], reuseport);
 
         if (!sock_valid(sock)) {
             continue;
@@ -1005,27 +1746,257 @@ TCP_Server *new_TCP_server(const Logger *logger, const Random *rng, const Networ
         ++temp->num_listening_socks;
     }
 
-    if (temp->num_listening_socks == 0) {
-        free(temp->socks_listening);
-        free(temp);
+    return temp->num_listening_socks != 0;
+}
+
+/** @brief Free a server or shard. Does not touch the key list or callbacks. */
+non_null()
+static void tcp_server_free(TCP_Server *tcp_server)
+{
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
+        kill_sock(tcp_server->ns, tcp_server->socks_listening[i]);
+    }
+
+#ifdef TCP_SERVER_USE_EPOLL
+
+    if (tcp_server->efd != -1) {
+        close(tcp_server->efd);
+    }
+
+#endif
+
+    for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
+        wipe_secure_connection(&tcp_server->incoming_connection_queue[i]);
+        wipe_secure_connection(&tcp_server->unconfirmed_connection_queue[i]);
+    }
+
+    free_accepted_connection_array(tcp_server);
+
+#ifdef TCP_SERVER_USE_THREADS
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        if (tcp_server->wake_pipe[i] != -1) {
+            close(tcp_server->wake_pipe[i]);
+        }
+    }
+
+    free(tcp_server->wait_fds);
+    free(tcp_server->wait_socks);
+#endif
+
+    crypto_memzero(tcp_server->secret_key, sizeof(tcp_server->secret_key));
+
+    free(tcp_server->socks_listening);
+    free(tcp_server);
+}
+
+#ifdef TCP_SERVER_USE_THREADS
+non_null()
+static void *tcp_shard_thread(void *arg);
+
+/** @brief Create the non-blocking pipe that wakes the worker of a shard. */
+non_null()
+static bool tcp_shard_open_wake_pipe(TCP_Server *shard)
+{
+    if (pipe(shard->wake_pipe) != 0) {
+        shard->wake_pipe[0] = -1;
+        shard->wake_pipe[1] = -1;
+        return false;
+    }
+
+    for (uint32_t i = 0; i < 2; ++i) {
+        const int flags = fcntl(shard->wake_pipe[i], F_GETFL);
+
+        if (flags == -1 || fcntl(shard->wake_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Stop the worker threads and free the shards. */
+non_null()
+static void tcp_server_kill_shards(TCP_Server *root)
+{
+    __atomic_store_n(&root->stop, 1, __ATOMIC_RELEASE);
+
+    for (uint16_t i = 0; i < root->num_shards; ++i) {
+        tcp_shard_wake(root->shards[i]);
+    }
+
+    for (uint16_t i = 0; i < root->num_shards; ++i) {
+        pthread_join(root->threads[i], nullptr);
+    }
+
+    /* Messages may still be queued between shards or for the main thread. */
+    for (uint16_t i = 0; i < root->num_shards; ++i) {
+        tcp_shard_queue_clear(&root->shards[i]->inbox);
+        mono_time_free(root->shards[i]->mono_time);
+        tcp_server_free(root->shards[i]);
+    }
+
+    tcp_shard_queue_clear(&root->inbox);
+
+    free(root->threads);
+    free(root->shards);
+    root->threads = nullptr;
+    root->shards = nullptr;
+    root->num_shards = 0;
+
+    if (root->key_list_lock != nullptr) {
+        pthread_mutex_destroy(root->key_list_lock);
+        free(root->key_list_lock);
+        root->key_list_lock = nullptr;
+    }
+}
+
+/** @brief Create `num_threads` shards listening on the same ports and start their threads.
+ *
+ * @retval true on success.
+ */
+non_null()
+static bool tcp_server_start_shards(TCP_Server *root, bool ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                                    uint16_t num_threads)
+{
+    root->key_list_lock = (pthread_mutex_t *)calloc(1, sizeof(pthread_mutex_t));
+
+    if (root->key_list_lock == nullptr) {
+        return false;
+    }
+
+    if (pthread_mutex_init(root->key_list_lock, nullptr) != 0) {
+        free(root->key_list_lock);
+        root->key_list_lock = nullptr;
+        return false;
+    }
+
+    root->shards = (TCP_Server **)calloc(num_threads, sizeof(TCP_Server *));
+    root->threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+
+    if (root->shards == nullptr || root->threads == nullptr) {
+        return false;
+    }
+
+    for (uint16_t i = 0; i < num_threads; ++i) {
+        TCP_Server *shard = tcp_server_alloc(root->logger, root->rng, root->ns, root->secret_key);
+
+        if (shard == nullptr) {
+            return false;
+        }
+
+        shard->root = root;
+        shard->shard_id = i;
+        shard->onion = root->onion;
+        shard->forwarding = root->forwarding;
+        shard->mono_time = mono_time_new(nullptr, nullptr);
+
+        if (!tcp_shard_open_wake_pipe(shard)) {
+            LOGGER_ERROR(root->logger, "TCP relay shard %u could not create its wake pipe", i);
+            mono_time_free(shard->mono_time);
+            tcp_server_free(shard);
+            return false;
+        }
+
+        if (shard->mono_time == nullptr || !tcp_server_listen(shard, ipv6_enabled, num_sockets, ports, true)) {
+            LOGGER_ERROR(root->logger, "TCP relay shard %u could not listen (SO_REUSEPORT required)", i);
+            mono_time_free(shard->mono_time);
+            tcp_server_free(shard);
+            return false;
+        }
+
+        if (pthread_create(&root->threads[i], nullptr, tcp_shard_thread, shard) != 0) {
+            LOGGER_ERROR(root->logger, "TCP relay shard %u thread creation failed", i);
+            mono_time_free(shard->mono_time);
+            tcp_server_free(shard);
+            return false;
+        }
+
+        root->shards[i] = shard;
+        ++root->num_shards;
+    }
+
+    return true;
+}
+#else
+non_null()
+static bool tcp_server_start_shards(TCP_Server *root, bool ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                                    uint16_t num_threads)
+{
+    LOGGER_ERROR(root->logger, "TCP relay threads are not supported on this platform");
+    return false;
+}
+#endif /* TCP_SERVER_USE_THREADS */
+
+/** @brief Free a root server and its shards. Does not touch the callbacks. */
+non_null()
+static void tcp_server_kill_root(TCP_Server *tcp_server)
+{
+#ifdef TCP_SERVER_USE_THREADS
+    tcp_server_kill_shards(tcp_server);
+#endif
+
+    hash_list_free(&tcp_server->accepted_key_list);
+    tcp_server_free(tcp_server);
+}
+
+TCP_Server *new_TCP_server(const Logger *logger, const Random *rng, const Network *ns,
+                           bool ipv6_enabled, uint16_t num_sockets,
+                           const uint16_t *ports, const uint8_t *secret_key, Onion *onion, Forwarding *forwarding)
+{
+    return new_TCP_server_ex(logger, rng, ns, ipv6_enabled, num_sockets, ports, secret_key, onion, forwarding, 0);
+}
+
+TCP_Server *new_TCP_server_ex(const Logger *logger, const Random *rng, const Network *ns,
+                              bool ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                              const uint8_t *secret_key, Onion *onion, Forwarding *forwarding, uint16_t num_threads)
+{
+    if (num_sockets == 0 || ports == nullptr) {
+        LOGGER_ERROR(logger, "no sockets");
+        return nullptr;
+    }
+
+    if (ns == nullptr) {
+        LOGGER_ERROR(logger, "NULL network");
+        return nullptr;
+    }
+
+    if (num_threads > TCP_SERVER_MAX_THREADS) {
+        LOGGER_ERROR(logger, "too many TCP relay threads: %u > %u", num_threads, TCP_SERVER_MAX_THREADS);
+        return nullptr;
+    }
+
+    TCP_Server *temp = tcp_server_alloc(logger, rng, ns, secret_key);
+
+    if (temp == nullptr) {
+        return nullptr;
+    }
+
+    temp->onion = onion;
+    temp->forwarding = forwarding;
+
+    if (hash_list_init(&temp->accepted_key_list, CRYPTO_PUBLIC_KEY_SIZE, 8, random_u64(rng)) == 0) {
+        tcp_server_free(temp);
+        return nullptr;
+    }
+
+    const bool listening = num_threads == 0
+                           ? tcp_server_listen(temp, ipv6_enabled, num_sockets, ports, false)
+                           : tcp_server_start_shards(temp, ipv6_enabled, num_sockets, ports, num_threads);
+
+    if (!listening) {
+        tcp_server_kill_root(temp);
         return nullptr;
     }
 
     if (onion != nullptr) {
-        temp->onion = onion;
         set_callback_handle_recv_1(onion, &handle_onion_recv_1, temp);
     }
 
     if (forwarding != nullptr) {
-        temp->forwarding = forwarding;
         set_callback_forward_reply(forwarding, &handle_forward_reply_tcp, temp);
     }
 
-    memcpy(temp->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
-    crypto_derive_public_key(temp->public_key, temp->secret_key);
-
-    bs_list_init(&temp->accepted_key_list, CRYPTO_PUBLIC_KEY_SIZE, 8);
-
     return temp;
 }
 
@@ -1359,7 +2330,8 @@ static void do_TCP_epoll(TCP_Server *tcp_server, const Mono_Time *mono_time)
 }
 #endif
 
-void do_TCP_server(TCP_Server *tcp_server, const Mono_Time *mono_time)
+non_null()
+static void tcp_server_iterate(TCP_Server *tcp_server, const Mono_Time *mono_time)
 {
 #ifdef TCP_SERVER_USE_EPOLL
     do_TCP_epoll(tcp_server, mono_time);
@@ -1373,39 +2345,184 @@ void do_TCP_server(TCP_Server *tcp_server, const Mono_Time *mono_time)
     do_TCP_confirmed(tcp_server, mono_time);
 }
 
-void kill_TCP_server(TCP_Server *tcp_server)
+#ifdef TCP_SERVER_USE_THREADS
+/** While data waits for a socket to become writable, the shard retries sending it this often. */
+#define TCP_SHARD_PENDING_DATA_WAIT 10
+
+/** @brief Time in ms the worker of a shard may sleep if nothing arrives. */
+non_null()
+static int tcp_shard_wait_timeout(TCP_Server *shard)
 {
-    if (tcp_server == nullptr) {
-        return;
+#ifndef TCP_SERVER_USE_EPOLL
+
+    for (uint32_t i = 0; i < shard->size_accepted_connections; ++i) {
+        const TCP_Secure_Connection *conn = &shard->accepted_connection_array[i];
+
+        if (conn->status == TCP_STATUS_CONFIRMED && tcp_has_pending_data(&conn->con)) {
+            return TCP_SHARD_PENDING_DATA_WAIT;
+        }
     }
 
-    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
-        kill_sock(tcp_server->ns, tcp_server->socks_listening[i]);
+#endif
+
+    // Pings and connection timeouts are checked at whole seconds.
+    return (int)mono_time_until_next_second(shard->mono_time);
+}
+
+/** @brief Block until one of the shard's sockets is readable, a message is
+ * posted to it, the server is stopped, or its timers are due.
+ */
+non_null()
+static void tcp_shard_wait(TCP_Server *shard)
+{
+    const uint32_t num_socks = tcp_server_get_sockets(shard, nullptr, 0);
+
+    if (num_socks + 1 > shard->wait_fds_size) {
+        struct pollfd *fds = (struct pollfd *)realloc(shard->wait_fds, (num_socks + 1) * sizeof(struct pollfd));
+
+        if (fds == nullptr) {
+            return;
+        }
+
+        shard->wait_fds = fds;
+
+        Socket *socks = (Socket *)realloc(shard->wait_socks, (num_socks + 1) * sizeof(Socket));
+
+        if (socks == nullptr) {
+            return;
+        }
+
+        shard->wait_socks = socks;
+        shard->wait_fds_size = num_socks + 1;
     }
 
-    if (tcp_server->onion != nullptr) {
-        set_callback_handle_recv_1(tcp_server->onion, nullptr, nullptr);
+    tcp_server_get_sockets(shard, shard->wait_socks, num_socks);
+
+    for (uint32_t i = 0; i < num_socks; ++i) {
+        shard->wait_fds[i].fd = shard->wait_socks[i].sock;
+        shard->wait_fds[i].events = POLLIN;
+        shard->wait_fds[i].revents = 0;
     }
 
-    if (tcp_server->forwarding != nullptr) {
-        set_callback_forward_reply(tcp_server->forwarding, nullptr, nullptr);
+    shard->wait_fds[num_socks].fd = shard->wake_pipe[0];
+    shard->wait_fds[num_socks].events = POLLIN;
+    shard->wait_fds[num_socks].revents = 0;
+
+    __atomic_store_n(&shard->waiting, 1, __ATOMIC_RELAXED);
+    // Pairs with the fence in `tcp_shard_wake`.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (tcp_shard_queue_is_empty(&shard->inbox) && __atomic_load_n(&shard->root->stop, __ATOMIC_RELAXED) == 0) {
+        poll(shard->wait_fds, num_socks + 1, tcp_shard_wait_timeout(shard));
     }
 
-    bs_list_free(&tcp_server->accepted_key_list);
+    __atomic_store_n(&shard->waiting, 0, __ATOMIC_RELAXED);
+
+    uint8_t buf[64];
+
+    while (read(shard->wake_pipe[0], buf, sizeof(buf)) > 0) {
+        // Drain the wake ups, the messages are handled by the caller.
+    }
+}
+
+/** Worker thread running a single shard until the server is killed. */
+static void *tcp_shard_thread(void *arg)
+{
+    TCP_Server *const shard = (TCP_Server *)arg;
+
+    while (__atomic_load_n(&shard->root->stop, __ATOMIC_ACQUIRE) == 0) {
+        mono_time_update(shard->mono_time);
+        const bool busy = tcp_shard_drain(shard);
+        tcp_server_iterate(shard, shard->mono_time);
+
+        if (!busy) {
+            tcp_shard_wait(shard);
+        }
+    }
+
+    return nullptr;
+}
+#endif
+
+void do_TCP_server(TCP_Server *tcp_server, const Mono_Time *mono_time)
+{
+#ifdef TCP_SERVER_USE_THREADS
+
+    if (tcp_server->num_shards != 0) {
+        /* The shards run on their own threads, only the onion and forwarding are left to us. */
+        tcp_shard_drain(tcp_server);
+        return;
+    }
+
+#endif
+
+    tcp_server_iterate(tcp_server, mono_time);
+}
+
+non_null(1, 3) nullable(2)
+static void add_socket(Socket *socks, uint32_t socks_size, uint32_t *count, Socket sock)
+{
+    if (*count < socks_size) {
+        socks[*count] = sock;
+    }
+
+    ++*count;
+}
+
+uint32_t tcp_server_get_sockets(const TCP_Server *tcp_server, Socket *socks, uint32_t socks_size)
+{
+    uint32_t count = 0;
+
+#ifdef TCP_SERVER_USE_THREADS
+
+    if (tcp_server->num_shards != 0) {
+        return count;
+    }
 
-#ifdef TCP_SERVER_USE_EPOLL
-    close(tcp_server->efd);
 #endif
 
+#ifdef TCP_SERVER_USE_EPOLL
+    const Socket efd = {tcp_server->efd};
+    add_socket(socks, socks_size, &count, efd);
+#else
+
+    for (uint32_t i = 0; i < tcp_server->num_listening_socks; ++i) {
+        add_socket(socks, socks_size, &count, tcp_server->socks_listening[i]);
+    }
+
     for (uint32_t i = 0; i < MAX_INCOMING_CONNECTIONS; ++i) {
-        wipe_secure_connection(&tcp_server->incoming_connection_queue[i]);
-        wipe_secure_connection(&tcp_server->unconfirmed_connection_queue[i]);
+        if (tcp_server->incoming_connection_queue[i].status != TCP_STATUS_NO_STATUS) {
+            add_socket(socks, socks_size, &count, tcp_server->incoming_connection_queue[i].con.sock);
+        }
+
+        if (tcp_server->unconfirmed_connection_queue[i].status != TCP_STATUS_NO_STATUS) {
+            add_socket(socks, socks_size, &count, tcp_server->unconfirmed_connection_queue[i].con.sock);
+        }
     }
 
-    free_accepted_connection_array(tcp_server);
+    for (uint32_t i = 0; i < tcp_server->size_accepted_connections; ++i) {
+        if (tcp_server->accepted_connection_array[i].status != TCP_STATUS_NO_STATUS) {
+            add_socket(socks, socks_size, &count, tcp_server->accepted_connection_array[i].con.sock);
+        }
+    }
 
-    crypto_memzero(tcp_server->secret_key, sizeof(tcp_server->secret_key));
+#endif
+    return count;
+}
 
-    free(tcp_server->socks_listening);
-    free(tcp_server);
+void kill_TCP_server(TCP_Server *tcp_server)
+{
+    if (tcp_server == nullptr) {
+        return;
+    }
+
+    if (tcp_server->onion != nullptr) {
+        set_callback_handle_recv_1(tcp_server->onion, nullptr, nullptr);
+    }
+
+    if (tcp_server->forwarding != nullptr) {
+        set_callback_forward_reply(tcp_server->forwarding, nullptr, nullptr);
+    }
+
+    tcp_server_kill_root(tcp_server);
 }
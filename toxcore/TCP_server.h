@@ -19,6 +19,9 @@
 
 #define ARRAY_ENTRY_SIZE 6
 
+/** Maximum number of worker threads of a sharded TCP server. */
+#define TCP_SERVER_MAX_THREADS 64
+
 typedef enum TCP_Status {
     TCP_STATUS_NO_STATUS,
     TCP_STATUS_CONNECTED,
@@ -39,10 +42,41 @@ TCP_Server *new_TCP_server(const Logger *logger, const Random *rng, const Networ
                            bool ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
                            const uint8_t *secret_key, Onion *onion, Forwarding *forwarding);
 
+/** @brief Create new TCP server instance running on worker threads.
+ *
+ * With `num_threads` set to 0 this is the same as new_TCP_server. Otherwise
+ * each of the `num_threads` workers owns a shard of the server: its own
+ * listening sockets on the given ports (bound with SO_REUSEPORT so that the
+ * kernel spreads incoming connections over the shards), its own epoll set and
+ * its own accepted connections. Packets routed between connections on
+ * different shards are handed over through lock-free queues.
+ *
+ * do_TCP_server must still be called regularly from the thread that runs
+ * `onion` and `forwarding`; it only handles their requests and responses.
+ *
+ * Fails if the platform does not support SO_REUSEPORT or threads.
+ */
+non_null(1, 2, 3, 6, 7) nullable(8, 9)
+TCP_Server *new_TCP_server_ex(const Logger *logger, const Random *rng, const Network *ns,
+                              bool ipv6_enabled, uint16_t num_sockets, const uint16_t *ports,
+                              const uint8_t *secret_key, Onion *onion, Forwarding *forwarding, uint16_t num_threads);
+
 /** Run the TCP_server */
 non_null()
 void do_TCP_server(TCP_Server *tcp_server, const Mono_Time *mono_time);
 
+/** @brief Get the sockets do_TCP_server reads from.
+ *
+ * With epoll this is just the epoll socket. In sharded mode the shards wait
+ * on their own sockets and there are none.
+ *
+ * Writes up to `socks_size` sockets to `socks`.
+ *
+ * @return the number of sockets, which may be more than `socks_size`.
+ */
+non_null(1) nullable(2)
+uint32_t tcp_server_get_sockets(const TCP_Server *tcp_server, Socket *socks, uint32_t socks_size);
+
 /** Kill the TCP server */
 nullable(1)
 void kill_TCP_server(TCP_Server *tcp_server);
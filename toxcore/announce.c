@@ -19,7 +19,7 @@
 #include "util.h"
 
 // Settings for the shared key cache
-#define MAX_KEYS_PER_SLOT 4
+#define MAX_CACHED_KEYS 4096
 #define KEYS_TIMEOUT 600
 
 uint8_t announce_response_of_request_type(uint8_t request_type)
@@ -73,6 +73,11 @@ void announce_set_synch_offset(Announcements *announce, int32_t synch_offset)
     announce->synch_offset = synch_offset;
 }
 
+void announce_get_shared_key_stats(const Announcements *announce, Shared_Key_Cache_Stats *stats)
+{
+    shared_key_cache_get_stats(announce->shared_keys, stats);
+}
+
 /**
  * An entry is considered to be "deleted" for the purposes of the protocol
  * once it has timed out.
@@ -658,7 +663,7 @@ Announcements *new_announcements(const Logger *log, const Random *rng, const Mon
     announce->public_key = dht_get_self_public_key(announce->dht);
     announce->secret_key = dht_get_self_secret_key(announce->dht);
     new_hmac_key(announce->rng, announce->hmac_key);
-    announce->shared_keys = shared_key_cache_new(mono_time, announce->secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    announce->shared_keys = shared_key_cache_new(mono_time, rng, announce->secret_key, KEYS_TIMEOUT, MAX_CACHED_KEYS);
     if (announce->shared_keys == nullptr) {
         free(announce);
         return nullptr;
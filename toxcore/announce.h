@@ -30,6 +30,10 @@ bool announce_on_stored(const Announcements *announce, const uint8_t *data_publi
 non_null()
 void announce_set_synch_offset(Announcements *announce, int32_t synch_offset);
 
+/** @brief Copy the counters of the shared key cache for announce requests. */
+non_null()
+void announce_get_shared_key_stats(const Announcements *announce, Shared_Key_Cache_Stats *stats);
+
 nullable(1)
 void kill_announcements(Announcements *announce);
 
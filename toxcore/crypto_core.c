@@ -115,7 +115,7 @@ const uint8_t *get_chat_id(const uint8_t *key)
     return key + ENC_PUBLIC_KEY_SIZE;
 }
 
-#if !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+#if defined(VANILLA_NACL) && !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
 static uint8_t *crypto_malloc(size_t bytes)
 {
     uint8_t *ptr = (uint8_t *)malloc(bytes);
@@ -137,7 +137,7 @@ static void crypto_free(uint8_t *ptr, size_t bytes)
 
     free(ptr);
 }
-#endif  // !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+#endif  // defined(VANILLA_NACL) && !defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
 
 void crypto_memzero(void *data, size_t length)
 {
@@ -292,11 +292,20 @@ int32_t encrypt_data_symmetric(const uint8_t *shared_key, const uint8_t *nonce,
         return -1;
     }
 
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
-    // Don't encrypt anything.
-    memcpy(encrypted, plain, length);
+#if defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
+    // Don't encrypt anything. The buffers may overlap for in-place encryption.
+    memmove(encrypted, plain, length);
     // Zero MAC to avoid uninitialized memory reads.
     memset(encrypted + length, 0, crypto_box_MACBYTES);
+#elif !defined(VANILLA_NACL)
+
+    // The easy interface writes the MAC followed by the cipher text, which is
+    // exactly our wire format, so no padded temporaries are needed. It also
+    // supports overlapping input and output buffers.
+    if (crypto_box_easy_afternm(encrypted, plain, length, nonce, shared_key) != 0) {
+        return -1;
+    }
+
 #else
 
     const size_t size_temp_plain = length + crypto_box_ZEROBYTES;
@@ -345,9 +354,15 @@ int32_t decrypt_data_symmetric(const uint8_t *shared_key, const uint8_t *nonce,
         return -1;
     }
 
-#ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
+#if defined(FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION)
     assert(length >= crypto_box_MACBYTES);
-    memcpy(plain, encrypted, length - crypto_box_MACBYTES);  // Don't encrypt anything
+    memmove(plain, encrypted, length - crypto_box_MACBYTES);  // Don't encrypt anything
+#elif !defined(VANILLA_NACL)
+
+    if (crypto_box_open_easy_afternm(plain, encrypted, length, nonce, shared_key) != 0) {
+        return -1;
+    }
+
 #else
 
     const size_t size_temp_plain = length + crypto_box_ZEROBYTES;
@@ -372,6 +372,10 @@ int32_t encrypt_precompute(const uint8_t *public_key, const uint8_t *secret_key,
  * using a shared key @ref CRYPTO_SYMMETRIC_KEY_SIZE big and a @ref CRYPTO_NONCE_SIZE
  * byte nonce.
  *
+ * This function does not allocate. The buffers may overlap, so a packet can be
+ * encrypted in place by putting the plain text @ref CRYPTO_MAC_SIZE bytes after
+ * the start of @p encrypted.
+ *
  * @retval -1 if there was a problem.
  * @return length of encrypted data if everything was fine.
  */
@@ -386,6 +390,9 @@ int32_t encrypt_data_symmetric(const uint8_t *shared_key, const uint8_t *nonce,
  * `length - CRYPTO_MAC_SIZE` using a shared key @ref CRYPTO_SHARED_KEY_SIZE
  * big and a @ref CRYPTO_NONCE_SIZE byte nonce.
  *
+ * This function does not allocate. @p plain may point at @p encrypted or at
+ * `encrypted + CRYPTO_MAC_SIZE` to decrypt in place.
+ *
  * @retval -1 if there was a problem (decryption failed).
  * @return length of plain data if everything was fine.
  */
@@ -18,6 +18,7 @@ using ExtPublicKey = std::array<uint8_t, EXT_PUBLIC_KEY_SIZE>;
 using ExtSecretKey = std::array<uint8_t, EXT_SECRET_KEY_SIZE>;
 using Signature = std::array<uint8_t, CRYPTO_SIGNATURE_SIZE>;
 using Nonce = std::array<uint8_t, CRYPTO_NONCE_SIZE>;
+using SharedKey = std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE>;
 
 TEST(CryptoCore, EncryptLargeData)
 {
@@ -113,4 +114,37 @@ TEST(CryptoCore, Hmac)
     }
 }
 
+TEST(CryptoCore, SymmetricEncryptInPlace)
+{
+    const Random *rng = system_random();
+    ASSERT_NE(rng, nullptr);
+
+    SharedKey k;
+    new_symmetric_key(rng, k.data());
+    Nonce nonce;
+    random_nonce(rng, nonce.data());
+
+    std::vector<uint8_t> message(1024);
+    random_bytes(rng, message.data(), message.size());
+
+    std::vector<uint8_t> expected(message.size() + CRYPTO_MAC_SIZE);
+    ASSERT_EQ(encrypt_data_symmetric(
+                  k.data(), nonce.data(), message.data(), message.size(), expected.data()),
+        expected.size());
+
+    // Plain text placed right after the space for the MAC is encrypted in place.
+    std::vector<uint8_t> buffer(CRYPTO_MAC_SIZE + message.size());
+    std::copy(message.begin(), message.end(), buffer.begin() + CRYPTO_MAC_SIZE);
+    ASSERT_EQ(encrypt_data_symmetric(k.data(), nonce.data(), buffer.data() + CRYPTO_MAC_SIZE,
+                  message.size(), buffer.data()),
+        buffer.size());
+    EXPECT_EQ(buffer, expected);
+
+    // And decrypted in place again.
+    ASSERT_EQ(decrypt_data_symmetric(
+                  k.data(), nonce.data(), buffer.data(), buffer.size(), buffer.data()),
+        message.size());
+    EXPECT_TRUE(std::equal(message.begin(), message.end(), buffer.begin()));
+}
+
 }  // namespace
@@ -52,6 +52,29 @@
 /* Header information attached to all broadcast messages: broadcast_type */
 #define GC_BROADCAST_ENC_HEADER_SIZE 1
 
+/* Header of a relayed broadcast, followed by the broadcast itself. Contains the origin's public encryption key,
+ * the start and end of the range of peers to forward it to, the signature, and the broadcast id. The signature
+ * covers the id and the broadcast.
+ */
+#define GC_RELAYED_BROADCAST_HEADER_SIZE (ENC_PUBLIC_KEY_SIZE + sizeof(uint32_t) + sizeof(uint32_t) + SIGNATURE_SIZE +\
+                                          sizeof(uint64_t))
+
+/* Offsets of the fields of a relayed broadcast header */
+#define GC_RELAYED_BROADCAST_RANGE_OFFSET ENC_PUBLIC_KEY_SIZE
+#define GC_RELAYED_BROADCAST_SIG_OFFSET (GC_RELAYED_BROADCAST_RANGE_OFFSET + sizeof(uint32_t) + sizeof(uint32_t))
+#define GC_RELAYED_BROADCAST_ID_OFFSET (GC_RELAYED_BROADCAST_SIG_OFFSET + SIGNATURE_SIZE)
+
+/* Ack of a relayed broadcast: the origin's public encryption key and the broadcast id */
+#define GC_RELAYED_BROADCAST_ACK_SIZE (ENC_PUBLIC_KEY_SIZE + sizeof(uint64_t))
+
+/* Seconds we keep a relayed broadcast whose branches haven't all acked it. A branch whose peer
+ * leaves is repaired before then, so this only bounds how long we hold the copy.
+ */
+#define GC_RELAY_PENDING_TIMEOUT (GC_CONFIRMED_PEER_TIMEOUT * 2)
+
+/* Flags byte appended to our peer info: set if we forward relayed broadcasts */
+#define GC_PEER_INFO_RELAYS_BROADCASTS 0x01
+
 /* Size of a group packet message ID */
 #define GC_MESSAGE_ID_BYTES sizeof(uint64_t)
 
@@ -339,12 +362,13 @@ void gc_get_self_public_key(const GC_Chat *chat, uint8_t *public_key)
  * If `ext_public_key` is null this function has no effect.
  */
 non_null()
-static void self_gc_set_ext_public_key(const GC_Chat *chat, const uint8_t *ext_public_key)
+static void self_gc_set_ext_public_key(GC_Chat *chat, const uint8_t *ext_public_key)
 {
     if (ext_public_key != nullptr) {
         GC_Connection *gconn = get_gc_connection(chat, 0);
         assert(gconn != nullptr);
-        memcpy(gconn->addr.public_key, ext_public_key, EXT_PUBLIC_KEY_SIZE);
+        memcpy(gconn->addr.public_key, ext_public_key, ENC_PUBLIC_KEY_SIZE);
+        set_peer_sig_pk(chat, 0, get_sig_pk(ext_public_key));
     }
 }
 
@@ -570,27 +594,174 @@ static uint16_t get_gc_topic_checksum(const GC_TopicInfo *topic_info)
     return data_checksum(topic_info->topic, topic_info->length);
 }
 
-int get_peer_number_of_enc_pk(const GC_Chat *chat, const uint8_t *public_enc_key, bool confirmed)
+/** Returns true if `public_sig_key` is all zeroes, which means we don't know the peer's signature key yet. */
+non_null()
+static bool sig_pk_is_unset(const uint8_t *public_sig_key)
 {
-    for (uint32_t i = 0; i < chat->numpeers; ++i) {
-        const GC_Connection *gconn = get_gc_connection(chat, i);
+    const uint8_t zero_key[SIG_PUBLIC_KEY_SIZE] = {0};
+    return memcmp(public_sig_key, zero_key, SIG_PUBLIC_KEY_SIZE) == 0;
+}
 
-        assert(gconn != nullptr);
+non_null()
+static void cleanup_gc_peer_indices(GC_Chat *chat)
+{
+    hash_list_free(&chat->peers_by_enc_pk);
+    hash_list_free(&chat->peers_by_sig_pk);
+    hash_list_free(&chat->peers_by_id);
+}
 
-        if (gconn->pending_delete) {
-            continue;
-        }
+/** @brief Initialises the peer indices of `chat`.
+ *
+ * On failure the indices that were already initialised are freed again.
+ *
+ * Return true on success.
+ */
+non_null()
+static bool init_gc_peer_indices(GC_Chat *chat)
+{
+    chat->sig_pk_unindexed = 0;
+    chat->peer_id_hint = 0;
 
-        if (confirmed && !gconn->confirmed) {
-            continue;
+    if (hash_list_init(&chat->peers_by_enc_pk, ENC_PUBLIC_KEY_SIZE, 0, random_u64(chat->rng)) == 1
+            && hash_list_init(&chat->peers_by_sig_pk, SIG_PUBLIC_KEY_SIZE, 0, random_u64(chat->rng)) == 1
+            && hash_list_init(&chat->peers_by_id, sizeof(uint32_t), 0, random_u64(chat->rng)) == 1) {
+        return true;
+    }
+
+    cleanup_gc_peer_indices(chat);
+    return false;
+}
+
+/** @brief Adds the signature key of `peer_number` to the index.
+ *
+ * If another peer already uses the key, or we run out of memory, the peer is
+ * counted in `sig_pk_unindexed` and lookups fall back to a linear search.
+ */
+non_null()
+static void index_peer_sig_pk(GC_Chat *chat, uint32_t peer_number)
+{
+    const uint8_t *public_sig_key = get_sig_pk(chat->group[peer_number].gconn.addr.public_key);
+
+    if (sig_pk_is_unset(public_sig_key)) {
+        return;
+    }
+
+    if (!hash_list_add(&chat->peers_by_sig_pk, public_sig_key, peer_number)) {
+        ++chat->sig_pk_unindexed;
+    }
+}
+
+/** Removes the signature key of `peer_number` from the index. */
+non_null()
+static void unindex_peer_sig_pk(GC_Chat *chat, uint32_t peer_number)
+{
+    const uint8_t *public_sig_key = get_sig_pk(chat->group[peer_number].gconn.addr.public_key);
+
+    if (sig_pk_is_unset(public_sig_key)) {
+        return;
+    }
+
+    if (!hash_list_remove(&chat->peers_by_sig_pk, public_sig_key, peer_number)) {
+        assert(chat->sig_pk_unindexed > 0);
+        --chat->sig_pk_unindexed;
+    }
+}
+
+void set_peer_sig_pk(GC_Chat *chat, uint32_t peer_number, const uint8_t *public_sig_key)
+{
+    unindex_peer_sig_pk(chat, peer_number);
+    set_sig_pk(chat->group[peer_number].gconn.addr.public_key, public_sig_key);
+    index_peer_sig_pk(chat, peer_number);
+}
+
+/** @brief Adds the encryption key and peer id of `peer_number` to the indices.
+ *
+ * A peer waiting to be deleted may share its encryption key with a live peer.
+ * The live peer always keeps the key in the index, as lookups by encryption
+ * key skip peers waiting to be deleted anyway: a live peer replaces such a
+ * peer, and a peer waiting to be deleted is left out of the encryption key
+ * index while a live peer holds its key.
+ *
+ * Return true on success.
+ */
+non_null()
+static bool index_peer(GC_Chat *chat, uint32_t peer_number)
+{
+    const GC_Peer *peer = &chat->group[peer_number];
+    const uint8_t *public_enc_key = get_enc_key(peer->gconn.addr.public_key);
+    uint8_t peer_id[sizeof(uint32_t)];
+    memcpy(peer_id, &peer->peer_id, sizeof(peer_id));
+
+    const int old_peer_number = hash_list_find(&chat->peers_by_enc_pk, public_enc_key);
+    bool index_enc_pk = true;
+
+    if (old_peer_number != -1) {
+        if (!chat->group[old_peer_number].gconn.pending_delete) {
+            if (!peer->gconn.pending_delete) {
+                // Two live peers with the same key; peer_add never lets this happen.
+                return false;
+            }
+
+            index_enc_pk = false;
+        } else if (peer->gconn.pending_delete) {
+            // Neither is found by lookups, so it doesn't matter which one is indexed.
+            index_enc_pk = false;
+        } else {
+            hash_list_remove(&chat->peers_by_enc_pk, public_enc_key, old_peer_number);
         }
+    }
 
-        if (memcmp(gconn->addr.public_key, public_enc_key, ENC_PUBLIC_KEY_SIZE) == 0) {
-            return i;
+    if (index_enc_pk && !hash_list_add(&chat->peers_by_enc_pk, public_enc_key, peer_number)) {
+        return false;
+    }
+
+    if (!hash_list_add(&chat->peers_by_id, peer_id, peer_number)) {
+        if (index_enc_pk) {
+            hash_list_remove(&chat->peers_by_enc_pk, public_enc_key, peer_number);
         }
+
+        return false;
     }
 
-    return -1;
+    index_peer_sig_pk(chat, peer_number);
+
+    return true;
+}
+
+/** Removes `peer_number` from all peer indices. */
+non_null()
+static void unindex_peer(GC_Chat *chat, uint32_t peer_number)
+{
+    const GC_Peer *peer = &chat->group[peer_number];
+    uint8_t peer_id[sizeof(uint32_t)];
+    memcpy(peer_id, &peer->peer_id, sizeof(peer_id));
+
+    hash_list_remove(&chat->peers_by_enc_pk, get_enc_key(peer->gconn.addr.public_key), peer_number);
+    hash_list_remove(&chat->peers_by_id, peer_id, peer_number);
+    unindex_peer_sig_pk(chat, peer_number);
+}
+
+int get_peer_number_of_enc_pk(const GC_Chat *chat, const uint8_t *public_enc_key, bool confirmed)
+{
+    const int peer_number = hash_list_find(&chat->peers_by_enc_pk, public_enc_key);
+
+    if (peer_number == -1) {
+        return -1;
+    }
+
+    const GC_Connection *gconn = get_gc_connection(chat, peer_number);
+
+    assert(gconn != nullptr);
+
+    if (gconn->pending_delete) {
+        return -1;
+    }
+
+    if (confirmed && !gconn->confirmed) {
+        return -1;
+    }
+
+    return peer_number;
 }
 
 /** @brief Check if peer associated with `public_sig_key` is in peer list.
@@ -601,6 +772,12 @@ int get_peer_number_of_enc_pk(const GC_Chat *chat, const uint8_t *public_enc_key
 non_null()
 static int get_peer_number_of_sig_pk(const GC_Chat *chat, const uint8_t *public_sig_key)
 {
+    const int peer_number = hash_list_find(&chat->peers_by_sig_pk, public_sig_key);
+
+    if (peer_number != -1 || chat->sig_pk_unindexed == 0) {
+        return peer_number;
+    }
+
     for (uint32_t i = 0; i < chat->numpeers; ++i) {
         const GC_Connection *gconn = get_gc_connection(chat, i);
 
@@ -617,20 +794,18 @@ static int get_peer_number_of_sig_pk(const GC_Chat *chat, const uint8_t *public_
 non_null()
 static bool gc_get_enc_pk_from_sig_pk(const GC_Chat *chat, uint8_t *public_key, const uint8_t *public_sig_key)
 {
-    for (uint32_t i = 0; i < chat->numpeers; ++i) {
-        const GC_Connection *gconn = get_gc_connection(chat, i);
+    const int peer_number = get_peer_number_of_sig_pk(chat, public_sig_key);
 
-        assert(gconn != nullptr);
+    if (peer_number == -1) {
+        return false;
+    }
 
-        const uint8_t *full_pk = gconn->addr.public_key;
+    const GC_Connection *gconn = get_gc_connection(chat, peer_number);
 
-        if (memcmp(public_sig_key, get_sig_pk(full_pk), SIG_PUBLIC_KEY_SIZE) == 0) {
-            memcpy(public_key, get_enc_key(full_pk), ENC_PUBLIC_KEY_SIZE);
-            return true;
-        }
-    }
+    assert(gconn != nullptr);
 
-    return false;
+    memcpy(public_key, get_enc_key(gconn->addr.public_key), ENC_PUBLIC_KEY_SIZE);
+    return true;
 }
 
 non_null()
@@ -664,25 +839,22 @@ static GC_Connection *random_gc_connection(const GC_Chat *chat)
 non_null()
 static int get_peer_number_of_peer_id(const GC_Chat *chat, uint32_t peer_id)
 {
-    for (uint32_t i = 0; i < chat->numpeers; ++i) {
-        if (chat->group[i].peer_id == peer_id) {
-            return i;
-        }
-    }
+    uint8_t key[sizeof(uint32_t)];
+    memcpy(key, &peer_id, sizeof(key));
 
-    return -1;
+    return hash_list_find(&chat->peers_by_id, key);
 }
 
 /** @brief Returns a unique peer ID.
  * Returns UINT32_MAX if all possible peer ID's are taken.
  *
  * These ID's are permanently assigned to a peer when they join the group and should be
- * considered arbitrary values.
+ * considered arbitrary values. We always hand out the lowest free one.
  */
 non_null()
 static uint32_t get_new_peer_id(const GC_Chat *chat)
 {
-    for (uint32_t i = 0; i < UINT32_MAX - 1; ++i) {
+    for (uint32_t i = chat->peer_id_hint; i < UINT32_MAX - 1; ++i) {
         if (get_peer_number_of_peer_id(chat, i) == -1) {
             return i;
         }
@@ -1401,6 +1573,48 @@ static bool sign_gc_shared_state(GC_Chat *chat)
     return true;
 }
 
+/** @brief Strips the padding and header from the decrypted group packet `plain`.
+ *
+ * @param message_id should be set to NULL for lossy packets.
+ *
+ * Returns length of the payload, which starts `header_len` bytes into `plain`.
+ * Return -3 if plaintext payload length is invalid.
+ */
+non_null(1, 4, 5) nullable(3)
+static int unpack_group_packet_header(const uint8_t *plain, int plain_len, uint64_t *message_id, uint8_t *packet_type,
+                                      uint32_t *header_len)
+{
+    const int min_plain_len = message_id != nullptr ? 1 + GC_MESSAGE_ID_BYTES : 1;
+
+    if (plain_len < min_plain_len) {
+        return -3;
+    }
+
+    /* remove padding */
+    uint32_t padding_len = 0;
+
+    while (plain[padding_len] == 0) {
+        ++padding_len;
+        --plain_len;
+
+        if (plain_len < min_plain_len) {
+            return -3;
+        }
+    }
+
+    *header_len = padding_len + sizeof(uint8_t);
+    *packet_type = plain[padding_len];
+    plain_len -= sizeof(uint8_t);
+
+    if (message_id != nullptr) {
+        net_unpack_u64(plain + *header_len, message_id);
+        plain_len -= GC_MESSAGE_ID_BYTES;
+        *header_len += GC_MESSAGE_ID_BYTES;
+    }
+
+    return plain_len;
+}
+
 /** @brief Decrypts data using the shared key associated with `gconn`.
  *
  * The packet payload should begin with a nonce.
@@ -1428,44 +1642,98 @@ static int group_packet_unwrap(const Logger *log, const GC_Connection *gconn, ui
         return -1;
     }
 
-    int plain_len = decrypt_data_symmetric(gconn->session_shared_key, packet, packet + CRYPTO_NONCE_SIZE,
-                                           length - CRYPTO_NONCE_SIZE, plain);
+    const int plain_len = decrypt_data_symmetric(gconn->session_shared_key, packet, packet + CRYPTO_NONCE_SIZE,
+                          length - CRYPTO_NONCE_SIZE, plain);
 
     if (plain_len <= 0) {
         free(plain);
         return plain_len == 0 ? -3 : -2;
     }
 
-    const int min_plain_len = message_id != nullptr ? 1 + GC_MESSAGE_ID_BYTES : 1;
+    uint32_t header_len;
+    const int payload_len = unpack_group_packet_header(plain, plain_len, message_id, packet_type, &header_len);
 
-    /* remove padding */
-    const uint8_t *real_plain = plain;
+    if (payload_len >= 0) {
+        memcpy(data, plain + header_len, payload_len);
+    }
 
-    while (real_plain[0] == 0) {
-        ++real_plain;
-        --plain_len;
+    free(plain);
 
-        if (plain_len < min_plain_len) {
-            free(plain);
-            return -3;
+    return payload_len;
+}
+
+/** @brief Decrypts a lossless packet that is expected to continue the fragment sequence of `gconn`.
+ *
+ * The packet is decrypted straight into the fragment buffer of `gconn` with
+ * its header in front of the buffer's tail, so a fragment's payload lands
+ * right behind the fragments before it and is never copied. The bytes the
+ * header overwrites are restored afterwards. Packets that turn out not to be
+ * fragments are copied to a newly allocated buffer.
+ *
+ * On success `data` is set to the payload, which must be free'd by the caller
+ * unless it is the tail of the fragment buffer.
+ *
+ * Returns length of the payload on success.
+ * Return -1 if encrypted payload length is invalid or on allocation failure.
+ * Return -2 on decryption failure.
+ * Return -3 if plaintext payload length is invalid.
+ */
+non_null()
+static int group_packet_unwrap_fragment(const Logger *log, GC_Connection *gconn, uint8_t **data, uint64_t *message_id,
+                                        uint8_t *packet_type, const uint8_t *packet, uint16_t length)
+{
+    if (length <= CRYPTO_NONCE_SIZE + CRYPTO_MAC_SIZE) {
+        LOGGER_FATAL(log, "Invalid packet length: %u", length);
+        return -1;
+    }
+
+    const uint16_t plain_size = length - CRYPTO_NONCE_SIZE - CRYPTO_MAC_SIZE;
+    uint8_t *tail = gcc_fragment_buffer_tail(gconn);
+
+    if (tail == nullptr || plain_size > GC_FRAGMENT_HEADROOM + MAX_GC_PACKET_SIZE - gconn->fragment_length) {
+        *data = (uint8_t *)malloc(length);
+
+        if (*data == nullptr) {
+            return -1;
         }
+
+        return group_packet_unwrap(log, gconn, *data, message_id, packet_type, packet, length);
     }
 
-    uint32_t header_len = sizeof(uint8_t);
-    *packet_type = real_plain[0];
-    plain_len -= sizeof(uint8_t);
+    uint8_t *plain = tail - GC_FRAGMENT_HEADROOM;
+    uint8_t overwritten[GC_FRAGMENT_HEADROOM];
+    memcpy(overwritten, plain, sizeof(overwritten));
 
-    if (message_id != nullptr) {
-        net_unpack_u64(real_plain + sizeof(uint8_t), message_id);
-        plain_len -= GC_MESSAGE_ID_BYTES;
-        header_len += GC_MESSAGE_ID_BYTES;
+    const int plain_len = decrypt_data_symmetric(gconn->session_shared_key, packet, packet + CRYPTO_NONCE_SIZE,
+                          length - CRYPTO_NONCE_SIZE, plain);
+
+    int payload_len = plain_len == 0 ? -3 : -2;
+    uint32_t header_len = 0;
+
+    if (plain_len > 0) {
+        payload_len = unpack_group_packet_header(plain, plain_len, message_id, packet_type, &header_len);
     }
 
-    memcpy(data, real_plain + header_len, plain_len);
+    if (payload_len >= 0 && *packet_type == GP_FRAGMENT) {
+        /* only padded fragments, i.e. the last one of a sequence, need moving */
+        if (header_len != GC_FRAGMENT_HEADROOM) {
+            memmove(tail, plain + header_len, payload_len);
+        }
 
-    free(plain);
+        *data = tail;
+    } else if (payload_len >= 0) {
+        *data = (uint8_t *)malloc(length);
 
-    return plain_len;
+        if (*data == nullptr) {
+            payload_len = -1;
+        } else {
+            memcpy(*data, plain + header_len, payload_len);
+        }
+    }
+
+    memcpy(plain, overwritten, sizeof(overwritten));
+
+    return payload_len;
 }
 
 int group_packet_wrap(
@@ -2301,7 +2569,394 @@ static bool send_gc_broadcast_message(const GC_Chat *chat, const uint8_t *data,
 
     const uint16_t packet_len = make_gc_broadcast_header(data, length, packet, bc_type);
 
-    send_gc_lossless_packet_all_peers(chat, packet, packet_len, GP_BROADCAST);
+    send_gc_lossless_packet_all_peers(chat, packet, packet_len, GP_BROADCAST);
+
+    free(packet);
+
+    return true;
+}
+
+/** @brief Returns true if broadcasts of type `bc_type` may be relayed.
+ *
+ * Exits and moderation events change how every peer treats the sender or
+ * target, so they are always sent to every peer directly.
+ */
+static bool gc_broadcast_type_is_relayable(uint8_t bc_type)
+{
+    return bc_type == GM_STATUS || bc_type == GM_NICK || bc_type == GM_PLAIN_MESSAGE || bc_type == GM_ACTION_MESSAGE;
+}
+
+/** @brief Puts the confirmed peers that relay broadcasts and whose public key hash is
+ * within `range_start` and `range_end` into `candidates`, except for the two peers
+ * designated by `skip_a` and `skip_b`.
+ *
+ * `candidates` must have room for `numpeers` entries.
+ *
+ * Returns the number of candidates.
+ */
+non_null()
+static uint32_t get_gc_relay_candidates(const GC_Chat *chat, uint32_t range_start, uint32_t range_end,
+                                        uint32_t skip_a, uint32_t skip_b, GC_Relay_Candidate *candidates)
+{
+    uint32_t num_candidates = 0;
+
+    for (uint32_t i = 1; i < chat->numpeers; ++i) {
+        const GC_Connection *gconn = get_gc_connection(chat, i);
+
+        assert(gconn != nullptr);
+
+        if (i == skip_a || i == skip_b || !gconn->confirmed || !gconn->relays_broadcasts) {
+            continue;
+        }
+
+        if (gconn->public_key_hash < range_start || gconn->public_key_hash > range_end) {
+            continue;
+        }
+
+        GC_Relay_Candidate *candidate = &candidates[num_candidates];
+        candidate->hash = gconn->public_key_hash;
+        candidate->peer_number = i;
+        candidate->direct = gcc_conn_is_direct(chat->mono_time, gconn);
+        ++num_candidates;
+    }
+
+    return num_candidates;
+}
+
+/** @brief Acks the relayed broadcast `id` created by the peer with public encryption key
+ * `origin_pk` to `gconn`, which tells it that every peer of the branch it sent it to has it.
+ *
+ * Returns true on success.
+ */
+non_null()
+static bool send_gc_relayed_broadcast_ack(const GC_Chat *chat, GC_Connection *gconn, const uint8_t *origin_pk,
+        uint64_t id)
+{
+    uint8_t data[GC_RELAYED_BROADCAST_ACK_SIZE];
+    memcpy(data, origin_pk, ENC_PUBLIC_KEY_SIZE);
+    net_pack_u64(data + ENC_PUBLIC_KEY_SIZE, id);
+
+    return send_lossless_group_packet(chat, gconn, data, sizeof(data), GP_RELAYED_BROADCAST_ACK);
+}
+
+/** @brief Sends the relayed broadcast `packet` directly to every peer in the range of a
+ * branch that failed, with an empty range so that they don't forward it.
+ *
+ * Returns the number of packets sent.
+ */
+non_null()
+static uint32_t repair_gc_relay_branch(GC_Chat *chat, uint8_t *packet, uint16_t length, uint32_t range_start,
+                                       uint32_t range_end)
+{
+    if (gc_relay_range_is_empty(range_start, range_end)) {
+        return 0;
+    }
+
+    const bool self_is_origin = memcmp(packet, get_enc_key(chat->self_public_key), ENC_PUBLIC_KEY_SIZE) == 0;
+    const int origin_number = self_is_origin ? 0 : get_peer_number_of_enc_pk(chat, packet, false);
+
+    if (origin_number < 0) {
+        // Peers drop the broadcasts of a peer that left
+        return 0;
+    }
+
+    GC_Relay_Candidate *candidates = (GC_Relay_Candidate *)calloc(chat->numpeers, sizeof(GC_Relay_Candidate));
+
+    if (candidates == nullptr) {
+        return 0;
+    }
+
+    const uint32_t num_candidates = get_gc_relay_candidates(chat, range_start, range_end, 0, (uint32_t)origin_number,
+                                    candidates);
+
+    net_pack_u32(packet + GC_RELAYED_BROADCAST_RANGE_OFFSET, 1);
+    net_pack_u32(packet + GC_RELAYED_BROADCAST_RANGE_OFFSET + sizeof(uint32_t), 0);
+
+    uint32_t sent = 0;
+
+    for (uint32_t i = 0; i < num_candidates; ++i) {
+        GC_Connection *gconn = get_gc_connection(chat, candidates[i].peer_number);
+
+        assert(gconn != nullptr);
+
+        if (send_lossless_group_packet(chat, gconn, packet, length, GP_RELAYED_BROADCAST)) {
+            ++sent;
+        }
+    }
+
+    free(candidates);
+
+    chat->broadcast_stats.repaired += sent;
+
+    return sent;
+}
+
+/** @brief Sends the relayed broadcast `packet` to one peer of each branch of the tree
+ * below us, which is made of `candidates`. The range of each branch is written into
+ * the packet before it is sent.
+ *
+ * Branches we fail to send to are repaired right away. We wait for the others to ack
+ * the broadcast before we ack it to `parent`, the peer we got it from, or null if we
+ * created it.
+ *
+ * Returns the number of packets sent, or -1 on allocation failure.
+ */
+non_null(1, 2, 4) nullable(6)
+static int send_gc_relay_branches(GC_Chat *chat, GC_Relay_Candidate *candidates, uint32_t num_candidates,
+                                  uint8_t *packet, uint16_t length, GC_Connection *parent)
+{
+    GC_Relay_Branch *branches = (GC_Relay_Branch *)calloc(num_candidates, sizeof(GC_Relay_Branch));
+
+    if (branches == nullptr) {
+        return -1;
+    }
+
+    GC_Relay_Pending_Branch *pending = (GC_Relay_Pending_Branch *)calloc(num_candidates,
+                                       sizeof(GC_Relay_Pending_Branch));
+
+    if (pending == nullptr) {
+        free(branches);
+        return -1;
+    }
+
+    const uint32_t self_hash = chat->group[0].gconn.public_key_hash;
+    const uint32_t num_branches = gc_relay_plan(candidates, num_candidates, self_hash, chat->relay_fanout, branches);
+
+    int sent = 0;
+    uint32_t num_pending = 0;
+
+    for (uint32_t i = 0; i < num_branches; ++i) {
+        const GC_Relay_Branch *branch = &branches[i];
+        const GC_Peer *peer = get_gc_peer(chat, branch->peer_number);
+        GC_Connection *gconn = get_gc_connection(chat, branch->peer_number);
+
+        assert(peer != nullptr && gconn != nullptr);
+
+        net_pack_u32(packet + GC_RELAYED_BROADCAST_RANGE_OFFSET, branch->range_start);
+        net_pack_u32(packet + GC_RELAYED_BROADCAST_RANGE_OFFSET + sizeof(uint32_t), branch->range_end);
+
+        if (!send_lossless_group_packet(chat, gconn, packet, length, GP_RELAYED_BROADCAST)) {
+            repair_gc_relay_branch(chat, packet, length, branch->range_start, branch->range_end);
+            continue;
+        }
+
+        ++sent;
+
+        GC_Relay_Pending_Branch *waiting = &pending[num_pending];
+        ++num_pending;
+
+        memcpy(waiting->peer_pk, get_enc_key(gconn->addr.public_key), ENC_PUBLIC_KEY_SIZE);
+        waiting->peer_id = peer->peer_id;
+        waiting->range_start = branch->range_start;
+        waiting->range_end = branch->range_end;
+    }
+
+    free(branches);
+
+    uint64_t id;
+    net_unpack_u64(packet + GC_RELAYED_BROADCAST_ID_OFFSET, &id);
+
+    if (num_pending == 0) {
+        if (parent != nullptr) {
+            send_gc_relayed_broadcast_ack(chat, parent, packet, id);
+        }
+    } else if (!gc_relay_pending_add(&chat->relay_pending, packet, id, packet, length,
+                                     parent != nullptr ? get_enc_key(parent->addr.public_key) : nullptr,
+                                     pending, num_pending, mono_time_get(chat->mono_time))) {
+        LOGGER_WARNING(chat->log, "Failed to wait for the acks of a relayed broadcast");
+    }
+
+    free(pending);
+
+    return sent;
+}
+
+/** @brief Stops waiting for the pending relayed broadcast at `index`, whose branches all
+ * acked it or were repaired, and acks it to the peer we got it from.
+ */
+non_null()
+static void finish_gc_relay_pending(GC_Chat *chat, uint32_t index)
+{
+    const GC_Relay_Pending *pending = &chat->relay_pending.entries[index];
+
+    if (pending->has_parent) {
+        GC_Connection *parent = get_gc_connection(chat, get_peer_number_of_enc_pk(chat, pending->parent_pk, true));
+
+        if (parent != nullptr) {
+            send_gc_relayed_broadcast_ack(chat, parent, pending->origin_pk, pending->id);
+        }
+    }
+
+    gc_relay_pending_remove(&chat->relay_pending, index);
+}
+
+/** @brief Returns true if the peer we sent a branch of a relayed broadcast to is still
+ * connected over the connection we sent it on.
+ */
+non_null()
+static bool gc_relay_branch_peer_is_present(const GC_Chat *chat, const GC_Relay_Pending_Branch *branch)
+{
+    const GC_Peer *peer = get_gc_peer(chat, get_peer_number_of_enc_pk(chat, branch->peer_pk, true));
+
+    return peer != nullptr && peer->peer_id == branch->peer_id;
+}
+
+/** @brief Repairs the branches of the relayed broadcasts we wait for whose peer left
+ * before acking them, and forgets the broadcasts we waited for too long.
+ */
+non_null()
+static void do_gc_relay_repairs(GC_Chat *chat)
+{
+    uint32_t i = 0;
+
+    while (i < chat->relay_pending.num_entries) {
+        GC_Relay_Pending *pending = &chat->relay_pending.entries[i];
+
+        if (mono_time_is_timeout(chat->mono_time, pending->time_added, GC_RELAY_PENDING_TIMEOUT)) {
+            gc_relay_pending_remove(&chat->relay_pending, i);
+            continue;
+        }
+
+        uint32_t j = 0;
+
+        while (j < pending->num_branches) {
+            const GC_Relay_Pending_Branch *branch = &pending->branches[j];
+
+            if (gc_relay_branch_peer_is_present(chat, branch)) {
+                ++j;
+                continue;
+            }
+
+            repair_gc_relay_branch(chat, pending->packet, pending->length, branch->range_start, branch->range_end);
+            gc_relay_pending_remove_branch(pending, j);
+        }
+
+        if (pending->num_branches == 0) {
+            finish_gc_relay_pending(chat, i);
+            continue;
+        }
+
+        ++i;
+    }
+}
+
+/** @brief Sends the broadcast packet `broadcast` along a spanning tree of the peers that
+ * relay broadcasts, and directly to every other confirmed peer.
+ *
+ * Returns true if the broadcast was sent.
+ * Returns false if there are too few relaying peers to be worth it or on allocation
+ * failure, in which case the caller should send it to every peer directly.
+ */
+non_null()
+static bool send_gc_relayed_broadcast(GC_Chat *chat, const uint8_t *broadcast, uint16_t broadcast_length)
+{
+    GC_Relay_Candidate *candidates = (GC_Relay_Candidate *)calloc(chat->numpeers, sizeof(GC_Relay_Candidate));
+
+    if (candidates == nullptr) {
+        return false;
+    }
+
+    const uint32_t num_candidates = get_gc_relay_candidates(chat, 0, UINT32_MAX, 0, 0, candidates);
+
+    if (num_candidates <= chat->relay_fanout) {
+        free(candidates);
+        return false;
+    }
+
+    const uint16_t length = GC_RELAYED_BROADCAST_HEADER_SIZE + broadcast_length;
+    uint8_t *packet = (uint8_t *)malloc(length);
+
+    if (packet == nullptr) {
+        free(candidates);
+        return false;
+    }
+
+    ++chat->relay_message_id;
+
+    memcpy(packet, get_enc_key(chat->self_public_key), ENC_PUBLIC_KEY_SIZE);
+    net_pack_u64(packet + GC_RELAYED_BROADCAST_ID_OFFSET, chat->relay_message_id);
+    memcpy(packet + GC_RELAYED_BROADCAST_HEADER_SIZE, broadcast, broadcast_length);
+
+    if (!crypto_signature_create(packet + GC_RELAYED_BROADCAST_SIG_OFFSET, packet + GC_RELAYED_BROADCAST_ID_OFFSET,
+                                 length - GC_RELAYED_BROADCAST_ID_OFFSET, get_sig_sk(chat->self_secret_key))) {
+        LOGGER_ERROR(chat->log, "Failed to sign relayed broadcast");
+        free(packet);
+        free(candidates);
+        return false;
+    }
+
+    const int sent = send_gc_relay_branches(chat, candidates, num_candidates, packet, length, nullptr);
+
+    free(packet);
+    free(candidates);
+
+    if (sent < 0) {
+        return false;
+    }
+
+    GC_Broadcast_Stats *stats = &chat->broadcast_stats;
+    stats->packets += (uint64_t)sent;
+    stats->bytes += (uint64_t)sent * length;
+
+    // Peers that don't relay broadcasts aren't part of the tree
+    for (uint32_t i = 1; i < chat->numpeers; ++i) {
+        GC_Connection *gconn = get_gc_connection(chat, i);
+
+        assert(gconn != nullptr);
+
+        if (gconn->confirmed && !gconn->relays_broadcasts
+                && send_lossless_group_packet(chat, gconn, broadcast, broadcast_length, GP_BROADCAST)) {
+            ++stats->packets;
+            stats->bytes += broadcast_length;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Sends a group broadcast of a type that may be relayed.
+ *
+ * If relaying is enabled and enough peers relay broadcasts, the broadcast is
+ * sent along a spanning tree. Otherwise it is sent to every confirmed peer.
+ *
+ * Returns true on success.
+ */
+non_null(1) nullable(2)
+static bool send_gc_relayable_broadcast(GC_Chat *chat, const uint8_t *data, uint16_t length, uint8_t bc_type)
+{
+    assert(gc_broadcast_type_is_relayable(bc_type));
+
+    if (length + GC_BROADCAST_ENC_HEADER_SIZE + GC_RELAYED_BROADCAST_HEADER_SIZE > MAX_GC_PACKET_SIZE) {
+        LOGGER_ERROR(chat->log, "Failed to broadcast message: invalid length %u", length);
+        return false;
+    }
+
+    uint8_t *packet = (uint8_t *)malloc(length + GC_BROADCAST_ENC_HEADER_SIZE);
+
+    if (packet == nullptr) {
+        return false;
+    }
+
+    const uint16_t packet_len = make_gc_broadcast_header(data, length, packet, bc_type);
+
+    GC_Broadcast_Stats *stats = &chat->broadcast_stats;
+    ++stats->sent;
+
+    if (chat->relay_fanout > 0 && send_gc_relayed_broadcast(chat, packet, packet_len)) {
+        free(packet);
+        return true;
+    }
+
+    for (uint32_t i = 1; i < chat->numpeers; ++i) {
+        GC_Connection *gconn = get_gc_connection(chat, i);
+
+        assert(gconn != nullptr);
+
+        if (gconn->confirmed && send_lossless_group_packet(chat, gconn, packet, packet_len, GP_BROADCAST)) {
+            ++stats->packets;
+            stats->bytes += packet_len;
+        }
+    }
 
     free(packet);
 
@@ -2447,7 +3102,7 @@ static int handle_gc_ping(GC_Chat *chat, GC_Connection *gconn, const uint8_t *da
 int gc_set_self_status(const Messenger *m, int group_number, Group_Peer_Status status)
 {
     const GC_Session *c = m->group_handler;
-    const GC_Chat *chat = gc_get_group(c, group_number);
+    GC_Chat *chat = gc_get_group(c, group_number);
 
     if (chat == nullptr) {
         return -1;
@@ -2458,7 +3113,7 @@ int gc_set_self_status(const Messenger *m, int group_number, Group_Peer_Status s
     uint8_t data[1];
     data[0] = gc_get_self_status(chat);
 
-    if (!send_gc_broadcast_message(chat, data, 1, GM_STATUS)) {
+    if (!send_gc_relayable_broadcast(chat, data, 1, GM_STATUS)) {
         return -2;
     }
 
@@ -2546,7 +3201,7 @@ static bool send_self_to_peer(const GC_Chat *chat, GC_Connection *gconn)
 
     copy_self(chat, self);
 
-    const uint16_t data_size = PACKED_GC_PEER_SIZE + sizeof(uint16_t) + MAX_GC_PASSWORD_SIZE;
+    const uint16_t data_size = PACKED_GC_PEER_SIZE + sizeof(uint16_t) + MAX_GC_PASSWORD_SIZE + sizeof(uint8_t);
     uint8_t *data = (uint8_t *)malloc(data_size);
 
     if (data == nullptr) {
@@ -2575,6 +3230,12 @@ static bool send_self_to_peer(const GC_Chat *chat, GC_Connection *gconn)
         return false;
     }
 
+    // Peers that don't know about the flags ignore them
+    if (chat->relay_fanout > 0) {
+        data[length] = GC_PEER_INFO_RELAYS_BROADCASTS;
+        ++length;
+    }
+
     const bool ret = send_lossless_group_packet(chat, gconn, data, length, GP_PEER_INFO_RESPONSE);
 
     free(data);
@@ -2694,12 +3355,16 @@ static int handle_gc_peer_info_response(const GC_Session *c, GC_Chat *chat, uint
         return -8;
     }
 
-    if (unpack_gc_peer(peer_info, data + unpacked_len, length - unpacked_len) == -1) {
+    const int packed_peer_len = unpack_gc_peer(peer_info, data + unpacked_len, length - unpacked_len);
+
+    if (packed_peer_len == -1) {
         LOGGER_ERROR(chat->log, "unpack_gc_peer() failed");
         free(peer_info);
         return -6;
     }
 
+    unpacked_len += packed_peer_len;
+
     if (peer_update(chat, peer_info, peer_number) == -1) {
         LOGGER_WARNING(chat->log, "peer_update() failed");
         free(peer_info);
@@ -2710,6 +3375,7 @@ static int handle_gc_peer_info_response(const GC_Session *c, GC_Chat *chat, uint
 
     const bool was_confirmed = gconn->confirmed;
     gconn->confirmed = true;
+    gconn->relays_broadcasts = length > unpacked_len && (data[unpacked_len] & GC_PEER_INFO_RELAYS_BROADCASTS) != 0;
 
     update_gc_peer_roles(chat);
 
@@ -3066,6 +3732,19 @@ static int handle_gc_sanctions_list_error(GC_Chat *chat)
     return 0;
 }
 
+/** @brief Returns true if a sanctions list with credentials `creds` should replace ours. */
+non_null()
+static bool is_newer_gc_sanctions_list(const Moderation *moderation, const Mod_Sanction_Creds *creds)
+{
+    if (creds->version < moderation->sanctions_creds.version) {
+        return false;
+    }
+
+    // this may occur if two mods change the sanctions list at the exact same time
+    return creds->version != moderation->sanctions_creds.version
+           || creds->checksum > moderation->sanctions_creds.checksum;
+}
+
 /** @brief Handles a sanctions list packet.
  *
  * Return 0 if packet is handled correctly.
@@ -3105,20 +3784,20 @@ static int handle_gc_sanctions_list(const GC_Session *c, GC_Chat *chat, const ui
         return handle_gc_sanctions_list_error(chat);
     }
 
-    if (!sanctions_list_check_integrity(&chat->moderation, &creds, sanctions, num_sanctions)) {
-        LOGGER_WARNING(chat->log, "Sanctions list failed integrity check");
+    // We'd ignore an older list even if it were valid, so don't spend time verifying it. Without a
+    // list of our own an invalid one is an error though.
+    if (chat->moderation.sanctions_creds.version > 0 && !is_newer_gc_sanctions_list(&chat->moderation, &creds)) {
         free(sanctions);
-        return handle_gc_sanctions_list_error(chat);
+        return 0;
     }
 
-    if (creds.version < chat->moderation.sanctions_creds.version) {
+    if (!sanctions_list_check_integrity(&chat->moderation, &creds, sanctions, num_sanctions)) {
+        LOGGER_WARNING(chat->log, "Sanctions list failed integrity check");
         free(sanctions);
-        return 0;
+        return handle_gc_sanctions_list_error(chat);
     }
 
-    // this may occur if two mods change the sanctions list at the exact same time
-    if (creds.version == chat->moderation.sanctions_creds.version
-            && creds.checksum <= chat->moderation.sanctions_creds.checksum) {
+    if (!is_newer_gc_sanctions_list(&chat->moderation, &creds)) {
         free(sanctions);
         return 0;
     }
@@ -3469,7 +4148,7 @@ void gc_get_group_peer_connection_ip(const Messenger *m, int group_number, uint3
 int gc_set_self_nick(const Messenger *m, int group_number, const uint8_t *nick, uint16_t length)
 {
     const GC_Session *c = m->group_handler;
-    const GC_Chat *chat = gc_get_group(c, group_number);
+    GC_Chat *chat = gc_get_group(c, group_number);
 
     if (chat == nullptr) {
         return -1;
@@ -3487,7 +4166,7 @@ int gc_set_self_nick(const Messenger *m, int group_number, const uint8_t *nick,
         return -2;
     }
 
-    if (!send_gc_broadcast_message(chat, nick, length, GM_NICK)) {
+    if (!send_gc_relayable_broadcast(chat, nick, length, GM_NICK)) {
         return -4;
     }
 
@@ -4875,7 +5554,7 @@ int gc_founder_set_max_peers(GC_Chat *chat, uint16_t max_peers)
     return 0;
 }
 
-int gc_send_message(const GC_Chat *chat, const uint8_t *message, uint16_t length, uint8_t type, uint32_t *message_id)
+int gc_send_message(GC_Chat *chat, const uint8_t *message, uint16_t length, uint8_t type, uint32_t *message_id)
 {
     if (length > MAX_GC_MESSAGE_SIZE) {
         return -1;
@@ -4910,7 +5589,7 @@ int gc_send_message(const GC_Chat *chat, const uint8_t *message, uint16_t length
     net_pack_u32(message_raw, pseudo_msg_id);
     memcpy(message_raw + GC_MESSAGE_PSEUDO_ID_SIZE, message, length);
 
-    if (!send_gc_broadcast_message(chat, message_raw, length_raw, packet_type)) {
+    if (!send_gc_relayable_broadcast(chat, message_raw, length_raw, packet_type)) {
         free(message_raw);
         return -5;
     }
@@ -5314,7 +5993,7 @@ bool gc_send_message_ack(const GC_Chat *chat, GC_Connection *gconn, uint64_t mes
  * Return -3 if we failed to re-send a requested packet.
  */
 non_null()
-static int handle_gc_message_ack(const GC_Chat *chat, GC_Connection *gconn, const uint8_t *data, uint16_t length)
+static int handle_gc_message_ack(GC_Chat *chat, GC_Connection *gconn, const uint8_t *data, uint16_t length)
 {
     if (length < GC_LOSSLESS_ACK_PACKET_SIZE) {
         return -1;
@@ -5337,6 +6016,10 @@ static int handle_gc_message_ack(const GC_Chat *chat, GC_Connection *gconn, cons
         return 0;
     }
 
+    if (gconn->send_array == nullptr) {
+        return 0;
+    }
+
     const uint64_t tm = mono_time_get(chat->mono_time);
     const uint16_t idx = gcc_get_array_index(message_id);
 
@@ -5347,6 +6030,7 @@ static int handle_gc_message_ack(const GC_Chat *chat, GC_Connection *gconn, cons
                 gconn->send_array[idx].message_id,
                 gconn->send_array[idx].packet_type)) {
             gconn->send_array[idx].last_send_try = tm;
+            ++chat->lossless_stats.resent_on_request;
             LOGGER_DEBUG(chat->log, "Re-sent requested packet %llu", (unsigned long long)message_id);
         } else {
             return -3;
@@ -5495,6 +6179,183 @@ static int handle_gc_broadcast(const GC_Session *c, GC_Chat *chat, uint32_t peer
     return 0;
 }
 
+/** @brief Forwards the relayed broadcast `data` to the peers whose public key hash is within
+ * `range_start` and `range_end`, except for the peers who sent and created it.
+ *
+ * The sender gets an ack once every peer in the range has the broadcast.
+ */
+non_null()
+static void forward_gc_relayed_broadcast(GC_Chat *chat, const uint8_t *data, uint16_t length, uint32_t range_start,
+        uint32_t range_end, uint32_t sender_number, uint32_t origin_number, uint64_t relay_id)
+{
+    GC_Connection *sender = get_gc_connection(chat, sender_number);
+
+    assert(sender != nullptr);
+
+    GC_Relay_Candidate *candidates = (GC_Relay_Candidate *)calloc(chat->numpeers, sizeof(GC_Relay_Candidate));
+
+    if (candidates == nullptr) {
+        return;
+    }
+
+    const uint32_t num_candidates = get_gc_relay_candidates(chat, range_start, range_end, sender_number,
+                                    origin_number, candidates);
+
+    if (num_candidates == 0) {
+        free(candidates);
+        send_gc_relayed_broadcast_ack(chat, sender, data, relay_id);
+        return;
+    }
+
+    uint8_t *packet = (uint8_t *)malloc(length);
+
+    if (packet == nullptr) {
+        free(candidates);
+        return;
+    }
+
+    memcpy(packet, data, length);
+
+    const int sent = send_gc_relay_branches(chat, candidates, num_candidates, packet, length, sender);
+
+    free(packet);
+    free(candidates);
+
+    if (sent > 0) {
+        chat->broadcast_stats.relayed += (uint64_t)sent;
+        chat->broadcast_stats.relayed_bytes += (uint64_t)sent * length;
+    }
+}
+
+/** @brief Handles a relayed broadcast packet.
+ *
+ * The broadcast is forwarded to the branch of the tree we are responsible for,
+ * then handled as if the peer who created it had sent it to us directly.
+ *
+ * Returns 0 if packet is handled correctly or is a duplicate.
+ * Returns -1 if packet has invalid size or type.
+ * Returns -2 if the sender or the origin is not a confirmed peer.
+ * Returns -3 if the signature fails to validate.
+ * Returns -4 if the broadcast fails to be handled.
+ * Returns -5 on allocation failure.
+ */
+non_null(1, 2, 4) nullable(6)
+static int handle_gc_relayed_broadcast(const GC_Session *c, GC_Chat *chat, uint32_t peer_number, const uint8_t *data,
+                                       uint16_t length, void *userdata)
+{
+    if (length < GC_RELAYED_BROADCAST_HEADER_SIZE + GC_BROADCAST_ENC_HEADER_SIZE) {
+        return -1;
+    }
+
+    const uint8_t *broadcast = data + GC_RELAYED_BROADCAST_HEADER_SIZE;
+    const uint16_t broadcast_length = length - GC_RELAYED_BROADCAST_HEADER_SIZE;
+
+    if (!gc_broadcast_type_is_relayable(broadcast[0])) {
+        return -1;
+    }
+
+    GC_Connection *sender = get_gc_connection(chat, peer_number);
+
+    if (sender == nullptr || !sender->confirmed) {
+        return -2;
+    }
+
+    const int origin_number = get_peer_number_of_enc_pk(chat, data, true);
+
+    if (origin_number <= 0) {
+        return -2;
+    }
+
+    const GC_Connection *origin = get_gc_connection(chat, origin_number);
+
+    if (origin == nullptr) {
+        return -2;
+    }
+
+    if (!crypto_signature_verify(data + GC_RELAYED_BROADCAST_SIG_OFFSET, data + GC_RELAYED_BROADCAST_ID_OFFSET,
+                                 length - GC_RELAYED_BROADCAST_ID_OFFSET, get_sig_pk(origin->addr.public_key))) {
+        return -3;
+    }
+
+    uint64_t relay_id;
+    net_unpack_u64(data + GC_RELAYED_BROADCAST_ID_OFFSET, &relay_id);
+
+    // The window is kept by signature key, so broadcasts the origin sent before
+    // it last reconnected are still recognised
+    const int is_new = gc_relay_origins_check(&chat->relay_origins, get_sig_pk(origin->addr.public_key), relay_id);
+
+    if (is_new < 0) {
+        return -5;
+    }
+
+    if (is_new == 0) {
+        ++chat->broadcast_stats.duplicates;
+        // The sender still waits for our branch to ack it
+        send_gc_relayed_broadcast_ack(chat, sender, data, relay_id);
+        return 0;
+    }
+
+    uint32_t range_start;
+    uint32_t range_end;
+    net_unpack_u32(data + GC_RELAYED_BROADCAST_RANGE_OFFSET, &range_start);
+    net_unpack_u32(data + GC_RELAYED_BROADCAST_RANGE_OFFSET + sizeof(uint32_t), &range_end);
+
+    // Forward first: handling the broadcast runs callbacks that may change the peer list
+    if (gc_relay_range_is_empty(range_start, range_end)) {
+        send_gc_relayed_broadcast_ack(chat, sender, data, relay_id);
+    } else {
+        forward_gc_relayed_broadcast(chat, data, length, range_start, range_end, peer_number, (uint32_t)origin_number,
+                                     relay_id);
+    }
+
+    if (handle_gc_broadcast(c, chat, (uint32_t)origin_number, broadcast, broadcast_length, userdata) != 0) {
+        return -4;
+    }
+
+    return 0;
+}
+
+/** @brief Handles an ack from `gconn` for a relayed broadcast we sent to its branch.
+ *
+ * Once every branch acked the broadcast, we ack it to the peer we got it from.
+ *
+ * Returns 0 if packet is handled correctly.
+ * Returns -1 if packet has invalid size.
+ */
+non_null()
+static int handle_gc_relayed_broadcast_ack(GC_Chat *chat, const GC_Connection *gconn, const uint8_t *data,
+        uint16_t length)
+{
+    if (length != GC_RELAYED_BROADCAST_ACK_SIZE) {
+        return -1;
+    }
+
+    uint64_t relay_id;
+    net_unpack_u64(data + ENC_PUBLIC_KEY_SIZE, &relay_id);
+
+    const int index = gc_relay_pending_find(&chat->relay_pending, data, relay_id);
+
+    if (index == -1) {
+        // We sent it to repair a branch, or gave up waiting for it
+        return 0;
+    }
+
+    GC_Relay_Pending *pending = &chat->relay_pending.entries[index];
+
+    for (uint32_t i = 0; i < pending->num_branches; ++i) {
+        if (memcmp(pending->branches[i].peer_pk, get_enc_key(gconn->addr.public_key), ENC_PUBLIC_KEY_SIZE) == 0) {
+            gc_relay_pending_remove_branch(pending, i);
+            break;
+        }
+    }
+
+    if (pending->num_branches == 0) {
+        finish_gc_relay_pending(chat, (uint32_t)index);
+    }
+
+    return 0;
+}
+
 /** @brief Decrypts data of size `length` using self secret key and sender's public key.
  *
  * The packet payload should begin with a nonce.
@@ -5728,7 +6589,7 @@ static bool send_gc_oob_handshake_request(const GC_Chat *chat, const GC_Connecti
  * Returns -1 on failure.
  */
 non_null()
-static int handle_gc_handshake_response(const GC_Chat *chat, const uint8_t *sender_pk, const uint8_t *data,
+static int handle_gc_handshake_response(GC_Chat *chat, const uint8_t *sender_pk, const uint8_t *data,
                                         uint16_t length)
 {
     // this should be checked at lower level; this is a redundant defense check. Ideally we should
@@ -5754,7 +6615,7 @@ static int handle_gc_handshake_response(const GC_Chat *chat, const uint8_t *send
 
     gcc_make_session_shared_key(gconn, sender_session_pk);
 
-    set_sig_pk(gconn->addr.public_key, data + ENC_PUBLIC_KEY_SIZE);
+    set_peer_sig_pk(chat, peer_number, data + ENC_PUBLIC_KEY_SIZE);
 
     gcc_set_recv_message_id(gconn, 2);  // handshake response is always second packet
 
@@ -5913,7 +6774,7 @@ static int handle_gc_handshake_request(GC_Chat *chat, const IP_Port *ipp, const
 
     gcc_make_session_shared_key(gconn, sender_session_pk);
 
-    set_sig_pk(gconn->addr.public_key, public_sig_key);
+    set_peer_sig_pk(chat, peer_number, public_sig_key);
 
     if (join_type == HJ_PUBLIC && !is_public_chat(chat)) {
         gcc_mark_for_deletion(gconn, chat->tcp_conn, GC_EXIT_TYPE_DISCONNECTED, nullptr, 0);
@@ -6008,6 +6869,16 @@ bool handle_gc_lossless_helper(const GC_Session *c, GC_Chat *chat, uint32_t peer
             break;
         }
 
+        case GP_RELAYED_BROADCAST: {
+            ret = handle_gc_relayed_broadcast(c, chat, peer_number, data, length, userdata);
+            break;
+        }
+
+        case GP_RELAYED_BROADCAST_ACK: {
+            ret = handle_gc_relayed_broadcast_ack(chat, gconn, data, length);
+            break;
+        }
+
         case GP_PEER_INFO_REQUEST: {
             ret = handle_gc_peer_info_request(chat, peer_number);
             break;
@@ -6169,29 +7040,40 @@ static bool handle_gc_lossless_packet(const GC_Session *c, GC_Chat *chat, const
         return true;
     }
 
-    uint8_t *data = (uint8_t *)malloc(length);
-
-    if (data == nullptr) {
-        LOGGER_DEBUG(chat->log, "Failed to allocate memory for packet data buffer");
-        return false;
-    }
-
+    uint8_t *data = nullptr;
     uint8_t packet_type;
     uint64_t message_id;
+    int len;
+
+    if (gconn->last_chunk_id != 0) {
+        len = group_packet_unwrap_fragment(chat->log, gconn, &data, &message_id, &packet_type, packet, length);
+    } else {
+        data = (uint8_t *)malloc(length);
+
+        if (data == nullptr) {
+            LOGGER_DEBUG(chat->log, "Failed to allocate memory for packet data buffer");
+            return false;
+        }
 
-    const int len = group_packet_unwrap(chat->log, gconn, data, &message_id, &packet_type, packet, length);
+        len = group_packet_unwrap(chat->log, gconn, data, &message_id, &packet_type, packet, length);
+    }
+
+    /* a fragment that was decrypted into the fragment buffer belongs to the buffer */
+    const bool in_place = data != nullptr && gconn->fragment_buffer != nullptr
+                          && data == gconn->fragment_buffer + GC_FRAGMENT_HEADROOM + gconn->fragment_length;
+    uint8_t *owned_data = in_place ? nullptr : data;
 
     if (len < 0) {
         Ip_Ntoa ip_str;
         LOGGER_DEBUG(chat->log, "Failed to unwrap lossless packet from %s:%d: %d",
                      net_ip_ntoa(&gconn->addr.ip_port.ip, &ip_str), net_ntohs(gconn->addr.ip_port.port), len);
-        free(data);
+        free(owned_data);
         return false;
     }
 
     if (!gconn->handshaked && (packet_type != GP_HS_RESPONSE_ACK && packet_type != GP_INVITE_REQUEST)) {
         LOGGER_DEBUG(chat->log, "Got lossless packet type 0x%02x from unconfirmed peer", packet_type);
-        free(data);
+        free(owned_data);
         return false;
     }
 
@@ -6201,7 +7083,7 @@ static bool handle_gc_lossless_packet(const GC_Session *c, GC_Chat *chat, const
     if (message_id == 3 && is_invite_packet && gconn->received_message_id <= 1) {
         // we missed initial handshake request. Drop this packet and wait for another handshake request.
         LOGGER_DEBUG(chat->log, "Missed handshake packet, type: 0x%02x", packet_type);
-        free(data);
+        free(owned_data);
         return false;
     }
 
@@ -6209,20 +7091,20 @@ static bool handle_gc_lossless_packet(const GC_Session *c, GC_Chat *chat, const
                              packet_type, message_id, direct_conn);
 
     if (packet_type == GP_INVITE_REQUEST && !gconn->handshaked) {  // Both peers sent request at same time
-        free(data);
+        free(owned_data);
         return true;
     }
 
     if (lossless_ret < 0) {
         LOGGER_DEBUG(chat->log, "failed to handle packet %llu (type: 0x%02x, id: %llu)",
                      (unsigned long long)message_id, packet_type, (unsigned long long)message_id);
-        free(data);
+        free(owned_data);
         return false;
     }
 
     /* Duplicate packet */
     if (lossless_ret == 0) {
-        free(data);
+        free(owned_data);
         return gc_send_message_ack(chat, gconn, message_id, GR_ACK_RECV);
     }
 
@@ -6230,7 +7112,7 @@ static bool handle_gc_lossless_packet(const GC_Session *c, GC_Chat *chat, const
     if (lossless_ret == 1) {
         LOGGER_TRACE(chat->log, "received out of order packet from peer %u. expected %llu, got %llu", peer_number,
                      (unsigned long long)gconn->received_message_id + 1, (unsigned long long)message_id);
-        free(data);
+        free(owned_data);
         return gc_send_message_ack(chat, gconn, gconn->received_message_id + 1, GR_ACK_REQ);
     }
 
@@ -6238,13 +7120,13 @@ static bool handle_gc_lossless_packet(const GC_Session *c, GC_Chat *chat, const
     if (lossless_ret == 3) {
         const bool frag_ret = handle_gc_packet_fragment(c, chat, peer_number, gconn, data, (uint16_t)len, packet_type,
                               message_id, userdata);
-        free(data);
+        free(owned_data);
         return frag_ret;
     }
 
     const bool ret = handle_gc_lossless_helper(c, chat, peer_number, data, (uint16_t)len, packet_type, userdata);
 
-    free(data);
+    free(owned_data);
 
     if (!ret) {
         return false;
@@ -6721,22 +7603,37 @@ static bool peer_delete(const GC_Session *c, GC_Chat *chat, uint32_t peer_number
     uint8_t nick[MAX_GC_NICK_SIZE];
     const uint16_t nick_length = peer->nick_length;
     const GC_Exit_Info exit_info = peer->gconn.exit_info;
+    uint8_t sig_pk[SIG_PUBLIC_KEY_SIZE];
 
     assert(nick_length <= MAX_GC_NICK_SIZE);
     memcpy(nick, peer->nick, nick_length);
+    memcpy(sig_pk, get_sig_pk(peer->gconn.addr.public_key), SIG_PUBLIC_KEY_SIZE);
+
+    unindex_peer(chat, peer_number);
 
     gcc_peer_cleanup(&peer->gconn);
 
     --chat->numpeers;
 
     if (chat->numpeers != peer_number) {
+        // Removing the moved peer frees the room its new entries need, so adding them back can't fail
+        unindex_peer(chat, chat->numpeers);
         chat->group[peer_number] = chat->group[chat->numpeers];
+        index_peer(chat, peer_number);
     }
 
+    chat->peer_id_hint = min_u32(chat->peer_id_hint, peer_id);
+
     chat->group[chat->numpeers] = (GC_Peer) {
         0
     };
 
+    // A peer that left for good has no use for its relay window, unless it already rejoined
+    if ((exit_info.exit_type == GC_EXIT_TYPE_QUIT || exit_info.exit_type == GC_EXIT_TYPE_KICKED)
+            && get_peer_number_of_sig_pk(chat, sig_pk) == -1) {
+        gc_relay_origins_remove(&chat->relay_origins, sig_pk);
+    }
+
     GC_Peer *tmp_group = (GC_Peer *)realloc(chat->group, chat->numpeers * sizeof(GC_Peer));
 
     if (tmp_group == nullptr) {
@@ -6813,21 +7710,6 @@ int peer_add(GC_Chat *chat, const IP_Port *ipp, const uint8_t *public_key)
         }
     }
 
-    GC_Message_Array_Entry *send = (GC_Message_Array_Entry *)calloc(GCC_BUFFER_SIZE, sizeof(GC_Message_Array_Entry));
-    GC_Message_Array_Entry *recv = (GC_Message_Array_Entry *)calloc(GCC_BUFFER_SIZE, sizeof(GC_Message_Array_Entry));
-
-    if (send == nullptr || recv == nullptr) {
-        LOGGER_ERROR(chat->log, "Failed to allocate memory for gconn buffers");
-
-        if (tcp_connection_num != -1) {
-            kill_tcp_connection_to(chat->tcp_conn, tcp_connection_num);
-        }
-
-        free(send);
-        free(recv);
-        return -1;
-    }
-
     GC_Peer *tmp_group = (GC_Peer *)realloc(chat->group, (chat->numpeers + 1) * sizeof(GC_Peer));
 
     if (tmp_group == nullptr) {
@@ -6837,8 +7719,6 @@ int peer_add(GC_Chat *chat, const IP_Port *ipp, const uint8_t *public_key)
             kill_tcp_connection_to(chat->tcp_conn, tcp_connection_num);
         }
 
-        free(send);
-        free(recv);
         return -1;
     }
 
@@ -6851,9 +7731,6 @@ int peer_add(GC_Chat *chat, const IP_Port *ipp, const uint8_t *public_key)
 
     GC_Connection *gconn = &chat->group[peer_number].gconn;
 
-    gconn->send_array = send;
-    gconn->recv_array = recv;
-
     gcc_set_ip_port(gconn, ipp);
     chat->group[peer_number].role = GR_USER;
     chat->group[peer_number].peer_id = peer_id;
@@ -6881,6 +7758,21 @@ int peer_add(GC_Chat *chat, const IP_Port *ipp, const uint8_t *public_key)
     gconn->self_is_closer = id_closest(get_chat_id(chat->chat_public_key),
                                        get_enc_key(chat->self_public_key),
                                        get_enc_key(gconn->addr.public_key)) == 1;
+
+    if (!index_peer(chat, peer_number)) {
+        LOGGER_ERROR(chat->log, "Failed to index peer %d", peer_number);
+
+        if (tcp_connection_num != -1) {
+            kill_tcp_connection_to(chat->tcp_conn, tcp_connection_num);
+        }
+
+        gcc_peer_cleanup(gconn);
+        --chat->numpeers;
+        return -1;
+    }
+
+    chat->peer_id_hint = peer_id + 1;
+
     return peer_number;
 }
 
@@ -6974,6 +7866,10 @@ static void do_peer_connections(const GC_Session *c, GC_Chat *chat, void *userda
 
         gcc_check_recv_array(c, chat, gconn, i, userdata);   // may change peer numbers
     }
+
+    for (uint32_t i = 1; i < chat->numpeers; ++i) {
+        gcc_free_idle_arrays(chat->mono_time, get_gc_connection(chat, i));
+    }
 }
 
 /** @brief Executes pending handshakes for peers.
@@ -7305,6 +8201,7 @@ void do_gc(GC_Session *c, void *userdata)
 
         do_new_connection_cooldown(chat);
         do_peer_delete(c, chat, userdata);
+        do_gc_relay_repairs(chat);
 
         if (chat->connection_state != state) {
             if (c->connection_status_change != nullptr) {
@@ -7318,6 +8215,56 @@ void do_gc(GC_Session *c, void *userdata)
     }
 }
 
+uint32_t gc_run_interval(const GC_Session *c)
+{
+    uint32_t interval = UINT32_MAX;
+
+    if (c == nullptr) {
+        return interval;
+    }
+
+    for (uint32_t i = 0; i < c->chats_index; ++i) {
+        const GC_Chat *chat = &c->chats[i];
+
+        if (chat->connection_state == CS_NONE) {
+            continue;
+        }
+
+        if (chat->flag_exit) {
+            return 0;
+        }
+
+        if (chat->connection_state != CS_DISCONNECTED && chat->tcp_conn != nullptr) {
+            interval = min_u32(interval, tcp_connections_run_interval(chat->tcp_conn));
+        }
+    }
+
+    return interval;
+}
+
+uint32_t gc_get_sockets(const GC_Session *c, Socket *socks, uint32_t socks_size)
+{
+    uint32_t count = 0;
+
+    if (c == nullptr) {
+        return count;
+    }
+
+    for (uint32_t i = 0; i < c->chats_index; ++i) {
+        const GC_Chat *chat = &c->chats[i];
+
+        if (chat->connection_state == CS_NONE || chat->connection_state == CS_DISCONNECTED
+                || chat->tcp_conn == nullptr) {
+            continue;
+        }
+
+        const uint32_t space = count < socks_size ? socks_size - count : 0;
+        count += tcp_connections_get_sockets(chat->tcp_conn, space > 0 ? &socks[count] : nullptr, space);
+    }
+
+    return count;
+}
+
 /** @brief Set the size of the groupchat list to n.
  *
  * Return true on success.
@@ -7460,6 +8407,26 @@ static void init_gc_moderation(GC_Chat *chat)
 non_null()
 static bool create_new_chat_ext_keypair(GC_Chat *chat);
 
+/** @brief Sets up relaying of `chat`'s broadcasts according to the options of `m`.
+ *
+ * Broadcast ids start from the current time so that they keep increasing when
+ * we rejoin before our peers have forgotten the ids we used before.
+ *
+ * Returns false on allocation failure.
+ */
+non_null()
+static bool init_gc_relay(GC_Chat *chat, const Messenger *m, uint64_t tm)
+{
+    chat->relay_fanout = min_u16(m->options.group_relay_fanout, GC_RELAY_MAX_FANOUT);
+    chat->relay_message_id = tm << 24;
+    chat->broadcast_stats = (GC_Broadcast_Stats) {
+        0
+    };
+    chat->relay_pending.num_entries = 0;
+
+    return gc_relay_origins_init(&chat->relay_origins, random_u64(chat->rng));
+}
+
 non_null()
 static int create_new_group(GC_Session *c, const uint8_t *nick, size_t nick_length, bool founder,
                             const Group_Privacy_State privacy_state)
@@ -7494,6 +8461,16 @@ static int create_new_group(GC_Session *c, const uint8_t *nick, size_t nick_leng
     chat->last_ping_interval = tm;
     chat->friend_connection_id = -1;
 
+    if (!init_gc_relay(chat, m, tm)) {
+        group_delete(c, chat);
+        return -1;
+    }
+
+    if (!init_gc_peer_indices(chat)) {
+        group_delete(c, chat);
+        return -1;
+    }
+
     if (!create_new_chat_ext_keypair(chat)) {
         LOGGER_ERROR(chat->log, "Failed to create extended keypair");
         group_delete(c, chat);
@@ -7630,6 +8607,16 @@ int gc_group_load(GC_Session *c, Bin_Unpack *bu)
     chat->last_ping_interval = tm;
     chat->friend_connection_id = -1;
 
+    if (!init_gc_relay(chat, m, tm)) {
+        LOGGER_ERROR(chat->log, "Failed to init relay windows");
+        return -1;
+    }
+
+    if (!init_gc_peer_indices(chat)) {
+        LOGGER_ERROR(chat->log, "Failed to init peer indices");
+        return -1;
+    }
+
     // Initialise these first, because we may need to log/dealloc things on cleanup.
     chat->moderation.log = m->log;
 
@@ -8264,6 +9251,10 @@ static void group_cleanup(GC_Session *c, GC_Chat *chat)
         chat->group = nullptr;
     }
 
+    cleanup_gc_peer_indices(chat);
+    gc_relay_origins_free(&chat->relay_origins);
+    gc_relay_pending_free(&chat->relay_pending);
+
     crypto_memunlock(chat->self_secret_key, sizeof(chat->self_secret_key));
     crypto_memunlock(chat->chat_secret_key, sizeof(chat->chat_secret_key));
     crypto_memunlock(chat->shared_state.password, sizeof(chat->shared_state.password));
@@ -8475,6 +9466,26 @@ void copy_peerlist(const GC_Chat *chat, uint32_t *out_list)
     }
 }
 
+void gc_get_broadcast_stats(const GC_Chat *chat, GC_Broadcast_Stats *stats)
+{
+    *stats = chat->broadcast_stats;
+}
+
+void gc_get_lossless_stats(const GC_Chat *chat, GC_Lossless_Stats *stats)
+{
+    *stats = chat->lossless_stats;
+
+    for (uint32_t i = 0; i < chat->numpeers; ++i) {
+        const GC_Connection *gconn = get_gc_connection(chat, i);
+        assert(gconn != nullptr);
+
+        stats->send_arrays += gconn->send_array != nullptr ? 1 : 0;
+        stats->recv_arrays += gconn->recv_array != nullptr ? 1 : 0;
+        stats->array_bytes += gcc_array_memory(gconn);
+        stats->in_flight += gconn->resend_queue_size;
+    }
+}
+
 GC_Chat *gc_get_group(const GC_Session *c, int group_number)
 {
     if (!group_number_valid(c, group_number)) {
@@ -21,6 +21,10 @@
 #include "group_connection.h"
 #include "logger.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define GC_PING_TIMEOUT 12
 #define GC_SEND_IP_PORT_INTERVAL (GC_PING_TIMEOUT * 5)
 #define GC_CONFIRMED_PEER_TIMEOUT (GC_PING_TIMEOUT * 4 + 10)
@@ -82,6 +86,8 @@ typedef enum Group_Packet_Type {
     GP_INVITE_RESPONSE_REJECT   = 0x03,
 
     /* lossless packets */
+    GP_RELAYED_BROADCAST_ACK    = 0xec,
+    GP_RELAYED_BROADCAST        = 0xed,
     GP_CUSTOM_PRIVATE_PACKET    = 0xee,
     GP_FRAGMENT                 = 0xef,
     GP_KEY_ROTATION             = 0xf0,
@@ -163,7 +169,7 @@ uint16_t gc_get_wrapped_packet_size(uint16_t length, Net_Packet_Type packet_type
  * Returns -5 if the packet fails to send.
  */
 non_null(1, 2, 3, 4) nullable(5)
-int gc_send_message(const GC_Chat *chat, const uint8_t *message, uint16_t length, uint8_t type,
+int gc_send_message(GC_Chat *chat, const uint8_t *message, uint16_t length, uint8_t type,
                     uint32_t *message_id);
 
 /** @brief Sends a private message to peer_id.
@@ -584,6 +590,23 @@ non_null(1) nullable(2) void gc_callback_voice_state(const Messenger *m, gc_voic
 non_null(1) nullable(2)
 void do_gc(GC_Session *c, void *userdata);
 
+/** @brief Time in ms until do_gc has work that neither incoming packets nor a
+ * whole-second timeout will trigger.
+ *
+ * @return UINT32_MAX if there is no such work.
+ */
+nullable(1)
+uint32_t gc_run_interval(const GC_Session *c);
+
+/** @brief Get the sockets of the TCP relay connections of all groups.
+ *
+ * Writes up to `socks_size` sockets to `socks`.
+ *
+ * @return the number of sockets, which may be more than `socks_size`.
+ */
+nullable(1, 2)
+uint32_t gc_get_sockets(const GC_Session *c, Socket *socks, uint32_t socks_size);
+
 /**
  * Make sure that DHT is initialized before calling this.
  * Returns a NULL pointer on failure.
@@ -746,6 +769,14 @@ bool gc_peer_number_is_valid(const GC_Chat *chat, int peer_number);
 non_null()
 GC_Chat *gc_get_group(const GC_Session *c, int group_number);
 
+/** @brief Copies the counters of the broadcasts `chat` sent and relayed into `stats`. */
+non_null()
+void gc_get_broadcast_stats(const GC_Chat *chat, GC_Broadcast_Stats *stats);
+
+/** @brief Copies the memory and retransmission counters of the connections of `chat` into `stats`. */
+non_null()
+void gc_get_lossless_stats(const GC_Chat *chat, GC_Lossless_Stats *stats);
+
 /** @brief Sends a lossy message acknowledgement to peer associated with `gconn`.
  *
  * If `type` is GR_ACK_RECV we send a read-receipt for read_id's packet. If `type` is GR_ACK_REQ
@@ -808,4 +839,8 @@ GC_Chat *gc_get_group_by_public_key(const GC_Session *c, const uint8_t *public_k
 non_null()
 int gc_add_peers_from_announces(GC_Chat *chat, const GC_Announce *announces, uint8_t gc_announces_count);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif  // GROUP_CHATS_H
@@ -0,0 +1,213 @@
+#include "group_chats.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "crypto_core.h"
+#include "group_common.h"
+#include "group_connection.h"
+#include "list.h"
+#include "tox.h"
+#include "tox_struct.h"
+
+namespace {
+
+using EncPublicKey = std::array<uint8_t, ENC_PUBLIC_KEY_SIZE>;
+using SigPublicKey = std::array<uint8_t, SIG_PUBLIC_KEY_SIZE>;
+
+class GroupPeerIndex : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        Tox_Options *options = tox_options_new(nullptr);
+        ASSERT_NE(options, nullptr);
+        tox_options_set_ipv6_enabled(options, false);
+        tox_options_set_local_discovery_enabled(options, false);
+        tox_options_set_udp_enabled(options, false);
+        tox_ = tox_new(options, nullptr);
+        tox_options_free(options);
+        ASSERT_NE(tox_, nullptr);
+
+        const uint8_t name[] = "test";
+        const uint32_t group_number = tox_group_new(tox_, TOX_GROUP_PRIVACY_STATE_PRIVATE, name, sizeof(name) - 1,
+                                      name, sizeof(name) - 1, nullptr);
+        session_ = tox_->m->group_handler;
+        chat_ = gc_get_group(session_, group_number);
+        ASSERT_NE(chat_, nullptr);
+
+        rng_ = system_random();
+        ASSERT_NE(rng_, nullptr);
+    }
+
+    void TearDown() override { tox_kill(tox_); }
+
+    EncPublicKey random_enc_key()
+    {
+        EncPublicKey key;
+        random_bytes(rng_, key.data(), key.size());
+        return key;
+    }
+
+    int add(const EncPublicKey &key) { return peer_add(chat_, nullptr, key.data()); }
+
+    /** Adds a peer and gives it a random signature key, as the handshake would. */
+    int add_with_sig_key(const EncPublicKey &key)
+    {
+        const int peer_number = add(key);
+
+        if (peer_number >= 0) {
+            SigPublicKey sig_key;
+            random_bytes(rng_, sig_key.data(), sig_key.size());
+            set_peer_sig_pk(chat_, peer_number, sig_key.data());
+        }
+
+        return peer_number;
+    }
+
+    void mark_for_deletion(uint32_t peer_number)
+    {
+        gcc_mark_for_deletion(&chat_->group[peer_number].gconn, chat_->tcp_conn, GC_EXIT_TYPE_NO_CALLBACK, nullptr,
+                              0);
+    }
+
+    /** Runs the main loop until no peer is waiting to be deleted any more. */
+    void delete_marked_peers()
+    {
+        for (uint32_t i = 0; i < 16 && has_marked_peers(); ++i) {
+            do_gc(session_, nullptr);
+        }
+
+        ASSERT_FALSE(has_marked_peers());
+    }
+
+    bool has_marked_peers() const
+    {
+        for (uint32_t i = 1; i < chat_->numpeers; ++i) {
+            if (chat_->group[i].gconn.pending_delete) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    int find_by_enc_key(const EncPublicKey &key) const { return hash_list_find(&chat_->peers_by_enc_pk, key.data()); }
+
+    int find_by_peer_id(uint32_t peer_id) const
+    {
+        uint8_t key[sizeof(uint32_t)];
+        memcpy(key, &peer_id, sizeof(key));
+        return hash_list_find(&chat_->peers_by_id, key);
+    }
+
+    /** Checks that every peer other than ourselves can be found through each of the indices. */
+    void expect_indices_match_peers() const
+    {
+        for (uint32_t i = 1; i < chat_->numpeers; ++i) {
+            const GC_Peer *peer = &chat_->group[i];
+            const uint8_t *public_key = peer->gconn.addr.public_key;
+
+            EXPECT_EQ(find_by_peer_id(peer->peer_id), static_cast<int>(i));
+            EXPECT_EQ(hash_list_find(&chat_->peers_by_sig_pk, get_sig_pk(public_key)), static_cast<int>(i));
+
+            if (!peer->gconn.pending_delete) {
+                EXPECT_EQ(hash_list_find(&chat_->peers_by_enc_pk, get_enc_key(public_key)), static_cast<int>(i));
+                EXPECT_EQ(get_peer_number_of_enc_pk(chat_, get_enc_key(public_key), false), static_cast<int>(i));
+            }
+        }
+    }
+
+    Tox *tox_ = nullptr;
+    GC_Session *session_ = nullptr;
+    GC_Chat *chat_ = nullptr;
+    const Random *rng_ = nullptr;
+};
+
+TEST_F(GroupPeerIndex, AddedPeersAreIndexed)
+{
+    for (uint32_t i = 0; i < 8; ++i) {
+        ASSERT_GT(add_with_sig_key(random_enc_key()), 0);
+    }
+
+    expect_indices_match_peers();
+}
+
+TEST_F(GroupPeerIndex, DuplicateKeyIsRefused)
+{
+    const EncPublicKey key = random_enc_key();
+
+    ASSERT_GT(add(key), 0);
+    EXPECT_EQ(add(key), -2);
+}
+
+TEST_F(GroupPeerIndex, PeerMovedIntoFreedSlotIsReindexed)
+{
+    std::vector<EncPublicKey> keys;
+    std::vector<uint32_t> peer_ids;
+
+    for (uint32_t i = 0; i < 6; ++i) {
+        keys.push_back(random_enc_key());
+        const int peer_number = add_with_sig_key(keys.back());
+        ASSERT_GT(peer_number, 0);
+        peer_ids.push_back(chat_->group[peer_number].peer_id);
+    }
+
+    const int last = get_peer_number_of_enc_pk(chat_, keys.back().data(), false);
+    const int first = get_peer_number_of_enc_pk(chat_, keys.front().data(), false);
+    SigPublicKey first_sig_key;
+    memcpy(first_sig_key.data(), get_sig_pk(chat_->group[first].gconn.addr.public_key), first_sig_key.size());
+
+    mark_for_deletion(first);
+    delete_marked_peers();
+
+    // The last peer took the place of the deleted one.
+    EXPECT_EQ(get_peer_number_of_enc_pk(chat_, keys.back().data(), false), first);
+    EXPECT_NE(last, first);
+    EXPECT_EQ(find_by_enc_key(keys.front()), -1);
+    EXPECT_EQ(find_by_peer_id(peer_ids.front()), -1);
+    EXPECT_EQ(hash_list_find(&chat_->peers_by_sig_pk, first_sig_key.data()), -1);
+    expect_indices_match_peers();
+}
+
+TEST_F(GroupPeerIndex, LivePeerKeepsKeyOfPeerWaitingToBeDeleted)
+{
+    const EncPublicKey key = random_enc_key();
+
+    const int x = add_with_sig_key(random_enc_key());
+    const int y = add_with_sig_key(random_enc_key());
+    const int old_peer = add_with_sig_key(key);
+    ASSERT_GT(x, 0);
+    ASSERT_GT(y, 0);
+    ASSERT_GT(old_peer, 0);
+
+    // The peer rejoins while its old connection still waits to be deleted.
+    mark_for_deletion(old_peer);
+    const int new_peer = add_with_sig_key(key);
+    ASSERT_GT(new_peer, old_peer);
+    const uint32_t new_peer_id = chat_->group[new_peer].peer_id;
+    EXPECT_EQ(find_by_enc_key(key), new_peer);
+
+    // Deleting x moves the new peer into its slot, deleting y then moves the
+    // old peer into a freed slot while it still waits to be deleted.
+    mark_for_deletion(x);
+    mark_for_deletion(y);
+    do_gc(session_, nullptr);
+
+    const int moved_new_peer = find_by_peer_id(new_peer_id);
+    ASSERT_GT(moved_new_peer, 0);
+    EXPECT_EQ(find_by_enc_key(key), moved_new_peer);
+    EXPECT_EQ(get_peer_number_of_enc_pk(chat_, key.data(), false), moved_new_peer);
+
+    delete_marked_peers();
+
+    EXPECT_EQ(chat_->numpeers, 2u);
+    EXPECT_EQ(find_by_enc_key(key), 1);
+    EXPECT_EQ(get_peer_number_of_enc_pk(chat_, key.data(), false), 1);
+    EXPECT_EQ(add(key), -2);
+    expect_indices_match_peers();
+}
+
+}  // namespace
@@ -15,6 +15,12 @@
 #include "DHT.h"
 #include "TCP_connection.h"
 #include "group_moderation.h"
+#include "group_relay.h"
+#include "list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 #define MAX_GC_PART_MESSAGE_SIZE 128
 #define MAX_GC_NICK_SIZE 128
@@ -42,6 +48,10 @@
 /* Max number of messages to store in the send/recv arrays */
 #define GCC_BUFFER_SIZE 8192
 
+/* Room in front of the payload in the fragment buffer for the packet type and message id of a fragment
+ * that is decrypted into it */
+#define GC_FRAGMENT_HEADROOM (1 + sizeof(uint64_t))
+
 /** Self UDP status. Must correspond to return values from `ipport_self_copy()`. */
 typedef enum Self_UDP_Status {
     SELF_UDP_STATUS_NONE = 0x00,
@@ -78,19 +88,34 @@ typedef struct GC_Message_Array_Entry {
     uint64_t message_id;
     uint64_t time_added;
     uint64_t last_send_try;
+    uint64_t next_resend;   /* when to resend the packet if it hasn't been acked; send array only */
+    uint16_t queue_index;   /* position of the entry in the resend queue; send array only */
 } GC_Message_Array_Entry;
 
 typedef struct GC_Connection {
     uint64_t send_message_id;   /* message_id of the next message we send to peer */
 
     uint16_t send_array_start;   /* send_array index of oldest item */
-    GC_Message_Array_Entry *send_array;
+    GC_Message_Array_Entry *send_array;  /* allocated on first use and freed again when idle */
+    uint64_t send_array_last_used;  /* the last time we added a packet to send_array */
+
+    /* send_array indices of unacked packets as a min-heap ordered by next resend time */
+    uint16_t *resend_queue;
+    uint16_t resend_queue_size;
+    uint16_t resend_queue_capacity;
 
     uint64_t received_message_id;   /* message_id of peer's last message to us */
-    GC_Message_Array_Entry *recv_array;
+    GC_Message_Array_Entry *recv_array;  /* allocated on first use and freed again when idle */
+    uint16_t recv_array_count;  /* number of packets stored in recv_array */
+    uint64_t recv_array_last_used;  /* the last time we stored a packet in recv_array or fragment_buffer */
 
     uint64_t    last_chunk_id;  /* The message ID of the last packet fragment we received */
 
+    /* The fragments received so far of the current sequence, back to back after GC_FRAGMENT_HEADROOM bytes.
+     * Allocated on first use and freed again when idle. */
+    uint8_t     *fragment_buffer;
+    uint16_t    fragment_length;
+
     GC_PeerAddress   addr;   /* holds peer's extended real public key and ip_port */
     uint32_t    public_key_hash;   /* Jenkins one at a time hash of peer's real encryption public key */
 
@@ -128,6 +153,8 @@ typedef struct GC_Connection {
 
     bool        pending_delete;  /* true if this peer has been marked for deletion */
     GC_Exit_Info exit_info;
+
+    bool        relays_broadcasts;  /* true if this peer forwards relayed broadcasts */
 } GC_Connection;
 
 /***
@@ -240,6 +267,27 @@ typedef struct GC_TopicInfo {
     uint8_t     public_sig_key[SIG_PUBLIC_KEY_SIZE];  // Public signature key of the topic setter
 } GC_TopicInfo;
 
+/** Counters of the broadcasts sent and relayed by a group, for measuring what they cost. */
+typedef struct GC_Broadcast_Stats {
+    uint64_t sent;           /* message, nick and status broadcasts we sent */
+    uint64_t packets;        /* packets queued for the broadcasts we sent */
+    uint64_t bytes;          /* payload bytes of those packets */
+    uint64_t relayed;        /* packets queued to forward other peers' broadcasts */
+    uint64_t relayed_bytes;  /* payload bytes of those packets */
+    uint64_t duplicates;     /* relayed broadcasts dropped because we already had them */
+    uint64_t repaired;       /* packets queued to send a relayed broadcast directly to the peers of a failed branch */
+} GC_Broadcast_Stats;
+
+/** Memory and retransmission counters of the lossless connections of a group. */
+typedef struct GC_Lossless_Stats {
+    uint32_t send_arrays;         /* peers we currently hold a send array for */
+    uint32_t recv_arrays;         /* peers we currently hold a receive array for */
+    uint64_t array_bytes;         /* memory held by those arrays and the resend queues */
+    uint64_t in_flight;           /* packets waiting for an ack */
+    uint64_t resent;              /* packets resent because they weren't acked in time */
+    uint64_t resent_on_request;   /* packets resent because the peer asked for them */
+} GC_Lossless_Stats;
+
 typedef struct GC_Chat {
     Mono_Time       *mono_time;
     const Logger    *log;
@@ -274,6 +322,14 @@ typedef struct GC_Chat {
     uint32_t    numpeers;
     int         group_number;
 
+    /* Peer numbers by encryption key, signature key and peer id. Peers waiting to be deleted may be
+     * missing from the key indices, and so may peers whose signature key is unknown or taken by another peer. */
+    Hash_List   peers_by_enc_pk;
+    Hash_List   peers_by_sig_pk;
+    Hash_List   peers_by_id;
+    uint32_t    sig_pk_unindexed;  // number of peers with a known signature key that is missing from the index
+    uint32_t    peer_id_hint;  // every peer id below this one is taken
+
     uint8_t     chat_public_key[EXT_PUBLIC_KEY_SIZE];  // the chat_id is the sig portion
     uint8_t     chat_secret_key[EXT_SECRET_KEY_SIZE];  // only used by the founder
 
@@ -315,6 +371,13 @@ typedef struct GC_Chat {
     int         friend_connection_id;  // identifier for group's messenger friend connection
 
     bool        flag_exit;  // true if the group will be deleted after the next do_gc() iteration
+
+    uint8_t     relay_fanout;  // number of peers we send a broadcast to for relaying, 0 if we don't relay
+    uint64_t    relay_message_id;  // id of the last relayed broadcast we sent
+    GC_Relay_Origins relay_origins;  // ids of the relayed broadcasts we've seen, by creator
+    GC_Relay_Pending_List relay_pending;  // relayed broadcasts whose branches haven't acked them yet
+    GC_Broadcast_Stats broadcast_stats;
+    GC_Lossless_Stats lossless_stats;  // only the resend counters are kept up to date
 } GC_Chat;
 
 #ifndef MESSENGER_DEFINED
@@ -388,6 +451,10 @@ typedef struct GC_Session {
 non_null(1, 3) nullable(2)
 int peer_add(GC_Chat *chat, const IP_Port *ipp, const uint8_t *public_key);
 
+/** @brief Sets the signature key of `peer_number` to `public_sig_key` and updates the peer index. */
+non_null()
+void set_peer_sig_pk(GC_Chat *chat, uint32_t peer_number, const uint8_t *public_sig_key);
+
 /** @brief Unpacks saved peers from `data` of size `length` into `chat`.
  *
  * Returns the number of unpacked peers on success.
@@ -407,4 +474,8 @@ int unpack_gc_saved_peers(GC_Chat *chat, const uint8_t *data, uint16_t length);
 non_null(1, 2) nullable(4)
 int pack_gc_saved_peers(const GC_Chat *chat, uint8_t *data, uint16_t length, uint16_t *processed);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif  // GROUP_COMMON_H
@@ -27,6 +27,12 @@
 /** Seconds since last direct UDP packet was received before the connection is considered dead */
 #define GCC_UDP_DIRECT_TIMEOUT (GC_PING_TIMEOUT + 4)
 
+/** Seconds an empty send or receive array is kept around before it is freed */
+#define GCC_ARRAY_IDLE_TIMEOUT 30
+
+/** Initial number of slots in a resend queue; it doubles as needed up to GCC_BUFFER_SIZE */
+#define GCC_RESEND_QUEUE_MIN_CAPACITY 16
+
 /** Returns true if array entry does not contain an active packet. */
 non_null()
 static bool array_entry_is_empty(const GC_Message_Array_Entry *array_entry)
@@ -48,6 +54,164 @@ static void clear_array_entry(GC_Message_Array_Entry *const array_entry)
     };
 }
 
+/** @brief Returns when a packet first sent at `time_added` is next due to be resent after `now`.
+ *
+ * Unacked packets are resent 3, 5, 9, 17, ... seconds after they were first sent.
+ */
+static uint64_t next_resend_time(uint64_t time_added, uint64_t now)
+{
+    uint64_t delay = 2;
+
+    while (time_added + delay + 1 <= now) {
+        delay *= 2;
+    }
+
+    return time_added + delay + 1;
+}
+
+/** Returns true if the send array entry at `a` is due to be resent before the one at `b`. */
+non_null()
+static bool resend_queue_less(const GC_Connection *gconn, uint16_t a, uint16_t b)
+{
+    const GC_Message_Array_Entry *entry_a = &gconn->send_array[a];
+    const GC_Message_Array_Entry *entry_b = &gconn->send_array[b];
+
+    if (entry_a->next_resend != entry_b->next_resend) {
+        return entry_a->next_resend < entry_b->next_resend;
+    }
+
+    return entry_a->message_id < entry_b->message_id;
+}
+
+non_null()
+static void resend_queue_set(GC_Connection *gconn, uint16_t pos, uint16_t idx)
+{
+    gconn->resend_queue[pos] = idx;
+    gconn->send_array[idx].queue_index = pos;
+}
+
+non_null()
+static void resend_queue_sift_up(GC_Connection *gconn, uint16_t pos)
+{
+    const uint16_t idx = gconn->resend_queue[pos];
+
+    while (pos > 0) {
+        const uint16_t parent = (pos - 1) / 2;
+
+        if (!resend_queue_less(gconn, idx, gconn->resend_queue[parent])) {
+            break;
+        }
+
+        resend_queue_set(gconn, pos, gconn->resend_queue[parent]);
+        pos = parent;
+    }
+
+    resend_queue_set(gconn, pos, idx);
+}
+
+non_null()
+static void resend_queue_sift_down(GC_Connection *gconn, uint16_t pos)
+{
+    const uint16_t idx = gconn->resend_queue[pos];
+    const uint16_t size = gconn->resend_queue_size;
+
+    while (true) {
+        const uint32_t left = 2 * (uint32_t)pos + 1;
+
+        if (left >= size) {
+            break;
+        }
+
+        uint16_t child = (uint16_t)left;
+
+        if (left + 1 < size && resend_queue_less(gconn, gconn->resend_queue[left + 1], gconn->resend_queue[left])) {
+            child = (uint16_t)(left + 1);
+        }
+
+        if (!resend_queue_less(gconn, gconn->resend_queue[child], idx)) {
+            break;
+        }
+
+        resend_queue_set(gconn, pos, gconn->resend_queue[child]);
+        pos = child;
+    }
+
+    resend_queue_set(gconn, pos, idx);
+}
+
+/** @brief Adds the send array entry at `idx` to the resend queue of `gconn`.
+ *
+ * Return true on success.
+ */
+non_null()
+static bool resend_queue_push(GC_Connection *gconn, uint16_t idx)
+{
+    if (gconn->resend_queue_size == gconn->resend_queue_capacity) {
+        const uint16_t new_capacity = gconn->resend_queue_capacity == 0
+                                      ? GCC_RESEND_QUEUE_MIN_CAPACITY
+                                      : min_u16(gconn->resend_queue_capacity * 2, GCC_BUFFER_SIZE);
+
+        if (new_capacity == gconn->resend_queue_capacity) {
+            return false;
+        }
+
+        uint16_t *new_queue = (uint16_t *)realloc(gconn->resend_queue, new_capacity * sizeof(uint16_t));
+
+        if (new_queue == nullptr) {
+            return false;
+        }
+
+        gconn->resend_queue = new_queue;
+        gconn->resend_queue_capacity = new_capacity;
+    }
+
+    const uint16_t pos = gconn->resend_queue_size;
+    ++gconn->resend_queue_size;
+
+    resend_queue_set(gconn, pos, idx);
+    resend_queue_sift_up(gconn, pos);
+
+    return true;
+}
+
+/** @brief Removes the send array entry at `idx` from the resend queue of `gconn`. */
+non_null()
+static void resend_queue_remove(GC_Connection *gconn, uint16_t idx)
+{
+    const uint16_t pos = gconn->send_array[idx].queue_index;
+
+    assert(pos < gconn->resend_queue_size);
+    assert(gconn->resend_queue[pos] == idx);
+
+    --gconn->resend_queue_size;
+
+    if (pos == gconn->resend_queue_size) {
+        return;
+    }
+
+    resend_queue_set(gconn, pos, gconn->resend_queue[gconn->resend_queue_size]);
+
+    if (pos > 0 && resend_queue_less(gconn, gconn->resend_queue[pos], gconn->resend_queue[(pos - 1) / 2])) {
+        resend_queue_sift_up(gconn, pos);
+    } else {
+        resend_queue_sift_down(gconn, pos);
+    }
+}
+
+/** @brief Clears the send array entry at `idx` and removes it from the resend queue. */
+non_null()
+static void clear_send_array_entry(GC_Connection *gconn, uint16_t idx)
+{
+    GC_Message_Array_Entry *entry = &gconn->send_array[idx];
+
+    if (array_entry_is_empty(entry)) {
+        return;
+    }
+
+    resend_queue_remove(gconn, idx);
+    clear_array_entry(entry);
+}
+
 /**
  * Clears every send array message from queue starting at the index designated by
  * `start_id` and ending at `end_id`, and sets the send_message_id for `gconn`
@@ -60,13 +224,41 @@ static void clear_send_queue_id_range(GC_Connection *gconn, uint64_t start_id, u
     const uint16_t end_idx = gcc_get_array_index(end_id);
 
     for (uint16_t i = start_idx; i != end_idx; i = (i + 1) % GCC_BUFFER_SIZE) {
-        GC_Message_Array_Entry *entry = &gconn->send_array[i];
-        clear_array_entry(entry);
+        clear_send_array_entry(gconn, i);
     }
 
     gconn->send_message_id = start_id;
 }
 
+/** @brief Allocates `*array` if it hasn't been yet.
+ *
+ * Return true if the array is allocated.
+ */
+non_null()
+static bool allocate_array(GC_Message_Array_Entry **array)
+{
+    if (*array == nullptr) {
+        *array = (GC_Message_Array_Entry *)calloc(GCC_BUFFER_SIZE, sizeof(GC_Message_Array_Entry));
+    }
+
+    return *array != nullptr;
+}
+
+/** @brief Frees `array` and the packets stored in it. */
+nullable(1)
+static void free_array(GC_Message_Array_Entry *array)
+{
+    if (array == nullptr) {
+        return;
+    }
+
+    for (size_t i = 0; i < GCC_BUFFER_SIZE; ++i) {
+        free(array[i].data);
+    }
+
+    free(array);
+}
+
 uint16_t gcc_get_array_index(uint64_t message_id)
 {
     return message_id % GCC_BUFFER_SIZE;
@@ -112,6 +304,7 @@ static bool create_array_entry(const Mono_Time *mono_time, GC_Message_Array_Entr
     array_entry->message_id = message_id;
     array_entry->time_added = tm;
     array_entry->last_send_try = tm;
+    array_entry->next_resend = next_resend_time(tm, tm);
 
     return true;
 }
@@ -130,6 +323,11 @@ static bool add_to_send_array(const Logger *log, const Mono_Time *mono_time, GC_
         return false;
     }
 
+    if (!allocate_array(&gconn->send_array)) {
+        LOGGER_ERROR(log, "Failed to allocate send array");
+        return false;
+    }
+
     const uint16_t idx = gcc_get_array_index(gconn->send_message_id);
     GC_Message_Array_Entry *array_entry = &gconn->send_array[idx];
 
@@ -143,6 +341,13 @@ static bool add_to_send_array(const Logger *log, const Mono_Time *mono_time, GC_
         return false;
     }
 
+    if (!resend_queue_push(gconn, idx)) {
+        LOGGER_WARNING(log, "Failed to add array entry to resend queue");
+        clear_array_entry(array_entry);
+        return false;
+    }
+
+    gconn->send_array_last_used = array_entry->time_added;
     ++gconn->send_message_id;
 
     return true;
@@ -229,6 +434,10 @@ bool gcc_send_lossless_packet_fragments(const GC_Chat *chat, GC_Connection *gcon
 
 bool gcc_handle_ack(const Logger *log, GC_Connection *gconn, uint64_t message_id)
 {
+    if (gconn->send_array == nullptr) {
+        return true;
+    }
+
     uint16_t idx = gcc_get_array_index(message_id);
     GC_Message_Array_Entry *array_entry = &gconn->send_array[idx];
 
@@ -241,7 +450,7 @@ bool gcc_handle_ack(const Logger *log, GC_Connection *gconn, uint64_t message_id
         return false;
     }
 
-    clear_array_entry(array_entry);
+    clear_send_array_entry(gconn, idx);
 
     /* Put send_array_start in proper position */
     if (idx == gconn->send_array_start) {
@@ -327,6 +536,11 @@ static bool store_in_recv_array(const Logger *log, const Mono_Time *mono_time, G
                                 const uint8_t *data,
                                 uint16_t length, uint8_t packet_type, uint64_t message_id)
 {
+    if (!allocate_array(&gconn->recv_array)) {
+        LOGGER_ERROR(log, "Failed to allocate recv array");
+        return false;
+    }
+
     const uint16_t idx = gcc_get_array_index(message_id);
     GC_Message_Array_Entry *ary_entry = &gconn->recv_array[idx];
 
@@ -340,81 +554,73 @@ static bool store_in_recv_array(const Logger *log, const Mono_Time *mono_time, G
         return false;
     }
 
+    ++gconn->recv_array_count;
+    gconn->recv_array_last_used = ary_entry->time_added;
+
     return true;
 }
 
-/**
- * Reassembles a fragmented packet sequence ending with the data in the receive
- * array at slot `message_id - 1` and starting with the last found slot containing
- * a GP_FRAGMENT packet when searching backwards in the array.
- *
- * The fully reassembled packet is stored in `payload`, which must be passed as a
- * null pointer, and must be free'd by the caller.
- *
- * Return the length of the fully reassembled packet on success.
- * Return 0 on failure.
- */
-non_null(1, 3) nullable(2)
-static uint16_t reassemble_packet(const Logger *log, GC_Connection *gconn, uint8_t **payload, uint64_t message_id)
+/** @brief Clears the receive array entry of `gconn` for `message_id` if it's still stored. */
+non_null()
+static void clear_recv_array_entry(GC_Connection *gconn, uint64_t message_id)
 {
-    uint16_t end_idx = gcc_get_array_index(message_id - 1);
-    uint16_t start_idx = end_idx;
-    uint16_t packet_length = 0;
-
-    GC_Message_Array_Entry *entry = &gconn->recv_array[end_idx];
-
-    // search backwards in recv array until we find an empty slot or a non-fragment packet type
-    while (!array_entry_is_empty(entry) && entry->packet_type == GP_FRAGMENT) {
-        assert(entry->data != nullptr);
-        assert(entry->data_length <= MAX_GC_PACKET_CHUNK_SIZE);
-
-        const uint16_t diff = packet_length + entry->data_length;
+    if (gconn->recv_array == nullptr) {
+        return;
+    }
 
-        assert(diff > packet_length);  // overflow check
-        packet_length = diff;
+    GC_Message_Array_Entry *entry = &gconn->recv_array[gcc_get_array_index(message_id)];
 
-        if (packet_length > MAX_GC_PACKET_SIZE) {
-            LOGGER_ERROR(log, "Payload of size %u exceeded max packet size", packet_length);  // should never happen
-            return 0;
-        }
+    if (!array_entry_is_empty(entry) && entry->message_id == message_id) {
+        clear_array_entry(entry);
+        --gconn->recv_array_count;
+    }
+}
 
-        start_idx = start_idx > 0 ? start_idx - 1 : GCC_BUFFER_SIZE - 1;
-        entry = &gconn->recv_array[start_idx];
+uint8_t *gcc_fragment_buffer_tail(GC_Connection *gconn)
+{
+    if (gconn->fragment_buffer == nullptr) {
+        gconn->fragment_buffer = (uint8_t *)malloc(GC_FRAGMENT_HEADROOM + MAX_GC_PACKET_SIZE);
 
-        if (start_idx == end_idx) {
-            LOGGER_ERROR(log, "Packet reassemble wrap-around");
-            return 0;
+        if (gconn->fragment_buffer == nullptr) {
+            return nullptr;
         }
-    }
 
-    if (packet_length == 0) {
-        return 0;
+        gconn->fragment_length = 0;
     }
 
-    assert(*payload == nullptr);
-    *payload = (uint8_t *)malloc(packet_length);
+    return gconn->fragment_buffer + GC_FRAGMENT_HEADROOM + gconn->fragment_length;
+}
 
-    if (*payload == nullptr) {
-        LOGGER_ERROR(log, "Failed to allocate %u bytes for payload buffer", packet_length);
-        return 0;
+/** @brief Appends the packet fragment `chunk` to the fragment buffer of `gconn`.
+ *
+ * Nothing is copied if the fragment was decrypted into the tail of the buffer.
+ *
+ * Return true on success.
+ */
+non_null()
+static bool append_packet_fragment(const Logger *log, const Mono_Time *mono_time, GC_Connection *gconn,
+                                   const uint8_t *chunk, uint16_t length)
+{
+    if (length > MAX_GC_PACKET_SIZE - gconn->fragment_length) {
+        LOGGER_ERROR(log, "Payload of size %u exceeded max packet size", gconn->fragment_length + length);
+        return false;
     }
 
-    start_idx = (start_idx + 1) % GCC_BUFFER_SIZE;
-    end_idx = (end_idx + 1) % GCC_BUFFER_SIZE;
+    uint8_t *tail = gcc_fragment_buffer_tail(gconn);
 
-    uint16_t processed = 0;
-
-    for (uint16_t i = start_idx; i != end_idx; i = (i + 1) % GCC_BUFFER_SIZE) {
-        entry = &gconn->recv_array[i];
-
-        assert(processed + entry->data_length <= packet_length);
-        memcpy(*payload + processed, entry->data, entry->data_length);
-        processed += entry->data_length;
+    if (tail == nullptr) {
+        LOGGER_ERROR(log, "Failed to allocate fragment buffer");
+        return false;
+    }
 
-        clear_array_entry(entry);
+    if (chunk != tail) {
+        memcpy(tail, chunk, length);
     }
 
-    return processed;
+    gconn->fragment_length += length;
+    gconn->recv_array_last_used = mono_time_get(mono_time);
+
+    return true;
 }
 
 int gcc_handle_packet_fragment(const GC_Session *c, GC_Chat *chat, uint32_t peer_number,
@@ -422,7 +628,7 @@ int gcc_handle_packet_fragment(const GC_Session *c, GC_Chat *chat, uint32_t peer
                                uint64_t message_id, void *userdata)
 {
     if (length > 0) {
-        if (!store_in_recv_array(chat->log, chat->mono_time, gconn, chunk, length, packet_type, message_id)) {
+        if (!append_packet_fragment(chat->log, chat->mono_time, gconn, chunk, length)) {
             return -1;
         }
 
@@ -432,35 +638,43 @@ int gcc_handle_packet_fragment(const GC_Session *c, GC_Chat *chat, uint32_t peer
         return 1;
     }
 
+    if (gconn->fragment_buffer == nullptr || gconn->fragment_length == 0) {
+        return -1;
+    }
+
     uint8_t sender_pk[ENC_PUBLIC_KEY_SIZE];
     memcpy(sender_pk, get_enc_key(gconn->addr.public_key), ENC_PUBLIC_KEY_SIZE);
 
-    uint8_t *payload = nullptr;
-    const uint16_t processed_len = reassemble_packet(chat->log, gconn, &payload, message_id);
+    /* The handler gets the buffer to itself, as it may delete the peer or start a new sequence. */
+    uint8_t *buffer = gconn->fragment_buffer;
+    const uint16_t buffer_length = gconn->fragment_length;
+    gconn->fragment_buffer = nullptr;
+    gconn->fragment_length = 0;
 
-    if (processed_len == 0) {
-        free(payload);
-        return -1;
-    }
-
-    if (!handle_gc_lossless_helper(c, chat, peer_number, payload + 1, processed_len - 1, payload[0], userdata)) {
-        free(payload);
-        return -1;
-    }
+    const uint8_t *payload = buffer + GC_FRAGMENT_HEADROOM;
+    const bool ret = handle_gc_lossless_helper(c, chat, peer_number, payload + 1, buffer_length - 1, payload[0],
+                     userdata);
 
     /* peer number can change from peer add operations in packet handlers */
     peer_number = get_peer_number_of_enc_pk(chat, sender_pk, false);
     gconn = get_gc_connection(chat, peer_number);
 
-    if (gconn == nullptr) {
-        return 0;
+    if (gconn == nullptr || gconn->fragment_buffer != nullptr) {
+        free(buffer);
+        return ret ? 0 : -1;
+    }
+
+    gconn->fragment_buffer = buffer;
+
+    if (!ret) {
+        /* keep the fragments for when the peer resends the end of the sequence */
+        gconn->fragment_length = buffer_length;
+        return -1;
     }
 
     gcc_set_recv_message_id(gconn, gconn->received_message_id + 1);
     gconn->last_chunk_id = 0;
 
-    free(payload);
-
     return 0;
 }
 
@@ -490,6 +704,9 @@ int gcc_handle_received_message(const Logger *log, const Mono_Time *mono_time, G
         return 1;
     }
 
+    /* a resend can overtake the copy we stored when the packet first arrived out of order */
+    clear_recv_array_entry(gconn, message_id);
+
     gcc_set_recv_message_id(gconn, gconn->received_message_id + 1);
 
     return 2;
@@ -508,25 +725,29 @@ static bool process_recv_array_entry(const GC_Session *c, GC_Chat *chat, GC_Conn
     uint8_t sender_pk[ENC_PUBLIC_KEY_SIZE];
     memcpy(sender_pk, get_enc_key(gconn->addr.public_key), ENC_PUBLIC_KEY_SIZE);
 
+    const uint64_t message_id = array_entry->message_id;
+
     const bool ret = handle_gc_lossless_helper(c, chat, peer_number, array_entry->data, array_entry->data_length,
                      array_entry->packet_type, userdata);
 
+    clear_array_entry(array_entry);
+
     /* peer number can change from peer add operations in packet handlers */
     peer_number = get_peer_number_of_enc_pk(chat, sender_pk, false);
     gconn = get_gc_connection(chat, peer_number);
 
-    clear_array_entry(array_entry);
-
     if (gconn == nullptr) {
         return true;
     }
 
+    --gconn->recv_array_count;
+
     if (!ret) {
-        gc_send_message_ack(chat, gconn, array_entry->message_id, GR_ACK_REQ);
+        gc_send_message_ack(chat, gconn, message_id, GR_ACK_REQ);
         return false;
     }
 
-    gc_send_message_ack(chat, gconn, array_entry->message_id, GR_ACK_RECV);
+    gc_send_message_ack(chat, gconn, message_id, GR_ACK_RECV);
 
     gcc_set_recv_message_id(gconn, gconn->received_message_id + 1);
 
@@ -540,6 +761,10 @@ void gcc_check_recv_array(const GC_Session *c, GC_Chat *chat, GC_Connection *gco
         return;
     }
 
+    if (gconn->recv_array_count == 0) {
+        return;
+    }
+
     const uint16_t idx = (gconn->received_message_id + 1) % GCC_BUFFER_SIZE;
     GC_Message_Array_Entry *const array_entry = &gconn->recv_array[idx];
 
@@ -548,44 +773,84 @@ void gcc_check_recv_array(const GC_Session *c, GC_Chat *chat, GC_Connection *gco
     }
 }
 
-void gcc_resend_packets(const GC_Chat *chat, GC_Connection *gconn)
+void gcc_resend_packets(GC_Chat *chat, GC_Connection *gconn)
 {
-    const uint64_t tm = mono_time_get(chat->mono_time);
-    const uint16_t start = gconn->send_array_start;
-    const uint16_t end = gconn->send_message_id % GCC_BUFFER_SIZE;
-
-    GC_Message_Array_Entry *array_entry = &gconn->send_array[start];
-
-    if (array_entry_is_empty(array_entry)) {
+    if (gconn->resend_queue_size == 0) {
         return;
     }
 
-    if (mono_time_is_timeout(chat->mono_time, array_entry->time_added, GC_CONFIRMED_PEER_TIMEOUT)) {
+    const GC_Message_Array_Entry *oldest = &gconn->send_array[gconn->send_array_start];
+
+    if (!array_entry_is_empty(oldest)
+            && mono_time_is_timeout(chat->mono_time, oldest->time_added, GC_CONFIRMED_PEER_TIMEOUT)) {
         gcc_mark_for_deletion(gconn, chat->tcp_conn, GC_EXIT_TYPE_TIMEOUT, nullptr, 0);
         LOGGER_DEBUG(chat->log, "Send array stuck; timing out peer");
         return;
     }
 
-    for (uint16_t i = start; i != end; i = (i + 1) % GCC_BUFFER_SIZE) {
-        array_entry = &gconn->send_array[i];
+    const uint64_t tm = mono_time_get(chat->mono_time);
 
-        if (array_entry_is_empty(array_entry)) {
-            continue;
-        }
+    /* only the packets that are due are looked at, however many are in flight */
+    while (gconn->resend_queue_size > 0) {
+        GC_Message_Array_Entry *array_entry = &gconn->send_array[gconn->resend_queue[0]];
 
-        if (tm == array_entry->last_send_try) {
-            continue;
+        if (array_entry->next_resend > tm) {
+            break;
         }
 
-        const uint64_t delta = array_entry->last_send_try - array_entry->time_added;
         array_entry->last_send_try = tm;
+        array_entry->next_resend = next_resend_time(array_entry->time_added, tm);
+        resend_queue_sift_down(gconn, 0);
 
-        /* if this occurrs less than once per second this won't be reliable */
-        if (delta > 1 && is_power_of_2(delta)) {
-            gcc_encrypt_and_send_lossless_packet(chat, gconn, array_entry->data, array_entry->data_length,
-                                                 array_entry->message_id, array_entry->packet_type);
-        }
+        gcc_encrypt_and_send_lossless_packet(chat, gconn, array_entry->data, array_entry->data_length,
+                                             array_entry->message_id, array_entry->packet_type);
+        ++chat->lossless_stats.resent;
+    }
+}
+
+void gcc_free_idle_arrays(const Mono_Time *mono_time, GC_Connection *gconn)
+{
+    if (gconn->send_array != nullptr && gconn->resend_queue_size == 0
+            && mono_time_is_timeout(mono_time, gconn->send_array_last_used, GCC_ARRAY_IDLE_TIMEOUT)) {
+        free_array(gconn->send_array);
+        free(gconn->resend_queue);
+        gconn->send_array = nullptr;
+        gconn->resend_queue = nullptr;
+        gconn->resend_queue_capacity = 0;
+    }
+
+    if (gconn->last_chunk_id != 0
+            || !mono_time_is_timeout(mono_time, gconn->recv_array_last_used, GCC_ARRAY_IDLE_TIMEOUT)) {
+        return;
+    }
+
+    if (gconn->recv_array != nullptr && gconn->recv_array_count == 0) {
+        free_array(gconn->recv_array);
+        gconn->recv_array = nullptr;
+    }
+
+    free(gconn->fragment_buffer);
+    gconn->fragment_buffer = nullptr;
+    gconn->fragment_length = 0;
+}
+
+uint64_t gcc_array_memory(const GC_Connection *gconn)
+{
+    uint64_t bytes = (uint64_t)gconn->resend_queue_capacity * sizeof(uint16_t);
+
+    if (gconn->send_array != nullptr) {
+        bytes += GCC_BUFFER_SIZE * sizeof(GC_Message_Array_Entry);
+    }
+
+    if (gconn->recv_array != nullptr) {
+        bytes += GCC_BUFFER_SIZE * sizeof(GC_Message_Array_Entry);
     }
+
+    if (gconn->fragment_buffer != nullptr) {
+        bytes += GC_FRAGMENT_HEADROOM + MAX_GC_PACKET_SIZE;
+    }
+
+    return bytes;
 }
 
 bool gcc_send_packet(const GC_Chat *chat, const GC_Connection *gconn, const uint8_t *packet, uint16_t length)
@@ -681,13 +946,10 @@ void gcc_mark_for_deletion(GC_Connection *gconn, TCP_Connections *tcp_conn, Grou
 
 void gcc_peer_cleanup(GC_Connection *gconn)
 {
-    for (size_t i = 0; i < GCC_BUFFER_SIZE; ++i) {
-        free(gconn->send_array[i].data);
-        free(gconn->recv_array[i].data);
-    }
-
-    free(gconn->recv_array);
-    free(gconn->send_array);
+    free_array(gconn->recv_array);
+    free_array(gconn->send_array);
+    free(gconn->resend_queue);
+    free(gconn->fragment_buffer);
 
     crypto_memunlock(gconn->session_secret_key, sizeof(gconn->session_secret_key));
     crypto_memunlock(gconn->session_shared_key, sizeof(gconn->session_shared_key));
@@ -12,6 +12,10 @@
 
 #include "group_common.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /* Max number of TCP relays we share with a peer on handshake */
 #define GCC_MAX_TCP_SHARED_RELAYS 3
 
@@ -35,9 +39,10 @@ int gcc_handle_received_message(const Logger *log, const Mono_Time *mono_time, G
 
 /** @brief Handles a packet fragment.
  *
- * If the fragment is incomplete, it gets stored in the recv
- * array. Otherwise the segment is re-assembled into a complete
- * payload and processed.
+ * Fragments are appended to the fragment buffer of `gconn`, where they are
+ * copied unless `chunk` was decrypted straight into its tail. The empty
+ * fragment that ends a sequence hands the buffer to the packet handler
+ * without copying the payload.
  *
  * Return 1 if fragment is successfully handled and is not the end of the sequence.
  * Return 0 if fragment is the end of a sequence and successfully handled.
@@ -48,6 +53,17 @@ int gcc_handle_packet_fragment(const GC_Session *c, GC_Chat *chat, uint32_t peer
                                const uint8_t *chunk, uint16_t length, uint8_t packet_type,  uint64_t message_id,
                                void *userdata);
 
+/** @brief Returns where in the fragment buffer of `gconn` the next fragment goes, allocating the buffer if needed.
+ *
+ * There are at least `GC_FRAGMENT_HEADROOM` writable bytes before the returned
+ * pointer, holding the previous fragment if there is one, and room for
+ * `MAX_GC_PACKET_SIZE - gconn->fragment_length` bytes after it.
+ *
+ * Returns null if the buffer couldn't be allocated.
+ */
+non_null()
+uint8_t *gcc_fragment_buffer_tail(GC_Connection *gconn);
+
 /** @brief Return array index for message_id */
 uint16_t gcc_get_array_index(uint64_t message_id);
 
@@ -108,9 +124,23 @@ non_null(1, 2, 3) nullable(5)
 void gcc_check_recv_array(const GC_Session *c, GC_Chat *chat, GC_Connection *gconn, uint32_t peer_number,
                           void *userdata);
 
-/** @brief Attempts to re-send lossless packets that have not yet received an ack. */
+/** @brief Attempts to re-send lossless packets that have not yet received an ack.
+ *
+ * Only the packets that are due are visited, in the order of their resend time.
+ */
 non_null()
-void gcc_resend_packets(const GC_Chat *chat, GC_Connection *gconn);
+void gcc_resend_packets(GC_Chat *chat, GC_Connection *gconn);
+
+/** @brief Frees the send and receive arrays of `gconn` if they have been empty for a while.
+ *
+ * They are allocated again when the next packet needs to be stored.
+ */
+non_null()
+void gcc_free_idle_arrays(const Mono_Time *mono_time, GC_Connection *gconn);
+
+/** @brief Returns the number of bytes held by the send and receive arrays and the resend queue of `gconn`. */
+non_null()
+uint64_t gcc_array_memory(const GC_Connection *gconn);
 
 /**
  * Uses public encryption key `sender_pk` and the shared secret key associated with `gconn`
@@ -186,4 +216,8 @@ void gcc_peer_cleanup(GC_Connection *gconn);
 non_null()
 void gcc_cleanup(const GC_Chat *chat);
 
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif  // GROUP_CONNECTION_H
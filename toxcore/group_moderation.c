@@ -436,11 +436,13 @@ static bool sanctions_list_make_hash(const Mod_Sanction *sanctions, uint32_t new
 }
 
 /** @brief Verifies that sanction contains valid info and was assigned by a current mod or group founder.
+ *
+ * This does not verify the signature of the sanction.
  *
  * Returns true on success.
  */
 non_null()
-static bool sanctions_list_validate_entry(const Moderation *moderation, const Mod_Sanction *sanction)
+static bool sanctions_list_validate_entry_data(const Moderation *moderation, const Mod_Sanction *sanction)
 {
     if (!mod_list_verify_sig_pk(moderation, sanction->setter_public_sig_key)) {
         return false;
@@ -450,10 +452,16 @@ static bool sanctions_list_validate_entry(const Moderation *moderation, const Mo
         return false;
     }
 
-    if (sanction->time_set == 0) {
-        return false;
-    }
+    return sanction->time_set != 0;
+}
 
+/** @brief Verifies that sanction was signed by its setter.
+ *
+ * Returns true on success.
+ */
+non_null()
+static bool sanctions_list_verify_entry_signature(const Mod_Sanction *sanction)
+{
     uint8_t packed_data[MOD_SANCTION_PACKED_SIZE];
     const int packed_len = sanctions_list_pack(packed_data, sizeof(packed_data), sanction, 1, nullptr);
 
@@ -465,6 +473,40 @@ static bool sanctions_list_validate_entry(const Moderation *moderation, const Mo
                                    sanction->setter_public_sig_key);
 }
 
+/** @brief Verifies that sanction contains valid info and was assigned by a current mod or group founder.
+ *
+ * Returns true on success.
+ */
+non_null()
+static bool sanctions_list_validate_entry(const Moderation *moderation, const Mod_Sanction *sanction)
+{
+    return sanctions_list_validate_entry_data(moderation, sanction)
+           && sanctions_list_verify_entry_signature(sanction);
+}
+
+/** @brief Returns true if an entry identical to `sanction` is in our sanctions list.
+ *
+ * The signature of every entry in our list was verified before the entry was
+ * added, or made by ourselves, so an identical entry needs no verification.
+ */
+non_null()
+static bool sanctions_list_has_verified_entry(const Moderation *moderation, const Mod_Sanction *sanction)
+{
+    for (uint16_t i = 0; i < moderation->num_sanctions; ++i) {
+        const Mod_Sanction *entry = &moderation->sanctions[i];
+
+        if (memcmp(entry->signature, sanction->signature, SIGNATURE_SIZE) == 0
+                && memcmp(entry->setter_public_sig_key, sanction->setter_public_sig_key, SIG_PUBLIC_KEY_SIZE) == 0
+                && memcmp(entry->target_public_enc_key, sanction->target_public_enc_key, ENC_PUBLIC_KEY_SIZE) == 0
+                && entry->time_set == sanction->time_set
+                && entry->type == sanction->type) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 non_null()
 static uint16_t sanctions_creds_get_checksum(const Mod_Sanction_Creds *creds)
 {
@@ -561,14 +603,31 @@ static bool sanctions_creds_validate(const Moderation *moderation, const Mod_San
 bool sanctions_list_check_integrity(const Moderation *moderation, const Mod_Sanction_Creds *creds,
                                     const Mod_Sanction *sanctions, uint16_t num_sanctions)
 {
+    // Do the cheap checks first so that an invalid list costs at most one signature verification.
     for (uint16_t i = 0; i < num_sanctions; ++i) {
-        if (!sanctions_list_validate_entry(moderation, &sanctions[i])) {
+        if (!sanctions_list_validate_entry_data(moderation, &sanctions[i])) {
             LOGGER_WARNING(moderation->log, "Invalid entry");
             return false;
         }
     }
 
-    return sanctions_creds_validate(moderation, sanctions, creds, num_sanctions);
+    if (!sanctions_creds_validate(moderation, sanctions, creds, num_sanctions)) {
+        return false;
+    }
+
+    // Usually most entries are already in our own list, so only new ones need to be verified.
+    for (uint16_t i = 0; i < num_sanctions; ++i) {
+        if (sanctions_list_has_verified_entry(moderation, &sanctions[i])) {
+            continue;
+        }
+
+        if (!sanctions_list_verify_entry_signature(&sanctions[i])) {
+            LOGGER_WARNING(moderation->log, "Invalid entry signature");
+            return false;
+        }
+    }
+
+    return true;
 }
 
 /** @brief Validates a sanctions list if credentials are supplied. If successful,
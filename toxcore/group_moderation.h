@@ -229,6 +229,9 @@ non_null()
 bool sanctions_list_make_creds(Moderation *moderation);
 
 /** @brief Validates all sanctions list entries as well as the list itself.
+ *
+ * Signatures of entries that are identical to an entry in our own sanctions
+ * list are not verified again.
  *
  * Returns true if all entries are valid.
  * Returns false if one or more entries are invalid.
@@ -248,4 +248,22 @@ TEST_F(SanctionsListMod, ReplaceSanctionSignatures)
         sanctions_list_check_integrity(&mod, &mod.sanctions_creds, sanctions, mod.num_sanctions));
 }
 
+TEST_F(SanctionsListMod, ModifiedKnownEntryIsVerified)
+{
+    // The signature matches one of our entries, but the signed data doesn't.
+    Mod_Sanction modified[2] = {sanctions[0], sanctions[1]};
+    ++modified[1].time_set;
+
+    EXPECT_FALSE(
+        sanctions_list_check_integrity(&mod, &mod.sanctions_creds, modified, mod.num_sanctions));
+}
+
+TEST_F(SanctionsListMod, KnownEntryOfRemovedModIsRejected)
+{
+    ASSERT_TRUE(mod_list_remove_entry(&mod, get_sig_pk(pk.data())));
+    EXPECT_FALSE(
+        sanctions_list_check_integrity(&mod, &mod.sanctions_creds, sanctions, mod.num_sanctions));
+    ASSERT_TRUE(mod_list_add_entry(&mod, get_sig_pk(pk.data())));
+}
+
 }  // namespace
@@ -0,0 +1,422 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Spanning tree planning and replay protection for relayed group broadcasts.
+ */
+#include "group_relay.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccompat.h"
+#include "util.h"
+
+/** Number of ids behind the highest one that a window remembers. */
+#define GC_RELAY_WINDOW_SIZE 64
+
+bool gc_relay_window_check(GC_Relay_Window *window, uint64_t id)
+{
+    if (window->seen == 0) {
+        window->max_id = id;
+        window->seen = 1;
+        return true;
+    }
+
+    if (id > window->max_id) {
+        const uint64_t shift = id - window->max_id;
+        window->seen = shift < GC_RELAY_WINDOW_SIZE ? (window->seen << shift) | 1 : 1;
+        window->max_id = id;
+        return true;
+    }
+
+    const uint64_t behind = window->max_id - id;
+
+    if (behind >= GC_RELAY_WINDOW_SIZE) {
+        return false;
+    }
+
+    const uint64_t bit = (uint64_t)1 << behind;
+
+    if ((window->seen & bit) != 0) {
+        return false;
+    }
+
+    window->seen |= bit;
+    return true;
+}
+
+bool gc_relay_origins_init(GC_Relay_Origins *origins, uint64_t seed)
+{
+    origins->origins = nullptr;
+    origins->num_origins = 0;
+    origins->capacity = 0;
+    origins->uses = 0;
+
+    return hash_list_init(&origins->index, SIG_PUBLIC_KEY_SIZE, 0, seed) == 1;
+}
+
+void gc_relay_origins_free(GC_Relay_Origins *origins)
+{
+    if (origins == nullptr) {
+        return;
+    }
+
+    hash_list_free(&origins->index);
+    free(origins->origins);
+    origins->origins = nullptr;
+    origins->num_origins = 0;
+    origins->capacity = 0;
+}
+
+/** @brief Removes the origin at `index`, moving the last origin into its place. */
+non_null()
+static void relay_origins_remove_index(GC_Relay_Origins *origins, uint32_t index)
+{
+    hash_list_remove(&origins->index, origins->origins[index].sig_pk, (int)index);
+
+    --origins->num_origins;
+
+    if (index == origins->num_origins) {
+        return;
+    }
+
+    // Removing the moved origin first frees the room its new entry needs
+    const uint32_t last = origins->num_origins;
+    hash_list_remove(&origins->index, origins->origins[last].sig_pk, (int)last);
+    origins->origins[index] = origins->origins[last];
+    hash_list_add(&origins->index, origins->origins[index].sig_pk, (int)index);
+}
+
+/** @brief Makes room for one more origin, dropping the least recently used one if
+ * the table is full.
+ *
+ * Returns false on allocation failure.
+ */
+non_null()
+static bool relay_origins_reserve(GC_Relay_Origins *origins)
+{
+    if (origins->num_origins >= GC_RELAY_MAX_ORIGINS) {
+        uint32_t oldest = 0;
+
+        for (uint32_t i = 1; i < origins->num_origins; ++i) {
+            if (origins->origins[i].last_used < origins->origins[oldest].last_used) {
+                oldest = i;
+            }
+        }
+
+        relay_origins_remove_index(origins, oldest);
+        return true;
+    }
+
+    if (origins->num_origins < origins->capacity) {
+        return true;
+    }
+
+    const uint32_t new_capacity = min_u32(origins->capacity == 0 ? 8 : origins->capacity * 2, GC_RELAY_MAX_ORIGINS);
+
+    GC_Relay_Origin *new_origins = (GC_Relay_Origin *)realloc(origins->origins,
+                                   new_capacity * sizeof(GC_Relay_Origin));
+
+    if (new_origins == nullptr) {
+        return false;
+    }
+
+    origins->origins = new_origins;
+    origins->capacity = new_capacity;
+
+    return true;
+}
+
+int gc_relay_origins_check(GC_Relay_Origins *origins, const uint8_t *sig_pk, uint64_t id)
+{
+    ++origins->uses;
+
+    const int index = hash_list_find(&origins->index, sig_pk);
+
+    if (index >= 0) {
+        GC_Relay_Origin *origin = &origins->origins[index];
+        origin->last_used = origins->uses;
+        return gc_relay_window_check(&origin->window, id) ? 1 : 0;
+    }
+
+    if (!relay_origins_reserve(origins)) {
+        return -1;
+    }
+
+    if (!hash_list_add(&origins->index, sig_pk, (int)origins->num_origins)) {
+        return -1;
+    }
+
+    GC_Relay_Origin *origin = &origins->origins[origins->num_origins];
+    ++origins->num_origins;
+
+    memcpy(origin->sig_pk, sig_pk, SIG_PUBLIC_KEY_SIZE);
+    origin->window.max_id = 0;
+    origin->window.seen = 0;
+    origin->last_used = origins->uses;
+
+    return gc_relay_window_check(&origin->window, id) ? 1 : 0;
+}
+
+void gc_relay_origins_remove(GC_Relay_Origins *origins, const uint8_t *sig_pk)
+{
+    const int index = hash_list_find(&origins->index, sig_pk);
+
+    if (index >= 0) {
+        relay_origins_remove_index(origins, (uint32_t)index);
+    }
+}
+
+/** @brief Frees the copies held by `pending`. */
+non_null()
+static void relay_pending_clear(GC_Relay_Pending *pending)
+{
+    free(pending->packet);
+    free(pending->branches);
+    pending->packet = nullptr;
+    pending->branches = nullptr;
+    pending->num_branches = 0;
+}
+
+bool gc_relay_pending_add(GC_Relay_Pending_List *list, const uint8_t *origin_pk, uint64_t id,
+                          const uint8_t *packet, uint16_t length, const uint8_t *parent_pk,
+                          const GC_Relay_Pending_Branch *branches, uint32_t num_branches, uint64_t time_added)
+{
+    uint8_t *packet_copy = (uint8_t *)malloc(length);
+
+    if (packet_copy == nullptr) {
+        return false;
+    }
+
+    GC_Relay_Pending_Branch *branches_copy = (GC_Relay_Pending_Branch *)calloc(num_branches,
+            sizeof(GC_Relay_Pending_Branch));
+
+    if (branches_copy == nullptr) {
+        free(packet_copy);
+        return false;
+    }
+
+    memcpy(packet_copy, packet, length);
+    memcpy(branches_copy, branches, num_branches * sizeof(GC_Relay_Pending_Branch));
+
+    if (list->num_entries == GC_RELAY_MAX_PENDING) {
+        gc_relay_pending_remove(list, 0);
+    }
+
+    GC_Relay_Pending *pending = &list->entries[list->num_entries];
+    ++list->num_entries;
+
+    memcpy(pending->origin_pk, origin_pk, ENC_PUBLIC_KEY_SIZE);
+    pending->id = id;
+    pending->packet = packet_copy;
+    pending->length = length;
+    pending->has_parent = parent_pk != nullptr;
+
+    if (parent_pk != nullptr) {
+        memcpy(pending->parent_pk, parent_pk, ENC_PUBLIC_KEY_SIZE);
+    } else {
+        memset(pending->parent_pk, 0, ENC_PUBLIC_KEY_SIZE);
+    }
+
+    pending->branches = branches_copy;
+    pending->num_branches = num_branches;
+    pending->time_added = time_added;
+
+    return true;
+}
+
+int gc_relay_pending_find(const GC_Relay_Pending_List *list, const uint8_t *origin_pk, uint64_t id)
+{
+    for (uint32_t i = 0; i < list->num_entries; ++i) {
+        const GC_Relay_Pending *pending = &list->entries[i];
+
+        if (pending->id == id && memcmp(pending->origin_pk, origin_pk, ENC_PUBLIC_KEY_SIZE) == 0) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+void gc_relay_pending_remove_branch(GC_Relay_Pending *pending, uint32_t branch_index)
+{
+    if (branch_index >= pending->num_branches) {
+        return;
+    }
+
+    --pending->num_branches;
+    pending->branches[branch_index] = pending->branches[pending->num_branches];
+}
+
+void gc_relay_pending_remove(GC_Relay_Pending_List *list, uint32_t index)
+{
+    if (index >= list->num_entries) {
+        return;
+    }
+
+    relay_pending_clear(&list->entries[index]);
+
+    --list->num_entries;
+    memmove(&list->entries[index], &list->entries[index + 1],
+            (list->num_entries - index) * sizeof(GC_Relay_Pending));
+}
+
+void gc_relay_pending_free(GC_Relay_Pending_List *list)
+{
+    if (list == nullptr) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < list->num_entries; ++i) {
+        relay_pending_clear(&list->entries[i]);
+    }
+
+    list->num_entries = 0;
+}
+
+bool gc_relay_range_is_empty(uint32_t range_start, uint32_t range_end)
+{
+    return range_end < range_start;
+}
+
+non_null()
+static int cmp_relay_candidate(const void *a, const void *b)
+{
+    const GC_Relay_Candidate *ca = (const GC_Relay_Candidate *)a;
+    const GC_Relay_Candidate *cb = (const GC_Relay_Candidate *)b;
+
+    if (ca->hash != cb->hash) {
+        return ca->hash < cb->hash ? -1 : 1;
+    }
+
+    if (ca->peer_number != cb->peer_number) {
+        return ca->peer_number < cb->peer_number ? -1 : 1;
+    }
+
+    return 0;
+}
+
+/** @brief Returns true if candidate `i` can't be part of a range because its hash isn't unique. */
+non_null()
+static bool relay_candidate_collides(const GC_Relay_Candidate *candidates, uint32_t num_candidates, uint32_t i,
+                                     uint32_t self_hash)
+{
+    const uint32_t hash = candidates[i].hash;
+
+    return hash == self_hash
+           || (i > 0 && candidates[i - 1].hash == hash)
+           || (i + 1 < num_candidates && candidates[i + 1].hash == hash);
+}
+
+/** @brief Splits the sorted candidates `start` to `end - 1`, none of which has a hash on
+ * the other side of ours, into branches of about `chunk_size` candidates.
+ *
+ * Returns the number of branches added to `branches`.
+ */
+non_null()
+static uint32_t relay_plan_segment(const GC_Relay_Candidate *candidates, uint32_t num_candidates, uint32_t start,
+                                   uint32_t end, uint32_t self_hash, uint32_t chunk_size, GC_Relay_Branch *branches)
+{
+    uint32_t num_branches = 0;
+    uint32_t i = start;
+
+    while (i < end) {
+        GC_Relay_Branch *branch = &branches[num_branches];
+        ++num_branches;
+
+        if (relay_candidate_collides(candidates, num_candidates, i, self_hash)) {
+            branch->peer_number = candidates[i].peer_number;
+            branch->range_start = 1;
+            branch->range_end = 0;
+            ++i;
+            continue;
+        }
+
+        uint32_t last = i;
+
+        while (last + 1 < end && last + 1 - i < chunk_size
+                && !relay_candidate_collides(candidates, num_candidates, last + 1, self_hash)) {
+            ++last;
+        }
+
+        // The peer at either end of the chunk can forward to the rest of it, so
+        // prefer whichever of them we can reach directly.
+        if (candidates[i].direct || !candidates[last].direct) {
+            branch->peer_number = candidates[i].peer_number;
+            branch->range_start = i == last ? 1 : candidates[i + 1].hash;
+            branch->range_end = i == last ? 0 : candidates[last].hash;
+        } else {
+            branch->peer_number = candidates[last].peer_number;
+            branch->range_start = candidates[i].hash;
+            branch->range_end = candidates[last - 1].hash;
+        }
+
+        i = last + 1;
+    }
+
+    return num_branches;
+}
+
+uint32_t gc_relay_plan(GC_Relay_Candidate *candidates, uint32_t num_candidates, uint32_t self_hash,
+                       uint16_t fanout, GC_Relay_Branch *branches)
+{
+    if (num_candidates == 0) {
+        return 0;
+    }
+
+    if (fanout == 0) {
+        fanout = 1;
+    }
+
+    qsort(candidates, num_candidates, sizeof(GC_Relay_Candidate), cmp_relay_candidate);
+
+    // A branch must not span our own hash, or the tree below it would send the
+    // broadcast back to us, so the candidates below and above us are split
+    // separately.
+    uint32_t below = 0;
+
+    while (below < num_candidates && candidates[below].hash < self_hash) {
+        ++below;
+    }
+
+    const uint32_t above = num_candidates - below;
+
+    if (fanout == 1 && below > 0 && above > 0) {
+        // Only the peer that created a broadcast has candidates on both sides of
+        // its own hash, and forwarders never send a broadcast back to the peer
+        // that created it, so a single branch may span our hash here.
+        return relay_plan_segment(candidates, num_candidates, 0, num_candidates, self_hash, num_candidates,
+                                  branches);
+    }
+
+    uint32_t chunks_below = 0;
+    uint32_t chunks_above = 0;
+
+    if (above == 0) {
+        chunks_below = fanout;
+    } else if (below == 0) {
+        chunks_above = fanout;
+    } else {
+        chunks_below = (uint32_t)(((uint64_t)fanout * below + num_candidates / 2) / num_candidates);
+        chunks_below = max_u32(1, min_u32(chunks_below, (uint32_t)fanout - 1));
+        chunks_above = max_u32(1, fanout - chunks_below);
+    }
+
+    uint32_t num_branches = 0;
+
+    if (below > 0) {
+        const uint32_t chunk_size = (below + chunks_below - 1) / chunks_below;
+        num_branches += relay_plan_segment(candidates, num_candidates, 0, below, self_hash, chunk_size,
+                                           branches + num_branches);
+    }
+
+    if (above > 0) {
+        const uint32_t chunk_size = (above + chunks_above - 1) / chunks_above;
+        num_branches += relay_plan_segment(candidates, num_candidates, below, num_candidates, self_hash, chunk_size,
+                                           branches + num_branches);
+    }
+
+    return num_branches;
+}
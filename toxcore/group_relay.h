@@ -0,0 +1,217 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Spanning tree planning and replay protection for relayed group broadcasts.
+ *
+ * Instead of sending a broadcast to every peer itself, the originating peer
+ * splits the peers, ordered by the hash of their public key, into at most
+ * `fanout` contiguous branches and sends the broadcast once to one peer of
+ * each branch. That peer forwards it the same way to the rest of its branch,
+ * and so on, so the broadcast reaches n peers in about log(n) hops with each
+ * peer sending at most `fanout` packets.
+ *
+ * A branch is described by the range of hashes the receiving peer is
+ * responsible for. The range never contains the hash of the receiver or of the
+ * peer that planned it, so a peer that already has the broadcast is never
+ * included again further down the tree. Peers whose hash collides with another
+ * peer's get their own branch with an empty range.
+ *
+ * A peer acks a relayed broadcast to the peer it got it from once every branch
+ * below it acked, so an ack covers the whole branch. Until then the sender
+ * keeps a copy of the broadcast, and if the peer of a branch leaves before
+ * acking, the sender sends the broadcast directly to every peer in the range
+ * of that branch instead.
+ */
+#ifndef C_TOXCORE_TOXCORE_GROUP_RELAY_H
+#define C_TOXCORE_TOXCORE_GROUP_RELAY_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attributes.h"
+#include "crypto_core.h"
+#include "list.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Largest number of branches a peer splits a relayed broadcast into. */
+#define GC_RELAY_MAX_FANOUT 64
+
+/** Largest number of peers whose relay windows we keep. */
+#define GC_RELAY_MAX_ORIGINS 1024
+
+/** Largest number of relayed broadcasts we wait for acks for at a time. */
+#define GC_RELAY_MAX_PENDING 64
+
+/** Remembers which relayed broadcast ids of one peer were already seen. */
+typedef struct GC_Relay_Window {
+    uint64_t max_id;    /* highest id seen so far */
+    uint64_t seen;      /* bit i is set if id `max_id - i` was seen */
+} GC_Relay_Window;
+
+/** The relay window of one peer. */
+typedef struct GC_Relay_Origin {
+    uint8_t  sig_pk[SIG_PUBLIC_KEY_SIZE];
+    GC_Relay_Window window;
+    uint64_t last_used;  /* value of `uses` of the table when the window was last checked */
+} GC_Relay_Origin;
+
+/** @brief The relay windows of the peers whose relayed broadcasts we've seen, by their
+ * signature public key.
+ *
+ * An entry outlives the connection to the peer, so when a peer reconnects, its
+ * old broadcasts can't be replayed to us. It is removed when the peer leaves the
+ * group for good, and once the table holds `GC_RELAY_MAX_ORIGINS` entries, the
+ * least recently used one makes room for a new peer.
+ */
+typedef struct GC_Relay_Origins {
+    Hash_List index;            /* signature public key -> index into `origins` */
+    GC_Relay_Origin *origins;
+    uint32_t num_origins;
+    uint32_t capacity;
+    uint64_t uses;              /* number of windows checked so far */
+} GC_Relay_Origins;
+
+/** A branch of a relayed broadcast we sent that hasn't acked it yet. */
+typedef struct GC_Relay_Pending_Branch {
+    uint8_t  peer_pk[ENC_PUBLIC_KEY_SIZE];  /* the peer we sent it to */
+    uint32_t peer_id;                       /* its peer id, which changes if it reconnects */
+    uint32_t range_start;
+    uint32_t range_end;
+} GC_Relay_Pending_Branch;
+
+/** A relayed broadcast we sent or forwarded and wait for the acks of its branches for. */
+typedef struct GC_Relay_Pending {
+    uint8_t  origin_pk[ENC_PUBLIC_KEY_SIZE];  /* the peer that created the broadcast */
+    uint64_t id;
+    uint8_t  *packet;       /* the relayed broadcast, to send again if a branch fails */
+    uint16_t length;
+    bool     has_parent;    /* false if we created the broadcast */
+    uint8_t  parent_pk[ENC_PUBLIC_KEY_SIZE];  /* the peer to ack to once every branch acked */
+    GC_Relay_Pending_Branch *branches;
+    uint32_t num_branches;
+    uint64_t time_added;
+} GC_Relay_Pending;
+
+/** The relayed broadcasts we wait for acks for, oldest first. */
+typedef struct GC_Relay_Pending_List {
+    GC_Relay_Pending entries[GC_RELAY_MAX_PENDING];
+    uint32_t num_entries;
+} GC_Relay_Pending_List;
+
+/** A peer a relayed broadcast may be sent to. */
+typedef struct GC_Relay_Candidate {
+    uint32_t hash;          /* hash of the peer's public key, its position in the tree */
+    uint32_t peer_number;
+    bool     direct;        /* true if we have a direct UDP connection to the peer */
+} GC_Relay_Candidate;
+
+/** A peer to send the broadcast to and the range of hashes it forwards it to. */
+typedef struct GC_Relay_Branch {
+    uint32_t peer_number;
+    uint32_t range_start;
+    uint32_t range_end;     /* the range is empty if range_end < range_start */
+} GC_Relay_Branch;
+
+/** @brief Records `id` in `window`.
+ *
+ * Ids may arrive out of order as long as they are no more than 63 behind the
+ * highest id seen.
+ *
+ * @retval true if `id` was not seen before.
+ * @retval false if it is a duplicate or too old to tell.
+ */
+non_null()
+bool gc_relay_window_check(GC_Relay_Window *window, uint64_t id);
+
+/** @brief Initialises an empty set of relay windows.
+ *
+ * @param seed randomises the hash of the keys. Pass a random value.
+ *
+ * @retval true on success.
+ * @retval false on allocation failure.
+ */
+non_null()
+bool gc_relay_origins_init(GC_Relay_Origins *origins, uint64_t seed);
+
+/** @brief Frees the relay windows. */
+nullable(1)
+void gc_relay_origins_free(GC_Relay_Origins *origins);
+
+/** @brief Records `id` in the relay window of the peer with signature public key `sig_pk`.
+ *
+ * If there is no window for the peer yet and the table is full, the least
+ * recently used window is dropped.
+ *
+ * @retval 1 if `id` was not seen before.
+ * @retval 0 if it is a duplicate or too old to tell.
+ * @retval -1 if there was no window for the peer yet and allocating one failed.
+ */
+non_null()
+int gc_relay_origins_check(GC_Relay_Origins *origins, const uint8_t *sig_pk, uint64_t id);
+
+/** @brief Drops the relay window of the peer with signature public key `sig_pk`, if any. */
+non_null()
+void gc_relay_origins_remove(GC_Relay_Origins *origins, const uint8_t *sig_pk);
+
+/** @brief Starts waiting for the acks of `num_branches` branches of a relayed broadcast.
+ *
+ * `packet` and `branches` are copied. If `GC_RELAY_MAX_PENDING` broadcasts are
+ * pending already, the oldest one is dropped.
+ *
+ * @param parent_pk the peer we got the broadcast from, or null if we created it.
+ *
+ * @retval true on success.
+ * @retval false on allocation failure.
+ */
+non_null(1, 2, 4, 7) nullable(6)
+bool gc_relay_pending_add(GC_Relay_Pending_List *list, const uint8_t *origin_pk, uint64_t id,
+                          const uint8_t *packet, uint16_t length, const uint8_t *parent_pk,
+                          const GC_Relay_Pending_Branch *branches, uint32_t num_branches, uint64_t time_added);
+
+/** @brief Returns the index of the pending relayed broadcast `id` created by `origin_pk`,
+ * or -1 if we don't wait for acks for it.
+ */
+non_null()
+int gc_relay_pending_find(const GC_Relay_Pending_List *list, const uint8_t *origin_pk, uint64_t id);
+
+/** @brief Stops waiting for branch `branch_index` of `pending`. */
+non_null()
+void gc_relay_pending_remove_branch(GC_Relay_Pending *pending, uint32_t branch_index);
+
+/** @brief Stops waiting for the pending relayed broadcast at `index`. */
+non_null()
+void gc_relay_pending_remove(GC_Relay_Pending_List *list, uint32_t index);
+
+/** @brief Frees every pending relayed broadcast. */
+nullable(1)
+void gc_relay_pending_free(GC_Relay_Pending_List *list);
+
+/** @brief Returns true if the range from `range_start` to `range_end` contains no hash. */
+bool gc_relay_range_is_empty(uint32_t range_start, uint32_t range_end);
+
+/** @brief Splits `candidates` into branches of the tree below us.
+ *
+ * All candidates must have a hash in our range and must not be us. The array
+ * is sorted by hash in place.
+ *
+ * @param self_hash the hash of our own public key.
+ * @param fanout the number of branches to aim for, at least 1.
+ * @param branches must have room for `num_candidates` entries.
+ *
+ * @return the number of branches. This is at most `fanout`, except that
+ *   colliding hashes get a branch each.
+ */
+non_null()
+uint32_t gc_relay_plan(GC_Relay_Candidate *candidates, uint32_t num_candidates, uint32_t self_hash,
+                       uint16_t fanout, GC_Relay_Branch *branches);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif // C_TOXCORE_TOXCORE_GROUP_RELAY_H
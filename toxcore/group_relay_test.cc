@@ -0,0 +1,392 @@
+#include "group_relay.h"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstring>
+#include <deque>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Delivery {
+    uint32_t peer;
+    uint32_t sender;
+    uint32_t range_start;
+    uint32_t range_end;
+};
+
+std::vector<GC_Relay_Branch> plan(std::vector<GC_Relay_Candidate> candidates, uint32_t self_hash, uint16_t fanout)
+{
+    std::vector<GC_Relay_Branch> branches(candidates.size());
+    const uint32_t num = gc_relay_plan(candidates.data(), static_cast<uint32_t>(candidates.size()), self_hash, fanout,
+                                       branches.data());
+    branches.resize(num);
+    return branches;
+}
+
+/** Runs a relayed broadcast from `origin` through a group in which everyone knows everyone.
+ *
+ * Returns how often each peer received the broadcast and sets `sent` to the number of packets each peer sent.
+ */
+std::vector<uint32_t> simulate(const std::vector<uint32_t> &hashes, uint32_t origin, uint16_t fanout,
+                               std::vector<uint32_t> &sent)
+{
+    std::vector<uint32_t> received(hashes.size());
+    sent.assign(hashes.size(), 0);
+    std::deque<Delivery> queue;
+
+    auto send_to_branches = [&](uint32_t self, uint32_t sender, uint32_t range_start, uint32_t range_end) {
+        std::vector<GC_Relay_Candidate> candidates;
+
+        for (uint32_t i = 0; i < hashes.size(); ++i) {
+            if (i == self || i == origin || i == sender) {
+                continue;
+            }
+
+            if (hashes[i] >= range_start && hashes[i] <= range_end) {
+                candidates.push_back({hashes[i], i, i % 3 != 0});
+            }
+        }
+
+        for (const GC_Relay_Branch &branch : plan(candidates, hashes[self], fanout)) {
+            queue.push_back({branch.peer_number, self, branch.range_start, branch.range_end});
+            ++sent[self];
+        }
+    };
+
+    send_to_branches(origin, origin, 0, UINT32_MAX);
+
+    while (!queue.empty()) {
+        const Delivery delivery = queue.front();
+        queue.pop_front();
+
+        ++received[delivery.peer];
+
+        if (!gc_relay_range_is_empty(delivery.range_start, delivery.range_end)) {
+            send_to_branches(delivery.peer, delivery.sender, delivery.range_start, delivery.range_end);
+        }
+    }
+
+    return received;
+}
+
+TEST(GroupRelay, WindowAcceptsEachIdOnce)
+{
+    GC_Relay_Window window{};
+
+    EXPECT_TRUE(gc_relay_window_check(&window, 1000));
+    EXPECT_FALSE(gc_relay_window_check(&window, 1000));
+    EXPECT_TRUE(gc_relay_window_check(&window, 1002));
+    EXPECT_TRUE(gc_relay_window_check(&window, 1001));
+    EXPECT_FALSE(gc_relay_window_check(&window, 1001));
+    EXPECT_FALSE(gc_relay_window_check(&window, 1002));
+}
+
+TEST(GroupRelay, WindowForgetsOldIds)
+{
+    GC_Relay_Window window{};
+
+    EXPECT_TRUE(gc_relay_window_check(&window, 5));
+    EXPECT_TRUE(gc_relay_window_check(&window, 5 + 63));
+    EXPECT_TRUE(gc_relay_window_check(&window, 6));
+    EXPECT_FALSE(gc_relay_window_check(&window, 6));
+
+    EXPECT_TRUE(gc_relay_window_check(&window, 5 + 64));
+    EXPECT_FALSE(gc_relay_window_check(&window, 5));
+    EXPECT_FALSE(gc_relay_window_check(&window, 6));
+
+    EXPECT_TRUE(gc_relay_window_check(&window, 1000));
+    EXPECT_FALSE(gc_relay_window_check(&window, 5 + 64));
+    EXPECT_TRUE(gc_relay_window_check(&window, 999));
+}
+
+TEST(GroupRelay, OriginsRejectReplayAfterReconnect)
+{
+    GC_Relay_Origins origins;
+    ASSERT_TRUE(gc_relay_origins_init(&origins, 42));
+
+    std::array<uint8_t, SIG_PUBLIC_KEY_SIZE> origin{};
+    std::array<uint8_t, SIG_PUBLIC_KEY_SIZE> other{};
+    origin[0] = 1;
+    other[0] = 2;
+
+    EXPECT_EQ(gc_relay_origins_check(&origins, origin.data(), 1000), 1);
+    EXPECT_EQ(gc_relay_origins_check(&origins, origin.data(), 1001), 1);
+
+    // The origin leaves and rejoins, so it gets a new peer number and
+    // connection, but not a new signature key. A relay replaying its old
+    // broadcasts must still be caught.
+    EXPECT_EQ(gc_relay_origins_check(&origins, origin.data(), 1000), 0);
+    EXPECT_EQ(gc_relay_origins_check(&origins, origin.data(), 1001), 0);
+    EXPECT_EQ(gc_relay_origins_check(&origins, origin.data(), 1002), 1);
+
+    // Ids are per origin.
+    EXPECT_EQ(gc_relay_origins_check(&origins, other.data(), 1000), 1);
+
+    gc_relay_origins_free(&origins);
+}
+
+TEST(GroupRelay, OriginsKeepWindowsWhileGrowing)
+{
+    GC_Relay_Origins origins;
+    ASSERT_TRUE(gc_relay_origins_init(&origins, 42));
+
+    std::array<uint8_t, SIG_PUBLIC_KEY_SIZE> key{};
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        std::memcpy(key.data(), &i, sizeof(i));
+        ASSERT_EQ(gc_relay_origins_check(&origins, key.data(), i), 1);
+    }
+
+    for (uint32_t i = 0; i < 1000; ++i) {
+        std::memcpy(key.data(), &i, sizeof(i));
+        EXPECT_EQ(gc_relay_origins_check(&origins, key.data(), i), 0) << "origin " << i;
+        EXPECT_EQ(gc_relay_origins_check(&origins, key.data(), i + 1), 1) << "origin " << i;
+    }
+
+    gc_relay_origins_free(&origins);
+}
+
+TEST(GroupRelay, OriginsForgetRemovedPeer)
+{
+    GC_Relay_Origins origins;
+    ASSERT_TRUE(gc_relay_origins_init(&origins, 42));
+
+    std::array<uint8_t, SIG_PUBLIC_KEY_SIZE> key{};
+
+    for (uint32_t i = 0; i < 3; ++i) {
+        key[0] = static_cast<uint8_t>(i);
+        ASSERT_EQ(gc_relay_origins_check(&origins, key.data(), 1000), 1);
+    }
+
+    key[0] = 0;
+    gc_relay_origins_remove(&origins, key.data());
+    EXPECT_EQ(origins.num_origins, 2);
+    EXPECT_EQ(gc_relay_origins_check(&origins, key.data(), 1000), 1);
+
+    // The peer that took the place of the removed one keeps its window.
+    key[0] = 2;
+    EXPECT_EQ(gc_relay_origins_check(&origins, key.data(), 1000), 0);
+
+    gc_relay_origins_free(&origins);
+}
+
+TEST(GroupRelay, OriginsDropLeastRecentlyUsedWhenFull)
+{
+    GC_Relay_Origins origins;
+    ASSERT_TRUE(gc_relay_origins_init(&origins, 42));
+
+    std::array<uint8_t, SIG_PUBLIC_KEY_SIZE> key{};
+
+    for (uint32_t i = 0; i < GC_RELAY_MAX_ORIGINS; ++i) {
+        std::memcpy(key.data(), &i, sizeof(i));
+        ASSERT_EQ(gc_relay_origins_check(&origins, key.data(), 1000), 1);
+    }
+
+    // Origin 0 is used again, so origin 1 is the least recently used one.
+    uint32_t index = 0;
+    std::memcpy(key.data(), &index, sizeof(index));
+    ASSERT_EQ(gc_relay_origins_check(&origins, key.data(), 1001), 1);
+
+    index = GC_RELAY_MAX_ORIGINS;
+    std::memcpy(key.data(), &index, sizeof(index));
+    ASSERT_EQ(gc_relay_origins_check(&origins, key.data(), 1000), 1);
+    EXPECT_EQ(origins.num_origins, GC_RELAY_MAX_ORIGINS);
+
+    index = 0;
+    std::memcpy(key.data(), &index, sizeof(index));
+    EXPECT_EQ(gc_relay_origins_check(&origins, key.data(), 1001), 0);
+
+    index = 1;
+    std::memcpy(key.data(), &index, sizeof(index));
+    EXPECT_EQ(gc_relay_origins_check(&origins, key.data(), 1000), 1);
+
+    gc_relay_origins_free(&origins);
+}
+
+TEST(GroupRelay, PendingBroadcastsAreFoundByOriginAndId)
+{
+    GC_Relay_Pending_List list{};
+
+    std::array<uint8_t, ENC_PUBLIC_KEY_SIZE> origin{};
+    std::array<uint8_t, ENC_PUBLIC_KEY_SIZE> parent{};
+    origin[0] = 1;
+    parent[0] = 2;
+
+    const std::array<uint8_t, 4> packet = {1, 2, 3, 4};
+    std::vector<GC_Relay_Pending_Branch> branches(2);
+    branches[0].peer_id = 10;
+    branches[1].peer_id = 11;
+
+    ASSERT_TRUE(gc_relay_pending_add(&list, origin.data(), 7, packet.data(), packet.size(), parent.data(),
+                                     branches.data(), branches.size(), 100));
+    ASSERT_TRUE(gc_relay_pending_add(&list, origin.data(), 8, packet.data(), packet.size(), nullptr,
+                                     branches.data(), 1, 100));
+
+    ASSERT_EQ(gc_relay_pending_find(&list, origin.data(), 7), 0);
+    ASSERT_EQ(gc_relay_pending_find(&list, origin.data(), 8), 1);
+    EXPECT_EQ(gc_relay_pending_find(&list, parent.data(), 7), -1);
+    EXPECT_EQ(gc_relay_pending_find(&list, origin.data(), 9), -1);
+
+    const GC_Relay_Pending *first = &list.entries[0];
+    EXPECT_TRUE(first->has_parent);
+    EXPECT_EQ(std::memcmp(first->parent_pk, parent.data(), parent.size()), 0);
+    EXPECT_EQ(std::memcmp(first->packet, packet.data(), packet.size()), 0);
+    EXPECT_FALSE(list.entries[1].has_parent);
+
+    gc_relay_pending_remove_branch(&list.entries[0], 0);
+    ASSERT_EQ(list.entries[0].num_branches, 1);
+    EXPECT_EQ(list.entries[0].branches[0].peer_id, 11);
+
+    gc_relay_pending_remove(&list, 0);
+    EXPECT_EQ(gc_relay_pending_find(&list, origin.data(), 7), -1);
+    EXPECT_EQ(gc_relay_pending_find(&list, origin.data(), 8), 0);
+
+    gc_relay_pending_free(&list);
+    EXPECT_EQ(list.num_entries, 0);
+}
+
+TEST(GroupRelay, PendingDropsOldestWhenFull)
+{
+    GC_Relay_Pending_List list{};
+
+    std::array<uint8_t, ENC_PUBLIC_KEY_SIZE> origin{};
+    const std::array<uint8_t, 4> packet = {1, 2, 3, 4};
+    GC_Relay_Pending_Branch branch{};
+
+    for (uint64_t id = 0; id <= GC_RELAY_MAX_PENDING; ++id) {
+        ASSERT_TRUE(gc_relay_pending_add(&list, origin.data(), id, packet.data(), packet.size(), nullptr, &branch,
+                                         1, id));
+    }
+
+    EXPECT_EQ(list.num_entries, GC_RELAY_MAX_PENDING);
+    EXPECT_EQ(gc_relay_pending_find(&list, origin.data(), 0), -1);
+    EXPECT_EQ(gc_relay_pending_find(&list, origin.data(), 1), 0);
+    EXPECT_EQ(gc_relay_pending_find(&list, origin.data(), GC_RELAY_MAX_PENDING), GC_RELAY_MAX_PENDING - 1);
+
+    gc_relay_pending_free(&list);
+}
+
+TEST(GroupRelay, PlanPrefersDirectPeersAtChunkEnds)
+{
+    const std::vector<GC_Relay_Candidate> candidates = {
+        {10, 1, false}, {20, 2, false}, {30, 3, true},
+        {40, 4, false}, {50, 5, false}, {60, 6, false},
+    };
+
+    const std::vector<GC_Relay_Branch> branches = plan(candidates, 100, 2);
+    ASSERT_EQ(branches.size(), 2);
+
+    EXPECT_EQ(branches[0].peer_number, 3);
+    EXPECT_EQ(branches[0].range_start, 10);
+    EXPECT_EQ(branches[0].range_end, 20);
+
+    EXPECT_EQ(branches[1].peer_number, 4);
+    EXPECT_EQ(branches[1].range_start, 50);
+    EXPECT_EQ(branches[1].range_end, 60);
+}
+
+TEST(GroupRelay, PlanNeverSpansOwnHash)
+{
+    const std::vector<GC_Relay_Candidate> candidates = {
+        {10, 1, true}, {20, 2, true}, {30, 3, true}, {40, 4, true},
+    };
+
+    const std::vector<GC_Relay_Branch> branches = plan(candidates, 35, 2);
+    ASSERT_EQ(branches.size(), 2);
+
+    EXPECT_EQ(branches[0].peer_number, 1);
+    EXPECT_EQ(branches[0].range_start, 20);
+    EXPECT_EQ(branches[0].range_end, 30);
+
+    EXPECT_EQ(branches[1].peer_number, 4);
+    EXPECT_TRUE(gc_relay_range_is_empty(branches[1].range_start, branches[1].range_end));
+}
+
+TEST(GroupRelay, PlanWithFanoutOneHasOneBranch)
+{
+    const std::vector<GC_Relay_Candidate> candidates = {
+        {10, 1, true}, {20, 2, true}, {30, 3, true}, {40, 4, true},
+    };
+
+    const std::vector<GC_Relay_Branch> branches = plan(candidates, 35, 1);
+    ASSERT_EQ(branches.size(), 1);
+
+    EXPECT_EQ(branches[0].peer_number, 1);
+    EXPECT_EQ(branches[0].range_start, 20);
+    EXPECT_EQ(branches[0].range_end, 40);
+}
+
+TEST(GroupRelay, PlanSendsCollidingHashesDirectly)
+{
+    const std::vector<GC_Relay_Candidate> candidates = {
+        {10, 1, true}, {20, 2, true}, {20, 3, true}, {30, 4, true}, {40, 5, true},
+    };
+
+    const std::vector<GC_Relay_Branch> branches = plan(candidates, 0, 1);
+    ASSERT_EQ(branches.size(), 4);
+
+    EXPECT_EQ(branches[0].peer_number, 1);
+    EXPECT_TRUE(gc_relay_range_is_empty(branches[0].range_start, branches[0].range_end));
+    EXPECT_EQ(branches[1].peer_number, 2);
+    EXPECT_TRUE(gc_relay_range_is_empty(branches[1].range_start, branches[1].range_end));
+    EXPECT_EQ(branches[2].peer_number, 3);
+    EXPECT_TRUE(gc_relay_range_is_empty(branches[2].range_start, branches[2].range_end));
+    EXPECT_EQ(branches[3].peer_number, 4);
+    EXPECT_EQ(branches[3].range_start, 40);
+    EXPECT_EQ(branches[3].range_end, 40);
+}
+
+TEST(GroupRelay, TreeReachesEveryPeerOnce)
+{
+    std::mt19937 rng(42);
+    std::vector<uint32_t> hashes(500);
+
+    for (uint32_t &hash : hashes) {
+        hash = rng();
+    }
+
+    for (const uint16_t fanout : {1, 2, 4, 8, 16}) {
+        std::vector<uint32_t> sent;
+        const std::vector<uint32_t> received = simulate(hashes, 0, fanout, sent);
+
+        EXPECT_EQ(received[0], 0) << "fanout " << fanout;
+
+        for (uint32_t i = 1; i < hashes.size(); ++i) {
+            EXPECT_EQ(received[i], 1) << "peer " << i << ", fanout " << fanout;
+        }
+
+        // Without colliding hashes nobody sends more than `fanout` packets.
+        for (uint32_t i = 0; i < hashes.size(); ++i) {
+            EXPECT_LE(sent[i], fanout) << "peer " << i << ", fanout " << fanout;
+        }
+    }
+}
+
+TEST(GroupRelay, TreeReachesEveryPeerOnceDespiteCollisions)
+{
+    std::mt19937 rng(1234);
+    std::vector<uint32_t> hashes(300);
+
+    for (uint32_t &hash : hashes) {
+        hash = rng() % 1000;
+    }
+
+    // Some collisions are certain, make sure one of them is with the origin.
+    hashes[100] = hashes[0];
+
+    for (const uint16_t fanout : {1, 3, 8}) {
+        std::vector<uint32_t> sent;
+        const std::vector<uint32_t> received = simulate(hashes, 0, fanout, sent);
+
+        EXPECT_EQ(received[0], 0) << "fanout " << fanout;
+
+        for (uint32_t i = 1; i < hashes.size(); ++i) {
+            EXPECT_EQ(received[i], 1) << "peer " << i << ", fanout " << fanout;
+        }
+    }
+}
+
+}  // namespace
@@ -250,3 +250,213 @@ bool bs_list_remove(BS_List *list, const uint8_t *data, int id)
 
     return true;
 }
+
+/**
+ * The hash list uses open addressing with linear probing. Removal shifts the
+ * following elements of the probe run back instead of leaving tombstones, so
+ * lookups stay short however much the list churns. The table is kept at most
+ * half full.
+ */
+
+static uint64_t hash_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+non_null()
+static uint32_t hash_slot(const Hash_List *list, const uint8_t *data)
+{
+    uint64_t h = list->seed ^ list->element_size;
+    uint32_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= list->element_size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        h = hash_mix(h ^ word);
+    }
+
+    if (i < list->element_size) {
+        uint64_t word = 0;
+        memcpy(&word, data + i, list->element_size - i);
+        h = hash_mix(h ^ word);
+    }
+
+    return (uint32_t)h & (list->capacity - 1);
+}
+
+/** @brief Find data in the table.
+ *
+ * @return the slot holding data, or the empty slot where it would go.
+ */
+non_null()
+static uint32_t hash_find_slot(const Hash_List *list, const uint8_t *data)
+{
+    const uint32_t mask = list->capacity - 1;
+    uint32_t slot = hash_slot(list, data);
+
+    while (list->ids[slot] != -1
+            && memcmp(list->data + (size_t)slot * list->element_size, data, list->element_size) != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    return slot;
+}
+
+/**
+ * Moves all elements into a table with `new_capacity` slots.
+ *
+ * @return true on success.
+ */
+non_null()
+static bool hash_resize(Hash_List *list, uint32_t new_capacity)
+{
+    uint8_t *data = (uint8_t *)malloc((size_t)new_capacity * list->element_size);
+    int *ids = (int *)malloc(new_capacity * sizeof(int));
+
+    if (data == nullptr || ids == nullptr) {
+        free(data);
+        free(ids);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < new_capacity; ++i) {
+        ids[i] = -1;
+    }
+
+    Hash_List old = *list;
+    list->capacity = new_capacity;
+    list->data = data;
+    list->ids = ids;
+
+    for (uint32_t i = 0; i < old.capacity; ++i) {
+        if (old.ids[i] == -1) {
+            continue;
+        }
+
+        const uint8_t *element = old.data + (size_t)i * old.element_size;
+        const uint32_t slot = hash_find_slot(list, element);
+        memcpy(list->data + (size_t)slot * list->element_size, element, list->element_size);
+        list->ids[slot] = old.ids[i];
+    }
+
+    free(old.data);
+    free(old.ids);
+    return true;
+}
+
+int hash_list_init(Hash_List *list, uint32_t element_size, uint32_t initial_capacity, uint64_t seed)
+{
+    list->n = 0;
+    list->capacity = 0;
+    list->element_size = element_size;
+    list->seed = seed;
+    list->data = nullptr;
+    list->ids = nullptr;
+
+    // Room for initial_capacity elements at half load.
+    uint32_t capacity = 8;
+
+    while (capacity < initial_capacity * 2 && capacity < (UINT32_MAX >> 2)) {
+        capacity *= 2;
+    }
+
+    list->min_capacity = capacity;
+
+    if (!hash_resize(list, capacity)) {
+        return 0;
+    }
+
+    return 1;
+}
+
+void hash_list_free(Hash_List *list)
+{
+    if (list == nullptr) {
+        return;
+    }
+
+    free(list->data);
+    list->data = nullptr;
+
+    free(list->ids);
+    list->ids = nullptr;
+
+    list->n = 0;
+    list->capacity = 0;
+}
+
+int hash_list_find(const Hash_List *list, const uint8_t *data)
+{
+    if (list->n == 0) {
+        return -1;
+    }
+
+    return list->ids[hash_find_slot(list, data)];
+}
+
+bool hash_list_add(Hash_List *list, const uint8_t *data, int id)
+{
+    if (id < 0 || list->capacity == 0) {
+        return false;
+    }
+
+    if ((list->n + 1) * 2 > list->capacity) {
+        if (list->capacity >= (UINT32_MAX >> 2) || !hash_resize(list, list->capacity * 2)) {
+            return false;
+        }
+    }
+
+    const uint32_t slot = hash_find_slot(list, data);
+
+    if (list->ids[slot] != -1) {
+        // already in list
+        return false;
+    }
+
+    memcpy(list->data + (size_t)slot * list->element_size, data, list->element_size);
+    list->ids[slot] = id;
+    ++list->n;
+
+    return true;
+}
+
+bool hash_list_remove(Hash_List *list, const uint8_t *data, int id)
+{
+    if (list->n == 0) {
+        return false;
+    }
+
+    const uint32_t mask = list->capacity - 1;
+    uint32_t hole = hash_find_slot(list, data);
+
+    if (list->ids[hole] == -1 || list->ids[hole] != id) {
+        return false;
+    }
+
+    // Shift back every following element of the run that may live in the hole.
+    for (uint32_t next = (hole + 1) & mask; list->ids[next] != -1; next = (next + 1) & mask) {
+        const uint8_t *element = list->data + (size_t)next * list->element_size;
+        const uint32_t home = hash_slot(list, element);
+
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            memcpy(list->data + (size_t)hole * list->element_size, element, list->element_size);
+            list->ids[hole] = list->ids[next];
+            hole = next;
+        }
+    }
+
+    list->ids[hole] = -1;
+    --list->n;
+
+    // decrease the size of the table if needed
+    if (list->capacity > list->min_capacity && list->n * 8 < list->capacity) {
+        hash_resize(list, list->capacity / 2);
+    }
+
+    return true;
+}
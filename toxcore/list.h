@@ -67,6 +67,65 @@ bool bs_list_add(BS_List *list, const uint8_t *data, int id);
 non_null()
 bool bs_list_remove(BS_List *list, const uint8_t *data, int id);
 
+/**
+ * Hash table with the same contract as BS_List: it associates non-negative
+ * ids with fixed size elements, compared byte by byte.
+ *
+ * Unlike BS_List, adding and removing elements takes constant time on average,
+ * so it should be used for lists with many add/remove calls, e.g. connections
+ * that come and go all the time.
+ */
+typedef struct Hash_List {
+    uint32_t n; // number of elements
+    uint32_t capacity; // number of slots, 0 or a power of 2
+    uint32_t min_capacity; // the table never shrinks below this
+    uint32_t element_size; // size of the elements
+    uint64_t seed; // hash seed
+    uint8_t *data; // array of elements, indexed by slot
+    int *ids; // array of element ids, -1 for empty slots
+} Hash_List;
+
+/** @brief Initialize a hash list.
+ *
+ * @param element_size is the size of the elements in the list.
+ * @param initial_capacity is the number of elements the memory will be initially allocated for.
+ * @param seed randomises the hash function. Pass a random value if the elements
+ *   can be chosen by other peers, so they can't force collisions.
+ *
+ * @retval 1 success
+ * @retval 0 failure
+ */
+non_null()
+int hash_list_init(Hash_List *list, uint32_t element_size, uint32_t initial_capacity, uint64_t seed);
+
+/** Free a list initiated with hash_list_init */
+nullable(1)
+void hash_list_free(Hash_List *list);
+
+/** @brief Retrieve the id of an element in the list
+ *
+ * @retval >=0 id associated with data
+ * @retval -1 failure
+ */
+non_null()
+int hash_list_find(const Hash_List *list, const uint8_t *data);
+
+/** @brief Add an element with associated id to the list
+ *
+ * @retval true  success
+ * @retval false failure (data already in list, negative id or no memory)
+ */
+non_null()
+bool hash_list_add(Hash_List *list, const uint8_t *data, int id);
+
+/** @brief Remove element from the list
+ *
+ * @retval true  success
+ * @retval false failure (element not found or id does not match)
+ */
+non_null()
+bool hash_list_remove(Hash_List *list, const uint8_t *data, int id);
+
 #ifdef __cplusplus
 }  // extern "C"
 #endif
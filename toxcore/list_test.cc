@@ -2,6 +2,12 @@
 
 #include <gtest/gtest.h>
 
+#include <array>
+#include <cstring>
+#include <map>
+#include <random>
+#include <vector>
+
 namespace {
 
 TEST(List, CreateAndDestroyWithNonZeroSize)
@@ -27,4 +33,89 @@ TEST(List, DeleteFromEmptyList)
     bs_list_free(&list);
 }
 
+TEST(HashList, CreateAndDestroyWithZeroSize)
+{
+    Hash_List list;
+    ASSERT_EQ(hash_list_init(&list, sizeof(int), 0, 0), 1);
+    hash_list_free(&list);
+}
+
+TEST(HashList, DeleteFromEmptyList)
+{
+    Hash_List list;
+    ASSERT_EQ(hash_list_init(&list, sizeof(int), 0, 0), 1);
+    const uint8_t data[sizeof(int)] = {0};
+    EXPECT_FALSE(hash_list_remove(&list, data, 0));
+    hash_list_free(&list);
+}
+
+TEST(HashList, RejectsDuplicatesAndWrongIds)
+{
+    Hash_List list;
+    ASSERT_EQ(hash_list_init(&list, 3, 0, 1234), 1);
+    const uint8_t data[3] = {1, 2, 3};
+
+    EXPECT_EQ(hash_list_find(&list, data), -1);
+    EXPECT_TRUE(hash_list_add(&list, data, 7));
+    EXPECT_FALSE(hash_list_add(&list, data, 8));
+    EXPECT_FALSE(hash_list_add(&list, data + 1, -1));
+    EXPECT_EQ(hash_list_find(&list, data), 7);
+    EXPECT_FALSE(hash_list_remove(&list, data, 8));
+    EXPECT_TRUE(hash_list_remove(&list, data, 7));
+    EXPECT_EQ(hash_list_find(&list, data), -1);
+
+    hash_list_free(&list);
+}
+
+using Key = std::array<uint8_t, 32>;
+
+Key random_key(std::mt19937_64 &rng)
+{
+    Key key;
+
+    for (uint8_t &b : key) {
+        b = rng();
+    }
+
+    return key;
+}
+
+TEST(HashList, MatchesBinarySearchList)
+{
+    std::mt19937_64 rng(42);
+    Hash_List hash;
+    BS_List bs;
+    ASSERT_EQ(hash_list_init(&hash, sizeof(Key), 8, rng()), 1);
+    ASSERT_EQ(bs_list_init(&bs, sizeof(Key), 8), 1);
+
+    std::vector<Key> keys;
+
+    for (int round = 0; round < 20000; ++round) {
+        if (keys.empty() || rng() % 3 != 0) {
+            Key key = random_key(rng);
+            // Use a few fixed prefixes so that some keys share their leading bytes.
+            key[0] = rng() % 4;
+            const int id = round;
+            ASSERT_EQ(hash_list_add(&hash, key.data(), id), bs_list_add(&bs, key.data(), id));
+            keys.push_back(key);
+        } else {
+            const size_t i = rng() % keys.size();
+            const int id = bs_list_find(&bs, keys[i].data());
+            ASSERT_EQ(hash_list_find(&hash, keys[i].data()), id);
+            ASSERT_EQ(hash_list_remove(&hash, keys[i].data(), id), bs_list_remove(&bs, keys[i].data(), id));
+            keys[i] = keys.back();
+            keys.pop_back();
+        }
+
+        ASSERT_EQ(hash.n, bs.n);
+    }
+
+    for (const Key &key : keys) {
+        EXPECT_EQ(hash_list_find(&hash, key.data()), bs_list_find(&bs, key.data()));
+    }
+
+    hash_list_free(&hash);
+    bs_list_free(&bs);
+}
+
 }  // namespace
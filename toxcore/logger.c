@@ -21,6 +21,8 @@ struct Logger {
     logger_cb *callback;
     void *context;
     void *userdata;
+    /* Serialises the callback, so one logger can be shared between threads. */
+    pthread_mutex_t *lock;
 };
 
 static const char *logger_level_name(Logger_Level level)
@@ -70,27 +72,72 @@ static const Logger logger_stderr = {
     logger_stderr_handler,
     nullptr,
     nullptr,
+    nullptr,
 };
 
+/** @brief Pass a formatted message to the callback of the logger, one thread at a time.
+ *
+ * The lock is taken with the real pthread functions, so MUTEXLOCKINGDEBUG
+ * doesn't log every log message twice more.
+ */
+non_null(1, 3, 5, 6)
+static void logger_call(const Logger *log, Logger_Level level, const char *file, int line, const char *func,
+                        const char *message)
+{
+    if (log->lock != nullptr) {
+        (pthread_mutex_lock)(log->lock);
+    }
+
+    if (log->callback != nullptr) {
+        log->callback(log->context, level, file, line, func, message, log->userdata);
+    }
+
+    if (log->lock != nullptr) {
+        (pthread_mutex_unlock)(log->lock);
+    }
+}
+
 /*
  * Public Functions
  */
 
 Logger *logger_new(void)
 {
-    return (Logger *)calloc(1, sizeof(Logger));
+    Logger *log = (Logger *)calloc(1, sizeof(Logger));
+
+    if (log == nullptr) {
+        return nullptr;
+    }
+
+    log->lock = (pthread_mutex_t *)calloc(1, sizeof(pthread_mutex_t));
+
+    if (log->lock == nullptr || pthread_mutex_init(log->lock, nullptr) != 0) {
+        free(log->lock);
+        free(log);
+        return nullptr;
+    }
+
+    return log;
 }
 
 void logger_kill(Logger *log)
 {
+    if (log == nullptr) {
+        return;
+    }
+
+    pthread_mutex_destroy(log->lock);
+    free(log->lock);
     free(log);
 }
 
 void logger_callback_log(Logger *log, logger_cb *function, void *context, void *userdata)
 {
+    (pthread_mutex_lock)(log->lock);
     log->callback = function;
     log->context  = context;
     log->userdata = userdata;
+    (pthread_mutex_unlock)(log->lock);
 }
 
 void logger_write(const Logger *log, Logger_Level level, const char *file, int line, const char *func,
@@ -123,7 +170,7 @@ void logger_write(const Logger *log, Logger_Level level, const char *file, int l
     vsnprintf(msg, sizeof(msg), format, args);
     va_end(args);
 
-    log->callback(log->context, level, file, line, func, msg, log->userdata);
+    logger_call(log, level, file, line, func, msg);
 }
 
 
@@ -159,7 +206,7 @@ void logger_api_write(const Logger *log, Logger_Level level, const char *file, i
     char msg[1024];
     vsnprintf(msg, sizeof(msg), format, args);
 
-    log->callback(log->context, level, file, line, func, msg, log->userdata);
+    logger_call(log, level, file, line, func, msg);
 }
 
 /*
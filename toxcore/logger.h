@@ -50,6 +50,9 @@ typedef void logger_cb(void *context, Logger_Level level, const char *file, int
 
 /**
  * Creates a new logger with logging disabled (callback is NULL) by default.
+ *
+ * The logger may be shared between threads: its callback is only ever run by
+ * one thread at a time.
  */
 Logger *logger_new(void);
 
@@ -263,3 +263,14 @@ uint64_t current_time_monotonic(Mono_Time *mono_time)
 #endif
     return cur_time;
 }
+
+uint32_t mono_time_until_next_second(Mono_Time *mono_time)
+{
+    const uint64_t now = current_time_monotonic(mono_time);
+
+    if (now / 1000ULL + mono_time->base_time != mono_time_get(mono_time)) {
+        return 0;
+    }
+
+    return 1000 - (uint32_t)(now % 1000ULL);
+}
@@ -79,6 +79,16 @@ bool mono_time_is_timeout(const Mono_Time *mono_time, uint64_t timestamp, uint64
 non_null()
 uint64_t current_time_monotonic(Mono_Time *mono_time);
 
+/**
+ * Return the time in milliseconds until `mono_time_get()` will next change,
+ * i.e. until the next deadline of anything timed in whole seconds.
+ *
+ * Returns 0 if it already changed but `mono_time_update()` hasn't been called
+ * since.
+ */
+non_null()
+uint32_t mono_time_until_next_second(Mono_Time *mono_time);
+
 /**
  * Override implementation of `current_time_monotonic()` (for tests).
  *
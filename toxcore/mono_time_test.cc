@@ -64,4 +64,31 @@ TEST(MonoTime, CustomTime)
     mono_time_free(mono_time);
 }
 
+TEST(MonoTime, UntilNextSecond)
+{
+    Mono_Time *mono_time = mono_time_new(nullptr, nullptr);
+    ASSERT_NE(mono_time, nullptr);
+
+    uint64_t test_time = 1000000;
+
+    mono_time_set_current_time_callback(
+        mono_time, [](void *user_data) { return *static_cast<uint64_t *>(user_data); }, &test_time);
+    mono_time_update(mono_time);
+
+    EXPECT_EQ(mono_time_until_next_second(mono_time), 1000);
+
+    test_time += 999;
+    EXPECT_EQ(mono_time_until_next_second(mono_time), 1);
+
+    // The second changed, but nobody has looked at it yet.
+    test_time += 1;
+    EXPECT_EQ(mono_time_until_next_second(mono_time), 0);
+
+    test_time += 250;
+    mono_time_update(mono_time);
+    EXPECT_EQ(mono_time_until_next_second(mono_time), 750);
+
+    mono_time_free(mono_time);
+}
+
 }  // namespace
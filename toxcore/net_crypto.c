@@ -10,6 +10,7 @@
  */
 #include "net_crypto.h"
 
+#include <assert.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -18,6 +19,8 @@
 #include "ccompat.h"
 #include "list.h"
 #include "mono_time.h"
+#include "shared_key_cache.h"
+#include "timer_wheel.h"
 #include "util.h"
 
 typedef struct Packet_Data {
@@ -26,8 +29,43 @@ typedef struct Packet_Data {
     uint8_t data[MAX_CRYPTO_DATA_SIZE];
 } Packet_Data;
 
+/** A Packet_Data slot sitting on the free list of a Packet_Pool. */
+typedef struct Packet_Pool_Entry {
+    struct Packet_Pool_Entry *next;
+} Packet_Pool_Entry;
+
+/** Default number of unused packets kept around for reuse. */
+#define PACKET_POOL_DEFAULT_MAX_CACHED 1024
+
+/**
+ * Fixed-size allocator for the packets queued in the send and receive arrays
+ * of all crypto connections. Released packets go on a free list (up to
+ * `max_cached` of them) so a busy connection doesn't hit malloc for every
+ * lossless packet.
+ */
+typedef struct Packet_Pool {
+    Packet_Pool_Entry *free_list;
+    uint32_t num_cached;
+    uint32_t max_cached;
+
+    uint32_t num_in_use;
+    uint64_t heap_allocations;
+    uint64_t reused;
+} Packet_Pool;
+
+/** Smallest number of slots allocated for a non-empty packets array. Must be a power of 2. */
+#define PACKETS_ARRAY_MIN_SIZE 32
+
+/**
+ * A ring of packet slots indexed by `packet number % buffer_size`.
+ *
+ * The slot table is allocated on first use and grows (or shrinks) in powers of
+ * 2 so that it always covers `{buffer_start, buffer_end)`, up to
+ * CRYPTO_PACKET_BUFFER_SIZE slots. Idle connections don't hold a table at all.
+ */
 typedef struct Packets_Array {
-    Packet_Data *buffer[CRYPTO_PACKET_BUFFER_SIZE];
+    Packet_Data **buffer;
+    uint32_t  buffer_size; /* number of slots in buffer, 0 or a power of 2 */
     uint32_t  buffer_start;
     uint32_t  buffer_end; /* packet numbers in array: `{buffer_start, buffer_end)` */
 } Packets_Array;
@@ -119,6 +157,12 @@ typedef struct Crypto_Connection {
     dht_pk_cb *dht_pk_callback;
     void *dht_pk_callback_object;
     uint32_t dht_pk_callback_number;
+
+    /* Set while the connection is in the run list of Net_Crypto. */
+    bool run_queued;
+    /* Set while an established connection with nothing to do skips its rate
+     * updates and waits for its next request packet in the timer wheel. */
+    bool parked;
 } Crypto_Connection;
 
 static const Crypto_Connection empty_crypto_connection = {{0}};
@@ -149,7 +193,38 @@ struct Net_Crypto {
     /* The current optimal sleep time */
     uint32_t current_sleep_time;
 
-    BS_List ip_port_list;
+    Hash_List ip_port_list;
+
+    /* Real public key to crypto connection id. */
+    Hash_List pk_list;
+
+    /* Storage for the packets in the send and receive arrays of all connections. */
+    Packet_Pool packet_pool;
+
+    /* Deadlines of connections waiting to resend a temp packet or request
+     * packet. Connections without a deadline or pending work are idle. */
+    Timer_Wheel *timers;
+
+    /* Connections for the next send_crypto_packets: ones that came due or
+     * received or queued packets since, and busy ones, which stay here.
+     * Holds each connection at most once, so crypto_connections_length
+     * entries are always enough. */
+    uint32_t *run_list;
+    uint32_t run_list_length;
+    uint32_t run_list_capacity;
+    /* Set when a connection was added to the run list since the last run. */
+    bool run_list_woken;
+
+    /* Keys shared between our real key and the real keys of peers, which
+     * encrypt and decrypt handshakes. */
+    Shared_Key_Cache *handshake_keys;
+    /* Bumped whenever our real key changes, so handshakes whose key was
+     * computed with the old one are dropped when they come back from the pool. */
+    uint32_t handshake_keys_generation;
+
+    /* Computes the keys of incoming cookie requests and handshakes on worker
+     * threads, or nullptr to compute them synchronously. */
+    Precompute_Pool *handshake_pool;
 };
 
 const uint8_t *nc_get_self_public_key(const Net_Crypto *c)
@@ -188,6 +263,13 @@ static bool crypt_connection_id_is_valid(const Net_Crypto *c, int crypt_connecti
     return status != CRYPTO_CONN_NO_CONNECTION && status != CRYPTO_CONN_FREE;
 }
 
+/** Number of keys shared with the real keys of peers to keep for handshakes. */
+#define MAX_CACHED_HANDSHAKE_KEYS 4096
+/** Seconds after which an unused handshake key is forgotten. */
+#define HANDSHAKE_KEYS_TIMEOUT 600
+/** Interval in ms at which do_net_crypto should run while the handshake pool has work. */
+#define HANDSHAKE_POOL_POLL_INTERVAL 1
+
 /** cookie timeout in seconds */
 #define COOKIE_TIMEOUT 15
 #define COOKIE_DATA_LENGTH (uint16_t)(CRYPTO_PUBLIC_KEY_SIZE * 2)
@@ -319,6 +401,26 @@ static int create_cookie_response(const Net_Crypto *c, uint8_t *packet, const ui
     return COOKIE_RESPONSE_LENGTH;
 }
 
+/** @brief Decrypt the cookie request packet of length COOKIE_REQUEST_LENGTH with shared_key.
+ * Put what was in the request in request_plain (must be of size COOKIE_REQUEST_PLAIN_LENGTH)
+ *
+ * @retval -1 on failure.
+ * @retval 0 on success.
+ */
+non_null()
+static int open_cookie_request(uint8_t *request_plain, const uint8_t *shared_key, const uint8_t *packet)
+{
+    const int len = decrypt_data_symmetric(shared_key, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE,
+                                           packet + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE, COOKIE_REQUEST_PLAIN_LENGTH + CRYPTO_MAC_SIZE,
+                                           request_plain);
+
+    if (len != COOKIE_REQUEST_PLAIN_LENGTH) {
+        return -1;
+    }
+
+    return 0;
+}
+
 /** @brief Handle the cookie request packet of length length.
  * Put what was in the request in request_plain (must be of size COOKIE_REQUEST_PLAIN_LENGTH)
  * Put the key used to decrypt the request into shared_key (of size CRYPTO_SHARED_KEY_SIZE) for use in the response.
@@ -336,39 +438,107 @@ static int handle_cookie_request(const Net_Crypto *c, uint8_t *request_plain, ui
 
     memcpy(dht_public_key, packet + 1, CRYPTO_PUBLIC_KEY_SIZE);
     const uint8_t *tmp_shared_key = dht_get_shared_key_sent(c->dht, dht_public_key);
+
+    if (tmp_shared_key == nullptr) {
+        return -1;
+    }
+
     memcpy(shared_key, tmp_shared_key, CRYPTO_SHARED_KEY_SIZE);
-    const int len = decrypt_data_symmetric(shared_key, packet + 1 + CRYPTO_PUBLIC_KEY_SIZE,
-                                           packet + 1 + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_NONCE_SIZE, COOKIE_REQUEST_PLAIN_LENGTH + CRYPTO_MAC_SIZE,
-                                           request_plain);
+    return open_cookie_request(request_plain, shared_key, packet);
+}
 
-    if (len != COOKIE_REQUEST_PLAIN_LENGTH) {
+/** @brief Answer the cookie request packet of length COOKIE_REQUEST_LENGTH from source over raw UDP.
+ *
+ * @retval -1 on failure.
+ * @retval 0 on success.
+ */
+non_null()
+static int udp_answer_cookie_request(const Net_Crypto *c, const IP_Port *source, const uint8_t *shared_key,
+                                     const uint8_t *packet)
+{
+    uint8_t request_plain[COOKIE_REQUEST_PLAIN_LENGTH];
+
+    if (open_cookie_request(request_plain, shared_key, packet) != 0) {
+        return -1;
+    }
+
+    uint8_t data[COOKIE_RESPONSE_LENGTH];
+
+    if (create_cookie_response(c, data, request_plain, shared_key, packet + 1) != sizeof(data)) {
+        return -1;
+    }
+
+    if ((uint32_t)sendpacket(dht_get_net(c->dht), source, data, sizeof(data)) != sizeof(data)) {
         return -1;
     }
 
     return 0;
 }
 
+/** Source address and packet of a cookie request waiting for its key in the handshake pool. */
+#define COOKIE_REQUEST_JOB_LENGTH (sizeof(IP_Port) + COOKIE_REQUEST_LENGTH)
+
+static_assert(COOKIE_REQUEST_JOB_LENGTH <= PRECOMPUTE_JOB_DATA_SIZE,
+              "a deferred cookie request must fit in a precompute job");
+
+/** Finish a cookie request once the handshake pool computed its key. */
+non_null(1, 3) nullable(2, 5)
+static void udp_cookie_request_computed(void *object, const uint8_t *shared_key, const uint8_t *data, uint16_t length,
+                                        void *userdata)
+{
+    Net_Crypto *c = (Net_Crypto *)object;
+
+    if (shared_key == nullptr || length != COOKIE_REQUEST_JOB_LENGTH) {
+        return;
+    }
+
+    IP_Port source;
+    memcpy(&source, data, sizeof(IP_Port));
+    const uint8_t *packet = data + sizeof(IP_Port);
+
+    dht_add_shared_key_sent(c->dht, packet + 1, shared_key);
+    udp_answer_cookie_request(c, &source, shared_key, packet);
+}
+
 /** Handle the cookie request packet (for raw UDP) */
 non_null(1, 2, 3) nullable(5)
 static int udp_handle_cookie_request(void *object, const IP_Port *source, const uint8_t *packet, uint16_t length,
                                      void *userdata)
 {
-    const Net_Crypto *c = (const Net_Crypto *)object;
-    uint8_t request_plain[COOKIE_REQUEST_PLAIN_LENGTH];
-    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
-    uint8_t dht_public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    Net_Crypto *c = (Net_Crypto *)object;
 
-    if (handle_cookie_request(c, request_plain, shared_key, dht_public_key, packet, length) != 0) {
+    if (length != COOKIE_REQUEST_LENGTH) {
         return 1;
     }
 
-    uint8_t data[COOKIE_RESPONSE_LENGTH];
+    const uint8_t *dht_public_key = packet + 1;
+    const uint8_t *shared_key;
 
-    if (create_cookie_response(c, data, request_plain, shared_key, dht_public_key) != sizeof(data)) {
+    if (c->handshake_pool == nullptr) {
+        shared_key = dht_get_shared_key_sent(c->dht, dht_public_key);
+    } else {
+        shared_key = dht_find_shared_key_sent(c->dht, dht_public_key);
+
+        if (shared_key == nullptr) {
+            // Leave the key agreement to the pool and answer when it's done.
+            uint8_t job[COOKIE_REQUEST_JOB_LENGTH];
+            memcpy(job, source, sizeof(IP_Port));
+            memcpy(job + sizeof(IP_Port), packet, COOKIE_REQUEST_LENGTH);
+
+            if (!precompute_pool_add(c->handshake_pool, dht_public_key, dht_get_self_secret_key(c->dht),
+                                     &udp_cookie_request_computed, c, job, sizeof(job))) {
+                return 1;
+            }
+
+            return 0;
+        }
+    }
+
+    if (shared_key == nullptr) {
         return 1;
     }
 
-    if ((uint32_t)sendpacket(dht_get_net(c->dht), source, data, sizeof(data)) != sizeof(data)) {
+    if (udp_answer_cookie_request(c, source, shared_key, packet) != 0) {
         return 1;
     }
 
@@ -465,7 +635,7 @@ static int handle_cookie_response(uint8_t *cookie, uint64_t *number,
  * @retval HANDSHAKE_PACKET_LENGTH on success.
  */
 non_null()
-static int create_crypto_handshake(const Net_Crypto *c, uint8_t *packet, const uint8_t *cookie, const uint8_t *nonce,
+static int create_crypto_handshake(Net_Crypto *c, uint8_t *packet, const uint8_t *cookie, const uint8_t *nonce,
                                    const uint8_t *session_pk, const uint8_t *peer_real_pk, const uint8_t *peer_dht_pubkey)
 {
     uint8_t plain[CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_SHA512_SIZE + COOKIE_LENGTH];
@@ -481,9 +651,15 @@ static int create_crypto_handshake(const Net_Crypto *c, uint8_t *packet, const u
         return -1;
     }
 
+    const uint8_t *shared_key = shared_key_cache_lookup(c->handshake_keys, peer_real_pk);
+
+    if (shared_key == nullptr) {
+        return -1;
+    }
+
     random_nonce(c->rng, packet + 1 + COOKIE_LENGTH);
-    const int len = encrypt_data(peer_real_pk, c->self_secret_key, packet + 1 + COOKIE_LENGTH, plain, sizeof(plain),
-                                 packet + 1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE);
+    const int len = encrypt_data_symmetric(shared_key, packet + 1 + COOKIE_LENGTH, plain, sizeof(plain),
+                                           packet + 1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE);
 
     if (len != HANDSHAKE_PACKET_LENGTH - (1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE)) {
         return -1;
@@ -495,34 +671,24 @@ static int create_crypto_handshake(const Net_Crypto *c, uint8_t *packet, const u
     return HANDSHAKE_PACKET_LENGTH;
 }
 
-/** @brief Handle a crypto handshake packet of length.
- * put the nonce contained in the packet in nonce,
- * the session public key in session_pk
- * the real public key of the peer in peer_real_pk
- * the dht public key of the peer in dht_public_key and
- * the cookie inside the encrypted part of the packet in cookie.
+/** @brief Open the cookie of a crypto handshake packet of length.
+ * put the real and dht public key of the peer the cookie was made for in
+ * cookie_plain, which must be at least COOKIE_DATA_LENGTH.
  *
  * if expected_real_pk isn't NULL it denotes the real public key
  * the packet should be from.
  *
- * nonce must be at least CRYPTO_NONCE_SIZE
- * session_pk must be at least CRYPTO_PUBLIC_KEY_SIZE
- * peer_real_pk must be at least CRYPTO_PUBLIC_KEY_SIZE
- * cookie must be at least COOKIE_LENGTH
- *
  * @retval false on failure.
  * @retval true on success.
  */
-non_null(1, 2, 3, 4, 5, 6, 7) nullable(9)
-static bool handle_crypto_handshake(const Net_Crypto *c, uint8_t *nonce, uint8_t *session_pk, uint8_t *peer_real_pk,
-                                    uint8_t *dht_public_key, uint8_t *cookie, const uint8_t *packet, uint16_t length, const uint8_t *expected_real_pk)
+non_null(1, 2, 3) nullable(5)
+static bool open_handshake_cookie(const Net_Crypto *c, uint8_t *cookie_plain, const uint8_t *packet, uint16_t length,
+                                  const uint8_t *expected_real_pk)
 {
     if (length != HANDSHAKE_PACKET_LENGTH) {
         return false;
     }
 
-    uint8_t cookie_plain[COOKIE_DATA_LENGTH];
-
     if (open_cookie(c->mono_time, cookie_plain, packet + 1, c->secret_symmetric_key) != 0) {
         return false;
     }
@@ -531,13 +697,38 @@ static bool handle_crypto_handshake(const Net_Crypto *c, uint8_t *nonce, uint8_t
         return false;
     }
 
+    return true;
+}
+
+/** @brief Decrypt a crypto handshake packet of length HANDSHAKE_PACKET_LENGTH
+ * whose cookie was opened into cookie_plain, with the key shared with the real
+ * public key of the peer in there.
+ * put the nonce contained in the packet in nonce,
+ * the session public key in session_pk
+ * the real public key of the peer in peer_real_pk
+ * the dht public key of the peer in dht_public_key and
+ * the cookie inside the encrypted part of the packet in cookie.
+ *
+ * nonce must be at least CRYPTO_NONCE_SIZE
+ * session_pk must be at least CRYPTO_PUBLIC_KEY_SIZE
+ * peer_real_pk must be at least CRYPTO_PUBLIC_KEY_SIZE
+ * cookie must be at least COOKIE_LENGTH
+ *
+ * @retval false on failure.
+ * @retval true on success.
+ */
+non_null()
+static bool open_crypto_handshake(const uint8_t *shared_key, const uint8_t *cookie_plain, uint8_t *nonce,
+                                  uint8_t *session_pk, uint8_t *peer_real_pk, uint8_t *dht_public_key, uint8_t *cookie,
+                                  const uint8_t *packet)
+{
     uint8_t cookie_hash[CRYPTO_SHA512_SIZE];
     crypto_sha512(cookie_hash, packet + 1, COOKIE_LENGTH);
 
     uint8_t plain[CRYPTO_NONCE_SIZE + CRYPTO_PUBLIC_KEY_SIZE + CRYPTO_SHA512_SIZE + COOKIE_LENGTH];
-    const int len = decrypt_data(cookie_plain, c->self_secret_key, packet + 1 + COOKIE_LENGTH,
-                                 packet + 1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE,
-                                 HANDSHAKE_PACKET_LENGTH - (1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE), plain);
+    const int len = decrypt_data_symmetric(shared_key, packet + 1 + COOKIE_LENGTH,
+                                           packet + 1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE,
+                                           HANDSHAKE_PACKET_LENGTH - (1 + COOKIE_LENGTH + CRYPTO_NONCE_SIZE), plain);
 
     if (len != sizeof(plain)) {
         return false;
@@ -555,6 +746,34 @@ static bool handle_crypto_handshake(const Net_Crypto *c, uint8_t *nonce, uint8_t
     return true;
 }
 
+/** @brief Handle a crypto handshake packet of length.
+ * The outputs are those of open_crypto_handshake.
+ *
+ * if expected_real_pk isn't NULL it denotes the real public key
+ * the packet should be from.
+ *
+ * @retval false on failure.
+ * @retval true on success.
+ */
+non_null(1, 2, 3, 4, 5, 6, 7) nullable(9)
+static bool handle_crypto_handshake(Net_Crypto *c, uint8_t *nonce, uint8_t *session_pk, uint8_t *peer_real_pk,
+                                    uint8_t *dht_public_key, uint8_t *cookie, const uint8_t *packet, uint16_t length, const uint8_t *expected_real_pk)
+{
+    uint8_t cookie_plain[COOKIE_DATA_LENGTH];
+
+    if (!open_handshake_cookie(c, cookie_plain, packet, length, expected_real_pk)) {
+        return false;
+    }
+
+    const uint8_t *shared_key = shared_key_cache_lookup(c->handshake_keys, cookie_plain);
+
+    if (shared_key == nullptr) {
+        return false;
+    }
+
+    return open_crypto_handshake(shared_key, cookie_plain, nonce, session_pk, peer_real_pk, dht_public_key, cookie,
+                                 packet);
+}
 
 non_null()
 static Crypto_Connection *get_crypto_connection(const Net_Crypto *c, int crypt_connection_id)
@@ -566,6 +785,87 @@ static Crypto_Connection *get_crypto_connection(const Net_Crypto *c, int crypt_c
     return &c->crypto_connections[crypt_connection_id];
 }
 
+/** @brief Make sure the run list can hold `num` connections.
+ *
+ * @retval false on allocation failure.
+ */
+non_null()
+static bool run_list_reserve(Net_Crypto *c, uint32_t num)
+{
+    if (num <= c->run_list_capacity) {
+        return true;
+    }
+
+    const uint32_t capacity = max_u32(num, c->run_list_capacity * 2);
+    uint32_t *run_list = (uint32_t *)realloc(c->run_list, capacity * sizeof(uint32_t));
+
+    if (run_list == nullptr) {
+        return false;
+    }
+
+    c->run_list = run_list;
+    c->run_list_capacity = capacity;
+    return true;
+}
+
+non_null()
+static void run_list_add(Net_Crypto *c, uint32_t crypt_connection_id)
+{
+    Crypto_Connection *conn = &c->crypto_connections[crypt_connection_id];
+
+    if (conn->run_queued) {
+        return;
+    }
+
+    assert(c->run_list_length < c->run_list_capacity);
+    conn->run_queued = true;
+    c->run_list[c->run_list_length] = crypt_connection_id;
+    ++c->run_list_length;
+    c->run_list_woken = true;
+}
+
+non_null()
+static void run_list_remove(Net_Crypto *c, uint32_t crypt_connection_id)
+{
+    for (uint32_t i = 0; i < c->run_list_length; ++i) {
+        if (c->run_list[i] == crypt_connection_id) {
+            --c->run_list_length;
+            c->run_list[i] = c->run_list[c->run_list_length];
+            c->crypto_connections[crypt_connection_id].run_queued = false;
+            return;
+        }
+    }
+}
+
+non_null()
+static void run_list_add_due(void *object, uint32_t crypt_connection_id)
+{
+    Net_Crypto *c = (Net_Crypto *)object;
+
+    if (get_crypto_connection(c, crypt_connection_id) != nullptr) {
+        run_list_add(c, crypt_connection_id);
+    }
+}
+
+/** @brief Have send_crypto_packets look at a connection on its next run.
+ *
+ * Call this whenever something happens to a connection that may give it
+ * work to do before its deadline.
+ */
+non_null()
+static void wake_crypto_connection(Net_Crypto *c, int crypt_connection_id)
+{
+    /* Connections still being set up (CRYPTO_CONN_NO_CONNECTION) count too,
+     * their status changes right after queueing their first packet. */
+    if ((uint32_t)crypt_connection_id >= c->crypto_connections_length
+            || c->crypto_connections[crypt_connection_id].status == CRYPTO_CONN_FREE) {
+        return;
+    }
+
+    timer_wheel_cancel(c->timers, crypt_connection_id);
+    run_list_add(c, crypt_connection_id);
+}
+
 
 /** @brief Associate an ip_port to a connection.
  *
@@ -583,21 +883,21 @@ static int add_ip_port_connection(Net_Crypto *c, int crypt_connection_id, const
 
     if (net_family_is_ipv4(ip_port->ip.family)) {
         if (!ipport_equal(ip_port, &conn->ip_portv4) && !ip_is_lan(&conn->ip_portv4.ip)) {
-            if (!bs_list_add(&c->ip_port_list, (const uint8_t *)ip_port, crypt_connection_id)) {
+            if (!hash_list_add(&c->ip_port_list, (const uint8_t *)ip_port, crypt_connection_id)) {
                 return -1;
             }
 
-            bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv4, crypt_connection_id);
+            hash_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv4, crypt_connection_id);
             conn->ip_portv4 = *ip_port;
             return 0;
         }
     } else if (net_family_is_ipv6(ip_port->ip.family)) {
         if (!ipport_equal(ip_port, &conn->ip_portv6)) {
-            if (!bs_list_add(&c->ip_port_list, (const uint8_t *)ip_port, crypt_connection_id)) {
+            if (!hash_list_add(&c->ip_port_list, (const uint8_t *)ip_port, crypt_connection_id)) {
                 return -1;
             }
 
-            bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv6, crypt_connection_id);
+            hash_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv6, crypt_connection_id);
             conn->ip_portv6 = *ip_port;
             return 0;
         }
@@ -726,6 +1026,64 @@ static int send_packet_to(Net_Crypto *c, int crypt_connection_id, const uint8_t
 
 /*** START: Array Related functions */
 
+/** @brief Get an uninitialised packet from the pool.
+ *
+ * @retval nullptr on allocation failure.
+ */
+non_null()
+static Packet_Data *packet_pool_alloc(Packet_Pool *pool)
+{
+    Packet_Pool_Entry *entry = pool->free_list;
+
+    if (entry != nullptr) {
+        pool->free_list = entry->next;
+        --pool->num_cached;
+        ++pool->reused;
+        ++pool->num_in_use;
+        return (Packet_Data *)entry;
+    }
+
+    Packet_Data *packet = (Packet_Data *)malloc(sizeof(Packet_Data));
+
+    if (packet == nullptr) {
+        return nullptr;
+    }
+
+    ++pool->heap_allocations;
+    ++pool->num_in_use;
+    return packet;
+}
+
+/** @brief Give a packet back to the pool. */
+non_null()
+static void packet_pool_free(Packet_Pool *pool, Packet_Data *packet)
+{
+    assert(pool->num_in_use > 0);
+    --pool->num_in_use;
+
+    if (pool->num_cached >= pool->max_cached) {
+        free(packet);
+        return;
+    }
+
+    Packet_Pool_Entry *entry = (Packet_Pool_Entry *)packet;
+    entry->next = pool->free_list;
+    pool->free_list = entry;
+    ++pool->num_cached;
+}
+
+/** @brief Free all cached packets, keeping at most `max_cached` of them. */
+non_null()
+static void packet_pool_trim(Packet_Pool *pool, uint32_t max_cached)
+{
+    while (pool->num_cached > max_cached) {
+        Packet_Pool_Entry *entry = pool->free_list;
+        pool->free_list = entry->next;
+        --pool->num_cached;
+        free(entry);
+    }
+}
+
 
 /** @brief Return number of packets in array
  * Note that holes are counted too.
@@ -736,32 +1094,110 @@ static uint32_t num_packets_array(const Packets_Array *array)
     return array->buffer_end - array->buffer_start;
 }
 
+/** @brief Return the slot holding the packet with the given number.
+ *
+ * The number must be within the span covered by the slot table.
+ */
+non_null()
+static Packet_Data **packets_array_slot(const Packets_Array *array, uint32_t number)
+{
+    assert(number - array->buffer_start < array->buffer_size);
+    return &array->buffer[number & (array->buffer_size - 1)];
+}
+
+/** @brief Reallocate the slot table to hold new_size slots.
+ *
+ * new_size must be a power of 2 and at least `num_packets_array(array)`.
+ *
+ * @retval false on allocation failure. The array is left unchanged.
+ */
+non_null()
+static bool packets_array_resize(Packets_Array *array, uint32_t new_size)
+{
+    Packet_Data **new_buffer = (Packet_Data **)calloc(new_size, sizeof(Packet_Data *));
+
+    if (new_buffer == nullptr) {
+        return false;
+    }
+
+    for (uint32_t i = array->buffer_start; i != array->buffer_end; ++i) {
+        new_buffer[i & (new_size - 1)] = *packets_array_slot(array, i);
+    }
+
+    free(array->buffer);
+    array->buffer = new_buffer;
+    array->buffer_size = new_size;
+    return true;
+}
+
+/** @brief Make sure the slot table covers `{buffer_start, buffer_start + span)`.
+ *
+ * @retval false if span is too large or the table could not be grown.
+ */
+non_null()
+static bool packets_array_reserve(Packets_Array *array, uint32_t span)
+{
+    if (span > CRYPTO_PACKET_BUFFER_SIZE) {
+        return false;
+    }
+
+    if (span <= array->buffer_size) {
+        return true;
+    }
+
+    uint32_t new_size = array->buffer_size == 0 ? PACKETS_ARRAY_MIN_SIZE : array->buffer_size;
+
+    while (new_size < span) {
+        new_size *= 2;
+    }
+
+    return packets_array_resize(array, new_size);
+}
+
+/** @brief Give back slots after the array has drained.
+ *
+ * Halves the slot table once it is at most a quarter full, so a connection
+ * returns to a small table after a burst without resizing on every packet.
+ */
+non_null()
+static void packets_array_shrink(Packets_Array *array)
+{
+    if (array->buffer_size > PACKETS_ARRAY_MIN_SIZE && num_packets_array(array) <= array->buffer_size / 4) {
+        // On failure we just keep the bigger table.
+        packets_array_resize(array, array->buffer_size / 2);
+    }
+}
+
 /** @brief Add data with packet number to array.
  *
  * @retval -1 on failure.
  * @retval 0 on success.
  */
 non_null()
-static int add_data_to_buffer(Packets_Array *array, uint32_t number, const Packet_Data *data)
+static int add_data_to_buffer(Packet_Pool *pool, Packets_Array *array, uint32_t number, const Packet_Data *data)
 {
     if (number - array->buffer_start >= CRYPTO_PACKET_BUFFER_SIZE) {
         return -1;
     }
 
-    const uint32_t num = number % CRYPTO_PACKET_BUFFER_SIZE;
+    if (!packets_array_reserve(array, number - array->buffer_start + 1)) {
+        return -1;
+    }
 
-    if (array->buffer[num] != nullptr) {
+    Packet_Data **slot = packets_array_slot(array, number);
+
+    if (*slot != nullptr) {
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)calloc(1, sizeof(Packet_Data));
+    Packet_Data *new_d = packet_pool_alloc(pool);
 
     if (new_d == nullptr) {
         return -1;
     }
 
     *new_d = *data;
-    array->buffer[num] = new_d;
+    *slot = new_d;
 
     if (number - array->buffer_start >= num_packets_array(array)) {
         array->buffer_end = number + 1;
@@ -785,13 +1221,13 @@ static int get_data_pointer(const Packets_Array *array, Packet_Data **data, uint
         return -1;
     }
 
-    const uint32_t num = number % CRYPTO_PACKET_BUFFER_SIZE;
+    Packet_Data *const packet = *packets_array_slot(array, number);
 
-    if (array->buffer[num] == nullptr) {
+    if (packet == nullptr) {
         return 0;
     }
 
-    *data = array->buffer[num];
+    *data = packet;
     return 1;
 }
 
@@ -801,7 +1237,8 @@ static int get_data_pointer(const Packets_Array *array, Packet_Data **data, uint
  * @return packet number on success.
  */
 non_null()
-static int64_t add_data_end_of_buffer(const Logger *logger, Packets_Array *array, const Packet_Data *data)
+static int64_t add_data_end_of_buffer(const Logger *logger, Packet_Pool *pool, Packets_Array *array,
+                                      const Packet_Data *data)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -810,7 +1247,12 @@ static int64_t add_data_end_of_buffer(const Logger *logger, Packets_Array *array
         return -1;
     }
 
-    Packet_Data *new_d = (Packet_Data *)calloc(1, sizeof(Packet_Data));
+    if (!packets_array_reserve(array, num_spots + 1)) {
+        LOGGER_ERROR(logger, "packet array allocation failed");
+        return -1;
+    }
+
+    Packet_Data *new_d = packet_pool_alloc(pool);
 
     if (new_d == nullptr) {
         LOGGER_ERROR(logger, "packet data allocation failed");
@@ -819,8 +1261,8 @@ static int64_t add_data_end_of_buffer(const Logger *logger, Packets_Array *array
 
     *new_d = *data;
     const uint32_t id = array->buffer_end;
-    array->buffer[id % CRYPTO_PACKET_BUFFER_SIZE] = new_d;
     ++array->buffer_end;
+    *packets_array_slot(array, id) = new_d;
     return id;
 }
 
@@ -830,23 +1272,24 @@ static int64_t add_data_end_of_buffer(const Logger *logger, Packets_Array *array
  * @return packet number on success.
  */
 non_null()
-static int64_t read_data_beg_buffer(Packets_Array *array, Packet_Data *data)
+static int64_t read_data_beg_buffer(Packet_Pool *pool, Packets_Array *array, Packet_Data *data)
 {
     if (array->buffer_end == array->buffer_start) {
         return -1;
     }
 
-    const uint32_t num = array->buffer_start % CRYPTO_PACKET_BUFFER_SIZE;
+    Packet_Data **slot = packets_array_slot(array, array->buffer_start);
 
-    if (array->buffer[num] == nullptr) {
+    if (*slot == nullptr) {
         return -1;
     }
 
-    *data = *array->buffer[num];
+    *data = **slot;
     const uint32_t id = array->buffer_start;
     ++array->buffer_start;
-    free(array->buffer[num]);
-    array->buffer[num] = nullptr;
+    packet_pool_free(pool, *slot);
+    *slot = nullptr;
+    packets_array_shrink(array);
     return id;
 }
 
@@ -856,7 +1299,7 @@ static int64_t read_data_beg_buffer(Packets_Array *array, Packet_Data *data)
  * @retval 0 on success
  */
 non_null()
-static int clear_buffer_until(Packets_Array *array, uint32_t number)
+static int clear_buffer_until(Packet_Pool *pool, Packets_Array *array, uint32_t number)
 {
     const uint32_t num_spots = num_packets_array(array);
 
@@ -867,33 +1310,38 @@ static int clear_buffer_until(Packets_Array *array, uint32_t number)
     uint32_t i;
 
     for (i = array->buffer_start; i != number; ++i) {
-        const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        Packet_Data **slot = packets_array_slot(array, i);
 
-        if (array->buffer[num] != nullptr) {
-            free(array->buffer[num]);
-            array->buffer[num] = nullptr;
+        if (*slot != nullptr) {
+            packet_pool_free(pool, *slot);
+            *slot = nullptr;
         }
     }
 
     array->buffer_start = i;
+    packets_array_shrink(array);
     return 0;
 }
 
+/** @brief Delete all packets in array and release its slot table. */
 non_null()
-static int clear_buffer(Packets_Array *array)
+static int clear_buffer(Packet_Pool *pool, Packets_Array *array)
 {
     uint32_t i;
 
     for (i = array->buffer_start; i != array->buffer_end; ++i) {
-        const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        Packet_Data **slot = packets_array_slot(array, i);
 
-        if (array->buffer[num] != nullptr) {
-            free(array->buffer[num]);
-            array->buffer[num] = nullptr;
+        if (*slot != nullptr) {
+            packet_pool_free(pool, *slot);
+            *slot = nullptr;
         }
     }
 
     array->buffer_start = i;
+    free(array->buffer);
+    array->buffer = nullptr;
+    array->buffer_size = 0;
     return 0;
 }
 
@@ -913,6 +1361,10 @@ static int set_buffer_end(Packets_Array *array, uint32_t number)
         return -1;
     }
 
+    if (!packets_array_reserve(array, number - array->buffer_start)) {
+        return -1;
+    }
+
     array->buffer_end = number;
     return 0;
 }
@@ -946,9 +1398,7 @@ static int generate_request_packet(uint8_t *data, uint16_t length, const Packets
     uint32_t n = 1;
 
     for (uint32_t i = recv_array->buffer_start; i != recv_array->buffer_end; ++i) {
-        const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
-
-        if (recv_array->buffer[num] == nullptr) {
+        if (*packets_array_slot(recv_array, i) == nullptr) {
             data[cur_len] = n;
             n = 0;
             ++cur_len;
@@ -979,7 +1429,7 @@ static int generate_request_packet(uint8_t *data, uint16_t length, const Packets
  * @return number of requested packets on success.
  */
 non_null()
-static int handle_request_packet(Mono_Time *mono_time, Packets_Array *send_array,
+static int handle_request_packet(Mono_Time *mono_time, Packet_Pool *pool, Packets_Array *send_array,
                                  const uint8_t *data, uint16_t length,
                                  uint64_t *latest_send_time, uint64_t rtt_time)
 {
@@ -1009,14 +1459,14 @@ static int handle_request_packet(Mono_Time *mono_time, Packets_Array *send_array
             break;
         }
 
-        const uint32_t num = i % CRYPTO_PACKET_BUFFER_SIZE;
+        Packet_Data **slot = packets_array_slot(send_array, i);
 
         if (n == data[0]) {
-            if (send_array->buffer[num] != nullptr) {
-                const uint64_t sent_time = send_array->buffer[num]->sent_time;
+            if (*slot != nullptr) {
+                const uint64_t sent_time = (*slot)->sent_time;
 
                 if ((sent_time + rtt_time) < temp_time) {
-                    send_array->buffer[num]->sent_time = 0;
+                    (*slot)->sent_time = 0;
                 }
             }
 
@@ -1025,11 +1475,11 @@ static int handle_request_packet(Mono_Time *mono_time, Packets_Array *send_array
             n = 0;
             ++requested;
         } else {
-            if (send_array->buffer[num] != nullptr) {
-                l_sent_time = max_u64(l_sent_time, send_array->buffer[num]->sent_time);
+            if (*slot != nullptr) {
+                l_sent_time = max_u64(l_sent_time, (*slot)->sent_time);
 
-                free(send_array->buffer[num]);
-                send_array->buffer[num] = nullptr;
+                packet_pool_free(pool, *slot);
+                *slot = nullptr;
             }
         }
 
@@ -1056,15 +1506,22 @@ static int handle_request_packet(Mono_Time *mono_time, Packets_Array *send_array
 
 #define MAX_DATA_DATA_PACKET_SIZE (MAX_CRYPTO_PACKET_SIZE - (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE))
 
-/** @brief Creates and sends a data packet to the peer using the fastest route.
+/** Offset of the plain text in a data packet that is encrypted in place. */
+#define DATA_PACKET_PLAIN_OFFSET (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE)
+
+/** @brief Encrypts and sends a data packet to the peer using the fastest route.
+ *
+ * @param packet a buffer of `DATA_PACKET_PLAIN_OFFSET + length` bytes with the
+ *   plain text already written at `DATA_PACKET_PLAIN_OFFSET`. It is encrypted
+ *   in place.
  *
  * @retval -1 on failure.
  * @retval 0 on success.
  */
 non_null()
-static int send_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *data, uint16_t length)
+static int send_data_packet(Net_Crypto *c, int crypt_connection_id, uint8_t *packet, uint16_t length)
 {
-    const uint16_t max_length = MAX_CRYPTO_PACKET_SIZE - (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE);
+    const uint16_t max_length = MAX_CRYPTO_PACKET_SIZE - DATA_PACKET_PLAIN_OFFSET;
 
     if (length == 0 || length > max_length) {
         LOGGER_ERROR(c->log, "zero-length or too large data packet: %d (max: %d)", length, max_length);
@@ -1078,11 +1535,11 @@ static int send_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_
         return -1;
     }
 
-    const uint16_t packet_size = 1 + sizeof(uint16_t) + length + CRYPTO_MAC_SIZE;
-    VLA(uint8_t, packet, packet_size);
+    const uint16_t packet_size = DATA_PACKET_PLAIN_OFFSET + length;
     packet[0] = NET_PACKET_CRYPTO_DATA;
     memcpy(packet + 1, conn->sent_nonce + (CRYPTO_NONCE_SIZE - sizeof(uint16_t)), sizeof(uint16_t));
-    const int len = encrypt_data_symmetric(conn->shared_key, conn->sent_nonce, data, length, packet + 1 + sizeof(uint16_t));
+    const int len = encrypt_data_symmetric(conn->shared_key, conn->sent_nonce, packet + DATA_PACKET_PLAIN_OFFSET,
+                                           length, packet + 1 + sizeof(uint16_t));
 
     if (len + 1 + sizeof(uint16_t) != packet_size) {
         LOGGER_ERROR(c->log, "encryption failed: %d", len);
@@ -1091,7 +1548,7 @@ static int send_data_packet(Net_Crypto *c, int crypt_connection_id, const uint8_
 
     increment_nonce(conn->sent_nonce);
 
-    return send_packet_to(c, crypt_connection_id, packet, SIZEOF_VLA(packet));
+    return send_packet_to(c, crypt_connection_id, packet, packet_size);
 }
 
 /** @brief Creates and sends a data packet with buffer_start and num to the peer using the fastest route.
@@ -1111,13 +1568,15 @@ static int send_data_packet_helper(Net_Crypto *c, int crypt_connection_id, uint3
     num = net_htonl(num);
     buffer_start = net_htonl(buffer_start);
     const uint16_t padding_length = (MAX_CRYPTO_DATA_SIZE - length) % CRYPTO_MAX_PADDING;
-    VLA(uint8_t, packet, sizeof(uint32_t) + sizeof(uint32_t) + padding_length + length);
-    memcpy(packet, &buffer_start, sizeof(uint32_t));
-    memcpy(packet + sizeof(uint32_t), &num, sizeof(uint32_t));
-    memset(packet + (sizeof(uint32_t) * 2), PACKET_ID_PADDING, padding_length);
-    memcpy(packet + (sizeof(uint32_t) * 2) + padding_length, data, length);
+    const uint16_t plain_length = sizeof(uint32_t) + sizeof(uint32_t) + padding_length + length;
+    VLA(uint8_t, packet, DATA_PACKET_PLAIN_OFFSET + plain_length);
+    uint8_t *plain = packet + DATA_PACKET_PLAIN_OFFSET;
+    memcpy(plain, &buffer_start, sizeof(uint32_t));
+    memcpy(plain + sizeof(uint32_t), &num, sizeof(uint32_t));
+    memset(plain + (sizeof(uint32_t) * 2), PACKET_ID_PADDING, padding_length);
+    memcpy(plain + (sizeof(uint32_t) * 2) + padding_length, data, length);
 
-    return send_data_packet(c, crypt_connection_id, packet, SIZEOF_VLA(packet));
+    return send_data_packet(c, crypt_connection_id, packet, plain_length);
 }
 
 non_null()
@@ -1184,7 +1643,7 @@ static int64_t send_lossless_packet(Net_Crypto *c, int crypt_connection_id, cons
     dt.sent_time = 0;
     dt.length = length;
     memcpy(dt.data, data, length);
-    const int64_t packet_num = add_data_end_of_buffer(c->log, &conn->send_array, &dt);
+    const int64_t packet_num = add_data_end_of_buffer(c->log, &c->packet_pool, &conn->send_array, &dt);
 
     if (packet_num == -1) {
         return -1;
@@ -1351,7 +1810,7 @@ static int send_requested_packets(Net_Crypto *c, int crypt_connection_id, uint32
  * @retval 0 on success.
  */
 non_null()
-static int new_temp_packet(const Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length)
+static int new_temp_packet(Net_Crypto *c, int crypt_connection_id, const uint8_t *packet, uint16_t length)
 {
     if (length == 0 || length > MAX_CRYPTO_PACKET_SIZE) {
         return -1;
@@ -1378,6 +1837,7 @@ static int new_temp_packet(const Net_Crypto *c, int crypt_connection_id, const u
     conn->temp_packet_length = length;
     conn->temp_packet_sent_time = 0;
     conn->temp_packet_num_sent = 0;
+    wake_crypto_connection(c, crypt_connection_id);
     return 0;
 }
 
@@ -1543,7 +2003,7 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
             rtt_calc_time = packet_time->sent_time;
         }
 
-        if (clear_buffer_until(&conn->send_array, buffer_start) != 0) {
+        if (clear_buffer_until(&c->packet_pool, &conn->send_array, buffer_start) != 0) {
             return -1;
         }
     }
@@ -1584,7 +2044,7 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
             rtt_time = DEFAULT_TCP_PING_CONNECTION;
         }
 
-        const int requested = handle_request_packet(c->mono_time, &conn->send_array,
+        const int requested = handle_request_packet(c->mono_time, &c->packet_pool, &conn->send_array,
                               real_data, real_length,
                               &rtt_calc_time, rtt_time);
 
@@ -1598,12 +2058,12 @@ static int handle_data_packet_core(Net_Crypto *c, int crypt_connection_id, const
         dt.length = real_length;
         memcpy(dt.data, real_data, real_length);
 
-        if (add_data_to_buffer(&conn->recv_array, num, &dt) != 0) {
+        if (add_data_to_buffer(&c->packet_pool, &conn->recv_array, num, &dt) != 0) {
             return -1;
         }
 
         while (true) {
-            const int ret = read_data_beg_buffer(&conn->recv_array, &dt);
+            const int ret = read_data_beg_buffer(&c->packet_pool, &conn->recv_array, &dt);
 
             if (ret == -1) {
                 break;
@@ -1753,6 +2213,8 @@ static int handle_packet_connection(Net_Crypto *c, int crypt_connection_id, cons
         return -1;
     }
 
+    wake_crypto_connection(c, crypt_connection_id);
+
     switch (packet[0]) {
         case NET_PACKET_COOKIE_RESPONSE:
             return handle_packet_cookie_response(c, crypt_connection_id, packet, length);
@@ -1794,14 +2256,20 @@ static int realloc_cryptoconnection(Net_Crypto *c, uint32_t num)
 }
 
 
-/** @brief Create a new empty crypto connection.
+/** @brief Create a new empty crypto connection to the peer with the given real public key.
+ *
+ * The connection is added to the public key index.
  *
  * @retval -1 on failure.
  * @return connection id on success.
  */
 non_null()
-static int create_crypto_connection(Net_Crypto *c)
+static int create_crypto_connection(Net_Crypto *c, const uint8_t *public_key)
 {
+    if (!run_list_reserve(c, c->crypto_connections_length + 1)) {
+        return -1;
+    }
+
     int id = -1;
 
     for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
@@ -1819,16 +2287,24 @@ static int create_crypto_connection(Net_Crypto *c)
         }
     }
 
-    if (id != -1) {
-        // Memsetting float/double to 0 is non-portable, so we explicitly set them to 0
-        c->crypto_connections[id].packet_recv_rate = 0;
-        c->crypto_connections[id].packet_send_rate = 0;
-        c->crypto_connections[id].last_packets_left_rem = 0;
-        c->crypto_connections[id].packet_send_rate_requested = 0;
-        c->crypto_connections[id].last_packets_left_requested_rem = 0;
-        c->crypto_connections[id].status = CRYPTO_CONN_NO_CONNECTION;
+    if (id == -1) {
+        return -1;
+    }
+
+    if (!hash_list_add(&c->pk_list, public_key, id)) {
+        return -1;
     }
 
+    memcpy(c->crypto_connections[id].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+
+    // Memsetting float/double to 0 is non-portable, so we explicitly set them to 0
+    c->crypto_connections[id].packet_recv_rate = 0;
+    c->crypto_connections[id].packet_send_rate = 0;
+    c->crypto_connections[id].last_packets_left_rem = 0;
+    c->crypto_connections[id].packet_send_rate_requested = 0;
+    c->crypto_connections[id].last_packets_left_requested_rem = 0;
+    c->crypto_connections[id].status = CRYPTO_CONN_NO_CONNECTION;
+
     return id;
 }
 
@@ -1856,6 +2332,13 @@ static int wipe_crypto_connection(Net_Crypto *c, int crypt_connection_id)
 
     uint32_t i;
 
+    hash_list_remove(&c->pk_list, c->crypto_connections[crypt_connection_id].public_key, crypt_connection_id);
+    timer_wheel_cancel(c->timers, crypt_connection_id);
+
+    if (c->crypto_connections[crypt_connection_id].run_queued) {
+        run_list_remove(c, crypt_connection_id);
+    }
+
     crypto_memzero(&c->crypto_connections[crypt_connection_id], sizeof(Crypto_Connection));
 
     /* check if we can resize the connections array */
@@ -1881,17 +2364,13 @@ static int wipe_crypto_connection(Net_Crypto *c, int crypt_connection_id)
 non_null()
 static int getcryptconnection_id(const Net_Crypto *c, const uint8_t *public_key)
 {
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
-        if (!crypt_connection_id_is_valid(c, i)) {
-            continue;
-        }
+    const int id = hash_list_find(&c->pk_list, public_key);
 
-        if (pk_equal(public_key, c->crypto_connections[i].public_key)) {
-            return i;
-        }
+    if (id < 0 || !crypt_connection_id_is_valid(c, id)) {
+        return -1;
     }
 
-    return -1;
+    return id;
 }
 
 /** @brief Add a source to the crypto connection.
@@ -1948,15 +2427,16 @@ void new_connection_handler(Net_Crypto *c, new_connection_cb *new_connection_cal
     c->new_connection_callback_object = object;
 }
 
-/** @brief Handle a handshake packet by someone who wants to initiate a new connection with us.
+/** @brief Accept a handshake packet by someone who wants to initiate a new connection with us,
+ * once the key shared with their real public key in cookie_plain is known.
  * This calls the callback set by `new_connection_handler()` if the handshake is ok.
  *
  * @retval -1 on failure.
  * @retval 0 on success.
  */
-non_null(1, 2, 3) nullable(5)
-static int handle_new_connection_handshake(Net_Crypto *c, const IP_Port *source, const uint8_t *data, uint16_t length,
-        void *userdata)
+non_null(1, 2, 3, 4, 5) nullable(6)
+static int accept_new_connection_handshake(Net_Crypto *c, const IP_Port *source, const uint8_t *shared_key,
+        const uint8_t *cookie_plain, const uint8_t *data, void *userdata)
 {
     New_Connection n_c;
     n_c.cookie = (uint8_t *)malloc(COOKIE_LENGTH);
@@ -1968,8 +2448,8 @@ static int handle_new_connection_handshake(Net_Crypto *c, const IP_Port *source,
     n_c.source = *source;
     n_c.cookie_length = COOKIE_LENGTH;
 
-    if (!handle_crypto_handshake(c, n_c.recv_nonce, n_c.peersessionpublic_key, n_c.public_key, n_c.dht_public_key,
-                                 n_c.cookie, data, length, nullptr)) {
+    if (!open_crypto_handshake(shared_key, cookie_plain, n_c.recv_nonce, n_c.peersessionpublic_key, n_c.public_key,
+                               n_c.dht_public_key, n_c.cookie, data)) {
         free(n_c.cookie);
         return -1;
     }
@@ -1980,6 +2460,7 @@ static int handle_new_connection_handshake(Net_Crypto *c, const IP_Port *source,
         Crypto_Connection *conn = get_crypto_connection(c, crypt_connection_id);
 
         if (conn == nullptr) {
+            free(n_c.cookie);
             return -1;
         }
 
@@ -2013,6 +2494,87 @@ static int handle_new_connection_handshake(Net_Crypto *c, const IP_Port *source,
     return ret;
 }
 
+/** Key generation, source address, opened cookie and packet of a handshake waiting for its key in the handshake pool. */
+#define HANDSHAKE_JOB_LENGTH (sizeof(uint32_t) + sizeof(IP_Port) + COOKIE_DATA_LENGTH + HANDSHAKE_PACKET_LENGTH)
+
+static_assert(HANDSHAKE_JOB_LENGTH <= PRECOMPUTE_JOB_DATA_SIZE, "a deferred handshake must fit in a precompute job");
+
+/** Finish a new connection handshake once the handshake pool computed its key. */
+non_null(1, 3) nullable(2, 5)
+static void new_connection_handshake_computed(void *object, const uint8_t *shared_key, const uint8_t *data,
+        uint16_t length, void *userdata)
+{
+    Net_Crypto *c = (Net_Crypto *)object;
+
+    if (shared_key == nullptr || length != HANDSHAKE_JOB_LENGTH) {
+        return;
+    }
+
+    uint32_t generation;
+    memcpy(&generation, data, sizeof(uint32_t));
+
+    if (generation != c->handshake_keys_generation) {
+        // Computed with a secret key we no longer have.
+        return;
+    }
+
+    IP_Port source;
+    memcpy(&source, data + sizeof(uint32_t), sizeof(IP_Port));
+    const uint8_t *cookie_plain = data + sizeof(uint32_t) + sizeof(IP_Port);
+    const uint8_t *packet = cookie_plain + COOKIE_DATA_LENGTH;
+
+    shared_key_cache_insert(c->handshake_keys, cookie_plain, shared_key);
+    accept_new_connection_handshake(c, &source, shared_key, cookie_plain, packet, userdata);
+}
+
+/** @brief Handle a handshake packet by someone who wants to initiate a new connection with us.
+ * This calls the callback set by `new_connection_handler()` if the handshake is ok,
+ * or later from do_net_crypto if the key agreement was left to the handshake pool.
+ *
+ * @retval -1 on failure.
+ * @retval 0 on success.
+ */
+non_null(1, 2, 3) nullable(5)
+static int handle_new_connection_handshake(Net_Crypto *c, const IP_Port *source, const uint8_t *data, uint16_t length,
+        void *userdata)
+{
+    // Opening the cookie is cheap and weeds out garbage before any key agreement.
+    uint8_t cookie_plain[COOKIE_DATA_LENGTH];
+
+    if (!open_handshake_cookie(c, cookie_plain, data, length, nullptr)) {
+        return -1;
+    }
+
+    const uint8_t *shared_key;
+
+    if (c->handshake_pool == nullptr) {
+        shared_key = shared_key_cache_lookup(c->handshake_keys, cookie_plain);
+    } else {
+        shared_key = shared_key_cache_find(c->handshake_keys, cookie_plain);
+
+        if (shared_key == nullptr) {
+            uint8_t job[HANDSHAKE_JOB_LENGTH];
+            memcpy(job, &c->handshake_keys_generation, sizeof(uint32_t));
+            memcpy(job + sizeof(uint32_t), source, sizeof(IP_Port));
+            memcpy(job + sizeof(uint32_t) + sizeof(IP_Port), cookie_plain, COOKIE_DATA_LENGTH);
+            memcpy(job + sizeof(uint32_t) + sizeof(IP_Port) + COOKIE_DATA_LENGTH, data, HANDSHAKE_PACKET_LENGTH);
+
+            if (!precompute_pool_add(c->handshake_pool, cookie_plain, c->self_secret_key,
+                                     &new_connection_handshake_computed, c, job, sizeof(job))) {
+                return -1;
+            }
+
+            return 0;
+        }
+    }
+
+    if (shared_key == nullptr) {
+        return -1;
+    }
+
+    return accept_new_connection_handshake(c, source, shared_key, cookie_plain, data, userdata);
+}
+
 /** @brief Accept a crypto connection.
  *
  * return -1 on failure.
@@ -2024,7 +2586,7 @@ int accept_crypto_connection(Net_Crypto *c, const New_Connection *n_c)
         return -1;
     }
 
-    const int crypt_connection_id = create_crypto_connection(c);
+    const int crypt_connection_id = create_crypto_connection(c, n_c->public_key);
 
     if (crypt_connection_id == -1) {
         LOGGER_ERROR(c->log, "Could not create new crypto connection");
@@ -2046,7 +2608,6 @@ int accept_crypto_connection(Net_Crypto *c, const New_Connection *n_c)
     }
 
     conn->connection_number_tcp = connection_number_tcp;
-    memcpy(conn->public_key, n_c->public_key, CRYPTO_PUBLIC_KEY_SIZE);
     memcpy(conn->recv_nonce, n_c->recv_nonce, CRYPTO_NONCE_SIZE);
     memcpy(conn->peersessionpublic_key, n_c->peersessionpublic_key, CRYPTO_PUBLIC_KEY_SIZE);
     random_nonce(c->rng, conn->sent_nonce);
@@ -2083,7 +2644,7 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
         return crypt_connection_id;
     }
 
-    crypt_connection_id = create_crypto_connection(c);
+    crypt_connection_id = create_crypto_connection(c, real_public_key);
 
     if (crypt_connection_id == -1) {
         return -1;
@@ -2099,7 +2660,6 @@ int new_crypto_connection(Net_Crypto *c, const uint8_t *real_public_key, const u
     }
 
     conn->connection_number_tcp = connection_number_tcp;
-    memcpy(conn->public_key, real_public_key, CRYPTO_PUBLIC_KEY_SIZE);
     random_nonce(c->rng, conn->sent_nonce);
     crypto_new_keypair(c->rng, conn->sessionpublic_key, conn->sessionsecret_key);
     conn->status = CRYPTO_CONN_COOKIE_REQUESTING;
@@ -2635,7 +3195,7 @@ int nc_dht_pk_callback(const Net_Crypto *c, int crypt_connection_id, dht_pk_cb *
 non_null()
 static int crypto_id_ip_port(const Net_Crypto *c, const IP_Port *ip_port)
 {
-    return bs_list_find(&c->ip_port_list, (const uint8_t *)ip_port);
+    return hash_list_find(&c->ip_port_list, (const uint8_t *)ip_port);
 }
 
 #define CRYPTO_MIN_PACKET_SIZE (1 + sizeof(uint16_t) + CRYPTO_MAC_SIZE)
@@ -2711,6 +3271,88 @@ static int udp_handle_packet(void *object, const IP_Port *source, const uint8_t
  */
 #define SEND_QUEUE_RATIO 2.0
 
+non_null()
+static bool crypto_connection_timed_out(const Crypto_Connection *conn)
+{
+    return (conn->status == CRYPTO_CONN_COOKIE_REQUESTING || conn->status == CRYPTO_CONN_HANDSHAKE_SENT
+            || conn->status == CRYPTO_CONN_NOT_CONFIRMED)
+           && conn->temp_packet_num_sent >= MAX_NUM_SENDPACKET_TRIES;
+}
+
+/** @brief Check whether an established connection would only send request packets.
+ *
+ * True when there is no traffic in either direction and the congestion
+ * control state has settled at its minimum, so that running
+ * send_crypto_packets for it every iteration changes nothing.
+ */
+non_null()
+static bool crypto_connection_is_idle(const Crypto_Connection *conn, uint64_t temp_time)
+{
+    if (conn->packet_counter != 0 || conn->packets_sent != 0 || conn->packets_resent != 0
+            || num_packets_array(&conn->send_array) != 0 || num_packets_array(&conn->recv_array) != 0) {
+        return false;
+    }
+
+    if (conn->packet_recv_rate > CRYPTO_PACKET_MIN_RATE || conn->packet_send_rate > CRYPTO_PACKET_MIN_RATE * 1.5
+            || conn->last_congestion_event + CONGESTION_EVENT_TIMEOUT >= temp_time) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < CONGESTION_QUEUE_ARRAY_SIZE; ++i) {
+        if (conn->last_sendqueue_size[i] != 0) {
+            return false;
+        }
+    }
+
+    for (uint32_t i = 0; i < CONGESTION_LAST_SENT_ARRAY_SIZE; ++i) {
+        if (conn->last_num_packets_sent[i] != 0 || conn->last_num_packets_resent[i] != 0) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** @brief Take a connection off the run list after it ran.
+ *
+ * Connections with traffic or congestion state to update stay on it. The
+ * others sleep in the timer wheel until their next temp or request packet is
+ * due, or until something wakes them.
+ *
+ * @retval true if the connection stays on the run list.
+ */
+non_null()
+static bool schedule_crypto_connection(Net_Crypto *c, uint32_t crypt_connection_id, uint64_t temp_time)
+{
+    Crypto_Connection *conn = &c->crypto_connections[crypt_connection_id];
+
+    if (crypto_connection_timed_out(conn)) {
+        return true;
+    }
+
+    if (conn->status == CRYPTO_CONN_ESTABLISHED && !crypto_connection_is_idle(conn, temp_time)) {
+        return true;
+    }
+
+    uint64_t due = UINT64_MAX;
+
+    if (conn->temp_packet != nullptr) {
+        due = conn->temp_packet_sent_time + CRYPTO_SEND_PACKET_INTERVAL + 1;
+    }
+
+    if (conn->status == CRYPTO_CONN_NOT_CONFIRMED || conn->status == CRYPTO_CONN_ESTABLISHED) {
+        due = min_u64(due, conn->last_request_packet_sent + CRYPTO_SEND_PACKET_INTERVAL + 1);
+    }
+
+    if (due != UINT64_MAX && !timer_wheel_schedule(c->timers, crypt_connection_id, due)) {
+        return true;
+    }
+
+    conn->run_queued = false;
+    conn->parked = conn->status == CRYPTO_CONN_ESTABLISHED;
+    return false;
+}
+
 non_null()
 static void send_crypto_packets(Net_Crypto *c)
 {
@@ -2718,13 +3360,32 @@ static void send_crypto_packets(Net_Crypto *c)
     double total_send_rate = 0;
     uint32_t peak_request_packet_interval = -1;
 
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
+    /* Entries added while running go after the ones we look at now. */
+    const uint32_t num_run = c->run_list_length;
+    uint32_t num_kept = 0;
+
+    for (uint32_t k = 0; k < num_run; ++k) {
+        const uint32_t i = c->run_list[k];
         Crypto_Connection *conn = get_crypto_connection(c, i);
 
         if (conn == nullptr) {
+            /* Still being set up: look again next time. */
+            c->run_list[num_kept] = i;
+            ++num_kept;
             continue;
         }
 
+        if (conn->parked) {
+            /* Don't hand out send allowance for the time it slept. */
+            conn->parked = false;
+
+            if (conn->last_packets_left_set != 0 && temp_time > PACKET_COUNTER_AVERAGE_INTERVAL) {
+                const uint64_t last_set = temp_time - PACKET_COUNTER_AVERAGE_INTERVAL;
+                conn->last_packets_left_set = max_u64(conn->last_packets_left_set, last_set);
+                conn->last_packets_left_requested_set = max_u64(conn->last_packets_left_requested_set, last_set);
+            }
+        }
+
         if ((CRYPTO_SEND_PACKET_INTERVAL + conn->temp_packet_sent_time) < temp_time) {
             send_temp_packet(c, i);
         }
@@ -2924,8 +3585,17 @@ static void send_crypto_packets(Net_Crypto *c)
                 total_send_rate += conn->packet_send_rate;
             }
         }
+
+        if (schedule_crypto_connection(c, i, temp_time)) {
+            c->run_list[num_kept] = i;
+            ++num_kept;
+        }
     }
 
+    memmove(&c->run_list[num_kept], &c->run_list[num_run], (c->run_list_length - num_run) * sizeof(uint32_t));
+    c->run_list_length = num_kept + (c->run_list_length - num_run);
+    c->run_list_woken = c->run_list_length > num_kept;
+
     c->current_sleep_time = -1;
     uint32_t sleep_time = peak_request_packet_interval;
 
@@ -3025,6 +3695,8 @@ int64_t write_cryptpacket(Net_Crypto *c, int crypt_connection_id, const uint8_t
         return -1;
     }
 
+    wake_crypto_connection(c, crypt_connection_id);
+
     if (congestion_control) {
         --conn->packets_left;
         --conn->packets_left_requested;
@@ -3114,11 +3786,11 @@ int crypto_kill(Net_Crypto *c, int crypt_connection_id)
 
         kill_tcp_connection_to(c->tcp_c, conn->connection_number_tcp);
 
-        bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv4, crypt_connection_id);
-        bs_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv6, crypt_connection_id);
+        hash_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv4, crypt_connection_id);
+        hash_list_remove(&c->ip_port_list, (uint8_t *)&conn->ip_portv6, crypt_connection_id);
         clear_temp_packet(c, crypt_connection_id);
-        clear_buffer(&conn->send_array);
-        clear_buffer(&conn->recv_array);
+        clear_buffer(&c->packet_pool, &conn->send_array);
+        clear_buffer(&c->packet_pool, &conn->recv_array);
         ret = wipe_crypto_connection(c, crypt_connection_id);
     }
 
@@ -3176,6 +3848,8 @@ void load_secret_key(Net_Crypto *c, const uint8_t *sk)
 {
     memcpy(c->self_secret_key, sk, CRYPTO_SECRET_KEY_SIZE);
     crypto_derive_public_key(c->self_public_key, c->self_secret_key);
+    shared_key_cache_clear(c->handshake_keys);
+    ++c->handshake_keys_generation;
 }
 
 /** @brief Create new instance of Net_Crypto.
@@ -3198,9 +3872,17 @@ Net_Crypto *new_net_crypto(const Logger *log, const Random *rng, const Network *
     temp->mono_time = mono_time;
     temp->ns = ns;
 
+    temp->timers = timer_wheel_new(current_time_monotonic(mono_time));
+
+    if (temp->timers == nullptr) {
+        free(temp);
+        return nullptr;
+    }
+
     temp->tcp_c = new_tcp_connections(log, rng, ns, mono_time, dht_get_self_secret_key(dht), proxy_info);
 
     if (temp->tcp_c == nullptr) {
+        timer_wheel_kill(temp->timers);
         free(temp);
         return nullptr;
     }
@@ -3213,6 +3895,24 @@ Net_Crypto *new_net_crypto(const Logger *log, const Random *rng, const Network *
     new_keys(temp);
     new_symmetric_key(rng, temp->secret_symmetric_key);
 
+    temp->handshake_keys = shared_key_cache_new(mono_time, rng, temp->self_secret_key, HANDSHAKE_KEYS_TIMEOUT,
+                           MAX_CACHED_HANDSHAKE_KEYS);
+
+    if (temp->handshake_keys == nullptr) {
+        kill_tcp_connections(temp->tcp_c);
+        timer_wheel_kill(temp->timers);
+        free(temp);
+        return nullptr;
+    }
+
+    if (hash_list_init(&temp->pk_list, CRYPTO_PUBLIC_KEY_SIZE, 8, random_u64(rng)) == 0) {
+        shared_key_cache_free(temp->handshake_keys);
+        kill_tcp_connections(temp->tcp_c);
+        timer_wheel_kill(temp->timers);
+        free(temp);
+        return nullptr;
+    }
+
     temp->current_sleep_time = CRYPTO_SEND_PACKET_INTERVAL;
 
     networking_registerhandler(dht_get_net(dht), NET_PACKET_COOKIE_REQUEST, &udp_handle_cookie_request, temp);
@@ -3220,7 +3920,9 @@ Net_Crypto *new_net_crypto(const Logger *log, const Random *rng, const Network *
     networking_registerhandler(dht_get_net(dht), NET_PACKET_CRYPTO_HS, &udp_handle_packet, temp);
     networking_registerhandler(dht_get_net(dht), NET_PACKET_CRYPTO_DATA, &udp_handle_packet, temp);
 
-    bs_list_init(&temp->ip_port_list, sizeof(IP_Port), 8);
+    hash_list_init(&temp->ip_port_list, sizeof(IP_Port), 8, random_u64(rng));
+
+    temp->packet_pool.max_cached = PACKET_POOL_DEFAULT_MAX_CACHED;
 
     return temp;
 }
@@ -3228,19 +3930,22 @@ Net_Crypto *new_net_crypto(const Logger *log, const Random *rng, const Network *
 non_null(1) nullable(2)
 static void kill_timedout(Net_Crypto *c, void *userdata)
 {
-    for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
+    /* Only connections in the run list can have sent their temp packet since
+     * the last check. Killing one removes it from the list by moving the last
+     * entry into its place, so go backwards. */
+    for (uint32_t k = c->run_list_length; k > 0; --k) {
+        if (k > c->run_list_length) {
+            continue;
+        }
+
+        const uint32_t i = c->run_list[k - 1];
         const Crypto_Connection *conn = get_crypto_connection(c, i);
 
         if (conn == nullptr) {
             continue;
         }
 
-        if (conn->status == CRYPTO_CONN_COOKIE_REQUESTING || conn->status == CRYPTO_CONN_HANDSHAKE_SENT
-                || conn->status == CRYPTO_CONN_NOT_CONFIRMED) {
-            if (conn->temp_packet_num_sent < MAX_NUM_SENDPACKET_TRIES) {
-                continue;
-            }
-
+        if (crypto_connection_timed_out(conn)) {
             connection_kill(c, i, userdata);
         }
 
@@ -3258,15 +3963,91 @@ static void kill_timedout(Net_Crypto *c, void *userdata)
 /** return the optimal interval in ms for running do_net_crypto. */
 uint32_t crypto_run_interval(const Net_Crypto *c)
 {
-    return c->current_sleep_time;
+    if (c->run_list_woken) {
+        return 0;
+    }
+
+    uint32_t interval = min_u32(c->current_sleep_time, tcp_connections_run_interval(c->tcp_c));
+
+    if (c->handshake_pool != nullptr && precompute_pool_in_flight(c->handshake_pool) > 0) {
+        // Pick up the finished key agreements soon.
+        interval = min_u32(interval, HANDSHAKE_POOL_POLL_INTERVAL);
+    }
+
+    const uint64_t next_due = timer_wheel_next_due(c->timers);
+
+    if (next_due == UINT64_MAX) {
+        return interval;
+    }
+
+    const uint64_t now = current_time_monotonic(c->mono_time);
+
+    if (next_due <= now) {
+        return 0;
+    }
+
+    return min_u64(next_due - now, interval);
+}
+
+void nc_get_packet_pool_stats(const Net_Crypto *c, Net_Crypto_Packet_Pool_Stats *stats)
+{
+    stats->in_use = c->packet_pool.num_in_use;
+    stats->cached = c->packet_pool.num_cached;
+    stats->heap_allocations = c->packet_pool.heap_allocations;
+    stats->reused = c->packet_pool.reused;
+}
+
+void nc_set_packet_pool_max_cached(Net_Crypto *c, uint32_t max_cached)
+{
+    c->packet_pool.max_cached = max_cached;
+    packet_pool_trim(&c->packet_pool, max_cached);
+}
+
+bool nc_set_handshake_threads(Net_Crypto *c, uint16_t num_threads, uint32_t max_queued)
+{
+    Precompute_Pool *pool = nullptr;
+
+    if (num_threads > 0) {
+        pool = precompute_pool_new(c->log, num_threads, max_queued);
+
+        if (pool == nullptr) {
+            return false;
+        }
+    }
+
+    // Handshakes still in the old pool are dropped; peers will resend them.
+    dht_set_request_pool(c->dht, pool);
+    precompute_pool_free(c->handshake_pool);
+    c->handshake_pool = pool;
+    return true;
+}
+
+bool nc_get_handshake_pool_stats(const Net_Crypto *c, Precompute_Pool_Stats *stats)
+{
+    if (c->handshake_pool == nullptr) {
+        return false;
+    }
+
+    precompute_pool_get_stats(c->handshake_pool, stats);
+    return true;
 }
 
 /** Main loop. */
 void do_net_crypto(Net_Crypto *c, void *userdata)
 {
+    if (c->handshake_pool != nullptr) {
+        precompute_pool_do(c->handshake_pool, userdata);
+    }
+
+    timer_wheel_expire(c->timers, current_time_monotonic(c->mono_time), &run_list_add_due, c);
     kill_timedout(c, userdata);
     do_tcp(c, userdata);
+
+    // Direct UDP sends of all connections go out together at the end.
+    Networking_Core *net = dht_get_net(c->dht);
+    networking_send_batch_begin(net);
     send_crypto_packets(c);
+    networking_send_batch_flush(net);
 }
 
 void kill_net_crypto(Net_Crypto *c)
@@ -3275,12 +4056,22 @@ void kill_net_crypto(Net_Crypto *c)
         return;
     }
 
+    if (c->handshake_pool != nullptr) {
+        dht_set_request_pool(c->dht, nullptr);
+        precompute_pool_free(c->handshake_pool);
+    }
+
     for (uint32_t i = 0; i < c->crypto_connections_length; ++i) {
         crypto_kill(c, i);
     }
 
     kill_tcp_connections(c->tcp_c);
-    bs_list_free(&c->ip_port_list);
+    shared_key_cache_free(c->handshake_keys);
+    hash_list_free(&c->ip_port_list);
+    packet_pool_trim(&c->packet_pool, 0);
+    hash_list_free(&c->pk_list);
+    timer_wheel_kill(c->timers);
+    free(c->run_list);
     networking_registerhandler(dht_get_net(c->dht), NET_PACKET_COOKIE_REQUEST, nullptr, nullptr);
     networking_registerhandler(dht_get_net(c->dht), NET_PACKET_COOKIE_RESPONSE, nullptr, nullptr);
     networking_registerhandler(dht_get_net(c->dht), NET_PACKET_CRYPTO_HS, nullptr, nullptr);
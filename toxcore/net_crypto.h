@@ -15,6 +15,7 @@
 #include "LAN_discovery.h"
 #include "TCP_connection.h"
 #include "logger.h"
+#include "precompute_pool.h"
 
 /*** Crypto payloads. */
 
@@ -401,7 +402,55 @@ void load_secret_key(Net_Crypto *c, const uint8_t *sk);
 non_null()
 Net_Crypto *new_net_crypto(const Logger *log, const Random *rng, const Network *ns, Mono_Time *mono_time, DHT *dht, const TCP_Proxy_Info *proxy_info);
 
-/** return the optimal interval in ms for running do_net_crypto. */
+/** Occupancy counters of the packet pool backing all send and receive queues. */
+typedef struct Net_Crypto_Packet_Pool_Stats {
+    uint32_t in_use;            /* packets currently queued in send or receive arrays */
+    uint32_t cached;            /* released packets kept on the free list */
+    uint64_t heap_allocations;  /* packets that had to be allocated with malloc */
+    uint64_t reused;            /* packets taken from the free list instead */
+} Net_Crypto_Packet_Pool_Stats;
+
+/** @brief Copy the current packet pool counters into stats. */
+non_null()
+void nc_get_packet_pool_stats(const Net_Crypto *c, Net_Crypto_Packet_Pool_Stats *stats);
+
+/** @brief Set how many released packets the pool keeps for reuse.
+ *
+ * Lowering the limit frees cached packets above it immediately. 0 disables
+ * caching, so every queued packet is allocated and freed individually.
+ */
+non_null()
+void nc_set_packet_pool_max_cached(Net_Crypto *c, uint32_t max_cached);
+
+/** Default number of handshakes that may wait for the handshake threads. */
+#define NC_HANDSHAKE_QUEUE_SIZE 1024
+
+/** @brief Set the number of threads that do the key agreements of incoming handshakes.
+ *
+ * With threads, UDP cookie requests, handshakes that start a new connection and
+ * DHT crypto requests from senders without a cached key are queued for the
+ * threads and finished by do_net_crypto once their key is computed, so a burst
+ * of them doesn't stall the thread running Net_Crypto.
+ * Once `max_queued` of them wait, further ones are dropped until the threads
+ * catch up. 0 threads, the default, computes keys synchronously.
+ *
+ * @retval false if the threads could not be started; the previous setting is kept.
+ */
+non_null()
+bool nc_set_handshake_threads(Net_Crypto *c, uint16_t num_threads, uint32_t max_queued);
+
+/** @brief Copy the counters of the handshake threads into stats.
+ *
+ * @retval false if keys are computed synchronously.
+ */
+non_null()
+bool nc_get_handshake_pool_stats(const Net_Crypto *c, Precompute_Pool_Stats *stats);
+
+/** @brief Return the optimal interval in ms for running do_net_crypto.
+ *
+ * This is the time until the next connection or TCP relay has work to do,
+ * not counting packets that may arrive before then.
+ */
 non_null()
 uint32_t crypto_run_interval(const Net_Crypto *c);
 
@@ -21,6 +21,11 @@
 #define _XOPEN_SOURCE 700
 #endif
 
+// For recvmmsg and sendmmsg on Linux.
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #if defined(_WIN32) && _WIN32_WINNT >= _WIN32_WINNT_WINXP
 #undef _WIN32_WINNT
 #define _WIN32_WINNT  0x501
@@ -102,6 +107,15 @@
 #define MSG_NOSIGNAL 0
 #endif
 
+// recvmmsg and sendmmsg are only declared with _GNU_SOURCE, which also
+// defines MSG_WAITFORONE.
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+#define NET_HAVE_MMSG
+#endif
+
+/** Maximum number of datagrams received or sent with one batched syscall. */
+#define NET_BATCH_SIZE 16
+
 #ifndef IPV6_ADD_MEMBERSHIP
 #ifdef IPV6_JOIN_GROUP
 #define IPV6_ADD_MEMBERSHIP IPV6_JOIN_GROUP
@@ -544,6 +558,91 @@ static int sys_recvfrom(void *obj, int sock, uint8_t *buf, size_t len, Network_A
     return ret;
 }
 
+#ifdef NET_HAVE_MMSG
+non_null()
+static int sys_recvmmsg(void *obj, int sock, Net_Datagram *msgs, uint32_t count)
+{
+    struct mmsghdr hdrs[NET_BATCH_SIZE];
+    struct iovec iovs[NET_BATCH_SIZE];
+
+    if (count > NET_BATCH_SIZE) {
+        count = NET_BATCH_SIZE;
+    }
+
+    memset(hdrs, 0, count * sizeof(struct mmsghdr));
+
+    for (uint32_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = msgs[i].buf;
+        iovs[i].iov_len = msgs[i].len;
+        hdrs[i].msg_hdr.msg_name = &msgs[i].addr->addr;
+        hdrs[i].msg_hdr.msg_namelen = msgs[i].addr->size;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    const int ret = recvmmsg(sock, hdrs, count, MSG_DONTWAIT, nullptr);
+
+    for (int i = 0; i < ret; ++i) {
+        msgs[i].len = hdrs[i].msg_len;
+        msgs[i].addr->size = hdrs[i].msg_hdr.msg_namelen;
+    }
+
+    return ret;
+}
+
+non_null()
+static int sys_sendmmsg(void *obj, int sock, const Net_Datagram *msgs, uint32_t count)
+{
+    struct mmsghdr hdrs[NET_BATCH_SIZE];
+    struct iovec iovs[NET_BATCH_SIZE];
+
+    if (count > NET_BATCH_SIZE) {
+        count = NET_BATCH_SIZE;
+    }
+
+    memset(hdrs, 0, count * sizeof(struct mmsghdr));
+
+    for (uint32_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = msgs[i].buf;
+        iovs[i].iov_len = msgs[i].len;
+        hdrs[i].msg_hdr.msg_name = &msgs[i].addr->addr;
+        hdrs[i].msg_hdr.msg_namelen = msgs[i].addr->size;
+        hdrs[i].msg_hdr.msg_iov = &iovs[i];
+        hdrs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    return sendmmsg(sock, hdrs, count, 0);
+}
+#endif /* NET_HAVE_MMSG */
+
+#ifndef OS_WIN32
+/** Maximum number of spans written with one vectored send. */
+#define NET_SENDV_MAX_SPANS 8
+
+non_null()
+static int sys_sendv(void *obj, int sock, const Net_Span *spans, uint32_t count)
+{
+    struct iovec iovs[NET_SENDV_MAX_SPANS];
+
+    if (count > NET_SENDV_MAX_SPANS) {
+        count = NET_SENDV_MAX_SPANS;
+    }
+
+    for (uint32_t i = 0; i < count; ++i) {
+        iovs[i].iov_base = (void *)(uintptr_t)spans[i].buf;
+        iovs[i].iov_len = spans[i].len;
+    }
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iovs;
+    msg.msg_iovlen = count;
+
+    // Not writev: sendmsg takes MSG_NOSIGNAL, so a closed peer can't raise SIGPIPE.
+    return (int)sendmsg(sock, &msg, MSG_NOSIGNAL);
+}
+#endif /* OS_WIN32 */
+
 non_null()
 static int sys_socket(void *obj, int domain, int type, int proto)
 {
@@ -590,6 +689,20 @@ static const Network_Funcs system_network_funcs = {
     sys_socket_nonblock,
     sys_getsockopt,
     sys_setsockopt,
+    nullptr,
+    nullptr,
+#ifdef NET_HAVE_MMSG
+    sys_recvmmsg,
+    sys_sendmmsg,
+#else
+    nullptr,
+    nullptr,
+#endif
+#ifndef OS_WIN32
+    sys_sendv,
+#else
+    nullptr,
+#endif
 };
 static const Network system_network_obj = {&system_network_funcs};
 
@@ -809,6 +922,38 @@ int net_send(const Network *ns, const Logger *log,
     return res;
 }
 
+int net_sendv(const Network *ns, const Logger *log, Socket sock, const Net_Span *spans, uint32_t count,
+              const IP_Port *ip_port)
+{
+    if (count == 0) {
+        return 0;
+    }
+
+    if (ns->funcs->sendv != nullptr) {
+        const int res = ns->funcs->sendv(ns->obj, sock.sock, spans, count);
+        loglogdata(log, "T=>", spans[0].buf, spans[0].len, ip_port, res);
+        return res;
+    }
+
+    int sent = 0;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const int res = net_send(ns, log, sock, spans[i].buf, spans[i].len, ip_port);
+
+        if (res <= 0) {
+            break;
+        }
+
+        sent += res;
+
+        if ((size_t)res != spans[i].len) {
+            break;
+        }
+    }
+
+    return sent == 0 ? -1 : sent;
+}
+
 non_null()
 static int net_sendto(
         const Network *ns,
@@ -832,6 +977,52 @@ static int net_recvfrom(const Network *ns,
     return ns->funcs->recvfrom(ns->obj, sock.sock, buf, len, addr);
 }
 
+non_null()
+static int net_recvmmsg(const Network *ns, Socket sock, Net_Datagram *msgs, uint32_t count)
+{
+    if (ns->funcs->recvmmsg != nullptr) {
+        return ns->funcs->recvmmsg(ns->obj, sock.sock, msgs, count);
+    }
+
+    uint32_t received = 0;
+
+    while (received < count) {
+        Net_Datagram *msg = &msgs[received];
+        const int len = net_recvfrom(ns, sock, msg->buf, msg->len, msg->addr);
+
+        if (len < 0) {
+            break;
+        }
+
+        msg->len = (size_t)len;
+        ++received;
+    }
+
+    return received == 0 ? -1 : (int)received;
+}
+
+non_null()
+static int net_sendmmsg(const Network *ns, Socket sock, const Net_Datagram *msgs, uint32_t count)
+{
+    if (ns->funcs->sendmmsg != nullptr) {
+        return ns->funcs->sendmmsg(ns->obj, sock.sock, msgs, count);
+    }
+
+    uint32_t sent = 0;
+
+    while (sent < count) {
+        const Net_Datagram *msg = &msgs[sent];
+
+        if (ns->funcs->sendto(ns->obj, sock.sock, msg->buf, msg->len, msg->addr) < 0) {
+            break;
+        }
+
+        ++sent;
+    }
+
+    return sent == 0 ? -1 : (int)sent;
+}
+
 int net_listen(const Network *ns, Socket sock, int backlog)
 {
     return ns->funcs->listen(ns->obj, sock.sock, backlog);
@@ -876,6 +1067,16 @@ bool set_socket_reuseaddr(const Network *ns, Socket sock)
     return net_setsockopt(ns, sock, SOL_SOCKET, SO_REUSEADDR, &set, sizeof(set)) == 0;
 }
 
+bool set_socket_reuseport(const Network *ns, Socket sock)
+{
+#ifdef SO_REUSEPORT
+    int set = 1;
+    return net_setsockopt(ns, sock, SOL_SOCKET, SO_REUSEPORT, &set, sizeof(set)) == 0;
+#else
+    return false;
+#endif
+}
+
 bool set_socket_dualstack(const Network *ns, Socket sock)
 {
     int ipv6only = 0;
@@ -896,6 +1097,18 @@ typedef struct Packet_Handler {
     void *object;
 } Packet_Handler;
 
+/** Buffers for datagrams received or sent with one batched syscall. */
+typedef struct Net_Batch {
+    Net_Datagram msgs[NET_BATCH_SIZE];
+    Network_Addr addrs[NET_BATCH_SIZE];
+    uint8_t data[NET_BATCH_SIZE][MAX_UDP_PACKET_SIZE];
+
+    /* Number of queued datagrams, only used for sending. */
+    uint32_t count;
+    /* Whether send_packet queues into this batch, only used for sending. */
+    bool active;
+} Net_Batch;
+
 struct Networking_Core {
     const Logger *log;
     Packet_Handler packethandlers[256];
@@ -905,6 +1118,10 @@ struct Networking_Core {
     uint16_t port;
     /* Our UDP socket. */
     Socket sock;
+
+    /* NULL if UDP is disabled. */
+    Net_Batch *recv_batch;
+    Net_Batch *send_batch;
 };
 
 Family net_family(const Networking_Core *net)
@@ -917,9 +1134,60 @@ uint16_t net_port(const Networking_Core *net)
     return net->port;
 }
 
+Socket net_socket_of(const Networking_Core *net)
+{
+    return net->sock;
+}
+
 /* Basic network functions:
  */
 
+/** @brief Send all datagrams queued in the send batch.
+ *
+ * Datagrams the socket refuses are dropped, as a failed sendto would drop them.
+ */
+non_null()
+static void send_batch(const Networking_Core *net)
+{
+    Net_Batch *const batch = net->send_batch;
+    uint32_t sent = 0;
+
+    while (sent < batch->count) {
+        const int res = net_sendmmsg(net->ns, net->sock, &batch->msgs[sent], batch->count - sent);
+
+        if (res <= 0) {
+            const int error = net_error();
+            char *strerror = net_new_strerror(error);
+            LOGGER_DEBUG(net->log, "dropping batched packet of length %u: %d, %s",
+                         (unsigned int)batch->msgs[sent].len, error, strerror);
+            net_kill_strerror(strerror);
+            ++sent;
+            continue;
+        }
+
+        sent += (uint32_t)res;
+    }
+
+    batch->count = 0;
+}
+
+void networking_send_batch_begin(Networking_Core *net)
+{
+    if (net->send_batch != nullptr) {
+        net->send_batch->active = true;
+    }
+}
+
+void networking_send_batch_flush(Networking_Core *net)
+{
+    if (net->send_batch == nullptr) {
+        return;
+    }
+
+    send_batch(net);
+    net->send_batch->active = false;
+}
+
 int send_packet(const Networking_Core *net, const IP_Port *ip_port, Packet packet)
 {
     IP_Port ipp_copy = *ip_port;
@@ -985,6 +1253,24 @@ int send_packet(const Networking_Core *net, const IP_Port *ip_port, Packet packe
         return -1;
     }
 
+    Net_Batch *const batch = net->send_batch;
+
+    if (batch != nullptr && batch->active) {
+        if (batch->count == NET_BATCH_SIZE || packet.length > MAX_UDP_PACKET_SIZE) {
+            send_batch(net);
+        }
+
+        if (packet.length <= MAX_UDP_PACKET_SIZE) {
+            memcpy(batch->data[batch->count], packet.data, packet.length);
+            batch->addrs[batch->count] = addr;
+            batch->msgs[batch->count].len = packet.length;
+            ++batch->count;
+
+            loglogdata(net->log, "O=>", packet.data, packet.length, ip_port, packet.length);
+            return packet.length;
+        }
+    }
+
     const long res = net_sendto(net->ns, net->sock, packet.data, packet.length, &addr, &ipp_copy);
     loglogdata(net->log, "O=>", packet.data, packet.length, ip_port, res);
 
@@ -1003,55 +1289,35 @@ int sendpacket(const Networking_Core *net, const IP_Port *ip_port, const uint8_t
     return send_packet(net, ip_port, packet);
 }
 
-/** @brief Function to receive data
- * ip and port of sender is put into ip_port.
- * Packet data is put into data.
- * Packet length is put into length.
+/** @brief Convert the address of a received datagram to an IP_Port.
+ *
+ * @retval false if the address family is not supported.
  */
 non_null()
-static int receivepacket(const Network *ns, const Logger *log, Socket sock, IP_Port *ip_port, uint8_t *data, uint32_t *length)
+static bool ip_port_from_addr(const Network_Addr *addr, IP_Port *ip_port)
 {
     memset(ip_port, 0, sizeof(IP_Port));
-    Network_Addr addr = {{0}};
-    addr.size = sizeof(addr.addr);
-    *length = 0;
 
-    const int fail_or_len = net_recvfrom(ns, sock, data, MAX_UDP_PACKET_SIZE, &addr);
-
-    if (fail_or_len < 0) {
-        const int error = net_error();
-
-        if (!should_ignore_recv_error(error)) {
-            char *strerror = net_new_strerror(error);
-            LOGGER_ERROR(log, "unexpected error reading from socket: %u, %s", error, strerror);
-            net_kill_strerror(strerror);
-        }
-
-        return -1; /* Nothing received. */
-    }
-
-    *length = (uint32_t)fail_or_len;
-
-    if (addr.addr.ss_family == AF_INET) {
-        const struct sockaddr_in *addr_in = (const struct sockaddr_in *)&addr.addr;
+    if (addr->addr.ss_family == AF_INET) {
+        const struct sockaddr_in *addr_in = (const struct sockaddr_in *)&addr->addr;
 
         const Family *const family = make_tox_family(addr_in->sin_family);
         assert(family != nullptr);
 
         if (family == nullptr) {
-            return -1;
+            return false;
         }
 
         ip_port->ip.family = *family;
         get_ip4(&ip_port->ip.ip.v4, &addr_in->sin_addr);
         ip_port->port = addr_in->sin_port;
-    } else if (addr.addr.ss_family == AF_INET6) {
-        const struct sockaddr_in6 *addr_in6 = (const struct sockaddr_in6 *)&addr.addr;
+    } else if (addr->addr.ss_family == AF_INET6) {
+        const struct sockaddr_in6 *addr_in6 = (const struct sockaddr_in6 *)&addr->addr;
         const Family *const family = make_tox_family(addr_in6->sin6_family);
         assert(family != nullptr);
 
         if (family == nullptr) {
-            return -1;
+            return false;
         }
 
         ip_port->ip.family = *family;
@@ -1063,12 +1329,43 @@ static int receivepacket(const Network *ns, const Logger *log, Socket sock, IP_P
             ip_port->ip.ip.v4.uint32 = ip_port->ip.ip.v6.uint32[3];
         }
     } else {
-        return -1;
+        return false;
+    }
+
+    return true;
+}
+
+/** @brief Receive up to NET_BATCH_SIZE datagrams into the receive batch.
+ *
+ * @return the number of datagrams received.
+ * @retval -1 if nothing was received.
+ */
+non_null()
+static int receive_packets(const Networking_Core *net)
+{
+    Net_Batch *const batch = net->recv_batch;
+
+    for (uint32_t i = 0; i < NET_BATCH_SIZE; ++i) {
+        memset(&batch->addrs[i], 0, sizeof(Network_Addr));
+        batch->addrs[i].size = sizeof(batch->addrs[i].addr);
+        batch->msgs[i].len = MAX_UDP_PACKET_SIZE;
     }
 
-    loglogdata(log, "=>O", data, MAX_UDP_PACKET_SIZE, ip_port, *length);
+    const int count = net_recvmmsg(net->ns, net->sock, batch->msgs, NET_BATCH_SIZE);
 
-    return 0;
+    if (count < 0) {
+        const int error = net_error();
+
+        if (!should_ignore_recv_error(error)) {
+            char *strerror = net_new_strerror(error);
+            LOGGER_ERROR(net->log, "unexpected error reading from socket: %u, %s", error, strerror);
+            net_kill_strerror(strerror);
+        }
+
+        return -1; /* Nothing received. */
+    }
+
+    return count;
 }
 
 void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handler_cb *cb, void *object)
@@ -1084,26 +1381,54 @@ void networking_poll(const Networking_Core *net, void *userdata)
         return;
     }
 
-    IP_Port ip_port;
-    uint8_t data[MAX_UDP_PACKET_SIZE] = {0};
-    uint32_t length;
+    const Net_Batch *const batch = net->recv_batch;
+    int count;
 
-    while (receivepacket(net->ns, net->log, net->sock, &ip_port, data, &length) != -1) {
-        if (length < 1) {
-            continue;
-        }
+    while ((count = receive_packets(net)) != -1) {
+        for (int i = 0; i < count; ++i) {
+            const uint8_t *const data = batch->data[i];
+            const uint32_t length = (uint32_t)batch->msgs[i].len;
+            IP_Port ip_port;
 
-        const Packet_Handler *const handler = &net->packethandlers[data[0]];
+            if (!ip_port_from_addr(&batch->addrs[i], &ip_port)) {
+                continue;
+            }
 
-        if (handler->function == nullptr) {
-            // TODO(https://github.com/TokTok/c-toxcore/issues/1115): Make this
-            // a warning or error again.
-            LOGGER_DEBUG(net->log, "[%02u] -- Packet has no handler", data[0]);
-            continue;
+            loglogdata(net->log, "=>O", data, MAX_UDP_PACKET_SIZE, &ip_port, length);
+
+            if (length < 1) {
+                continue;
+            }
+
+            const Packet_Handler *const handler = &net->packethandlers[data[0]];
+
+            if (handler->function == nullptr) {
+                // TODO(https://github.com/TokTok/c-toxcore/issues/1115): Make this
+                // a warning or error again.
+                LOGGER_DEBUG(net->log, "[%02u] -- Packet has no handler", data[0]);
+                continue;
+            }
+
+            handler->function(handler->object, &ip_port, data, length, userdata);
         }
+    }
+}
+
+/** @brief Allocate a batch with each datagram pointing at its own buffer and address. */
+static Net_Batch *net_batch_new(void)
+{
+    Net_Batch *batch = (Net_Batch *)calloc(1, sizeof(Net_Batch));
+
+    if (batch == nullptr) {
+        return nullptr;
+    }
 
-        handler->function(handler->object, &ip_port, data, length, userdata);
+    for (uint32_t i = 0; i < NET_BATCH_SIZE; ++i) {
+        batch->msgs[i].buf = batch->data[i];
+        batch->msgs[i].addr = &batch->addrs[i];
     }
+
+    return batch;
 }
 
 /** @brief Initialize networking.
@@ -1177,6 +1502,14 @@ Networking_Core *new_networking_ex(
         return nullptr;
     }
 
+    temp->recv_batch = net_batch_new();
+    temp->send_batch = net_batch_new();
+
+    if (temp->recv_batch == nullptr || temp->send_batch == nullptr) {
+        kill_networking(temp);
+        return nullptr;
+    }
+
     /* Functions to increase the size of the send and receive UDP buffers.
      */
     int n = 1024 * 1024 * 2;
@@ -1248,7 +1581,7 @@ Networking_Core *new_networking_ex(
 
         portptr = &addr6->sin6_port;
     } else {
-        free(temp);
+        kill_networking(temp);
         return nullptr;
     }
 
@@ -1379,6 +1712,8 @@ void kill_networking(Networking_Core *net)
         kill_sock(net->ns, net->sock);
     }
 
+    free(net->send_batch);
+    free(net->recv_batch);
     free(net);
 }
 
@@ -2031,7 +2366,7 @@ char *net_new_strerror(int error)
     return str;
 }
 #else
-#ifdef _GNU_SOURCE
+#if defined(_GNU_SOURCE) && defined(__GLIBC__)
 non_null()
 static const char *net_strerror_r(int error, char *tmp, size_t tmp_size)
 {
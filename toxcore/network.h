@@ -40,10 +40,45 @@ typedef int net_setsockopt_cb(void *obj, int sock, int level, int optname, const
 typedef int net_getaddrinfo_cb(void *obj, int family, Network_Addr **addrs);
 typedef int net_freeaddrinfo_cb(void *obj, Network_Addr *addrs);
 
+/** @brief One datagram in a batched receive or send.
+ *
+ * When receiving, `len` is the size of `buf` on input and the length of the
+ * received datagram on output, and `addr` is set to the sender's address.
+ */
+typedef struct Net_Datagram {
+    uint8_t *buf;
+    size_t len;
+    Network_Addr *addr;
+} Net_Datagram;
+
+/** @brief Receive or send up to `count` datagrams in one call.
+ *
+ * @return the number of datagrams received or sent, which may be less than
+ *   `count`, or -1 on error (including when nothing could be received).
+ */
+typedef int net_recvmmsg_cb(void *obj, int sock, Net_Datagram *msgs, uint32_t count);
+typedef int net_sendmmsg_cb(void *obj, int sock, const Net_Datagram *msgs, uint32_t count);
+
+/** @brief A contiguous span of bytes to be written to a stream socket. */
+typedef struct Net_Span {
+    const uint8_t *buf;
+    size_t len;
+} Net_Span;
+
+/** @brief Send the concatenation of `count` spans on a stream socket in one call.
+ *
+ * @return the number of bytes sent, which may be less than the total length
+ *   of all spans, or -1 on error.
+ */
+typedef int net_sendv_cb(void *obj, int sock, const Net_Span *spans, uint32_t count);
+
 /** @brief Functions wrapping POSIX network functions.
  *
  * Refer to POSIX man pages for documentation of what these functions are
  * expected to do when providing alternative Network implementations.
+ *
+ * `recvmmsg` and `sendmmsg` are optional. If they are NULL, batches are
+ * received and sent one datagram at a time using `recvfrom` and `sendto`.
  */
 typedef struct Network_Funcs {
     net_close_cb *close;
@@ -61,6 +96,9 @@ typedef struct Network_Funcs {
     net_setsockopt_cb *setsockopt;
     net_getaddrinfo_cb *getaddrinfo;
     net_freeaddrinfo_cb *freeaddrinfo;
+    net_recvmmsg_cb *recvmmsg;
+    net_sendmmsg_cb *sendmmsg;
+    net_sendv_cb *sendv;
 } Network_Funcs;
 
 typedef struct Network {
@@ -283,6 +321,15 @@ extern const Socket net_invalid_socket;
  */
 non_null()
 int net_send(const Network *ns, const Logger *log, Socket sock, const uint8_t *buf, size_t len, const IP_Port *ip_port);
+/**
+ * Calls sendmsg(sockfd, msg, MSG_NOSIGNAL) with one iovec per span, or falls
+ * back to one send per span if the Network has no vectored send.
+ *
+ * @return the number of bytes sent, or -1 if nothing could be sent.
+ */
+non_null()
+int net_sendv(const Network *ns, const Logger *log, Socket sock, const Net_Span *spans, uint32_t count,
+              const IP_Port *ip_port);
 /**
  * Calls recv(sockfd, buf, len, MSG_NOSIGNAL).
  */
@@ -456,6 +503,8 @@ non_null()
 Family net_family(const Networking_Core *net);
 non_null()
 uint16_t net_port(const Networking_Core *net);
+non_null()
+Socket net_socket_of(const Networking_Core *net);
 
 /** Close the socket. */
 non_null()
@@ -485,6 +534,16 @@ bool set_socket_nosigpipe(const Network *ns, Socket sock);
 non_null()
 bool set_socket_reuseaddr(const Network *ns, Socket sock);
 
+/**
+ * Enable SO_REUSEPORT on socket, so that several sockets can listen on the
+ * same port and share its incoming connections.
+ *
+ * @return true on success, false on failure or if the platform does not
+ *   support it.
+ */
+non_null()
+bool set_socket_reuseport(const Network *ns, Socket sock);
+
 /**
  * Set socket to dual (IPv4 + IPv6 socket)
  *
@@ -519,6 +578,19 @@ int send_packet(const Networking_Core *net, const IP_Port *ip_port, Packet packe
 non_null()
 int sendpacket(const Networking_Core *net, const IP_Port *ip_port, const uint8_t *data, uint16_t length);
 
+/** @brief Start queueing packets sent on this socket.
+ *
+ * Until `networking_send_batch_flush` is called, `send_packet` copies packets
+ * into a batch and reports them as sent. The batch is sent with as few
+ * syscalls as the platform allows whenever it fills up or is flushed.
+ */
+non_null()
+void networking_send_batch_begin(Networking_Core *net);
+
+/** @brief Send all queued packets and stop queueing. */
+non_null()
+void networking_send_batch_flush(Networking_Core *net);
+
 /** Function to call when packet beginning with byte is received. */
 non_null(1) nullable(3, 4)
 void networking_registerhandler(Networking_Core *net, uint8_t byte, packet_handler_cb *cb, void *object);
@@ -2,6 +2,11 @@
 
 #include <gtest/gtest.h>
 
+#include <cstring>
+#include <vector>
+
+#include "logger.h"
+
 namespace {
 
 TEST(IpNtoa, DoesntWriteOutOfBounds)
@@ -73,4 +78,128 @@ TEST(IpParseAddr, FormatsIPv6)
     EXPECT_EQ(std::string(ip_str), "ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff");
 }
 
+/** Receives on one loopback socket what another loopback socket sends. */
+class LoopbackPair {
+public:
+    explicit LoopbackPair(const Network *ns)
+        : log_(logger_new())
+    {
+        IP ip;
+        ip_init(&ip, false);
+        ip.ip.v4 = get_ip4_loopback();
+
+        sender_ = new_networking_ex(log_, ns, &ip, 33445, 34445, nullptr);
+        receiver_ = new_networking_ex(log_, ns, &ip, 33445, 34445, nullptr);
+
+        dest_.ip = ip;
+        dest_.port = receiver_ != nullptr ? net_port(receiver_) : 0;
+
+        if (receiver_ != nullptr) {
+            networking_registerhandler(receiver_, kPacketId, &LoopbackPair::handle_packet, this);
+        }
+    }
+
+    ~LoopbackPair()
+    {
+        kill_networking(receiver_);
+        kill_networking(sender_);
+        logger_kill(log_);
+    }
+
+    bool ok() const { return sender_ != nullptr && receiver_ != nullptr; }
+    Networking_Core *sender() { return sender_; }
+    const IP_Port &dest() const { return dest_; }
+    const std::vector<std::vector<uint8_t>> &received() const { return received_; }
+
+    void poll() { networking_poll(receiver_, nullptr); }
+    void clear() { received_.clear(); }
+
+    static constexpr uint8_t kPacketId = 0xf0;
+
+private:
+    static int handle_packet(
+        void *object, const IP_Port *ip_port, const uint8_t *data, uint16_t len, void *userdata)
+    {
+        LoopbackPair *self = static_cast<LoopbackPair *>(object);
+        self->received_.emplace_back(data, data + len);
+        return 0;
+    }
+
+    Logger *log_;
+    Networking_Core *sender_ = nullptr;
+    Networking_Core *receiver_ = nullptr;
+    IP_Port dest_{};
+    std::vector<std::vector<uint8_t>> received_;
+};
+
+/** The system network with batched syscalls disabled. */
+class PerDatagramNetwork {
+public:
+    PerDatagramNetwork()
+        : funcs_(*system_network()->funcs)
+    {
+        funcs_.recvmmsg = nullptr;
+        funcs_.sendmmsg = nullptr;
+        funcs_.sendv = nullptr;
+        ns_.funcs = &funcs_;
+        ns_.obj = system_network()->obj;
+    }
+
+    const Network *get() const { return &ns_; }
+
+private:
+    Network_Funcs funcs_;
+    Network ns_;
+};
+
+void send_numbered(LoopbackPair &pair, uint32_t first, uint32_t count, uint16_t length)
+{
+    std::vector<uint8_t> packet(length);
+    packet[0] = LoopbackPair::kPacketId;
+
+    for (uint32_t i = first; i < first + count; ++i) {
+        std::memcpy(&packet[1], &i, sizeof(i));
+        ASSERT_EQ(sendpacket(pair.sender(), &pair.dest(), packet.data(), length), length);
+    }
+}
+
+void check_batched_send_in_order(const Network *ns)
+{
+    LoopbackPair pair(ns);
+    ASSERT_TRUE(pair.ok());
+
+    // More than one batch worth, so the batch is flushed while queueing.
+    constexpr uint32_t kCount = 40;
+    networking_send_batch_begin(pair.sender());
+    send_numbered(pair, 0, kCount, 100);
+    networking_send_batch_flush(pair.sender());
+
+    // After the flush, sends go straight out again.
+    send_numbered(pair, kCount, 1, 100);
+
+    for (int i = 0; i < 100 && pair.received().size() < kCount + 1; ++i) {
+        pair.poll();
+    }
+
+    ASSERT_EQ(pair.received().size(), kCount + 1);
+
+    for (uint32_t i = 0; i <= kCount; ++i) {
+        uint32_t num;
+        std::memcpy(&num, &pair.received()[i][1], sizeof(num));
+        EXPECT_EQ(num, i);
+        EXPECT_EQ(pair.received()[i].size(), 100);
+    }
+}
+
+TEST(NetworkingBatch, SendsBatchedPacketsInOrder)
+{
+    check_batched_send_in_order(system_network());
+}
+
+TEST(NetworkingBatch, SendsBatchedPacketsInOrderWithoutMmsg)
+{
+    PerDatagramNetwork ns;
+    check_batched_send_in_order(ns.get());
+}
+
 }  // namespace
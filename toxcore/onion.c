@@ -29,7 +29,7 @@
 
 
 // Settings for the shared key cache
-#define MAX_KEYS_PER_SLOT 4
+#define MAX_CACHED_KEYS 4096
 #define KEYS_TIMEOUT 600
 
 /** Change symmetric keys every 2 hours to make paths expire eventually. */
@@ -689,9 +689,9 @@ Onion *new_onion(const Logger *log, const Mono_Time *mono_time, const Random *rn
     onion->timestamp = mono_time_get(onion->mono_time);
 
     const uint8_t *secret_key = dht_get_self_secret_key(dht);
-    onion->shared_keys_1 = shared_key_cache_new(mono_time, secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
-    onion->shared_keys_2 = shared_key_cache_new(mono_time, secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
-    onion->shared_keys_3 = shared_key_cache_new(mono_time, secret_key, KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    onion->shared_keys_1 = shared_key_cache_new(mono_time, rng, secret_key, KEYS_TIMEOUT, MAX_CACHED_KEYS);
+    onion->shared_keys_2 = shared_key_cache_new(mono_time, rng, secret_key, KEYS_TIMEOUT, MAX_CACHED_KEYS);
+    onion->shared_keys_3 = shared_key_cache_new(mono_time, rng, secret_key, KEYS_TIMEOUT, MAX_CACHED_KEYS);
 
     if (onion->shared_keys_1 == nullptr ||
         onion->shared_keys_2 == nullptr ||
@@ -15,6 +15,7 @@
 #include "DHT.h"
 #include "LAN_discovery.h"
 #include "ccompat.h"
+#include "list.h"
 #include "mono_time.h"
 #include "shared_key_cache.h"
 #include "util.h"
@@ -33,7 +34,7 @@
 #define ONION_MINIMAL_SIZE (ONION_PING_ID_SIZE + CRYPTO_PUBLIC_KEY_SIZE * 2 + ONION_ANNOUNCE_SENDBACK_DATA_LENGTH)
 
 /* Settings for the shared key cache */
-#define MAX_KEYS_PER_SLOT 4
+#define MAX_CACHED_KEYS 4096
 #define KEYS_TIMEOUT 600
 
 static_assert(ONION_PING_ID_SIZE == CRYPTO_PUBLIC_KEY_SIZE,
@@ -45,15 +46,32 @@ typedef struct Onion_Announce_Entry {
     uint8_t ret[ONION_RETURN_3];
     uint8_t data_public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint64_t announce_time;
+
+    /* Position in the distance heap. */
+    uint32_t heap_index;
+    /* Neighbours in the list of entries ordered by announce_time. */
+    uint32_t older;
+    uint32_t newer;
 } Onion_Announce_Entry;
 
+#define NO_ENTRY UINT32_MAX
+
 struct Onion_Announce {
     const Logger *log;
     const Mono_Time *mono_time;
     const Random *rng;
     DHT     *dht;
     Networking_Core *net;
-    Onion_Announce_Entry entries[ONION_ANNOUNCE_MAX_ENTRIES];
+    Onion_Announce_Entry *entries;
+    uint32_t num_entries;
+    uint32_t max_entries;
+    /* Slot of each public key in entries, including timed out ones. */
+    Hash_List keys;
+    /* Entries by distance to our key, the farthest one at the root. */
+    uint32_t *heap;
+    /* Ends of the announce_time list, so the first to time out is at hand. */
+    uint32_t oldest;
+    uint32_t newest;
     uint8_t hmac_key[CRYPTO_HMAC_KEY_SIZE];
 
     Shared_Key_Cache *shared_keys_recv;
@@ -71,16 +89,6 @@ void onion_announce_extra_data_callback(Onion_Announce *onion_a, uint16_t extra_
     onion_a->extra_data_object = extra_data_object;
 }
 
-uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry)
-{
-    return onion_a->entries[entry].public_key;
-}
-
-void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t announce_time)
-{
-    onion_a->entries[entry].announce_time = announce_time;
-}
-
 /** @brief Create an onion announce request packet in packet of max_packet_length.
  *
  * Recommended value for max_packet_length is ONION_ANNOUNCE_REQUEST_MIN_SIZE.
@@ -262,87 +270,127 @@ int send_data_request(const Networking_Core *net, const Random *rng, const Onion
 non_null()
 static int in_entries(const Onion_Announce *onion_a, const uint8_t *public_key)
 {
-    for (unsigned int i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-        if (!mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].announce_time, ONION_ANNOUNCE_TIMEOUT)
-                && pk_equal(onion_a->entries[i].public_key, public_key)) {
-            return i;
-        }
+    const int pos = hash_list_find(&onion_a->keys, public_key);
+
+    if (pos == -1
+            || mono_time_is_timeout(onion_a->mono_time, onion_a->entries[pos].announce_time, ONION_ANNOUNCE_TIMEOUT)) {
+        return -1;
     }
 
-    return -1;
+    return pos;
 }
 
-typedef struct Cmp_Data {
-    const Mono_Time *mono_time;
-    const uint8_t *base_public_key;
-    Onion_Announce_Entry entry;
-} Cmp_Data;
+/** Check whether entry `a` is farther from our key than entry `b`. */
+non_null()
+static bool entry_is_farther(const Onion_Announce *onion_a, uint32_t a, uint32_t b)
+{
+    return id_closest(dht_get_self_public_key(onion_a->dht), onion_a->entries[a].public_key,
+                      onion_a->entries[b].public_key) == 2;
+}
 
 non_null()
-static int cmp_entry(const void *a, const void *b)
+static void heap_set(Onion_Announce *onion_a, uint32_t heap_index, uint32_t entry)
 {
-    const Cmp_Data *cmp1 = (const Cmp_Data *)a;
-    const Cmp_Data *cmp2 = (const Cmp_Data *)b;
-    const Onion_Announce_Entry entry1 = cmp1->entry;
-    const Onion_Announce_Entry entry2 = cmp2->entry;
-    const uint8_t *cmp_public_key = cmp1->base_public_key;
+    onion_a->heap[heap_index] = entry;
+    onion_a->entries[entry].heap_index = heap_index;
+}
 
-    const bool t1 = mono_time_is_timeout(cmp1->mono_time, entry1.announce_time, ONION_ANNOUNCE_TIMEOUT);
-    const bool t2 = mono_time_is_timeout(cmp1->mono_time, entry2.announce_time, ONION_ANNOUNCE_TIMEOUT);
+/** @brief Restore the heap order after the key of the entry at heap_index changed. */
+non_null()
+static void heap_fix(Onion_Announce *onion_a, uint32_t heap_index)
+{
+    const uint32_t entry = onion_a->heap[heap_index];
 
-    if (t1 && t2) {
-        return 0;
-    }
+    while (heap_index > 0) {
+        const uint32_t parent = (heap_index - 1) / 2;
 
-    if (t1) {
-        return -1;
-    }
+        if (!entry_is_farther(onion_a, entry, onion_a->heap[parent])) {
+            break;
+        }
 
-    if (t2) {
-        return 1;
+        heap_set(onion_a, heap_index, onion_a->heap[parent]);
+        heap_index = parent;
     }
 
-    const int closest = id_closest(cmp_public_key, entry1.public_key, entry2.public_key);
+    while (true) {
+        const uint32_t left = heap_index * 2 + 1;
 
-    if (closest == 1) {
-        return 1;
-    }
+        if (left >= onion_a->num_entries) {
+            break;
+        }
 
-    if (closest == 2) {
-        return -1;
+        uint32_t child = left;
+
+        if (left + 1 < onion_a->num_entries && entry_is_farther(onion_a, onion_a->heap[left + 1], onion_a->heap[left])) {
+            child = left + 1;
+        }
+
+        if (!entry_is_farther(onion_a, onion_a->heap[child], entry)) {
+            break;
+        }
+
+        heap_set(onion_a, heap_index, onion_a->heap[child]);
+        heap_index = child;
     }
 
-    return 0;
+    heap_set(onion_a, heap_index, entry);
 }
 
 non_null()
-static void sort_onion_announce_list(Onion_Announce_Entry *list, unsigned int length, const Mono_Time *mono_time,
-                                     const uint8_t *comp_public_key)
+static void time_list_unlink(Onion_Announce *onion_a, uint32_t entry)
 {
-    // Pass comp_public_key to qsort with each Client_data entry, so the
-    // comparison function can use it as the base of comparison.
-    Cmp_Data *cmp_list = (Cmp_Data *)calloc(length, sizeof(Cmp_Data));
+    Onion_Announce_Entry *const e = &onion_a->entries[entry];
 
-    if (cmp_list == nullptr) {
-        return;
+    if (e->older != NO_ENTRY) {
+        onion_a->entries[e->older].newer = e->newer;
+    } else {
+        onion_a->oldest = e->newer;
     }
 
-    for (uint32_t i = 0; i < length; ++i) {
-        cmp_list[i].mono_time = mono_time;
-        cmp_list[i].base_public_key = comp_public_key;
-        cmp_list[i].entry = list[i];
+    if (e->newer != NO_ENTRY) {
+        onion_a->entries[e->newer].older = e->older;
+    } else {
+        onion_a->newest = e->older;
     }
+}
+
+non_null()
+static void time_list_append(Onion_Announce *onion_a, uint32_t entry)
+{
+    Onion_Announce_Entry *const e = &onion_a->entries[entry];
+    e->older = onion_a->newest;
+    e->newer = NO_ENTRY;
 
-    qsort(cmp_list, length, sizeof(Cmp_Data), cmp_entry);
+    if (onion_a->newest != NO_ENTRY) {
+        onion_a->entries[onion_a->newest].newer = entry;
+    } else {
+        onion_a->oldest = entry;
+    }
+
+    onion_a->newest = entry;
+}
+
+/** @brief Give a used slot to a new public key. */
+non_null()
+static void rekey_entry(Onion_Announce *onion_a, uint32_t pos, const uint8_t *public_key)
+{
+    time_list_unlink(onion_a, pos);
+    hash_list_remove(&onion_a->keys, onion_a->entries[pos].public_key, pos);
 
-    for (uint32_t i = 0; i < length; ++i) {
-        list[i] = cmp_list[i].entry;
+    // The table has room for max_entries keys without growing, so this can't fail.
+    if (!hash_list_add(&onion_a->keys, public_key, pos)) {
+        LOGGER_FATAL(onion_a->log, "failed to index announce entry %u", pos);
     }
 
-    free(cmp_list);
+    memcpy(onion_a->entries[pos].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
 }
 
 /** @brief add entry to entries list
+ *
+ * Once the list is full, a new entry replaces the one that timed out first,
+ * or failing that the one farthest from us if the new one is closer. Both
+ * are found in constant time, and the replaced entry is moved to its place
+ * in the heap in O(log n).
  *
  * return -1 if failure
  * return position if added
@@ -351,35 +399,129 @@ non_null()
 static int add_to_entries(Onion_Announce *onion_a, const IP_Port *ret_ip_port, const uint8_t *public_key,
                           const uint8_t *data_public_key, const uint8_t *ret)
 {
-    int pos = in_entries(onion_a, public_key);
+    // A timed out entry for the same key is refreshed in place.
+    int pos = hash_list_find(&onion_a->keys, public_key);
 
-    if (pos == -1) {
-        for (unsigned i = 0; i < ONION_ANNOUNCE_MAX_ENTRIES; ++i) {
-            if (mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].announce_time, ONION_ANNOUNCE_TIMEOUT)) {
-                pos = i;
-            }
+    if (pos != -1) {
+        time_list_unlink(onion_a, pos);
+    } else if (onion_a->num_entries < onion_a->max_entries) {
+        pos = onion_a->num_entries;
+
+        if (!hash_list_add(&onion_a->keys, public_key, pos)) {
+            return -1;
         }
+
+        heap_set(onion_a, onion_a->num_entries, pos);
+        ++onion_a->num_entries;
+    } else if (mono_time_is_timeout(onion_a->mono_time, onion_a->entries[onion_a->oldest].announce_time,
+                                    ONION_ANNOUNCE_TIMEOUT)) {
+        pos = onion_a->oldest;
+        rekey_entry(onion_a, pos, public_key);
+    } else if (id_closest(dht_get_self_public_key(onion_a->dht), public_key,
+                          onion_a->entries[onion_a->heap[0]].public_key) == 1) {
+        pos = onion_a->heap[0];
+        rekey_entry(onion_a, pos, public_key);
+    } else {
+        return -1;
     }
 
-    if (pos == -1) {
-        if (id_closest(dht_get_self_public_key(onion_a->dht), public_key, onion_a->entries[0].public_key) == 1) {
-            pos = 0;
+    Onion_Announce_Entry *const entry = &onion_a->entries[pos];
+    memcpy(entry->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    entry->ret_ip_port = *ret_ip_port;
+    memcpy(entry->ret, ret, ONION_RETURN_3);
+    memcpy(entry->data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    entry->announce_time = mono_time_get(onion_a->mono_time);
+
+    time_list_append(onion_a, pos);
+    heap_fix(onion_a, entry->heap_index);
+    return pos;
+}
+
+bool onion_announce_set_max_entries(Onion_Announce *onion_a, uint32_t max_entries)
+{
+    if (max_entries == 0 || max_entries > ONION_ANNOUNCE_ENTRIES_LIMIT || max_entries < onion_a->num_entries) {
+        return false;
+    }
+
+    // Build everything for the new maximum before touching the current tables,
+    // so a failure leaves them all sized for the old one.
+    Onion_Announce_Entry *entries = (Onion_Announce_Entry *)calloc(max_entries, sizeof(Onion_Announce_Entry));
+    uint32_t *heap = (uint32_t *)calloc(max_entries, sizeof(uint32_t));
+
+    if (entries == nullptr || heap == nullptr) {
+        free(heap);
+        free(entries);
+        return false;
+    }
+
+    // Size the index for the new maximum, so adding a key never needs memory.
+    Hash_List keys;
+
+    if (hash_list_init(&keys, CRYPTO_PUBLIC_KEY_SIZE, max_entries, random_u64(onion_a->rng)) == 0) {
+        free(heap);
+        free(entries);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < onion_a->num_entries; ++i) {
+        if (!hash_list_add(&keys, onion_a->entries[i].public_key, i)) {
+            hash_list_free(&keys);
+            free(heap);
+            free(entries);
+            return false;
         }
     }
 
+    if (onion_a->num_entries > 0) {
+        memcpy(entries, onion_a->entries, onion_a->num_entries * sizeof(Onion_Announce_Entry));
+        memcpy(heap, onion_a->heap, onion_a->num_entries * sizeof(uint32_t));
+    }
+
+    free(onion_a->entries);
+    free(onion_a->heap);
+    hash_list_free(&onion_a->keys);
+    onion_a->entries = entries;
+    onion_a->heap = heap;
+    onion_a->keys = keys;
+    onion_a->max_entries = max_entries;
+    return true;
+}
+
+uint32_t onion_announce_max_entries(const Onion_Announce *onion_a)
+{
+    return onion_a->max_entries;
+}
+
+void onion_announce_get_shared_key_stats(const Onion_Announce *onion_a, Shared_Key_Cache_Stats *stats)
+{
+    shared_key_cache_get_stats(onion_a->shared_keys_recv, stats);
+}
+
+bool onion_announce_entry_add(Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    const IP_Port ip_port = {{{0}}};
+    const uint8_t ret[ONION_RETURN_3] = {0};
+    return add_to_entries(onion_a, &ip_port, public_key, public_key, ret) != -1;
+}
+
+uint32_t onion_announce_entry_rank(const Onion_Announce *onion_a, const uint8_t *public_key)
+{
+    const int pos = in_entries(onion_a, public_key);
+
     if (pos == -1) {
-        return -1;
+        return UINT32_MAX;
     }
 
-    memcpy(onion_a->entries[pos].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].ret_ip_port = *ret_ip_port;
-    memcpy(onion_a->entries[pos].ret, ret, ONION_RETURN_3);
-    memcpy(onion_a->entries[pos].data_public_key, data_public_key, CRYPTO_PUBLIC_KEY_SIZE);
-    onion_a->entries[pos].announce_time = mono_time_get(onion_a->mono_time);
-
-    sort_onion_announce_list(onion_a->entries, ONION_ANNOUNCE_MAX_ENTRIES, onion_a->mono_time,
-                             dht_get_self_public_key(onion_a->dht));
-    return in_entries(onion_a, public_key);
+    uint32_t rank = 0;
+
+    for (uint32_t i = 0; i < onion_a->num_entries; ++i) {
+        if (!mono_time_is_timeout(onion_a->mono_time, onion_a->entries[i].announce_time, ONION_ANNOUNCE_TIMEOUT)
+                && entry_is_farther(onion_a, pos, i)) {
+            ++rank;
+        }
+    }
+
+    return rank;
 }
 
 non_null()
@@ -656,17 +798,24 @@ Onion_Announce *new_onion_announce(const Logger *log, const Random *rng, const M
     onion_a->mono_time = mono_time;
     onion_a->dht = dht;
     onion_a->net = dht_get_net(dht);
+    onion_a->oldest = NO_ENTRY;
+    onion_a->newest = NO_ENTRY;
     onion_a->extra_data_max_size = 0;
     onion_a->extra_data_callback = nullptr;
     onion_a->extra_data_object = nullptr;
     new_hmac_key(rng, onion_a->hmac_key);
 
-    onion_a->shared_keys_recv = shared_key_cache_new(mono_time, dht_get_self_secret_key(dht), KEYS_TIMEOUT, MAX_KEYS_PER_SLOT);
+    onion_a->shared_keys_recv = shared_key_cache_new(mono_time, rng, dht_get_self_secret_key(dht), KEYS_TIMEOUT, MAX_CACHED_KEYS);
     if (onion_a->shared_keys_recv == nullptr) {
         kill_onion_announce(onion_a);
         return nullptr;
     }
 
+    if (!onion_announce_set_max_entries(onion_a, ONION_ANNOUNCE_MAX_ENTRIES)) {
+        kill_onion_announce(onion_a);
+        return nullptr;
+    }
+
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST, &handle_announce_request, onion_a);
     networking_registerhandler(onion_a->net, NET_PACKET_ANNOUNCE_REQUEST_OLD, &handle_announce_request_old, onion_a);
     networking_registerhandler(onion_a->net, NET_PACKET_ONION_DATA_REQUEST, &handle_data_request, onion_a);
@@ -687,5 +836,8 @@ void kill_onion_announce(Onion_Announce *onion_a)
     crypto_memzero(onion_a->hmac_key, CRYPTO_HMAC_KEY_SIZE);
     shared_key_cache_free(onion_a->shared_keys_recv);
 
+    hash_list_free(&onion_a->keys);
+    free(onion_a->heap);
+    free(onion_a->entries);
     free(onion_a);
 }
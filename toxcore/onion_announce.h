@@ -13,7 +13,10 @@
 #include "onion.h"
 #include "timed_auth.h"
 
+/** Default number of announcements stored, see onion_announce_set_max_entries. */
 #define ONION_ANNOUNCE_MAX_ENTRIES 160
+/** Upper bound for onion_announce_set_max_entries. */
+#define ONION_ANNOUNCE_ENTRIES_LIMIT (1 << 22)
 #define ONION_ANNOUNCE_TIMEOUT 300
 #define ONION_PING_ID_SIZE TIMED_AUTH_SIZE
 #define ONION_MAX_EXTRA_DATA_SIZE 136
@@ -38,10 +41,32 @@
 typedef struct Onion_Announce Onion_Announce;
 
 /** These two are not public; they are for tests only! */
+
+/** @brief Store an announcement of public_key as if it came in an announce request. */
+non_null()
+bool onion_announce_entry_add(Onion_Announce *onion_a, const uint8_t *public_key);
+/** @brief Number of stored entries closer to us than public_key, UINT32_MAX if it is not stored. */
+non_null()
+uint32_t onion_announce_entry_rank(const Onion_Announce *onion_a, const uint8_t *public_key);
+
+/** @brief Set how many announcements are stored.
+ *
+ * Nodes with spare memory, like dedicated bootstrap nodes, can store more
+ * than the default ONION_ANNOUNCE_MAX_ENTRIES, so that more peers can
+ * announce themselves on them. Lookups take constant time regardless.
+ *
+ * @retval false if max_entries is 0, above ONION_ANNOUNCE_ENTRIES_LIMIT or
+ *   below the number of entries stored already, or on allocation failure.
+ */
 non_null()
-uint8_t *onion_announce_entry_public_key(Onion_Announce *onion_a, uint32_t entry);
+bool onion_announce_set_max_entries(Onion_Announce *onion_a, uint32_t max_entries);
+
+non_null()
+uint32_t onion_announce_max_entries(const Onion_Announce *onion_a);
+
+/** @brief Copy the counters of the shared key cache for announce and data requests. */
 non_null()
-void onion_announce_entry_set_time(Onion_Announce *onion_a, uint32_t entry, uint64_t announce_time);
+void onion_announce_get_shared_key_stats(const Onion_Announce *onion_a, Shared_Key_Cache_Stats *stats);
 
 /** @brief Create an onion announce request packet in packet of max_packet_length.
  *
@@ -0,0 +1,299 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Computes shared keys on worker threads.
+ */
+#include "precompute_pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef ESP_PLATFORM
+#define PRECOMPUTE_POOL_USE_THREADS
+#include <pthread.h>
+#endif
+
+#include "ccompat.h"
+
+typedef struct Precompute_Job {
+    uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
+    uint8_t secret_key[CRYPTO_SECRET_KEY_SIZE];
+    uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
+    bool ok;
+
+    precompute_done_cb *callback;
+    void *object;
+    uint16_t length;
+    uint8_t data[PRECOMPUTE_JOB_DATA_SIZE];
+} Precompute_Job;
+
+/** A FIFO of job numbers with room for every job of the pool. */
+typedef struct Job_Ring {
+    uint32_t *jobs;
+    uint32_t head;
+    uint32_t count;
+} Job_Ring;
+
+struct Precompute_Pool {
+    const Logger *log;
+
+    Precompute_Job *jobs;
+    uint32_t max_jobs;
+
+    /* Jobs not in flight. Only touched by the owning thread. */
+    uint32_t *free_jobs;
+    uint32_t num_free;
+
+    /* Jobs taken out of `done` by precompute_pool_do. */
+    uint32_t *batch;
+
+    uint64_t completed;
+    uint64_t rejected;
+
+#ifdef PRECOMPUTE_POOL_USE_THREADS
+    /* Protects `todo`, `done` and `stop`. */
+    pthread_mutex_t lock;
+    /* Signalled when a job is queued in `todo` or the workers should stop. */
+    pthread_cond_t work;
+    bool lock_initialized;
+    bool work_initialized;
+
+    pthread_t *threads;
+    uint16_t num_threads;
+#endif
+
+    Job_Ring todo;
+    Job_Ring done;
+    bool stop;
+};
+
+non_null()
+static void job_ring_push(Job_Ring *ring, uint32_t max_jobs, uint32_t job)
+{
+    ring->jobs[(ring->head + ring->count) % max_jobs] = job;
+    ++ring->count;
+}
+
+non_null()
+static uint32_t job_ring_pop(Job_Ring *ring, uint32_t max_jobs)
+{
+    const uint32_t job = ring->jobs[ring->head];
+    ring->head = (ring->head + 1) % max_jobs;
+    --ring->count;
+    return job;
+}
+
+#ifdef PRECOMPUTE_POOL_USE_THREADS
+non_null()
+static void *precompute_thread(void *arg)
+{
+    Precompute_Pool *pool = (Precompute_Pool *)arg;
+
+    pthread_mutex_lock(&pool->lock);
+
+    while (true) {
+        while (pool->todo.count == 0 && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+
+        if (pool->stop) {
+            break;
+        }
+
+        const uint32_t job_num = job_ring_pop(&pool->todo, pool->max_jobs);
+        pthread_mutex_unlock(&pool->lock);
+
+        Precompute_Job *job = &pool->jobs[job_num];
+        job->ok = encrypt_precompute(job->public_key, job->secret_key, job->shared_key) == 0;
+        crypto_memzero(job->secret_key, sizeof(job->secret_key));
+
+        pthread_mutex_lock(&pool->lock);
+        job_ring_push(&pool->done, pool->max_jobs, job_num);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+    return nullptr;
+}
+#endif
+
+void precompute_pool_free(Precompute_Pool *pool)
+{
+    if (pool == nullptr) {
+        return;
+    }
+
+#ifdef PRECOMPUTE_POOL_USE_THREADS
+
+    if (pool->num_threads > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pool->stop = true;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->lock);
+
+        for (uint16_t i = 0; i < pool->num_threads; ++i) {
+            pthread_join(pool->threads[i], nullptr);
+        }
+    }
+
+    if (pool->work_initialized) {
+        pthread_cond_destroy(&pool->work);
+    }
+
+    if (pool->lock_initialized) {
+        pthread_mutex_destroy(&pool->lock);
+    }
+
+    free(pool->threads);
+#endif
+
+    if (pool->jobs != nullptr) {
+        // Don't leave key material in memory
+        crypto_memzero(pool->jobs, pool->max_jobs * sizeof(Precompute_Job));
+    }
+
+    free(pool->done.jobs);
+    free(pool->todo.jobs);
+    free(pool->batch);
+    free(pool->free_jobs);
+    free(pool->jobs);
+    free(pool);
+}
+
+Precompute_Pool *precompute_pool_new(const Logger *log, uint16_t num_threads, uint32_t max_jobs)
+{
+#ifdef PRECOMPUTE_POOL_USE_THREADS
+
+    if (num_threads == 0 || num_threads > PRECOMPUTE_POOL_MAX_THREADS || max_jobs == 0) {
+        return nullptr;
+    }
+
+    Precompute_Pool *pool = (Precompute_Pool *)calloc(1, sizeof(Precompute_Pool));
+
+    if (pool == nullptr) {
+        return nullptr;
+    }
+
+    pool->log = log;
+    pool->max_jobs = max_jobs;
+    pool->jobs = (Precompute_Job *)calloc(max_jobs, sizeof(Precompute_Job));
+    pool->free_jobs = (uint32_t *)calloc(max_jobs, sizeof(uint32_t));
+    pool->batch = (uint32_t *)calloc(max_jobs, sizeof(uint32_t));
+    pool->todo.jobs = (uint32_t *)calloc(max_jobs, sizeof(uint32_t));
+    pool->done.jobs = (uint32_t *)calloc(max_jobs, sizeof(uint32_t));
+    pool->threads = (pthread_t *)calloc(num_threads, sizeof(pthread_t));
+
+    if (pool->jobs == nullptr || pool->free_jobs == nullptr || pool->batch == nullptr
+            || pool->todo.jobs == nullptr || pool->done.jobs == nullptr || pool->threads == nullptr) {
+        precompute_pool_free(pool);
+        return nullptr;
+    }
+
+    // Hand out the lowest job numbers first.
+    for (uint32_t i = 0; i < max_jobs; ++i) {
+        pool->free_jobs[i] = max_jobs - 1 - i;
+    }
+
+    pool->num_free = max_jobs;
+
+    pool->lock_initialized = pthread_mutex_init(&pool->lock, nullptr) == 0;
+    pool->work_initialized = pthread_cond_init(&pool->work, nullptr) == 0;
+
+    if (!pool->lock_initialized || !pool->work_initialized) {
+        precompute_pool_free(pool);
+        return nullptr;
+    }
+
+    for (uint16_t i = 0; i < num_threads; ++i) {
+        if (pthread_create(&pool->threads[i], nullptr, precompute_thread, pool) != 0) {
+            LOGGER_ERROR(log, "precompute pool thread %u creation failed", i);
+            precompute_pool_free(pool);
+            return nullptr;
+        }
+
+        ++pool->num_threads;
+    }
+
+    return pool;
+#else
+    LOGGER_ERROR(log, "precompute pools need threads, which this platform does not have");
+    return nullptr;
+#endif
+}
+
+bool precompute_pool_add(Precompute_Pool *pool, const uint8_t *public_key, const uint8_t *secret_key,
+                         precompute_done_cb *callback, void *object, const uint8_t *data, uint16_t length)
+{
+    if (length > PRECOMPUTE_JOB_DATA_SIZE || (length > 0 && data == nullptr)) {
+        return false;
+    }
+
+    if (pool->num_free == 0) {
+        ++pool->rejected;
+        return false;
+    }
+
+    const uint32_t job_num = pool->free_jobs[--pool->num_free];
+    Precompute_Job *job = &pool->jobs[job_num];
+    memcpy(job->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    memcpy(job->secret_key, secret_key, CRYPTO_SECRET_KEY_SIZE);
+    job->callback = callback;
+    job->object = object;
+    job->length = length;
+
+    if (length > 0) {
+        memcpy(job->data, data, length);
+    }
+
+#ifdef PRECOMPUTE_POOL_USE_THREADS
+    pthread_mutex_lock(&pool->lock);
+    job_ring_push(&pool->todo, pool->max_jobs, job_num);
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+#endif
+
+    return true;
+}
+
+uint32_t precompute_pool_do(Precompute_Pool *pool, void *userdata)
+{
+    uint32_t num = 0;
+
+#ifdef PRECOMPUTE_POOL_USE_THREADS
+    pthread_mutex_lock(&pool->lock);
+
+    while (pool->done.count > 0) {
+        pool->batch[num] = job_ring_pop(&pool->done, pool->max_jobs);
+        ++num;
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+#endif
+
+    for (uint32_t i = 0; i < num; ++i) {
+        const uint32_t job_num = pool->batch[i];
+        Precompute_Job *job = &pool->jobs[job_num];
+
+        job->callback(job->object, job->ok ? job->shared_key : nullptr, job->data, job->length, userdata);
+
+        crypto_memzero(job->shared_key, sizeof(job->shared_key));
+        pool->free_jobs[pool->num_free] = job_num;
+        ++pool->num_free;
+    }
+
+    pool->completed += num;
+    return num;
+}
+
+uint32_t precompute_pool_in_flight(const Precompute_Pool *pool)
+{
+    return pool->max_jobs - pool->num_free;
+}
+
+void precompute_pool_get_stats(const Precompute_Pool *pool, Precompute_Pool_Stats *stats)
+{
+    stats->in_flight = precompute_pool_in_flight(pool);
+    stats->completed = pool->completed;
+    stats->rejected = pool->rejected;
+}
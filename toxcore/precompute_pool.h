@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Computes shared keys on worker threads.
+ *
+ * A shared key takes one curve25519 scalar multiplication, which is slow
+ * enough that a burst of them stalls everything else on the thread that does
+ * them. Jobs added to the pool are computed by its workers and handed back to
+ * the thread that owns the pool by precompute_pool_do, which runs the
+ * completion callback of every finished job. Only the owning thread may call
+ * any of these functions.
+ *
+ * The number of jobs in flight is bounded. Once the pool is full,
+ * precompute_pool_add fails and the caller should drop the work; peers resend
+ * handshakes that go unanswered anyway.
+ */
+#ifndef C_TOXCORE_TOXCORE_PRECOMPUTE_POOL_H
+#define C_TOXCORE_TOXCORE_PRECOMPUTE_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attributes.h"
+#include "crypto_core.h"
+#include "logger.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of worker threads of a pool. */
+#define PRECOMPUTE_POOL_MAX_THREADS 64
+
+/** Maximum length of the data a job carries to its completion callback.
+ *
+ * Enough for a DHT crypto request of MAX_CRYPTO_REQUEST_SIZE and its source address.
+ */
+#define PRECOMPUTE_JOB_DATA_SIZE 1088
+
+typedef struct Precompute_Pool Precompute_Pool;
+
+/** @brief Called by precompute_pool_do for each finished job.
+ *
+ * @param shared_key the computed key, or nullptr if the public key was invalid.
+ * @param data the data given to precompute_pool_add.
+ */
+typedef void precompute_done_cb(void *object, const uint8_t *shared_key, const uint8_t *data, uint16_t length,
+                                void *userdata);
+
+/** Counters of a pool, for monitoring whether it keeps up. */
+typedef struct Precompute_Pool_Stats {
+    uint32_t in_flight;     /* jobs added but not yet handed back */
+    uint64_t completed;     /* jobs handed back by precompute_pool_do */
+    uint64_t rejected;      /* jobs refused because the pool was full */
+} Precompute_Pool_Stats;
+
+/**
+ * @brief Create a pool and start its worker threads.
+ *
+ * @param num_threads number of workers, between 1 and PRECOMPUTE_POOL_MAX_THREADS.
+ * @param max_jobs maximum number of jobs in flight.
+ *
+ * @return nullptr on failure, or if the platform has no threads.
+ */
+non_null()
+Precompute_Pool *precompute_pool_new(const Logger *log, uint16_t num_threads, uint32_t max_jobs);
+
+/** @brief Stop the workers and free the pool. Jobs in flight are dropped without calling back. */
+nullable(1)
+void precompute_pool_free(Precompute_Pool *pool);
+
+/**
+ * @brief Queue the computation of the shared key of public_key and secret_key.
+ *
+ * Both keys and `data` are copied, so they need not outlive the call.
+ *
+ * @retval true if the job was queued.
+ * @retval false if the pool is full or `length` exceeds PRECOMPUTE_JOB_DATA_SIZE.
+ */
+non_null(1, 2, 3, 4) nullable(5, 6)
+bool precompute_pool_add(Precompute_Pool *pool, const uint8_t *public_key, const uint8_t *secret_key,
+                         precompute_done_cb *callback, void *object, const uint8_t *data, uint16_t length);
+
+/**
+ * @brief Run the completion callbacks of all jobs the workers have finished.
+ *
+ * The callbacks may add new jobs.
+ *
+ * @return the number of callbacks run.
+ */
+non_null(1) nullable(2)
+uint32_t precompute_pool_do(Precompute_Pool *pool, void *userdata);
+
+/** @brief Number of jobs added but not yet handed back by precompute_pool_do. */
+non_null()
+uint32_t precompute_pool_in_flight(const Precompute_Pool *pool);
+
+/** @brief Copy the current counters of the pool into stats. */
+non_null()
+void precompute_pool_get_stats(const Precompute_Pool *pool, Precompute_Pool_Stats *stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif // C_TOXCORE_TOXCORE_PRECOMPUTE_POOL_H
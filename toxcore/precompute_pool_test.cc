@@ -0,0 +1,180 @@
+#include "precompute_pool.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "crypto_core.h"
+#include "logger.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+using SecretKey = std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE>;
+using SharedKey = std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE>;
+
+struct Result {
+    bool ok;
+    SharedKey shared_key;
+    std::vector<uint8_t> data;
+};
+
+void record_result(void *object, const uint8_t *shared_key, const uint8_t *data, uint16_t length, void *userdata)
+{
+    std::vector<Result> *results = static_cast<std::vector<Result> *>(userdata);
+    Result result{shared_key != nullptr, {}, std::vector<uint8_t>(data, data + length)};
+
+    if (shared_key != nullptr) {
+        std::copy(shared_key, shared_key + CRYPTO_SHARED_KEY_SIZE, result.shared_key.begin());
+    }
+
+    results->push_back(result);
+}
+
+class PrecomputePool : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        rng_ = system_random();
+        ASSERT_NE(rng_, nullptr);
+        log_ = logger_new();
+        ASSERT_NE(log_, nullptr);
+        crypto_new_keypair(rng_, self_pk_.data(), self_sk_.data());
+    }
+
+    void TearDown() override { logger_kill(log_); }
+
+    PublicKey new_public_key()
+    {
+        PublicKey pk;
+        SecretKey sk;
+        crypto_new_keypair(rng_, pk.data(), sk.data());
+        return pk;
+    }
+
+    /** Run the pool until `count` results came back or a few seconds passed. */
+    std::vector<Result> wait_for(Precompute_Pool *pool, size_t count)
+    {
+        std::vector<Result> results;
+
+        for (int i = 0; i < 5000 && results.size() < count; ++i) {
+            precompute_pool_do(pool, &results);
+
+            if (results.size() < count) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+
+        return results;
+    }
+
+    const Random *rng_ = nullptr;
+    Logger *log_ = nullptr;
+    PublicKey self_pk_;
+    SecretKey self_sk_;
+};
+
+TEST_F(PrecomputePool, ComputesSharedKeysAndHandsBackData)
+{
+    Precompute_Pool *pool = precompute_pool_new(log_, 4, 64);
+    ASSERT_NE(pool, nullptr);
+
+    std::vector<PublicKey> pks;
+
+    for (uint8_t i = 0; i < 32; ++i) {
+        pks.push_back(new_public_key());
+        const uint8_t data[] = {i, 0xaa};
+        ASSERT_TRUE(precompute_pool_add(pool, pks.back().data(), self_sk_.data(), record_result, nullptr, data,
+                                        sizeof(data)));
+    }
+
+    const std::vector<Result> results = wait_for(pool, pks.size());
+    ASSERT_EQ(results.size(), pks.size());
+
+    for (const Result &result : results) {
+        ASSERT_TRUE(result.ok);
+        ASSERT_EQ(result.data.size(), 2);
+        EXPECT_EQ(result.data[1], 0xaa);
+
+        SharedKey expected;
+        encrypt_precompute(pks[result.data[0]].data(), self_sk_.data(), expected.data());
+        EXPECT_EQ(result.shared_key, expected);
+    }
+
+    Precompute_Pool_Stats stats;
+    precompute_pool_get_stats(pool, &stats);
+    EXPECT_EQ(stats.in_flight, 0);
+    EXPECT_EQ(stats.completed, pks.size());
+    EXPECT_EQ(stats.rejected, 0);
+
+    precompute_pool_free(pool);
+}
+
+TEST_F(PrecomputePool, RejectsJobsWhenFull)
+{
+    Precompute_Pool *pool = precompute_pool_new(log_, 1, 2);
+    ASSERT_NE(pool, nullptr);
+
+    const PublicKey pk = new_public_key();
+
+    // Finished jobs count as in flight until they are handed back.
+    EXPECT_TRUE(precompute_pool_add(pool, pk.data(), self_sk_.data(), record_result, nullptr, nullptr, 0));
+    EXPECT_TRUE(precompute_pool_add(pool, pk.data(), self_sk_.data(), record_result, nullptr, nullptr, 0));
+    EXPECT_FALSE(precompute_pool_add(pool, pk.data(), self_sk_.data(), record_result, nullptr, nullptr, 0));
+    EXPECT_EQ(precompute_pool_in_flight(pool), 2);
+
+    EXPECT_EQ(wait_for(pool, 2).size(), 2);
+    EXPECT_TRUE(precompute_pool_add(pool, pk.data(), self_sk_.data(), record_result, nullptr, nullptr, 0));
+
+    Precompute_Pool_Stats stats;
+    precompute_pool_get_stats(pool, &stats);
+    EXPECT_EQ(stats.rejected, 1);
+    EXPECT_EQ(stats.completed, 2);
+    EXPECT_EQ(stats.in_flight, 1);
+
+    // Jobs still in flight are dropped.
+    precompute_pool_free(pool);
+}
+
+TEST_F(PrecomputePool, ReportsInvalidPublicKeys)
+{
+    Precompute_Pool *pool = precompute_pool_new(log_, 2, 4);
+    ASSERT_NE(pool, nullptr);
+
+    const PublicKey zero_pk{};
+    ASSERT_TRUE(precompute_pool_add(pool, zero_pk.data(), self_sk_.data(), record_result, nullptr, nullptr, 0));
+
+    const std::vector<Result> results = wait_for(pool, 1);
+    ASSERT_EQ(results.size(), 1);
+    EXPECT_FALSE(results[0].ok);
+
+    precompute_pool_free(pool);
+}
+
+TEST_F(PrecomputePool, RejectsInvalidParameters)
+{
+    EXPECT_EQ(precompute_pool_new(log_, 0, 16), nullptr);
+    EXPECT_EQ(precompute_pool_new(log_, PRECOMPUTE_POOL_MAX_THREADS + 1, 16), nullptr);
+    EXPECT_EQ(precompute_pool_new(log_, 1, 0), nullptr);
+
+    Precompute_Pool *pool = precompute_pool_new(log_, 1, 4);
+    ASSERT_NE(pool, nullptr);
+
+    const PublicKey pk = new_public_key();
+    std::vector<uint8_t> data(PRECOMPUTE_JOB_DATA_SIZE + 1);
+    EXPECT_FALSE(precompute_pool_add(pool, pk.data(), self_sk_.data(), record_result, nullptr, data.data(),
+                                     static_cast<uint16_t>(data.size())));
+
+    Precompute_Pool_Stats stats;
+    precompute_pool_get_stats(pool, &stats);
+    EXPECT_EQ(stats.in_flight, 0);
+    EXPECT_EQ(stats.rejected, 0);
+
+    precompute_pool_free(pool);
+}
+
+}  // namespace
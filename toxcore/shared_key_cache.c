@@ -11,22 +11,56 @@
 
 #include "ccompat.h"
 #include "crypto_core.h"
+#include "list.h"
 #include "mono_time.h"
+#include "util.h"
+
+/** Keys are allocated in blocks of this many, so their addresses never change. */
+#define KEYS_PER_BLOCK 256
+
+/** Number of keys the hash table is initially sized for. */
+#define INITIAL_INDEX_CAPACITY 64
+
+#define NO_KEY UINT32_MAX
 
 typedef struct Shared_Key {
     uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE];
     uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE];
     uint64_t time_last_requested;
+    uint32_t next_free; /** Links unused keys, only valid while the key is empty */
+    bool referenced; /** Set on every hit, cleared when the CLOCK hand passes the key */
 } Shared_Key;
 
 struct Shared_Key_Cache {
-    Shared_Key *keys;
+    Shared_Key **blocks;
+    uint32_t num_blocks;
+    uint32_t num_allocated; /** Keys in all blocks, at most max_keys */
+    uint32_t num_used; /** Keys ever handed out from the blocks, the rest have never been used */
+    uint32_t free_key; /** Head of the list of erased keys */
+    uint32_t num_keys;
+    uint32_t max_keys;
+    uint32_t clock_hand;
+
+    Hash_List index; /** Maps public keys to their key number */
+
     const uint8_t* self_secret_key;
     uint64_t timeout; /** After this time (in seconds), a key is erased on the next housekeeping cycle */
+    uint64_t next_housekeeping;
     const Mono_Time *time;
-    uint8_t keys_per_slot;
+
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t expirations;
 };
 
+non_null()
+static Shared_Key *shared_key_get(const Shared_Key_Cache *cache, uint32_t key_num)
+{
+    assert(key_num < cache->num_allocated);
+    return &cache->blocks[key_num / KEYS_PER_BLOCK][key_num % KEYS_PER_BLOCK];
+}
+
 non_null()
 static bool shared_key_is_empty(const Shared_Key *k) {
     assert(k != nullptr);
@@ -43,9 +77,17 @@ static void shared_key_set_empty(Shared_Key *k) {
     assert(shared_key_is_empty(k));
 }
 
-Shared_Key_Cache *shared_key_cache_new(const Mono_Time *time, const uint8_t *self_secret_key, uint64_t timeout, uint8_t keys_per_slot)
+non_null()
+static uint32_t block_size(const Shared_Key_Cache *cache, uint32_t block)
 {
-    if (time == nullptr || self_secret_key == nullptr || timeout == 0 || keys_per_slot == 0) {
+    const uint32_t start = block * KEYS_PER_BLOCK;
+    return min_u32(KEYS_PER_BLOCK, cache->max_keys - start);
+}
+
+Shared_Key_Cache *shared_key_cache_new(const Mono_Time *time, const Random *rng, const uint8_t *self_secret_key,
+                                       uint64_t timeout, uint32_t max_keys)
+{
+    if (time == nullptr || self_secret_key == nullptr || timeout == 0 || max_keys == 0 || max_keys > INT32_MAX) {
         return nullptr;
     }
 
@@ -61,19 +103,18 @@ Shared_Key_Cache *shared_key_cache_new(const Mono_Time *time, const uint8_t *sel
         return nullptr;
     }
 
-    res->self_secret_key = self_secret_key;
-    res->time = time;
-    res->keys_per_slot = keys_per_slot;
-    // We take one byte from the public key for each bucket and store keys_per_slot elements there
-    const size_t cache_size = 256 * keys_per_slot;
-    res->keys = (Shared_Key *)calloc(cache_size, sizeof (Shared_Key));
-
-    if (res->keys == nullptr) {
+    if (hash_list_init(&res->index, CRYPTO_PUBLIC_KEY_SIZE, min_u32(max_keys, INITIAL_INDEX_CAPACITY),
+                       random_u64(rng)) == 0) {
         free(res);
         return nullptr;
     }
 
-    crypto_memlock(res->keys, cache_size * sizeof (Shared_Key));
+    res->self_secret_key = self_secret_key;
+    res->time = time;
+    res->timeout = timeout;
+    res->max_keys = max_keys;
+    res->free_key = NO_KEY;
+    res->next_housekeeping = mono_time_get(time) + max_u64(1, timeout / 2);
 
     return res;
 }
@@ -84,78 +125,222 @@ void shared_key_cache_free(Shared_Key_Cache *cache)
         return;
     }
 
-    const size_t cache_size = 256 * cache->keys_per_slot;
-    // Don't leave key material in memory
-    crypto_memzero(cache->keys, cache_size * sizeof (Shared_Key));
-    crypto_memunlock(cache->keys, cache_size * sizeof (Shared_Key));
-    free(cache->keys);
+    for (uint32_t i = 0; i < cache->num_blocks; ++i) {
+        const size_t size = block_size(cache, i) * sizeof (Shared_Key);
+        // Don't leave key material in memory
+        crypto_memzero(cache->blocks[i], size);
+        crypto_memunlock(cache->blocks[i], size);
+        free(cache->blocks[i]);
+    }
+
+    hash_list_free(&cache->index);
+    free(cache->blocks);
     free(cache);
 }
 
-/* NOTE: On each lookup housekeeping is performed to evict keys that did timeout. */
-const uint8_t *shared_key_cache_lookup(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE])
+/** @brief Erase the key and put it on the free list. */
+non_null()
+static void shared_key_release(Shared_Key_Cache *cache, uint32_t key_num)
 {
-    // caching the time is not necessary, but calls to mono_time_get(...) are not free
-    const uint64_t cur_time = mono_time_get(cache->time);
-    // We can't use the first and last bytes because they are masked in curve25519. Selected 8 for good alignment.
-    const uint8_t bucket_idx = public_key[8];
-    Shared_Key* bucket_start = &cache->keys[bucket_idx*cache->keys_per_slot];
+    Shared_Key *k = shared_key_get(cache, key_num);
+    shared_key_set_empty(k);
+    k->next_free = cache->free_key;
+    cache->free_key = key_num;
+}
 
-    const uint8_t* found = nullptr;
+/** @brief Erase all keys that were not requested within the timeout. */
+non_null()
+static void shared_key_cache_housekeeping(Shared_Key_Cache *cache, uint64_t cur_time)
+{
+    for (uint32_t i = 0; i < cache->num_used; ++i) {
+        const Shared_Key *k = shared_key_get(cache, i);
 
-    // Perform lookup
-    for(size_t i = 0; i < cache->keys_per_slot; ++i) {
-        if (shared_key_is_empty(&bucket_start[i])) {
+        if (shared_key_is_empty(k) || k->time_last_requested + cache->timeout >= cur_time) {
             continue;
         }
 
-        if (pk_equal(public_key, bucket_start[i].public_key)) {
-            found = bucket_start[i].shared_key;
-            bucket_start[i].time_last_requested = cur_time;
-            break;
+        hash_list_remove(&cache->index, k->public_key, (int)i);
+        shared_key_release(cache, i);
+        --cache->num_keys;
+        ++cache->expirations;
+    }
+
+    cache->next_housekeeping = cur_time + max_u64(1, cache->timeout / 2);
+}
+
+/** @brief Find room for another key: an erased one, a fresh one, or the one CLOCK evicts.
+ *
+ * @return NO_KEY on allocation failure.
+ */
+non_null()
+static uint32_t shared_key_take(Shared_Key_Cache *cache)
+{
+    if (cache->free_key != NO_KEY) {
+        const uint32_t key_num = cache->free_key;
+        cache->free_key = shared_key_get(cache, key_num)->next_free;
+        return key_num;
+    }
+
+    if (cache->num_used < cache->num_allocated) {
+        return cache->num_used++;
+    }
+
+    if (cache->num_allocated < cache->max_keys) {
+        const uint32_t size = block_size(cache, cache->num_blocks);
+        Shared_Key **blocks = (Shared_Key **)realloc(cache->blocks, (cache->num_blocks + 1) * sizeof(Shared_Key *));
+
+        if (blocks == nullptr) {
+            return NO_KEY;
+        }
+
+        cache->blocks = blocks;
+        Shared_Key *block = (Shared_Key *)calloc(size, sizeof (Shared_Key));
+
+        if (block == nullptr) {
+            return NO_KEY;
         }
+
+        crypto_memlock(block, size * sizeof (Shared_Key));
+        cache->blocks[cache->num_blocks] = block;
+        ++cache->num_blocks;
+        cache->num_allocated += size;
+        return cache->num_used++;
     }
 
-    // Perform housekeeping for this bucket
-    for (size_t i = 0; i < cache->keys_per_slot; ++i) {
-        if (shared_key_is_empty(&bucket_start[i])) {
+    // Every key is in use. Evict the first one the hand finds that wasn't
+    // requested again since the hand last passed it.
+    for (;;) {
+        const uint32_t key_num = cache->clock_hand;
+        Shared_Key *k = shared_key_get(cache, key_num);
+        cache->clock_hand = (key_num + 1) % cache->num_allocated;
+
+        if (k->referenced) {
+            k->referenced = false;
             continue;
         }
 
-        const bool timed_out = (bucket_start[i].time_last_requested + cache->timeout) < cur_time;
-        if (timed_out) {
-            shared_key_set_empty(&bucket_start[i]);
-        }
+        hash_list_remove(&cache->index, k->public_key, (int)key_num);
+        shared_key_set_empty(k);
+        --cache->num_keys;
+        ++cache->evictions;
+        return key_num;
     }
+}
 
-    if (found == nullptr) {
-        // Insert into cache
+/** @brief Find the cached key for public_key and mark it as requested.
+ *
+ * Runs the housekeeping first if it is due.
+ */
+non_null()
+static Shared_Key *shared_key_find(Shared_Key_Cache *cache, const uint8_t *public_key, uint64_t cur_time)
+{
+    if (cur_time >= cache->next_housekeeping) {
+        shared_key_cache_housekeeping(cache, cur_time);
+    }
 
-        uint64_t oldest_timestamp = UINT64_MAX;
-        size_t oldest_index = 0;
+    const int found = hash_list_find(&cache->index, public_key);
 
-        /*
-         *  Find least recently used entry, unused entries are prioritised,
-         *  because their time_last_requested field is zeroed.
-         */
-        for (size_t i = 0; i < cache->keys_per_slot; ++i) {
-            if (bucket_start[i].time_last_requested < oldest_timestamp) {
-                oldest_timestamp = bucket_start[i].time_last_requested;
-                oldest_index = i;
-            }
-        }
+    if (found < 0) {
+        return nullptr;
+    }
 
-        // Compute the shared key for the cache
-        if (encrypt_precompute(public_key, cache->self_secret_key, bucket_start[oldest_index].shared_key) != 0) {
-            // Don't put anything in the cache on error
-            return nullptr;
-        }
+    Shared_Key *k = shared_key_get(cache, (uint32_t)found);
+    k->time_last_requested = cur_time;
+    k->referenced = true;
+    ++cache->hits;
+    return k;
+}
+
+/** @brief Add the key for public_key, which must not be cached yet.
+ *
+ * @param shared_key the shared key computed elsewhere, or nullptr to compute it here.
+ */
+non_null(1, 2) nullable(3)
+static const uint8_t *shared_key_store(Shared_Key_Cache *cache, const uint8_t *public_key, const uint8_t *shared_key,
+                                       uint64_t cur_time)
+{
+    ++cache->misses;
+
+    const uint32_t key_num = shared_key_take(cache);
+
+    if (key_num == NO_KEY) {
+        return nullptr;
+    }
+
+    Shared_Key *k = shared_key_get(cache, key_num);
+
+    if (shared_key != nullptr) {
+        memcpy(k->shared_key, shared_key, CRYPTO_SHARED_KEY_SIZE);
+    } else if (encrypt_precompute(public_key, cache->self_secret_key, k->shared_key) != 0) {
+        // Don't put anything in the cache on error
+        shared_key_release(cache, key_num);
+        return nullptr;
+    }
+
+    if (!hash_list_add(&cache->index, public_key, (int)key_num)) {
+        shared_key_release(cache, key_num);
+        return nullptr;
+    }
+
+    // update cache entry
+    memcpy(k->public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    k->time_last_requested = cur_time;
+    ++cache->num_keys;
+    return k->shared_key;
+}
+
+const uint8_t *shared_key_cache_lookup(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE])
+{
+    // caching the time is not necessary, but calls to mono_time_get(...) are not free
+    const uint64_t cur_time = mono_time_get(cache->time);
+    const Shared_Key *k = shared_key_find(cache, public_key, cur_time);
+
+    if (k != nullptr) {
+        return k->shared_key;
+    }
+
+    return shared_key_store(cache, public_key, nullptr, cur_time);
+}
+
+const uint8_t *shared_key_cache_find(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE])
+{
+    const Shared_Key *k = shared_key_find(cache, public_key, mono_time_get(cache->time));
+    return k != nullptr ? k->shared_key : nullptr;
+}
+
+const uint8_t *shared_key_cache_insert(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE],
+                                       const uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE])
+{
+    const uint64_t cur_time = mono_time_get(cache->time);
+    const Shared_Key *k = shared_key_find(cache, public_key, cur_time);
+
+    if (k != nullptr) {
+        return k->shared_key;
+    }
+
+    return shared_key_store(cache, public_key, shared_key, cur_time);
+}
 
-        // update cache entry
-        memcpy(bucket_start[oldest_index].public_key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
-        bucket_start[oldest_index].time_last_requested = cur_time;
-        found = bucket_start[oldest_index].shared_key;
+void shared_key_cache_clear(Shared_Key_Cache *cache)
+{
+    for (uint32_t i = 0; i < cache->num_used; ++i) {
+        const Shared_Key *k = shared_key_get(cache, i);
+
+        if (!shared_key_is_empty(k)) {
+            hash_list_remove(&cache->index, k->public_key, (int)i);
+            shared_key_release(cache, i);
+        }
     }
 
-    return found;
+    cache->num_keys = 0;
+}
+
+void shared_key_cache_get_stats(const Shared_Key_Cache *cache, Shared_Key_Cache_Stats *stats)
+{
+    stats->keys = cache->num_keys;
+    stats->max_keys = cache->max_keys;
+    stats->hits = cache->hits;
+    stats->misses = cache->misses;
+    stats->evictions = cache->evictions;
+    stats->expirations = cache->expirations;
 }
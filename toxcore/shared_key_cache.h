@@ -10,25 +10,47 @@
 #include "crypto_core.h"
 #include "mono_time.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
  * This implements a cache for shared keys, since key generation is expensive.
+ *
+ * Keys are found through a hash table on the public key. The cache grows on
+ * demand up to a fixed number of keys; once it is full, the least valuable key
+ * is evicted with the CLOCK algorithm, which gives a key that was looked up
+ * again since the hand last passed it a second chance. Keys that were not
+ * requested for longer than the timeout are erased by a housekeeping pass that
+ * runs at most once every half timeout, not on every lookup.
  */
 
 typedef struct Shared_Key_Cache Shared_Key_Cache;
 
+/** Counters of a shared key cache, for monitoring its hit rate. */
+typedef struct Shared_Key_Cache_Stats {
+    uint32_t keys;          /* keys currently in the cache */
+    uint32_t max_keys;      /* number of keys the cache may grow to */
+    uint64_t hits;          /* lookups answered from the cache */
+    uint64_t misses;        /* lookups that had to compute the shared key */
+    uint64_t evictions;     /* keys dropped to make room for another one */
+    uint64_t expirations;   /* keys erased because they timed out */
+} Shared_Key_Cache_Stats;
+
 /**
  * @brief Initializes a new shared key cache.
  * @param time Time object for retrieving current time.
+ * @param rng Random number generator, used to seed the hash table so peers can't force collisions.
  * @param self_secret_key Our own secret key of length CRYPTO_SECRET_KEY_SIZE,
- * it must not change during the lifetime of the cache.
- * @param timeout Number of milliseconds, after which a key should be evicted.
- * @param keys_per_slot There are 256 slots, this controls how many keys are stored per slot and the size of the cache.
+ * it must not change during the lifetime of the cache, unless the cache is cleared right after.
+ * @param timeout Number of seconds, after which an unused key should be evicted.
+ * @param max_keys Maximum number of keys stored. Memory is allocated as the cache fills up.
  * @return nullptr on error.
  */
 non_null()
-Shared_Key_Cache *shared_key_cache_new(const Mono_Time *time,
+Shared_Key_Cache *shared_key_cache_new(const Mono_Time *time, const Random *rng,
                                        const uint8_t *self_secret_key,
-                                       uint64_t timeout, uint8_t keys_per_slot);
+                                       uint64_t timeout, uint32_t max_keys);
 
 /**
  * @brief Deletes the cache and frees all resources.
@@ -43,9 +65,48 @@ void shared_key_cache_free(Shared_Key_Cache *cache);
  * @param public_key Public key, used for the lookup and computation.
  *
  * @return The shared key of length CRYPTO_SHARED_KEY_SIZE, matching the public key and our secret key.
+ *   It stays valid at least until the next lookup on the same cache.
  * @return nullptr on error.
  */
 non_null()
 const uint8_t* shared_key_cache_lookup(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE]);
 
+/**
+ * @brief Looks up a key from the cache without computing it.
+ *
+ * A key that is found counts as a hit. Nothing is counted otherwise, so a
+ * caller that computes the key elsewhere should add it with
+ * shared_key_cache_insert, which counts the miss.
+ *
+ * @return The shared key, valid until the next lookup on the same cache.
+ * @return nullptr if the key is not in the cache.
+ */
+non_null()
+const uint8_t *shared_key_cache_find(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE]);
+
+/**
+ * @brief Adds a shared key that was computed elsewhere, e.g. on another thread.
+ *
+ * `shared_key` must be the key matching the public key and our secret key. If
+ * the public key is already cached, the cached key is kept.
+ *
+ * @return The cached shared key, valid until the next lookup on the same cache.
+ * @return nullptr on allocation failure.
+ */
+non_null()
+const uint8_t *shared_key_cache_insert(Shared_Key_Cache *cache, const uint8_t public_key[CRYPTO_PUBLIC_KEY_SIZE],
+                                       const uint8_t shared_key[CRYPTO_SHARED_KEY_SIZE]);
+
+/** @brief Erases all keys, e.g. because our secret key changed. The counters are kept. */
+non_null()
+void shared_key_cache_clear(Shared_Key_Cache *cache);
+
+/** @brief Copy the current counters of the cache into stats. */
+non_null()
+void shared_key_cache_get_stats(const Shared_Key_Cache *cache, Shared_Key_Cache_Stats *stats);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
 #endif // C_TOXCORE_TOXCORE_SHARED_KEY_CACHE_H
@@ -0,0 +1,195 @@
+#include "shared_key_cache.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <vector>
+
+#include "crypto_core.h"
+#include "mono_time.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+using SharedKey = std::array<uint8_t, CRYPTO_SHARED_KEY_SIZE>;
+
+constexpr uint64_t TIMEOUT = 600;
+
+class SharedKeyCache : public ::testing::Test {
+protected:
+    void SetUp() override
+    {
+        rng_ = system_random();
+        ASSERT_NE(rng_, nullptr);
+        mono_time_ = mono_time_new(nullptr, nullptr);
+        ASSERT_NE(mono_time_, nullptr);
+        now_ = current_time_monotonic(mono_time_) + 1000;
+        mono_time_set_current_time_callback(
+            mono_time_, [](void *user_data) { return *static_cast<uint64_t *>(user_data); }, &now_);
+        mono_time_update(mono_time_);
+
+        PublicKey self_pk;
+        crypto_new_keypair(rng_, self_pk.data(), self_sk_.data());
+    }
+
+    void TearDown() override { mono_time_free(mono_time_); }
+
+    void advance_seconds(uint64_t seconds)
+    {
+        now_ += seconds * 1000;
+        mono_time_update(mono_time_);
+    }
+
+    PublicKey new_public_key()
+    {
+        PublicKey pk;
+        std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> sk;
+        crypto_new_keypair(rng_, pk.data(), sk.data());
+        return pk;
+    }
+
+    SharedKey expected_shared_key(const PublicKey &pk)
+    {
+        SharedKey shared_key;
+        encrypt_precompute(pk.data(), self_sk_.data(), shared_key.data());
+        return shared_key;
+    }
+
+    Shared_Key_Cache_Stats stats(const Shared_Key_Cache *cache)
+    {
+        Shared_Key_Cache_Stats stats;
+        shared_key_cache_get_stats(cache, &stats);
+        return stats;
+    }
+
+    const Random *rng_ = nullptr;
+    Mono_Time *mono_time_ = nullptr;
+    uint64_t now_ = 0;
+    std::array<uint8_t, CRYPTO_SECRET_KEY_SIZE> self_sk_;
+};
+
+bool matches(const uint8_t *shared_key, const SharedKey &expected)
+{
+    return shared_key != nullptr && std::equal(expected.begin(), expected.end(), shared_key);
+}
+
+TEST_F(SharedKeyCache, ReturnsPrecomputedKeyAndCountsHits)
+{
+    Shared_Key_Cache *cache = shared_key_cache_new(mono_time_, rng_, self_sk_.data(), TIMEOUT, 16);
+    ASSERT_NE(cache, nullptr);
+
+    const PublicKey pk = new_public_key();
+    const SharedKey expected = expected_shared_key(pk);
+
+    EXPECT_TRUE(matches(shared_key_cache_lookup(cache, pk.data()), expected));
+    EXPECT_TRUE(matches(shared_key_cache_lookup(cache, pk.data()), expected));
+
+    const Shared_Key_Cache_Stats s = stats(cache);
+    EXPECT_EQ(s.keys, 1);
+    EXPECT_EQ(s.max_keys, 16);
+    EXPECT_EQ(s.hits, 1);
+    EXPECT_EQ(s.misses, 1);
+    EXPECT_EQ(s.evictions, 0);
+
+    shared_key_cache_free(cache);
+}
+
+TEST_F(SharedKeyCache, GrowsUpToMaxKeys)
+{
+    // More than one block of keys.
+    const uint32_t max_keys = 600;
+    Shared_Key_Cache *cache = shared_key_cache_new(mono_time_, rng_, self_sk_.data(), TIMEOUT, max_keys);
+    ASSERT_NE(cache, nullptr);
+
+    std::vector<PublicKey> pks;
+
+    for (uint32_t i = 0; i < max_keys; ++i) {
+        pks.push_back(new_public_key());
+        ASSERT_NE(shared_key_cache_lookup(cache, pks.back().data()), nullptr);
+    }
+
+    for (const PublicKey &pk : pks) {
+        EXPECT_TRUE(matches(shared_key_cache_lookup(cache, pk.data()), expected_shared_key(pk)));
+    }
+
+    const Shared_Key_Cache_Stats s = stats(cache);
+    EXPECT_EQ(s.keys, max_keys);
+    EXPECT_EQ(s.hits, max_keys);
+    EXPECT_EQ(s.misses, max_keys);
+    EXPECT_EQ(s.evictions, 0);
+
+    shared_key_cache_free(cache);
+}
+
+TEST_F(SharedKeyCache, EvictsKeysNotRequestedAgainFirst)
+{
+    Shared_Key_Cache *cache = shared_key_cache_new(mono_time_, rng_, self_sk_.data(), TIMEOUT, 4);
+    ASSERT_NE(cache, nullptr);
+
+    std::vector<PublicKey> pks;
+
+    for (uint32_t i = 0; i < 4; ++i) {
+        pks.push_back(new_public_key());
+        ASSERT_NE(shared_key_cache_lookup(cache, pks.back().data()), nullptr);
+    }
+
+    // Request all but the second key again, so that one is the only candidate.
+    for (uint32_t i : {0, 2, 3}) {
+        ASSERT_NE(shared_key_cache_lookup(cache, pks[i].data()), nullptr);
+    }
+
+    const PublicKey newcomer = new_public_key();
+    EXPECT_TRUE(matches(shared_key_cache_lookup(cache, newcomer.data()), expected_shared_key(newcomer)));
+    EXPECT_EQ(stats(cache).evictions, 1);
+    EXPECT_EQ(stats(cache).keys, 4);
+
+    const uint64_t hits = stats(cache).hits;
+
+    for (uint32_t i : {0, 2, 3}) {
+        EXPECT_TRUE(matches(shared_key_cache_lookup(cache, pks[i].data()), expected_shared_key(pks[i])));
+    }
+
+    EXPECT_EQ(stats(cache).hits, hits + 3);
+
+    // The evicted key is computed again.
+    EXPECT_TRUE(matches(shared_key_cache_lookup(cache, pks[1].data()), expected_shared_key(pks[1])));
+    EXPECT_EQ(stats(cache).misses, 6);
+
+    shared_key_cache_free(cache);
+}
+
+TEST_F(SharedKeyCache, ErasesKeysAfterTimeout)
+{
+    Shared_Key_Cache *cache = shared_key_cache_new(mono_time_, rng_, self_sk_.data(), TIMEOUT, 16);
+    ASSERT_NE(cache, nullptr);
+
+    const PublicKey idle = new_public_key();
+    const PublicKey busy = new_public_key();
+    ASSERT_NE(shared_key_cache_lookup(cache, idle.data()), nullptr);
+
+    // Keep one key in use while the other one times out.
+    for (uint64_t t = 0; t < 2 * TIMEOUT; t += TIMEOUT / 4) {
+        advance_seconds(TIMEOUT / 4);
+        ASSERT_NE(shared_key_cache_lookup(cache, busy.data()), nullptr);
+    }
+
+    Shared_Key_Cache_Stats s = stats(cache);
+    EXPECT_EQ(s.expirations, 1);
+    EXPECT_EQ(s.keys, 1);
+
+    EXPECT_TRUE(matches(shared_key_cache_lookup(cache, idle.data()), expected_shared_key(idle)));
+    s = stats(cache);
+    EXPECT_EQ(s.misses, 3);
+    EXPECT_EQ(s.keys, 2);
+
+    shared_key_cache_free(cache);
+}
+
+TEST_F(SharedKeyCache, RejectsInvalidParameters)
+{
+    EXPECT_EQ(shared_key_cache_new(mono_time_, rng_, self_sk_.data(), 0, 16), nullptr);
+    EXPECT_EQ(shared_key_cache_new(mono_time_, rng_, self_sk_.data(), TIMEOUT, 0), nullptr);
+}
+
+}  // namespace
@@ -0,0 +1,309 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Hierarchical timing wheel for scheduling work on numbered objects.
+ */
+#include "timer_wheel.h"
+
+#include <stdlib.h>
+
+#include "ccompat.h"
+#include "util.h"
+
+#define LEVEL0_BITS 10
+#define LEVEL0_SIZE (1 << LEVEL0_BITS)
+#define LEVEL0_MASK (LEVEL0_SIZE - 1)
+#define LEVEL1_BITS 6
+#define LEVEL1_SIZE (1 << LEVEL1_BITS)
+#define LEVEL1_MASK (LEVEL1_SIZE - 1)
+
+/** Slot holding the ids being expired by the current timer_wheel_expire call. */
+#define EXPIRING_SLOT (LEVEL0_SIZE + LEVEL1_SIZE)
+#define NUM_SLOTS (EXPIRING_SLOT + 1)
+
+#define NO_ID UINT32_MAX
+#define NO_SLOT UINT32_MAX
+
+typedef struct Timer_Wheel_Entry {
+    uint64_t due;
+    uint32_t prev;
+    uint32_t next;
+    uint32_t slot; // NO_SLOT if not scheduled
+} Timer_Wheel_Entry;
+
+typedef struct Timer_Wheel_Slot {
+    uint32_t head;
+    uint32_t tail;
+} Timer_Wheel_Slot;
+
+struct Timer_Wheel {
+    /* The first millisecond not yet expired. */
+    uint64_t current;
+
+    Timer_Wheel_Slot slots[NUM_SLOTS];
+    uint32_t level0_count;
+    uint32_t count;
+
+    Timer_Wheel_Entry *entries; // indexed by id
+    uint32_t entries_size;
+};
+
+Timer_Wheel *timer_wheel_new(uint64_t now)
+{
+    Timer_Wheel *wheel = (Timer_Wheel *)calloc(1, sizeof(Timer_Wheel));
+
+    if (wheel == nullptr) {
+        return nullptr;
+    }
+
+    wheel->current = now;
+
+    for (uint32_t i = 0; i < NUM_SLOTS; ++i) {
+        wheel->slots[i].head = NO_ID;
+        wheel->slots[i].tail = NO_ID;
+    }
+
+    return wheel;
+}
+
+void timer_wheel_kill(Timer_Wheel *wheel)
+{
+    if (wheel == nullptr) {
+        return;
+    }
+
+    free(wheel->entries);
+    free(wheel);
+}
+
+non_null()
+static void wheel_link(Timer_Wheel *wheel, uint32_t id, uint32_t slot)
+{
+    Timer_Wheel_Entry *entry = &wheel->entries[id];
+    Timer_Wheel_Slot *s = &wheel->slots[slot];
+
+    entry->slot = slot;
+    entry->next = NO_ID;
+    entry->prev = s->tail;
+
+    if (s->tail != NO_ID) {
+        wheel->entries[s->tail].next = id;
+    } else {
+        s->head = id;
+    }
+
+    s->tail = id;
+
+    if (slot < LEVEL0_SIZE) {
+        ++wheel->level0_count;
+    }
+}
+
+non_null()
+static void wheel_unlink(Timer_Wheel *wheel, uint32_t id)
+{
+    Timer_Wheel_Entry *entry = &wheel->entries[id];
+    Timer_Wheel_Slot *s = &wheel->slots[entry->slot];
+
+    if (entry->prev != NO_ID) {
+        wheel->entries[entry->prev].next = entry->next;
+    } else {
+        s->head = entry->next;
+    }
+
+    if (entry->next != NO_ID) {
+        wheel->entries[entry->next].prev = entry->prev;
+    } else {
+        s->tail = entry->prev;
+    }
+
+    if (entry->slot < LEVEL0_SIZE) {
+        --wheel->level0_count;
+    }
+
+    entry->slot = NO_SLOT;
+}
+
+/** @brief File an entry in the slot for its deadline, relative to the current time. */
+non_null()
+static void wheel_place(Timer_Wheel *wheel, uint32_t id)
+{
+    const uint64_t due = max_u64(wheel->entries[id].due, wheel->current);
+
+    if (due - wheel->current < LEVEL0_SIZE) {
+        wheel_link(wheel, id, due & LEVEL0_MASK);
+        return;
+    }
+
+    const uint64_t current_block = wheel->current >> LEVEL0_BITS;
+    uint64_t block = due >> LEVEL0_BITS;
+
+    if (block - current_block >= LEVEL1_SIZE) {
+        /* Too far out: park it in the last slot, to be re-filed from there. */
+        block = current_block + LEVEL1_SIZE - 1;
+    }
+
+    wheel_link(wheel, id, LEVEL0_SIZE + (block & LEVEL1_MASK));
+}
+
+non_null()
+static bool wheel_reserve(Timer_Wheel *wheel, uint32_t id)
+{
+    if (id < wheel->entries_size) {
+        return true;
+    }
+
+    uint32_t new_size = wheel->entries_size == 0 ? 16 : wheel->entries_size;
+
+    while (new_size <= id) {
+        if (new_size > UINT32_MAX / 2) {
+            return false;
+        }
+
+        new_size *= 2;
+    }
+
+    Timer_Wheel_Entry *entries = (Timer_Wheel_Entry *)realloc(wheel->entries, new_size * sizeof(Timer_Wheel_Entry));
+
+    if (entries == nullptr) {
+        return false;
+    }
+
+    for (uint32_t i = wheel->entries_size; i < new_size; ++i) {
+        entries[i].slot = NO_SLOT;
+    }
+
+    wheel->entries = entries;
+    wheel->entries_size = new_size;
+    return true;
+}
+
+bool timer_wheel_schedule(Timer_Wheel *wheel, uint32_t id, uint64_t due)
+{
+    if (id == NO_ID || !wheel_reserve(wheel, id)) {
+        return false;
+    }
+
+    if (wheel->entries[id].slot != NO_SLOT) {
+        wheel_unlink(wheel, id);
+    } else {
+        ++wheel->count;
+    }
+
+    wheel->entries[id].due = due;
+    wheel_place(wheel, id);
+    return true;
+}
+
+void timer_wheel_cancel(Timer_Wheel *wheel, uint32_t id)
+{
+    if (!timer_wheel_is_scheduled(wheel, id)) {
+        return;
+    }
+
+    wheel_unlink(wheel, id);
+    --wheel->count;
+}
+
+bool timer_wheel_is_scheduled(const Timer_Wheel *wheel, uint32_t id)
+{
+    return id < wheel->entries_size && wheel->entries[id].slot != NO_SLOT;
+}
+
+uint32_t timer_wheel_count(const Timer_Wheel *wheel)
+{
+    return wheel->count;
+}
+
+/** @brief Move all entries of a slot to another one, in order. */
+non_null()
+static void wheel_move_slot(Timer_Wheel *wheel, uint32_t from, uint32_t to)
+{
+    while (wheel->slots[from].head != NO_ID) {
+        const uint32_t id = wheel->slots[from].head;
+        wheel_unlink(wheel, id);
+        wheel_link(wheel, id, to);
+    }
+}
+
+/** @brief Re-file the second level slot whose block starts at the current time. */
+non_null()
+static void wheel_cascade(Timer_Wheel *wheel)
+{
+    const uint32_t slot = LEVEL0_SIZE + ((wheel->current >> LEVEL0_BITS) & LEVEL1_MASK);
+
+    while (wheel->slots[slot].head != NO_ID) {
+        const uint32_t id = wheel->slots[slot].head;
+        wheel_unlink(wheel, id);
+        wheel_place(wheel, id);
+    }
+}
+
+void timer_wheel_expire(Timer_Wheel *wheel, uint64_t now, timer_wheel_expire_cb *callback, void *object)
+{
+    while (wheel->current <= now) {
+        if ((wheel->current & LEVEL0_MASK) == 0) {
+            wheel_cascade(wheel);
+        }
+
+        if (wheel->level0_count == 0) {
+            /* Nothing due in this block: skip to the next one. */
+            const uint64_t next_block = (wheel->current | LEVEL0_MASK) + 1;
+            wheel->current = min_u64(next_block, now + 1);
+            continue;
+        }
+
+        const uint32_t slot = wheel->current & LEVEL0_MASK;
+        ++wheel->current;
+
+        /* Callbacks may schedule or cancel anything, so take the due ids out
+         * of the wheel first and hand them out one at a time. */
+        wheel_move_slot(wheel, slot, EXPIRING_SLOT);
+
+        while (wheel->slots[EXPIRING_SLOT].head != NO_ID) {
+            const uint32_t id = wheel->slots[EXPIRING_SLOT].head;
+            wheel_unlink(wheel, id);
+            --wheel->count;
+            callback(object, id);
+        }
+    }
+}
+
+uint64_t timer_wheel_next_due(const Timer_Wheel *wheel)
+{
+    uint64_t next_due = UINT64_MAX;
+
+    if (wheel->count == 0) {
+        return next_due;
+    }
+
+    if (wheel->level0_count > 0) {
+        for (uint32_t i = 0; i < LEVEL0_SIZE; ++i) {
+            if (wheel->slots[(wheel->current + i) & LEVEL0_MASK].head != NO_ID) {
+                next_due = wheel->current + i;
+                break;
+            }
+        }
+    }
+
+    /* Second level deadlines can be earlier than first level ones filed
+     * after them, and parked ones later than deadlines in the blocks after
+     * theirs, so look at every block that starts before the best so far. */
+    const uint64_t current_block = wheel->current >> LEVEL0_BITS;
+
+    for (uint32_t i = 0; i < LEVEL1_SIZE; ++i) {
+        if (((current_block + i) << LEVEL0_BITS) > next_due) {
+            break;
+        }
+
+        const Timer_Wheel_Slot *s = &wheel->slots[LEVEL0_SIZE + ((current_block + i) & LEVEL1_MASK)];
+
+        for (uint32_t id = s->head; id != NO_ID; id = wheel->entries[id].next) {
+            next_due = min_u64(next_due, max_u64(wheel->entries[id].due, wheel->current));
+        }
+    }
+
+    return next_due;
+}
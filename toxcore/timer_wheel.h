@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Hierarchical timing wheel for scheduling work on numbered objects.
+ *
+ * Each id (e.g. a connection number) has at most one pending deadline, in
+ * milliseconds of monotonic time. Scheduling, cancelling and expiring an id
+ * take constant time, so a caller with many mostly-idle objects only pays for
+ * the ones that are due.
+ *
+ * The first level has one slot per millisecond for the next 1024 ms, the
+ * second level one slot per 1024 ms for about a minute after that. Deadlines
+ * further out are parked in the last slot and re-filed when it comes up.
+ */
+#ifndef C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+#define C_TOXCORE_TOXCORE_TIMER_WHEEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attributes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Timer_Wheel Timer_Wheel;
+
+/** @brief Called for every id whose deadline has passed.
+ *
+ * The id is no longer scheduled when this is called. The callback may
+ * schedule or cancel any id, including this one.
+ */
+typedef void timer_wheel_expire_cb(void *object, uint32_t id);
+
+/**
+ * @brief Create an empty timing wheel.
+ *
+ * @param now the current time in milliseconds.
+ *
+ * @return pointer to allocated Timer_Wheel on success, nullptr on failure.
+ */
+Timer_Wheel *timer_wheel_new(uint64_t now);
+
+/** @brief Free a timing wheel and all its pending deadlines. */
+nullable(1)
+void timer_wheel_kill(Timer_Wheel *wheel);
+
+/** @brief Set the deadline of `id`, replacing any earlier one.
+ *
+ * Deadlines in the past expire on the next call to timer_wheel_expire.
+ *
+ * @retval true on success.
+ * @retval false on allocation failure (the id is not scheduled).
+ */
+non_null()
+bool timer_wheel_schedule(Timer_Wheel *wheel, uint32_t id, uint64_t due);
+
+/** @brief Remove the deadline of `id`, if it has one. */
+non_null()
+void timer_wheel_cancel(Timer_Wheel *wheel, uint32_t id);
+
+/** @brief Check whether `id` has a pending deadline. */
+non_null()
+bool timer_wheel_is_scheduled(const Timer_Wheel *wheel, uint32_t id);
+
+/** @brief Number of ids with a pending deadline. */
+non_null()
+uint32_t timer_wheel_count(const Timer_Wheel *wheel);
+
+/** @brief Call `callback` for every id whose deadline is at or before `now`, earliest first. */
+non_null(1, 3) nullable(4)
+void timer_wheel_expire(Timer_Wheel *wheel, uint64_t now, timer_wheel_expire_cb *callback, void *object);
+
+/** @brief The earliest pending deadline.
+ *
+ * Deadlines that were already in the past when they were scheduled are
+ * reported as the first millisecond not yet expired.
+ *
+ * @return UINT64_MAX if no id is scheduled.
+ */
+non_null()
+uint64_t timer_wheel_next_due(const Timer_Wheel *wheel);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,205 @@
+#include "timer_wheel.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+namespace {
+
+void record_expired(void *object, uint32_t id)
+{
+    static_cast<std::vector<uint32_t> *>(object)->push_back(id);
+}
+
+std::vector<uint32_t> expire(Timer_Wheel *wheel, uint64_t now)
+{
+    std::vector<uint32_t> ids;
+    timer_wheel_expire(wheel, now, record_expired, &ids);
+    return ids;
+}
+
+TEST(TimerWheel, CreateAndDestroy)
+{
+    Timer_Wheel *wheel = timer_wheel_new(1000);
+    ASSERT_NE(wheel, nullptr);
+    EXPECT_EQ(timer_wheel_count(wheel), 0);
+    EXPECT_EQ(timer_wheel_next_due(wheel), UINT64_MAX);
+    EXPECT_FALSE(timer_wheel_is_scheduled(wheel, 0));
+    timer_wheel_cancel(wheel, 1234);
+    timer_wheel_kill(wheel);
+}
+
+TEST(TimerWheel, ExpiresAtDeadline)
+{
+    Timer_Wheel *wheel = timer_wheel_new(1000);
+    ASSERT_NE(wheel, nullptr);
+
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 3, 1500));
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 7, 1200));
+    EXPECT_EQ(timer_wheel_next_due(wheel), 1200);
+
+    EXPECT_TRUE(expire(wheel, 1199).empty());
+    EXPECT_EQ(expire(wheel, 1200), std::vector<uint32_t> {7});
+    EXPECT_FALSE(timer_wheel_is_scheduled(wheel, 7));
+    EXPECT_TRUE(timer_wheel_is_scheduled(wheel, 3));
+    EXPECT_EQ(timer_wheel_next_due(wheel), 1500);
+
+    EXPECT_EQ(expire(wheel, 5000), std::vector<uint32_t> {3});
+    EXPECT_EQ(timer_wheel_count(wheel), 0);
+
+    timer_wheel_kill(wheel);
+}
+
+TEST(TimerWheel, PastDeadlinesExpireOnNextCall)
+{
+    Timer_Wheel *wheel = timer_wheel_new(1000);
+    ASSERT_NE(wheel, nullptr);
+
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 1, 10));
+    EXPECT_EQ(timer_wheel_next_due(wheel), 1000);
+    EXPECT_EQ(expire(wheel, 1000), std::vector<uint32_t> {1});
+
+    timer_wheel_kill(wheel);
+}
+
+TEST(TimerWheel, RescheduleAndCancel)
+{
+    Timer_Wheel *wheel = timer_wheel_new(0);
+    ASSERT_NE(wheel, nullptr);
+
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 1, 100));
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 2, 100));
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 1, 5000));
+    timer_wheel_cancel(wheel, 2);
+    EXPECT_EQ(timer_wheel_count(wheel), 1);
+
+    EXPECT_TRUE(expire(wheel, 4999).empty());
+    EXPECT_EQ(expire(wheel, 5000), std::vector<uint32_t> {1});
+
+    timer_wheel_kill(wheel);
+}
+
+TEST(TimerWheel, SecondLevelDeadlineBeforeFirstLevelOne)
+{
+    Timer_Wheel *wheel = timer_wheel_new(0);
+    ASSERT_NE(wheel, nullptr);
+
+    // Filed in the second level, then a later deadline lands in the first.
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 1, 1030));
+    EXPECT_TRUE(expire(wheel, 500).empty());
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 2, 1400));
+
+    EXPECT_EQ(timer_wheel_next_due(wheel), 1030);
+    EXPECT_EQ(expire(wheel, 1030), std::vector<uint32_t> {1});
+    EXPECT_EQ(timer_wheel_next_due(wheel), 1400);
+
+    timer_wheel_kill(wheel);
+}
+
+TEST(TimerWheel, FarDeadlinesAreRefiled)
+{
+    Timer_Wheel *wheel = timer_wheel_new(0);
+    ASSERT_NE(wheel, nullptr);
+
+    constexpr uint64_t kHour = 60 * 60 * 1000;
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 9, kHour));
+    EXPECT_EQ(timer_wheel_next_due(wheel), kHour);
+
+    EXPECT_TRUE(expire(wheel, kHour - 1).empty());
+    EXPECT_EQ(expire(wheel, kHour), std::vector<uint32_t> {9});
+
+    timer_wheel_kill(wheel);
+}
+
+struct Rescheduler {
+    Timer_Wheel *wheel;
+    uint64_t now;
+    uint32_t calls = 0;
+};
+
+TEST(TimerWheel, CallbackCanRescheduleAndCancel)
+{
+    Timer_Wheel *wheel = timer_wheel_new(0);
+    ASSERT_NE(wheel, nullptr);
+
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 1, 10));
+    ASSERT_TRUE(timer_wheel_schedule(wheel, 2, 10));
+
+    Rescheduler r{wheel, 10};
+    timer_wheel_expire(wheel, 10, [](void *object, uint32_t id) {
+        Rescheduler *self = static_cast<Rescheduler *>(object);
+        ++self->calls;
+        // The first one cancels the second and reschedules itself for "now",
+        // which must not expire again in the same call.
+        timer_wheel_cancel(self->wheel, 3 - id);
+        timer_wheel_schedule(self->wheel, id, self->now);
+    }, &r);
+
+    EXPECT_EQ(r.calls, 1);
+    EXPECT_EQ(timer_wheel_count(wheel), 1);
+    EXPECT_EQ(timer_wheel_next_due(wheel), 11);
+
+    timer_wheel_kill(wheel);
+}
+
+TEST(TimerWheel, MatchesSortedDeadlines)
+{
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint64_t> delay(0, 100000);
+    std::uniform_int_distribution<uint64_t> step(0, 700);
+    std::uniform_int_distribution<uint32_t> id_dist(0, 299);
+
+    uint64_t now = 123456;
+    Timer_Wheel *wheel = timer_wheel_new(now);
+    ASSERT_NE(wheel, nullptr);
+
+    std::map<uint32_t, uint64_t> expected;
+    uint64_t first_unexpired = now;
+
+    for (int round = 0; round < 20000; ++round) {
+        const uint32_t id = id_dist(rng);
+
+        if (rng() % 4 == 0) {
+            timer_wheel_cancel(wheel, id);
+            expected.erase(id);
+        } else {
+            // Mostly short deadlines, with the occasional far one.
+            const uint64_t due = now + (rng() % 8 == 0 ? delay(rng) : delay(rng) % 1500);
+            ASSERT_TRUE(timer_wheel_schedule(wheel, id, due));
+            expected[id] = due;
+        }
+
+        uint64_t min_due = UINT64_MAX;
+
+        for (const auto &entry : expected) {
+            min_due = std::min(min_due, entry.second);
+        }
+
+        ASSERT_EQ(timer_wheel_next_due(wheel), min_due == UINT64_MAX ? min_due : std::max(min_due, first_unexpired));
+
+        now += step(rng);
+        std::vector<uint32_t> ids = expire(wheel, now);
+        first_unexpired = now + 1;
+        std::vector<uint32_t> expected_ids;
+
+        for (auto it = expected.begin(); it != expected.end();) {
+            if (it->second <= now) {
+                expected_ids.push_back(it->first);
+                it = expected.erase(it);
+            } else {
+                ++it;
+            }
+        }
+
+        std::sort(ids.begin(), ids.end());
+        ASSERT_EQ(ids, expected_ids);
+        ASSERT_EQ(timer_wheel_count(wheel), expected.size());
+    }
+
+    timer_wheel_kill(wheel);
+}
+
+}  // namespace
@@ -27,6 +27,7 @@
 #include "network.h"
 #include "tox_private.h"
 #include "tox_struct.h"
+#include "util.h"
 
 #include "../toxencryptsave/defines.h"
 
@@ -274,6 +275,21 @@ static void tox_file_recv_chunk_handler(Messenger *m, uint32_t friend_number, ui
     }
 }
 
+static m_file_recv_progress_cb tox_file_recv_progress_handler;
+non_null(1) nullable(5)
+static void tox_file_recv_progress_handler(Messenger *m, uint32_t friend_number, uint32_t file_number,
+        uint64_t bytes_written, void *user_data)
+{
+    struct Tox_Userdata *tox_data = (struct Tox_Userdata *)user_data;
+
+    if (tox_data->tox->file_recv_progress_callback != nullptr) {
+        tox_unlock(tox_data->tox);
+        tox_data->tox->file_recv_progress_callback(tox_data->tox, friend_number, file_number, bytes_written,
+                tox_data->user_data);
+        tox_lock(tox_data->tox);
+    }
+}
+
 static g_conference_invite_cb tox_conference_invite_handler;
 non_null(1, 4) nullable(6)
 static void tox_conference_invite_handler(Messenger *m, uint32_t friend_number, int type, const uint8_t *cookie,
@@ -805,6 +821,8 @@ Tox *tox_new(const struct Tox_Options *options, Tox_Err_New *error)
     m_options.hole_punching_enabled = tox_options_get_hole_punching_enabled(opts);
     m_options.local_discovery_enabled = tox_options_get_local_discovery_enabled(opts);
     m_options.dht_announcements_enabled = tox_options_get_dht_announcements_enabled(opts);
+    m_options.handshake_threads = tox_options_get_experimental_handshake_threads(opts);
+    m_options.group_relay_fanout = tox_options_get_experimental_group_relay_fanout(opts);
 
     if (m_options.udp_disabled) {
         m_options.local_discovery_enabled = false;
@@ -991,6 +1009,7 @@ Tox *tox_new(const struct Tox_Options *options, Tox_Err_New *error)
     callback_file_reqchunk(tox->m, tox_file_chunk_request_handler);
     callback_file_sendrequest(tox->m, tox_file_recv_handler);
     callback_file_data(tox->m, tox_file_recv_chunk_handler);
+    callback_file_recv_progress(tox->m, tox_file_recv_progress_handler);
     dht_callback_get_nodes_response(tox->m->dht, tox_dht_get_nodes_response_handler);
     g_callback_group_invite(tox->m->conferences_object, tox_conference_invite_handler);
     g_callback_group_connected(tox->m->conferences_object, tox_conference_connected_handler);
@@ -1269,6 +1288,42 @@ uint32_t tox_iteration_interval(const Tox *tox)
     return ret;
 }
 
+uint32_t tox_iteration_timeout(const Tox *tox)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    const uint32_t ret = messenger_wait_interval(tox->m);
+    tox_unlock(tox);
+    return ret;
+}
+
+uint32_t tox_get_fds(const Tox *tox, int32_t *fds, uint32_t fds_size)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    uint32_t count = messenger_get_sockets(tox->m, nullptr, 0);
+    const uint32_t num_copy = fds == nullptr ? 0 : min_u32(count, fds_size);
+
+    if (num_copy > 0) {
+        Socket *socks = (Socket *)calloc(num_copy, sizeof(Socket));
+
+        if (socks == nullptr) {
+            count = 0;
+        } else {
+            messenger_get_sockets(tox->m, socks, num_copy);
+
+            for (uint32_t i = 0; i < num_copy; ++i) {
+                fds[i] = socks[i].sock;
+            }
+
+            free(socks);
+        }
+    }
+
+    tox_unlock(tox);
+    return count;
+}
+
 void tox_iterate(Tox *tox, void *user_data)
 {
     assert(tox != nullptr);
@@ -2005,6 +2060,47 @@ bool tox_file_control(Tox *tox, uint32_t friend_number, uint32_t file_number, To
     return false;
 }
 
+bool tox_file_recv_to_fd(Tox *tox, uint32_t friend_number, uint32_t file_number, int fd, uint64_t progress_interval,
+                         bool preallocate, Tox_Err_File_Recv_To_Fd *error)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    const int ret = file_recv_sink_fd(tox->m, friend_number, file_number, fd, progress_interval, preallocate);
+    tox_unlock(tox);
+
+    if (ret == 0) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FILE_RECV_TO_FD_OK);
+        return true;
+    }
+
+    switch (ret) {
+        case -1: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_RECV_TO_FD_FRIEND_NOT_FOUND);
+            return false;
+        }
+
+        case -2: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_RECV_TO_FD_NOT_FOUND);
+            return false;
+        }
+
+        case -3: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_RECV_TO_FD_BAD_FD);
+            return false;
+        }
+
+        case -4: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_RECV_TO_FD_MALLOC);
+            return false;
+        }
+    }
+
+    /* can't happen */
+    LOGGER_FATAL(tox->m->log, "impossible return value: %d", ret);
+
+    return false;
+}
+
 bool tox_file_seek(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position,
                    Tox_Err_File_Seek *error)
 {
@@ -2091,8 +2187,39 @@ bool tox_file_get_file_id(const Tox *tox, uint32_t friend_number, uint32_t file_
     return false;
 }
 
-uint32_t tox_file_send(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t file_size, const uint8_t *file_id,
-                       const uint8_t *filename, size_t filename_length, Tox_Err_File_Send *error)
+uint64_t tox_file_get_bytes_per_second(const Tox *tox, uint32_t friend_number, uint32_t file_number,
+                                       Tox_Err_File_Get *error)
+{
+    assert(tox != nullptr);
+    uint64_t bytes_per_second = 0;
+
+    tox_lock(tox);
+    const int ret = file_get_bytes_per_second(tox->m, friend_number, file_number, &bytes_per_second);
+    tox_unlock(tox);
+
+    if (ret == 0) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FILE_GET_OK);
+        return bytes_per_second;
+    }
+
+    if (ret == -1) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FILE_GET_FRIEND_NOT_FOUND);
+    } else {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FILE_GET_NOT_FOUND);
+    }
+
+    return 0;
+}
+
+/** @brief Send a file transmission request and set where core reads the file from.
+ *
+ * @param source One of File_Source, `fd` and `data` are used by FILE_SOURCE_FD
+ *   and FILE_SOURCE_DATA respectively.
+ */
+non_null(1) nullable(5, 6, 10, 11)
+static uint32_t file_send_from_source(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t file_size,
+                                      const uint8_t *file_id, const uint8_t *filename, size_t filename_length,
+                                      File_Source source, int fd, const uint8_t *data, Tox_Err_File_Send *error)
 {
     assert(tox != nullptr);
 
@@ -2101,6 +2228,16 @@ uint32_t tox_file_send(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t
         return UINT32_MAX;
     }
 
+    if (source == FILE_SOURCE_DATA && data == nullptr && file_size != 0) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SEND_NULL);
+        return UINT32_MAX;
+    }
+
+    if (source != FILE_SOURCE_CLIENT && (file_size == UINT64_MAX || (source == FILE_SOURCE_FD && fd < 0))) {
+        SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SEND_BAD_SOURCE);
+        return UINT32_MAX;
+    }
+
     uint8_t f_id[FILE_ID_LENGTH];
 
     if (file_id == nullptr) {
@@ -2111,6 +2248,16 @@ uint32_t tox_file_send(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t
 
     tox_lock(tox);
     const long int file_num = new_filesender(tox->m, friend_number, kind, file_size, file_id, filename, filename_length);
+
+    if (file_num >= 0) {
+        // Can't fail: the transfer exists and the source was checked above.
+        if (source == FILE_SOURCE_FD) {
+            file_send_source_fd(tox->m, friend_number, file_num, fd);
+        } else if (source == FILE_SOURCE_DATA) {
+            file_send_source_data(tox->m, friend_number, file_num, data);
+        }
+    }
+
     tox_unlock(tox);
 
     if (file_num >= 0) {
@@ -2146,6 +2293,64 @@ uint32_t tox_file_send(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t
     return UINT32_MAX;
 }
 
+uint32_t tox_file_send(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t file_size, const uint8_t *file_id,
+                       const uint8_t *filename, size_t filename_length, Tox_Err_File_Send *error)
+{
+    return file_send_from_source(tox, friend_number, kind, file_size, file_id, filename, filename_length,
+                                 FILE_SOURCE_CLIENT, -1, nullptr, error);
+}
+
+uint32_t tox_file_send_fd(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t file_size, const uint8_t *file_id,
+                          const uint8_t *filename, size_t filename_length, int fd, Tox_Err_File_Send *error)
+{
+    return file_send_from_source(tox, friend_number, kind, file_size, file_id, filename, filename_length,
+                                 FILE_SOURCE_FD, fd, nullptr, error);
+}
+
+uint32_t tox_file_send_mmap(Tox *tox, uint32_t friend_number, uint32_t kind, const uint8_t *data, uint64_t file_size,
+                            const uint8_t *file_id, const uint8_t *filename, size_t filename_length,
+                            Tox_Err_File_Send *error)
+{
+    return file_send_from_source(tox, friend_number, kind, file_size, file_id, filename, filename_length,
+                                 FILE_SOURCE_DATA, -1, data, error);
+}
+
+bool tox_file_set_priority(Tox *tox, uint32_t friend_number, uint32_t file_number, Tox_File_Priority priority,
+                           Tox_Err_File_Set_Priority *error)
+{
+    assert(tox != nullptr);
+    tox_lock(tox);
+    const int ret = file_set_priority(tox->m, friend_number, file_number, priority);
+    tox_unlock(tox);
+
+    switch (ret) {
+        case 0: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_PRIORITY_OK);
+            return true;
+        }
+
+        case -1: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_PRIORITY_FRIEND_NOT_FOUND);
+            return false;
+        }
+
+        case -2: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_PRIORITY_NOT_FOUND);
+            return false;
+        }
+
+        case -3: {
+            SET_ERROR_PARAMETER(error, TOX_ERR_FILE_SET_PRIORITY_BAD_PRIORITY);
+            return false;
+        }
+    }
+
+    /* can't happen */
+    LOGGER_FATAL(tox->m->log, "impossible return value: %d", ret);
+
+    return false;
+}
+
 bool tox_file_send_chunk(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t position, const uint8_t *data,
                          size_t length, Tox_Err_File_Send_Chunk *error)
 {
@@ -2220,6 +2425,12 @@ void tox_callback_file_recv_chunk(Tox *tox, tox_file_recv_chunk_cb *callback)
     tox->file_recv_chunk_callback = callback;
 }
 
+void tox_callback_file_recv_progress(Tox *tox, tox_file_recv_progress_cb *callback)
+{
+    assert(tox != nullptr);
+    tox->file_recv_progress_callback = callback;
+}
+
 void tox_callback_conference_invite(Tox *tox, tox_conference_invite_cb *callback)
 {
     assert(tox != nullptr);
@@ -4173,7 +4384,7 @@ bool tox_group_send_message(const Tox *tox, uint32_t group_number, Tox_Message_T
     assert(tox != nullptr);
 
     tox_lock(tox);
-    const GC_Chat *chat = gc_get_group(tox->m->group_handler, group_number);
+    GC_Chat *chat = gc_get_group(tox->m->group_handler, group_number);
 
     if (chat == nullptr) {
         SET_ERROR_PARAMETER(error, TOX_ERR_GROUP_SEND_MESSAGE_GROUP_NOT_FOUND);
@@ -731,6 +731,27 @@ struct Tox_Options {
      */
     bool experimental_thread_safety;
 
+    /**
+     * Number of threads that compute the keys of incoming connection
+     * handshakes and DHT requests from new peers, so a burst of peers
+     * connecting at once doesn't stall the tox_iterate thread. 0 computes
+     * them on the tox_iterate thread.
+     *
+     * Default: 0.
+     */
+    uint16_t experimental_handshake_threads;
+
+    /**
+     * Number of peers a group message, nick change or status change is sent
+     * to. Those peers forward it to the rest of the group along a spanning
+     * tree, so sending to a large group costs about as much as sending to
+     * this many peers. Peers that don't relay broadcasts still get them
+     * directly. 0 sends every broadcast to every peer, as before.
+     *
+     * Default: 0.
+     */
+    uint8_t experimental_group_relay_fanout;
+
     /**
      * Low level operating system functionality such as send/recv and random
      * number generation.
@@ -808,6 +829,14 @@ bool tox_options_get_experimental_thread_safety(const struct Tox_Options *option
 
 void tox_options_set_experimental_thread_safety(struct Tox_Options *options, bool experimental_thread_safety);
 
+uint16_t tox_options_get_experimental_handshake_threads(const struct Tox_Options *options);
+
+void tox_options_set_experimental_handshake_threads(struct Tox_Options *options, uint16_t experimental_handshake_threads);
+
+uint8_t tox_options_get_experimental_group_relay_fanout(const struct Tox_Options *options);
+
+void tox_options_set_experimental_group_relay_fanout(struct Tox_Options *options, uint8_t experimental_group_relay_fanout);
+
 const Tox_System *tox_options_get_operating_system(const struct Tox_Options *options);
 
 void tox_options_set_operating_system(struct Tox_Options *options, const Tox_System *operating_system);
@@ -1120,9 +1149,37 @@ void tox_callback_self_connection_status(Tox *tox, tox_self_connection_status_cb
 /**
  * @brief Return the time in milliseconds before `tox_iterate()` should be called again
  *   for optimal performance.
+ *
+ * This is short enough to pick up incoming packets in time when the caller
+ * just sleeps between iterations. Callers that wait for the sockets from
+ * `tox_get_fds()` should use `tox_iteration_timeout()` instead.
  */
 uint32_t tox_iteration_interval(const Tox *tox);
 
+/**
+ * @brief Return the time in milliseconds until the next timed event of the
+ *   instance, such as a retransmission, a keepalive or a DHT ping.
+ *
+ * Use this as the timeout when waiting for any of the sockets from
+ * `tox_get_fds()` to become readable (e.g. with poll or epoll), then call
+ * `tox_iterate()` either way. Returns 0 if `tox_iterate()` has work to do
+ * right away.
+ */
+uint32_t tox_iteration_timeout(const Tox *tox);
+
+/**
+ * @brief Get the file descriptors of the sockets that `tox_iterate()` reads from.
+ *
+ * Copies up to `fds_size` descriptors into `fds`. The set changes as TCP relay
+ * connections come and go, so get it again after every `tox_iterate()`.
+ *
+ * @param fds An array of at least `fds_size` elements, or NULL to only count.
+ *
+ * @return the total number of descriptors, which may be larger than `fds_size`,
+ *   or 0 if memory for copying them couldn't be allocated.
+ */
+uint32_t tox_get_fds(const Tox *tox, int32_t *fds, uint32_t fds_size);
+
 /**
  * @brief The main loop that needs to be run in intervals of `tox_iteration_interval()`
  *   milliseconds.
@@ -2245,6 +2302,23 @@ typedef enum Tox_Err_File_Get {
 bool tox_file_get_file_id(const Tox *tox, uint32_t friend_number, uint32_t file_number, uint8_t *file_id,
                           Tox_Err_File_Get *error);
 
+/**
+ * @brief Return the throughput of a file transfer in bytes per second.
+ *
+ * This works for files that are being sent and received. The throughput is
+ * averaged over the last full second of sent or received data and does not
+ * depend on how often this function is called. If the transfer stalls, the
+ * value goes down to 0 over the following seconds.
+ *
+ * @param friend_number The friend number of the friend the file is being
+ *   transferred to or received from.
+ * @param file_number The friend-specific identifier for the file transfer.
+ *
+ * @return the number of file data bytes per second, 0 on error.
+ */
+uint64_t tox_file_get_bytes_per_second(const Tox *tox, uint32_t friend_number, uint32_t file_number,
+                                       Tox_Err_File_Get *error);
+
 /** @} */
 
 
@@ -2285,6 +2359,13 @@ typedef enum Tox_Err_File_Send {
      */
     TOX_ERR_FILE_SEND_TOO_MANY,
 
+    /**
+     * The file to be read by core was invalid: the file size was UINT64_MAX or
+     * the file descriptor was negative (only returned by `tox_file_send_fd` and
+     * `tox_file_send_mmap`).
+     */
+    TOX_ERR_FILE_SEND_BAD_SOURCE,
+
 } Tox_Err_File_Send;
 
 
@@ -2349,6 +2430,114 @@ typedef enum Tox_Err_File_Send {
 uint32_t tox_file_send(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t file_size, const uint8_t *file_id,
                        const uint8_t *filename, size_t filename_length, Tox_Err_File_Send *error);
 
+/**
+ * @brief Send a file transmission request for a file that core reads itself.
+ *
+ * This works like `tox_file_send`, but instead of requesting every chunk from
+ * the client through the `file_chunk_request` event, core reads the chunks
+ * directly from the file descriptor `fd` with pread() at their position in the
+ * file, starting at offset 0. This avoids a callback and a copy per chunk,
+ * which matters for large files.
+ *
+ * The `file_chunk_request` event is only triggered once, with length 0, when
+ * the transfer has finished. The descriptor is not closed by core; the client
+ * may close it after that event or after the transfer was cancelled by either
+ * side. Other kinds of transfers also end when the friend goes offline, but
+ * `TOX_FILE_KIND_FTV2` transfers continue after the friend comes back online,
+ * so their descriptor must stay open while the friend is offline. If reading
+ * fails, the transfer is cancelled and the `file_recv_control` event is
+ * triggered with `TOX_FILE_CONTROL_CANCEL`.
+ *
+ * Streaming (file_size = UINT64_MAX) is not supported.
+ *
+ * @param fd A file descriptor opened for reading that supports positioned reads.
+ *
+ * @return A file number, see `tox_file_send`.
+ */
+uint32_t tox_file_send_fd(Tox *tox, uint32_t friend_number, uint32_t kind, uint64_t file_size, const uint8_t *file_id,
+                          const uint8_t *filename, size_t filename_length, int fd, Tox_Err_File_Send *error);
+
+/**
+ * @brief Send a file transmission request for a file in memory.
+ *
+ * Like `tox_file_send_fd`, but core copies the chunks from `data`, which is
+ * typically a read-only mmap() of the file. `data` must hold `file_size` bytes
+ * and stay valid until the transfer has ended as described for `tox_file_send_fd`,
+ * which for `TOX_FILE_KIND_FTV2` includes the time the friend is offline.
+ *
+ * @param data The contents of the file. May be NULL if file_size is 0.
+ *
+ * @return A file number, see `tox_file_send`.
+ */
+uint32_t tox_file_send_mmap(Tox *tox, uint32_t friend_number, uint32_t kind, const uint8_t *data, uint64_t file_size,
+                            const uint8_t *file_id, const uint8_t *filename, size_t filename_length,
+                            Tox_Err_File_Send *error);
+
+/**
+ * @brief Priority of a file that is being sent.
+ *
+ * When several files are sent to the same friend, they take turns using the
+ * free space in the send queue. Per turn, a HIGH file may send 16 chunks, a
+ * NORMAL file 4 and a LOW file 1, so small files are not stuck behind large
+ * ones and no file is starved.
+ */
+typedef enum Tox_File_Priority {
+
+    /**
+     * Background transfers that may take the longest.
+     */
+    TOX_FILE_PRIORITY_LOW,
+
+    /**
+     * The default for TOX_FILE_KIND_DATA and TOX_FILE_KIND_FTV2 files.
+     */
+    TOX_FILE_PRIORITY_NORMAL,
+
+    /**
+     * The default for TOX_FILE_KIND_AVATAR and MessageV2 files.
+     */
+    TOX_FILE_PRIORITY_HIGH,
+
+} Tox_File_Priority;
+
+typedef enum Tox_Err_File_Set_Priority {
+
+    /**
+     * The function returned successfully.
+     */
+    TOX_ERR_FILE_SET_PRIORITY_OK,
+
+    /**
+     * The friend_number passed did not designate a valid friend.
+     */
+    TOX_ERR_FILE_SET_PRIORITY_FRIEND_NOT_FOUND,
+
+    /**
+     * No file transfer with the given file number is being sent to the friend.
+     */
+    TOX_ERR_FILE_SET_PRIORITY_NOT_FOUND,
+
+    /**
+     * The priority is not one of Tox_File_Priority.
+     */
+    TOX_ERR_FILE_SET_PRIORITY_BAD_PRIORITY,
+
+} Tox_Err_File_Set_Priority;
+
+/**
+ * @brief Change the priority of a file that is being sent.
+ *
+ * The priority can be changed at any time while the file transfer exists.
+ *
+ * @param friend_number The friend number of the friend the file is being sent to.
+ * @param file_number The file transfer identifier returned by tox_file_send.
+ * @param priority The new priority of the file transfer.
+ *
+ * @return true on success.
+ */
+bool tox_file_set_priority(Tox *tox, uint32_t friend_number, uint32_t file_number, Tox_File_Priority priority,
+                           Tox_Err_File_Set_Priority *error);
+
 typedef enum Tox_Err_File_Send_Chunk {
 
     /**
@@ -2524,6 +2713,94 @@ typedef void tox_file_recv_chunk_cb(Tox *tox, uint32_t friend_number, uint32_t f
  */
 void tox_callback_file_recv_chunk(Tox *tox, tox_file_recv_chunk_cb *callback);
 
+typedef enum Tox_Err_File_Recv_To_Fd {
+
+    /**
+     * The function returned successfully.
+     */
+    TOX_ERR_FILE_RECV_TO_FD_OK,
+
+    /**
+     * The friend_number passed did not designate a valid friend.
+     */
+    TOX_ERR_FILE_RECV_TO_FD_FRIEND_NOT_FOUND,
+
+    /**
+     * No incoming file transfer with the given file number was found for the
+     * given friend.
+     */
+    TOX_ERR_FILE_RECV_TO_FD_NOT_FOUND,
+
+    /**
+     * The file descriptor was negative.
+     */
+    TOX_ERR_FILE_RECV_TO_FD_BAD_FD,
+
+    /**
+     * Memory allocation failed.
+     */
+    TOX_ERR_FILE_RECV_TO_FD_MALLOC,
+
+} Tox_Err_File_Recv_To_Fd;
+
+
+/**
+ * @brief Let core write an incoming file to a file descriptor.
+ *
+ * Usually called from the `file_recv` callback before accepting the transfer.
+ * Core then collects the received chunks in a buffer and writes them with
+ * pwrite() at their position in the file, in large writes aligned to the
+ * buffer size. The `file_recv_chunk` event is not triggered for the chunks; it
+ * is only triggered once, with length 0, when the transfer has finished and
+ * all data was written. Progress is reported through the `file_recv_progress`
+ * event.
+ *
+ * For `TOX_FILE_KIND_FTV2` transfers, the file id is not written to the file.
+ *
+ * The descriptor is not closed by core. The client may close it after the
+ * `file_recv_chunk` event with length 0, or after cancelling the transfer or
+ * receiving a `TOX_FILE_CONTROL_CANCEL`. When the friend goes offline, the
+ * buffered data is written out. Other kinds of transfers end there, but
+ * `TOX_FILE_KIND_FTV2` transfers continue after the friend comes back online,
+ * so their descriptor must stay open while the friend is offline. If writing
+ * fails, the transfer is cancelled and the `file_recv_control` event is
+ * triggered with `TOX_FILE_CONTROL_CANCEL`.
+ *
+ * @param friend_number The friend number of the friend who is sending the file.
+ * @param file_number The friend-specific identifier for the file transfer.
+ * @param fd A file descriptor opened for writing that supports positioned writes.
+ * @param progress_interval Trigger the `file_recv_progress` event each time this
+ *   many more bytes were written. 0 to only report the end of the transfer.
+ * @param preallocate Reserve the announced file size on disk before writing,
+ *   where the platform supports it.
+ *
+ * @return true on success.
+ */
+bool tox_file_recv_to_fd(Tox *tox, uint32_t friend_number, uint32_t file_number, int fd, uint64_t progress_interval,
+                         bool preallocate, Tox_Err_File_Recv_To_Fd *error);
+
+/**
+ * @param friend_number The friend number of the friend who is sending the file.
+ * @param file_number The friend-specific file number of the transfer.
+ * @param bytes_written The file was written up to this position.
+ */
+typedef void tox_file_recv_progress_cb(Tox *tox, uint32_t friend_number, uint32_t file_number, uint64_t bytes_written,
+                                       void *user_data);
+
+
+/**
+ * @brief Set the callback for the `file_recv_progress` event.
+ *
+ * Pass NULL to unset.
+ *
+ * This event is triggered for transfers passed to `tox_file_recv_to_fd` each
+ * time the configured amount of data was written, and once when the whole
+ * file was written, right before the `file_recv_chunk` event with length 0.
+ * It is also triggered when the friend goes offline and the buffered data of
+ * the transfer was written out.
+ */
+void tox_callback_file_recv_progress(Tox *tox, tox_file_recv_progress_cb *callback);
+
 /** @} */
 
 
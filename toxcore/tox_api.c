@@ -125,6 +125,8 @@ ACCESSORS(void *, log_, user_data)
 ACCESSORS(bool,, local_discovery_enabled)
 ACCESSORS(bool,, dht_announcements_enabled)
 ACCESSORS(bool,, experimental_thread_safety)
+ACCESSORS(uint16_t,, experimental_handshake_threads)
+ACCESSORS(uint8_t,, experimental_group_relay_fanout)
 ACCESSORS(const Tox_System *,, operating_system)
 
 //!TOKSTYLE+
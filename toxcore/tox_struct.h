@@ -35,6 +35,7 @@ struct Tox {
     tox_file_chunk_request_cb *file_chunk_request_callback;
     tox_file_recv_cb *file_recv_callback;
     tox_file_recv_chunk_cb *file_recv_chunk_callback;
+    tox_file_recv_progress_cb *file_recv_progress_callback;
     tox_conference_invite_cb *conference_invite_callback;
     tox_conference_connected_cb *conference_connected_callback;
     tox_conference_message_cb *conference_message_callback;
@@ -0,0 +1,348 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Index of public keys ordered by XOR distance to any target key.
+ */
+#include "xor_index.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ccompat.h"
+#include "crypto_core.h"
+
+/** Entries are keyed by the public key followed by the big-endian value. */
+#define KEY_SIZE (CRYPTO_PUBLIC_KEY_SIZE + sizeof(uint32_t))
+#define KEY_BITS (KEY_SIZE * 8)
+
+/** Child references with this bit set point into the leaves array. */
+#define LEAF_FLAG 0x80000000
+#define NO_REF UINT32_MAX
+
+typedef struct Xor_Index_Leaf {
+    uint8_t key[KEY_SIZE];
+    uint32_t next_free;
+} Xor_Index_Leaf;
+
+typedef struct Xor_Index_Node {
+    /* Children for the critical bit being 0 and 1. The first one links the free list. */
+    uint32_t child[2];
+    /* Index of the first bit in which the keys of the two subtrees differ. */
+    uint16_t bit;
+} Xor_Index_Node;
+
+struct Xor_Index {
+    uint32_t root;
+
+    Xor_Index_Leaf *leaves;
+    uint32_t leaves_size;
+    uint32_t leaves_used;
+    uint32_t free_leaf;
+
+    Xor_Index_Node *nodes;
+    uint32_t nodes_size;
+    uint32_t nodes_used;
+    uint32_t free_node;
+
+    uint32_t count;
+};
+
+Xor_Index *xor_index_new(void)
+{
+    Xor_Index *index = (Xor_Index *)calloc(1, sizeof(Xor_Index));
+
+    if (index == nullptr) {
+        return nullptr;
+    }
+
+    index->root = NO_REF;
+    index->free_leaf = NO_REF;
+    index->free_node = NO_REF;
+    return index;
+}
+
+void xor_index_free(Xor_Index *index)
+{
+    if (index == nullptr) {
+        return;
+    }
+
+    free(index->nodes);
+    free(index->leaves);
+    free(index);
+}
+
+uint32_t xor_index_size(const Xor_Index *index)
+{
+    return index->count;
+}
+
+non_null()
+static void make_key(uint8_t *key, const uint8_t *public_key, uint32_t value)
+{
+    memcpy(key, public_key, CRYPTO_PUBLIC_KEY_SIZE);
+    key[CRYPTO_PUBLIC_KEY_SIZE] = (uint8_t)(value >> 24);
+    key[CRYPTO_PUBLIC_KEY_SIZE + 1] = (uint8_t)(value >> 16);
+    key[CRYPTO_PUBLIC_KEY_SIZE + 2] = (uint8_t)(value >> 8);
+    key[CRYPTO_PUBLIC_KEY_SIZE + 3] = (uint8_t)value;
+}
+
+non_null()
+static uint32_t key_value(const uint8_t *key)
+{
+    return ((uint32_t)key[CRYPTO_PUBLIC_KEY_SIZE] << 24)
+           | ((uint32_t)key[CRYPTO_PUBLIC_KEY_SIZE + 1] << 16)
+           | ((uint32_t)key[CRYPTO_PUBLIC_KEY_SIZE + 2] << 8)
+           | key[CRYPTO_PUBLIC_KEY_SIZE + 3];
+}
+
+non_null()
+static uint8_t key_bit(const uint8_t *key, uint16_t bit)
+{
+    return (key[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+/** @brief Take a leaf from the free list or the end of the array.
+ *
+ * @return NO_REF on allocation failure.
+ */
+non_null()
+static uint32_t alloc_leaf(Xor_Index *index)
+{
+    if (index->free_leaf != NO_REF) {
+        const uint32_t leaf = index->free_leaf;
+        index->free_leaf = index->leaves[leaf].next_free;
+        return leaf;
+    }
+
+    if (index->leaves_used == index->leaves_size) {
+        if (index->leaves_size >= LEAF_FLAG / 2) {
+            return NO_REF;
+        }
+
+        const uint32_t new_size = index->leaves_size == 0 ? 16 : index->leaves_size * 2;
+        Xor_Index_Leaf *leaves = (Xor_Index_Leaf *)realloc(index->leaves, new_size * sizeof(Xor_Index_Leaf));
+
+        if (leaves == nullptr) {
+            return NO_REF;
+        }
+
+        index->leaves = leaves;
+        index->leaves_size = new_size;
+    }
+
+    return index->leaves_used++;
+}
+
+non_null()
+static void release_leaf(Xor_Index *index, uint32_t leaf)
+{
+    index->leaves[leaf].next_free = index->free_leaf;
+    index->free_leaf = leaf;
+}
+
+/** @brief Take an internal node from the free list or the end of the array.
+ *
+ * @return NO_REF on allocation failure.
+ */
+non_null()
+static uint32_t alloc_node(Xor_Index *index)
+{
+    if (index->free_node != NO_REF) {
+        const uint32_t node = index->free_node;
+        index->free_node = index->nodes[node].child[0];
+        return node;
+    }
+
+    if (index->nodes_used == index->nodes_size) {
+        if (index->nodes_size >= LEAF_FLAG / 2) {
+            return NO_REF;
+        }
+
+        const uint32_t new_size = index->nodes_size == 0 ? 16 : index->nodes_size * 2;
+        Xor_Index_Node *nodes = (Xor_Index_Node *)realloc(index->nodes, new_size * sizeof(Xor_Index_Node));
+
+        if (nodes == nullptr) {
+            return NO_REF;
+        }
+
+        index->nodes = nodes;
+        index->nodes_size = new_size;
+    }
+
+    return index->nodes_used++;
+}
+
+non_null()
+static void release_node(Xor_Index *index, uint32_t node)
+{
+    index->nodes[node].child[0] = index->free_node;
+    index->free_node = node;
+}
+
+/** @brief Find the leaf sharing the longest prefix with `key` among those in the tree. */
+non_null()
+static const uint8_t *closest_leaf_key(const Xor_Index *index, const uint8_t *key)
+{
+    uint32_t ref = index->root;
+
+    while ((ref & LEAF_FLAG) == 0) {
+        const Xor_Index_Node *node = &index->nodes[ref];
+        ref = node->child[key_bit(key, node->bit)];
+    }
+
+    return index->leaves[ref & ~LEAF_FLAG].key;
+}
+
+bool xor_index_add(Xor_Index *index, const uint8_t *public_key, uint32_t value)
+{
+    uint8_t key[KEY_SIZE];
+    make_key(key, public_key, value);
+
+    if (index->root == NO_REF) {
+        const uint32_t leaf = alloc_leaf(index);
+
+        if (leaf == NO_REF) {
+            return false;
+        }
+
+        memcpy(index->leaves[leaf].key, key, KEY_SIZE);
+        index->root = leaf | LEAF_FLAG;
+        ++index->count;
+        return true;
+    }
+
+    const uint8_t *best = closest_leaf_key(index, key);
+    uint16_t bit = 0;
+
+    while (bit < KEY_BITS && best[bit / 8] == key[bit / 8]) {
+        bit += 8;
+    }
+
+    if (bit == KEY_BITS) {
+        return true;
+    }
+
+    const uint8_t diff = best[bit / 8] ^ key[bit / 8];
+
+    while ((diff & (0x80 >> (bit % 8))) == 0) {
+        ++bit;
+    }
+
+    // Allocate both before taking pointers into the arrays.
+    const uint32_t leaf = alloc_leaf(index);
+
+    if (leaf == NO_REF) {
+        return false;
+    }
+
+    const uint32_t node = alloc_node(index);
+
+    if (node == NO_REF) {
+        release_leaf(index, leaf);
+        return false;
+    }
+
+    memcpy(index->leaves[leaf].key, key, KEY_SIZE);
+
+    uint32_t *where = &index->root;
+
+    while ((*where & LEAF_FLAG) == 0) {
+        Xor_Index_Node *parent = &index->nodes[*where];
+
+        if (parent->bit > bit) {
+            break;
+        }
+
+        where = &parent->child[key_bit(key, parent->bit)];
+    }
+
+    const uint8_t dir = key_bit(key, bit);
+    Xor_Index_Node *new_node = &index->nodes[node];
+    new_node->bit = bit;
+    new_node->child[dir] = leaf | LEAF_FLAG;
+    new_node->child[1 - dir] = *where;
+    *where = node;
+
+    ++index->count;
+    return true;
+}
+
+bool xor_index_remove(Xor_Index *index, const uint8_t *public_key, uint32_t value)
+{
+    if (index->root == NO_REF) {
+        return false;
+    }
+
+    uint8_t key[KEY_SIZE];
+    make_key(key, public_key, value);
+
+    uint32_t *where = &index->root;
+    uint32_t *parent_where = nullptr;
+    uint8_t dir = 0;
+
+    while ((*where & LEAF_FLAG) == 0) {
+        parent_where = where;
+        Xor_Index_Node *node = &index->nodes[*where];
+        dir = key_bit(key, node->bit);
+        where = &node->child[dir];
+    }
+
+    const uint32_t leaf = *where & ~LEAF_FLAG;
+
+    if (memcmp(index->leaves[leaf].key, key, KEY_SIZE) != 0) {
+        return false;
+    }
+
+    release_leaf(index, leaf);
+
+    if (parent_where == nullptr) {
+        index->root = NO_REF;
+    } else {
+        const uint32_t parent = *parent_where;
+        *parent_where = index->nodes[parent].child[1 - dir];
+        release_node(index, parent);
+    }
+
+    --index->count;
+    return true;
+}
+
+void xor_index_closest(const Xor_Index *index, const uint8_t *public_key, xor_index_visit_cb *callback, void *object)
+{
+    if (index->root == NO_REF) {
+        return;
+    }
+
+    uint8_t target[KEY_SIZE];
+    make_key(target, public_key, 0);
+
+    // Critical bits strictly increase along any path, so the depth is bounded
+    // by the key length, and each level leaves at most one sibling behind.
+    uint32_t stack[KEY_BITS + 1];
+    uint32_t top = 0;
+    stack[top++] = index->root;
+
+    while (top > 0) {
+        const uint32_t ref = stack[--top];
+
+        if ((ref & LEAF_FLAG) != 0) {
+            const uint8_t *key = index->leaves[ref & ~LEAF_FLAG].key;
+
+            if (!callback(object, key, key_value(key))) {
+                return;
+            }
+
+            continue;
+        }
+
+        // The subtree agreeing with the target on the critical bit is closer
+        // than anything in the other one, so visit it first.
+        const Xor_Index_Node *node = &index->nodes[ref];
+        const uint8_t dir = key_bit(target, node->bit);
+        stack[top++] = node->child[1 - dir];
+        stack[top++] = node->child[dir];
+    }
+}
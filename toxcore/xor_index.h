@@ -0,0 +1,82 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief Index of public keys ordered by XOR distance to any target key.
+ *
+ * Entries are (public key, value) pairs kept in a crit-bit tree. Adding and
+ * removing an entry takes time proportional to the key length, independent of
+ * the number of entries, and a closest-first walk only visits the part of the
+ * tree it needs, so finding the k closest keys to a target costs about
+ * O(k + log n) instead of a scan over every key.
+ *
+ * The same public key may be stored several times with different values.
+ */
+#ifndef C_TOXCORE_TOXCORE_XOR_INDEX_H
+#define C_TOXCORE_TOXCORE_XOR_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "attributes.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct Xor_Index Xor_Index;
+
+/** @brief Called for each entry by xor_index_closest.
+ *
+ * The callback must not add or remove entries of the index being walked.
+ *
+ * @retval true to continue with the next closest entry.
+ * @retval false to stop the walk.
+ */
+typedef bool xor_index_visit_cb(void *object, const uint8_t *public_key, uint32_t value);
+
+/**
+ * @brief Create an empty index.
+ *
+ * @return pointer to allocated Xor_Index on success, nullptr on failure.
+ */
+Xor_Index *xor_index_new(void);
+
+/** @brief Free an index and all its entries. */
+nullable(1)
+void xor_index_free(Xor_Index *index);
+
+/** @brief Add the entry (public_key, value) unless it is already present.
+ *
+ * @retval true if the entry is in the index after the call.
+ * @retval false on allocation failure.
+ */
+non_null()
+bool xor_index_add(Xor_Index *index, const uint8_t *public_key, uint32_t value);
+
+/** @brief Remove the entry (public_key, value).
+ *
+ * @retval true if the entry was removed.
+ * @retval false if it was not in the index.
+ */
+non_null()
+bool xor_index_remove(Xor_Index *index, const uint8_t *public_key, uint32_t value);
+
+/** @brief Number of entries in the index. */
+non_null()
+uint32_t xor_index_size(const Xor_Index *index);
+
+/** @brief Visit entries in order of increasing XOR distance to `public_key`.
+ *
+ * Entries with the same public key are visited in increasing order of value.
+ * The walk stops after the last entry or when `callback` returns false.
+ */
+non_null(1, 2, 3) nullable(4)
+void xor_index_closest(const Xor_Index *index, const uint8_t *public_key, xor_index_visit_cb *callback, void *object);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,201 @@
+#include "xor_index.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "crypto_core.h"
+
+namespace {
+
+using PublicKey = std::array<uint8_t, CRYPTO_PUBLIC_KEY_SIZE>;
+using Entry = std::pair<PublicKey, uint32_t>;
+
+struct Walk {
+    std::vector<Entry> entries;
+    size_t limit;
+};
+
+bool record_entry(void *object, const uint8_t *public_key, uint32_t value)
+{
+    Walk *walk = static_cast<Walk *>(object);
+    PublicKey pk;
+    std::copy(public_key, public_key + CRYPTO_PUBLIC_KEY_SIZE, pk.begin());
+    walk->entries.emplace_back(pk, value);
+    return walk->entries.size() < walk->limit;
+}
+
+std::vector<Entry> closest(const Xor_Index *index, const PublicKey &target, size_t limit = SIZE_MAX)
+{
+    Walk walk{{}, limit};
+    xor_index_closest(index, target.data(), record_entry, &walk);
+    return walk.entries;
+}
+
+PublicKey random_pk(std::mt19937 &rng)
+{
+    PublicKey pk;
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    for (uint8_t &b : pk) {
+        b = static_cast<uint8_t>(byte(rng));
+    }
+
+    return pk;
+}
+
+/** Sort entries by XOR distance of the key to the target, then by value. */
+void sort_by_distance(std::vector<Entry> &entries, const PublicKey &target)
+{
+    std::sort(entries.begin(), entries.end(), [&target](const Entry &a, const Entry &b) {
+        for (size_t i = 0; i < CRYPTO_PUBLIC_KEY_SIZE; ++i) {
+            const uint8_t da = a.first[i] ^ target[i];
+            const uint8_t db = b.first[i] ^ target[i];
+
+            if (da != db) {
+                return da < db;
+            }
+        }
+
+        return a.second < b.second;
+    });
+}
+
+TEST(XorIndex, EmptyIndexVisitsNothing)
+{
+    Xor_Index *index = xor_index_new();
+    ASSERT_NE(index, nullptr);
+
+    EXPECT_EQ(xor_index_size(index), 0);
+    EXPECT_TRUE(closest(index, PublicKey{}).empty());
+    EXPECT_FALSE(xor_index_remove(index, PublicKey{}.data(), 0));
+
+    xor_index_free(index);
+}
+
+TEST(XorIndex, AddIsIdempotentAndRemoveIsExact)
+{
+    Xor_Index *index = xor_index_new();
+    ASSERT_NE(index, nullptr);
+
+    PublicKey pk{};
+    pk[0] = 0x42;
+
+    ASSERT_TRUE(xor_index_add(index, pk.data(), 1));
+    ASSERT_TRUE(xor_index_add(index, pk.data(), 1));
+    ASSERT_TRUE(xor_index_add(index, pk.data(), 2));
+    EXPECT_EQ(xor_index_size(index), 2);
+
+    EXPECT_FALSE(xor_index_remove(index, pk.data(), 3));
+    EXPECT_TRUE(xor_index_remove(index, pk.data(), 1));
+    EXPECT_FALSE(xor_index_remove(index, pk.data(), 1));
+    EXPECT_EQ(closest(index, PublicKey{}), (std::vector<Entry> {{pk, 2}}));
+
+    EXPECT_TRUE(xor_index_remove(index, pk.data(), 2));
+    EXPECT_EQ(xor_index_size(index), 0);
+    EXPECT_TRUE(closest(index, pk).empty());
+
+    xor_index_free(index);
+}
+
+TEST(XorIndex, StopsWhenCallbackReturnsFalse)
+{
+    Xor_Index *index = xor_index_new();
+    ASSERT_NE(index, nullptr);
+
+    std::mt19937 rng(1);
+
+    for (uint32_t i = 0; i < 20; ++i) {
+        ASSERT_TRUE(xor_index_add(index, random_pk(rng).data(), i));
+    }
+
+    EXPECT_EQ(closest(index, random_pk(rng), 4).size(), 4);
+
+    xor_index_free(index);
+}
+
+TEST(XorIndex, VisitsInOrderOfDistance)
+{
+    Xor_Index *index = xor_index_new();
+    ASSERT_NE(index, nullptr);
+
+    std::mt19937 rng(2);
+    std::vector<Entry> entries;
+
+    for (uint32_t i = 0; i < 500; ++i) {
+        const PublicKey pk = random_pk(rng);
+        entries.emplace_back(pk, i);
+        ASSERT_TRUE(xor_index_add(index, pk.data(), i));
+
+        // Some keys are stored more than once.
+        if (i % 7 == 0) {
+            entries.emplace_back(pk, i + 1000);
+            ASSERT_TRUE(xor_index_add(index, pk.data(), i + 1000));
+        }
+    }
+
+    // Remove a few, including duplicated keys.
+    for (size_t i = 0; i < entries.size(); i += 5) {
+        ASSERT_TRUE(xor_index_remove(index, entries[i].first.data(), entries[i].second));
+        entries[i].second = UINT32_MAX;
+    }
+
+    entries.erase(std::remove_if(entries.begin(), entries.end(),
+    [](const Entry &e) {
+        return e.second == UINT32_MAX;
+    }), entries.end());
+    ASSERT_EQ(xor_index_size(index), entries.size());
+
+    for (int round = 0; round < 20; ++round) {
+        // Alternate between random targets and keys in the index.
+        const PublicKey target = round % 2 == 0 ? random_pk(rng) : entries[round * 13].first;
+        sort_by_distance(entries, target);
+        EXPECT_EQ(closest(index, target), entries);
+    }
+
+    xor_index_free(index);
+}
+
+TEST(XorIndex, ReusesFreedEntries)
+{
+    Xor_Index *index = xor_index_new();
+    ASSERT_NE(index, nullptr);
+
+    std::mt19937 rng(3);
+
+    for (int round = 0; round < 50; ++round) {
+        std::vector<PublicKey> pks;
+
+        for (uint32_t i = 0; i < 32; ++i) {
+            pks.push_back(random_pk(rng));
+            ASSERT_TRUE(xor_index_add(index, pks.back().data(), i));
+        }
+
+        const PublicKey target = random_pk(rng);
+        const std::vector<Entry> found = closest(index, target, 1);
+        ASSERT_EQ(found.size(), 1);
+
+        std::vector<Entry> expected;
+
+        for (uint32_t i = 0; i < 32; ++i) {
+            expected.emplace_back(pks[i], i);
+        }
+
+        sort_by_distance(expected, target);
+        EXPECT_EQ(found[0], expected[0]);
+
+        for (uint32_t i = 0; i < 32; ++i) {
+            ASSERT_TRUE(xor_index_remove(index, pks[i].data(), i));
+        }
+
+        ASSERT_EQ(xor_index_size(index), 0);
+    }
+
+    xor_index_free(index);
+}
+
+}  // namespace
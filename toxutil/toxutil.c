@@ -38,8 +38,10 @@
 #include "../toxcore/util.h"
 #include "../toxcore/tox.h"
 #include "toxutil.h"
+#include "toxutil_map.h"
 
 #include <assert.h>
+#include <pthread.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -51,40 +53,18 @@
 
 // #define TOX_UTIL_EXPIRE_FT_MS 50000 // msgV2 FTs should expire after 50 seconds
 
-typedef struct tox_utils_Node {
-    uint8_t key[TOX_PUBLIC_KEY_SIZE];
-    uint32_t key2;
-    void *data;
-    struct tox_utils_Node *next;
-} tox_utils_Node;
-
-typedef struct tox_utils_List {
-    uint32_t size;
-    tox_utils_Node *head;
-} tox_utils_List;
-
-
-static tox_utils_List global_friend_capability_list;
-
-typedef struct global_friend_capability_entry {
-    bool msgv2_cap;
-} global_friend_capability_entry;
-
-
-static tox_utils_List global_msgv2_incoming_ft_list;
-
 typedef struct global_msgv2_incoming_ft_entry {
     uint32_t friend_number;
     uint32_t file_number;
     uint32_t kind;
     uint64_t file_size;
     uint32_t timestamp;
-    uint8_t msg_data[TOX_MAX_FILETRANSFER_SIZE_MSGV2];
+    bool spill; // chunks go straight to the spill callback, msg_data is empty
+    struct global_msgv2_incoming_ft_entry *next; // only used while dropping entries
+    uint32_t buffered; // bytes allocated for msg_data, counted against the memory budget
+    uint8_t msg_data[];
 } global_msgv2_incoming_ft_entry;
 
-
-static tox_utils_List global_msgv2_outgoing_ft_list;
-
 typedef struct global_msgv2_outgoing_ft_entry {
     uint32_t friend_number;
     uint32_t file_number;
@@ -94,8 +74,32 @@ typedef struct global_msgv2_outgoing_ft_entry {
     uint8_t msg_data[TOX_MAX_FILETRANSFER_SIZE_MSGV2];
 } global_msgv2_outgoing_ft_entry;
 
+/*
+ * The toxutil state of one Tox instance. Created by tox_utils_new (or by the
+ * first callback for a Tox instance that was created with tox_new) and freed by
+ * tox_utils_kill.
+ */
+typedef struct tox_utils_Friend {
+    bool msgv2_cap;
+    uint64_t msgv2_buffered; // bytes buffered for incoming msgV2 FTs of this friend
+} tox_utils_Friend;
+
+typedef struct tox_utils_State {
+    const Tox *tox;
+    pthread_mutex_t mutex[1]; // protects everything below except next
+    tox_utils_Map incoming_ft;
+    tox_utils_Map outgoing_ft;
+    tox_utils_Friend *friends; // indexed by friend number
+    uint32_t friends_size;
+    uint64_t msgv2_budget;
+    uint64_t msgv2_buffered; // sum of msgv2_buffered of all friends
+    struct tox_utils_State *next;
+} tox_utils_State;
+
+static tox_utils_State *global_tox_utils_states = NULL;
+static pthread_mutex_t global_tox_utils_states_mutex = PTHREAD_MUTEX_INITIALIZER;
+
 static uint16_t global_ts_ms = 0;
-static pthread_mutex_t mutex_tox_util[1];
 
 // ------------ UTILS ------------
 
@@ -114,16 +118,6 @@ static int timed_out(time_t timestamp, time_t timeout)
 }
 #endif
 
-/* compares 2 items of length len (e.g.: Tox Pubkeys)
-   Returns 0 if they are the same, 1 if they differ
- */
-static int check_file_signature(const uint8_t *pubkey1, const uint8_t *pubkey2, size_t len)
-{
-    int ret = memcmp(pubkey1, pubkey2, len);
-    return ret == 0 ? 0 : 1;
-}
-
-
 #if 0
 /**
  * @fn
@@ -180,191 +174,173 @@ get_hex(char *buf, int buf_len, char *hex_, int hex_len, int num_col)
 #endif
 
 
-
-static void tox_utils_list_init(tox_utils_List *l)
+/* Returns the toxutil state of this Tox instance, creating it on first use.
+   Returns NULL on allocation failure. */
+static tox_utils_State *tox_utils_get_state(const Tox *tox)
 {
-    pthread_mutex_lock(mutex_tox_util);
-    l->size = 0;
-    l->head = NULL;
-    pthread_mutex_unlock(mutex_tox_util);
-}
+    pthread_mutex_lock(&global_tox_utils_states_mutex);
 
-static void tox_utils_list_clear(tox_utils_List *l)
-{
-    pthread_mutex_lock(mutex_tox_util);
-
-    tox_utils_Node *head = l->head;
-    tox_utils_Node *next_ = NULL;
+    tox_utils_State *s = global_tox_utils_states;
 
-    while (head) {
-        next_ = head->next;
+    while (s != NULL && s->tox != tox) {
+        s = s->next;
+    }
 
-        l->size--;
-        l->head = next_;
+    if (s == NULL) {
+        s = (tox_utils_State *)calloc(1, sizeof(tox_utils_State));
 
-        if (head->data) {
-            free(head->data);
+        if (s != NULL) {
+            if (pthread_mutex_init(s->mutex, NULL) != 0) {
+                free(s);
+                s = NULL;
+            } else {
+                s->tox = tox;
+                s->msgv2_budget = TOX_UTILS_MSGV2_DEFAULT_MEMORY_BUDGET;
+                s->next = global_tox_utils_states;
+                global_tox_utils_states = s;
+            }
         }
-
-        free(head);
-        head = next_;
     }
 
-    l->size = 0;
-    l->head = NULL;
+    pthread_mutex_unlock(&global_tox_utils_states_mutex);
 
-    pthread_mutex_unlock(mutex_tox_util);
+    return s;
 }
 
-
-static void tox_utils_list_add(tox_utils_List *l, uint8_t *key, uint32_t key2, void *data)
+static void tox_utils_free_state(const Tox *tox)
 {
-    pthread_mutex_lock(mutex_tox_util);
-
-    tox_utils_Node *n = (tox_utils_Node *)calloc(1, sizeof(tox_utils_Node));
+    pthread_mutex_lock(&global_tox_utils_states_mutex);
 
-    memcpy(n->key, key, TOX_PUBLIC_KEY_SIZE);
-    n->key2 = key2;
-    n->data = data;
+    tox_utils_State **prev = &global_tox_utils_states;
 
-    if (l->head == NULL) {
-        n->next = NULL;
-    } else {
-        n->next = l->head;
+    while (*prev != NULL && (*prev)->tox != tox) {
+        prev = &(*prev)->next;
     }
 
-    l->head = n;
-    l->size++;
-
-    pthread_mutex_unlock(mutex_tox_util);
-}
+    tox_utils_State *s = *prev;
 
-static tox_utils_Node *tox_utils_list_get(tox_utils_List *l, uint8_t *key, uint32_t key2)
-{
-    pthread_mutex_lock(mutex_tox_util);
-
-    tox_utils_Node *head = l->head;
+    if (s != NULL) {
+        *prev = s->next;
+    }
 
-    while (head) {
-        if (head->key2 == key2) {
-            if (check_file_signature(head->key, key, TOX_PUBLIC_KEY_SIZE) == 0) {
-                pthread_mutex_unlock(mutex_tox_util);
-                return head;
-            }
-        }
+    pthread_mutex_unlock(&global_tox_utils_states_mutex);
 
-        head = head->next;
+    if (s == NULL) {
+        return;
     }
 
-    pthread_mutex_unlock(mutex_tox_util);
-    return NULL;
+    tox_utils_map_clear(&s->incoming_ft);
+    tox_utils_map_clear(&s->outgoing_ft);
+    free(s->friends);
+    pthread_mutex_destroy(s->mutex);
+    free(s);
 }
 
-static void tox_utils_list_remove_single_node(tox_utils_List *l, tox_utils_Node *n, tox_utils_Node *n_minus_1)
+/* Returns the per friend state, NULL if there is none yet and create is false or on allocation
+   failure. Must be called with the state lock held. */
+static tox_utils_Friend *tox_utils_get_friend(tox_utils_State *s, uint32_t friend_number, bool create)
 {
-    if (!l) {
-        return;
+    if (friend_number < s->friends_size) {
+        return &s->friends[friend_number];
     }
 
-    if (!n) {
-        return;
+    if (!create) {
+        return NULL;
     }
 
-    if (n_minus_1 == NULL) {
-        // want to delete the first node
-        l->head = n->next;
+    const uint32_t new_size = friend_number + 1;
+    tox_utils_Friend *new_friends = (tox_utils_Friend *)realloc(s->friends, new_size * sizeof(tox_utils_Friend));
 
-        if (n->data) {
-            free(n->data);
-        }
-
-        free(n);
-        l->size--;
-        n = NULL;
-        return;
-    } else {
-        n_minus_1->next = n->next;
-
-        if (n->data) {
-            free(n->data);
-        }
-
-        free(n);
-        l->size--;
-        n = NULL;
+    if (new_friends == NULL) {
+        return NULL;
     }
 
-}
+    memset(new_friends + s->friends_size, 0, (new_size - s->friends_size) * sizeof(tox_utils_Friend));
+    s->friends = new_friends;
+    s->friends_size = new_size;
 
-static void tox_utils_list_remove(tox_utils_List *l, uint8_t *key, uint32_t key2)
-{
-    pthread_mutex_lock(mutex_tox_util);
-
-    tox_utils_Node *head = l->head;
-    tox_utils_Node *prev_ = NULL;
-    tox_utils_Node *next_ = NULL;
-
-    while (head) {
-        next_ = head->next;
-
-        if (head->key2 == key2) {
-            if (check_file_signature(head->key, key, TOX_PUBLIC_KEY_SIZE) == 0) {
-                tox_utils_list_remove_single_node(l, head, prev_);
-                // start from beginning of the list
-                head = l->head;
-                prev_ = NULL;
-                next_ = NULL;
-                continue;
-            }
-        }
-
-        prev_ = head;
-        head = next_;
-    }
-
-    pthread_mutex_unlock(mutex_tox_util);
+    return &s->friends[friend_number];
 }
 
-static void tox_utils_list_remove_2(tox_utils_List *l, uint8_t *key)
+/* Give the memory of an incoming FT back to the budget. Must be called with the state lock held. */
+static void tox_utils_release_incoming_ft(tox_utils_State *s, const global_msgv2_incoming_ft_entry *e)
 {
-    pthread_mutex_lock(mutex_tox_util);
-
-    tox_utils_Node *head = l->head;
-    tox_utils_Node *prev_ = NULL;
-    tox_utils_Node *next_ = NULL;
-
-    while (head) {
-        next_ = head->next;
-
-        if (check_file_signature(head->key, key, TOX_PUBLIC_KEY_SIZE) == 0) {
-            tox_utils_list_remove_single_node(l, head, prev_);
-            // start from beginning of the list
-            head = l->head;
-            prev_ = NULL;
-            next_ = NULL;
-            continue;
-        }
+    tox_utils_Friend *f = tox_utils_get_friend(s, e->friend_number, false);
 
-        prev_ = head;
-        head = next_;
+    if (f != NULL) {
+        f->msgv2_buffered -= e->buffered;
     }
 
-    pthread_mutex_unlock(mutex_tox_util);
+    s->msgv2_buffered -= e->buffered;
 }
 
-// ------------ UTILS ------------
+typedef struct tox_utils_Taken_Fts {
+    tox_utils_State *s;
+    global_msgv2_incoming_ft_entry *taken;
+} tox_utils_Taken_Fts;
 
+static void tox_utils_take_incoming_ft(void *data, void *user_data)
+{
+    tox_utils_Taken_Fts *t = (tox_utils_Taken_Fts *)user_data;
+    global_msgv2_incoming_ft_entry *e = (global_msgv2_incoming_ft_entry *)data;
+    tox_utils_release_incoming_ft(t->s, e);
+    e->next = t->taken;
+    t->taken = e;
+}
 
+/* Take the incoming FTs of one friend (or of all friends) out of the map and return them chained
+   through their next pointer. Must be called with the state lock held. */
+static global_msgv2_incoming_ft_entry *tox_utils_take_incoming_fts(tox_utils_State *s, bool all_friends,
+        uint32_t friend_number)
+{
+    tox_utils_Taken_Fts t = {s, NULL};
+    tox_utils_map_take_friend(&s->incoming_ft, all_friends, friend_number, tox_utils_take_incoming_ft, &t);
+    return t.taken;
+}
 
+/* Remember an outgoing msgV2 FT so we can answer its chunk requests. */
+static bool tox_utils_add_outgoing_ft(Tox *tox, uint32_t friend_number, uint32_t file_number,
+                                      uint32_t kind, const uint8_t *raw_message, uint32_t raw_msg_len)
+{
+    tox_utils_State *s = tox_utils_get_state(tox);
 
+    if (s == NULL) {
+        return false;
+    }
 
+    global_msgv2_outgoing_ft_entry *data = (global_msgv2_outgoing_ft_entry *)malloc(sizeof(global_msgv2_outgoing_ft_entry));
 
+    if (data == NULL) {
+        return false;
+    }
 
+    data->friend_number = friend_number;
+    data->file_number = file_number;
+    data->kind = kind;
+    data->file_size = raw_msg_len;
+    Messenger *m = *(Messenger **)tox;
+    data->timestamp = current_time_monotonic(m->mono_time);
 
+    if (raw_msg_len <= TOX_MAX_FILETRANSFER_SIZE_MSGV2) {
+        memcpy(data->msg_data, raw_message, raw_msg_len);
+    } else {
+        // HINT: this should never happen
+        memcpy(data->msg_data, raw_message, TOX_MAX_FILETRANSFER_SIZE_MSGV2);
+        data->file_size = TOX_MAX_FILETRANSFER_SIZE_MSGV2;
+    }
 
+    pthread_mutex_lock(s->mutex);
+    bool res = tox_utils_map_put(&s->outgoing_ft, friend_number, file_number, data);
+    pthread_mutex_unlock(s->mutex);
 
+    if (!res) {
+        free(data);
+    }
 
+    return res;
+}
 
+// ------------ UTILS ------------
 
 // ----------- FUNCS -----------
 #if 0
@@ -381,12 +357,6 @@ static int64_t tox_utils_pubkey_to_friendnum(Tox *tox, const uint8_t *public_key
 }
 #endif
 
-static bool tox_utils_friendnum_to_pubkey(Tox *tox, uint8_t *public_key, uint32_t friend_number)
-{
-    TOX_ERR_FRIEND_GET_PUBLIC_KEY error;
-    return tox_friend_get_public_key(tox, friend_number, public_key, &error);
-}
-
 static bool tox_utils_get_capabilities(Tox *tox, uint32_t friendnumber)
 {
 
@@ -399,61 +369,46 @@ static bool tox_utils_get_capabilities(Tox *tox, uint32_t friendnumber)
         return true;
     }
 
-    uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-    if (friend_pubkey) {
-        bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friendnumber);
-
-        if (res == true) {
-            tox_utils_Node *n = tox_utils_list_get(&global_friend_capability_list, friend_pubkey, 0);
-
-            if (n != NULL) {
-                free(friend_pubkey);
-                return ((global_friend_capability_entry *)(n->data))->msgv2_cap;
-            }
-        }
+    tox_utils_State *s = tox_utils_get_state(tox);
 
-        free(friend_pubkey);
+    if (s == NULL) {
+        return false;
     }
 
-    return false;
+    pthread_mutex_lock(s->mutex);
+    const tox_utils_Friend *f = tox_utils_get_friend(s, friendnumber, false);
+    const bool cap = f != NULL && f->msgv2_cap;
+    pthread_mutex_unlock(s->mutex);
+
+    return cap;
 }
 
 static void tox_utils_set_capabilities(Tox *tox, uint32_t friendnumber, bool cap)
 {
-    uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
+    tox_utils_State *s = tox_utils_get_state(tox);
 
-    if (friend_pubkey) {
-        bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friendnumber);
+    if (s == NULL) {
+        return;
+    }
 
-        if (res == true) {
-            global_friend_capability_entry *data = (global_friend_capability_entry *)calloc(1, sizeof(global_friend_capability_entry));
-            data->msgv2_cap = cap;
+    pthread_mutex_lock(s->mutex);
 
-            tox_utils_Node *n = tox_utils_list_get(&global_friend_capability_list, friend_pubkey, 0);
+    tox_utils_Friend *f = tox_utils_get_friend(s, friendnumber, cap);
 
-            if (n == NULL) {
-                if (cap == true) {
-                    tox_utils_list_add(&global_friend_capability_list, friend_pubkey, 0, data);
-                    // TODO(iphydf): Don't rely on toxcore internals.
-                    Messenger *m;
-                    m = *(Messenger **)tox;
-                    LOGGER_WARNING(m->log, "toxutil:set_capabilities(add:1)");
-                }
-            } else {
-                tox_utils_list_remove(&global_friend_capability_list, friend_pubkey, 0);
-                Messenger *m = *(Messenger **)tox;
-                LOGGER_WARNING(m->log, "toxutil:set_capabilities(rm)");
-
-                if (cap == true) {
-                    tox_utils_list_add(&global_friend_capability_list, friend_pubkey, 0, data);
-                    Messenger *m2 = *(Messenger **)tox;
-                    LOGGER_WARNING(m2->log, "toxutil:set_capabilities(add:2)");
-                }
-            }
-        }
+    if (f == NULL) {
+        pthread_mutex_unlock(s->mutex);
+        return;
+    }
+
+    const bool changed = f->msgv2_cap != cap;
+    f->msgv2_cap = cap;
 
-        free(friend_pubkey);
+    pthread_mutex_unlock(s->mutex);
+
+    if (changed) {
+        // TODO(iphydf): Don't rely on toxcore internals.
+        Messenger *m = *(Messenger **)tox;
+        LOGGER_WARNING(m->log, "toxutil:set_capabilities(%d)", (int)cap);
     }
 }
 
@@ -492,104 +447,6 @@ static void tox_utils_receive_capabilities(Tox *tox, uint32_t friendnumber, cons
     }
 }
 
-static void tox_utils_housekeeping(Tox *tox)
-{
-#if 0
-
-    pthread_mutex_lock(mutex_tox_util);
-
-    // cancel and clear old outgoing FTs ----------------
-    tox_utils_List *l = &global_msgv2_outgoing_ft_list;
-
-    tox_utils_Node *head = l->head;
-    tox_utils_Node *next_ = NULL;
-
-    while (head) {
-        next_ = head->next;
-
-        if (head->data) {
-            global_msgv2_outgoing_ft_entry *e = ((global_msgv2_outgoing_ft_entry *)(head->data));
-
-            Messenger *m = *(Messenger **)tox;
-
-            if ((e->timestamp + TOX_UTIL_EXPIRE_FT_MS) < current_time_monotonic(m->mono_time)) {
-                // cancel FT
-                uint32_t friend_number = e->friend_number;
-                uint32_t file_number = e->file_number;
-
-                bool res = tox_file_control(tox, friend_number, file_number,
-                                            (TOX_FILE_CONTROL)TOX_FILE_CONTROL_CANCEL, NULL);
-
-                if (res == true) {
-                    // remove FT from list
-                    if (head->data) {
-                        free(head->data);
-                    }
-
-                    l->size--;
-                    l->head = next_;
-                    free(head);
-
-                    break;
-                }
-            }
-        }
-
-        l->head = next_;
-        head = next_;
-    }
-
-    // cancel and clear old outgoing FTs ----------------
-
-
-
-    // cancel and clear old incoming FTs ----------------
-    l = &global_msgv2_incoming_ft_list;
-
-    head = l->head;
-    next_ = NULL;
-
-    while (head) {
-        next_ = head->next;
-
-        if (head->data) {
-            global_msgv2_incoming_ft_entry *e = ((global_msgv2_incoming_ft_entry *)(head->data));
-
-            Messenger *m = *(Messenger **)tox;
-
-            if ((e->timestamp + TOX_UTIL_EXPIRE_FT_MS) < current_time_monotonic(m->mono_time)) {
-                // cancel FT
-                uint32_t friend_number = e->friend_number;
-                uint32_t file_number = e->file_number;
-
-                bool res = tox_file_control(tox, friend_number, file_number,
-                                            (TOX_FILE_CONTROL)TOX_FILE_CONTROL_CANCEL, NULL);
-
-                if (res == true) {
-                    // remove FT from list
-                    if (head->data) {
-                        free(head->data);
-                    }
-
-                    l->size--;
-                    l->head = next_;
-                    free(head);
-
-                    break;
-                }
-            }
-        }
-
-        l->head = next_;
-        head = next_;
-    }
-
-    pthread_mutex_unlock(mutex_tox_util);
-
-    // cancel and clear old incoming FTs ----------------
-#endif
-}
-
 // ----------- FUNCS -----------
 
 
@@ -692,52 +549,135 @@ void tox_utils_callback_friend_read_receipt_message_v2(Tox *tox,
             const uint8_t *))callback;
 }
 
+tox_util_friend_message_v2_spill_cb *tox_utils_friend_message_v2_spill = NULL;
+
+void tox_utils_callback_friend_message_v2_spill(Tox *tox, tox_util_friend_message_v2_spill_cb *callback)
+{
+    tox_utils_friend_message_v2_spill = callback;
+}
+
+
+void tox_utils_set_msgv2_memory_budget(Tox *tox, uint64_t budget)
+{
+    tox_utils_State *s = tox_utils_get_state(tox);
+
+    if (s == NULL) {
+        return;
+    }
+
+    // FTs that are already buffered keep their memory, only new ones see the new budget
+    pthread_mutex_lock(s->mutex);
+    s->msgv2_budget = budget;
+    pthread_mutex_unlock(s->mutex);
+}
+
+uint64_t tox_utils_get_msgv2_buffered_bytes(const Tox *tox)
+{
+    tox_utils_State *s = tox_utils_get_state(tox);
+
+    if (s == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(s->mutex);
+    const uint64_t buffered = s->msgv2_buffered;
+    pthread_mutex_unlock(s->mutex);
+
+    return buffered;
+}
+
+uint64_t tox_utils_friend_get_msgv2_buffered_bytes(const Tox *tox, uint32_t friend_number)
+{
+    tox_utils_State *s = tox_utils_get_state(tox);
+
+    if (s == NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(s->mutex);
+    const tox_utils_Friend *f = tox_utils_get_friend(s, friend_number, false);
+    const uint64_t buffered = f != NULL ? f->msgv2_buffered : 0;
+    pthread_mutex_unlock(s->mutex);
+
+    return buffered;
+}
+
+/* Free incoming FTs that were taken out of the map before they were complete. Spilled FTs
+   are reported as aborted, so the application can drop what it collected. */
+static void tox_utils_drop_incoming_fts(Tox *tox, global_msgv2_incoming_ft_entry *e)
+{
+    while (e != NULL) {
+        global_msgv2_incoming_ft_entry *next = e->next;
+
+        if (e->spill && tox_utils_friend_message_v2_spill) {
+            tox_utils_friend_message_v2_spill(tox, e->friend_number, e->file_number, e->kind,
+                                              e->file_size, 0, NULL, 0, true);
+        }
+
+        free(e);
+        e = next;
+    }
+}
+
+/* Forget all FTs and the capabilities of one friend. */
+static void tox_utils_forget_friend(Tox *tox, uint32_t friend_number)
+{
+    tox_utils_State *s = tox_utils_get_state(tox);
+
+    if (s == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(s->mutex);
+
+    global_msgv2_incoming_ft_entry *dropped = tox_utils_take_incoming_fts(s, false, friend_number);
+    tox_utils_map_remove_friend(&s->outgoing_ft, friend_number);
+
+    tox_utils_Friend *f = tox_utils_get_friend(s, friend_number, false);
+
+    if (f != NULL) {
+        f->msgv2_cap = false;
+    }
+
+    pthread_mutex_unlock(s->mutex);
+
+    tox_utils_drop_incoming_fts(tox, dropped);
+}
+
 
 Tox *tox_utils_new(const struct Tox_Options *options, TOX_ERR_NEW *error)
 {
-    if (pthread_mutex_init(mutex_tox_util, NULL) != 0) {
+    // ATTENTION: we only have a mono_time instance after this call returns!!
+    Tox *tox = tox_new(options, error);
+
+    if (tox == NULL) {
+        return NULL;
+    }
+
+    if (tox_utils_get_state(tox) == NULL) {
+        tox_kill(tox);
+
         if (error) {
-            // TODO: find a better error code, use malloc error for now
             *error = TOX_ERR_NEW_MALLOC;
         }
 
         return NULL;
     }
 
-    tox_utils_list_init(&global_friend_capability_list);
-    tox_utils_list_init(&global_msgv2_incoming_ft_list);
-    tox_utils_list_init(&global_msgv2_outgoing_ft_list);
-
-    // ATTENTION: we only have a mono_time instance after this call returns!!
-    return tox_new(options, error);
+    return tox;
 }
 
 void tox_utils_kill(Tox *tox)
 {
-    tox_utils_list_clear(&global_friend_capability_list);
-    tox_utils_list_clear(&global_msgv2_incoming_ft_list);
-    tox_utils_list_clear(&global_msgv2_outgoing_ft_list);
+    tox_utils_free_state(tox);
 
     tox_kill(tox);
-
-    pthread_mutex_destroy(mutex_tox_util);
 }
 
 bool tox_utils_friend_delete(Tox *tox, uint32_t friend_number, TOX_ERR_FRIEND_DELETE *error)
 {
-    // clear all FTs of this friend from incmoning/outgoing FT lists
-    uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-    if (friend_pubkey) {
-        bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-        if (res == true) {
-            tox_utils_list_remove_2(&global_msgv2_incoming_ft_list, friend_pubkey);
-            tox_utils_list_remove_2(&global_msgv2_outgoing_ft_list, friend_pubkey);
-        }
-
-        free(friend_pubkey);
-    }
+    // clear all FTs of this friend from incmoning/outgoing FT maps
+    tox_utils_forget_friend(tox, friend_number);
 
     return tox_friend_delete(tox, friend_number, error);
 }
@@ -768,8 +708,16 @@ void tox_utils_self_connection_status_cb(Tox *tox,
     // ------- do messageV2 stuff -------
     if (connection_status == TOX_CONNECTION_NONE) {
         // if we go offline ourselves, remove all FT data
-        tox_utils_list_clear(&global_msgv2_incoming_ft_list);
-        tox_utils_list_clear(&global_msgv2_outgoing_ft_list);
+        tox_utils_State *s = tox_utils_get_state(tox);
+
+        if (s != NULL) {
+            pthread_mutex_lock(s->mutex);
+            global_msgv2_incoming_ft_entry *dropped = tox_utils_take_incoming_fts(s, true, 0);
+            tox_utils_map_clear(&s->outgoing_ft);
+            pthread_mutex_unlock(s->mutex);
+
+            tox_utils_drop_incoming_fts(tox, dropped);
+        }
     }
 
     // ------- do messageV2 stuff -------
@@ -790,21 +738,8 @@ void tox_utils_friend_connection_status_cb(Tox *tox, uint32_t friendnumber,
 {
     // ------- do messageV2 stuff -------
     if (connection_status == TOX_CONNECTION_NONE) {
-        tox_utils_set_capabilities(tox, friendnumber, false);
-
-        // remove FT data from list
-        uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-        if (friend_pubkey) {
-            bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friendnumber);
-
-            if (res == true) {
-                tox_utils_list_remove_2(&global_msgv2_incoming_ft_list, friend_pubkey);
-                tox_utils_list_remove_2(&global_msgv2_outgoing_ft_list, friend_pubkey);
-            }
-
-            free(friend_pubkey);
-        }
+        // remove FT data and capabilities of this friend
+        tox_utils_forget_friend(tox, friendnumber);
     } else {
         tox_utils_send_capabilities(tox, friendnumber);
     }
@@ -821,61 +756,50 @@ void tox_utils_friend_connection_status_cb(Tox *tox, uint32_t friendnumber,
     // ------- call the real CB function -------
 }
 
+static bool tox_utils_is_msgv2_kind(uint32_t kind)
+{
+    return (kind == TOX_FILE_KIND_MESSAGEV2_SEND)
+           || (kind == TOX_FILE_KIND_MESSAGEV2_ANSWER)
+           || (kind == TOX_FILE_KIND_MESSAGEV2_SYNC);
+}
 
 void tox_utils_file_recv_control_cb(Tox *tox, uint32_t friend_number, uint32_t file_number,
                                     TOX_FILE_CONTROL control, void *user_data)
 {
     // ------- do messageV2 stuff -------
     if (control == TOX_FILE_CONTROL_CANCEL) {
-        uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-        if (friend_pubkey) {
-            bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-            if (res == true) {
-                tox_utils_Node *n = tox_utils_list_get(&global_msgv2_outgoing_ft_list,
-                                                       friend_pubkey, file_number);
-
-                if (n != NULL) {
-                    if (
-                        (((global_msgv2_outgoing_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SEND)
-                        ||
-                        (((global_msgv2_outgoing_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_ANSWER)
-                        ||
-                        (((global_msgv2_outgoing_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SYNC)
-                    ) {
-                        // remove FT data from list
-                        tox_utils_list_remove(&global_msgv2_outgoing_ft_list,
-                                              friend_pubkey, file_number);
-
-                        free(friend_pubkey);
-                        return;
-                    }
-                }
+        tox_utils_State *s = tox_utils_get_state(tox);
 
-                n = tox_utils_list_get(&global_msgv2_incoming_ft_list,
-                                       friend_pubkey, file_number);
-
-                if (n != NULL) {
-                    if (
-                        (((global_msgv2_incoming_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SEND)
-                        ||
-                        (((global_msgv2_incoming_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_ANSWER)
-                        ||
-                        (((global_msgv2_incoming_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SYNC)
-                    ) {
-                        // remove FT data from list
-                        tox_utils_list_remove(&global_msgv2_incoming_ft_list,
-                                              friend_pubkey, file_number);
-
-                        free(friend_pubkey);
-                        return;
-                    }
-                }
+        if (s != NULL) {
+            pthread_mutex_lock(s->mutex);
+
+            // remove FT data from map
+            bool found = false;
+            global_msgv2_incoming_ft_entry *dropped = NULL;
+            tox_utils_Map_Slot *slot = tox_utils_map_find(&s->outgoing_ft, friend_number, file_number);
 
+            if (slot != NULL
+                    && tox_utils_is_msgv2_kind(((global_msgv2_outgoing_ft_entry *)(slot->data))->kind)) {
+                tox_utils_map_remove(&s->outgoing_ft, friend_number, file_number);
+                found = true;
+            } else {
+                dropped = (global_msgv2_incoming_ft_entry *)tox_utils_map_take(&s->incoming_ft, friend_number,
+                          file_number);
+
+                if (dropped != NULL) {
+                    tox_utils_release_incoming_ft(s, dropped);
+                    dropped->next = NULL;
+                    found = true;
+                }
             }
 
-            free(friend_pubkey);
+            pthread_mutex_unlock(s->mutex);
+
+            tox_utils_drop_incoming_fts(tox, dropped);
+
+            if (found) {
+                return;
+            }
         }
     }
 
@@ -896,52 +820,35 @@ void tox_utils_file_chunk_request_cb(Tox *tox, uint32_t friend_number, uint32_t
                                      uint64_t position, size_t length, void *user_data)
 {
     // ------- do messageV2 stuff -------
-    uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-    if (friend_pubkey) {
-        bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-        if (res == true) {
-            tox_utils_Node *n = tox_utils_list_get(&global_msgv2_outgoing_ft_list,
-                                                   friend_pubkey, file_number);
-
-            if (n != NULL) {
-                if (
-                    (((global_msgv2_outgoing_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SEND)
-                    ||
-                    (((global_msgv2_outgoing_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_ANSWER)
-                    ||
-                    (((global_msgv2_outgoing_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SYNC)
-                ) {
-                    if (length == 0) {
-                        // FT finished
-                        // remove FT data from list
-                        tox_utils_list_remove(&global_msgv2_outgoing_ft_list,
-                                              friend_pubkey, file_number);
-                    } else {
-                        uint8_t *data_ = ((uint8_t *)((global_msgv2_outgoing_ft_entry *)(n->data))->msg_data);
-                        uint64_t filesize = ((global_msgv2_outgoing_ft_entry *)(n->data))->file_size;
-                        const uint8_t *data = (const uint8_t *)(data_ + position);
-
-                        if (position >= filesize) {
-                            free(friend_pubkey);
-                            return;
-                        }
-
-                        TOX_ERR_FILE_SEND_CHUNK error_send_chunk;
-                        bool result = tox_file_send_chunk(tox, friend_number,
-                                                          file_number,
-                                                          position, data,
-                                                          length, &error_send_chunk);
-                    }
+    tox_utils_State *s = tox_utils_get_state(tox);
+
+    if (s != NULL) {
+        pthread_mutex_lock(s->mutex);
+
+        tox_utils_Map_Slot *slot = tox_utils_map_find(&s->outgoing_ft, friend_number, file_number);
+
+        if (slot != NULL
+                && tox_utils_is_msgv2_kind(((global_msgv2_outgoing_ft_entry *)(slot->data))->kind)) {
+            if (length == 0) {
+                // FT finished
+                // remove FT data from map
+                tox_utils_map_remove(&s->outgoing_ft, friend_number, file_number);
+            } else {
+                const global_msgv2_outgoing_ft_entry *e = (const global_msgv2_outgoing_ft_entry *)(slot->data);
 
-                    free(friend_pubkey);
-                    return;
+                if (position < e->file_size && length <= e->file_size - position) {
+                    // toxcore takes its own lock, it never calls back into toxutil from here
+                    TOX_ERR_FILE_SEND_CHUNK error_send_chunk;
+                    tox_file_send_chunk(tox, friend_number, file_number, position,
+                                        e->msg_data + position, length, &error_send_chunk);
                 }
             }
+
+            pthread_mutex_unlock(s->mutex);
+            return;
         }
 
-        free(friend_pubkey);
+        pthread_mutex_unlock(s->mutex);
     }
 
     // ------- do messageV2 stuff -------
@@ -961,14 +868,37 @@ void tox_utils_file_recv_cb(Tox *tox, uint32_t friend_number, uint32_t file_numb
                             const uint8_t *filename, size_t filename_length, void *user_data)
 {
     // ------- do messageV2 stuff -------
-    if (
-        (kind == TOX_FILE_KIND_MESSAGEV2_SEND)
-        ||
-        (kind == TOX_FILE_KIND_MESSAGEV2_ANSWER)
-        ||
-        (kind == TOX_FILE_KIND_MESSAGEV2_SYNC)
-    ) {
-        global_msgv2_incoming_ft_entry *data = (global_msgv2_incoming_ft_entry *)calloc(1, sizeof(global_msgv2_incoming_ft_entry));
+    if (tox_utils_is_msgv2_kind(kind)) {
+        tox_utils_State *s = tox_utils_get_state(tox);
+
+        if (s == NULL) {
+            return;
+        }
+
+        pthread_mutex_lock(s->mutex);
+
+        // a FT that toxcore reused the file number of is not coming back
+        global_msgv2_incoming_ft_entry *dropped = (global_msgv2_incoming_ft_entry *)tox_utils_map_take(
+                    &s->incoming_ft, friend_number, file_number);
+
+        if (dropped != NULL) {
+            tox_utils_release_incoming_ft(s, dropped);
+            dropped->next = NULL;
+        }
+
+        // buffer the FT if it fits into the memory budget, otherwise stream it to the spill callback
+        tox_utils_Friend *f = tox_utils_get_friend(s, friend_number, true);
+        const bool fits = f != NULL && file_size <= TOX_MAX_FILETRANSFER_SIZE_MSGV2
+                          && s->msgv2_buffered <= s->msgv2_budget
+                          && file_size <= s->msgv2_budget - s->msgv2_buffered;
+        const bool spill = !fits && file_size <= TOX_MAX_FILETRANSFER_SIZE_MSGV2
+                           && tox_utils_friend_message_v2_spill != NULL;
+        global_msgv2_incoming_ft_entry *data = NULL;
+
+        if (fits || spill) {
+            data = (global_msgv2_incoming_ft_entry *)malloc(sizeof(global_msgv2_incoming_ft_entry)
+                    + (fits ? (size_t)file_size : 0));
+        }
 
         if (data) {
             data->friend_number = friend_number;
@@ -977,25 +907,35 @@ void tox_utils_file_recv_cb(Tox *tox, uint32_t friend_number, uint32_t file_numb
             data->file_size = file_size;
             Messenger *m = *(Messenger **)tox;
             data->timestamp = current_time_monotonic(m->mono_time);
-
-            uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-            if (friend_pubkey) {
-                bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-                if (res == true) {
-                    tox_utils_housekeeping(tox);
-                    tox_utils_list_add(&global_msgv2_incoming_ft_list, friend_pubkey,
-                                       file_number, data);
-                    // Messenger *m = (Messenger *)tox;
-                    // LOGGER_WARNING(m->log, "toxutil:file_recv_cb:TOX_FILE_KIND_MESSAGEV2_SEND:%d:%d",
-                    //               (int)friend_number, (int)file_number);
+            data->spill = !fits;
+            data->next = NULL;
+            data->buffered = fits ? (uint32_t)file_size : 0;
+
+            if (tox_utils_map_put(&s->incoming_ft, friend_number, file_number, data)) {
+                if (fits) {
+                    f->msgv2_buffered += data->buffered;
+                    s->msgv2_buffered += data->buffered;
                 }
-
-                free(friend_pubkey);
             } else {
                 free(data);
+                data = NULL;
             }
+
+            // Messenger *m = (Messenger *)tox;
+            // LOGGER_WARNING(m->log, "toxutil:file_recv_cb:TOX_FILE_KIND_MESSAGEV2_SEND:%d:%d",
+            //               (int)friend_number, (int)file_number);
+        }
+
+        pthread_mutex_unlock(s->mutex);
+
+        tox_utils_drop_incoming_fts(tox, dropped);
+
+        if (data == NULL) {
+            // over the memory budget and nowhere to spill to, the sender can resend the message later
+            Messenger *m = *(Messenger **)tox;
+            LOGGER_WARNING(m->log, "toxutil:file_recv_cb:cancel msgV2 FT fnum=%d filenum=%d size=%d",
+                           (int)friend_number, (int)file_number, (int)file_size);
+            tox_file_control(tox, friend_number, file_number, TOX_FILE_CONTROL_CANCEL, NULL);
         }
 
         return;
@@ -1015,115 +955,96 @@ void tox_utils_file_recv_cb(Tox *tox, uint32_t friend_number, uint32_t file_numb
     }
 }
 
+/* Hand a completely received msgV2 FT to the application. Called without holding the state lock. */
+static void tox_utils_deliver_incoming_ft(Tox *tox, const global_msgv2_incoming_ft_entry *e)
+{
+    const uint32_t friend_number = e->friend_number;
+    const uint8_t *data_ = e->msg_data;
+    const uint64_t size_ = e->file_size;
+
+    if (e->kind == TOX_FILE_KIND_MESSAGEV2_SEND) {
+        if (tox_utils_friend_message_v2) {
+            tox_utils_friend_message_v2(tox, friend_number, data_, (size_t)size_);
+        }
+    } else if (e->kind == TOX_FILE_KIND_MESSAGEV2_SYNC) {
+        if (tox_utils_friend_sync_message_v2) {
+            tox_utils_friend_sync_message_v2(tox, friend_number, data_, (size_t)size_);
+        }
+    } else if (e->kind == TOX_FILE_KIND_MESSAGEV2_ANSWER) {
+        if (tox_utils_friend_read_receipt_message_v2) {
+            uint32_t answer_raw_size = tox_messagev2_size(0,
+                                       TOX_FILE_KIND_MESSAGEV2_ANSWER,
+                                       0);
+
+            if (size_ >= answer_raw_size) {
+                const uint32_t ts_sec_ = tox_messagev2_get_ts_sec(data_);
+                uint8_t msgid_[TOX_PUBLIC_KEY_SIZE];
+
+                if (tox_messagev2_get_message_id(data_, msgid_) == true) {
+                    tox_utils_friend_read_receipt_message_v2(tox, friend_number,
+                            ts_sec_, (const uint8_t *)msgid_);
+                }
+            }
+        }
+    }
+}
+
 void tox_utils_file_recv_chunk_cb(Tox *tox, uint32_t friend_number, uint32_t file_number,
                                   uint64_t position, const uint8_t *data, size_t length,
                                   void *user_data)
 {
     // ------- do messageV2 stuff -------
-    uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-    if (friend_pubkey) {
-        bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-        if (res == true) {
-            tox_utils_Node *n = tox_utils_list_get(&global_msgv2_incoming_ft_list,
-                                                   friend_pubkey, file_number);
-
-            if (n != NULL) {
-                if (((global_msgv2_incoming_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SEND) {
-                    if (length == 0) {
-                        // FT finished
-                        if (tox_utils_friend_message_v2) {
-                            const uint8_t *data_ = ((uint8_t *)((global_msgv2_incoming_ft_entry *)
-                                                                (n->data))->msg_data);
-                            const uint64_t size_ = ((global_msgv2_incoming_ft_entry *)
-                                                    (n->data))->file_size;
-                            tox_utils_friend_message_v2(tox, friend_number, data_, (size_t)size_);
-                        }
-
-                        // remove FT data from list
-                        tox_utils_list_remove(&global_msgv2_incoming_ft_list,
-                                              friend_pubkey, file_number);
-                    } else {
-                        // copy chunk into buffer
-                        uint8_t *data_ = ((uint8_t *)((global_msgv2_incoming_ft_entry *)(n->data))->msg_data);
-                        memcpy((data_ + position), data, length);
-                    }
+    tox_utils_State *s = tox_utils_get_state(tox);
 
-                    free(friend_pubkey);
-                    return;
-                } else if (((global_msgv2_incoming_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_SYNC) {
-                    if (length == 0) {
-                        // FT finished
-                        if (tox_utils_friend_sync_message_v2) {
-                            const uint8_t *data_ = ((uint8_t *)((global_msgv2_incoming_ft_entry *)
-                                                                (n->data))->msg_data);
-                            const uint64_t size_ = ((global_msgv2_incoming_ft_entry *)
-                                                    (n->data))->file_size;
-                            tox_utils_friend_sync_message_v2(tox, friend_number, data_, (size_t)size_);
-                        }
-
-                        // remove FT data from list
-                        tox_utils_list_remove(&global_msgv2_incoming_ft_list,
-                                              friend_pubkey, file_number);
-                    } else {
-                        // copy chunk into buffer
-                        uint8_t *data_ = ((uint8_t *)((global_msgv2_incoming_ft_entry *)(n->data))->msg_data);
-                        memcpy((data_ + position), data, length);
-                    }
+    if (s != NULL) {
+        pthread_mutex_lock(s->mutex);
 
-                    free(friend_pubkey);
-                    return;
-                } else if (((global_msgv2_incoming_ft_entry *)(n->data))->kind == TOX_FILE_KIND_MESSAGEV2_ANSWER) {
-                    if (length == 0) {
-                        // FT finished
-                        if (tox_utils_friend_read_receipt_message_v2) {
-                            const uint8_t *data_ = ((uint8_t *)((global_msgv2_incoming_ft_entry *)
-                                                                (n->data))->msg_data);
-                            const uint64_t size_ = ((global_msgv2_incoming_ft_entry *)
-                                                    (n->data))->file_size;
-
-                            uint32_t answer_raw_size = tox_messagev2_size(0,
-                                                       TOX_FILE_KIND_MESSAGEV2_ANSWER,
-                                                       0);
-
-                            if (size_ >= answer_raw_size) {
-
-                                const uint32_t ts_sec_ = tox_messagev2_get_ts_sec(data_);
-                                uint8_t *msgid_ = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-                                if (msgid_) {
-                                    bool res1 = tox_messagev2_get_message_id(data_, msgid_);
-
-                                    if (res1 == true) {
-                                        tox_utils_friend_read_receipt_message_v2(tox, friend_number,
-                                                ts_sec_, (const uint8_t *)msgid_);
-                                    }
-
-                                    free(msgid_);
-                                }
-                            }
-
-                        }
-
-                        // remove FT data from list
-                        tox_utils_list_remove(&global_msgv2_incoming_ft_list,
-                                              friend_pubkey, file_number);
-                    } else {
-                        // copy chunk into buffer
-                        uint8_t *data_ = ((uint8_t *)((global_msgv2_incoming_ft_entry *)(n->data))->msg_data);
-                        memcpy((data_ + position), data, length);
-                    }
+        tox_utils_Map_Slot *slot = tox_utils_map_find(&s->incoming_ft, friend_number, file_number);
+
+        if (slot != NULL) {
+            global_msgv2_incoming_ft_entry *e = (global_msgv2_incoming_ft_entry *)(slot->data);
 
-                    free(friend_pubkey);
-                    return;
+            if (length == 0) {
+                // FT finished, take it out of the map and deliver it without holding the lock
+                tox_utils_map_remove_slot(&s->incoming_ft, (uint32_t)(slot - s->incoming_ft.slots));
+                tox_utils_release_incoming_ft(s, e);
+                pthread_mutex_unlock(s->mutex);
+
+                if (!e->spill) {
+                    tox_utils_deliver_incoming_ft(tox, e);
+                } else if (tox_utils_friend_message_v2_spill) {
+                    tox_utils_friend_message_v2_spill(tox, friend_number, file_number, e->kind,
+                                                      e->file_size, position, NULL, 0, false);
                 }
 
+                free(e);
+                return;
+            }
 
+            if (e->spill) {
+                // hand the chunk on as it is, the entry may be gone once the lock is released
+                const uint32_t kind = e->kind;
+                const uint64_t file_size = e->file_size;
+                pthread_mutex_unlock(s->mutex);
+
+                if (tox_utils_friend_message_v2_spill) {
+                    tox_utils_friend_message_v2_spill(tox, friend_number, file_number, kind, file_size,
+                                                      position, data, length, false);
+                }
+
+                return;
+            }
+
+            // copy chunk into buffer, a peer sending more than it announced gets its excess dropped
+            if (position < e->buffered && length <= e->buffered - position) {
+                memcpy(e->msg_data + position, data, length);
             }
+
+            pthread_mutex_unlock(s->mutex);
+            return;
         }
 
-        free(friend_pubkey);
+        pthread_mutex_unlock(s->mutex);
     }
 
     // ------- do messageV2 stuff -------
@@ -1183,52 +1104,16 @@ bool tox_util_friend_send_msg_receipt_v2(Tox *tox, uint32_t friend_number, uint8
                     return false;
                 }
 
-                global_msgv2_outgoing_ft_entry *data = (global_msgv2_outgoing_ft_entry *)calloc(1, sizeof(global_msgv2_outgoing_ft_entry));
-
-                if (data) {
-                    data->friend_number = friend_number;
-                    data->file_number = file_num_new;
-                    data->kind = TOX_FILE_KIND_MESSAGEV2_ANSWER;
-                    data->file_size = raw_msg_len;
-                    Messenger *m = *(Messenger **)tox;
-                    data->timestamp = current_time_monotonic(m->mono_time);
-
-                    if (raw_msg_len <= TOX_MAX_FILETRANSFER_SIZE_MSGV2) {
-                        memcpy(data->msg_data, raw_message, raw_msg_len);
-                    } else {
-                        // HINT: this should never happen
-                        memcpy(data->msg_data, raw_message, TOX_MAX_FILETRANSFER_SIZE_MSGV2);
-                    }
-
-                    uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-                    if (friend_pubkey) {
-                        bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-                        if (res == true) {
-                            tox_utils_housekeeping(tox);
-                            tox_utils_list_add(&global_msgv2_outgoing_ft_list, friend_pubkey,
-                                               file_num_new, data);
-                            //Messenger *m = (Messenger *)tox;
-                            //LOGGER_WARNING(m->log,
-                            //               "toxutil:tox_util_friend_send_message_v2:TOX_FILE_KIND_MESSAGEV2_ANSWER:%d:%d",
-                            //               (int)friend_number, (int)file_num_new);
-                        }
-
-                        free(friend_pubkey);
-                        free(raw_message);
-                        return true;
-
-                    } else {
-                        free(data);
-
-                        free(raw_message);
-                        return false;
-                    }
-                }
+                bool res = tox_utils_add_outgoing_ft(tox, friend_number, file_num_new,
+                                                     TOX_FILE_KIND_MESSAGEV2_ANSWER,
+                                                     raw_message, raw_msg_len);
+                //Messenger *m = (Messenger *)tox;
+                //LOGGER_WARNING(m->log,
+                //               "toxutil:tox_util_friend_send_message_v2:TOX_FILE_KIND_MESSAGEV2_ANSWER:%d:%d",
+                //               (int)friend_number, (int)file_num_new);
 
                 free(raw_message);
-                return false;
+                return res;
             } else {
                 free(raw_message);
                 return false;
@@ -1252,16 +1137,11 @@ bool tox_util_friend_resend_message_v2(Tox *tox, uint32_t friend_number,
         *error = TOX_ERR_FRIEND_SEND_MESSAGE_SENDQ;
     }
 
-    uint8_t *msgid = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-    if (!msgid) {
-        return false;
-    }
+    uint8_t msgid[TOX_PUBLIC_KEY_SIZE];
 
     bool res2 = tox_messagev2_get_message_id(raw_message, msgid);
 
     if (res2 == false) {
-        free(msgid);
         return false;
     }
 
@@ -1274,48 +1154,13 @@ bool tox_util_friend_resend_message_v2(Tox *tox, uint32_t friend_number,
                                           (const uint8_t *)filename, (size_t)strlen(filename),
                                           &error_send);
 
-    free(msgid);
     if ((file_num_new == UINT32_MAX) || (error_send != TOX_ERR_FILE_SEND_OK)) {
         return false;
     }
 
-    global_msgv2_outgoing_ft_entry *data = (global_msgv2_outgoing_ft_entry *)calloc(1, sizeof(global_msgv2_outgoing_ft_entry));
-
-    if (data) {
-        data->friend_number = friend_number;
-        data->file_number = file_num_new;
-        data->kind = TOX_FILE_KIND_MESSAGEV2_SEND;
-        data->file_size = raw_msg_len;
-        Messenger *m = *(Messenger **)tox;
-        data->timestamp = current_time_monotonic(m->mono_time);
-
-        if (raw_msg_len <= TOX_MAX_FILETRANSFER_SIZE_MSGV2) {
-            memcpy(data->msg_data, raw_message, raw_msg_len);
-        } else {
-            // HINT: this should never happen
-            memcpy(data->msg_data, raw_message, TOX_MAX_FILETRANSFER_SIZE_MSGV2);
-        }
-
-        uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-        if (friend_pubkey) {
-            bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-            if (res == true) {
-                tox_utils_housekeeping(tox);
-                tox_utils_list_add(&global_msgv2_outgoing_ft_list, friend_pubkey,
-                                   file_num_new, data);
-                //Messenger *m = (Messenger *)tox;
-                //LOGGER_WARNING(m->log,
-                //               "toxutil:tox_util_friend_resend_message_v2:TOX_FILE_KIND_MESSAGEV2_SEND:%d:%d",
-                //               (int)friend_number, (int)file_num_new);
-            }
-
-            free(friend_pubkey);
-        } else {
-            free(data);
-        }
-    }
+    tox_utils_add_outgoing_ft(tox, friend_number, file_num_new,
+                              (uint32_t)TOX_FILE_KIND_MESSAGEV2_SEND,
+                              raw_message, raw_msg_len);
 
     if (error) {
         *error = TOX_ERR_FRIEND_SEND_MESSAGE_OK;
@@ -1335,16 +1180,11 @@ bool tox_util_friend_send_sync_message_v2(Tox *tox, uint32_t friend_number,
         *error = TOX_ERR_FRIEND_SEND_MESSAGE_SENDQ;
     }
 
-    uint8_t *msgid = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-    if (!msgid) {
-        return false;
-    }
+    uint8_t msgid[TOX_PUBLIC_KEY_SIZE];
 
     bool res2 = tox_messagev2_get_message_id(raw_message, msgid);
 
     if (res2 == false) {
-        free(msgid);
         return false;
     }
 
@@ -1357,49 +1197,13 @@ bool tox_util_friend_send_sync_message_v2(Tox *tox, uint32_t friend_number,
                                           (const uint8_t *)filename, (size_t)strlen(filename),
                                           &error_send);
 
-    free(msgid);
-
     if ((file_num_new == UINT32_MAX) || (error_send != TOX_ERR_FILE_SEND_OK)) {
         return false;
     }
 
-    global_msgv2_outgoing_ft_entry *data = (global_msgv2_outgoing_ft_entry *)calloc(1, sizeof(global_msgv2_outgoing_ft_entry));
-
-    if (data) {
-        data->friend_number = friend_number;
-        data->file_number = file_num_new;
-        data->kind = TOX_FILE_KIND_MESSAGEV2_SYNC;
-        data->file_size = raw_msg_len;
-        Messenger *m = *(Messenger **)tox;
-        data->timestamp = current_time_monotonic(m->mono_time);
-
-        if (raw_msg_len <= TOX_MAX_FILETRANSFER_SIZE_MSGV2) {
-            memcpy(data->msg_data, raw_message, raw_msg_len);
-        } else {
-            // HINT: this should never happen
-            memcpy(data->msg_data, raw_message, TOX_MAX_FILETRANSFER_SIZE_MSGV2);
-        }
-
-        uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-        if (friend_pubkey) {
-            bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-            if (res == true) {
-                tox_utils_housekeeping(tox);
-                tox_utils_list_add(&global_msgv2_outgoing_ft_list, friend_pubkey,
-                                   file_num_new, data);
-                //Messenger *m = (Messenger *)tox;
-                //LOGGER_WARNING(m->log,
-                //               "toxutil:tox_util_friend_resend_message_v2:TOX_FILE_KIND_MESSAGEV2_SEND:%d:%d",
-                //               (int)friend_number, (int)file_num_new);
-            }
-
-            free(friend_pubkey);
-        } else {
-            free(data);
-        }
-    }
+    tox_utils_add_outgoing_ft(tox, friend_number, file_num_new,
+                              (uint32_t)TOX_FILE_KIND_MESSAGEV2_SYNC,
+                              raw_message, raw_msg_len);
 
     if (error) {
         *error = TOX_ERR_FRIEND_SEND_MESSAGE_OK;
@@ -1444,12 +1248,7 @@ int64_t tox_util_friend_send_message_v2(Tox *tox, uint32_t friend_number, TOX_ME
                 return -1;
             }
 
-            uint8_t *msgid = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-            if (!msgid) {
-                free(raw_message);
-                return -1;
-            }
+            uint8_t msgid[TOX_PUBLIC_KEY_SIZE] = {0};
 
             bool result = tox_messagev2_wrap((uint32_t)length,
                                              (uint32_t)TOX_FILE_KIND_MESSAGEV2_SEND,
@@ -1512,48 +1311,17 @@ int64_t tox_util_friend_send_message_v2(Tox *tox, uint32_t friend_number, TOX_ME
 
                 if ((file_num_new == UINT32_MAX) || (error_send != TOX_ERR_FILE_SEND_OK)) {
                     free(raw_message);
-                    free(msgid);
 
                     return -1;
                 }
 
-                global_msgv2_outgoing_ft_entry *data = (global_msgv2_outgoing_ft_entry *)calloc(1, sizeof(global_msgv2_outgoing_ft_entry));
-
-                if (data) {
-                    data->friend_number = friend_number;
-                    data->file_number = file_num_new;
-                    data->kind = TOX_FILE_KIND_MESSAGEV2_SEND;
-                    data->file_size = raw_msg_len;
-                    Messenger *m = *(Messenger **)tox;
-                    data->timestamp = current_time_monotonic(m->mono_time);
-
-                    if (raw_msg_len <= TOX_MAX_FILETRANSFER_SIZE_MSGV2) {
-                        memcpy(data->msg_data, raw_message, raw_msg_len);
-                    } else {
-                        // HINT: this should never happen
-                        memcpy(data->msg_data, raw_message, TOX_MAX_FILETRANSFER_SIZE_MSGV2);
-                    }
-
-                    uint8_t *friend_pubkey = (uint8_t *)calloc(1, TOX_PUBLIC_KEY_SIZE);
-
-                    if (friend_pubkey) {
-                        bool res = tox_utils_friendnum_to_pubkey(tox, friend_pubkey, friend_number);
-
-                        if (res == true) {
-                            tox_utils_housekeeping(tox);
-                            tox_utils_list_add(&global_msgv2_outgoing_ft_list, friend_pubkey,
-                                               file_num_new, data);
-                            //Messenger *m = (Messenger *)tox;
-                            //LOGGER_WARNING(m->log,
-                            //               "toxutil:tox_util_friend_send_message_v2:TOX_FILE_KIND_MESSAGEV2_SEND:%d:%d",
-                            //               (int)friend_number, (int)file_num_new);
-                        }
-
-                        free(friend_pubkey);
-                    } else {
-                        free(data);
-                    }
-                }
+                tox_utils_add_outgoing_ft(tox, friend_number, file_num_new,
+                                          (uint32_t)TOX_FILE_KIND_MESSAGEV2_SEND,
+                                          raw_message, raw_msg_len);
+                //Messenger *m = (Messenger *)tox;
+                //LOGGER_WARNING(m->log,
+                //               "toxutil:tox_util_friend_send_message_v2:TOX_FILE_KIND_MESSAGEV2_SEND:%d:%d",
+                //               (int)friend_number, (int)file_num_new);
 
                 if (error) {
                     *error = TOX_ERR_FRIEND_SEND_MESSAGE_OK;
@@ -1561,7 +1329,6 @@ int64_t tox_util_friend_send_message_v2(Tox *tox, uint32_t friend_number, TOX_ME
             }
 
             free(raw_message);
-            free(msgid);
 
             return -1;
         } else {
@@ -101,6 +101,43 @@ void tox_utils_callback_friend_read_receipt_message_v2(Tox *tox,
         tox_utils_friend_read_receipt_message_v2_cb *callback);
 
 
+// HINT: incoming messageV2 transfers are kept in memory until they are complete.
+//       all incoming transfers of one tox instance together may buffer at most
+//       the memory budget. a transfer that does not fit is streamed to the
+//       spill callback below instead, or cancelled if no spill callback is set.
+//       a transfer announcing more than TOX_MAX_FILETRANSFER_SIZE_MSGV2 bytes
+//       is always cancelled.
+#define TOX_UTILS_MSGV2_DEFAULT_MEMORY_BUDGET (4 * 1024 * 1024)
+
+// params: budget        max. bytes of all incoming messageV2 transfers together
+//                       (0 -> stream everything to the spill callback)
+void tox_utils_set_msgv2_memory_budget(Tox *tox, uint64_t budget);
+
+// return: uint64_t      bytes currently buffered for incoming messageV2 transfers
+uint64_t tox_utils_get_msgv2_buffered_bytes(const Tox *tox);
+
+// return: uint64_t      bytes currently buffered for incoming messageV2 transfers of this friend
+uint64_t tox_utils_friend_get_msgv2_buffered_bytes(const Tox *tox, uint32_t friend_number);
+
+// HINT: receive a messageV2 transfer that did not fit into the memory budget, chunk by chunk
+//       as it arrives. collect the chunks yourself, they are not buffered by toxutil.
+//       the transfer is finished when length is 0 and aborted is false, the collected data
+//       is then what the message, sync message or receipt callback would have received.
+//       if aborted is true (cancelled, friend or we went offline) drop what was collected.
+// params: file_number   identifies the transfer together with friend_number
+//         kind          TOX_FILE_KIND_MESSAGEV2_SEND, TOX_FILE_KIND_MESSAGEV2_SYNC
+//                       or TOX_FILE_KIND_MESSAGEV2_ANSWER
+//         file_size     size of the raw messageV2 data incl. header
+//         position      offset of this chunk in the raw messageV2 data
+//         data          chunk of raw messageV2 data
+//         length        bytes in this chunk
+typedef void tox_util_friend_message_v2_spill_cb(Tox *tox, uint32_t friend_number, uint32_t file_number,
+        uint32_t kind, uint64_t file_size, uint64_t position, const uint8_t *data, size_t length,
+        bool aborted);
+
+void tox_utils_callback_friend_message_v2_spill(Tox *tox, tox_util_friend_message_v2_spill_cb *callback);
+
+
 // HINT: use only this API function to send messages (it will automatically send old format if needed)
 // params: friend_number friend to send message to
 //         type          type of message (only used for old style messages)
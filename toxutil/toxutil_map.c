@@ -0,0 +1,196 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief MessageV2 file transfers in flight, keyed by (friend_number, file_number).
+ */
+#include "toxutil_map.h"
+
+#include <stdlib.h>
+
+static uint32_t tox_utils_map_hash(uint32_t friend_number, uint32_t file_number)
+{
+    // receiving file numbers only use the upper 16 bits, fold them down
+    uint32_t hash = (friend_number * 0x9E3779B1U) ^ file_number ^ (file_number >> 16);
+    hash ^= hash >> 15;
+    hash *= 0x85EBCA6BU;
+    hash ^= hash >> 13;
+    return hash;
+}
+
+uint32_t tox_utils_map_home_slot(const tox_utils_Map *map, uint32_t friend_number, uint32_t file_number)
+{
+    return tox_utils_map_hash(friend_number, file_number) & (map->capacity - 1);
+}
+
+tox_utils_Map_Slot *tox_utils_map_find(const tox_utils_Map *map, uint32_t friend_number, uint32_t file_number)
+{
+    if (map->capacity == 0) {
+        return NULL;
+    }
+
+    const uint32_t mask = map->capacity - 1;
+
+    for (uint32_t i = tox_utils_map_home_slot(map, friend_number, file_number);; i = (i + 1) & mask) {
+        tox_utils_Map_Slot *slot = &map->slots[i];
+
+        if (slot->data == NULL) {
+            return NULL;
+        }
+
+        if (slot->friend_number == friend_number && slot->file_number == file_number) {
+            return slot;
+        }
+    }
+}
+
+/* Place an entry that is known not to be in the map yet. There must be a free slot. */
+static void tox_utils_map_place(tox_utils_Map *map, uint32_t friend_number, uint32_t file_number, void *data)
+{
+    const uint32_t mask = map->capacity - 1;
+    uint32_t i = tox_utils_map_home_slot(map, friend_number, file_number);
+
+    while (map->slots[i].data != NULL) {
+        i = (i + 1) & mask;
+    }
+
+    map->slots[i].friend_number = friend_number;
+    map->slots[i].file_number = file_number;
+    map->slots[i].data = data;
+    ++map->size;
+}
+
+static bool tox_utils_map_grow(tox_utils_Map *map)
+{
+    const uint32_t new_capacity = map->capacity == 0 ? TOX_UTILS_MAP_MIN_CAPACITY : map->capacity * 2;
+    tox_utils_Map_Slot *new_slots = (tox_utils_Map_Slot *)calloc(new_capacity, sizeof(tox_utils_Map_Slot));
+
+    if (new_slots == NULL) {
+        return false;
+    }
+
+    tox_utils_Map_Slot *old_slots = map->slots;
+    const uint32_t old_capacity = map->capacity;
+
+    map->slots = new_slots;
+    map->capacity = new_capacity;
+    map->size = 0;
+
+    for (uint32_t i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].data != NULL) {
+            tox_utils_map_place(map, old_slots[i].friend_number, old_slots[i].file_number, old_slots[i].data);
+        }
+    }
+
+    free(old_slots);
+    return true;
+}
+
+bool tox_utils_map_put(tox_utils_Map *map, uint32_t friend_number, uint32_t file_number, void *data)
+{
+    tox_utils_Map_Slot *slot = tox_utils_map_find(map, friend_number, file_number);
+
+    if (slot != NULL) {
+        free(slot->data);
+        slot->data = data;
+        return true;
+    }
+
+    if ((map->size + 1) * 2 > map->capacity) {
+        if (!tox_utils_map_grow(map)) {
+            return false;
+        }
+    }
+
+    tox_utils_map_place(map, friend_number, file_number, data);
+    return true;
+}
+
+void tox_utils_map_remove_slot(tox_utils_Map *map, uint32_t i)
+{
+    const uint32_t mask = map->capacity - 1;
+
+    map->slots[i].data = NULL;
+    --map->size;
+
+    for (uint32_t j = (i + 1) & mask; map->slots[j].data != NULL; j = (j + 1) & mask) {
+        const uint32_t home = tox_utils_map_home_slot(map, map->slots[j].friend_number, map->slots[j].file_number);
+
+        // the entry at j may only move back if the hole is not in front of its home slot
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            map->slots[i] = map->slots[j];
+            map->slots[j].data = NULL;
+            i = j;
+        }
+    }
+}
+
+void *tox_utils_map_take(tox_utils_Map *map, uint32_t friend_number, uint32_t file_number)
+{
+    tox_utils_Map_Slot *slot = tox_utils_map_find(map, friend_number, file_number);
+
+    if (slot == NULL) {
+        return NULL;
+    }
+
+    void *data = slot->data;
+    tox_utils_map_remove_slot(map, (uint32_t)(slot - map->slots));
+    return data;
+}
+
+void tox_utils_map_remove(tox_utils_Map *map, uint32_t friend_number, uint32_t file_number)
+{
+    free(tox_utils_map_take(map, friend_number, file_number));
+}
+
+void tox_utils_map_take_friend(tox_utils_Map *map, bool all_friends, uint32_t friend_number,
+                               tox_utils_map_take_cb *take_cb, void *user_data)
+{
+    if (map->size == 0) {
+        return;
+    }
+
+    const uint32_t mask = map->capacity - 1;
+
+    // start right after a free slot: no probe run crosses it, so removing an entry only
+    // ever shifts entries the scan has not reached yet back into the slot it is looking at
+    uint32_t start = 0;
+
+    while (map->slots[start].data != NULL) {
+        ++start;
+    }
+
+    for (uint32_t n = 1; n <= map->capacity; ++n) {
+        const uint32_t i = (start + n) & mask;
+
+        // removing shifts the next entry of the probe run into slot i, so look at it again
+        while (map->slots[i].data != NULL && (all_friends || map->slots[i].friend_number == friend_number)) {
+            void *data = map->slots[i].data;
+            tox_utils_map_remove_slot(map, i);
+            take_cb(data, user_data);
+        }
+    }
+}
+
+static void tox_utils_map_free_data(void *data, void *user_data)
+{
+    free(data);
+}
+
+void tox_utils_map_remove_friend(tox_utils_Map *map, uint32_t friend_number)
+{
+    tox_utils_map_take_friend(map, false, friend_number, tox_utils_map_free_data, NULL);
+}
+
+void tox_utils_map_clear(tox_utils_Map *map)
+{
+    for (uint32_t i = 0; i < map->capacity; ++i) {
+        free(map->slots[i].data);
+    }
+
+    free(map->slots);
+    map->slots = NULL;
+    map->size = 0;
+    map->capacity = 0;
+}
@@ -0,0 +1,72 @@
+/* SPDX-License-Identifier: GPL-3.0-or-later
+ * Copyright © 2026 The TokTok team.
+ */
+
+/** @file
+ * @brief MessageV2 file transfers in flight, keyed by (friend_number, file_number).
+ *
+ * Open addressing with linear probing. A slot is free if its data is NULL.
+ * The table is kept at most half full, so every probe sequence ends at a free slot.
+ * Removing an entry shifts the rest of its probe run back, so there are no tombstones.
+ */
+#ifndef C_TOXCORE_TOXUTIL_TOXUTIL_MAP_H
+#define C_TOXCORE_TOXUTIL_TOXUTIL_MAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct tox_utils_Map_Slot {
+    uint32_t friend_number;
+    uint32_t file_number;
+    void *data;
+} tox_utils_Map_Slot;
+
+typedef struct tox_utils_Map {
+    uint32_t size;
+    uint32_t capacity; // 0 or a power of 2
+    tox_utils_Map_Slot *slots;
+} tox_utils_Map;
+
+#define TOX_UTILS_MAP_MIN_CAPACITY 16
+
+/* The slot an entry with this key is placed in if that slot is free. The map must not be empty. */
+uint32_t tox_utils_map_home_slot(const tox_utils_Map *map, uint32_t friend_number, uint32_t file_number);
+
+/* Returns the slot of an entry, or NULL if there is no such entry. */
+tox_utils_Map_Slot *tox_utils_map_find(const tox_utils_Map *map, uint32_t friend_number, uint32_t file_number);
+
+/* Add an entry, the map takes ownership of data. An existing entry with the same key is freed.
+   Returns false (and does not take ownership) if the map could not grow. */
+bool tox_utils_map_put(tox_utils_Map *map, uint32_t friend_number, uint32_t file_number, void *data);
+
+/* Empty slot i and shift following entries of the same probe run back into the hole,
+   so lookups never need tombstones. Does not free the data of slot i. */
+void tox_utils_map_remove_slot(tox_utils_Map *map, uint32_t i);
+
+/* Remove an entry and hand its data to the caller. Returns NULL if there is no such entry. */
+void *tox_utils_map_take(tox_utils_Map *map, uint32_t friend_number, uint32_t file_number);
+
+/* Remove an entry and free its data. */
+void tox_utils_map_remove(tox_utils_Map *map, uint32_t friend_number, uint32_t file_number);
+
+typedef void tox_utils_map_take_cb(void *data, void *user_data);
+
+/* Remove the entries of one friend (or of all friends) and hand the data of each to take_cb. */
+void tox_utils_map_take_friend(tox_utils_Map *map, bool all_friends, uint32_t friend_number,
+                               tox_utils_map_take_cb *take_cb, void *user_data);
+
+/* Remove all entries of one friend and free their data. */
+void tox_utils_map_remove_friend(tox_utils_Map *map, uint32_t friend_number);
+
+/* Free all entries and the table. The map is empty and can be used again afterwards. */
+void tox_utils_map_clear(tox_utils_Map *map);
+
+#ifdef __cplusplus
+}  // extern "C"
+#endif
+
+#endif
@@ -0,0 +1,144 @@
+#include "toxutil_map.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace {
+
+void *new_value(uint32_t value)
+{
+    uint32_t *data = static_cast<uint32_t *>(std::malloc(sizeof(uint32_t)));
+    *data = value;
+    return data;
+}
+
+/** Returns a file number whose entry of this friend starts probing at `slot`. */
+uint32_t file_number_with_home(const tox_utils_Map &map, uint32_t friend_number, uint32_t slot,
+                               uint32_t after = 0)
+{
+    for (uint32_t file_number = after + 1;; ++file_number) {
+        if (tox_utils_map_home_slot(&map, friend_number, file_number) == slot) {
+            return file_number;
+        }
+    }
+}
+
+TEST(ToxUtilsMap, PutFindTake)
+{
+    tox_utils_Map map = {0};
+
+    ASSERT_TRUE(tox_utils_map_put(&map, 1, 2, new_value(12)));
+    ASSERT_TRUE(tox_utils_map_put(&map, 2, 1, new_value(21)));
+    EXPECT_EQ(map.size, 2);
+
+    tox_utils_Map_Slot *slot = tox_utils_map_find(&map, 1, 2);
+    ASSERT_NE(slot, nullptr);
+    EXPECT_EQ(*static_cast<uint32_t *>(slot->data), 12);
+    EXPECT_EQ(tox_utils_map_find(&map, 1, 1), nullptr);
+
+    void *data = tox_utils_map_take(&map, 2, 1);
+    ASSERT_NE(data, nullptr);
+    EXPECT_EQ(*static_cast<uint32_t *>(data), 21);
+    std::free(data);
+    EXPECT_EQ(tox_utils_map_take(&map, 2, 1), nullptr);
+    EXPECT_EQ(map.size, 1);
+
+    tox_utils_map_clear(&map);
+    EXPECT_EQ(map.capacity, 0);
+}
+
+TEST(ToxUtilsMap, RemoveFriendWithWrappedProbeRun)
+{
+    constexpr uint32_t kFriend = 7;
+    constexpr uint32_t kOther = 9;
+
+    tox_utils_Map map = {0};
+    ASSERT_TRUE(tox_utils_map_put(&map, kOther, 0xffffffff, new_value(0)));
+    ASSERT_EQ(map.capacity, TOX_UTILS_MAP_MIN_CAPACITY);
+    tox_utils_map_remove(&map, kOther, 0xffffffff);
+
+    // One probe run from the last slot wrapping around to the start of the table:
+    // [0] other friend, [1] friend, ..., [last] friend.
+    const uint32_t last = map.capacity - 1;
+    const uint32_t at_last = file_number_with_home(map, kFriend, last);
+    const uint32_t wraps_to_first = file_number_with_home(map, kOther, last);
+    const uint32_t wraps_to_second = file_number_with_home(map, kFriend, last, at_last);
+
+    ASSERT_TRUE(tox_utils_map_put(&map, kFriend, at_last, new_value(1)));
+    ASSERT_TRUE(tox_utils_map_put(&map, kOther, wraps_to_first, new_value(2)));
+    ASSERT_TRUE(tox_utils_map_put(&map, kFriend, wraps_to_second, new_value(3)));
+    ASSERT_EQ(map.slots[last].file_number, at_last);
+    ASSERT_EQ(map.slots[0].file_number, wraps_to_first);
+    ASSERT_EQ(map.slots[1].file_number, wraps_to_second);
+
+    tox_utils_map_remove_friend(&map, kFriend);
+
+    EXPECT_EQ(map.size, 1);
+    EXPECT_EQ(tox_utils_map_find(&map, kFriend, at_last), nullptr);
+    EXPECT_EQ(tox_utils_map_find(&map, kFriend, wraps_to_second), nullptr);
+    ASSERT_NE(tox_utils_map_find(&map, kOther, wraps_to_first), nullptr);
+
+    for (uint32_t i = 0; i < map.capacity; ++i) {
+        EXPECT_TRUE(map.slots[i].data == nullptr || map.slots[i].friend_number != kFriend) << "slot " << i;
+    }
+
+    tox_utils_map_clear(&map);
+}
+
+TEST(ToxUtilsMap, TakeFriendMatchesReference)
+{
+    std::mt19937 rng(42);
+
+    for (int round = 0; round < 200; ++round) {
+        tox_utils_Map map = {0};
+        std::map<std::pair<uint32_t, uint32_t>, uint32_t> reference;
+
+        // Few friends and a nearly half full table give long probe runs that wrap around.
+        const uint32_t count = 1 + rng() % 60;
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const uint32_t friend_number = rng() % 4;
+            const uint32_t file_number = (rng() % 8) << 16;
+
+            if (reference.emplace(std::make_pair(friend_number, file_number), i).second) {
+                ASSERT_TRUE(tox_utils_map_put(&map, friend_number, file_number, new_value(i)));
+            }
+        }
+
+        const uint32_t removed_friend = rng() % 4;
+        std::vector<uint32_t> taken;
+        tox_utils_map_take_friend(
+            &map, false, removed_friend,
+            [](void *data, void *user_data) {
+                static_cast<std::vector<uint32_t> *>(user_data)->push_back(*static_cast<uint32_t *>(data));
+                std::free(data);
+            },
+            &taken);
+
+        size_t expected_taken = 0;
+
+        for (const auto &entry : reference) {
+            const tox_utils_Map_Slot *slot = tox_utils_map_find(&map, entry.first.first, entry.first.second);
+
+            if (entry.first.first == removed_friend) {
+                ++expected_taken;
+                EXPECT_EQ(slot, nullptr);
+            } else {
+                ASSERT_NE(slot, nullptr);
+                EXPECT_EQ(*static_cast<uint32_t *>(slot->data), entry.second);
+            }
+        }
+
+        EXPECT_EQ(taken.size(), expected_taken);
+        EXPECT_EQ(map.size, reference.size() - expected_taken);
+
+        tox_utils_map_clear(&map);
+    }
+}
+
+}  // namespace